@@ -56,6 +56,9 @@
 #define Dbg				DbgLogdSqlite
 #include "../gdplogd/logd_sqlite.c"
 #undef Dbg
+#define Dbg				DbgLogdShard
+#include "../gdplogd/logd_shard.c"
+#undef Dbg
 
 
 /*
@@ -506,9 +509,14 @@ main(int argc, char *argv[])
 
 	if (ls_logs)
 	{
+		int shard;
+		int rc = EX_OK;
+
 		if (argc > 0)
 			usage("cannot use a GCL name with -l");
-		return list_logs(LogDir, verbosity);
+		for (shard = 0; shard < shard_count() && rc == EX_OK; shard++)
+			rc = list_logs(shard_root(shard), verbosity);
+		return rc;
 	}
 
 	if (argc <= 0)
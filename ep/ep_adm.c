@@ -118,13 +118,18 @@ read_param_file(char *path)
 		vp = p;
 		p += strcspn(p, "\n");
 		*p = '\0';
+
+		// files may be re-read while other threads are looking at
+		// values, so unchanged values are left alone and old ones
+		// are never freed
+		op = (char *) ep_hash_search(ParamHash, strlen(np), np);
+		if (op != NULL && strcmp(op, vp) == 0)
+			continue;
 		vp = ep_mem_strdup(vp);
 
 		// store it into the hash table
 		ep_dbg_cprintf(Dbg, 18, " ... adding %s=%s\n", np, vp);
-		op = (char *) ep_hash_insert(ParamHash, strlen(np), np, vp);
-		if (op != NULL)
-			ep_mem_free(op);
+		(void) ep_hash_insert(ParamHash, strlen(np), np, vp);
 	}
 
 	fclose(fp);
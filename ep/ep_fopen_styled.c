@@ -125,9 +125,9 @@ ep_fopen_styled(FILE *underlying,
 		return NULL;
 	sinf->underlying = underlying;
 	if (so != NULL)
-		sinf->so = strdup(so);
+		sinf->so = ep_mem_strdup(so);
 	if (si != NULL)
-		sinf->si = strdup(si);
+		sinf->si = ep_mem_strdup(si);
 
 #if __FreeBSD__ || __APPLE__
 	{
@@ -32,8 +32,13 @@
 #include <ep_mem.h>
 #include <unistd.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <string.h>
 
+#if EP_OSCF_USE_PTHREADS
+# include <pthread.h>
+#endif
+
 static struct ep_malloc_functions	DefaultMallocFunctions =
 {
 	&malloc,
@@ -122,6 +127,272 @@ system_mfree(void *p)
 }
 
 
+/*
+**  MEMORY ACCOUNTING
+**
+**	Every block is preceded by a mem_hdr, whether or not accounting
+**	is on, so ep_mem_free always knows where the header is and
+**	never has to guess from the memory in front of the block.
+**	Blocks allocated before accounting was turned on are flagged
+**	as not counted and are left out of the totals when freed.
+**
+**	Counts are kept per thread and merged into the per-tag totals
+**	every MEM_MERGE_OPS operations (or sooner if a lot of memory
+**	has moved), so the totals lag slightly but updating them
+**	never touches shared cache lines.  A thread's counts are
+**	merged when it exits.
+**
+**	Where the system can hand out page aligned memory
+**	(EP_OSCF_SYSTEM_VALLOC), aligned blocks (EP_MEM_F_ALIGN) get a
+**	whole page in front of them with the header at the end of it,
+**	so the caller's memory is still page aligned.
+*/
+
+struct mem_hdr
+{
+	uint64_t	size;			// bytes requested
+	uint32_t	tag;			// tag when allocated
+	uint32_t	flags;			// see below
+};
+
+#define MEM_HDR_COUNTED		0x00000001	// included in the tag totals
+#define MEM_HDR_ALIGNED		0x00000002	// header padded to a page
+#define MEM_MERGE_OPS		64
+#define MEM_MERGE_BYTES		(1024 * 1024)
+
+struct mem_tag
+{
+	const char	*name;
+	int64_t		live;
+	int64_t		max;
+	uint64_t	nalloc;
+	uint64_t	nfree;
+};
+
+struct mem_tls
+{
+	int64_t		bytes[EP_MEM_MAXTAGS];	// change since last merge
+	int64_t		nalloc[EP_MEM_MAXTAGS];
+	int64_t		nfree[EP_MEM_MAXTAGS];
+	int		nops;			// operations since last merge
+	bool		hooked;			// exit hook is set
+};
+
+bool				_EpMemAccount = false;
+static struct mem_tag		MemTags[EP_MEM_MAXTAGS] = { { "other" } };
+static int			NMemTags = 1;
+static __thread struct mem_tls	MemTls;
+static __thread int		MemTag;
+#if EP_OSCF_USE_PTHREADS
+static pthread_mutex_t		MemTagMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t		MemTlsKey;
+#endif
+
+static void
+mem_merge(struct mem_tls *t)
+{
+	int tag;
+
+	for (tag = 0; tag < EP_MEM_MAXTAGS; tag++)
+	{
+		struct mem_tag *mt = &MemTags[tag];
+		int64_t live;
+		int64_t max;
+
+		if (t->nalloc[tag] == 0 && t->nfree[tag] == 0 && t->bytes[tag] == 0)
+			continue;
+		__atomic_fetch_add(&mt->nalloc, t->nalloc[tag], __ATOMIC_RELAXED);
+		__atomic_fetch_add(&mt->nfree, t->nfree[tag], __ATOMIC_RELAXED);
+		live = __atomic_add_fetch(&mt->live, t->bytes[tag], __ATOMIC_RELAXED);
+		max = __atomic_load_n(&mt->max, __ATOMIC_RELAXED);
+		while (live > max &&
+				!__atomic_compare_exchange_n(&mt->max, &max, live, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			continue;
+		t->bytes[tag] = t->nalloc[tag] = t->nfree[tag] = 0;
+	}
+	t->nops = 0;
+}
+
+#if EP_OSCF_USE_PTHREADS
+static void
+mem_thread_exit(void *t)
+{
+	mem_merge((struct mem_tls *) t);
+}
+#endif
+
+static void
+mem_count(uint32_t tag, int64_t bytes, int nalloc, int nfree)
+{
+	struct mem_tls *t = &MemTls;
+
+	if (tag >= EP_MEM_MAXTAGS)
+		tag = EP_MEM_TAG_OTHER;
+#if EP_OSCF_USE_PTHREADS
+	if (!t->hooked)
+	{
+		t->hooked = true;
+		(void) pthread_setspecific(MemTlsKey, t);
+	}
+#endif
+	t->bytes[tag] += bytes;
+	t->nalloc[tag] += nalloc;
+	t->nfree[tag] += nfree;
+	if (++t->nops >= MEM_MERGE_OPS ||
+			t->bytes[tag] > MEM_MERGE_BYTES || t->bytes[tag] < -MEM_MERGE_BYTES)
+		mem_merge(t);
+}
+
+// return the header for a block from ep_mem_ialloc
+static struct mem_hdr *
+mem_hdr(void *p)
+{
+	return (struct mem_hdr *) p - 1;
+}
+
+// return the space taken in front of a block by its header
+static size_t
+mem_hdr_size(uint32_t hflags)
+{
+#ifdef EP_OSCF_SYSTEM_VALLOC
+	if (EP_UT_BITSET(MEM_HDR_ALIGNED, hflags))
+		return getpagesize();
+#endif
+	return sizeof (struct mem_hdr);
+}
+
+// return what the system allocator gave us for a block
+static void *
+mem_base(struct mem_hdr *h)
+{
+	return (char *) (h + 1) - mem_hdr_size(h->flags);
+}
+
+
+/*
+**  EP_MEM_ACCOUNT_INIT --- turn on accounting if configured
+**
+**		Should be called as soon as the parameters are read.
+**		Blocks allocated before this are not accounted.  It
+**		can't be turned off again.
+*/
+
+void
+ep_mem_account_init(void)
+{
+	if (_EpMemAccount || !ep_adm_getboolparam("libep.mem.account", false))
+		return;
+#if EP_OSCF_USE_PTHREADS
+	if (pthread_key_create(&MemTlsKey, &mem_thread_exit) != 0)
+		return;
+#endif
+	_EpMemAccount = true;
+}
+
+
+/*
+**  EP_MEM_TAG_REGISTER --- return the tag for a subsystem
+**
+**		Registering the same name twice returns the same tag.
+**		If there are too many tags, returns EP_MEM_TAG_OTHER.
+*/
+
+int
+ep_mem_tag_register(const char *name)
+{
+	int tag;
+
+#if EP_OSCF_USE_PTHREADS
+	pthread_mutex_lock(&MemTagMutex);
+#endif
+	for (tag = 0; tag < NMemTags; tag++)
+		if (strcmp(MemTags[tag].name, name) == 0)
+			break;
+	if (tag >= NMemTags)
+	{
+		if (NMemTags < EP_MEM_MAXTAGS)
+		{
+			MemTags[tag].name = name;
+			__atomic_store_n(&NMemTags, tag + 1, __ATOMIC_RELEASE);
+		}
+		else
+			tag = EP_MEM_TAG_OTHER;
+	}
+#if EP_OSCF_USE_PTHREADS
+	pthread_mutex_unlock(&MemTagMutex);
+#endif
+	return tag;
+}
+
+
+/*
+**  EP_MEM_TAG_SET --- set the tag for this thread's allocations
+*/
+
+int
+ep_mem_tag_set(int tag)
+{
+	int otag = MemTag;
+
+	MemTag = tag;
+	return otag;
+}
+
+
+/*
+**  EP_MEM_TAG_STATS --- return the totals for one tag
+**
+**		Returns false if there is no such tag.
+*/
+
+bool
+ep_mem_tag_stats(int tag, EP_MEM_TAG_STATS *st)
+{
+	struct mem_tag *mt;
+
+	if (tag < 0 || tag >= __atomic_load_n(&NMemTags, __ATOMIC_ACQUIRE))
+		return false;
+	mt = &MemTags[tag];
+	st->name = mt->name;
+	st->live_bytes = __atomic_load_n(&mt->live, __ATOMIC_RELAXED);
+	st->max_bytes = __atomic_load_n(&mt->max, __ATOMIC_RELAXED);
+	st->nalloc = __atomic_load_n(&mt->nalloc, __ATOMIC_RELAXED);
+	st->nfree = __atomic_load_n(&mt->nfree, __ATOMIC_RELAXED);
+	return true;
+}
+
+
+/*
+**  EP_MEM_ACCOUNT_DUMP --- print totals for all tags
+*/
+
+void
+ep_mem_account_dump(FILE *fp)
+{
+	EP_MEM_TAG_STATS st;
+	int tag;
+
+	if (fp == NULL)
+		fp = stderr;
+	fprintf(fp, "\n<<< Memory by subsystem >>>\n");
+	if (!_EpMemAccount)
+	{
+		fprintf(fp, "    (not accounted)\n");
+		return;
+	}
+	fprintf(fp, "    %-12s %12s %12s %12s %12s\n",
+			"tag", "live KB", "max KB", "allocs", "frees");
+	for (tag = 0; ep_mem_tag_stats(tag, &st); tag++)
+	{
+		fprintf(fp, "    %-12s %12" PRId64 " %12" PRId64
+				" %12" PRIu64 " %12" PRIu64 "\n",
+				st.name, st.live_bytes / 1024, st.max_bytes / 1024,
+				st.nalloc, st.nfree);
+	}
+}
+
+
 /*
 **  MCHECK_INIT -- initialize memory subsystem
 **
@@ -225,6 +496,9 @@ ep_mem_ialloc(
 	int line)
 {
 	void *p;
+	struct mem_hdr *h;
+	uint32_t hflags = 0;
+	size_t hsize;
 
 	// always require at least one pointer worth of data
 	if (nbytes < sizeof (void *))
@@ -233,9 +507,40 @@ ep_mem_ialloc(
 	// see if this request wants page alignment
 //	if ((nbytes & (EP_OSCF_MEM_PAGESIZE - 1)) == 0)
 //		flags |= EP_MEM_F_ALIGN;
+#ifdef EP_OSCF_SYSTEM_VALLOC
+	if (EP_UT_BITSET(EP_MEM_F_ALIGN, flags))
+		hflags |= MEM_HDR_ALIGNED;
+#endif
+
+	if (curmem != NULL)
+	{
+		struct mem_hdr *oh = mem_hdr(curmem);
+
+		if (EP_UT_BITSET(MEM_HDR_ALIGNED, hflags | oh->flags))
+		{
+			// realloc(3) won't keep the alignment; move it ourselves
+			p = ep_mem_ialloc(nbytes, NULL, flags | EP_MEM_F_ALIGN,
+					file, line);
+			if (p == NULL)
+				return p;
+			if ((flags & (EP_MEM_F_ZERO | EP_MEM_F_TRASH)) == 0)
+				memcpy(p, curmem,
+					oh->size < nbytes ? oh->size : nbytes);
+			ep_mem_free(curmem);
+			return p;
+		}
+
+		// reallocs move the header they had
+		curmem = oh;
+	}
+
+	// make room for the header
+	hsize = mem_hdr_size(hflags);
+	EP_ASSERT(nbytes + hsize >= nbytes);
 
 	// get the memory itself
-	p = system_malloc(nbytes, curmem, EP_UT_BITSET(EP_MEM_F_ALIGN, flags));
+	p = system_malloc(nbytes + hsize, curmem,
+			EP_UT_BITSET(EP_MEM_F_ALIGN, flags));
 
 	if (p == NULL)
 	{
@@ -248,7 +553,7 @@ ep_mem_ialloc(
 		if (MemoryRecoveryFunc != NULL)
 		{
 			(*MemoryRecoveryFunc)();
-			p = system_malloc(nbytes, curmem,
+			p = system_malloc(nbytes + hsize, curmem,
 					EP_UT_BITSET(EP_MEM_F_ALIGN, flags));
 		}
 
@@ -262,6 +567,26 @@ ep_mem_ialloc(
 		}
 	}
 
+	h = (struct mem_hdr *) ((char *) p + hsize) - 1;
+	if (curmem != NULL)
+	{
+		// realloc: header was copied; charge the difference
+		if (EP_UT_BITSET(MEM_HDR_COUNTED, h->flags))
+			mem_count(h->tag, (int64_t) nbytes - (int64_t) h->size, 0, 0);
+	}
+	else
+	{
+		h->tag = MemTag;
+		h->flags = hflags;
+		if (_EpMemAccount)
+		{
+			h->flags |= MEM_HDR_COUNTED;
+			mem_count(h->tag, nbytes, 1, 0);
+		}
+	}
+	h->size = nbytes;
+	p = h + 1;
+
 	// zero or trash memory if requested
 	if ( EP_UT_BITSET(EP_MEM_F_ZERO, flags))
 		memset(p, 0, nbytes);
@@ -459,5 +784,12 @@ ep_mem_trash(void *p,
 void
 ep_mem_free(void *p)
 {
-	system_mfree(p);
+	struct mem_hdr *h;
+
+	if (p == NULL)
+		return;
+	h = mem_hdr(p);
+	if (EP_UT_BITSET(MEM_HDR_COUNTED, h->flags))
+		mem_count(h->tag, -(int64_t) h->size, 0, 1);
+	system_mfree(mem_base(h));
 }
@@ -51,11 +51,21 @@ struct ep_malloc_functions
 	void	(*m_free)(void*);
 };
 
+/*
+**  Every block from ep_mem has a header in front of it, so memory
+**  from these routines must only be reallocated with ep_mem_realloc
+**  and freed with ep_mem_free, and memory from malloc(3), strdup(3)
+**  and friends must never be handed to them.  Either mix-up
+**  corrupts the heap.  Libraries that allocate memory that will be
+**  freed here (or free memory allocated here) have to be set up to
+**  use ep_mem, as libevent and protobuf-c are.
+*/
+
 // flag bits for allocation
 #define EP_MEM_F_FAILOK		0x00000001	// return NULL on error
 #define EP_MEM_F_ZERO		0x00000004	// zero memory before return
 #define EP_MEM_F_TRASH		0x00000008	// return random-filled memory
-#define EP_MEM_F_ALIGN		0x00000010	// return aligned memory (maybe)
+#define EP_MEM_F_ALIGN		0x00000010	// page align (if system can)
 #define EP_MEM_F_WAIT		0x00000020	// wait for memory on failure
 
 #if EP_MEM_DEBUG
@@ -127,5 +137,42 @@ extern void	ep_mem_set_malloc_functions(
 extern void	ep_mem_set_recovery_func(
 			void (*f)(void));
 
+/*
+**  Accounting by subsystem
+**
+**	When turned on (libep.mem.account) every block records its
+**	size and the tag that was current in the allocating thread,
+**	so live bytes can be charged back to that tag when the block
+**	is freed, wherever that happens.  Tags are registered once
+**	and set per thread around the code that allocates on behalf
+**	of a subsystem.  The header is there whether or not
+**	accounting is on.
+*/
+
+#define EP_MEM_MAXTAGS		32
+#define EP_MEM_TAG_OTHER	0		// anything untagged
+
+typedef struct ep_mem_tag_stats
+{
+	const char	*name;			// as registered
+	int64_t		live_bytes;		// allocated and not freed
+	int64_t		max_bytes;		// high water mark of live_bytes
+	uint64_t	nalloc;			// blocks allocated
+	uint64_t	nfree;			// blocks freed
+} EP_MEM_TAG_STATS;
+
+extern bool	_EpMemAccount;
+
+extern void	ep_mem_account_init(void);	// read params; maybe turn on
+extern int	ep_mem_tag_register(		// get tag for subsystem
+			const char *name);		// name (not copied)
+extern int	ep_mem_tag_set(			// set this thread's tag
+			int tag);			// returns previous tag
+extern bool	ep_mem_tag_stats(		// get totals for one tag
+			int tag,
+			EP_MEM_TAG_STATS *st);
+extern void	ep_mem_account_dump(		// print totals for all tags
+			FILE *fp);
+
 __END_DECLS
 #endif // _EP_MEM_H_
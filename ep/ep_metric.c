@@ -0,0 +1,249 @@
+/* vim: set ai sw=8 sts=8 ts=8 :*/
+
+/***********************************************************************
+**  ----- BEGIN LICENSE BLOCK -----
+**	LIBEP: Enhanced Portability Library (Reduced Edition)
+**
+**	Copyright (c) 2008-2019, Eric P. Allman.  All rights reserved.
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**  ----- END LICENSE BLOCK -----
+***********************************************************************/
+
+/***********************************************************************
+**
+**  METRICS
+**
+**	The registry is a simple list, only touched when a metric is
+**	registered (normally at startup) and when the metrics are
+**	exported.  Metrics with the same name (differing only in their
+**	labels) are kept together so that each name gets one HELP and
+**	TYPE line, as the text format requires.
+**
+**	Updates never look at the registry.  Export reads the values
+**	with relaxed loads, so a histogram might be caught part way
+**	through an update; its count is computed from the buckets so
+**	that it is at least self-consistent.
+**
+***********************************************************************/
+
+#include <ep.h>
+#include <ep_assert.h>
+#include <ep_dbg.h>
+#include <ep_mem.h>
+#include <ep_metric.h>
+#include <ep_thr.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("libep.metric", "Metrics");
+
+static EP_METRIC	*Metrics;		// the registry
+static EP_THR_MUTEX	MetricsMutex	EP_THR_MUTEX_INITIALIZER;
+
+const int64_t	EpMetricUsecBounds[13] =
+{
+	10, 25, 50, 100, 250, 500,
+	1000, 2500, 5000, 10000, 100000, 1000000, 10000000,
+};
+
+const int64_t	EpMetricSizeBounds[9] =
+{
+	64, 256, 1024, 4096, 16384, 65536, 131072, 262144, 1048576,
+};
+
+
+static bool
+same_name(const EP_METRIC *a, const EP_METRIC *b)
+{
+	return strcmp(a->subsys, b->subsys) == 0 && strcmp(a->name, b->name) == 0;
+}
+
+
+/*
+**  EP_METRIC_REGISTER --- add a metric to the registry
+**
+**		Registering a metric twice is harmless.
+*/
+
+void
+ep_metric_register(EP_METRIC *m)
+{
+	EP_METRIC **mp;
+	EP_METRIC **afterp = NULL;
+
+	EP_ASSERT_ELSE(m != NULL, return);
+	EP_ASSERT_ELSE(m->nbounds <= EP_METRIC_MAXBUCKETS,
+			m->nbounds = EP_METRIC_MAXBUCKETS);
+	ep_thr_mutex_lock(&MetricsMutex);
+	if (m->registered)
+		goto done;
+
+	// insert after the last metric with the same name (if any)
+	for (mp = &Metrics; *mp != NULL; mp = &(*mp)->next)
+	{
+		if (same_name(*mp, m))
+			afterp = &(*mp)->next;
+	}
+	if (afterp != NULL)
+		mp = afterp;
+	m->next = *mp;
+	*mp = m;
+	m->registered = true;
+	ep_dbg_cprintf(Dbg, 20, "ep_metric_register(%s_%s%s%s%s)\n",
+			m->subsys, m->name,
+			m->labels == NULL ? "" : "{",
+			m->labels == NULL ? "" : m->labels,
+			m->labels == NULL ? "" : "}");
+done:
+	ep_thr_mutex_unlock(&MetricsMutex);
+}
+
+
+/*
+**  EP_METRIC_NEW --- allocate and register a metric
+**
+**		Used when the metrics aren't known in advance (e.g., one
+**		per thread pool class) or when the value is computed at
+**		export time by func.  These are never freed, so they
+**		should not be created per-object.
+*/
+
+EP_METRIC *
+ep_metric_new(int type,
+	const char *subsys,
+	const char *name,
+	const char *help,
+	const char *labels,
+	EP_METRIC_FUNC *func,
+	void *arg)
+{
+	EP_METRIC *m = (EP_METRIC *) ep_mem_zalloc(sizeof *m);
+
+	m->type = type;
+	m->subsys = subsys;
+	m->name = name;
+	m->help = help;
+	if (labels != NULL)
+		m->labels = ep_mem_strdup(labels);
+	m->func = func;
+	m->arg = arg;
+	m->dynamic = true;
+	if (type == EP_METRIC_HISTOGRAM)
+	{
+		m->bounds = EpMetricUsecBounds;
+		m->nbounds = sizeof EpMetricUsecBounds / sizeof EpMetricUsecBounds[0];
+	}
+	ep_metric_register(m);
+	return m;
+}
+
+
+/*
+**  EP_METRIC_EXPORT --- write all registered metrics
+**
+**		Output is in the Prometheus text exposition format.
+**		Names are prefix_subsys_name.
+*/
+
+static const char *
+type_name(int type)
+{
+	switch (type)
+	{
+	  case EP_METRIC_COUNTER:
+		return "counter";
+	  case EP_METRIC_GAUGE:
+		return "gauge";
+	  case EP_METRIC_HISTOGRAM:
+		return "histogram";
+	}
+	return "untyped";
+}
+
+static void
+export_histogram(FILE *fp, const char *fullname, EP_METRIC *m)
+{
+	const char *labels = m->labels == NULL ? "" : m->labels;
+	const char *sep = m->labels == NULL ? "" : ",";
+	uint64_t cum = 0;
+	int i;
+
+	for (i = 0; i <= m->nbounds; i++)
+	{
+		cum += __atomic_load_n(&m->buckets[i], __ATOMIC_RELAXED);
+		if (i < m->nbounds)
+			fprintf(fp, "%s_bucket{%s%sle=\"%" PRId64 "\"} %" PRIu64 "\n",
+					fullname, labels, sep, m->bounds[i], cum);
+		else
+			fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n",
+					fullname, labels, sep, cum);
+	}
+	if (m->labels == NULL)
+	{
+		fprintf(fp, "%s_sum %" PRId64 "\n", fullname,
+				__atomic_load_n(&m->sum, __ATOMIC_RELAXED));
+		fprintf(fp, "%s_count %" PRIu64 "\n", fullname, cum);
+	}
+	else
+	{
+		fprintf(fp, "%s_sum{%s} %" PRId64 "\n", fullname, labels,
+				__atomic_load_n(&m->sum, __ATOMIC_RELAXED));
+		fprintf(fp, "%s_count{%s} %" PRIu64 "\n", fullname, labels, cum);
+	}
+}
+
+void
+ep_metric_export(FILE *fp, const char *prefix)
+{
+	EP_METRIC *m;
+	EP_METRIC *prev = NULL;
+	char fullname[200];
+
+	if (prefix == NULL)
+		prefix = "";
+	ep_thr_mutex_lock(&MetricsMutex);
+	for (m = Metrics; m != NULL; prev = m, m = m->next)
+	{
+		snprintf(fullname, sizeof fullname, "%s%s%s_%s",
+				prefix, *prefix == '\0' ? "" : "_",
+				m->subsys, m->name);
+		if (prev == NULL || !same_name(prev, m))
+		{
+			fprintf(fp, "# HELP %s %s\n", fullname, m->help);
+			fprintf(fp, "# TYPE %s %s\n", fullname, type_name(m->type));
+		}
+
+		if (m->type == EP_METRIC_HISTOGRAM)
+		{
+			export_histogram(fp, fullname, m);
+			continue;
+		}
+
+		int64_t v = m->func != NULL ? (*m->func)(m, m->arg) : ep_metric_get(m);
+		if (m->labels == NULL)
+			fprintf(fp, "%s %" PRId64 "\n", fullname, v);
+		else
+			fprintf(fp, "%s{%s} %" PRId64 "\n", fullname, m->labels, v);
+	}
+	ep_thr_mutex_unlock(&MetricsMutex);
+}
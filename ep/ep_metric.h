@@ -0,0 +1,171 @@
+/* vim: set ai sw=8 sts=8 ts=8 :*/
+
+/***********************************************************************
+**  ----- BEGIN LICENSE BLOCK -----
+**	LIBEP: Enhanced Portability Library (Reduced Edition)
+**
+**	Copyright (c) 2008-2019, Eric P. Allman.  All rights reserved.
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**  ----- END LICENSE BLOCK -----
+***********************************************************************/
+
+////////////////////////////////////////////////////////////////////////
+//
+//  METRICS
+//
+//	Counters, gauges, and histograms that are cheap enough to
+//	update on hot paths: an update is one relaxed atomic add (or
+//	three for a histogram), with no locks.  Metrics are normally
+//	static, declared much like debug flags:
+//
+//	    static EP_METRIC NSent = EP_METRIC_COUNTER_INIT("chan",
+//				"pdus_sent_total", "PDUs sent");
+//
+//	and registered once (usually in an init routine) so that
+//	ep_metric_export can find them.  They can be updated before
+//	they are registered.
+//
+//	Export is in the Prometheus text format.
+//
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _EP_METRIC_H_
+#define _EP_METRIC_H_
+
+#include <ep/ep.h>
+#include <stdio.h>
+__BEGIN_DECLS
+
+typedef struct ep_metric	EP_METRIC;
+
+// metric types
+#define EP_METRIC_COUNTER	1		// only goes up
+#define EP_METRIC_GAUGE		2		// goes up and down
+#define EP_METRIC_HISTOGRAM	3		// distribution of values
+
+#define EP_METRIC_MAXBUCKETS	20		// histogram bounds (not incl +Inf)
+
+// a function computing a value at export time
+typedef int64_t		(EP_METRIC_FUNC)(EP_METRIC *m, void *arg);
+
+// fields are private; use the initializers and functions below
+struct ep_metric
+{
+	int64_t			value;		// counter or gauge
+	uint64_t		count;		// histogram: observations
+	int64_t			sum;		// histogram: sum of observations
+	uint64_t		buckets[EP_METRIC_MAXBUCKETS + 1];
+	const int64_t		*bounds;	// histogram: bucket upper bounds
+	int			nbounds;	// histogram: number of bounds
+	int			type;		// EP_METRIC_*
+	const char		*subsys;	// subsystem (name prefix)
+	const char		*name;		// metric name within subsys
+	const char		*help;		// one line description
+	const char		*labels;	// e.g., lane="read" (may be NULL)
+	EP_METRIC_FUNC		*func;		// computes value on export
+	void			*arg;		// passed to func
+	bool			registered:1;	// in the registry
+	bool			dynamic:1;	// allocated by ep_metric_new
+	EP_METRIC		*next;		// next in registry
+};
+
+#define _EP_METRIC_INIT(t, s, n, h, b, nb)				\
+		{ 0, 0, 0, { 0 }, b, nb, t, s, n, h, NULL, NULL, NULL,	\
+		  false, false, NULL }
+#define EP_METRIC_COUNTER_INIT(subsys, name, help)			\
+		_EP_METRIC_INIT(EP_METRIC_COUNTER, subsys, name, help, NULL, 0)
+#define EP_METRIC_GAUGE_INIT(subsys, name, help)			\
+		_EP_METRIC_INIT(EP_METRIC_GAUGE, subsys, name, help, NULL, 0)
+// bounds must be static, ascending, and at most EP_METRIC_MAXBUCKETS long
+#define EP_METRIC_HISTOGRAM_INIT(subsys, name, help, bounds)		\
+		_EP_METRIC_INIT(EP_METRIC_HISTOGRAM, subsys, name, help,	\
+			bounds, (int) (sizeof bounds / sizeof bounds[0]))
+
+// bucket bounds for latencies in microseconds (10us to 10s)
+extern const int64_t	EpMetricUsecBounds[13];
+
+// bucket bounds for sizes in octets (64 to 1M)
+extern const int64_t	EpMetricSizeBounds[9];
+
+extern void		ep_metric_register(	// make visible to export
+				EP_METRIC *m);
+extern EP_METRIC	*ep_metric_new(		// allocate and register
+				int type,
+				const char *subsys,
+				const char *name,
+				const char *help,
+				const char *labels,	// copied, may be NULL
+				EP_METRIC_FUNC *func,	// may be NULL
+				void *arg);
+extern void		ep_metric_export(	// write all in text format
+				FILE *fp,
+				const char *prefix);	// e.g., "gdp"
+
+
+/*
+**  Updates.  These are lock free and may be called from any thread.
+*/
+
+// add to a counter or gauge
+static inline void
+ep_metric_add(EP_METRIC *m, int64_t n)
+{
+	__atomic_fetch_add(&m->value, n, __ATOMIC_RELAXED);
+}
+
+// add one to a counter or gauge
+static inline void
+ep_metric_inc(EP_METRIC *m)
+{
+	__atomic_fetch_add(&m->value, 1, __ATOMIC_RELAXED);
+}
+
+// set a gauge
+static inline void
+ep_metric_set(EP_METRIC *m, int64_t v)
+{
+	__atomic_store_n(&m->value, v, __ATOMIC_RELAXED);
+}
+
+// record one observation in a histogram
+static inline void
+ep_metric_observe(EP_METRIC *m, int64_t v)
+{
+	int i;
+
+	for (i = 0; i < m->nbounds && v > m->bounds[i]; i++)
+		continue;
+	__atomic_fetch_add(&m->buckets[i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&m->sum, v, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&m->count, 1, __ATOMIC_RELAXED);
+}
+
+// current value of a counter or gauge
+static inline int64_t
+ep_metric_get(EP_METRIC *m)
+{
+	return __atomic_load_n(&m->value, __ATOMIC_RELAXED);
+}
+
+__END_DECLS
+
+#endif // _EP_METRIC_H_
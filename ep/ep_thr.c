@@ -298,6 +298,8 @@ _ep_thr_mutex_init(EP_THR_MUTEX *mtx, int type,
 	pthread_mutexattr_settype(&attr, type);
 	if ((err = pthread_mutex_init(pmtx, &attr)) != 0)
 		diagnose_thr_err(err, "mutex_init", file, line, name, mtx);
+	else if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_register(mtx, file, line, name);
 	pthread_mutexattr_destroy(&attr);
 	TRACEMTX(mtx, "mutex_init");
 	CHECKMTX(mtx, "init <<<");
@@ -339,6 +341,8 @@ _ep_thr_mutex_destroy(EP_THR_MUTEX *mtx,
 				name, mtx->magic);
 	mtx->magic = 0xDEADBEEF;
 #endif // EP_OPT_EXTENDED_MUTEX_CHECK & 0x02
+	if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_forget(mtx);
 	if ((err = pthread_mutex_destroy(pmtx)) != 0)
 		diagnose_thr_err(err, "mutex_destroy", file, line, name, mtx);
 	return err;
@@ -422,7 +426,7 @@ _ep_thr_mutex_lock(EP_THR_MUTEX *mtx,
 	}
 #endif
 #if EP_OPT_EXTENDED_MUTEX_CHECK & 0x02
-	struct lorder *lorder;
+	struct lorder *lorder = NULL;
 	if (mtxorder > 0)
 	{
 		uint64_t mask;
@@ -445,7 +449,12 @@ _ep_thr_mutex_lock(EP_THR_MUTEX *mtx,
 		}
 	}
 #endif // EP_OPT_EXTENDED_MUTEX_CHECK & 0x02
-	if ((err = pthread_mutex_lock(pmtx)) != 0)
+	if (_EP_THR_LOCKPROF_ON())
+		err = _ep_thr_lockprof_acquire(mtx, pmtx, _EP_THR_LOCKPROF_MUTEX,
+				file, line, name);
+	else
+		err = pthread_mutex_lock(pmtx);
+	if (err != 0)
 		diagnose_thr_err(err, "mutex_lock", file, line, name, mtx);
 #if EP_OPT_EXTENDED_MUTEX_CHECK & 0x02
 	if (err == 0)
@@ -502,6 +511,8 @@ _ep_thr_mutex_trylock(EP_THR_MUTEX *mtx,
 	// EBUSY => mutex was already locked
 	if ((err = pthread_mutex_trylock(pmtx)) != 0 && err != EBUSY)
 		diagnose_thr_err(err, "mutex_trylock", file, line, name, mtx);
+	if (err == 0 && _EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_held(mtx, _EP_THR_LOCKPROF_MUTEX, file, line, name);
 #if EP_OPT_EXTENDED_MUTEX_CHECK & 0x02
 	struct lorder *lorder;
 	pthread_once(&lorder_once, lorder_init);
@@ -557,6 +568,8 @@ _ep_thr_mutex_unlock(EP_THR_MUTEX *mtx,
 		mtx->locker = 0;	// presumptuous
 	}
 #endif
+	if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_release(mtx);
 	if ((err = pthread_mutex_unlock(pmtx)) != 0)
 		diagnose_thr_err(err, "mutex_unlock", file, line, name, mtx);
 #if EP_OPT_EXTENDED_MUTEX_CHECK & 0x02
@@ -609,6 +622,8 @@ _ep_thr_mutex_tryunlock(EP_THR_MUTEX *mtx,
 		mtx->locker = 0;	// presumptuous
 	}
 #endif
+	if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_release(mtx);
 	// EAGAIN => mutex was not locked
 	// EPERM  => mutex held by a different thread
 	if ((err = pthread_mutex_unlock(pmtx)) != 0 &&
@@ -836,6 +851,9 @@ _ep_thr_cond_wait(EP_THR_COND *cv, EP_THR_MUTEX *mtx, EP_TIME_SPEC *timeout,
 	const char *save_l_file = mtx->l_file;
 	int save_l_line = mtx->l_line;
 #endif
+	// the wait itself is not time spent holding the mutex
+	if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_release(mtx);
 	if (timeout == NULL)
 	{
 		err = pthread_cond_wait(cv, pmtx);
@@ -849,6 +867,8 @@ _ep_thr_cond_wait(EP_THR_COND *cv, EP_THR_MUTEX *mtx, EP_TIME_SPEC *timeout,
 	}
 	if (err != 0)
 		diagnose_thr_err(err, "cond_wait", file, line, name, cv);
+	if ((err == 0 || err == ETIMEDOUT) && _EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_held(mtx, _EP_THR_LOCKPROF_MUTEX, file, line, name);
 #if EP_OPT_EXTENDED_MUTEX_CHECK & 0x02
 	mtx->locker = save_locker;
 	mtx->l_file = save_l_file;
@@ -891,6 +911,8 @@ _ep_thr_rwlock_init(EP_THR_RWLOCK *rwl,
 		return 0;
 	if ((err = pthread_rwlock_init(rwl, NULL)) != 0)
 		diagnose_thr_err(err, "rwlock_init", file, line, name, rwl);
+	else if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_register(rwl, file, line, name);
 	return err;
 }
 
@@ -903,6 +925,8 @@ _ep_thr_rwlock_destroy(EP_THR_RWLOCK *rwl,
 	TRACE(rwl, "rwlock_destroy");
 	if (!_EpThrUsePthreads)
 		return 0;
+	if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_forget(rwl);
 	if ((err = pthread_rwlock_destroy(rwl)) != 0)
 		diagnose_thr_err(err, "rwlock_destroy", file, line, name, rwl);
 	return err;
@@ -917,7 +941,12 @@ _ep_thr_rwlock_rdlock(EP_THR_RWLOCK *rwl,
 	TRACE(rwl, "rwlock_rdlock");
 	if (!_EpThrUsePthreads)
 		return 0;
-	if ((err = pthread_rwlock_rdlock(rwl)) != 0)
+	if (_EP_THR_LOCKPROF_ON())
+		err = _ep_thr_lockprof_acquire(rwl, rwl, _EP_THR_LOCKPROF_RDLOCK,
+				file, line, name);
+	else
+		err = pthread_rwlock_rdlock(rwl);
+	if (err != 0)
 		diagnose_thr_err(err, "rwlock_rdlock", file, line, name, rwl);
 	return err;
 }
@@ -933,6 +962,8 @@ _ep_thr_rwlock_tryrdlock(EP_THR_RWLOCK *rwl,
 		return 0;
 	if ((err = pthread_rwlock_tryrdlock(rwl)) != 0)
 		diagnose_thr_err(err, "rwlock_tryrdlock", file, line, name, rwl);
+	else if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_held(rwl, _EP_THR_LOCKPROF_RDLOCK, file, line, name);
 	return err;
 }
 
@@ -945,7 +976,12 @@ _ep_thr_rwlock_wrlock(EP_THR_RWLOCK *rwl,
 	TRACE(rwl, "rwlock_wrlock");
 	if (!_EpThrUsePthreads)
 		return 0;
-	if ((err = pthread_rwlock_wrlock(rwl)) != 0)
+	if (_EP_THR_LOCKPROF_ON())
+		err = _ep_thr_lockprof_acquire(rwl, rwl, _EP_THR_LOCKPROF_WRLOCK,
+				file, line, name);
+	else
+		err = pthread_rwlock_wrlock(rwl);
+	if (err != 0)
 		diagnose_thr_err(err, "rwlock_wrlock", file, line, name, rwl);
 	return err;
 }
@@ -961,6 +997,8 @@ _ep_thr_rwlock_trywrlock(EP_THR_RWLOCK *rwl,
 		return 0;
 	if ((err = pthread_rwlock_trywrlock(rwl)) != 0)
 		diagnose_thr_err(err, "rwlock_trywrlock", file, line, name, rwl);
+	else if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_held(rwl, _EP_THR_LOCKPROF_WRLOCK, file, line, name);
 	return err;
 }
 
@@ -973,6 +1011,8 @@ _ep_thr_rwlock_unlock(EP_THR_RWLOCK *rwl,
 	TRACE(rwl, "rwlock_unlock");
 	if (!_EpThrUsePthreads)
 		return 0;
+	if (_EP_THR_LOCKPROF_ON())
+		_ep_thr_lockprof_release(rwl);
 	if ((err = pthread_rwlock_unlock(rwl)) != 0)
 		diagnose_thr_err(err, "rwlock_unlock", file, line, name, rwl);
 	return err;
@@ -91,6 +91,11 @@ __BEGIN_DECLS
 **		ABI!!!  As a result, it should not be used in production.
 **	0x10	Do deeper lock checks (every time one is used).
 **		Probably inefficient.
+**
+**  EP_OPT_LOCK_PROFILE compiles in the lock contention profiler (see
+**	ep_thr_lockprof_init below).  It does not change the ABI, and
+**	until the profiler is turned on each lock operation pays only
+**	for one test of a flag, so it defaults on.
 */
 
 #ifndef EP_OPT_EXTENDED_MUTEX_CHECK				//XXX DEBUG TEMP
@@ -105,6 +110,10 @@ __BEGIN_DECLS
 # undef EP_OPT_EXTENDED_MUTEX_CHECK
 #endif
 
+#ifndef EP_OPT_LOCK_PROFILE
+# define EP_OPT_LOCK_PROFILE		1
+#endif
+
 #if EP_OSCF_USE_VALGRIND
 # include <valgrind/helgrind.h>
 #else
@@ -295,6 +304,46 @@ extern int	_ep_thr_rwlock_unlock(EP_THR_RWLOCK *rwl,
 #define		ep_thr_rwlock_unlock(rwl)	_ep_thr_rwlock_unlock(rwl, \
 				__FILE__, __LINE__, #rwl)
 
+/*
+**  Lock contention profiling
+**
+**	When turned on (libep.thr.lockprof.enable), every mutex and
+**	rwlock acquisition is charged to the place the lock was
+**	initialized: how often it was taken, how often the taker had
+**	to wait and for how long, and how long it was held (write
+**	locks only).  Locks that are statically initialized are
+**	charged to where they are first locked.  The report lists
+**	the sites with the most total wait time first.
+*/
+
+extern bool	_EpThrLockProf;
+
+extern void	ep_thr_lockprof_init(void);	// read params; maybe turn on
+extern void	ep_thr_lockprof_dump(		// print report
+			FILE *fp,		// where to print
+			int topn);		// max sites (<= 0 for all)
+
+// the rest are for ep_thr.c
+#define _EP_THR_LOCKPROF_MUTEX		0
+#define _EP_THR_LOCKPROF_RDLOCK		1
+#define _EP_THR_LOCKPROF_WRLOCK		2
+
+extern void	_ep_thr_lockprof_register(const void *lock,
+				const char *file, int line, const char *name);
+extern void	_ep_thr_lockprof_forget(const void *lock);
+extern int	_ep_thr_lockprof_acquire(const void *lock, void *plock,
+				int how, const char *file, int line,
+				const char *name);
+extern void	_ep_thr_lockprof_held(const void *lock, int how,
+				const char *file, int line, const char *name);
+extern void	_ep_thr_lockprof_release(const void *lock);
+
+#if EP_OPT_LOCK_PROFILE
+# define _EP_THR_LOCKPROF_ON()	__builtin_expect(_EpThrLockProf, false)
+#else
+# define _EP_THR_LOCKPROF_ON()	false
+#endif
+
 /*
 **  Thread pool declarations
 */
@@ -310,6 +359,92 @@ void		ep_thr_pool_run(
 			void (*func)(void *),	// the function
 			void *arg);		// passed to func
 
+// priority classes: separate queues sharing the pool by weight
+#define EP_THR_POOL_MAXCLASS		8	// number of classes
+#define EP_THR_POOL_CLASS_DEFAULT	0	// used by ep_thr_pool_run
+
+void		ep_thr_pool_run_class(
+			int cls,		// priority class
+			void (*func)(void *),	// the function
+			void *arg);		// passed to func
+
+// additional pools with their own workers (NULL means the default)
+typedef struct ep_thr_pool	EP_THR_POOL;
+
+EP_THR_POOL	*ep_thr_pool_new(
+			const char *name,	// for debugging (not copied)
+			int min_threads,	// min number of threads
+			int max_threads);	// max number of threads
+
+void		ep_thr_pool_run_in(
+			EP_THR_POOL *pool,	// the pool
+			int cls,		// priority class
+			void (*func)(void *),	// the function
+			void *arg);		// passed to func
+
+void		ep_thr_pool_setclass(
+			int cls,		// priority class
+			const char *name,	// name for stats (not copied)
+			int weight,		// relative scheduling weight
+			int share);		// max percent of workers
+
+typedef struct ep_thr_pool_stats
+{
+	const char	*name;		// class name (may be NULL)
+	int		depth;		// work waiting for a worker
+	int		max_depth;	// high water mark of depth
+	int		running;	// workers in this class now
+	int		max_running;	// high water mark of running
+	int		limit;		// most workers class may use
+	uint64_t	nrun;		// work run
+	uint64_t	wait_usec;	// total time work waited to run
+	uint64_t	max_wait_usec;	// longest time work waited
+} EP_THR_POOL_STATS;
+
+void		ep_thr_pool_getstats(
+			int cls,		// priority class
+			EP_THR_POOL_STATS *st,	// filled in
+			bool reset);		// reset interval stats
+
+void		ep_thr_pool_getstats_in(
+			EP_THR_POOL *pool,	// the pool
+			int cls,		// priority class
+			EP_THR_POOL_STATS *st,	// filled in
+			bool reset);		// reset interval stats
+
+// serial executors: work run in order, one worker at a time
+typedef struct ep_thr_serial	EP_THR_SERIAL;
+
+EP_THR_SERIAL	*ep_thr_serial_new(void);
+
+void		ep_thr_serial_free(
+			EP_THR_SERIAL *s);	// must be idle
+
+void		ep_thr_serial_run(
+			EP_THR_SERIAL *s,	// the executor
+			void (*func)(void *),	// the function
+			void *arg);		// passed to func
+
+void		ep_thr_serial_run_class(
+			EP_THR_SERIAL *s,	// the executor
+			int cls,		// class of this work
+			void (*func)(void *),	// the function
+			void *arg);		// passed to func
+
+void		ep_thr_serial_run_in(
+			EP_THR_SERIAL *s,	// the executor
+			EP_THR_POOL *pool,	// pool to use if idle
+			int cls,		// class of this work
+			void (*func)(void *),	// the function
+			void *arg);		// passed to func
+
+int		ep_thr_serial_depth(	// number of items queued
+			EP_THR_SERIAL *s,
+			int *max_depth);	// if set, high water mark
+
+bool		ep_thr_serial_idle(	// nothing queued or running?
+			EP_THR_SERIAL *s);
+
 # else // ! EP_OSCF_USE_PTHREADS
 
 # define	ep_thr_yield()
@@ -344,6 +479,9 @@ typedef int	EP_THR_RWLOCK;
 #  define	ep_thr_rwlock_trywrlock(rwl)	0
 #  define	ep_thr_rwlock_unlock(rwl)	0
 
+#  define	ep_thr_lockprof_init()
+#  define	ep_thr_lockprof_dump(fp, topn)
+
 # endif // EP_OSCF_USE_PTHREADS
 
 __END_DECLS
@@ -0,0 +1,443 @@
+/* vim: set ai sw=8 sts=8 ts=8 :*/
+
+/***********************************************************************
+**  ----- BEGIN LICENSE BLOCK -----
+**	LIBEP: Enhanced Portability Library (Reduced Edition)
+**
+**	Copyright (c) 2008-2019, Eric P. Allman.  All rights reserved.
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**  ----- END LICENSE BLOCK -----
+***********************************************************************/
+
+
+/***********************************************************************
+**
+**  LOCK CONTENTION PROFILING
+**
+**	Each lock is found by address in an open-addressed table that
+**	maps it to its site (where it was initialized) and remembers
+**	when it was last write-locked.  Lookups don't lock; additions
+**	and deletions are done under LpMutex, which is a raw pthread
+**	mutex so that profiling it doesn't recurse.  Deleted entries
+**	are left as tombstones and reused.  If the table fills up the
+**	extra locks are all charged to one "(overflow)" site.
+**
+**	Acquisition first tries the lock; only if that fails is the
+**	clock read and the wait measured, so uncontended locks cost
+**	one clock read (for the hold time) on top of the lookup.
+**
+***********************************************************************/
+
+#include <ep.h>
+#include <ep_app.h>
+#include <ep_dbg.h>
+#include <ep_mem.h>
+#include <ep_thr.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("libep.thr.lockprof", "Lock contention profiling");
+
+bool		_EpThrLockProf = false;
+
+#if EP_OSCF_USE_PTHREADS
+
+struct lp_site
+{
+	struct lp_site	*next;
+	const char	*file;		// where lock was initialized
+	int		line;
+	const char	*name;		// expression naming the lock
+	bool		lazy;		// not seen initialized
+	uint64_t	nacquire;	// times acquired
+	uint64_t	ncontend;	// ... after having to wait
+	uint64_t	wait_ns;	// total time waiting
+	uint64_t	max_wait_ns;
+	uint64_t	nhold;		// write holds timed
+	uint64_t	hold_ns;	// total time (write) held
+	uint64_t	max_hold_ns;
+};
+
+struct lp_lock
+{
+	const void	*lock;		// NULL => empty, LP_GONE => deleted
+	struct lp_site	*site;
+	uint64_t	acq_ns;		// when write locked (0 if not)
+};
+
+#define LP_GONE		((const void *) 1)
+
+static struct lp_lock	*Locks;		// the table
+static unsigned int	LockBits;	// log2 of table size
+static size_t		NLocks;		// 1 << LockBits
+static struct lp_site	*Sites;
+static int		NSites;
+static pthread_mutex_t	LpMutex		= PTHREAD_MUTEX_INITIALIZER;
+
+static struct lp_site	OverflowSite	= { NULL, "(overflow)", 0, "?", };
+static struct lp_lock	Overflow	= { NULL, &OverflowSite, 0 };
+
+
+static uint64_t
+lp_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t
+lp_hash(const void *lock)
+{
+	return (size_t) (((uintptr_t) lock * UINT64_C(0x9E3779B97F4A7C15))
+						>> (64 - LockBits));
+}
+
+static void
+lp_max(uint64_t *maxp, uint64_t v)
+{
+	uint64_t max = __atomic_load_n(maxp, __ATOMIC_RELAXED);
+
+	while (v > max &&
+			!__atomic_compare_exchange_n(maxp, &max, v, true,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		continue;
+}
+
+
+// find the table entry for lock (no locking needed)
+static struct lp_lock *
+lp_find(const void *lock)
+{
+	size_t i = lp_hash(lock);
+	size_t n;
+
+	for (n = 0; n < NLocks; n++, i = (i + 1) & (NLocks - 1))
+	{
+		const void *l = __atomic_load_n(&Locks[i].lock, __ATOMIC_ACQUIRE);
+
+		if (l == lock)
+			return &Locks[i];
+		if (l == NULL)
+			break;
+	}
+	return NULL;
+}
+
+// find or create a site (LpMutex must be held)
+static struct lp_site *
+lp_site(const char *file, int line, const char *name, bool lazy)
+{
+	struct lp_site *s;
+
+	for (s = Sites; s != NULL; s = s->next)
+	{
+		if (s->line == line && s->lazy == lazy &&
+				(s->file == file || strcmp(s->file, file) == 0))
+			return s;
+	}
+	s = (struct lp_site *) ep_mem_zalloc(sizeof *s);
+	s->file = file;
+	s->line = line;
+	s->name = name;
+	s->lazy = lazy;
+	s->next = Sites;
+	Sites = s;
+	NSites++;
+	return s;
+}
+
+// add or update the entry for lock (LpMutex must be held)
+static struct lp_lock *
+lp_insert(const void *lock, struct lp_site *site)
+{
+	struct lp_lock *e = lp_find(lock);
+	size_t i;
+	size_t n;
+
+	if (e != NULL)
+	{
+		// reinitialized, or memory reused without a destroy
+		e->site = site;
+		e->acq_ns = 0;
+		return e;
+	}
+	i = lp_hash(lock);
+	for (n = 0; n < NLocks; n++, i = (i + 1) & (NLocks - 1))
+	{
+		e = &Locks[i];
+		if (e->lock == NULL || e->lock == LP_GONE)
+		{
+			e->site = site;
+			e->acq_ns = 0;
+			__atomic_store_n(&e->lock, lock, __ATOMIC_RELEASE);
+			return e;
+		}
+	}
+	return &Overflow;
+}
+
+// get the entry for lock, charging it to the caller if new
+static struct lp_lock *
+lp_get(const void *lock, const char *file, int line, const char *name)
+{
+	struct lp_lock *e = lp_find(lock);
+
+	if (e != NULL)
+		return e;
+	pthread_mutex_lock(&LpMutex);
+	e = lp_insert(lock, lp_site(file, line, name, true));
+	pthread_mutex_unlock(&LpMutex);
+	return e;
+}
+
+
+/*
+**  Hooks called from ep_thr.c
+*/
+
+void
+_ep_thr_lockprof_register(const void *lock,
+		const char *file, int line, const char *name)
+{
+	pthread_mutex_lock(&LpMutex);
+	(void) lp_insert(lock, lp_site(file, line, name, false));
+	pthread_mutex_unlock(&LpMutex);
+}
+
+void
+_ep_thr_lockprof_forget(const void *lock)
+{
+	struct lp_lock *e;
+
+	pthread_mutex_lock(&LpMutex);
+	e = lp_find(lock);
+	if (e != NULL)
+		__atomic_store_n(&e->lock, LP_GONE, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&LpMutex);
+}
+
+int
+_ep_thr_lockprof_acquire(const void *lock, void *plock, int how,
+		const char *file, int line, const char *name)
+{
+	struct lp_lock *e = lp_get(lock, file, line, name);
+	struct lp_site *s = e->site;
+	uint64_t now = 0;
+	int err;
+
+	switch (how)
+	{
+	  case _EP_THR_LOCKPROF_MUTEX:
+		err = pthread_mutex_trylock((pthread_mutex_t *) plock);
+		break;
+	  case _EP_THR_LOCKPROF_RDLOCK:
+		err = pthread_rwlock_tryrdlock((pthread_rwlock_t *) plock);
+		break;
+	  default:
+		err = pthread_rwlock_trywrlock((pthread_rwlock_t *) plock);
+		break;
+	}
+	if (err == EBUSY)
+	{
+		uint64_t start = lp_now();
+
+		switch (how)
+		{
+		  case _EP_THR_LOCKPROF_MUTEX:
+			err = pthread_mutex_lock((pthread_mutex_t *) plock);
+			break;
+		  case _EP_THR_LOCKPROF_RDLOCK:
+			err = pthread_rwlock_rdlock((pthread_rwlock_t *) plock);
+			break;
+		  default:
+			err = pthread_rwlock_wrlock((pthread_rwlock_t *) plock);
+			break;
+		}
+		now = lp_now();
+		if (err == 0)
+		{
+			__atomic_fetch_add(&s->ncontend, 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&s->wait_ns, now - start, __ATOMIC_RELAXED);
+			lp_max(&s->max_wait_ns, now - start);
+		}
+	}
+	if (err != 0)
+		return err;
+	__atomic_fetch_add(&s->nacquire, 1, __ATOMIC_RELAXED);
+	if (how != _EP_THR_LOCKPROF_RDLOCK && e != &Overflow)
+		e->acq_ns = now != 0 ? now : lp_now();
+	return 0;
+}
+
+void
+_ep_thr_lockprof_held(const void *lock, int how,
+		const char *file, int line, const char *name)
+{
+	struct lp_lock *e = lp_get(lock, file, line, name);
+
+	__atomic_fetch_add(&e->site->nacquire, 1, __ATOMIC_RELAXED);
+	if (how != _EP_THR_LOCKPROF_RDLOCK && e != &Overflow)
+		e->acq_ns = lp_now();
+}
+
+void
+_ep_thr_lockprof_release(const void *lock)
+{
+	struct lp_lock *e = lp_find(lock);
+	struct lp_site *s;
+	uint64_t hold;
+
+	// readers never set acq_ns, so this only times writers
+	if (e == NULL || e->acq_ns == 0)
+		return;
+	hold = lp_now() - e->acq_ns;
+	e->acq_ns = 0;
+	s = e->site;
+	__atomic_fetch_add(&s->nhold, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->hold_ns, hold, __ATOMIC_RELAXED);
+	lp_max(&s->max_hold_ns, hold);
+}
+
+
+/*
+**  EP_THR_LOCKPROF_INIT --- turn on profiling if configured
+**
+**		Locks initialized before this is called are charged to
+**		where they are first locked rather than where they were
+**		initialized, so it should be called as early as
+**		possible (but after the parameters have been read).
+**		Profiling can't be turned off again.
+*/
+
+void
+ep_thr_lockprof_init(void)
+{
+	long nlocks;
+
+	if (_EpThrLockProf ||
+			!ep_adm_getboolparam("libep.thr.lockprof.enable", false))
+		return;
+#if !EP_OPT_LOCK_PROFILE
+	ep_dbg_cprintf(Dbg, 1, "ep_thr_lockprof_init: not compiled in\n");
+	return;
+#endif
+	nlocks = ep_adm_getlongparam("libep.thr.lockprof.locks", 16384);
+	for (LockBits = 4; LockBits < 30 && (1L << LockBits) < nlocks; LockBits++)
+		continue;
+	NLocks = (size_t) 1 << LockBits;
+	Locks = (struct lp_lock *) ep_mem_zalloc(NLocks * sizeof *Locks);
+	__atomic_store_n(&_EpThrLockProf, true, __ATOMIC_RELEASE);
+	ep_dbg_cprintf(Dbg, 2, "ep_thr_lockprof_init: tracking %zu locks\n",
+			NLocks);
+}
+
+
+/*
+**  EP_THR_LOCKPROF_DUMP --- print the sites with the most wait time
+*/
+
+static int
+site_cmp(const void *a_, const void *b_)
+{
+	const struct lp_site *a = *(const struct lp_site **) a_;
+	const struct lp_site *b = *(const struct lp_site **) b_;
+	uint64_t aw = __atomic_load_n(&a->wait_ns, __ATOMIC_RELAXED);
+	uint64_t bw = __atomic_load_n(&b->wait_ns, __ATOMIC_RELAXED);
+
+	if (aw != bw)
+		return aw < bw ? 1 : -1;
+	aw = __atomic_load_n(&a->nacquire, __ATOMIC_RELAXED);
+	bw = __atomic_load_n(&b->nacquire, __ATOMIC_RELAXED);
+	return aw < bw ? 1 : aw > bw ? -1 : 0;
+}
+
+void
+ep_thr_lockprof_dump(FILE *fp, int topn)
+{
+	struct lp_site **sv;
+	struct lp_site *s;
+	bool anylazy = false;
+	int nsites;
+	int i;
+
+	if (fp == NULL)
+		fp = stderr;
+	if (!_EpThrLockProf)
+	{
+		fprintf(fp, "\n<<< Lock contention >>>\n    (not turned on)\n");
+		return;
+	}
+
+	// take a snapshot of the site list
+	pthread_mutex_lock(&LpMutex);
+	sv = (struct lp_site **) ep_mem_malloc((NSites + 1) * sizeof *sv);
+	nsites = 0;
+	for (s = Sites; s != NULL; s = s->next)
+		sv[nsites++] = s;
+	pthread_mutex_unlock(&LpMutex);
+	if (__atomic_load_n(&OverflowSite.nacquire, __ATOMIC_RELAXED) != 0)
+		sv[nsites++] = &OverflowSite;
+
+	qsort(sv, nsites, sizeof *sv, &site_cmp);
+	if (topn <= 0 || topn > nsites)
+		topn = nsites;
+	fprintf(fp, "\n<<< Lock contention (top %d of %d sites by wait) >>>\n",
+			topn, nsites);
+	fprintf(fp, "    %-28s %-20s %10s %9s %10s %9s %9s %9s\n",
+			"site", "lock", "acquired", "contended", "wait ms",
+			"max wt us", "avg hd us", "max hd us");
+	for (i = 0; i < topn; i++)
+	{
+		char where[40];
+		const char *file;
+		uint64_t nacq, ncont, nhold;
+
+		s = sv[i];
+		nacq = __atomic_load_n(&s->nacquire, __ATOMIC_RELAXED);
+		ncont = __atomic_load_n(&s->ncontend, __ATOMIC_RELAXED);
+		nhold = __atomic_load_n(&s->nhold, __ATOMIC_RELAXED);
+		file = strrchr(s->file, '/');
+		file = file == NULL ? s->file : file + 1;
+		snprintf(where, sizeof where, "%s%s:%d", s->lazy ? "*" : "",
+				file, s->line);
+		anylazy |= s->lazy;
+		fprintf(fp, "    %-28s %-20.20s %10" PRIu64 " %9" PRIu64
+				" %10.1f %9" PRIu64 " %9" PRIu64 " %9" PRIu64 "\n",
+				where, s->name, nacq, ncont,
+				__atomic_load_n(&s->wait_ns, __ATOMIC_RELAXED) / 1e6,
+				__atomic_load_n(&s->max_wait_ns, __ATOMIC_RELAXED) / 1000,
+				nhold == 0 ? 0 :
+					__atomic_load_n(&s->hold_ns, __ATOMIC_RELAXED) /
+						nhold / 1000,
+				__atomic_load_n(&s->max_hold_ns, __ATOMIC_RELAXED) / 1000);
+	}
+	if (anylazy)
+		fprintf(fp, "    (* = not seen initialized; where first locked)\n");
+	ep_mem_free(sv);
+}
+
+#endif // EP_OSCF_USE_PTHREADS
@@ -34,19 +34,30 @@
 
 #include <ep.h>
 #include <ep_dbg.h>
+#include <ep_metric.h>
 #include <ep_thr.h>
 
+#include <limits.h>
 #include <string.h>
 #include <sys/queue.h>
 
 static EP_DBG	Dbg = EP_DBG_INIT("libep.thr.pool", "Thread Pool");
 
+// totals across all pools and classes (per class stats are in the pool)
+static EP_METRIC	TasksRun = EP_METRIC_COUNTER_INIT("pool",
+				"tasks_total", "Work items run by thread pools");
+static EP_METRIC	QueueWait = EP_METRIC_HISTOGRAM_INIT("pool",
+				"queue_wait_usec", "Time work waited for a thread",
+				EpMetricUsecBounds);
+
 struct twork
 {
 	STAILQ_ENTRY(twork)
 			next;			// next work in list
 	void		(*func)(void *);	// function to run
 	void		*arg;			// argument to pass
+	int		cls;			// priority class
+	EP_TIME_SPEC	queued;			// when it was queued (for stats)
 };
 
 static EP_THR_MUTEX	FreeTWorkMutex	EP_THR_MUTEX_INITIALIZER;
@@ -86,22 +97,132 @@ twork_free(struct twork *tw)
 
 /*
 **  Implementation of thread pool.
+**
+**	Work is queued by priority class, each class having its own
+**	FIFO.  Idle workers choose among the classes that have work
+**	using smooth weighted round robin, so over time each class
+**	gets workers in proportion to its weight.  A class can also
+**	be limited to a share of the workers; work in a class that
+**	is at its limit waits even if workers are idle, which keeps
+**	those workers available for the other classes.
+**
+**	There is always a default pool.  Applications can create
+**	more (e.g., one per disk) so that work that blocks in one
+**	can't tie up the workers of another.  Class weights and
+**	shares are the same in every pool.
 */
 
-struct thr_pool
+struct class_conf
+{
+	const char	*name;		// name (for stats)
+	int		weight;		// relative scheduling weight
+	int		share;		// max percentage of workers (1-100)
+};
+
+static struct class_conf	ClassConf[EP_THR_POOL_MAXCLASS];
+
+struct pool_class
+{
+	struct tworkq	work;		// queued work in this class
+	int		credit;		// current round robin credit
+	int		running;	// workers running this class
+	EP_THR_POOL_STATS stats;	// statistics since last reset
+};
+
+struct ep_thr_pool
 {
 	EP_THR_MUTEX	mutex;
 	EP_THR_COND	has_work;	// signaled when work becomes available
+	const char	*name;		// for debugging
 	int		free_threads;	// number of idle threads
 	int		num_threads;	// number of running threads
 	int		min_threads;	// minimum number of running threads
 	int		max_threads;	// maximum number of running threads
 	int		max_par_threads; // maximum number of parallel threads
-	struct tworkq	work;		// active work list
+	struct pool_class classes[EP_THR_POOL_MAXCLASS];
+	LIST_ENTRY(ep_thr_pool)	next;	// list of all pools
 	bool		initialized:1;	// set if initialized
 };
 
-static struct thr_pool		Pool;	// the pool!
+static EP_THR_POOL		Pool;	// the (default) pool!
+
+// all pools other than the default one (for ep_thr_pool_setclass)
+static EP_THR_MUTEX		PoolsMutex	EP_THR_MUTEX_INITIALIZER;
+static LIST_HEAD(, ep_thr_pool)	Pools = LIST_HEAD_INITIALIZER(Pools);
+
+static EP_THR_POOL *
+get_pool(EP_THR_POOL *pool)
+{
+	if (pool != NULL)
+		return pool;
+
+	// in case application doesn't initialized the pool
+	if (!Pool.initialized)
+		ep_thr_pool_init(-1, -1, 0);
+	return &Pool;
+}
+
+
+/*
+**  Helpers for the class queues; all must be called with pool locked.
+*/
+
+static int
+class_limit(EP_THR_POOL *pool, int cls)
+{
+	int limit;
+
+	if (ClassConf[cls].share >= 100)
+		return INT_MAX;
+	limit = pool->max_threads * ClassConf[cls].share / 100;
+	return limit > 0 ? limit : 1;
+}
+
+static void
+class_account(struct pool_class *pc, int nrun, uint64_t wait_usec,
+		uint64_t max_wait_usec)
+{
+	pc->stats.nrun += nrun;
+	pc->stats.wait_usec += wait_usec;
+	if (max_wait_usec > pc->stats.max_wait_usec)
+		pc->stats.max_wait_usec = max_wait_usec;
+}
+
+static uint64_t
+usec_since(const EP_TIME_SPEC *then, const EP_TIME_SPEC *now)
+{
+	int64_t usec;
+
+	usec = (now->tv_sec - then->tv_sec) * INT64_C(1000000) +
+		(now->tv_nsec - then->tv_nsec) / 1000;
+	return usec > 0 ? usec : 0;
+}
+
+// choose the next class to run (-1 if none may run now)
+static int
+pick_class(EP_THR_POOL *pool)
+{
+	int c;
+	int best = -1;
+	int total = 0;
+
+	for (c = 0; c < EP_THR_POOL_MAXCLASS; c++)
+	{
+		struct pool_class *pc = &pool->classes[c];
+
+		if (STAILQ_EMPTY(&pc->work) ||
+		    pc->running >= class_limit(pool, c))
+			continue;
+		pc->credit += ClassConf[c].weight;
+		total += ClassConf[c].weight;
+		if (best < 0 || pc->credit > pool->classes[best].credit)
+			best = c;
+	}
+	if (best >= 0)
+		pool->classes[best].credit -= total;
+	return best;
+}
+
 
 /*
 **  Worker thread
@@ -116,34 +237,67 @@ static struct thr_pool		Pool;	// the pool!
 **	sleep at all if possible to keep our cache hot.
 */
 
+static void	serial_drain(void *);
+
 static void *
-worker_thread(void *a)
+worker_thread(void *pool_)
 {
+	EP_THR_POOL *pool = (EP_THR_POOL *) pool_;
+
 	// start searching for work
 	for (;;)
 	{
 		struct twork *tw;
+		struct pool_class *pc;
+		EP_TIME_SPEC now;
+		int c;
 
 		// see if there is anything to do
-		ep_thr_mutex_lock(&Pool.mutex);
-		Pool.free_threads++;
-		while ((tw = STAILQ_FIRST(&Pool.work)) == NULL)
+		ep_thr_mutex_lock(&pool->mutex);
+		pool->free_threads++;
+		while ((c = pick_class(pool)) < 0)
 		{
 			// no, wait for something
-			ep_thr_cond_wait(&Pool.has_work, &Pool.mutex, NULL);
+			ep_thr_cond_wait(&pool->has_work, &pool->mutex, NULL);
 		}
 
 		// yes, please run it! (but don't stay locked)
-		STAILQ_REMOVE_HEAD(&Pool.work, next);
-		Pool.free_threads--;
+		pc = &pool->classes[c];
+		tw = STAILQ_FIRST(&pc->work);
+		STAILQ_REMOVE_HEAD(&pc->work, next);
+		pc->stats.depth--;
+		if (++pc->running > pc->stats.max_running)
+			pc->stats.max_running = pc->running;
+		pool->free_threads--;
+
+		// serial executors account for their own work
+		if (tw->func != &serial_drain)
+		{
+			uint64_t wait;
+
+			ep_time_now(&now);
+			wait = usec_since(&tw->queued, &now);
+			class_account(pc, 1, wait, wait);
+			ep_metric_inc(&TasksRun);
+			ep_metric_observe(&QueueWait, wait);
+		}
 
 		// keep stats for testing
-		if (Pool.num_threads - Pool.free_threads > Pool.max_par_threads)
-			Pool.max_par_threads = Pool.num_threads - Pool.free_threads;
-		ep_thr_mutex_unlock(&Pool.mutex);
+		if (pool->num_threads - pool->free_threads >
+		    pool->max_par_threads)
+			pool->max_par_threads = pool->num_threads -
+						pool->free_threads;
+		ep_thr_mutex_unlock(&pool->mutex);
 
 		tw->func(tw->arg);
 		twork_free(tw);
+
+		// if we were holding this class back, let someone else in
+		ep_thr_mutex_lock(&pool->mutex);
+		pc->running--;
+		if (!STAILQ_EMPTY(&pc->work) && pool->free_threads > 0)
+			ep_thr_cond_signal(&pool->has_work);
+		ep_thr_mutex_unlock(&pool->mutex);
 	}
 
 	// will never get here
@@ -159,13 +313,13 @@ worker_thread(void *a)
 */
 
 static void
-tp_add_thread(void)
+tp_add_thread(EP_THR_POOL *pool)
 {
 	pthread_t thread;
 	int err;
 
-	ep_dbg_cprintf(Dbg, 18, "Adding thread to pool\n");
-	err = pthread_create(&thread, NULL, &worker_thread, NULL);
+	ep_dbg_cprintf(Dbg, 18, "Adding thread to pool %s\n", pool->name);
+	err = pthread_create(&thread, NULL, &worker_thread, pool);
 	if (err != 0)
 	{
 		fprintf(stderr,
@@ -174,11 +328,46 @@ tp_add_thread(void)
 	}
 	else
 	{
-		Pool.num_threads++;
+		pool->num_threads++;
 	}
 }
 
 
+/*
+**  Set up a pool.  Classes nobody has configured run with weight
+**  one and no share limit, like the old single queue.
+*/
+
+static void
+pool_setup(EP_THR_POOL *pool, const char *name,
+		int min_threads, int max_threads)
+{
+	int c;
+	int i;
+
+	pool->name = name;
+	pool->min_threads = min_threads;
+	pool->max_threads = max_threads;
+	ep_thr_mutex_init(&pool->mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_cond_init(&pool->has_work);
+	for (c = 0; c < EP_THR_POOL_MAXCLASS; c++)
+	{
+		STAILQ_INIT(&pool->classes[c].work);
+		if (ClassConf[c].weight <= 0)
+			ClassConf[c].weight = 1;
+		if (ClassConf[c].share <= 0)
+			ClassConf[c].share = 100;
+	}
+
+	ep_metric_register(&TasksRun);
+	ep_metric_register(&QueueWait);
+
+	for (i = 0; i < min_threads; i++)
+		tp_add_thread(pool);
+	pool->initialized = true;
+}
+
+
 /*
 **  EP_THR_POOL_INIT --- initialize the thread pool
 **
@@ -198,8 +387,6 @@ tp_add_thread(void)
 void
 ep_thr_pool_init(int min_threads, int max_threads, uint32_t flags)
 {
-	int i;
-
 	if (Pool.initialized)
 		return;
 
@@ -218,15 +405,31 @@ ep_thr_pool_init(int min_threads, int max_threads, uint32_t flags)
 			max_threads = min_threads > 0 ? min_threads : 1;
 	}
 
-	Pool.min_threads = min_threads;
-	Pool.max_threads = max_threads;
-	ep_thr_mutex_init(&Pool.mutex, EP_THR_MUTEX_DEFAULT);
-	ep_thr_cond_init(&Pool.has_work);
-	STAILQ_INIT(&Pool.work);
+	pool_setup(&Pool, "default", min_threads, max_threads);
+}
 
-	for (i = 0; i < min_threads; i++)
-		tp_add_thread();
-	Pool.initialized = true;
+
+/*
+**  EP_THR_POOL_NEW --- create an additional pool
+**
+**	Work run in it never uses the default pool's workers, and
+**	vice versa.  Pools are never freed.
+*/
+
+EP_THR_POOL *
+ep_thr_pool_new(const char *name, int min_threads, int max_threads)
+{
+	EP_THR_POOL *pool = (EP_THR_POOL *) ep_mem_zalloc(sizeof *pool);
+
+	if (min_threads < 0)
+		min_threads = 0;
+	if (max_threads < min_threads || max_threads < 1)
+		max_threads = min_threads > 0 ? min_threads : 1;
+	pool_setup(pool, name, min_threads, max_threads);
+	ep_thr_mutex_lock(&PoolsMutex);
+	LIST_INSERT_HEAD(&Pools, pool, next);
+	ep_thr_mutex_unlock(&PoolsMutex);
+	return pool;
 }
 
 
@@ -234,27 +437,383 @@ ep_thr_pool_init(int min_threads, int max_threads, uint32_t flags)
 **  EP_THR_POOL_RUN --- run function in worker thread
 **
 **	This basically just calls a function in a worker thread.
-**	We make it a point to run these in a FIFO order.
+**	We make it a point to run these in a FIFO order within
+**	each class.  A NULL pool means the default one.
 */
 
+static void
+pool_enqueue(EP_THR_POOL *pool, struct twork *tw)
+{
+	struct pool_class *pc;
+
+	pool = get_pool(pool);
+	if (tw->cls < 0 || tw->cls >= EP_THR_POOL_MAXCLASS)
+		tw->cls = EP_THR_POOL_CLASS_DEFAULT;
+	pc = &pool->classes[tw->cls];
+	ep_thr_mutex_lock(&pool->mutex);
+	STAILQ_INSERT_TAIL(&pc->work, tw, next);
+	if (++pc->stats.depth > pc->stats.max_depth)
+		pc->stats.max_depth = pc->stats.depth;
+
+	// start up a new thread if needed and permitted
+	if (pool->free_threads == 0 && pool->num_threads < pool->max_threads)
+		tp_add_thread(pool);
+	else
+		ep_thr_cond_signal(&pool->has_work);
+	ep_thr_mutex_unlock(&pool->mutex);
+}
+
 void
-ep_thr_pool_run(void (*func)(void *), void *arg)
+ep_thr_pool_run_in(EP_THR_POOL *pool, int cls,
+		void (*func)(void *), void *arg)
 {
 	struct twork *tw = twork_new();
 
-	// in case application doesn't initialized the pool
-	if (!Pool.initialized)
-		ep_thr_pool_init(-1, -1, 0);
+	tw->func = func;
+	tw->arg = arg;
+	tw->cls = cls;
+	ep_time_now(&tw->queued);
+	pool_enqueue(pool, tw);
+}
+
+void
+ep_thr_pool_run_class(int cls, void (*func)(void *), void *arg)
+{
+	ep_thr_pool_run_in(NULL, cls, func, arg);
+}
+
+void
+ep_thr_pool_run(void (*func)(void *), void *arg)
+{
+	ep_thr_pool_run_in(NULL, EP_THR_POOL_CLASS_DEFAULT, func, arg);
+}
+
+
+/*
+**  EP_THR_POOL_SETCLASS --- set scheduling parameters for a class
+**
+**	Weight is relative to the other classes that have work
+**	queued.  Share is the largest percentage of the pool's
+**	maximum workers that this class may occupy at once; a
+**	share of 100 (or zero) means no limit.  Giving bulk
+**	classes shares that sum to less than 100 reserves the
+**	remaining workers for the others.  The settings apply to
+**	every pool.
+*/
+
+static void
+pool_setclass(EP_THR_POOL *pool, int cls, const char *name,
+		int weight, int share)
+{
+	// may be called before the pool exists (and so single threaded)
+	if (pool->initialized)
+		ep_thr_mutex_lock(&pool->mutex);
+	ClassConf[cls].name = name;
+	ClassConf[cls].weight = weight;
+	ClassConf[cls].share = share;
+	pool->classes[cls].credit = 0;
+	if (pool->initialized)
+	{
+		// a larger share may let waiting work run
+		ep_thr_cond_broadcast(&pool->has_work);
+		ep_thr_mutex_unlock(&pool->mutex);
+	}
+}
 
-	ep_thr_mutex_lock(&Pool.mutex);
+void
+ep_thr_pool_setclass(int cls, const char *name, int weight, int share)
+{
+	EP_THR_POOL *pool;
+
+	EP_ASSERT_ELSE(cls >= 0 && cls < EP_THR_POOL_MAXCLASS, return);
+	ep_dbg_cprintf(Dbg, 8, "ep_thr_pool_setclass(%d, %s): weight %d share %d%%\n",
+			cls, name == NULL ? "(none)" : name, weight, share);
+	weight = weight > 0 ? weight : 1;
+	share = share > 0 && share < 100 ? share : 100;
+
+	pool_setclass(&Pool, cls, name, weight, share);
+	ep_thr_mutex_lock(&PoolsMutex);
+	LIST_FOREACH(pool, &Pools, next)
+		pool_setclass(pool, cls, name, weight, share);
+	ep_thr_mutex_unlock(&PoolsMutex);
+}
+
+
+/*
+**  EP_THR_POOL_GETSTATS --- return statistics for a class
+**
+**	Depth and running are current values; everything else
+**	covers the time since the last reset.  Work in serial
+**	executors counts toward nrun and the wait times (measured
+**	from when the work was handed to the executor), but only
+**	executors waiting for a worker count toward depth.
+*/
+
+void
+ep_thr_pool_getstats_in(EP_THR_POOL *pool, int cls,
+		EP_THR_POOL_STATS *st, bool reset)
+{
+	struct pool_class *pc;
+
+	EP_ASSERT_ELSE(cls >= 0 && cls < EP_THR_POOL_MAXCLASS, return);
+	if (pool == NULL)
+		pool = &Pool;
+	if (!pool->initialized)
+	{
+		memset(st, 0, sizeof *st);
+		st->name = ClassConf[cls].name;
+		return;
+	}
+	pc = &pool->classes[cls];
+	ep_thr_mutex_lock(&pool->mutex);
+	*st = pc->stats;
+	st->name = ClassConf[cls].name;
+	st->running = pc->running;
+	st->limit = class_limit(pool, cls);
+	if (st->limit == INT_MAX)
+		st->limit = pool->max_threads;
+	if (reset)
+	{
+		pc->stats.max_depth = pc->stats.depth;
+		pc->stats.max_running = pc->running;
+		pc->stats.nrun = 0;
+		pc->stats.wait_usec = 0;
+		pc->stats.max_wait_usec = 0;
+	}
+	ep_thr_mutex_unlock(&pool->mutex);
+}
+
+void
+ep_thr_pool_getstats(int cls, EP_THR_POOL_STATS *st, bool reset)
+{
+	ep_thr_pool_getstats_in(NULL, cls, st, reset);
+}
+
+
+/*
+**  Serial executors
+**
+**	A serial executor is a FIFO of work that runs on the pool
+**	but never uses more than one worker at a time, so the work
+**	in it runs in order without holding any lock across it.
+**	Different executors run in parallel.
+**
+**	When work is added to an idle executor the executor itself
+**	is scheduled on the pool; the worker then drains it.  To
+**	be fair to other work, a worker that has run a batch from
+**	one executor puts it back at the end of the pool queue
+**	rather than draining it dry.
+**
+**	The executor is scheduled in the class of the work at its
+**	head, and a batch never crosses classes: when the next work
+**	is in a different class the executor goes back on the pool
+**	in that class.  This keeps the per-class worker limits
+**	honest without reordering anything.  The pool it runs on is
+**	chosen when it goes from idle to busy.
+*/
+
+#define SERIAL_BATCH	16		// work to run before yielding
+
+struct ep_thr_serial
+{
+	EP_THR_MUTEX	mutex;
+	struct tworkq	work;		// pending work
+	int		depth;		// length of work queue
+	int		max_depth;	// high water mark (for stats)
+	int		cls;		// class we are scheduled in
+	EP_THR_POOL	*pool;		// pool we are scheduled on
+	bool		scheduled:1;	// on the pool or running
+};
+
+static void
+serial_drain(void *s_)
+{
+	EP_THR_SERIAL *s = (EP_THR_SERIAL *) s_;
+	uint64_t wait_usec = 0;
+	uint64_t max_wait_usec = 0;
+	bool more = true;
+	EP_THR_POOL *pool;
+	int cls;
+	int next_cls;
+	int n;
+
+	ep_thr_mutex_lock(&s->mutex);
+	cls = next_cls = s->cls;
+	pool = s->pool;
+	ep_thr_mutex_unlock(&s->mutex);
+
+	for (n = 0; n < SERIAL_BATCH; n++)
+	{
+		struct twork *tw;
+		EP_TIME_SPEC now;
+		uint64_t wait;
+
+		ep_thr_mutex_lock(&s->mutex);
+		if ((tw = STAILQ_FIRST(&s->work)) == NULL)
+		{
+			// drained; next addition reschedules us
+			s->scheduled = false;
+			ep_thr_mutex_unlock(&s->mutex);
+			more = false;
+			break;
+		}
+		if (tw->cls != cls)
+		{
+			// switching class: requeue in the new one
+			s->cls = next_cls = tw->cls;
+			ep_thr_mutex_unlock(&s->mutex);
+			break;
+		}
+		STAILQ_REMOVE_HEAD(&s->work, next);
+		s->depth--;
+		ep_thr_mutex_unlock(&s->mutex);
+
+		ep_time_now(&now);
+		wait = usec_since(&tw->queued, &now);
+		wait_usec += wait;
+		if (wait > max_wait_usec)
+			max_wait_usec = wait;
+		ep_metric_inc(&TasksRun);
+		ep_metric_observe(&QueueWait, wait);
+		tw->func(tw->arg);
+		twork_free(tw);
+	}
+
+	// one trip through the pool lock per batch
+	if (n > 0)
+	{
+		ep_thr_mutex_lock(&pool->mutex);
+		class_account(&pool->classes[cls], n, wait_usec, max_wait_usec);
+		ep_thr_mutex_unlock(&pool->mutex);
+	}
+
+	// once drained someone else may already have rescheduled us
+	if (!more)
+		return;
+
+	// still more to do: go to the back of the line
+	ep_dbg_cprintf(Dbg, 40, "serial_drain(%p): yielding to class %d\n",
+			s, next_cls);
+	ep_thr_pool_run_in(pool, next_cls, &serial_drain, s);
+}
+
+
+/*
+**  EP_THR_SERIAL_NEW --- create a serial executor
+*/
+
+EP_THR_SERIAL *
+ep_thr_serial_new(void)
+{
+	EP_THR_SERIAL *s = (EP_THR_SERIAL *) ep_mem_zalloc(sizeof *s);
+
+	ep_thr_mutex_init(&s->mutex, EP_THR_MUTEX_DEFAULT);
+	STAILQ_INIT(&s->work);
+	return s;
+}
+
+
+/*
+**  EP_THR_SERIAL_FREE --- free a serial executor
+**
+**	The caller must ensure it is idle (see ep_thr_serial_idle)
+**	and that nobody else can add work to it.
+*/
+
+void
+ep_thr_serial_free(EP_THR_SERIAL *s)
+{
+	EP_ASSERT_ELSE(s->depth == 0 && !s->scheduled, return);
+	ep_thr_mutex_destroy(&s->mutex);
+	ep_mem_free(s);
+}
+
+
+/*
+**  EP_THR_SERIAL_RUN --- run function after earlier work on executor
+**
+**	The class only decides when the executor gets a worker;
+**	work on one executor always runs in the order it was added.
+**	The pool is only used if the executor was idle.
+*/
+
+void
+ep_thr_serial_run_in(EP_THR_SERIAL *s, EP_THR_POOL *pool, int cls,
+		void (*func)(void *), void *arg)
+{
+	struct twork *tw = twork_new();
+	bool schedule;
+
+	pool = get_pool(pool);
+	if (cls < 0 || cls >= EP_THR_POOL_MAXCLASS)
+		cls = EP_THR_POOL_CLASS_DEFAULT;
 	tw->func = func;
 	tw->arg = arg;
-	STAILQ_INSERT_TAIL(&Pool.work, tw, next);
+	tw->cls = cls;
+	ep_time_now(&tw->queued);
+	ep_thr_mutex_lock(&s->mutex);
+	STAILQ_INSERT_TAIL(&s->work, tw, next);
+	if (++s->depth > s->max_depth)
+		s->max_depth = s->depth;
+	schedule = !s->scheduled;
+	s->scheduled = true;
+	if (schedule)
+	{
+		s->cls = cls;
+		s->pool = pool;
+	}
+	ep_thr_mutex_unlock(&s->mutex);
 
-	// start up a new thread if needed and permitted
-	if (Pool.free_threads == 0 && Pool.num_threads < Pool.max_threads)
-		tp_add_thread();
-	else
-		ep_thr_cond_signal(&Pool.has_work);
-	ep_thr_mutex_unlock(&Pool.mutex);
+	if (schedule)
+		ep_thr_pool_run_in(pool, cls, &serial_drain, s);
+}
+
+void
+ep_thr_serial_run_class(EP_THR_SERIAL *s, int cls,
+		void (*func)(void *), void *arg)
+{
+	ep_thr_serial_run_in(s, NULL, cls, func, arg);
+}
+
+void
+ep_thr_serial_run(EP_THR_SERIAL *s, void (*func)(void *), void *arg)
+{
+	ep_thr_serial_run_class(s, EP_THR_POOL_CLASS_DEFAULT, func, arg);
+}
+
+
+/*
+**  EP_THR_SERIAL_DEPTH --- return number of pending work items
+**
+**	If max_depth is non-NULL it is set to the largest depth
+**	seen so far.
+*/
+
+int
+ep_thr_serial_depth(EP_THR_SERIAL *s, int *max_depth)
+{
+	int depth;
+
+	ep_thr_mutex_lock(&s->mutex);
+	depth = s->depth;
+	if (max_depth != NULL)
+		*max_depth = s->max_depth;
+	ep_thr_mutex_unlock(&s->mutex);
+	return depth;
+}
+
+
+/*
+**  EP_THR_SERIAL_IDLE --- tell if executor has nothing to do
+*/
+
+bool
+ep_thr_serial_idle(EP_THR_SERIAL *s)
+{
+	bool idle;
+
+	ep_thr_mutex_lock(&s->mutex);
+	idle = !s->scheduled;
+	ep_thr_mutex_unlock(&s->mutex);
+	return idle;
 }
@@ -0,0 +1,466 @@
+/* vim: set ai sw=8 sts=8 ts=8 :*/
+
+/***********************************************************************
+**  ----- BEGIN LICENSE BLOCK -----
+**	LIBEP: Enhanced Portability Library (Reduced Edition)
+**
+**	Copyright (c) 2008-2019, Eric P. Allman.  All rights reserved.
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**  ----- END LICENSE BLOCK -----
+***********************************************************************/
+
+/***********************************************************************
+**
+**  TIMER WHEELS
+**
+**	Timers are kept in a hierarchy of wheels, each of WHEEL_SLOTS
+**	slots.  The bottom wheel holds timers due within WHEEL_SLOTS
+**	ticks, one slot per tick; each wheel above covers WHEEL_SLOTS
+**	times the span of the one below it.  When the bottom wheel
+**	wraps, the next slot of the wheel above is "cascaded" down,
+**	redistributing its timers by their exact expiration.  This is
+**	the scheme from Varghese & Lauck, "Hashed and Hierarchical
+**	Timing Wheels", and (more or less) what the Linux kernel used
+**	for many years.
+**
+**	Setting and clearing a timer is O(1); so is firing it, since
+**	any timer is cascaded at most WHEEL_LEVELS - 1 times.  Nothing
+**	ever walks all the timers.  Timers further out than the
+**	wheels can represent are parked at the far edge and re-placed
+**	as they come around.
+**
+**	Timer functions are called without the wheel locked, so they
+**	may set or clear timers (including their own).  The wheel
+**	never touches a timer after calling its function, so the
+**	function may also free the object the timer is embedded in.
+**
+***********************************************************************/
+
+#include <ep.h>
+#include <ep_assert.h>
+#include <ep_dbg.h>
+#include <ep_thr.h>
+#include <ep_timer.h>
+
+#include <time.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("libep.timer", "Timer Wheels");
+
+
+/**************************  BEGIN PRIVATE  **************************/
+
+#define WHEEL_BITS	8
+#define WHEEL_SLOTS	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_SPAN	(UINT64_C(1) << (WHEEL_BITS * WHEEL_LEVELS))
+
+struct ep_timer_wheel
+{
+	EP_THR_MUTEX	mutex;
+	EP_THR_COND	cond;			// signaled when a func returns
+	uint32_t	flags;			// from ep_timer_wheel_new
+	uint32_t	tick_usec;		// length of a tick
+	struct timespec	epoch;			// tick zero (monotonic)
+	uint64_t	now;			// next tick to be processed
+						//   (so now - 1 is "current")
+	uint64_t	target;			// last tick to process
+	uint64_t	ntimers;		// number of pending timers
+	bool		advancing:1;		// some thread is firing timers
+	EP_TIMER	*running;		// timer whose func is running
+	EP_THR		runner;			// ... and the thread running it
+	EP_TIMER	*expired;		// timers ready to fire
+	EP_TIMER	*slot[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+/***************************  END PRIVATE  ***************************/
+
+
+/*
+**  Link/unlink a timer.  Wheel must be locked.
+*/
+
+static void
+timer_link(EP_TIMER **headp, EP_TIMER *t)
+{
+	if ((t->next = *headp) != NULL)
+		t->next->prevp = &t->next;
+	t->prevp = headp;
+	*headp = t;
+}
+
+static void
+timer_unlink(EP_TIMER *t)
+{
+	if (t->next != NULL)
+		t->next->prevp = t->prevp;
+	*t->prevp = t->next;
+	t->next = NULL;
+	t->prevp = NULL;
+}
+
+
+/*
+**  TIMER_PLACE --- put a timer in the slot for its expiration
+**
+**	Wheel must be locked.  The slot is chosen relative to w->now,
+**	so this is also used for cascading.
+*/
+
+static void
+timer_place(EP_TIMER_WHEEL *w, EP_TIMER *t)
+{
+	uint64_t expires = t->expires;
+	uint64_t delta;
+	int level;
+
+	if (expires < w->now)
+		expires = w->now;		// overdue: fire next tick
+	delta = expires - w->now;
+	if (delta >= WHEEL_SPAN)
+	{
+		// park at the far edge; re-placed when cascaded
+		delta = WHEEL_SPAN - 1;
+		expires = w->now + delta;
+	}
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+	{
+		if (delta < (UINT64_C(1) << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+	timer_link(&w->slot[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK],
+			t);
+}
+
+
+/*
+**  CASCADE --- move one slot of an upper wheel down the hierarchy
+**
+**	Returns the index of the slot, so the caller knows whether
+**	this wheel has also wrapped.
+*/
+
+static int
+cascade(EP_TIMER_WHEEL *w, int level)
+{
+	int index = (w->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	EP_TIMER *t = w->slot[level][index];
+
+	w->slot[level][index] = NULL;
+	while (t != NULL)
+	{
+		EP_TIMER *next = t->next;
+
+		t->next = NULL;
+		t->prevp = NULL;
+		timer_place(w, t);
+		t = next;
+	}
+	return index;
+}
+
+
+/*
+**  Current tick according to the clock
+*/
+
+static uint64_t
+clock_tick(EP_TIMER_WHEEL *w)
+{
+	struct timespec tv;
+	uint64_t usec;
+
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	usec = (tv.tv_sec - w->epoch.tv_sec) * UINT64_C(1000000) +
+		(tv.tv_nsec - w->epoch.tv_nsec) / 1000;
+	return usec / w->tick_usec;
+}
+
+
+/*
+**  ADVANCE_TO --- process ticks through w->target, firing timers
+**
+**	Wheel must be locked on entry; it is unlocked while each
+**	function runs.  Only one thread advances the wheel at a
+**	time; others just extend the target and leave.
+*/
+
+static int
+advance_to(EP_TIMER_WHEEL *w, uint64_t target)
+{
+	int nfired = 0;
+
+	if (target > w->target || !w->advancing)
+		w->target = target;
+	if (w->advancing)
+		return 0;
+	w->advancing = true;
+
+	while (w->now <= w->target)
+	{
+		int level;
+
+		if (w->ntimers == 0)
+		{
+			// nothing to do: jump straight there
+			w->now = w->target + 1;
+			break;
+		}
+
+		// at the top of each bottom-wheel rotation, cascade down
+		if ((w->now & WHEEL_MASK) == 0)
+		{
+			for (level = 1; level < WHEEL_LEVELS; level++)
+			{
+				if (cascade(w, level) != 0)
+					break;
+			}
+		}
+
+		// move this tick's timers to the expired list
+		{
+			EP_TIMER **headp = &w->slot[0][w->now & WHEEL_MASK];
+			EP_TIMER *t;
+
+			while ((t = *headp) != NULL)
+			{
+				timer_unlink(t);
+				timer_link(&w->expired, t);
+			}
+		}
+		w->now++;
+
+		// and fire them
+		while (w->expired != NULL)
+		{
+			EP_TIMER *t = w->expired;
+			EP_TIMER_FUNC *func = t->func;
+			void *arg = t->arg;
+
+			timer_unlink(t);
+			w->ntimers--;
+			w->running = t;
+			w->runner = ep_thr_getself();
+			ep_thr_mutex_unlock(&w->mutex);
+
+			ep_dbg_cprintf(Dbg, 40, "ep_timer: firing %p\n", t);
+			(*func)(t, arg);
+			nfired++;
+
+			ep_thr_mutex_lock(&w->mutex);
+			w->running = NULL;
+			ep_thr_cond_broadcast(&w->cond);
+		}
+	}
+
+	w->advancing = false;
+	return nfired;
+}
+
+
+/*
+**  EP_TIMER_WHEEL_NEW --- create a new timer wheel
+**
+**	Unless EP_TIMER_WHEEL_MANUAL is set, the wheel follows the
+**	monotonic clock and ep_timer_wheel_run should be called about
+**	once a tick.  Manual wheels only move when advanced, which is
+**	mostly useful for testing.
+*/
+
+EP_TIMER_WHEEL *
+ep_timer_wheel_new(uint32_t tick_usec, uint32_t flags)
+{
+	EP_TIMER_WHEEL *w;
+
+	EP_ASSERT_ELSE(tick_usec > 0, tick_usec = 1);
+	w = (EP_TIMER_WHEEL *) ep_mem_zalloc(sizeof *w);
+	ep_thr_mutex_init(&w->mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_cond_init(&w->cond);
+	w->flags = flags;
+	w->tick_usec = tick_usec;
+	w->now = 1;				// tick zero is "now"
+	clock_gettime(CLOCK_MONOTONIC, &w->epoch);
+	return w;
+}
+
+
+/*
+**  EP_TIMER_WHEEL_FREE --- free a timer wheel
+**
+**	Any timers still pending are left idle without being called.
+**	Nobody may be running or advancing the wheel.
+*/
+
+void
+ep_timer_wheel_free(EP_TIMER_WHEEL *w)
+{
+	int level;
+	int index;
+
+	EP_ASSERT_ELSE(!w->advancing, return);
+	for (level = 0; level < WHEEL_LEVELS; level++)
+	{
+		for (index = 0; index < WHEEL_SLOTS; index++)
+		{
+			EP_TIMER *t;
+
+			while ((t = w->slot[level][index]) != NULL)
+				timer_unlink(t);
+		}
+	}
+	ep_thr_cond_destroy(&w->cond);
+	ep_thr_mutex_destroy(&w->mutex);
+	ep_mem_free(w);
+}
+
+
+/*
+**  EP_TIMER_WHEEL_RUN --- fire all timers that are due
+**
+**	Returns the number of timers fired by this call.
+*/
+
+int
+ep_timer_wheel_run(EP_TIMER_WHEEL *w)
+{
+	int nfired;
+
+	if (EP_UT_BITSET(EP_TIMER_WHEEL_MANUAL, w->flags))
+		return 0;
+	ep_thr_mutex_lock(&w->mutex);
+	nfired = advance_to(w, clock_tick(w));
+	ep_thr_mutex_unlock(&w->mutex);
+	return nfired;
+}
+
+
+/*
+**  EP_TIMER_WHEEL_ADVANCE --- move the wheel forward nticks ticks
+**
+**	Timers set for up to nticks from now will have fired when
+**	this returns (unless another thread is already advancing the
+**	wheel, in which case that thread will fire them).
+*/
+
+int
+ep_timer_wheel_advance(EP_TIMER_WHEEL *w, uint64_t nticks)
+{
+	int nfired = 0;
+
+	ep_thr_mutex_lock(&w->mutex);
+	if (nticks > 0)
+		nfired = advance_to(w, w->now - 1 + nticks);
+	ep_thr_mutex_unlock(&w->mutex);
+	return nfired;
+}
+
+
+/*
+**  EP_TIMER_WHEEL_NTIMERS --- return number of pending timers
+*/
+
+uint64_t
+ep_timer_wheel_ntimers(EP_TIMER_WHEEL *w)
+{
+	uint64_t ntimers;
+
+	ep_thr_mutex_lock(&w->mutex);
+	ntimers = w->ntimers;
+	ep_thr_mutex_unlock(&w->mutex);
+	return ntimers;
+}
+
+
+/*
+**  EP_TIMER_SET --- arm a timer to call func(t, arg) in usec
+**
+**	If the timer is already pending it is moved.  The time is
+**	rounded up to a whole number of ticks, and a timer is never
+**	called before at least that many ticks have passed.
+*/
+
+void
+ep_timer_set(EP_TIMER_WHEEL *w,
+	EP_TIMER *t,
+	uint64_t usec,
+	EP_TIMER_FUNC *func,
+	void *arg)
+{
+	uint64_t nticks = (usec + w->tick_usec - 1) / w->tick_usec;
+
+	ep_thr_mutex_lock(&w->mutex);
+	if (t->prevp != NULL)
+		timer_unlink(t);
+	else
+		w->ntimers++;
+	t->func = func;
+	t->arg = arg;
+	t->expires = w->now - 1 + nticks;
+	if (!EP_UT_BITSET(EP_TIMER_WHEEL_MANUAL, w->flags))
+	{
+		// w->now may lag the clock if the wheel isn't run promptly
+		uint64_t tick = clock_tick(w);
+
+		if (tick > w->now - 1)
+			t->expires = tick + nticks;
+	}
+	timer_place(w, t);
+	ep_thr_mutex_unlock(&w->mutex);
+}
+
+
+/*
+**  EP_TIMER_CLR --- disarm a timer
+**
+**	If the timer's function is running in another thread, this
+**	waits for it to finish (and disarms the timer again if the
+**	function re-armed it), so once this returns the timer is
+**	idle and its function is not running unless this is being
+**	called from that function.  Returns true if the timer was
+**	pending.
+**
+**	Since this may wait, callers must not hold any lock that the
+**	timer's function blocks on.
+*/
+
+bool
+ep_timer_clr(EP_TIMER_WHEEL *w, EP_TIMER *t)
+{
+	bool pending = false;
+	EP_THR self = ep_thr_getself();
+
+	ep_thr_mutex_lock(&w->mutex);
+	for (;;)
+	{
+		if (t->prevp != NULL)
+		{
+			timer_unlink(t);
+			w->ntimers--;
+			pending = true;
+		}
+		if (w->running != t || pthread_equal(w->runner, self))
+			break;
+		ep_thr_cond_wait(&w->cond, &w->mutex, NULL);
+	}
+	ep_thr_mutex_unlock(&w->mutex);
+	return pending;
+}
@@ -0,0 +1,93 @@
+/* vim: set ai sw=8 sts=8 ts=8 :*/
+
+/***********************************************************************
+**  ----- BEGIN LICENSE BLOCK -----
+**	LIBEP: Enhanced Portability Library (Reduced Edition)
+**
+**	Copyright (c) 2008-2019, Eric P. Allman.  All rights reserved.
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**  ----- END LICENSE BLOCK -----
+***********************************************************************/
+
+////////////////////////////////////////////////////////////////////////
+//
+//  TIMER WHEELS
+//
+//	Hierarchical timing wheels for large numbers of timers
+//	(leases, idle timeouts, and the like).  Setting, clearing,
+//	and expiring a timer are all O(1).
+//
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _EP_TIMER_H_
+#define _EP_TIMER_H_
+
+#include <ep/ep.h>
+__BEGIN_DECLS
+
+typedef struct ep_timer		EP_TIMER;
+typedef struct ep_timer_wheel	EP_TIMER_WHEEL;
+
+// the type of a function called when a timer expires
+typedef void		(EP_TIMER_FUNC)(EP_TIMER *t, void *arg);
+
+// an individual timer, usually embedded in the object it times
+//	(a zeroed timer is valid and not pending; fields are private)
+struct ep_timer
+{
+	EP_TIMER		*next;		// next in slot
+	EP_TIMER		**prevp;	// back pointer, NULL if idle
+	uint64_t		expires;	// tick at which to fire
+	EP_TIMER_FUNC		*func;		// function to call
+	void			*arg;		// second argument to func
+};
+
+// flags for ep_timer_wheel_new
+#define EP_TIMER_WHEEL_MANUAL	0x00000001	// only ep_timer_wheel_advance
+
+extern EP_TIMER_WHEEL	*ep_timer_wheel_new(
+				uint32_t tick_usec,	// microseconds per tick
+				uint32_t flags);
+extern void		ep_timer_wheel_free(
+				EP_TIMER_WHEEL *w);	// pending timers dropped
+extern int		ep_timer_wheel_run(	// fire timers due by now
+				EP_TIMER_WHEEL *w);
+extern int		ep_timer_wheel_advance(	// move time forward
+				EP_TIMER_WHEEL *w,
+				uint64_t nticks);
+extern uint64_t		ep_timer_wheel_ntimers(	// number pending
+				EP_TIMER_WHEEL *w);
+
+extern void		ep_timer_set(		// (re)arm a timer
+				EP_TIMER_WHEEL *w,
+				EP_TIMER *t,
+				uint64_t usec,		// from now
+				EP_TIMER_FUNC *func,
+				void *arg);
+extern bool		ep_timer_clr(		// disarm, wait for func
+				EP_TIMER_WHEEL *w,
+				EP_TIMER *t);
+
+#define ep_timer_pending(t)	((t)->prevp != NULL)
+
+__END_DECLS
+#endif //_EP_TIMER_H_
@@ -0,0 +1,366 @@
+/* vim: set ai sw=8 sts=8 ts=8 :*/
+
+/***********************************************************************
+**  ----- BEGIN LICENSE BLOCK -----
+**	LIBEP: Enhanced Portability Library (Reduced Edition)
+**
+**	Copyright (c) 2008-2019, Eric P. Allman.  All rights reserved.
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**  ----- END LICENSE BLOCK -----
+***********************************************************************/
+
+
+/***********************************************************************
+**
+**  TRACING
+**
+**	Each thread that records anything gets a trace_thr holding its
+**	current context and a ring of the last NEvents events.  Only
+**	the owning thread writes to a ring, so recording takes no
+**	locks; the list of rings is locked only when a thread records
+**	for the first time and when the rings are dumped.  A dump that
+**	races with a thread wrapping its ring may show a torn event,
+**	which is acceptable for a diagnostic.
+**
+**	When a thread exits its ring is left on the list (so its events
+**	can still be dumped) and is reused by the next new thread.
+**
+***********************************************************************/
+
+#include <ep.h>
+#include <ep_app.h>
+#include <ep_dbg.h>
+#include <ep_mem.h>
+#include <ep_thr.h>
+#include <ep_trace.h>
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("libep.trace", "Request tracing");
+
+bool			_EpTraceEnabled = false;
+
+struct trace_ev
+{
+	uint64_t	start;			// usec since epoch
+	uint64_t	dur;			// usec (zero for instants)
+	uint64_t	trace_id;
+	uint64_t	span_id;
+	uint64_t	parent_id;
+	const char	*cat;
+	const char	*name;
+	char		ph;			// Chrome phase: 'X' or 'i'
+};
+
+struct trace_thr
+{
+	struct trace_thr	*next;		// list of all rings
+	bool			inuse;		// owned by a live thread
+	long			tid;		// owning thread
+	uint64_t		trace_id;	// current context
+	uint64_t		span_id;
+	uint64_t		rng;		// for ids and sampling
+	uint64_t		nrec;		// events ever recorded
+	struct trace_ev		ev[];		// NEvents of them
+};
+
+static int		NEvents;
+static struct trace_thr	*Rings;
+static EP_THR_MUTEX	RingsMutex	EP_THR_MUTEX_INITIALIZER;
+static pthread_key_t	RingKey;
+static pthread_once_t	RingKeyOnce = PTHREAD_ONCE_INIT;
+
+
+static uint64_t
+trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift64*; never returns zero
+static uint64_t
+trace_rand(struct trace_thr *t)
+{
+	uint64_t x = t->rng;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	t->rng = x;
+	x *= UINT64_C(0x2545F4914F6CDD1D);
+	return x == 0 ? 1 : x;
+}
+
+static void
+ring_release(void *t_)
+{
+	struct trace_thr *t = (struct trace_thr *) t_;
+
+	ep_thr_mutex_lock(&RingsMutex);
+	t->inuse = false;
+	t->trace_id = t->span_id = 0;
+	ep_thr_mutex_unlock(&RingsMutex);
+}
+
+static void
+ring_key_init(void)
+{
+	pthread_key_create(&RingKey, &ring_release);
+}
+
+// get (or create) this thread's ring
+static struct trace_thr *
+get_ring(void)
+{
+	struct trace_thr *t = (struct trace_thr *) pthread_getspecific(RingKey);
+
+	if (t != NULL)
+		return t;
+
+	ep_thr_mutex_lock(&RingsMutex);
+	for (t = Rings; t != NULL; t = t->next)
+		if (!t->inuse)
+			break;
+	if (t == NULL)
+	{
+		t = (struct trace_thr *) ep_mem_zalloc(sizeof *t +
+							NEvents * sizeof t->ev[0]);
+		t->next = Rings;
+		Rings = t;
+	}
+	t->inuse = true;
+	t->tid = (long) (intptr_t) ep_thr_gettid();
+	t->rng = trace_now() ^ (uintptr_t) t;
+	if (t->rng == 0)
+		t->rng = 1;
+	ep_thr_mutex_unlock(&RingsMutex);
+	pthread_setspecific(RingKey, t);
+	return t;
+}
+
+static void
+record(struct trace_thr *t, char ph, const char *cat, const char *name,
+		uint64_t start, uint64_t end, uint64_t span_id, uint64_t parent_id)
+{
+	struct trace_ev *e = &t->ev[t->nrec % NEvents];
+
+	e->start = start;
+	e->dur = end - start;
+	e->trace_id = t->trace_id;
+	e->span_id = span_id;
+	e->parent_id = parent_id;
+	e->cat = cat;
+	e->name = name;
+	e->ph = ph;
+	__atomic_store_n(&t->nrec, t->nrec + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+**  EP_TRACE_INIT --- turn on tracing
+**
+**		nevents is the number of events kept for each thread.
+**		Can only be called once.
+*/
+
+void
+ep_trace_init(int nevents)
+{
+	if (_EpTraceEnabled)
+		return;
+	if (nevents < 16)
+		nevents = 16;
+	NEvents = nevents;
+	pthread_once(&RingKeyOnce, &ring_key_init);
+	_EpTraceEnabled = true;
+	ep_dbg_cprintf(Dbg, 8, "ep_trace_init: %d events per thread\n", nevents);
+}
+
+
+/*
+**  EP_TRACE_SAMPLE --- start a new trace in one of every one_in_n calls
+**
+**		Does nothing if this thread already has a trace.  Returns
+**		true if a trace was started, in which case the caller
+**		must end it with ep_trace_set(0, 0).
+*/
+
+bool
+ep_trace_sample(int one_in_n)
+{
+	struct trace_thr *t;
+
+	if (!_EpTraceEnabled || one_in_n <= 0)
+		return false;
+	t = get_ring();
+	if (t->trace_id != 0)
+		return false;
+	if (one_in_n > 1 && trace_rand(t) % one_in_n != 0)
+		return false;
+	t->trace_id = trace_rand(t);
+	t->span_id = 0;
+	return true;
+}
+
+
+/*
+**  EP_TRACE_SET --- set the current context (e.g., from a message)
+*/
+
+void
+ep_trace_set(uint64_t trace_id, uint64_t span_id)
+{
+	struct trace_thr *t;
+
+	if (!_EpTraceEnabled)
+		return;
+	t = get_ring();
+	t->trace_id = trace_id;
+	t->span_id = trace_id == 0 ? 0 : span_id;
+}
+
+uint64_t
+ep_trace_id(void)
+{
+	if (!_EpTraceEnabled)
+		return 0;
+	return get_ring()->trace_id;
+}
+
+uint64_t
+ep_trace_span_id(void)
+{
+	if (!_EpTraceEnabled)
+		return 0;
+	return get_ring()->span_id;
+}
+
+
+/*
+**  Spans and instants
+*/
+
+void
+_ep_trace_begin(EP_TRACE_SPAN *sp, const char *cat, const char *name)
+{
+	struct trace_thr *t = get_ring();
+
+	if (t->trace_id == 0)
+		return;
+	sp->cat = cat;
+	sp->name = name;
+	sp->span_id = trace_rand(t);
+	sp->parent_id = t->span_id;
+	t->span_id = sp->span_id;
+	sp->start = trace_now();
+}
+
+void
+_ep_trace_end(EP_TRACE_SPAN *sp)
+{
+	struct trace_thr *t = get_ring();
+
+	// the context may have been cleared (or changed) under us
+	if (t->trace_id != 0)
+		record(t, 'X', sp->cat, sp->name, sp->start, trace_now(),
+				sp->span_id, sp->parent_id);
+	if (t->span_id == sp->span_id)
+		t->span_id = sp->parent_id;
+	sp->start = 0;
+}
+
+void
+ep_trace_instant(const char *cat, const char *name)
+{
+	struct trace_thr *t;
+	uint64_t now;
+
+	if (!_EpTraceEnabled)
+		return;
+	t = get_ring();
+	if (t->trace_id == 0)
+		return;
+	now = trace_now();
+	record(t, 'i', cat, name, now, now, 0, t->span_id);
+}
+
+
+/*
+**  EP_TRACE_DUMP --- write all rings as Chrome trace event JSON
+*/
+
+int
+ep_trace_dump(FILE *fp)
+{
+	struct trace_thr *t;
+	int pid = (int) getpid();
+	int n = 0;
+	const char *sep = ",\n";
+	const char *progname = ep_app_getprogname();
+
+	if (progname == NULL)
+		progname = "unknown";
+	fprintf(fp, "{\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+			"\"args\":{\"name\":\"%s\"}}", pid, progname);
+	if (!_EpTraceEnabled)
+		goto done;
+
+	ep_thr_mutex_lock(&RingsMutex);
+	for (t = Rings; t != NULL; t = t->next)
+	{
+		uint64_t nrec = __atomic_load_n(&t->nrec, __ATOMIC_ACQUIRE);
+		uint64_t i = nrec > (uint64_t) NEvents ? nrec - NEvents : 0;
+
+		for (; i < nrec; i++)
+		{
+			struct trace_ev e = t->ev[i % NEvents];
+
+			if (e.name == NULL)
+				continue;
+			fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\","
+					"\"ts\":%" PRIu64 ",",
+					sep, e.name, e.cat, e.ph, e.start);
+			if (e.ph == 'X')
+				fprintf(fp, "\"dur\":%" PRIu64 ",", e.dur);
+			else
+				fprintf(fp, "\"s\":\"t\",");
+			fprintf(fp, "\"pid\":%d,\"tid\":%ld,\"args\":{"
+					"\"trace\":\"%016" PRIx64 "\","
+					"\"span\":\"%016" PRIx64 "\","
+					"\"parent\":\"%016" PRIx64 "\"}}",
+					pid, t->tid, e.trace_id, e.span_id, e.parent_id);
+			n++;
+		}
+	}
+	ep_thr_mutex_unlock(&RingsMutex);
+
+done:
+	fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	return n;
+}
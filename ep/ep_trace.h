@@ -0,0 +1,115 @@
+/* vim: set ai sw=8 sts=8 ts=8 :*/
+
+/***********************************************************************
+**  ----- BEGIN LICENSE BLOCK -----
+**	LIBEP: Enhanced Portability Library (Reduced Edition)
+**
+**	Copyright (c) 2008-2019, Eric P. Allman.  All rights reserved.
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**  ----- END LICENSE BLOCK -----
+***********************************************************************/
+
+////////////////////////////////////////////////////////////////////////
+//
+//  TRACING
+//
+//	Spans of work tagged with a trace id, so the pieces of one
+//	operation can be lined up across threads and processes.  Each
+//	thread has a current trace context; a span started while the
+//	context is set becomes a child of the current span and is
+//	recorded, when it ends, into a ring buffer belonging to the
+//	thread.  With no context set (the common case) nothing is
+//	recorded.
+//
+//	When tracing has not been turned on with ep_trace_init the
+//	only cost is a test of a global flag.
+//
+//	The rings are written out in the Chrome trace event JSON
+//	format (load in chrome://tracing or Perfetto).  Times are
+//	wall clock microseconds so traces from several processes can
+//	be merged.
+//
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _EP_TRACE_H_
+#define _EP_TRACE_H_
+
+#include <ep/ep.h>
+#include <stdio.h>
+__BEGIN_DECLS
+
+typedef struct ep_trace_span
+{
+	uint64_t	start;		// usec; zero if not being recorded
+	uint64_t	span_id;
+	uint64_t	parent_id;
+	const char	*cat;		// category (static string)
+	const char	*name;		// name (static string)
+} EP_TRACE_SPAN;
+
+extern bool	_EpTraceEnabled;
+
+extern void	ep_trace_init(		// turn on tracing
+			int nevents);		// ring size per thread
+extern bool	ep_trace_sample(	// maybe start a new trace
+			int one_in_n);		// sampling rate
+extern void	ep_trace_set(		// adopt (or clear) a context
+			uint64_t trace_id,
+			uint64_t span_id);	// parent for new spans
+extern uint64_t	ep_trace_id(void);	// current trace id (or 0)
+extern uint64_t	ep_trace_span_id(void);	// current span id (or 0)
+extern void	ep_trace_instant(	// record a point event
+			const char *cat,
+			const char *name);
+extern int	ep_trace_dump(		// write Chrome JSON; returns count
+			FILE *fp);
+
+extern void	_ep_trace_begin(
+			EP_TRACE_SPAN *sp,
+			const char *cat,
+			const char *name);
+extern void	_ep_trace_end(
+			EP_TRACE_SPAN *sp);
+
+// start a span (a no-op unless this thread has a trace context)
+static inline void
+ep_trace_begin(EP_TRACE_SPAN *sp, const char *cat, const char *name)
+{
+	sp->start = 0;
+	if (__builtin_expect(_EpTraceEnabled, false))
+		_ep_trace_begin(sp, cat, name);
+}
+
+// end a span started with ep_trace_begin
+static inline void
+ep_trace_end(EP_TRACE_SPAN *sp)
+{
+	if (sp->start != 0)
+		_ep_trace_end(sp);
+}
+
+// true if tracing is turned on at all
+#define ep_trace_enabled()	__builtin_expect(_EpTraceEnabled, false)
+
+__END_DECLS
+
+#endif // _EP_TRACE_H_
@@ -190,6 +190,9 @@ extern gdp_datum_t		*gdp_event_getdatum(	// get the datum of the event
 extern void				*gdp_event_getudata(	// get user data (callback only)
 							gdp_event_t *gev);
 
+extern gdp_buf_t		*gdp_event_getcont(		// get read continuation token
+							gdp_event_t *gev);
+
 typedef void			(*gdp_event_cbfunc_t)(	// the callback function
 							gdp_event_t *ev);		// the event triggering the call
 
@@ -277,6 +280,23 @@ extern EP_STAT gdp_gin_read_by_recno_async(
 					gdp_event_cbfunc_t cbfunc,	// callback function
 					void *cbarg);			// argument to cbfunc
 
+// async read based on record number, bounded by bytes
+extern EP_STAT gdp_gin_read_range_async(
+					gdp_gin_t *gin,			// readable GIN handle
+					gdp_recno_t recno,		// starting record number
+					int32_t nrecs,			// number of records to read
+					size_t maxbytes,		// byte budget (0 => none)
+					gdp_event_cbfunc_t cbfunc,	// callback function
+					void *cbarg);			// argument to cbfunc
+
+// resume a budgeted read from a continuation token
+extern EP_STAT gdp_gin_read_resume_async(
+					gdp_gin_t *gin,			// readable GIN handle
+					gdp_buf_t *cont,		// from gdp_event_getcont
+					size_t maxbytes,		// byte budget (0 => none)
+					gdp_event_cbfunc_t cbfunc,	// callback function
+					void *cbarg);			// argument to cbfunc
+
 // synchronous read based on timestamp
 extern EP_STAT gdp_gin_read_by_ts(
 					gdp_gin_t *gin,			// readable GIN handle
@@ -305,6 +325,14 @@ extern EP_STAT gdp_gin_read_by_hash_async(
 					gdp_event_cbfunc_t cbfunc,	// callback function
 					void *cbarg);			// argument to cbfunc
 
+// async read of one record from each of many logs on the same server
+extern EP_STAT gdp_gin_multiread_async(
+					int n_gins,				// number of logs
+					gdp_gin_t **gins,		// readable GIN handles
+					gdp_recno_t *recnos,	// record numbers (<= 0 from end)
+					gdp_event_cbfunc_t cbfunc,	// callback function
+					void *cbarg);			// argument to cbfunc
+
 // subscribe based on record number
 extern EP_STAT	gdp_gin_subscribe_by_recno(
 					gdp_gin_t *gin,			// readable GIN handle
@@ -315,6 +343,16 @@ extern EP_STAT	gdp_gin_subscribe_by_recno(
 											// callback function for next datum
 					void *cbarg);			// argument passed to callback
 
+// subscribe to many logs on the same server with a single lease
+extern EP_STAT	gdp_gin_subscribe_group(
+					int n_gins,				// number of logs
+					gdp_gin_t **gins,		// readable GIN handles
+					gdp_recno_t *starts,	// starting recnos (<= 0 from end)
+					gdp_sub_qos_t *qos,		// quality of service info
+					gdp_event_cbfunc_t cbfunc,
+											// callback function for next datum
+					void *cbarg);			// argument passed to callback
+
 // subscribe based on timestamp
 extern EP_STAT	gdp_gin_subscribe_by_ts(
 					gdp_gin_t *gin,			// readable GIN handle
@@ -347,6 +385,12 @@ extern EP_STAT	gdp_gin_getmetadata(
 					gdp_gin_t *gin,			// GIN handle
 					gdp_md_t **gmdp);		// out-param for metadata
 
+// verify a run of records against a (signed) Merkle checkpoint
+extern EP_STAT	gdp_gin_vrfy_records(
+					gdp_gin_t *gin,			// GIN handle
+					int n,					// number of records
+					gdp_datum_t **datums);	// consecutive records
+
 // set append filter
 extern EP_STAT	gdp_gin_set_append_filter(
 					gdp_gin_t *gin,			// GIN handle
@@ -806,6 +806,63 @@ gdp_gin_read_by_recno_async(
 }
 
 
+/*
+**  GDP_GIN_READ_RANGE_ASYNC --- read a range bounded by a byte budget
+**
+**  The server stops once the records sent would exceed maxbytes
+**  (but always sends at least one).  If it stopped early the
+**  GDP_EVENT_DONE event has status GDP_STAT_READ_BUDGET and
+**  gdp_event_getcont returns a token to pass to
+**  gdp_gin_read_resume_async to get the next page.  The token
+**  belongs to the event; resume before freeing the event or
+**  keep a copy with gdp_buf_dup.
+*/
+
+EP_STAT
+gdp_gin_read_range_async(
+			gdp_gin_t *gin,
+			gdp_recno_t recno,
+			int32_t nrecs,
+			size_t maxbytes,
+			gdp_event_cbfunc_t cbfunc,
+			void *cbarg)
+{
+	EP_STAT estat;
+
+	ep_dbg_cprintf(Dbg, 39, "\n>>> gdp_gin_read_range_async\n");
+	estat = check_and_lock_gin_and_gob(gin, "gdp_gin_read_range_async");
+	EP_STAT_CHECK(estat, return estat);
+	estat = _gdp_gob_read_range_async(gin->gob, gin, recno, nrecs,
+							maxbytes, NULL, cbfunc, cbarg, _GdpChannel);
+	unlock_gin_and_gob(gin, "gdp_gin_read_range_async");
+	prstat(estat, gin, "gdp_gin_read_range_async");
+	return estat;
+}
+
+
+EP_STAT
+gdp_gin_read_resume_async(
+			gdp_gin_t *gin,
+			gdp_buf_t *cont,
+			size_t maxbytes,
+			gdp_event_cbfunc_t cbfunc,
+			void *cbarg)
+{
+	EP_STAT estat;
+
+	if (cont == NULL || gdp_buf_getlength(cont) == 0)
+		return EP_STAT_INVALID_ARG;
+	ep_dbg_cprintf(Dbg, 39, "\n>>> gdp_gin_read_resume_async\n");
+	estat = check_and_lock_gin_and_gob(gin, "gdp_gin_read_resume_async");
+	EP_STAT_CHECK(estat, return estat);
+	estat = _gdp_gob_read_range_async(gin->gob, gin, 0, 0,
+							maxbytes, cont, cbfunc, cbarg, _GdpChannel);
+	unlock_gin_and_gob(gin, "gdp_gin_read_resume_async");
+	prstat(estat, gin, "gdp_gin_read_resume_async");
+	return estat;
+}
+
+
 EP_STAT
 gdp_gin_read_by_ts_async(
 			gdp_gin_t *gin,
@@ -830,6 +887,46 @@ gdp_gin_read_by_hash_async(
 }
 
 
+/*
+**  GDP_GIN_MULTIREAD_ASYNC --- read one record from each of many logs
+**
+**  All the logs must live on the same log server.  One event is
+**  delivered per log (with gdp_event_getgin telling which one),
+**  followed by a single GDP_EVENT_DONE.  A NULL recnos means
+**  "latest" for every log.  The GINs must stay open until the
+**  DONE event.
+**
+**  Requests have to fit in one PDU, so large sets go out in
+**  batches of swarm.gdp.multiread.maxlogs; that doesn't show in
+**  the events.  If the first batch can't be sent this returns the
+**  error and no events are delivered.  If a later one can't, it
+**  returns OK and each log that wasn't sent gets a
+**  GDP_EVENT_FAILURE carrying the error.
+*/
+
+EP_STAT
+gdp_gin_multiread_async(
+			int n_gins,
+			gdp_gin_t **gins,
+			gdp_recno_t *recnos,
+			gdp_event_cbfunc_t cbfunc,
+			void *cbarg)
+{
+	EP_STAT estat;
+
+	ep_dbg_cprintf(Dbg, 39, "\n>>> gdp_gin_multiread_async(%d)\n", n_gins);
+	if (n_gins <= 0 || gins == NULL)
+		return EP_STAT_INVALID_ARG;
+	estat = check_and_lock_gin_and_gob(gins[0], "gdp_gin_multiread_async");
+	EP_STAT_CHECK(estat, return estat);
+	estat = _gdp_gob_multiread(n_gins, gins, recnos, cbfunc, cbarg,
+						_GdpChannel);
+	unlock_gin_and_gob(gins[0], "gdp_gin_multiread_async");
+	prstat(estat, gins[0], "gdp_gin_multiread_async");
+	return estat;
+}
+
+
 #if 0
 // back compat
 EP_STAT
@@ -874,6 +971,42 @@ gdp_gin_subscribe_by_recno(gdp_gin_t *gin,
 }
 
 
+/*
+**	GDP_GIN_SUBSCRIBE_GROUP --- subscribe to many logs at once
+**
+**	All the logs must live on the same log server.  The whole group
+**	is set up with a few PDUs and shares one lease, which is renewed
+**	with a single PDU.  Data arrives as ordinary GDP_EVENT_DATA
+**	events; gdp_event_getgin tells which log it came from.  A NULL
+**	starts means "new records only" for every log.  Unsubscribing
+**	the first GIN ends the whole group; the GINs must stay open
+**	until then.
+*/
+
+EP_STAT
+gdp_gin_subscribe_group(int n_gins,
+		gdp_gin_t **gins,
+		gdp_recno_t *starts,
+		gdp_sub_qos_t *qos,
+		gdp_event_cbfunc_t cbfunc,
+		void *cbarg)
+{
+	EP_STAT estat;
+
+	ep_dbg_cprintf(Dbg, 39, "\n>>> gdp_gin_subscribe_group(%d)\n", n_gins);
+	if (n_gins <= 0 || gins == NULL)
+		return EP_STAT_INVALID_ARG;
+	estat = check_and_lock_gin_and_gob(gins[0], "gdp_gin_subscribe_group");
+	EP_STAT_CHECK(estat, return estat);
+
+	estat = _gdp_gin_subscribe_group(n_gins, gins, starts, cbfunc, cbarg);
+
+	unlock_gin_and_gob(gins[0], "gdp_gin_subscribe_group");
+	prstat(estat, gins[0], "gdp_gin_subscribe_group");
+	return estat;
+}
+
+
 /*
 **	GDP_GIN_SUBSCRIBE_BY_TS --- subscribe to a GOB starting from a timestamp
 */
@@ -960,6 +1093,33 @@ gdp_gin_getmetadata(gdp_gin_t *gin,
 }
 
 
+/*
+**  GDP_GIN_VRFY_RECORDS --- verify records using a Merkle proof
+**
+**		The datums must be a run of consecutive records as returned
+**		by a read.  Returns OK if they are proven to be part of a
+**		checkpoint signed by the log owner, GDP_STAT_MERKLE_UNSIGNED
+**		(a warning) if they match an unsigned checkpoint, and an
+**		error otherwise.
+*/
+
+EP_STAT
+gdp_gin_vrfy_records(gdp_gin_t *gin,
+		int n,
+		gdp_datum_t **datums)
+{
+	EP_STAT estat;
+
+	ep_dbg_cprintf(Dbg, 39, "\n>>> gdp_gin_vrfy_records\n");
+	estat = check_and_lock_gin_and_gob(gin, "gdp_gin_vrfy_records");
+	EP_STAT_CHECK(estat, return estat);
+	estat = _gdp_gob_vrfy_records(gin->gob, n, datums, _GdpChannel, 0);
+	unlock_gin_and_gob(gin, "gdp_gin_vrfy_records");
+	prstat(estat, gin, "gdp_gin_vrfy_records");
+	return estat;
+}
+
+
 /*
 **  GDP_GIN_SET_APPEND_FILTER --- set the append filter function
 */
@@ -32,8 +32,10 @@
 
 #include "gdp.h"
 #include "gdp_buf.h"
+#include "gdp_priv.h"
 
 #include <ep/ep_dbg.h>
+#include <ep/ep_mem.h>
 
 #include <errno.h>
 #include <stdarg.h>
@@ -192,16 +194,171 @@ gdp_buf_getptr(gdp_buf_t *buf, size_t sz)
 /*
 **  Write data to a buffer.
 **		Returns 0 on success, -1 on failure.
+**
+**		A large write into an empty buffer (typically a record
+**		payload) goes into a wire block so that it can be sent
+**		later without another copy.
 */
 
 int
 gdp_buf_write(gdp_buf_t *buf, const void *in, size_t sz)
 {
-	int istat = evbuffer_add(buf, in, sz);
+	int istat;
+
+	if (sz >= GDP_BUF_WBLOCK_MIN && sz <= UINT32_MAX &&
+			evbuffer_get_length(buf) == 0)
+	{
+		uint8_t *wb = _gdp_buf_wblock_new(sz);
+
+		memcpy(wb, in, sz);
+		istat = _gdp_buf_add_wblock(buf, wb, sz);
+		_gdp_buf_wblock_free(wb);
+	}
+	else
+	{
+		istat = evbuffer_add(buf, in, sz);
+	}
 	DIAGNOSE("write", istat);
 	return istat;
 }
 
+/*
+**  Wire blocks.
+**
+**		The header sits just in front of the data.  Every live
+**		wire block is also entered in a small hash table keyed by
+**		its data address, which is how _gdp_buf_is_wblock tells
+**		them from other memory: it compares addresses and never
+**		looks at memory it doesn't already know to be a wire
+**		block.  Once a wire block has been filled in and shared
+**		it must not be changed; libevent never writes into memory
+**		added by reference.
+*/
+
+struct wblock_hdr
+{
+	struct wblock_hdr	*next;			// hash chain
+	uint32_t			refs;			// reference count
+	uint32_t			len;			// length of data
+};
+
+#define WBLOCK_NBUCKETS	256				// power of two
+
+static struct wblock_hdr	*WBlocks[WBLOCK_NBUCKETS];
+static EP_THR_MUTEX			WBlockMutex
+								EP_THR_MUTEX_INITIALIZER2(GDP_MUTEX_LORDER_LEAF);
+
+static struct wblock_hdr **
+wblock_bucket(const void *p)
+{
+	uintptr_t a = (uintptr_t) p;
+
+	return &WBlocks[((a >> 4) ^ (a >> 12)) & (WBLOCK_NBUCKETS - 1)];
+}
+
+uint8_t *
+_gdp_buf_wblock_new(size_t len)
+{
+	struct wblock_hdr *h;
+	struct wblock_hdr **hp;
+
+	EP_ASSERT(len <= UINT32_MAX);
+	h = (struct wblock_hdr *) ep_mem_malloc(sizeof *h + len);
+	h->refs = 1;
+	h->len = (uint32_t) len;
+	hp = wblock_bucket(h + 1);
+	ep_thr_mutex_lock(&WBlockMutex);
+	h->next = *hp;
+	*hp = h;
+	ep_thr_mutex_unlock(&WBlockMutex);
+	return (uint8_t *) (h + 1);
+}
+
+void
+_gdp_buf_wblock_free(uint8_t *p)
+{
+	struct wblock_hdr *h = (struct wblock_hdr *) p - 1;
+	struct wblock_hdr **hp;
+	bool found = false;
+
+	if (__atomic_sub_fetch(&h->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	ep_thr_mutex_lock(&WBlockMutex);
+	for (hp = wblock_bucket(p); *hp != NULL; hp = &(*hp)->next)
+	{
+		if (*hp == h)
+		{
+			*hp = h->next;
+			found = true;
+			break;
+		}
+	}
+	ep_thr_mutex_unlock(&WBlockMutex);
+	EP_ASSERT_ELSE(found, return);
+	ep_mem_free(h);
+}
+
+bool
+_gdp_buf_is_wblock(const void *p, size_t len)
+{
+	struct wblock_hdr *h;
+
+	ep_thr_mutex_lock(&WBlockMutex);
+	for (h = *wblock_bucket(p); h != NULL; h = h->next)
+	{
+		if ((const void *) (h + 1) == p)
+			break;
+	}
+	ep_thr_mutex_unlock(&WBlockMutex);
+	return h != NULL && (len == 0 || h->len == len);
+}
+
+static void
+wblock_cleanup(const void *data, size_t len, void *unused)
+{
+	_gdp_buf_wblock_free((uint8_t *) data);
+}
+
+/*
+**  Add a wire block to a buffer by reference.
+**		The buffer gets its own reference.
+**		Returns 0 on success, -1 on failure.
+*/
+
+int
+_gdp_buf_add_wblock(gdp_buf_t *buf, uint8_t *p, size_t len)
+{
+	struct wblock_hdr *h = (struct wblock_hdr *) p - 1;
+	int istat;
+
+	__atomic_add_fetch(&h->refs, 1, __ATOMIC_RELAXED);
+	istat = evbuffer_add_reference(buf, p, len, &wblock_cleanup, NULL);
+	if (istat < 0)
+		_gdp_buf_wblock_free(p);
+	return istat;
+}
+
+/*
+**  If a buffer holds exactly one whole wire block, return a new
+**  reference to it; otherwise NULL.
+*/
+
+uint8_t *
+_gdp_buf_get_wblock(gdp_buf_t *buf)
+{
+	struct evbuffer_iovec v[2];
+	size_t len = evbuffer_get_length(buf);
+	struct wblock_hdr *h;
+
+	if (len < GDP_BUF_WBLOCK_MIN || evbuffer_peek(buf, -1, NULL, v, 2) != 1)
+		return NULL;
+	if (v[0].iov_len != len || !_gdp_buf_is_wblock(v[0].iov_base, len))
+		return NULL;
+	h = (struct wblock_hdr *) v[0].iov_base - 1;
+	__atomic_add_fetch(&h->refs, 1, __ATOMIC_RELAXED);
+	return (uint8_t *) v[0].iov_base;
+}
+
 /*
 **  Do a "printf" on to the end of a buffer.
 **		Returns the number of bytes added.
@@ -40,11 +40,14 @@
 #include <ep/ep_dbg.h>
 #include <ep/ep_hexdump.h>
 #include <ep/ep_log.h>
+#include <ep/ep_metric.h>
 #include <ep/ep_prflags.h>
 #include <ep/ep_string.h>
 
 #include <errno.h>
+#include <poll.h>
 #include <string.h>
+#include <time.h>
 #include <sys/queue.h>
 #include <sys/signal.h>
 #include <sys/socket.h>
@@ -56,23 +59,107 @@ static EP_DBG	Dbg = EP_DBG_INIT("gdp.chan", "GDP channel processing");
 static EP_DBG	DbgTest1 = EP_DBG_INIT("test.gdp.chan.seqno", "GDP channel seqno randomization test");
 #endif
 
+static EP_METRIC	PdusSent = EP_METRIC_COUNTER_INIT("chan",
+							"pdus_sent_total", "PDUs sent");
+static EP_METRIC	OctetsSent = EP_METRIC_COUNTER_INIT("chan",
+							"octets_sent_total", "Octets sent, including headers");
+EP_METRIC			_GdpOctetsCopied = EP_METRIC_COUNTER_INIT("chan",
+							"octets_copied_total",
+							"Octets copied to build PDUs (vs. sent by reference)");
+static EP_METRIC	SendErrors = EP_METRIC_COUNTER_INIT("chan",
+							"send_errors_total", "PDUs that could not be sent");
+static EP_METRIC	PdusRecv = EP_METRIC_COUNTER_INIT("chan",
+							"pdus_recv_total", "PDUs received");
+static EP_METRIC	OctetsRecv = EP_METRIC_COUNTER_INIT("chan",
+							"octets_recv_total", "Octets received, including headers");
+static EP_METRIC	RecvErrors = EP_METRIC_COUNTER_INIT("chan",
+							"recv_errors_total", "Corrupt or unexpected PDUs received");
+static EP_METRIC	Connects = EP_METRIC_COUNTER_INIT("chan",
+							"connects_total", "Connections made to a router");
+static EP_METRIC	Disconnects = EP_METRIC_COUNTER_INIT("chan",
+							"disconnects_total", "Connections lost");
+static EP_METRIC	StripeFailovers = EP_METRIC_COUNTER_INIT("chan",
+							"stripe_failovers_total",
+							"PDUs sent on other than their usual stripe");
+static EP_METRIC	ConnectTime = EP_METRIC_HISTOGRAM_INIT("chan",
+							"connect_usec", "Time to connect to a router",
+							EpMetricUsecBounds);
+static EP_METRIC	ConnectFailures = EP_METRIC_COUNTER_INIT("chan",
+							"connect_failures_total",
+							"Router addresses that could not be connected to");
+static EP_METRIC	HeaderOctetsSent = EP_METRIC_COUNTER_INIT("chan",
+							"header_octets_sent_total", "PDU header octets sent");
+static EP_METRIC	FlowSetups = EP_METRIC_COUNTER_INIT("chan",
+							"flow_setups_total", "Flow ids bound for sending");
+static EP_METRIC	FlowMisses = EP_METRIC_COUNTER_INIT("chan",
+							"flow_misses_total",
+							"PDUs received with an unknown flow id");
+static EP_METRIC	FlowNaks = EP_METRIC_COUNTER_INIT("chan",
+							"flow_naks_total",
+							"Flow ids rejected by the other end");
+
 // protocol version number in layer 4 (transport) PDU
 #define GDP_CHAN_PROTO_VERSION	4
 
 static struct event_base	*EventBase;
-static EP_STAT				chan_reopen(gdp_chan_t *);
+
+#define GDP_CHAN_MAX_STRIPES	64		// limit on swarm.gdp.chan.stripes
+#define GDP_CHAN_MAX_FLOWS		65536	// flow ids are less than this
 
 /*
 **  Channel internal structure
+**
+**		A channel may be striped over several connections to the
+**		routing layer (swarm.gdp.chan.stripes).  Each PDU goes out
+**		on the stripe chosen by hashing its addresses, so all the
+**		traffic between us and one log stays on one connection and
+**		stays in order.  If that stripe is down the next live one
+**		is used until it comes back.  Input from all stripes goes
+**		to the same callbacks; above this module there is only one
+**		channel.
+**
+**		Each stripe also keeps the flow ids in use on it (see
+**		gdp_chan.h): those we have bound for sending, and those
+**		the other end has bound for us.
 */
 
+struct chan_flow
+{
+	uint64_t				used;			// time of last use (0 = free)
+	gdp_name_t				dst;			// destination address
+	gdp_name_t				src;			// source address
+};
+
+struct chan_stripe
+{
+	gdp_chan_t				*chan;			// the channel we belong to
+	struct bufferevent		*bev;			// associated bufferevent (socket)
+	struct event			*retry_ev;		// reconnect timer (if down)
+	int16_t					state;			// current state of this stripe
+	int16_t					index;			// our index in chan->stripes
+	struct sockaddr_storage	peer;			// router we are connected to
+	socklen_t				peerlen;		// length of peer
+	bool					flows_ok;		// send using flow ids
+	uint64_t				outclock;		// LRU clock for outflows
+	struct chan_flow		*outflows;		// flows we send on (by id)
+	struct chan_flow		*inflows;		// flows we receive on (by id)
+	uint32_t				ninflows;		// size of inflows
+};
+
+static EP_STAT				stripe_reopen(struct chan_stripe *);
+static void					chan_event_cb(struct bufferevent *, short, void *);
+static void					health_update(const struct sockaddr_storage *,
+									socklen_t, bool);
+
 struct gdp_chan
 {
 	EP_THR_MUTEX			mutex;			// data structure lock
 	EP_THR_COND				cond;			// wake up after state change
 	int16_t					state;			// current state of channel
 	uint16_t				flags;			// status flags
-	struct bufferevent		*bev;			// associated bufferevent (socket)
+	int						nstripes;		// number of connections
+	struct chan_stripe		*stripes;		// the connections themselves
+	int						nflows;			// flow table size per stripe
 	char					*router_addr;	// text version of router address
 	gdp_chan_x_t			*cdata;			// arbitrary user data
 
@@ -92,9 +179,12 @@ struct gdp_chan
 #define GDP_CHAN_CLOSING		4		// channel is closing
 
 
-//XXX following needs to be changed if ADDR_FMT != 0
-// magic, hdrlen, type, ttl, seq_mf_foff, fraglen, paylen, dst, src
-#define MIN_HEADER_LENGTH	(1 + 1 + 1 + 1 + 4 + 2 + 2 + 32 + 32)
+// magic, hdrlen, type, ttl, seq_mf_foff, fraglen, paylen
+#define FIXED_HEADER_LENGTH	(1 + 1 + 1 + 1 + 4 + 2 + 2)
+// ... then depending on the address format, flowid and/or dst, src
+#define MIN_HEADER_LENGTH	(FIXED_HEADER_LENGTH + 4)
+#define FULL_HEADER_LENGTH	(FIXED_HEADER_LENGTH + 32 + 32)
+#define FLOWSET_HEADER_LENGTH	(FIXED_HEADER_LENGTH + 4 + 32 + 32)
 #define MAX_HEADER_LENGTH	(255 * 4)
 
 
@@ -110,6 +200,23 @@ _gdp_chan_init(
 	if (evbase == NULL)
 		return EP_STAT_ABORT;
 	EventBase = evbase;
+
+	ep_metric_register(&PdusSent);
+	ep_metric_register(&OctetsSent);
+	ep_metric_register(&_GdpOctetsCopied);
+	ep_metric_register(&SendErrors);
+	ep_metric_register(&PdusRecv);
+	ep_metric_register(&OctetsRecv);
+	ep_metric_register(&RecvErrors);
+	ep_metric_register(&Connects);
+	ep_metric_register(&Disconnects);
+	ep_metric_register(&StripeFailovers);
+	ep_metric_register(&ConnectTime);
+	ep_metric_register(&ConnectFailures);
+	ep_metric_register(&HeaderOctetsSent);
+	ep_metric_register(&FlowSetups);
+	ep_metric_register(&FlowMisses);
+	ep_metric_register(&FlowNaks);
 	return EP_STAT_OK;
 }
 
@@ -131,6 +238,147 @@ _gdp_chan_unlock(gdp_chan_t *chan)
 }
 
 
+/*
+**  Flow id tables
+**
+**		The outgoing table is set associative: an address pair can
+**		go in any of FLOW_WAYS slots starting where it hashes to, and
+**		when they are all taken the least recently used one is
+**		replaced.  The flow id is just the slot number, so replacing
+**		an entry rebinds its id (with a FLOWSET on its next use).
+**
+**		The incoming table is indexed directly by the id the other
+**		end chose and grows as needed, so a binding stays until the
+**		other end replaces it; nothing on this end can make it
+**		forget a live id, whatever either end's swarm.gdp.chan.flows
+**		is.  Ids of GDP_CHAN_MAX_FLOWS or more are refused with a NAK.
+**
+**		The outgoing table is protected by the bufferevent lock,
+**		since binding an id and sending the FLOWSET that announces
+**		it must not be separated.  The incoming table is only used
+**		by the read callback.
+*/
+
+#define FLOW_WAYS			4		// slots an outgoing entry may go in
+
+static void
+flow_reset(struct chan_stripe *st)
+{
+	gdp_chan_t *chan = st->chan;
+
+	if (chan->nflows > 0)
+		memset(st->outflows, 0, chan->nflows * sizeof *st->outflows);
+	if (st->ninflows > 0)
+		memset(st->inflows, 0, st->ninflows * sizeof *st->inflows);
+	st->outclock = 0;
+	st->flows_ok = chan->nflows > 0 &&
+			ep_adm_getboolparam("swarm.gdp.chan.flowid", false);
+}
+
+// find (or make) the outgoing flow for an address pair
+static int
+flow_out(struct chan_stripe *st,
+		const gdp_name_t dst,
+		const gdp_name_t src,
+		bool *newp)
+{
+	gdp_chan_t *chan = st->chan;
+	int nways = chan->nflows < FLOW_WAYS ? chan->nflows : FLOW_WAYS;
+	struct chan_flow *f;
+	uint32_t h = 0;
+	int victim = -1;
+	unsigned int i;
+
+	if (!st->flows_ok || nways == 0)
+		return -1;
+	for (i = 0; i < sizeof (gdp_name_t); i++)
+		h = (h * 31 + dst[i]) * 31 + src[i];
+	for (i = 0; i < (unsigned) nways; i++)
+	{
+		int slot = (h + i) % chan->nflows;
+
+		f = &st->outflows[slot];
+		if (f->used != 0 &&
+				memcmp(f->dst, dst, sizeof f->dst) == 0 &&
+				memcmp(f->src, src, sizeof f->src) == 0)
+		{
+			f->used = ++st->outclock;
+			*newp = false;
+			return slot;
+		}
+		if (victim < 0 || f->used < st->outflows[victim].used)
+			victim = slot;
+	}
+	f = &st->outflows[victim];
+	memcpy(f->dst, dst, sizeof f->dst);
+	memcpy(f->src, src, sizeof f->src);
+	f->used = ++st->outclock;
+	*newp = true;
+	ep_metric_inc(&FlowSetups);
+	return victim;
+}
+
+// find an incoming flow; if dst and src are given, (re)bind it
+static struct chan_flow *
+flow_in(struct chan_stripe *st,
+		uint32_t id,
+		const gdp_name_t dst,
+		const gdp_name_t src)
+{
+	struct chan_flow *f;
+
+	if (id >= GDP_CHAN_MAX_FLOWS)
+		return NULL;
+	if (id >= st->ninflows)
+	{
+		uint32_t n = st->ninflows == 0 ? 64 : st->ninflows;
+
+		if (dst == NULL)
+			return NULL;
+		while (n <= id)
+			n *= 2;
+		st->inflows = (struct chan_flow *) ep_mem_realloc(st->inflows,
+								n * sizeof *st->inflows);
+		memset(&st->inflows[st->ninflows], 0,
+				(n - st->ninflows) * sizeof *st->inflows);
+		st->ninflows = n;
+	}
+	f = &st->inflows[id];
+	if (dst != NULL)
+	{
+		memcpy(f->dst, dst, sizeof f->dst);
+		memcpy(f->src, src, sizeof f->src);
+		f->used = 1;
+	}
+	else if (f->used == 0)
+	{
+		return NULL;
+	}
+	return f;
+}
+
+// tell the other end we do not know one of its flow ids
+static void
+flow_send_nak(struct chan_stripe *st, uint32_t id)
+{
+	char pb[MIN_HEADER_LENGTH];
+	char *pbp = pb;
+
+	PUT8(GDP_CHAN_PROTO_VERSION);		// version number
+	PUT8(MIN_HEADER_LENGTH / 4);		// header length (= 16 / 4)
+	PUT8(GDP_PKT_TYPE_NAK_NOROUTE | GDP_PKT_ADDR_TYPE_FLOWID);
+	PUT8(GDP_TTL_DEFAULT);				// time to live
+	PUT32(0);							// more frag bit, seqno, frag offset
+	PUT16(0);							// length of this fragment
+	PUT16(0);							// length of opaque payload
+	PUT32(id);							// the flow id we don't know
+	if (bufferevent_write(st->bev, pb, sizeof pb) < 0)
+		ep_metric_inc(&SendErrors);
+	else
+		ep_metric_add(&HeaderOctetsSent, sizeof pb);
+}
+
+
 /*
 **  Read and decode fixed PDU header
 **		On return, the header has been consumed from the input but
@@ -140,12 +388,21 @@ _gdp_chan_unlock(gdp_chan_t *chan)
 **			input buffer if the entire payload is not yet in memory.
 **		Returns GDP_STAT_NAK_NOROUTE if the router cannot find a
 **			path to the destination.
+**		Returns GDP_STAT_PDU_FLOW_UNKNOWN if one end did not know
+**			the flow id the other used.  This has been dealt with
+**			and the PDU consumed; there is nothing more to do.
+**		Returns GDP_STAT_PDU_DESYNC if the header makes no sense
+**			(wrong version, impossible lengths, fragments), so we
+**			can't tell where the next PDU starts.  All input has
+**			been thrown away; the connection must be restarted.
 */
 
 static EP_PRFLAGS_DESC	L4Flags[] =
 {
 	// address type portion
 	{ GDP_PKT_ADDR_TYPE_2FULL,	GDP_PKT_ADDR_TYPE_MASK,	"2FULL"			},
+	{ GDP_PKT_ADDR_TYPE_FLOWSET,GDP_PKT_ADDR_TYPE_MASK,	"FLOWSET"		},
+	{ GDP_PKT_ADDR_TYPE_FLOWID,	GDP_PKT_ADDR_TYPE_MASK,	"FLOWID"		},
 
 	// packet type portion
 	{ GDP_PKT_TYPE_REGULAR,		GDP_PKT_TYPE_MASK,		"REGULAR"		},
@@ -164,7 +421,7 @@ static EP_PRFLAGS_DESC	L4Flags[] =
 };
 
 static EP_STAT
-read_header(gdp_chan_t *chan,
+read_header(struct chan_stripe *st,
 		gdp_buf_t *ibuf,
 		gdp_name_t *src,
 		gdp_name_t *dst,
@@ -196,11 +453,7 @@ read_header(gdp_chan_t *chan,
 	{
 		ep_dbg_cprintf(Dbg, 1, "wrong protocol version %d (%d expected)\n",
 				ver, GDP_CHAN_PROTO_VERSION);
-		estat = GDP_STAT_PDU_VERSION_MISMATCH;
-
-		// for lack of anything better, flush the entire input buffer
-		gdp_buf_drain(ibuf, gdp_buf_getlength(ibuf));
-		goto fail0;
+		goto desync;
 	}
 	GET8(hdr_len);			// header length / 4
 	hdr_len &= 0x3F;		// top two bits reserved
@@ -210,13 +463,13 @@ read_header(gdp_chan_t *chan,
 		ep_dbg_cprintf(Dbg, 1,
 				"read_header: short header, need %d got %zd\n",
 				MIN_HEADER_LENGTH, hdr_len);
-		estat = GDP_STAT_PDU_CORRUPT;
-		goto done;
+		goto desync;
 	}
 
 	// if we don't yet have the whole header, wait until we do
 	if (gdp_buf_getlength(ibuf) < hdr_len)
 		return GDP_STAT_KEEP_READING;
+	pbp = gdp_buf_getptr(ibuf, hdr_len) + 2;
 
 	int flags;
 	GET8(flags);			// type of service/flags/address format
@@ -230,21 +483,117 @@ read_header(gdp_chan_t *chan,
 	uint16_t frag_len;
 	GET16(frag_len);		// fragment length
 	GET16(payload_len);		// length of opaque payload (reassembled)
-	if ((flags & GDP_PKT_ADDR_TYPE_MASK) == 0)
+
+	// nobody fragments, so the fragment must be the whole payload;
+	// otherwise we would wait for (or swallow) bytes that aren't ours
+	if ((seq_mf_foff & GDP_PKT_SEQNO_MF) != 0 || frag_off != 0 ||
+			(frag_len != 0 && frag_len != payload_len))
+	{
+		ep_dbg_cprintf(Dbg, 1,
+				"read_header: bad lengths, frag %d@%d%s, payload %zd\n",
+				frag_len, frag_off,
+				(seq_mf_foff & GDP_PKT_SEQNO_MF) != 0 ? "+" : "",
+				payload_len);
+		goto desync;
+	}
+
+	int addr_type = flags & GDP_PKT_ADDR_TYPE_MASK;
+	size_t need_len;
+	uint32_t flowid = 0;
+	switch (addr_type)
+	{
+	case GDP_PKT_ADDR_TYPE_2FULL:
+		need_len = FULL_HEADER_LENGTH;
+		break;
+
+	case GDP_PKT_ADDR_TYPE_FLOWSET:
+		need_len = FLOWSET_HEADER_LENGTH;
+		break;
+
+	case GDP_PKT_ADDR_TYPE_FLOWID:
+		need_len = MIN_HEADER_LENGTH;
+		break;
+
+	default:
+		ep_dbg_cprintf(Dbg, 1,
+				"read_header: unknown address format 0x%02x\n",
+				addr_type);
+		estat = GDP_STAT_PDU_CORRUPT;
+		goto done;
+	}
+	if (hdr_len < need_len)
+	{
+		ep_dbg_cprintf(Dbg, 1,
+				"read_header: short header, need %zd got %zd\n",
+				need_len, hdr_len);
+		estat = GDP_STAT_PDU_CORRUPT;
+		goto done;
+	}
+	if (addr_type != GDP_PKT_ADDR_TYPE_2FULL)
+		GET32(flowid);
+	if (addr_type != GDP_PKT_ADDR_TYPE_FLOWID)
 	{
 		memcpy(dst, pbp, sizeof (gdp_name_t));
 		pbp += sizeof (gdp_name_t);
 		memcpy(src, pbp, sizeof (gdp_name_t));
 		pbp += sizeof (gdp_name_t);
 	}
-	else
+
+	// make sure entire PDU is in memory
+	if (gdp_buf_getlength(ibuf) < hdr_len + payload_len)
+		return GDP_STAT_KEEP_READING;
+
+	// deal with flow ids
+	if (addr_type == GDP_PKT_ADDR_TYPE_FLOWID &&
+			(flags & GDP_PKT_TYPE_MASK) == GDP_PKT_TYPE_NAK_NOROUTE)
 	{
-		ep_dbg_cprintf(Dbg, 1,
-				"read_header: unknown address format 0x%02x\n",
-				flags & GDP_PKT_ADDR_TYPE_MASK);
-		estat = GDP_STAT_PDU_CORRUPT;
+		// other end lost one of our flows; bind it again on next use
+		ep_dbg_cprintf(Dbg, 10, "read_header: flow %" PRIu32 " NAKed\n",
+				flowid);
+		ep_metric_inc(&FlowNaks);
+		if (flowid < (uint32_t) st->chan->nflows)
+		{
+			bufferevent_lock(st->bev);
+			st->outflows[flowid].used = 0;
+			bufferevent_unlock(st->bev);
+		}
+		estat = GDP_STAT_PDU_FLOW_UNKNOWN;
 		goto done;
 	}
+	else if (addr_type == GDP_PKT_ADDR_TYPE_FLOWID)
+	{
+		struct chan_flow *f = flow_in(st, flowid, NULL, NULL);
+
+		if (f == NULL)
+		{
+			ep_dbg_cprintf(Dbg, 10, "read_header: unknown flow %" PRIu32 "\n",
+					flowid);
+			ep_metric_inc(&FlowMisses);
+			flow_send_nak(st, flowid);
+			estat = GDP_STAT_PDU_FLOW_UNKNOWN;
+			goto done;
+		}
+		memcpy(dst, f->dst, sizeof (gdp_name_t));
+		memcpy(src, f->src, sizeof (gdp_name_t));
+	}
+	else if (addr_type == GDP_PKT_ADDR_TYPE_FLOWSET)
+	{
+		// this one has full addresses, so it is delivered regardless
+		if (flow_in(st, flowid, *dst, *src) == NULL)
+		{
+			ep_dbg_cprintf(Dbg, 10, "read_header: flow %" PRIu32
+					" out of range\n", flowid);
+			ep_metric_inc(&FlowMisses);
+			flow_send_nak(st, flowid);
+		}
+		if (!st->flows_ok && st->chan->nflows > 0)
+		{
+			// the other end knows about flow ids, so we can use them
+			bufferevent_lock(st->bev);
+			st->flows_ok = true;
+			bufferevent_unlock(st->bev);
+		}
+	}
 
 #if GDP_EXTREME_TESTS
 	if (ep_dbg_test(DbgTest1, 102))
@@ -295,14 +644,10 @@ read_header(gdp_chan_t *chan,
 		goto done;
 	}
 
-	// XXX check for rational payload_len here? XXX
-
-	// make sure entire PDU is in memory
-	if (gdp_buf_getlength(ibuf) < hdr_len + payload_len)
-		return GDP_STAT_KEEP_READING;
-
 	// consume the header, but leave the payload
 	gdp_buf_drain(ibuf, hdr_len);
+	ep_metric_inc(&PdusRecv);
+	ep_metric_add(&OctetsRecv, hdr_len + payload_len);
 
 done:
 	if (EP_STAT_ISOK(estat))
@@ -314,10 +659,22 @@ done:
 	{
 		ep_dbg_cprintf(Dbg, 19, "read_header: draining %zd on error\n",
 						hdr_len + payload_len);
+		if (!EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOROUTE) &&
+				!EP_STAT_IS_SAME(estat, GDP_STAT_PDU_FLOW_UNKNOWN))
+			ep_metric_inc(&RecvErrors);
 		gdp_buf_drain(ibuf, hdr_len + payload_len);
 		payload_len = 0;
 	}
 
+	goto fail0;
+
+desync:
+	// we've lost our place in the stream; throw it all away
+	estat = GDP_STAT_PDU_DESYNC;
+	gdp_buf_drain(ibuf, gdp_buf_getlength(ibuf));
+	ep_metric_inc(&RecvErrors);
+	payload_len = 0;
+
 fail0:
 	{
 		char ebuf[100];
@@ -349,25 +706,39 @@ chan_read_cb(struct bufferevent *bev, void *ctx)
 {
 	EP_STAT estat;
 	gdp_buf_t *ibuf = GDP_BUF_FROM_EVBUFFER(bufferevent_get_input(bev));
-	gdp_chan_t *chan = (gdp_chan_t *) ctx;
+	struct chan_stripe *st = (struct chan_stripe *) ctx;
+	gdp_chan_t *chan = st->chan;
 	gdp_name_t src, dst;
 	gdp_seqno_t seqno = 0;
 
 	ep_dbg_cprintf(Dbg, 50, "chan_read_cb: fd %d, %zd bytes\n",
 			bufferevent_getfd(bev), gdp_buf_getlength(ibuf));
 
-	EP_ASSERT(bev == chan->bev);
+	EP_ASSERT(bev == st->bev);
 
 	while (gdp_buf_getlength(ibuf) >= MIN_HEADER_LENGTH)
 	{
 		// get the transport layer header
 		size_t payload_len;
-		estat = read_header(chan, ibuf, &src, &dst, &seqno, &payload_len);
+		estat = read_header(st, ibuf, &src, &dst, &seqno, &payload_len);
 
 		// if we don't have enough input, wait for more (we'll be called again)
 		if (EP_STAT_IS_SAME(estat, GDP_STAT_KEEP_READING))
 			break;
 
+		// flow id trouble has already been taken care of
+		if (EP_STAT_IS_SAME(estat, GDP_STAT_PDU_FLOW_UNKNOWN))
+			continue;
+
+		// the rest of the input can't be trusted; start over
+		if (EP_STAT_IS_SAME(estat, GDP_STAT_PDU_DESYNC))
+		{
+			ep_dbg_cprintf(Dbg, 1,
+					"chan_read_cb: lost PDU framing, reconnecting\n");
+			chan_event_cb(bev, BEV_EVENT_ERROR, st);
+			return;
+		}
+
 		if (!EP_STAT_ISOK(estat))
 		{
 			// deliver routing error to upper level
@@ -426,11 +797,42 @@ static EP_PRFLAGS_DESC	EventWhatFlags[] =
 	{ 0, 0, NULL }
 };
 
+// number of stripes that are up
+static int
+live_stripes(gdp_chan_t *chan)
+{
+	int i;
+	int n = 0;
+
+	for (i = 0; i < chan->nstripes; i++)
+		if (chan->stripes[i].state == GDP_CHAN_CONNECTED)
+			n++;
+	return n;
+}
+
+// try to bring a dead stripe back (timer callback)
+static void
+stripe_retry_cb(evutil_socket_t unused, short what, void *ctx)
+{
+	struct chan_stripe *st = (struct chan_stripe *) ctx;
+	EP_STAT estat;
+
+	estat = stripe_reopen(st);
+	if (!EP_STAT_ISOK(estat))
+	{
+		long delay = ep_adm_getlongparam("swarm.gdp.reconnect.delay", 1000L);
+		struct timeval tv = { delay / 1000, (delay % 1000) * 1000 };
+
+		evtimer_add(st->retry_ev, &tv);
+	}
+}
+
 static void
 chan_event_cb(struct bufferevent *bev, short events, void *ctx)
 {
 	bool restart_connection = false;
-	gdp_chan_t *chan = (gdp_chan_t *) ctx;
+	struct chan_stripe *st = (struct chan_stripe *) ctx;
+	gdp_chan_t *chan = st->chan;
 	uint32_t cbflags = 0;
 
 	if (ep_dbg_test(Dbg, 10))
@@ -443,20 +845,21 @@ chan_event_cb(struct bufferevent *bev, short events, void *ctx)
 				sockerr, evutil_socket_error_to_string(sockerr));
 	}
 
-	EP_ASSERT(bev == chan->bev);
+	EP_ASSERT(bev == st->bev);
 
 	if (EP_UT_BITSET(BEV_EVENT_CONNECTED, events))
 	{
 		// sometimes libevent says we're connected when we're not
 		if (EVUTIL_SOCKET_ERROR() == ECONNREFUSED)
 		{
-			chan->state = GDP_CHAN_ERROR;
+			st->state = GDP_CHAN_ERROR;
 			cbflags |= GDP_IOEVENT_ERROR;
 		}
 		else
 		{
-			chan->state = GDP_CHAN_CONNECTED;
+			st->state = GDP_CHAN_CONNECTED;
 			cbflags |= GDP_IOEVENT_CONNECTED;
+			ep_metric_inc(&Connects);
 		}
 		ep_thr_cond_broadcast(&chan->cond);
 	}
@@ -469,6 +872,7 @@ chan_event_cb(struct bufferevent *bev, short events, void *ctx)
 					getpid(), l);
 		cbflags |= GDP_IOEVENT_EOF;
 		restart_connection = true;
+		ep_metric_inc(&Disconnects);
 	}
 	if (EP_UT_BITSET(BEV_EVENT_ERROR, events))
 	{
@@ -487,21 +891,37 @@ chan_event_cb(struct bufferevent *bev, short events, void *ctx)
 	if (restart_connection)
 	{
 		EP_STAT estat;
+		long delay = ep_adm_getlongparam("swarm.gdp.reconnect.delay", 1000L);
 
-		chan->state = GDP_CHAN_ERROR;
+		st->state = GDP_CHAN_ERROR;
 		ep_thr_cond_broadcast(&chan->cond);
 
-		do
+		// try other routers before this one next time
+		health_update(&st->peer, st->peerlen, false);
+		st->peerlen = 0;
+		if (live_stripes(chan) > 0)
+		{
+			// others can carry our traffic; retry without blocking them
+			struct timeval tv = { delay / 1000, (delay % 1000) * 1000 };
+
+			if (st->bev != NULL)
+				bufferevent_free(st->bev);
+			st->bev = NULL;
+			evtimer_add(st->retry_ev, &tv);
+			return;
+		}
+		// nothing else is up: retry at once, since the first try
+		// will probably go to another router
+		while (!EP_STAT_ISOK(estat = stripe_reopen(st)))
 		{
-			long delay = ep_adm_getlongparam("swarm.gdp.reconnect.delay", 1000L);
 			if (delay > 0)
 				ep_time_nanosleep(delay * INT64_C(1000000));
-			estat = chan_reopen(chan);
-		} while (!EP_STAT_ISOK(estat));
+		}
 	}
 
-	if (chan->state == GDP_CHAN_CONNECTED)
-		(*chan->advert_cb)(chan, GDP_CMD_ADVERTISE, ctx);
+	if (EP_UT_BITSET(BEV_EVENT_CONNECTED, events) &&
+			st->state == GDP_CHAN_CONNECTED)
+		(*chan->advert_cb)(chan, GDP_CMD_ADVERTISE, chan);
 }
 
 
@@ -512,6 +932,8 @@ chan_event_cb(struct bufferevent *bev, short events, void *ctx)
 static EP_STAT
 chan_do_close(gdp_chan_t *chan, int what)
 {
+	int i;
+
 	if (ep_dbg_test(Dbg, 7))
 	{
 		ep_dbg_printf("chan_do_close(%p)\n    ", chan);
@@ -524,9 +946,20 @@ chan_do_close(gdp_chan_t *chan, int what)
 	ep_thr_cond_broadcast(&chan->cond);
 	if (chan->ioevent_cb != NULL)
 		(*chan->ioevent_cb)(chan, what);
-	if (chan->bev != NULL)
-		bufferevent_free(chan->bev);
-	chan->bev = NULL;
+	for (i = 0; i < chan->nstripes; i++)
+	{
+		struct chan_stripe *st = &chan->stripes[i];
+
+		if (st->retry_ev != NULL)
+			event_free(st->retry_ev);
+		if (st->bev != NULL)
+			bufferevent_free(st->bev);
+		if (st->outflows != NULL)
+			ep_mem_free(st->outflows);
+		if (st->inflows != NULL)
+			ep_mem_free(st->inflows);
+	}
+	ep_mem_free(chan->stripes);
 	if (chan->router_addr != NULL)
 		ep_mem_free(chan->router_addr);
 	ep_thr_cond_destroy(&chan->cond);
@@ -537,17 +970,412 @@ chan_do_close(gdp_chan_t *chan, int what)
 
 
 /*
-**	_GDP_CHAN_OPEN_HELPER --- open channel to the routing layer
+**  ROTATE_ADDRS --- start an address list at its n'th entry
+**
+**		Lets stripes be spread over several routers: each one
+**		prefers a different router but still falls back to the
+**		others.
+*/
+
+static void
+rotate_addrs(char *abuf, size_t bsize, int n)
+{
+	char tbuf[500];
+	char *p = abuf;
+	int naddrs = 1;
+
+	for (p = abuf; (p = strchr(p, ';')) != NULL; p++)
+		naddrs++;
+	if (abuf[strlen(abuf) - 1] == ';')
+		naddrs--;						// trailing delimiter
+	n %= naddrs;
+	for (p = abuf; n > 0 && p != NULL; n--)
+	{
+		p = strchr(p, ';');
+		if (p != NULL)
+			p++;
+	}
+	if (p == NULL || p == abuf)
+		return;
+	strlcpy(tbuf, p, sizeof tbuf);
+	if (tbuf[0] != '\0' && tbuf[strlen(tbuf) - 1] != ';')
+		strlcat(tbuf, ";", sizeof tbuf);
+	p[0] = '\0';
+	strlcat(tbuf, abuf, sizeof tbuf);
+	strlcpy(abuf, tbuf, bsize);
+}
+
+
+/*
+**  Connecting to the routing layer
+**
+**		Every address of every entry in the router list is a
+**		candidate.  Connects are non-blocking and raced in the
+**		"happy eyeballs" style: the first candidate is started,
+**		and if it hasn't answered within swarm.gdp.connect.stagger
+**		milliseconds (or as soon as it fails) the next is started
+**		as well, without giving up on the first.  Whichever gets
+**		there first wins and the others are closed.  A dead or
+**		black-holed router thus costs one stagger interval rather
+**		than a full TCP connect timeout.  The whole race is bounded
+**		by swarm.gdp.connect.timeout.
+**
+**		How each router address has fared is remembered, and
+**		candidates that have failed recently are tried after those
+**		that have not.  Otherwise the configured order is kept.
+*/
+
+#define MAX_CANDIDATES		32		// addresses considered per connect
+#define MAX_HEALTH			64		// router addresses remembered
+
+struct chan_cand
+{
+	struct sockaddr_storage	addr;		// address to connect to
+	socklen_t				addrlen;	// length of addr
+	int						order;		// position in the router list
+	int						nfails;		// recent failures (for ordering)
+	int64_t					start;		// when the connect started (usec)
+	char					label[80];	// host:port for messages
+};
+
+static struct router_health
+{
+	struct sockaddr_storage	addr;
+	socklen_t				addrlen;
+	int						nfails;		// failures since last success
+	int64_t					last_fail;	// time of last failure (usec)
+}						RouterHealth[MAX_HEALTH];
+static int				NRouterHealth;
+static EP_THR_MUTEX		RouterHealthMutex
+								EP_THR_MUTEX_INITIALIZER2(GDP_MUTEX_LORDER_LEAF);
+
+// monotonic time in microseconds
+static int64_t
+mono_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// find (or make) the health record for an address; must be locked
+static struct router_health *
+health_find(const struct sockaddr_storage *addr, socklen_t addrlen, bool create)
+{
+	struct router_health *h;
+	int i;
+
+	for (i = 0; i < NRouterHealth; i++)
+	{
+		h = &RouterHealth[i];
+		if (h->addrlen == addrlen && memcmp(&h->addr, addr, addrlen) == 0)
+			return h;
+	}
+	if (!create)
+		return NULL;
+	if (NRouterHealth < MAX_HEALTH)
+		h = &RouterHealth[NRouterHealth++];
+	else
+		h = &RouterHealth[random() % MAX_HEALTH];	// forget someone
+	memset(h, 0, sizeof *h);
+	memcpy(&h->addr, addr, addrlen);
+	h->addrlen = addrlen;
+	return h;
+}
+
+static void
+health_update(const struct sockaddr_storage *addr, socklen_t addrlen, bool ok)
+{
+	struct router_health *h;
+
+	if (addrlen == 0)
+		return;
+	ep_thr_mutex_lock(&RouterHealthMutex);
+	h = health_find(addr, addrlen, !ok);
+	if (h != NULL)
+	{
+		if (ok)
+			h->nfails = 0;
+		else
+		{
+			h->nfails++;
+			h->last_fail = mono_usec();
+		}
+	}
+	ep_thr_mutex_unlock(&RouterHealthMutex);
+}
+
+static int
+cand_cmp(const void *a_, const void *b_)
+{
+	const struct chan_cand *a = (const struct chan_cand *) a_;
+	const struct chan_cand *b = (const struct chan_cand *) b_;
+
+	if (a->nfails != b->nfails)
+		return a->nfails - b->nfails;
+	return a->order - b->order;
+}
+
+// sort candidates so those that have failed recently come last
+static void
+health_order(struct chan_cand *cands, int ncands)
+{
+	int64_t forget = ep_adm_getlongparam("swarm.gdp.router.health.forget",
+								60) * INT64_C(1000000);
+	int64_t now = mono_usec();
+	int i;
+
+	ep_thr_mutex_lock(&RouterHealthMutex);
+	for (i = 0; i < ncands; i++)
+	{
+		struct router_health *h = health_find(&cands[i].addr,
+											cands[i].addrlen, false);
+
+		if (h != NULL && now - h->last_fail < forget)
+			cands[i].nfails = h->nfails;
+	}
+	ep_thr_mutex_unlock(&RouterHealthMutex);
+	qsort(cands, ncands, sizeof *cands, &cand_cmp);
+}
+
+
+static void
+cand_failed(const struct chan_cand *c)
+{
+	ep_metric_inc(&ConnectFailures);
+	health_update(&c->addr, c->addrlen, false);
+}
+
+
+/*
+**  RACE_CONNECT --- connect to the first candidate that answers
+**
+**		Returns the connected (non-blocking) socket and its index
+**		in cands, or -1 with the reason in *estatp.
+*/
+
+static evutil_socket_t
+race_connect(struct chan_cand *cands, int ncands, int *winp, EP_STAT *estatp)
+{
+	struct pollfd pfds[MAX_CANDIDATES];
+	int pcand[MAX_CANDIDATES];			// candidate for each pollfd
+	int npfds = 0;
+	int next = 0;						// next candidate to start
+	int64_t stagger;
+	int64_t deadline;
+	int64_t next_start;
+	evutil_socket_t winner = -1;
+	int i;
+
+	stagger = ep_adm_getlongparam("swarm.gdp.connect.stagger", 250) * 1000;
+	deadline = mono_usec() +
+			ep_adm_getlongparam("swarm.gdp.connect.timeout", 10000) * 1000;
+	next_start = 0;
+	*estatp = GDP_STAT_NOTFOUND;
+
+	while (winner < 0)
+	{
+		int64_t now = mono_usec();
+		int64_t wait;
+
+		// start another candidate if it's time
+		if (next < ncands && now >= next_start)
+		{
+			struct chan_cand *c = &cands[next];
+			evutil_socket_t sock;
+
+			ep_dbg_cprintf(Dbg, 1, "Trying %s\n", c->label);
+			c->start = now;
+			sock = socket(c->addr.ss_family, SOCK_STREAM, 0);
+			if (sock < 0)
+			{
+				// bad news, but keep trying
+				*estatp = ep_stat_from_errno(errno);
+				ep_log(*estatp, "chan_open_helper: cannot create socket");
+				next++;
+				continue;
+			}
+			evutil_make_socket_nonblocking(sock);
+
+			// shall we disable Nagle algorithm?
+			if (ep_adm_getboolparam("swarm.gdp.tcp.nodelay", false))
+			{
+				int enable = 1;
+				if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
+							(void *) &enable, sizeof enable) != 0)
+				{
+					ep_log(ep_stat_from_errno(errno),
+							"chan_open_helper: cannot set TCP_NODELAY");
+					// error not fatal, let's just go on
+				}
+			}
+			if (connect(sock, (struct sockaddr *) &c->addr, c->addrlen) == 0)
+			{
+				*winp = next;
+				winner = sock;
+				break;
+			}
+			else if (errno != EINPROGRESS)
+			{
+				// connection failure; go straight on to the next one
+				*estatp = ep_stat_from_errno(errno);
+				ep_dbg_cprintf(Dbg, 38,
+						"chan_open_helper[%d]: connect %s failed: %s\n",
+						getpid(), c->label, strerror(errno));
+				cand_failed(c);
+				close(sock);
+				next++;
+				continue;
+			}
+			pfds[npfds].fd = sock;
+			pfds[npfds].events = POLLOUT;
+			pfds[npfds].revents = 0;
+			pcand[npfds++] = next++;
+			next_start = now + stagger;
+		}
+
+		if (npfds == 0 && next >= ncands)
+			break;						// nothing left to try
+		if (now >= deadline)
+		{
+			*estatp = ep_stat_from_errno(ETIMEDOUT);
+			break;
+		}
+
+		// wait for something to answer (or time to start another)
+		wait = deadline - now;
+		if (next < ncands && next_start - now < wait)
+			wait = next_start - now;
+		if (npfds == 0 || wait < 0)
+			wait = 0;
+		if (poll(pfds, npfds, (int) ((wait + 999) / 1000)) < 0 &&
+				errno != EINTR)
+		{
+			*estatp = ep_stat_from_errno(errno);
+			break;
+		}
+
+		for (i = 0; i < npfds && winner < 0; )
+		{
+			struct chan_cand *c = &cands[pcand[i]];
+			int err = 0;
+			socklen_t errlen = sizeof err;
+
+			if (pfds[i].revents == 0)
+			{
+				i++;
+				continue;
+			}
+			if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR,
+						(void *) &err, &errlen) < 0)
+				err = errno;
+			if (err == 0)
+			{
+				*winp = pcand[i];
+				winner = pfds[i].fd;
+				pfds[i] = pfds[--npfds];
+				pcand[i] = pcand[npfds];
+				break;
+			}
+
+			// this one failed; don't wait to start the next
+			*estatp = ep_stat_from_errno(err);
+			ep_dbg_cprintf(Dbg, 38,
+					"chan_open_helper[%d]: connect %s failed: %s\n",
+					getpid(), c->label, strerror(err));
+			cand_failed(c);
+			close(pfds[i].fd);
+			pfds[i] = pfds[--npfds];
+			pcand[i] = pcand[npfds];
+			next_start = 0;
+		}
+	}
+
+	// the losers; those that were outrun by a full stagger count as failed
+	for (i = 0; i < npfds; i++)
+	{
+		if (winner < 0 || mono_usec() - cands[pcand[i]].start >= stagger)
+			cand_failed(&cands[pcand[i]]);
+		close(pfds[i].fd);
+	}
+	if (winner >= 0)
+	{
+		health_update(&cands[*winp].addr, cands[*winp].addrlen, true);
+		ep_metric_observe(&ConnectTime, mono_usec() - cands[*winp].start);
+	}
+	return winner;
+}
+
+
+/*
+**  SET_KEEPALIVE --- probe an idle connection so we notice it dying
+**
+**		A router that vanishes without closing the connection would
+**		otherwise not be noticed until we next send something (and
+**		then only after the retransmit timeout).  With these
+**		settings it is noticed within idle + interval * count
+**		seconds either way.
+*/
+
+static void
+set_keepalive(evutil_socket_t sock)
+{
+	int idle = ep_adm_getintparam("swarm.gdp.tcp.keepalive.idle", 10);
+	int intvl = ep_adm_getintparam("swarm.gdp.tcp.keepalive.interval", 2);
+	int cnt = ep_adm_getintparam("swarm.gdp.tcp.keepalive.count", 3);
+	int on = 1;
+
+	if (idle <= 0)
+		return;
+	if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (void *) &on, sizeof on) != 0)
+	{
+		ep_dbg_cprintf(Dbg, 1, "set_keepalive: SO_KEEPALIVE: %s\n",
+				strerror(errno));
+		return;
+	}
+#ifdef TCP_KEEPIDLE
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE,
+				(void *) &idle, sizeof idle);
+#elif defined(TCP_KEEPALIVE)
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_KEEPALIVE,
+				(void *) &idle, sizeof idle);
+#endif
+#ifdef TCP_KEEPINTVL
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL,
+				(void *) &intvl, sizeof intvl);
+#endif
+#ifdef TCP_KEEPCNT
+	(void) setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT,
+				(void *) &cnt, sizeof cnt);
+#endif
+#ifdef TCP_USER_TIMEOUT
+	{
+		// same bound for data that is never acknowledged
+		unsigned int ms = (idle + intvl * cnt) * 1000;
+
+		(void) setsockopt(sock, IPPROTO_TCP, TCP_USER_TIMEOUT,
+					(void *) &ms, sizeof ms);
+	}
+#endif
+}
+
+
+/*
+**	_GDP_CHAN_OPEN_HELPER --- open one stripe to the routing layer
 */
 
 static EP_STAT
 chan_open_helper(
 		gdp_chan_t *chan,
-		void *adata)
+		struct chan_stripe *st)
 {
 	EP_STAT estat = EP_STAT_OK;
 	char abuf[500] = "";
 	char *port = NULL;		// keep gcc happy
+	struct chan_cand cands[MAX_CANDIDATES];
+	int ncands = 0;
+	const char *winner = NULL;
 
 	// attach to a socket
 	char *host;
@@ -598,10 +1426,13 @@ chan_open_helper(
 				ep_adm_getstrparam("swarm.gdp.routers", "127.0.0.1"),
 				sizeof abuf);
 	}
+	if (st->index > 0 && abuf[0] != '\0' &&
+			ep_adm_getboolparam("swarm.gdp.chan.stripes.spread", false))
+		rotate_addrs(abuf, sizeof abuf, st->index);
 
-	ep_dbg_cprintf(Dbg, 28, "chan_open_helper(%s)\n", abuf);
+	ep_dbg_cprintf(Dbg, 28, "chan_open_helper[%d](%s)\n", st->index, abuf);
 
-	// strip off addresses and try them
+	// strip off addresses and look them up
 	estat = GDP_STAT_NOTFOUND;				// anything that is not OK
 	{
 		char *delim = abuf;
@@ -618,8 +1449,6 @@ chan_open_helper(
 			if (*host == '\0')
 				continue;						// empty spec
 
-			ep_dbg_cprintf(Dbg, 1, "Trying %s\n", host);
-
 			port = host;
 			if (*host == '[')
 			{
@@ -648,7 +1477,7 @@ chan_open_helper(
 				port = pbuf;
 			}
 
-			ep_dbg_cprintf(Dbg, 20, "chan_open_helper: trying host %s port %s\n",
+			ep_dbg_cprintf(Dbg, 20, "chan_open_helper: looking up host %s port %s\n",
 					host, port);
 
 			// parsing done....  let's try the lookup
@@ -685,86 +1514,71 @@ chan_open_helper(
 				continue;
 			}
 
-			// attempt connects on all available addresses
-			_gdp_chan_lock(chan);
-			for (a = res; a != NULL; a = a->ai_next)
+			// every address is a candidate
+			for (a = res; a != NULL && ncands < MAX_CANDIDATES; a = a->ai_next)
 			{
-				// make the actual connection
-				// it would be nice to have a private timeout here...
-				evutil_socket_t sock = socket(a->ai_family, SOCK_STREAM, 0);
-				if (sock < 0)
-				{
-					// bad news, but keep trying
-					estat = ep_stat_from_errno(errno);
-					ep_log(estat, "chan_open_helper: cannot create socket");
-					continue;
-				}
+				struct chan_cand *c = &cands[ncands];
 
-				// shall we disable Nagle algorithm?
-				if (ep_adm_getboolparam("swarm.gdp.tcp.nodelay", false))
-				{
-					int enable = 1;
-					if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY,
-								(void *) &enable, sizeof enable) != 0)
-					{
-						estat = ep_stat_from_errno(errno);
-						ep_log(estat, "chan_open_helper: cannot set TCP_NODELAY");
-						// error not fatal, let's just go on
-					}
-				}
-				if (connect(sock, a->ai_addr, a->ai_addrlen) < 0)
-				{
-					// connection failure
-					estat = ep_stat_from_errno(errno);
-					ep_dbg_cprintf(Dbg, 38,
-							"chan_open_helper[%d]: connect failed: %s\n",
-							getpid(), strerror(errno));
-					close(sock);
+				if (a->ai_addrlen > sizeof c->addr)
 					continue;
-				}
-
-				// success!  Make it non-blocking and associate with bufferevent
-				ep_dbg_cprintf(Dbg, 39, "successful connect\n");
-				estat = EP_STAT_OK;
-
-				evutil_make_socket_nonblocking(sock);
-				chan->bev = bufferevent_socket_new(EventBase, sock,
-								BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE |
-								BEV_OPT_DEFER_CALLBACKS |
-								BEV_OPT_UNLOCK_CALLBACKS);
-				bufferevent_setcb(chan->bev,
-								chan_read_cb, NULL, chan_event_cb, chan);
-				bufferevent_setwatermark(chan->bev,
-								EV_READ, MIN_HEADER_LENGTH, 0);
-				bufferevent_enable(chan->bev, EV_READ | EV_WRITE);
-
-				// disable SIGPIPE so that we'll get an error instead of death
-#ifdef SO_NOSIGPIPE
-				int sockopt_set = 1;
-				setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE,
-						(void *) &sockopt_set, sizeof sockopt_set);
-#else
-				if (ep_adm_getboolparam("swarm.gdp.ignore.sigpipe", false))
-				{
-					// It isn't clear you want to do this, since this may
-					// cause stdout writes to dead pipes to keep going in
-					// programs that are not fastidious about error checking.
-					// (Most programs do not check e.g., printf for error.)
-					signal(SIGPIPE, SIG_IGN);
-				}
-#endif
-				break;
+				memset(c, 0, sizeof *c);
+				memcpy(&c->addr, a->ai_addr, a->ai_addrlen);
+				c->addrlen = a->ai_addrlen;
+				c->order = ncands++;
+				snprintf(c->label, sizeof c->label, "%s:%s", host, port);
 			}
-
-			_gdp_chan_unlock(chan);
 			freeaddrinfo(res);
+		} while (delim != NULL);
+	}
+
+	// race the candidates, healthiest first
+	if (ncands > 0)
+	{
+		evutil_socket_t sock;
+		int w;
 
-			if (EP_STAT_ISOK(estat))
+		health_order(cands, ncands);
+		_gdp_chan_lock(chan);
+		sock = race_connect(cands, ncands, &w, &estat);
+		if (sock >= 0)
+		{
+			// success!  Associate with bufferevent
+			ep_dbg_cprintf(Dbg, 39, "successful connect\n");
+			estat = EP_STAT_OK;
+			winner = cands[w].label;
+			memcpy(&st->peer, &cands[w].addr, cands[w].addrlen);
+			st->peerlen = cands[w].addrlen;
+
+			set_keepalive(sock);
+			flow_reset(st);				// new connection, no flows yet
+			st->bev = bufferevent_socket_new(EventBase, sock,
+							BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE |
+							BEV_OPT_DEFER_CALLBACKS |
+							BEV_OPT_UNLOCK_CALLBACKS);
+			bufferevent_setcb(st->bev,
+							chan_read_cb, NULL, chan_event_cb, st);
+			bufferevent_setwatermark(st->bev,
+							EV_READ, MIN_HEADER_LENGTH, 0);
+			bufferevent_enable(st->bev, EV_READ | EV_WRITE);
+			st->state = GDP_CHAN_CONNECTED;
+
+			// disable SIGPIPE so that we'll get an error instead of death
+#ifdef SO_NOSIGPIPE
+			int sockopt_set = 1;
+			setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE,
+					(void *) &sockopt_set, sizeof sockopt_set);
+#else
+			if (ep_adm_getboolparam("swarm.gdp.ignore.sigpipe", false))
 			{
-				// success
-				break;
+				// It isn't clear you want to do this, since this may
+				// cause stdout writes to dead pipes to keep going in
+				// programs that are not fastidious about error checking.
+				// (Most programs do not check e.g., printf for error.)
+				signal(SIGPIPE, SIG_IGN);
 			}
-		} while (delim != NULL);
+#endif
+		}
+		_gdp_chan_unlock(chan);
 	}
 
 	// error cleanup and return
@@ -781,9 +1595,8 @@ chan_open_helper(
 	else
 	{
 		ep_dbg_cprintf(Dbg, 1,
-					"chan_open_helper[%d]: talking to router at %s:%s\n",
-					getpid(), host, port);
-		(*chan->advert_cb)(chan, GDP_CMD_ADVERTISE, adata);
+					"chan_open_helper[%d]: stripe %d talking to router at %s\n",
+					getpid(), st->index, winner);
 	}
 	return estat;
 }
@@ -805,8 +1618,10 @@ _gdp_chan_open(
 		gdp_chan_x_t *cdata,
 		gdp_chan_t **pchan)
 {
-	EP_STAT estat;
+	EP_STAT estat = EP_STAT_OK;
 	gdp_chan_t *chan;
+	bool connected = false;
+	int i;
 
 	ep_dbg_cprintf(Dbg, 11, "_gdp_chan_open(%s)\n", router_addr);
 
@@ -824,11 +1639,54 @@ _gdp_chan_open(
 	chan->cdata = cdata;
 	if (router_addr != NULL)
 		chan->router_addr = ep_mem_strdup(router_addr);
+	chan->nstripes = ep_adm_getintparam("swarm.gdp.chan.stripes", 1);
+	if (chan->nstripes < 1)
+		chan->nstripes = 1;
+	else if (chan->nstripes > GDP_CHAN_MAX_STRIPES)
+		chan->nstripes = GDP_CHAN_MAX_STRIPES;
+	chan->stripes = (struct chan_stripe *)
+				ep_mem_zalloc(chan->nstripes * sizeof *chan->stripes);
+	chan->nflows = ep_adm_getintparam("swarm.gdp.chan.flows", 256);
+	if (chan->nflows < 0)
+		chan->nflows = 0;
+	else if (chan->nflows > GDP_CHAN_MAX_FLOWS)
+		chan->nflows = GDP_CHAN_MAX_FLOWS;
+
+	// we are open if any stripe is; the others keep trying
+	for (i = 0; i < chan->nstripes; i++)
+	{
+		struct chan_stripe *st = &chan->stripes[i];
+		EP_STAT stat;
+
+		st->chan = chan;
+		st->index = i;
+		st->state = GDP_CHAN_CONNECTING;
+		st->retry_ev = evtimer_new(EventBase, &stripe_retry_cb, st);
+		if (chan->nflows > 0)
+			st->outflows = (struct chan_flow *)
+					ep_mem_zalloc(chan->nflows * sizeof *st->outflows);
+		stat = chan_open_helper(chan, st);
+		if (EP_STAT_ISOK(stat))
+			connected = true;
+		else if (!connected)
+			estat = stat;
+	}
+	if (connected)
+	{
+		long delay = ep_adm_getlongparam("swarm.gdp.reconnect.delay", 1000L);
+		struct timeval tv = { delay / 1000, (delay % 1000) * 1000 };
 
-	estat = chan_open_helper(chan, NULL);
+		for (i = 0; i < chan->nstripes; i++)
+			if (chan->stripes[i].state != GDP_CHAN_CONNECTED)
+				evtimer_add(chan->stripes[i].retry_ev, &tv);
+		estat = EP_STAT_OK;
+	}
 
 	if (EP_STAT_ISOK(estat))
+	{
 		*pchan = chan;
+		(*chan->advert_cb)(chan, GDP_CMD_ADVERTISE, NULL);
+	}
 	else
 	{
 		ep_app_message(estat, "Cannot open connection to GDP");
@@ -839,22 +1697,28 @@ _gdp_chan_open(
 
 
 /*
-**  CHAN_REOPEN --- re-open a channel (e.g., on router failure)
+**  STRIPE_REOPEN --- re-open one stripe (e.g., on router failure)
+**
+**		Our names are advertised again on success.  That goes out
+**		on every stripe, which is redundant but harmless.
 */
 
 static EP_STAT
-chan_reopen(gdp_chan_t *chan)
+stripe_reopen(struct chan_stripe *st)
 {
+	gdp_chan_t *chan = st->chan;
 	EP_STAT estat;
 
-	ep_dbg_cprintf(Dbg, 12, "chan_reopen: %p\n	 advert_cb = %p\n",
-			chan, chan->advert_cb);
+	ep_dbg_cprintf(Dbg, 12, "stripe_reopen: %p[%d]\n	 advert_cb = %p\n",
+			chan, st->index, chan->advert_cb);
 
 	// close the (now dead) bufferevent
-	if (chan->bev != NULL)
-		bufferevent_free(chan->bev);
-	chan->bev = NULL;
-	estat = chan_open_helper(chan, NULL);
+	if (st->bev != NULL)
+		bufferevent_free(st->bev);
+	st->bev = NULL;
+	estat = chan_open_helper(chan, st);
+	if (EP_STAT_ISOK(estat))
+		(*chan->advert_cb)(chan, GDP_CMD_ADVERTISE, NULL);
 	return estat;
 }
 
@@ -872,15 +1736,87 @@ _gdp_chan_close(gdp_chan_t *chan)
 
 /*
 **  _GDP_CHAN_SEND --- send a message to a channel
+**
+**		The header is put in front of the payload and the whole
+**		thing is moved (not copied) to the output buffer in one
+**		go, so it is written with a single writev.  Nothing
+**		here linearizes the payload.
+**
+**		Where we can, regular traffic carries a flow id in place
+**		of its addresses (see gdp_chan.h [7]); that cuts the
+**		header from 76 octets to 16.
 */
 
+// hex dump a buffer without pulling it up
+static void
+dump_buf(gdp_buf_t *buf, size_t off)
+{
+	struct evbuffer_ptr pos;
+	struct evbuffer_iovec v[8];
+	int n;
+	int i;
+
+	if (evbuffer_ptr_set(buf, &pos, 0, EVBUFFER_PTR_SET) < 0)
+		return;
+	for (;;)
+	{
+		n = evbuffer_peek(buf, -1, &pos, v, 8);
+		for (i = 0; i < n && i < 8; i++)
+		{
+			ep_hexdump(v[i].iov_base, v[i].iov_len, ep_dbg_getfile(),
+					EP_HEXDUMP_ASCII, off);
+			off += v[i].iov_len;
+			evbuffer_ptr_set(buf, &pos, v[i].iov_len, EVBUFFER_PTR_ADD);
+		}
+		if (n <= 8)
+			break;
+	}
+}
+
+/*
+**  PICK_STRIPE --- choose the stripe to send a PDU on
+**
+**		The hash is symmetric in source and destination, so both
+**		directions of a flow prefer the same stripe number.  Names
+**		are already hashes; folding them is enough.  Returns NULL
+**		if no stripe is up.
+*/
+
+static struct chan_stripe *
+pick_stripe(gdp_chan_t *chan, const gdp_name_t src, const gdp_name_t dst)
+{
+	uint32_t h = 0;
+	unsigned int i;
+	int home;
+
+	if (chan->nstripes == 1)
+		return &chan->stripes[0];
+	for (i = 0; i < sizeof (gdp_name_t); i++)
+		h = h * 31 + (src[i] ^ dst[i]);
+	home = h % chan->nstripes;
+	for (i = 0; i < (unsigned) chan->nstripes; i++)
+	{
+		struct chan_stripe *st = &chan->stripes[(home + i) % chan->nstripes];
+
+		if (st->state == GDP_CHAN_CONNECTED && st->bev != NULL)
+		{
+			if (i > 0)
+				ep_metric_inc(&StripeFailovers);
+			return st;
+		}
+	}
+	return NULL;
+}
+
 static EP_STAT
 send_helper(gdp_chan_t *chan,
+			struct chan_stripe *st,		// NULL to choose by hash
 			gdp_target_t *target,
 			gdp_name_t src,
 			gdp_name_t dst,
 			gdp_buf_t *payload,
-			int tos)
+			int tos,
+			size_t *octetsp)			// add octets written (may be NULL)
 {
 	EP_STAT estat = EP_STAT_OK;
 	int i;
@@ -904,12 +1840,13 @@ send_helper(gdp_chan_t *chan,
 		else
 		{
 			ep_dbg_printf("len %zd\n", payload_len);
-			ep_hexdump(gdp_buf_getptr(payload, payload_len), payload_len,
-					ep_dbg_getfile(), EP_HEXDUMP_ASCII, 0);
+			dump_buf(payload, 0);
 		}
 	}
 
-	if (chan->bev == NULL)
+	if (st == NULL)
+		st = pick_stripe(chan, src, dst);
+	if (st == NULL || st->bev == NULL)
 	{
 		ep_dbg_cprintf(Dbg, 1, "send_helper: no channel\n");
 		return GDP_STAT_DEAD_DAEMON;
@@ -922,65 +1859,105 @@ send_helper(gdp_chan_t *chan,
 		return GDP_STAT_PDU_TOO_LONG;
 	}
 
+	// choosing a flow id and sending the PDU that uses it must
+	// not be separated, or a FLOWSET could follow its first use
+	bufferevent_lock(st->bev);
+
+	// regular traffic is sent with a flow id if possible
+	int flowid = -1;
+	bool newflow = false;
+	int addr_type = GDP_PKT_ADDR_TYPE_2FULL;
+	size_t hdr_len = FULL_HEADER_LENGTH;
+	if ((tos & GDP_PKT_TYPE_MASK) == GDP_PKT_TYPE_REGULAR)
+		flowid = flow_out(st, dst, src, &newflow);
+	if (flowid >= 0 && newflow)
+	{
+		addr_type = GDP_PKT_ADDR_TYPE_FLOWSET;
+		hdr_len = FLOWSET_HEADER_LENGTH;
+	}
+	else if (flowid >= 0)
+	{
+		addr_type = GDP_PKT_ADDR_TYPE_FLOWID;
+		hdr_len = MIN_HEADER_LENGTH;
+	}
+
 	// build the header in memory
 	char pb[MAX_HEADER_LENGTH];
 	char *pbp = pb;
 
 	PUT8(GDP_CHAN_PROTO_VERSION);		// version number
-	PUT8(MIN_HEADER_LENGTH / 4);		// header length (= 72 / 4)
-	PUT8(tos);							// flags / type of service
+	PUT8(hdr_len / 4);					// header length (= 16, 76, or 80 / 4)
+	PUT8((tos & ~GDP_PKT_ADDR_TYPE_MASK) | addr_type);
+										// flags / type of service
 	PUT8(GDP_TTL_DEFAULT);				// time to live
 	uint32_t seq_mf_foff = (seqno & GDP_PKT_SEQNO_MASK) << GDP_PKT_SEQNO_SHIFT;
 	PUT32(seq_mf_foff);					// more frag bit, seqno, frag offset
 	uint16_t frag_len = 0;
 	PUT16(frag_len);					// length of this fragment
 	PUT16(payload_len);					// length of opaque payload
-	memcpy(pbp, dst, sizeof (gdp_name_t));	// destination address
-	pbp += sizeof (gdp_name_t);
-	memcpy(pbp, src, sizeof (gdp_name_t));	// source address
-	pbp += sizeof (gdp_name_t);
-
-	// now write header to the socket
-	bufferevent_lock(chan->bev);
-	EP_ASSERT((pbp - pb) == MIN_HEADER_LENGTH);
+	if (flowid >= 0)
+		PUT32(flowid);					// flow id
+	if (addr_type != GDP_PKT_ADDR_TYPE_FLOWID)
+	{
+		memcpy(pbp, dst, sizeof (gdp_name_t));	// destination address
+		pbp += sizeof (gdp_name_t);
+		memcpy(pbp, src, sizeof (gdp_name_t));	// source address
+		pbp += sizeof (gdp_name_t);
+	}
+
+	EP_ASSERT((size_t) (pbp - pb) == hdr_len);
 	if (ep_dbg_test(Dbg, 42))
 	{
 		ep_dbg_printf("send_helper: sending %zd octets:\n",
 					payload_len + (pbp - pb));
 		ep_hexdump(pb, pbp - pb, ep_dbg_getfile(), 0, 0);
 		if (payload_len > 0)
-		{
-			ep_hexdump(gdp_buf_getptr(payload, payload_len), payload_len,
-					ep_dbg_getfile(), EP_HEXDUMP_ASCII, pbp - pb);
-		}
+			dump_buf(payload, pbp - pb);
 	}
 
-	i = bufferevent_write(chan->bev, pb, pbp - pb);
+	// chain header and payload and hand them over together
+	if (payload_len > 0)
+	{
+		i = evbuffer_prepend(payload, pb, pbp - pb);
+		if (i == 0)
+			i = bufferevent_write_buffer(st->bev, payload);
+	}
+	else
+	{
+		i = bufferevent_write(st->bev, pb, pbp - pb);
+	}
 	if (i < 0)
 	{
 		estat = GDP_STAT_PDU_WRITE_FAIL;
-		goto fail0;
-	}
 
-	// and the payload
-	if (payload_len > 0)
+		// the other end never saw this binding
+		if (newflow)
+			st->outflows[flowid].used = 0;
+	}
+	else
 	{
-		i = bufferevent_write_buffer(chan->bev, payload);
-		if (i < 0)
-		{
-			estat = GDP_STAT_PDU_WRITE_FAIL;
-			goto fail0;
-		}
+		ep_metric_add(&_GdpOctetsCopied, pbp - pb);
 	}
+	bufferevent_unlock(st->bev);
 
-fail0:
+	if (EP_STAT_ISOK(estat))
+	{
+		ep_metric_inc(&PdusSent);
+		ep_metric_add(&OctetsSent, (pbp - pb) + payload_len);
+		ep_metric_add(&HeaderOctetsSent, pbp - pb);
+		if (octetsp != NULL)
+			*octetsp += (pbp - pb) + payload_len;
+	}
+	else
+	{
+		ep_metric_inc(&SendErrors);
+	}
 	if (!EP_STAT_ISOK(estat) && ep_dbg_test(Dbg, 4))
 	{
 		char ebuf[100];
 		ep_dbg_printf("send_helper failure: %s\n",
 				ep_stat_tostr(estat, ebuf, sizeof ebuf));
 	}
-	bufferevent_unlock(chan->bev);
 	return estat;
 }
 
@@ -994,19 +1971,61 @@ _gdp_chan_send(gdp_chan_t *chan,
 {
 	if (ep_dbg_test(Dbg, 42))
 	{
-		size_t l = evbuffer_get_length(payload);
-		uint8_t *p = evbuffer_pullup(payload, l);
 		ep_dbg_printf("_gdp_chan_send: sending PDU:\n");
-		ep_hexdump(p, l, ep_dbg_getfile(), EP_HEXDUMP_ASCII, 0);
+		dump_buf(payload, 0);
 	}
-	return send_helper(chan, target, src, dst, payload, tos);
+
+	EP_TRACE_SPAN span;
+	EP_STAT estat;
+
+	ep_trace_begin(&span, "chan", "send");
+	estat = send_helper(chan, NULL, target, src, dst, payload, tos, NULL);
+	ep_trace_end(&span);
+	return estat;
 }
 
 
 /*
 **  Advertising primitives
+**
+**		Advertisements and withdrawals go out on every stripe
+**		that is up, since responses may come back on any of them.
 */
 
+static EP_STAT
+advert_send(gdp_chan_t *chan,
+			gdp_name_t gname,
+			gdp_buf_t *payload,
+			int tos,
+			size_t *octetsp)
+{
+	EP_STAT estat = GDP_STAT_DEAD_DAEMON;
+	int last = -1;
+	int i;
+
+	for (i = 0; i < chan->nstripes; i++)
+		if (chan->stripes[i].state == GDP_CHAN_CONNECTED)
+			last = i;
+	for (i = 0; i <= last; i++)
+	{
+		struct chan_stripe *st = &chan->stripes[i];
+		gdp_buf_t *pbuf = payload;
+		EP_STAT stat;
+
+		if (st->state != GDP_CHAN_CONNECTED)
+			continue;
+		if (payload != NULL && i < last)
+			pbuf = gdp_buf_dup(payload);	// sending consumes it
+		stat = send_helper(chan, st, NULL, _GdpMyRoutingName, gname,
+							pbuf, tos, octetsp);
+		if (pbuf != payload)
+			gdp_buf_free(pbuf);
+		if (!EP_STAT_ISOK(estat))
+			estat = stat;				// OK if any stripe got it
+	}
+	return estat;
+}
+
 EP_STAT
 _gdp_chan_advertise(
 			gdp_chan_t *chan,
@@ -1025,8 +2044,7 @@ _gdp_chan_advertise(
 
 	// might batch several adverts into one PDU
 //	gdp_buf_write(payload, gname, sizeof (gdp_name_t));
-	estat = send_helper(chan, NULL, _GdpMyRoutingName, gname,
-						NULL, GDP_PKT_TYPE_ADVERTISE);
+	estat = advert_send(chan, gname, NULL, GDP_PKT_TYPE_ADVERTISE, NULL);
 
 	if (ep_dbg_test(Dbg, 21))
 	{
@@ -1053,8 +2071,7 @@ _gdp_chan_withdraw(
 			gdp_printable_name(gname, pname));
 //	gdp_buf_t *payload = gdp_buf_new();
 //	gdp_buf_write(payload, gname, sizeof (gdp_name_t));
-	estat = send_helper(chan, NULL, _GdpMyRoutingName, gname,
-						NULL, GDP_PKT_TYPE_WITHDRAW);
+	estat = advert_send(chan, gname, NULL, GDP_PKT_TYPE_WITHDRAW, NULL);
 
 	if (ep_dbg_test(Dbg, 21))
 	{
@@ -1068,6 +2085,109 @@ _gdp_chan_withdraw(
 }
 
 
+/*
+**  Batched advertising primitives
+**
+**		Advertise or withdraw many names with few PDUs.  The first
+**		name in each PDU goes in the destination address as it
+**		would for a single advertisement; the rest are packed into
+**		the payload, 32 octets each, so a router that ignores the
+**		payload still learns (or forgets) the first name.  The
+**		number of names per PDU is set by swarm.gdp.advertise.batch.
+**		Routers that don't know about batches ignore the rest of
+**		the names, so this defaults to one (one PDU per name) and
+**		should only be raised when all the routers understand it.
+**
+**		Returns the number of PDUs sent in the status detail, and
+**		adds the octets written (on all stripes) to *octetsp.
+*/
+
+#define MAX_ADVERT_BATCH	(UINT16_MAX / sizeof (gdp_name_t) + 1)
+
+static EP_STAT
+advert_batch_helper(
+			gdp_chan_t *chan,
+			gdp_name_t *names,
+			int nnames,
+			int tos,
+			size_t *octetsp)
+{
+	EP_STAT estat = EP_STAT_OK;
+	long batch;
+	int npdus = 0;
+	int nx;
+	gdp_buf_t *payload = NULL;
+
+	batch = ep_adm_getlongparam("swarm.gdp.advertise.batch", 1);
+	if (batch < 1)
+		batch = 1;
+	else if (batch > (long) MAX_ADVERT_BATCH)
+		batch = MAX_ADVERT_BATCH;
+	if (batch > 1)
+		payload = gdp_buf_new();
+
+	for (nx = 0; nx < nnames; nx += batch)
+	{
+		int n = nnames - nx;
+
+		if (n > batch)
+			n = batch;
+		if (n > 1)
+			gdp_buf_write(payload, names[nx + 1],
+						(n - 1) * sizeof (gdp_name_t));
+		estat = advert_send(chan, names[nx], n > 1 ? payload : NULL, tos,
+							octetsp);
+		if (payload != NULL)
+			gdp_buf_reset(payload);
+		EP_STAT_CHECK(estat, break);
+		npdus++;
+	}
+
+	if (payload != NULL)
+		gdp_buf_free(payload);
+	if (ep_dbg_test(Dbg, 21))
+	{
+		char ebuf[100];
+
+		ep_dbg_printf("advert_batch_helper(%d names, batch %ld) => %s\n",
+				nnames, batch, ep_stat_tostr(estat, ebuf, sizeof ebuf));
+	}
+	if (EP_STAT_ISOK(estat))
+		estat = EP_STAT_FROM_INT(npdus);
+	return estat;
+}
+
+
+EP_STAT
+_gdp_chan_advertise_batch(
+			gdp_chan_t *chan,
+			gdp_name_t *names,
+			int nnames,
+			gdp_adcert_t *adcert,
+			gdp_chan_advert_cr_t *challenge_cb,
+			void *adata,
+			size_t *octetsp)
+{
+	ep_dbg_cprintf(Dbg, 39, "_gdp_chan_advertise_batch(%d names)\n", nnames);
+	return advert_batch_helper(chan, names, nnames, GDP_PKT_TYPE_ADVERTISE,
+							octetsp);
+}
+
+
+EP_STAT
+_gdp_chan_withdraw_batch(
+			gdp_chan_t *chan,
+			gdp_name_t *names,
+			int nnames,
+			void *adata,
+			size_t *octetsp)
+{
+	ep_dbg_cprintf(Dbg, 39, "_gdp_chan_withdraw_batch(%d names)\n", nnames);
+	return advert_batch_helper(chan, names, nnames, GDP_PKT_TYPE_WITHDRAW,
+							octetsp);
+}
+
+
 /*
 **  _GDP_CHAN_GET_UDATA --- get user data from channel
 */
@@ -1079,4 +2199,33 @@ _gdp_chan_get_cdata(gdp_chan_t *chan)
 }
 
 
+/*
+**  _GDP_CHAN_GET_OUTLEN --- get amount of data waiting to be sent
+**
+**		Used for flow control by code that can choose to hold
+**		output back rather than queuing it in the channel.
+*/
+
+size_t
+_gdp_chan_get_outlen(gdp_chan_t *chan)
+{
+	size_t len = 0;
+	int i;
+
+	if (chan == NULL)
+		return 0;
+	for (i = 0; i < chan->nstripes; i++)
+	{
+		struct bufferevent *bev = chan->stripes[i].bev;
+
+		if (bev == NULL)
+			continue;
+		bufferevent_lock(bev);
+		len += evbuffer_get_length(bufferevent_get_output(bev));
+		bufferevent_unlock(bev);
+	}
+	return len;
+}
+
+
 /* vim: set noexpandtab : */
@@ -89,8 +89,8 @@ typedef struct gdp_adcert		gdp_adcert_t;		// advertising cert
 **		10	2	payload (SDU) length (= P) [6]
 **				--- following depend on address format in octet 2 ---
 **		12	4	flow id (optional) [7]
-**		12	32	destination address (optional) [7]
-**		44	32	source address (optional) [7]
+**		12/16	32	destination address (optional) [7]
+**		44/48	32	source address (optional) [7]
 **		?	?	for future use (probably options)
 **		H	P	payload (SDU) (starts at offset given in octet 1)
 **
@@ -106,8 +106,8 @@ typedef struct gdp_adcert		gdp_adcert_t;		// advertising cert
 **
 **		[3] The low-order three bits define the address fields.  If
 **			zero, there are two 32-byte (256-bit) addresses for
-**			destination and source respectively.  Other values are
-**			reserved.
+**			destination and source respectively.  One and two are
+**			for flow ids; see [7].  Other values are reserved.
 **
 **			The next two bits are flag bits, as defined in the
 **			#defines below.
@@ -125,7 +125,12 @@ typedef struct gdp_adcert		gdp_adcert_t;		// advertising cert
 **				7: "transmission ACK"
 **
 **			Types 1, 2, and 3 are client to routing layer only.
-**			Type 4 is routing layer to client only.
+**			Types 2 and 3 may carry more names in the payload,
+**			each 32 octets; these are advertised or withdrawn
+**			exactly as the destination address is.  See
+**			_gdp_chan_advertise_batch.
+**			Type 4 is routing layer to client only, except that
+**			either end may send a flow id NAK (see [7]).
 **			Types 6 and 7 are reserved to the routing layer.
 **
 **		[4]	TTL is only bottom six bits; the remainder of the octet
@@ -144,13 +149,43 @@ typedef struct gdp_adcert		gdp_adcert_t;		// advertising cert
 **
 **		[6]	The SDU length (P) is the length of the entire reassembled
 **			opaque payload.  The fragment length (F) is the size of this
-**			fragment.  If transmitting over TCP, F is ignored.
+**			fragment.  Nothing fragments yet, so F must be zero or P,
+**			and the more fragments bit and fragment offset must be
+**			zero.  A PDU breaking these rules (or with the wrong
+**			version or an impossible header length) means the two
+**			ends no longer agree where PDUs start, so the receiver
+**			drops the connection and starts over.
 **
 **		[7]	The addresses included in the PDU are defined by the
-**			the bottom three bits of octet 2.  The intent is that
-**			once a flow is initialized, only that four octet field
-**			will be sent.  However, the flowid compression is not
-**			implemented yet.
+**			the bottom three bits of octet 2.  With address format
+**			zero there is no flow id, just the two addresses.
+**
+**			Format one (FLOWSET) has a flow id followed by both
+**			addresses; it binds the id to that (destination, source)
+**			pair.  Format two (FLOWID) has just the flow id, and
+**			stands for the addresses last bound to it.  Flow ids
+**			belong to one direction of one connection: the sender
+**			chooses them, may rebind an id at any time by sending
+**			another FLOWSET, and both ends forget them all when the
+**			connection closes.  Since the connection is ordered a
+**			FLOWSET always arrives before the PDUs that depend on it.
+**
+**			Flow ids are less than 65536, and a receiver keeps every
+**			binding until the sender replaces it, so a sender never
+**			has to guess how much the other end can remember.  A
+**			receiver that gets an id it has no binding for (which
+**			only a broken sender would send), or a FLOWSET with an
+**			id that is out of range, returns a "no route" NAK with
+**			address format FLOWID and that flow id.  The sender then
+**			sends FLOWSET the next time it uses that (destination,
+**			source) pair.  A FLOWSET is delivered either way, since
+**			it has both addresses; a FLOWID PDU with an unknown id
+**			is dropped.
+**
+**			Only regular traffic is compressed.  A sender starts
+**			using flow ids only if configured to or once the other
+**			end has sent it a FLOWSET, so it is safe to talk to
+**			routers that do not know about them.
 **
 **		Any additional octets in the header are interpreted as options.
 */
@@ -165,6 +200,8 @@ typedef struct gdp_adcert		gdp_adcert_t;		// advertising cert
 // address format
 #define GDP_PKT_ADDR_TYPE_MASK		0x07	// indicates structure of addresses
 #define GDP_PKT_ADDR_TYPE_2FULL		0x00	// two 256-bit addresses
+#define GDP_PKT_ADDR_TYPE_FLOWSET	0x01	// flow id and both addresses
+#define GDP_PKT_ADDR_TYPE_FLOWID	0x02	// flow id only
 
 // flag bits
 #define GDP_PKT_TYPE_RELIABLE		0x08	// do extra work to ensure delivery
@@ -288,6 +325,9 @@ EP_STAT			_gdp_chan_send(				// send data to channel
 gdp_chan_x_t	*_gdp_chan_get_cdata(		// get user data from channel
 						gdp_chan_t *chan);
 
+size_t			_gdp_chan_get_outlen(		// get length of output queue
+						gdp_chan_t *chan);
+
 EP_STAT			_gdp_chan_advertise(		// advertise name
 						gdp_chan_t *chan,
 						gdp_name_t gname,
@@ -300,6 +340,22 @@ EP_STAT			_gdp_chan_withdraw(			// withdraw advertisement
 						gdp_name_t gname,
 						void *adata);
 
+EP_STAT			_gdp_chan_advertise_batch(	// advertise many names
+						gdp_chan_t *chan,
+						gdp_name_t *names,
+						int nnames,
+						gdp_adcert_t *adcert,
+						gdp_chan_advert_cr_t *challenge_cb,
+						void *adata,
+						size_t *octetsp);		// add octets sent (or NULL)
+
+EP_STAT			_gdp_chan_withdraw_batch(	// withdraw many advertisements
+						gdp_chan_t *chan,
+						gdp_name_t *names,
+						int nnames,
+						void *adata,
+						size_t *octetsp);		// add octets sent (or NULL)
+
 void			_gdp_chan_lock(				// lock the channel
 						gdp_chan_t *chan);
 
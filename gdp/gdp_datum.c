@@ -72,7 +72,10 @@ gdp_datum_new(void)
 	if (datum == NULL)
 	{
 		// nothing on the free list; allocate anew
+		int otag = ep_mem_tag_set(_GdpMemTagDatum);
+
 		datum = (gdp_datum_t *) ep_mem_zalloc(sizeof *datum);
+		ep_mem_tag_set(otag);
 		ep_thr_mutex_init(&datum->mutex, EP_THR_MUTEX_DEFAULT);
 		ep_thr_mutex_setorder(&datum->mutex, GDP_MUTEX_LORDER_DATUM);
 	}
@@ -503,7 +506,7 @@ _gdp_datum_to_pb(const gdp_datum_t *datum,
 	else if (pbd->ts != NULL)
 	{
 		ep_dbg_cprintf(Dbg, 3, "_gdp_datum_to_pb: freeing ts\n");
-		gdp_timestamp__free_unpacked(pbd->ts, NULL);
+		gdp_timestamp__free_unpacked(pbd->ts, &_GdpProtobufAllocator);
 		pbd->ts = NULL;
 	}
 
@@ -512,8 +515,18 @@ _gdp_datum_to_pb(const gdp_datum_t *datum,
 	{
 		size_t l = gdp_buf_getlength(datum->dbuf);
 		pbd->data.len = l;
-		pbd->data.data = (uint8_t *) ep_mem_malloc(l);
-		memcpy(pbd->data.data, gdp_buf_getptr(datum->dbuf, l), l);
+
+		// share large payloads with the datum if we can
+		pbd->data.data = _gdp_buf_get_wblock(datum->dbuf);
+		if (pbd->data.data == NULL)
+		{
+			if (l >= GDP_BUF_WBLOCK_MIN)
+				pbd->data.data = _gdp_buf_wblock_new(l);
+			else
+				pbd->data.data = (uint8_t *) ep_mem_malloc(l);
+			gdp_buf_peek(datum->dbuf, pbd->data.data, l);
+			ep_metric_add(&_GdpOctetsCopied, l);
+		}
 	}
 
 	// hash of previous record
@@ -549,7 +562,7 @@ _gdp_datum_to_pb(const gdp_datum_t *datum,
 	else if (pbd->sig != NULL)
 	{
 		ep_dbg_cprintf(Dbg, 3, "_gdp_datum_to_pb: freeing sig\n");
-		gdp_signature__free_unpacked(pbd->sig, NULL);
+		gdp_signature__free_unpacked(pbd->sig, &_GdpProtobufAllocator);
 		pbd->sig = NULL;
 	}
 }
@@ -33,6 +33,7 @@
 #include <ep/ep_thr.h>
 #include <ep/ep_dbg.h>
 #include <ep/ep_funclist.h>
+#include <ep/ep_hash.h>
 #include <ep/ep_log.h>
 
 #include "gdp.h"
@@ -93,6 +94,8 @@ _gdp_event_new(gdp_event_t **gevp)
 		gev = (gdp_event_t *) ep_mem_zalloc(sizeof *gev);
 	}
 	VALGRIND_HG_CLEAN_MEMORY(gev, sizeof *gev);
+	gev->cont = NULL;
+	gev->samepdu = false;
 	*gevp = gev;
 	ep_dbg_cprintf(Dbg, 48, "_gdp_event_new => %p\n", gev);
 	return EP_STAT_OK;
@@ -123,6 +126,9 @@ gdp_event_free(gdp_event_t *gev)
 	if (gev->datum != NULL)
 		gdp_datum_free(gev->datum);
 	gev->datum = NULL;
+	if (gev->cont != NULL)
+		gdp_buf_free(gev->cont);
+	gev->cont = NULL;
 #if GDP_DEBUG_NO_FREE_LISTS		// avoid helgrind complaints
 	ep_mem_free(gev);
 #else
@@ -282,7 +288,7 @@ modulo_gt(gdp_seqno_t a, gdp_seqno_t b)
 }
 
 static void
-insert_pending_event(gdp_event_t *gev,
+queue_pending_event(gdp_event_t *gev,
 		gdp_req_t *req)
 {
 	EP_ASSERT_POINTER_VALID(gev);
@@ -389,6 +395,13 @@ insert_pending_event(gdp_event_t *gev,
 						gev = TAILQ_NEXT(gev, queue))
 			ep_dbg_printf(" %d", gev->seqno);
 	}
+}
+
+static void
+insert_pending_event(gdp_event_t *gev,
+		gdp_req_t *req)
+{
+	queue_pending_event(gev, req);
 
 	// now figure out what should be delivered to the application
 	_gdp_event_trigger_pending(req, false);
@@ -512,6 +525,38 @@ _gdp_event_trigger(gdp_event_t *gev, gdp_req_t *req)
 }
 
 
+/*
+**  Deliver a failure for a log whose multiread batch was never sent.
+**
+**		Nothing is coming back for it, so there is nothing to wait
+**		for: the event goes out right away without disturbing the
+**		seqno we expect for the results that are on their way.
+*/
+
+EP_STAT
+_gdp_event_add_unsent(gdp_req_t *req, gdp_gin_t *gin, EP_STAT stat)
+{
+	EP_STAT estat;
+	gdp_event_t *gev;
+	gdp_seqno_t seqnext = req->seqnext;
+
+	estat = _gdp_event_new(&gev);
+	EP_STAT_CHECK(estat, return estat);
+
+	gev->type = GDP_EVENT_FAILURE;
+	gev->gin = gin;
+	gev->stat = stat;
+	gev->udata = req->sub_cbarg;
+	gev->cb = req->sub_cbfunc;
+	gev->datum = gdp_datum_new();
+	gev->seqno = GDP_SEQNO_NONE;
+	EP_TIME_INVALIDATE(&gev->timeout);
+	_gdp_event_trigger(gev, req);
+	req->seqnext = seqnext;
+	return EP_STAT_OK;
+}
+
+
 /*
 **	Trigger any pending events that should be active.
 **		If the event is the next one we expect (based on the sequence
@@ -555,8 +600,12 @@ _gdp_event_trigger_pending(gdp_req_t *req, bool flush)
 
 		ep_dbg_cprintf(Dbg, 56, "  gseq %d rseq %d  ",
 				gev->seqno, req->seqnext);
+		//	Later results from a multiread PDU share the seqno of
+		//	the one we just triggered.
 		if (!flush &&
 				gev->seqno != req->seqnext &&
+				!(gev->samepdu &&
+					(gev->seqno + 1) % GDP_SEQNO_BASE == req->seqnext) &&
 				ep_time_before(&now, &gev->timeout))
 		{
 			ep_dbg_cprintf(Dbg, 56, "break\n");
@@ -650,6 +699,138 @@ _gdp_event_setcb(
 }
 
 
+/*
+**  Find the GIN corresponding to a multiread result.
+**
+**		Results come back in the same order as the selectors were
+**		sent, so the result index is normally enough.  Otherwise
+**		(e.g., group subscriptions, where results arrive as records
+**		are appended) look the name up.  Large sets get an index
+**		on first use so this doesn't turn into a linear search.
+*/
+
+#define GIN_INDEX_MIN		16		// smaller sets are searched linearly
+
+static gdp_gin_t *
+multiread_gin(gdp_req_t *req, int64_t rx, ProtobufCBinaryData *logname)
+{
+	int i;
+
+	if (req->gins == NULL || logname->len != sizeof (gdp_name_t))
+		return req->gin;
+	if (rx >= 0 && rx < req->ngins && req->gins[rx]->gob != NULL &&
+			memcmp(req->gins[rx]->gob->name, logname->data,
+						sizeof (gdp_name_t)) == 0)
+		return req->gins[rx];
+	if (req->ngins >= GIN_INDEX_MIN)
+	{
+		gdp_gin_t *gin;
+
+		if (req->ginindex == NULL)
+		{
+			req->ginindex = ep_hash_new("ginindex", NULL, req->ngins);
+			for (i = 0; i < req->ngins; i++)
+			{
+				if (req->gins[i]->gob == NULL)
+					continue;
+				(void) ep_hash_insert(req->ginindex, sizeof (gdp_name_t),
+									req->gins[i]->gob->name, req->gins[i]);
+			}
+		}
+		gin = (gdp_gin_t *) ep_hash_search(req->ginindex,
+									sizeof (gdp_name_t), logname->data);
+		if (gin != NULL)
+			return gin;
+	}
+	else
+	{
+		for (i = 0; i < req->ngins; i++)
+		{
+			if (req->gins[i]->gob != NULL &&
+					memcmp(req->gins[i]->gob->name, logname->data,
+								sizeof (gdp_name_t)) == 0)
+				return req->gins[i];
+		}
+	}
+	ep_dbg_cprintf(Dbg, 1, "multiread_gin: result %" PRId64 " unknown log\n",
+			rx);
+	return NULL;
+}
+
+
+/*
+**  Create one event for each result in an ACK_MULTI_CONTENT.
+**
+**		All events from one PDU share its seqno and are kept
+**		together (in order) in the pending list.
+*/
+
+static EP_STAT
+add_multi_events(gdp_req_t *req)
+{
+	GdpMessage *msg = req->rpdu->msg;
+	GdpMessage__AckMultiContent *payload;
+	gdp_event_t *prev = NULL;
+	int64_t rx;
+	size_t i;
+
+	EP_ASSERT_ELSE(msg->body_case == GDP_MESSAGE__BODY_ACK_MULTI_CONTENT,
+				return EP_STAT_ASSERT_ABORT);
+	payload = msg->ack_multi_content;
+
+	// ack_multi_content has already counted these results
+	rx = req->r_results - payload->n_r;
+	for (i = 0; i < payload->n_r; i++, rx++)
+	{
+		GdpMessage__AckMultiContent__Result *r = payload->r[i];
+		gdp_event_t *gev;
+		EP_STAT estat;
+
+		estat = _gdp_event_new(&gev);
+		EP_STAT_CHECK(estat, return estat);
+
+		gev->gin = multiread_gin(req, rx, &r->logname);
+		gev->udata = req->sub_cbarg;
+		gev->cb = req->sub_cbfunc;
+		gev->datum = gdp_datum_new();
+		gev->seqno = req->rpdu->seqno;
+		EP_TIME_INVALIDATE(&gev->timeout);
+		if (r->datum != NULL)
+		{
+			gev->type = GDP_EVENT_DATA;
+			gev->stat = EP_STAT_OK;
+			_gdp_datum_from_pb(gev->datum, r->datum, r->datum->sig);
+
+			// as for ACK_CONTENT; group subscriptions resume from here
+			if (gev->gin != NULL && gev->gin->gob != NULL &&
+					r->datum->recno > gev->gin->gob->nrecs)
+				gev->gin->gob->nrecs = r->datum->recno;
+		}
+		else
+		{
+			gev->stat = EP_STAT_FROM_INT(r->ep_stat);
+			if (EP_STAT_IS_SAME(gev->stat, GDP_STAT_NAK_REC_MISSING) ||
+					EP_STAT_IS_SAME(gev->stat, GDP_STAT_RECORD_MISSING))
+				gev->type = GDP_EVENT_MISSING;
+			else
+				gev->type = GDP_EVENT_FAILURE;
+		}
+
+		if (prev == NULL)
+			queue_pending_event(gev, req);
+		else
+		{
+			gev->samepdu = true;
+			TAILQ_INSERT_AFTER(&req->events, prev, gev, queue);
+		}
+		prev = gev;
+	}
+
+	_gdp_event_trigger_pending(req, false);
+	return EP_STAT_OK;
+}
+
+
 /*
 **  Create an event and link it into the queue based on a acknak req.
 */
@@ -678,9 +859,18 @@ _gdp_event_add_from_req(gdp_req_t *req)
 	  case GDP_ACK_CONTENT:
 		evtype = GDP_EVENT_DATA;
 		seqno = req->rpdu->seqno;
+		_gdp_subscr_credit(req);
 		break;
 
+	  case GDP_ACK_MULTI_CONTENT:
+		// one event per log
+		return add_multi_events(req);
+
 	  case GDP_ACK_END_OF_RESULTS:
+		// a multiread only gets one DONE, after its last batch
+		if (req->mr_batches > 0)
+			return EP_STAT_OK;
+
 		// end of subscription
 		evtype = GDP_EVENT_DONE;
 		seqno = req->rpdu->seqno;
@@ -739,6 +929,15 @@ _gdp_event_add_from_req(gdp_req_t *req)
 		EP_ASSERT(msg->ack_content->dl->n_d == 1);		//FIXME: should handle multiples
 		_gdp_datum_from_pb(gev->datum, msg->ack_content->dl->d[0], msg->sig);
 	}
+	else if (msg->cmd == GDP_ACK_END_OF_RESULTS &&
+			msg->ack_end_of_results->has_cont)
+	{
+		// read stopped at its byte budget; hand back where to resume
+		GdpMessage__AckEndOfResults *payload = msg->ack_end_of_results;
+		gev->cont = gdp_buf_new();
+		gdp_buf_write(gev->cont, payload->cont.data, payload->cont.len);
+		gev->stat = GDP_STAT_READ_BUDGET;
+	}
 
 	// schedule the event for delivery
 	insert_pending_event(gev, req);
@@ -894,3 +1093,11 @@ gdp_event_getstat(gdp_event_t *gev)
 	EP_ASSERT_POINTER_VALID(gev);
 	return gev->stat;
 }
+
+
+gdp_buf_t *
+gdp_event_getcont(gdp_event_t *gev)
+{
+	EP_ASSERT_POINTER_VALID(gev);
+	return gev->cont;
+}
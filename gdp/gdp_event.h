@@ -49,6 +49,8 @@ struct gdp_event
 	EP_STAT					stat;		// detailed status code
 	EP_TIME_SPEC			timeout;	// make active at this time
 	gdp_seqno_t				seqno;		// for sorting pending events
+	bool					samepdu;	// shares its PDU with the event before
+	gdp_buf_t				*cont;		// read continuation token (DONE)
 };
 
 // set up request to deliver events or callbacks
@@ -61,6 +63,12 @@ extern void				_gdp_event_setcb(
 extern EP_STAT			_gdp_event_add_from_req(
 								gdp_req_t *req);
 
+// deliver a failure for one log of a multiread that wasn't sent
+extern EP_STAT			_gdp_event_add_unsent(
+								gdp_req_t *req,
+								gdp_gin_t *gin,
+								EP_STAT stat);
+
 // add pending events to appropriate current queue
 extern void				_gdp_event_trigger_pending(
 								gdp_req_t *req,
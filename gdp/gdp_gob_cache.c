@@ -35,6 +35,7 @@
 #include <ep/ep_dbg.h>
 #include <ep/ep_hash.h>
 #include <ep/ep_log.h>
+#include <ep/ep_metric.h>
 #include <ep/ep_thr.h>
 
 #include "gdp.h"
@@ -49,6 +50,15 @@
 
 static EP_DBG	Dbg = EP_DBG_INIT("gdp.gob.cache", "GOB cache");
 
+static EP_METRIC	CacheHits = EP_METRIC_COUNTER_INIT("gob_cache",
+							"hits_total", "GOB cache lookups found");
+static EP_METRIC	CacheMisses = EP_METRIC_COUNTER_INIT("gob_cache",
+							"misses_total", "GOB cache lookups not found");
+static EP_METRIC	CacheDrops = EP_METRIC_COUNTER_INIT("gob_cache",
+							"drops_total", "GOBs dropped from the cache");
+static EP_METRIC	CacheEntries = EP_METRIC_GAUGE_INIT("gob_cache",
+							"entries", "GOBs in the cache");
+
 
 
 /***********************************************************************
@@ -117,6 +127,11 @@ _gdp_gob_cache_init(void)
 
 	// Nothing to do for LRU cache
 
+	ep_metric_register(&CacheHits);
+	ep_metric_register(&CacheMisses);
+	ep_metric_register(&CacheDrops);
+	ep_metric_register(&CacheEntries);
+
 	if (false)
 	{
 fail0:
@@ -164,6 +179,10 @@ check_cache_helper(size_t klen, const void *key, const void *val, va_list av)
 /*
 ** Check cache consistency.
 **		Returns true if is OK, false if is not.
+**
+**		This walks the entire cache (and worse), so it is only done
+**		when debugging; otherwise it would make every cache operation
+**		O(n) in the number of open GOBs.
 */
 
 static bool
@@ -178,6 +197,9 @@ check_cache_consistency(const char *where)
 		uint32_t	md4eq[MD4_DIGEST_LENGTH / 4];
 	} md4buf;
 
+	if (!ep_dbg_test(Dbg, 70))
+		return true;
+
 	memset(&md4buf, 0, sizeof md4buf);
 	memset(&bloom, 0, sizeof bloom);
 
@@ -272,6 +294,85 @@ rebuild_lru_list(void)
 
 
 
+/*
+**  GOB_IDLE_TIMEOUT --- reclaim a GOB that hasn't been used recently
+**
+**		Every cached GOB has an idle timer.  Using a GOB only updates
+**		utime; when the timer goes off it checks utime and sets
+**		itself again for the rest of the period if the GOB has been
+**		used in the meantime.  That keeps the cost of expiring a GOB
+**		constant however many GOBs there are.
+**
+**		This runs from the timer wheel with nothing locked, so the
+**		locks have to be taken in the usual order.  Since the GOB
+**		could be in the process of being freed (and that waits for
+**		us), we can't block on anything; if we can't get the locks
+**		we just try again a bit later.
+*/
+
+#define IDLE_RETRY_USEC		(1 * 1000000)		// retry if GOB busy
+
+static void
+gob_idle_timeout(EP_TIMER *t, void *gob_)
+{
+	gdp_gob_t *gob = (gdp_gob_t *) gob_;
+	time_t maxage = _gdp_reclaim_age();
+	struct timeval tv;
+
+	if (ep_thr_mutex_trylock(&GobCacheMutex) != 0)
+	{
+		ep_timer_set(_GdpTimers, t, IDLE_RETRY_USEC, &gob_idle_timeout, gob);
+		return;
+	}
+	if (ep_thr_mutex_trylock(&gob->mutex) != 0)
+	{
+		ep_thr_mutex_unlock(&GobCacheMutex);
+		ep_timer_set(_GdpTimers, t, IDLE_RETRY_USEC, &gob_idle_timeout, gob);
+		return;
+	}
+	gob->flags |= GOBF_ISLOCKED;
+
+	gettimeofday(&tv, NULL);
+	if (!EP_UT_BITSET(GOBF_INCACHE, gob->flags) ||
+			EP_UT_BITSET(GOBF_DROPPING, gob->flags))
+	{
+		// no longer ours to reclaim
+	}
+	else if (gob->utime > tv.tv_sec - maxage)
+	{
+		// used since the timer was set
+		ep_timer_set(_GdpTimers, t,
+				(gob->utime + maxage - tv.tv_sec) * INT64_C(1000000),
+				&gob_idle_timeout, gob);
+	}
+	else if (gob->refcnt > 0)
+	{
+		// someone still has it open (e.g., subscriptions)
+		ep_dbg_cprintf(Dbg, 19, "gob_idle_timeout: %s referenced\n",
+				gob->pname);
+		ep_timer_set(_GdpTimers, t, maxage * INT64_C(1000000),
+				&gob_idle_timeout, gob);
+	}
+	else
+	{
+		if (ep_dbg_test(Dbg, 32))
+		{
+			ep_dbg_printf("gob_idle_timeout: reclaiming:\n   ");
+			_gdp_gob_dump(gob, ep_dbg_getfile(), GDP_PR_DETAILED, 0);
+		}
+
+		// remove from the LRU list and the name->handle cache
+		_gdp_gob_cache_drop(gob, true);
+
+		// release memory (this will also unlock the corpse)
+		_gdp_gob_free(&gob);
+	}
+	if (gob != NULL)
+		_gdp_gob_unlock(gob);
+	ep_thr_mutex_unlock(&GobCacheMutex);
+}
+
+
 /*
 **  Add a GOB to both the associative and the LRU caches.
 **  The "unlocked" refers to GobCacheMutex, which should already
@@ -332,7 +433,12 @@ add_cache_unlocked(gdp_gob_t *gob)
 		}
 	}
 
+	// ... and start the idle timer
+	ep_timer_set(_GdpTimers, &gob->idle_timer,
+			_gdp_reclaim_age() * INT64_C(1000000), &gob_idle_timeout, gob);
+
 	gob->flags |= GOBF_INCACHE;
+	ep_metric_inc(&CacheEntries);
 	ep_dbg_cprintf(Dbg, 40, "_gdp_gob_cache_add: %s => %p\n",
 			gob->pname, gob);
 }
@@ -447,6 +553,7 @@ _gdp_gob_cache_get(
 			_gdp_gob_touch(gob);
 		}
 	}
+	ep_metric_inc(gob == NULL ? &CacheMisses : &CacheHits);
 	if (gob == NULL && EP_UT_BITSET(GGCF_CREATE, flags))
 	{
 		// create a new one
@@ -533,6 +640,8 @@ _gdp_gob_cache_drop(gdp_gob_t *gob, bool cleanup)
 	// ... and the LRU list
 	LIST_REMOVE(gob, ulist);
 	gob->flags &= ~GOBF_INCACHE;
+	ep_metric_add(&CacheEntries, -1);
+	ep_metric_inc(&CacheDrops);
 
 	if (!cleanup)
 	{
@@ -584,10 +693,13 @@ _gdp_gob_touch(gdp_gob_t *gob)
 
 
 /*
-**  Reclaim cache entries older than a specified age
+**  Reclaim cache entries to free up file descriptors
 **
-**		If we can't get the number of file descriptors down far enough
-**		we keep trying with increasingly stringent constraints, so maxage
+**		Idle GOBs are reclaimed by their timers after the reclaim
+**		age (see gob_idle_timeout), so this does nothing unless we
+**		are running short of file descriptors.  If we are, it closes
+**		GOBs older than maxage, and if that isn't enough it keeps
+**		trying with increasingly stringent constraints, so maxage
 **		is really more advice than a requirement.
 **
 **		XXX	Currently the GOB is not reclaimed if the reference count
@@ -631,6 +743,13 @@ _gdp_gob_cache_reclaim(time_t maxage)
 		time_t mintime;
 		long loopcount = 0;
 
+		// check to see if we have enough headroom
+		int maxfds;
+		int nfds = ep_app_numfds(&maxfds);
+
+		if (nfds < maxfds - headroom)
+			return;
+
 		gettimeofday(&tv, NULL);
 		mintime = tv.tv_sec - maxage;
 
@@ -688,13 +807,6 @@ _gdp_gob_cache_reclaim(time_t maxage)
 		}
 		ep_thr_mutex_unlock(&GobCacheMutex);
 
-		// check to see if we have enough headroom
-		int maxfds;
-		int nfds = ep_app_numfds(&maxfds);
-
-		if (nfds < maxfds - headroom)
-			return;
-
 		// try again, shortening timeout
 		maxage -= maxage < 4 ? 1 : maxage / 4;
 		if (maxage <= 0)
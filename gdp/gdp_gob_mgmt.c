@@ -97,7 +97,10 @@ _gdp_gob_new(gdp_name_t gob_name, gdp_gob_t **pgob)
 	if (gob == NULL)
 	{
 		// allocate the memory to hold the gob handle
+		int otag = ep_mem_tag_set(_GdpMemTagGob);
+
 		gob = (gdp_gob_t *) ep_mem_zalloc(sizeof *gob);
+		ep_mem_tag_set(otag);
 		if (gob == NULL)
 			goto fail1;
 
@@ -171,6 +174,9 @@ _gdp_gob_free(gdp_gob_t **pgob)
 	gob->flags |= GOBF_DROPPING;
 	gob->refcnt = 0;
 
+	// the idle timer mustn't fire on the recycled handle
+	ep_timer_clr(_GdpTimers, &gob->idle_timer);
+
 	if (EP_UT_BITSET(GOBF_INCACHE, gob->flags))
 	{
 		// drop it from the name -> handle cache and the LRU list
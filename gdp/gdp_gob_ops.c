@@ -884,26 +884,31 @@ fail0:
 
 
 /*
-**  _GDP_GOB_READ_BY_RECNO_ASYNC --- asynchronously read records from a GOB
+**  _GDP_GOB_READ_RANGE_ASYNC --- asynchronously read records from a GOB
 **
 **		Parameters:
 **			gob --- the gob from which to read
 **			recno --- the record number to read
 **			nrecs --- the number of records to read
+**			maxbytes --- byte budget for this read (0 => no budget)
+**			cont --- continuation token from an earlier read; if
+**				set, recno and nrecs are ignored
 **			cbfunc --- the callback function (NULL => deliver as events)
 **			cbarg --- user argument to cbfunc
 **			chan --- the data channel used to contact the remote
 **
-**		This might be read by recno or read by timestamp based on
-**		the command.  In any case the cmd is the defining factor.
+**		If the server stops short because of the byte budget, the
+**		DONE event carries a new continuation token.
 */
 
 EP_STAT
-_gdp_gob_read_by_recno_async(
+_gdp_gob_read_range_async(
 			gdp_gob_t *gob,
 			gdp_gin_t *gin,
 			gdp_recno_t recno,
 			uint32_t nrecs,
+			size_t maxbytes,
+			gdp_buf_t *cont,
 			gdp_event_cbfunc_t cbfunc,
 			void *cbarg,
 			gdp_chan_t *chan)
@@ -937,6 +942,18 @@ _gdp_gob_read_by_recno_async(
 		payload->nrecs = nrecs;
 		payload->has_nrecs = true;
 	}
+	if (maxbytes > 0)
+	{
+		payload->maxbytes = maxbytes > UINT32_MAX ? UINT32_MAX : maxbytes;
+		payload->has_maxbytes = true;
+	}
+	if (cont != NULL && gdp_buf_getlength(cont) > 0)
+	{
+		payload->cont.len = gdp_buf_getlength(cont);
+		payload->cont.data = ep_mem_malloc(payload->cont.len);
+		gdp_buf_peek(cont, payload->cont.data, payload->cont.len);
+		payload->has_cont = true;
+	}
 
 	// arrange for responses to appear as events or callbacks
 	_gdp_event_setcb(req, cbfunc, cbarg);
@@ -957,6 +974,160 @@ _gdp_gob_read_by_recno_async(
 	return estat;
 }
 
+EP_STAT
+_gdp_gob_read_by_recno_async(
+			gdp_gob_t *gob,
+			gdp_gin_t *gin,
+			gdp_recno_t recno,
+			uint32_t nrecs,
+			gdp_event_cbfunc_t cbfunc,
+			void *cbarg,
+			gdp_chan_t *chan)
+{
+	return _gdp_gob_read_range_async(gob, gin, recno, nrecs, 0, NULL,
+							cbfunc, cbarg, chan);
+}
+
+
+/*
+**  _GDP_GOB_MULTIREAD --- read one record from each of a set of logs
+**
+**		All of the logs must be hosted by the same server.  The
+**		command is addressed to the GOB of the first GIN, which
+**		must be locked by the caller.  Results are delivered as
+**		events (one per log) followed by a GDP_EVENT_DONE.
+**
+**		Record numbers <= 0 are relative to the end of each log,
+**		so 0 or -1 will fetch the latest record.
+**
+**		A command has to fit in one PDU, so large sets go out as
+**		several commands of swarm.gdp.multiread.maxlogs logs each,
+**		all on this one req.  Each batch ends with its own
+**		ACK_END_OF_RESULTS, but only the last makes a DONE.  If a
+**		later batch can't be sent the ones already out still
+**		complete; the logs that weren't sent get GDP_EVENT_FAILURE
+**		with the send status.
+*/
+
+#define MREAD_MAXLOGS_DEFAULT	1024		// ~40 bytes each on the wire
+
+EP_STAT
+_gdp_gob_multiread(
+			int n_gins,
+			gdp_gin_t **gins,
+			const gdp_recno_t *recnos,
+			gdp_event_cbfunc_t cbfunc,
+			void *cbarg,
+			gdp_chan_t *chan)
+{
+	EP_STAT estat;
+	gdp_req_t *req;
+	gdp_msg_t *msg;
+	gdp_gob_t *gob;
+	GdpMessage__CmdMultiread__Selector **sels;
+	int maxlogs;
+	int nsent;
+	int i;
+
+	errno = 0;				// avoid spurious messages
+
+	// sanity checks
+	if (n_gins <= 0)
+		return EP_STAT_INVALID_ARG;
+	gob = gins[0]->gob;
+	if (!GDP_GOB_ISGOOD(gob))
+		return GDP_STAT_LOG_NOT_OPEN;
+	for (i = 1; i < n_gins; i++)
+	{
+		if (gins[i] == NULL || !GDP_GOB_ISGOOD(gins[i]->gob))
+			return GDP_STAT_LOG_NOT_OPEN;
+	}
+
+	estat = _gdp_req_new(GDP_CMD_MULTIREAD, gob, chan, NULL,
+						GDP_REQ_ASYNCIO | GDP_REQ_PERSIST, &req);
+	EP_STAT_CHECK(estat, return estat);
+	req->gin = gins[0];
+
+	// remember the GINs so results can be mapped back
+	req->gins = (gdp_gin_t **) ep_mem_malloc(n_gins * sizeof *req->gins);
+	memcpy(req->gins, gins, n_gins * sizeof *req->gins);
+	req->ngins = n_gins;
+
+	maxlogs = ep_adm_getintparam("swarm.gdp.multiread.maxlogs",
+							MREAD_MAXLOGS_DEFAULT);
+	if (maxlogs <= 0)
+		maxlogs = MREAD_MAXLOGS_DEFAULT;
+	req->mr_batches = (n_gins + maxlogs - 1) / maxlogs;
+
+	msg = req->cpdu->msg;
+	EP_ASSERT_ELSE(msg != NULL, return EP_STAT_ASSERT_ABORT);
+	GdpMessage__CmdMultiread *payload = msg->cmd_multiread;
+	EP_ASSERT_ELSE(payload != NULL, return EP_STAT_ASSERT_ABORT);
+	payload->n_sel = n_gins;
+	payload->sel = (GdpMessage__CmdMultiread__Selector **)
+				ep_mem_malloc(n_gins * sizeof *payload->sel);
+	for (i = 0; i < n_gins; i++)
+	{
+		GdpMessage__CmdMultiread__Selector *sel;
+
+		sel = (GdpMessage__CmdMultiread__Selector *)
+					ep_mem_zalloc(sizeof *sel);
+		gdp_message__cmd_multiread__selector__init(sel);
+		sel->logname.len = sizeof (gdp_name_t);
+		sel->logname.data = (uint8_t *) ep_mem_malloc(sizeof (gdp_name_t));
+		memcpy(sel->logname.data, gins[i]->gob->name, sizeof (gdp_name_t));
+		sel->has_recno = true;
+		sel->recno = recnos == NULL ? 0 : recnos[i];
+		payload->sel[i] = sel;
+	}
+
+	// arrange for responses to appear as events or callbacks
+	_gdp_event_setcb(req, cbfunc, cbarg);
+
+	// send a batch at a time; we hold the req, so no results sneak in
+	sels = payload->sel;
+	for (nsent = 0; nsent < n_gins; nsent += payload->n_sel)
+	{
+		payload->sel = &sels[nsent];
+		payload->n_sel = n_gins - nsent;
+		if (payload->n_sel > (size_t) maxlogs)
+			payload->n_sel = maxlogs;
+		if (nsent == 0)
+			estat = _gdp_req_send(req);
+		else
+			estat = _gdp_pdu_out(req->cpdu, req->chan);
+		EP_STAT_CHECK(estat, break);
+	}
+	payload->sel = sels;
+	payload->n_sel = n_gins;
+
+	if (nsent > 0 && nsent < n_gins)
+	{
+		char ebuf[100];
+
+		// the batches already out finish normally; fail the rest here
+		ep_dbg_cprintf(Dbg, 1,
+				"_gdp_gob_multiread: sent %d of %d logs: %s\n",
+				nsent, n_gins, ep_stat_tostr(estat, ebuf, sizeof ebuf));
+		req->mr_batches -= (n_gins - nsent + maxlogs - 1) / maxlogs;
+		for (i = nsent; i < n_gins; i++)
+			(void) _gdp_event_add_unsent(req, gins[i], estat);
+		estat = EP_STAT_OK;
+	}
+
+	if (EP_STAT_ISOK(estat))
+	{
+		req->state = GDP_REQ_IDLE;
+		_gdp_req_unlock(req);
+	}
+	else
+	{
+		_gdp_req_free(&req);
+	}
+
+	return estat;
+}
+
 
 /*
 **  _GDP_GOB_GETMETADATA --- return metadata for a log
@@ -1013,6 +1184,135 @@ fail0:
 }
 
 
+/*
+**  _GDP_GOB_VRFY_RECORDS --- verify a run of records against the log
+**
+**		The records must be consecutive and in order.  They are
+**		linked to each other by their prevhash fields, so it is
+**		enough to get a Merkle inclusion proof for the last one from
+**		the server and check it against the checkpoint it returns.
+**		If the checkpoint is signed it is verified with the log's
+**		public key; if not, GDP_STAT_MERKLE_UNSIGNED is returned
+**		(the records are consistent with what the server claims,
+**		but the claim itself is unauthenticated).
+*/
+
+EP_STAT
+_gdp_gob_vrfy_records(gdp_gob_t *gob,
+		int n,
+		gdp_datum_t **datums,
+		gdp_chan_t *chan,
+		uint32_t reqflags)
+{
+	EP_STAT estat;
+	gdp_req_t *req;
+	gdp_hash_t *hash = NULL;
+	MerkleProof *proof;
+	MerkleCheckpoint *ckpt;
+	const uint8_t *path[64];
+	uint8_t leaf[GDP_MERKLE_HASHLEN];
+	uint8_t root[GDP_MERKLE_HASHLEN];
+	int i;
+
+	if (!GDP_GOB_ISGOOD(gob))
+		return GDP_STAT_LOG_NOT_OPEN;
+	if (n <= 0 || datums == NULL)
+		return EP_STAT_INVALID_ARG;
+
+	// check the hash chain within the run
+	for (i = 1; i < n; i++)
+	{
+		if (datums[i]->recno != datums[i - 1]->recno + 1 ||
+				datums[i]->prevhash == NULL ||
+				!_gdp_datum_hash_equal(datums[i - 1], gob, datums[i]->prevhash))
+		{
+			ep_dbg_cprintf(Dbg, 1,
+					"_gdp_gob_vrfy_records: chain broken at %" PRIgdp_recno "\n",
+					datums[i]->recno);
+			return GDP_STAT_MERKLE_PROOF_FAIL;
+		}
+	}
+
+	// ask the server to prove the last one
+	errno = 0;				// avoid spurious messages
+	estat = _gdp_req_new(GDP_CMD_GET_PROOF, gob, chan, NULL, reqflags, &req);
+	EP_STAT_CHECK(estat, goto fail0);
+	req->cpdu->msg->cmd_get_proof->recno = datums[n - 1]->recno;
+
+	estat = _gdp_invoke(req);
+	EP_STAT_CHECK(estat, goto fail1);
+
+	if (req->rpdu->msg->body_case != GDP_MESSAGE__BODY_ACK_SUCCESS ||
+			(proof = req->rpdu->msg->ack_success->proof) == NULL ||
+			(ckpt = proof->ckpt) == NULL ||
+			proof->recno != datums[n - 1]->recno ||
+			ckpt->root.len != GDP_MERKLE_HASHLEN ||
+			proof->n_path > sizeof path / sizeof path[0])
+	{
+		ep_dbg_cprintf(Dbg, 1, "_gdp_gob_vrfy_records: malformed proof\n");
+		estat = GDP_STAT_MERKLE_PROOF_FAIL;
+		goto fail1;
+	}
+	for (i = 0; i < (int) proof->n_path; i++)
+	{
+		if (proof->path[i].len != GDP_MERKLE_HASHLEN)
+		{
+			estat = GDP_STAT_MERKLE_PROOF_FAIL;
+			goto fail1;
+		}
+		path[i] = proof->path[i].data;
+	}
+
+	// walk the audit path up to the checkpoint root
+	hash = _gdp_datum_hash(datums[n - 1], gob);
+	{
+		size_t hashlen;
+		void *hashptr = gdp_hash_getptr(hash, &hashlen);
+
+		_gdp_merkle_leaf(hashptr, hashlen, leaf);
+	}
+	estat = _gdp_merkle_path_root(proof->recno - 1, ckpt->treesize, leaf,
+							proof->n_path, path, root);
+	EP_STAT_CHECK(estat, goto fail1);
+	if (memcmp(root, ckpt->root.data, sizeof root) != 0)
+	{
+		ep_dbg_cprintf(Dbg, 1, "_gdp_gob_vrfy_records: root mismatch\n");
+		estat = GDP_STAT_MERKLE_PROOF_FAIL;
+		goto fail1;
+	}
+
+	// and make sure the checkpoint came from the log owner
+	if (!ckpt->has_sig || ckpt->sig.len == 0)
+	{
+		estat = GDP_STAT_MERKLE_UNSIGNED;
+	}
+	else if (!EP_UT_BITSET(GOBF_VERIFYING, gob->flags))
+	{
+		estat = GDP_STAT_CRYPTO_NO_PUB_KEY;
+	}
+	else
+	{
+		EP_TIME_SPEC ts;
+		EP_CRYPTO_MD *md = ep_crypto_md_clone(gob->vrfy_ctx);
+
+		memset(&ts, 0, sizeof ts);
+		if (ckpt->ts != NULL)
+			_gdp_timestamp_from_pb(&ts, ckpt->ts);
+		_gdp_merkle_ckpt_digest(md, ckpt->treesize, &ts, root);
+		estat = ep_crypto_vrfy_final(md, ckpt->sig.data, ckpt->sig.len);
+		ep_crypto_md_free(md);
+	}
+
+fail1:
+	if (hash != NULL)
+		gdp_hash_free(hash);
+	_gdp_req_free(&req);
+
+fail0:
+	return estat;
+}
+
+
 /*
 **  Initialize signature verification context.
 **
@@ -1090,6 +1390,61 @@ nopubkey:
 **  Client side implementations for commands used internally only.
 ***********************************************************************/
 
+/*
+**  _GDP_REPLICA_PULL --- fetch a batch of records from a leader
+**
+**		Used by follower log servers (and tests).  The command is
+**		addressed to the leader log server itself, so there is no
+**		GOB involved; the response is matched on the channel.
+**		On success the request is returned (locked) holding the
+**		AckSuccess; the caller must _gdp_req_free it.
+*/
+
+EP_STAT
+_gdp_replica_pull(const gdp_name_t leader,
+		const gdp_name_t logname,
+		gdp_recno_t start,
+		int32_t maxrecs,
+		gdp_chan_t *chan,
+		gdp_req_t **reqp)
+{
+	EP_STAT estat;
+	gdp_req_t *req;
+
+	*reqp = NULL;
+	estat = _gdp_req_new(GDP_CMD_REPLICATE, NULL, chan, NULL,
+						GDP_REQ_ROUTEFAIL, &req);
+	EP_STAT_CHECK(estat, return estat);
+	_gdp_req_set_dst(req, leader);
+
+	GdpMessage__CmdReplicate *payload = req->cpdu->msg->cmd_replicate;
+	payload->logname.len = sizeof (gdp_name_t);
+	payload->logname.data = (uint8_t *) ep_mem_malloc(sizeof (gdp_name_t));
+	memcpy(payload->logname.data, logname, sizeof (gdp_name_t));
+	payload->start = start;
+	if (maxrecs > 0)
+	{
+		payload->maxrecs = maxrecs;
+		payload->has_maxrecs = true;
+	}
+
+	estat = _gdp_invoke(req);
+	if (EP_STAT_ISOK(estat) &&
+			req->rpdu->msg->body_case != GDP_MESSAGE__BODY_ACK_SUCCESS)
+	{
+		ep_dbg_cprintf(Dbg, 1,
+				"_gdp_replica_pull: unexpected response type %d\n",
+				req->rpdu->msg->body_case);
+		estat = GDP_STAT_PROTOCOL_FAIL;
+	}
+	if (EP_STAT_ISOK(estat))
+		*reqp = req;
+	else
+		_gdp_req_free(&req);
+	return estat;
+}
+
+
 #if 0	//XXX this should probably be done at Layer 4
 /*
 **  _GDP_GOB_FWD_APPEND --- forward APPEND command
@@ -1143,7 +1498,7 @@ _gdp_gob_fwd_append(
 	gdp_buf_write(req->cpdu->datum->dbuf, req->cpdu->dst, sizeof req->cpdu->dst);
 
 	// change the destination to be the final server, not the GOB
-	memcpy(req->cpdu->dst, to_server, sizeof req->cpdu->dst);
+	_gdp_req_set_dst(req, to_server);
 
 	// copy the existing datum, including metadata
 	size_t l = gdp_buf_getlength(datum->dbuf);
@@ -0,0 +1,307 @@
+/* vim: set ai sw=4 sts=4 ts=4 :*/
+
+/*
+**	GDP_LATENCY.C --- per-command latency histograms
+**
+**		Each command (GDP_CMD_*) gets a histogram for each stage
+**		of processing (see GDP_LAT_* in gdp_priv.h), so that slow
+**		operations can be blamed on queueing, lock waits, storage,
+**		crypto, or output rather than guessed at.
+**
+**		The histograms are log-linear in the style of HdrHistogram:
+**		each power of two is split into LAT_SUBBUCKETS linear
+**		buckets, giving about 12% precision from one microsecond to
+**		hours in a fixed, small table.  Recording is a clock read
+**		and a few relaxed atomic adds; nothing is locked.  The
+**		tables for a command are allocated the first time that
+**		command is seen.
+**
+**		They are printed with the rest of the state on SIGINFO
+**		(or SIGUSR1), and gdplogd can post them as admin events.
+**
+**	----- BEGIN LICENSE BLOCK -----
+**	GDP: Global Data Plane Support Library
+**	From the Ubiquitous Swarm Lab, 490 Cory Hall, U.C. Berkeley.
+**
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**	----- END LICENSE BLOCK -----
+*/
+
+#include "gdp.h"
+#include "gdp_priv.h"
+
+#include <ep/ep_dbg.h>
+#include <ep/ep_mem.h>
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("gdp.latency", "GDP command latency");
+
+#define LAT_SUBBITS			3		// log2 of LAT_SUBBUCKETS
+#define LAT_SUBBUCKETS		(1 << LAT_SUBBITS)
+#define LAT_MAXBITS			40		// 2^40 usec is about 12 days
+#define LAT_NBUCKETS		((LAT_MAXBITS - LAT_SUBBITS + 1) * LAT_SUBBUCKETS)
+
+struct lat_hist
+{
+	uint64_t		count;
+	uint64_t		sum;				// usec
+	uint64_t		max;				// usec
+	uint64_t		buckets[LAT_NBUCKETS];
+};
+
+struct lat_cmd
+{
+	struct lat_hist	stages[GDP_LAT_NSTAGES];
+};
+
+static struct lat_cmd	*LatCmds[256];	// indexed by command
+bool					_GdpLatEnabled = true;
+
+static const char	*LatStageNames[GDP_LAT_NSTAGES] =
+{
+	"queue",
+	"lock",
+	"storage",
+	"crypto",
+	"output",
+	"rtt",
+	"total",
+};
+
+const char *
+_gdp_lat_stage_name(int stage)
+{
+	if (stage < 0 || stage >= GDP_LAT_NSTAGES)
+		return "unknown";
+	return LatStageNames[stage];
+}
+
+
+/*
+**  Map between values (in microseconds) and bucket indices.
+**
+**		Values below LAT_SUBBUCKETS get a bucket each; above that
+**		the top LAT_SUBBITS + 1 bits select the bucket.
+*/
+
+static int
+lat_index(uint64_t v)
+{
+	int msb;
+	int i;
+
+	if (v < LAT_SUBBUCKETS)
+		return (int) v;
+	msb = 63 - __builtin_clzll(v);
+	i = (msb - LAT_SUBBITS + 1) * LAT_SUBBUCKETS +
+			(int) ((v >> (msb - LAT_SUBBITS)) & (LAT_SUBBUCKETS - 1));
+	if (i >= LAT_NBUCKETS)
+		i = LAT_NBUCKETS - 1;
+	return i;
+}
+
+// highest value that maps into bucket i
+static uint64_t
+lat_bucket_top(int i)
+{
+	int msb;
+
+	if (i < LAT_SUBBUCKETS)
+		return (uint64_t) i;
+	msb = i / LAT_SUBBUCKETS + LAT_SUBBITS - 1;
+	return ((uint64_t) (LAT_SUBBUCKETS + i % LAT_SUBBUCKETS + 1)
+					<< (msb - LAT_SUBBITS)) - 1;
+}
+
+
+/*
+**  _GDP_LAT_NOW --- timestamp for latency measurement
+**
+**		Returns zero if latency recording is turned off, which
+**		_gdp_lat_record takes to mean "don't record".
+*/
+
+uint64_t
+_gdp_lat_now(void)
+{
+	struct timespec ts;
+
+	if (!_GdpLatEnabled)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + 1;
+}
+
+
+/*
+**  _GDP_LAT_RECORD --- record time since start for a command stage
+*/
+
+void
+_gdp_lat_record(int cmd, int stage, uint64_t start)
+{
+	struct lat_cmd *lc;
+	struct lat_hist *h;
+	uint64_t v;
+	uint64_t max;
+
+	if (start == 0 || stage < 0 || stage >= GDP_LAT_NSTAGES)
+		return;
+	v = _gdp_lat_now();
+	if (v < start)
+		return;
+	v -= start;
+	cmd &= 0xff;
+
+	lc = __atomic_load_n(&LatCmds[cmd], __ATOMIC_ACQUIRE);
+	if (lc == NULL)
+	{
+		struct lat_cmd *nlc = (struct lat_cmd *) ep_mem_zalloc(sizeof *nlc);
+
+		if (__atomic_compare_exchange_n(&LatCmds[cmd], &lc, nlc, false,
+								__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			lc = nlc;
+		else
+			ep_mem_free(nlc);		// someone beat us to it
+	}
+
+	h = &lc->stages[stage];
+	__atomic_fetch_add(&h->buckets[lat_index(v)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (v > max &&
+			!__atomic_compare_exchange_n(&h->max, &max, v, true,
+								__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		continue;
+}
+
+
+/*
+**  _GDP_LAT_SUMMARY --- percentiles for one command and stage
+**
+**		Percentiles are the top of the bucket they fall into, so
+**		they overstate by at most one bucket width.  Returns false
+**		if nothing has been recorded.
+*/
+
+bool
+_gdp_lat_summary(int cmd, int stage, struct gdp_lat_summary *ls)
+{
+	static const double pct[] = { 0.50, 0.90, 0.99, 0.999 };
+	uint64_t *pv[] = { &ls->p50, &ls->p90, &ls->p99, &ls->p999 };
+	uint64_t counts[LAT_NBUCKETS];
+	struct lat_cmd *lc;
+	struct lat_hist *h;
+	uint64_t total = 0;
+	uint64_t cum = 0;
+	unsigned int p = 0;
+	int i;
+
+	memset(ls, 0, sizeof *ls);
+	if (cmd < 0 || cmd > 0xff || stage < 0 || stage >= GDP_LAT_NSTAGES)
+		return false;
+	lc = __atomic_load_n(&LatCmds[cmd], __ATOMIC_ACQUIRE);
+	if (lc == NULL)
+		return false;
+	h = &lc->stages[stage];
+
+	// take a copy so that the percentiles are consistent
+	for (i = 0; i < LAT_NBUCKETS; i++)
+	{
+		counts[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+		total += counts[i];
+	}
+	if (total == 0)
+		return false;
+	ls->count = total;
+	ls->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+	ls->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+	for (i = 0; i < LAT_NBUCKETS && p < sizeof pct / sizeof pct[0]; i++)
+	{
+		cum += counts[i];
+		while (p < sizeof pct / sizeof pct[0] && cum >= pct[p] * total)
+		{
+			uint64_t top = lat_bucket_top(i);
+
+			*pv[p++] = top < ls->max ? top : ls->max;
+		}
+	}
+	return true;
+}
+
+
+/*
+**  _GDP_LAT_DUMP --- print all latency histograms
+*/
+
+void
+_gdp_lat_dump(FILE *fp)
+{
+	int cmd;
+	int stage;
+
+	if (fp == NULL)
+		fp = stderr;
+	fprintf(fp, "\n<<< Command latency (usec) >>>\n");
+	if (!_GdpLatEnabled)
+	{
+		fprintf(fp, "    (not recorded)\n");
+		return;
+	}
+	fprintf(fp, "    %-20s %-8s %10s %8s %8s %8s %8s %8s %10s\n",
+			"command", "stage", "count", "avg", "p50", "p90", "p99",
+			"p99.9", "max");
+	for (cmd = 0; cmd < 256; cmd++)
+	{
+		for (stage = 0; stage < GDP_LAT_NSTAGES; stage++)
+		{
+			struct gdp_lat_summary ls;
+
+			if (!_gdp_lat_summary(cmd, stage, &ls))
+				continue;
+			fprintf(fp, "    %-20s %-8s %10" PRIu64 " %8" PRIu64
+					" %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+					" %10" PRIu64 "\n",
+					_gdp_proto_cmd_name(cmd), LatStageNames[stage],
+					ls.count, ls.sum / ls.count,
+					ls.p50, ls.p90, ls.p99, ls.p999, ls.max);
+		}
+	}
+}
+
+
+/*
+**  _GDP_LAT_INIT --- read parameters
+*/
+
+void
+_gdp_lat_init(void)
+{
+	_GdpLatEnabled = ep_adm_getboolparam("swarm.gdp.latency.enable", true);
+	ep_dbg_cprintf(Dbg, 8, "_gdp_lat_init: latency recording %s\n",
+			_GdpLatEnabled ? "on" : "off");
+}
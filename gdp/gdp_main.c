@@ -40,7 +40,9 @@
 #include <ep/ep_app.h>
 #include <ep/ep_dbg.h>
 #include <ep/ep_funclist.h>
+#include <ep/ep_hash.h>
 #include <ep/ep_log.h>
+#include <ep/ep_mem.h>
 #include <ep/ep_syslog.h>
 
 #include <event2/buffer.h>
@@ -59,8 +61,13 @@ static EP_DBG	DbgTimers = EP_DBG_INIT("gdp.libevent.timers", "GDP timer events")
 struct event_base	*_GdpIoEventBase;	// the base for GDP I/O events
 gdp_name_t			_GdpMyRoutingName;	// source name for PDUs
 gdp_chan_t			*_GdpChannel;		// our primary app-level protocol port
+EP_TIMER_WHEEL		*_GdpTimers;		// leases, idle timeouts, etc.
 static bool			_GdpRunCmdInThread = true;		// run commands in threads
+int					_GdpTraceSample = 0;			// trace one in N commands
 static bool			_GdpRunRespInThread = false;	// run responses in threads
+static bool			_GdpRunPerGob = true;			// one worker per GOB at a time
+gdp_admit_func_t	*_GdpAdmitFunc;		// admission control (servers only)
+gdp_pool_func_t		*_GdpGobPoolFunc;	// per-GOB pools (servers only)
 bool				_GdpLibInitialized;	// are we initialized?
 
 
@@ -148,9 +155,15 @@ process_cmd(void *cpdu_)
 	EP_STAT estat;
 	gdp_gob_t *gob = NULL;
 	gdp_req_t *req = NULL;
+	uint64_t rcvd;
+	uint64_t t0;
+	EP_TRACE_SPAN span;
+	EP_TRACE_SPAN subspan;
 
 	GDP_MSG_CHECK(cpdu, return);
 	cmd = cpdu->msg->cmd;
+	rcvd = cpdu->rcvd;
+	_gdp_lat_record(cmd, GDP_LAT_QUEUE, rcvd);
 
 	ep_dbg_cprintf(Dbg, 40,
 			"process_cmd(%s, thread %" EP_THR_PRItid ")\n",
@@ -160,7 +173,16 @@ process_cmd(void *cpdu_)
 	if (cmd == GDP_CMD_CREATE)
 		ep_thr_mutex_lock(&GdpCreateMutex);
 
+	// join the trace if the sender is tracing this command
+	if (ep_trace_enabled() && cpdu->msg->has_trace_id)
+		ep_trace_set(cpdu->msg->trace_id, cpdu->msg->span_id);
+	ep_trace_begin(&span, "command", _gdp_proto_cmd_name(cmd));
+
+	t0 = _gdp_lat_now();
+	ep_trace_begin(&subspan, "command", "lock");
 	estat = _gdp_gob_cache_get(cpdu->dst, GGCF_NOCREATE, &gob);
+	ep_trace_end(&subspan);
+	_gdp_lat_record(cmd, GDP_LAT_LOCK, t0);
 	if (gob != NULL)
 	{
 		GDP_GOB_ASSERT_ISLOCKED(gob);
@@ -230,9 +252,21 @@ process_cmd(void *cpdu_)
 
 		// send response PDU if appropriate
 		req->rpdu->msg->cmd = (GdpMsgCode) resp;
+		t0 = _gdp_lat_now();
+		ep_trace_begin(&subspan, "command", "output");
+		if (subspan.start != 0)
+		{
+			req->rpdu->msg->has_trace_id = true;
+			req->rpdu->msg->trace_id = ep_trace_id();
+			req->rpdu->msg->has_span_id = true;
+			req->rpdu->msg->span_id = subspan.span_id;
+		}
 		req->stat = _gdp_pdu_out(req->rpdu, req->chan);
+		ep_trace_end(&subspan);
+		_gdp_lat_record(cmd, GDP_LAT_OUTPUT, t0);
 		//XXX anything to do with estat here?
 	}
+	_gdp_lat_record(cmd, GDP_LAT_TOTAL, rcvd);
 
 	EP_ASSERT(gob == req->gob);
 	if (gob != NULL)
@@ -276,6 +310,9 @@ fail0:
 	if (cmd == GDP_CMD_CREATE)
 		ep_thr_mutex_unlock(&GdpCreateMutex);
 
+	ep_trace_end(&span);
+	if (ep_trace_enabled())
+		ep_trace_set(0, 0);
 	ep_dbg_cprintf(Dbg, 40, "process_cmd <<< done\n");
 }
 
@@ -319,24 +356,8 @@ find_req_in_channel_list(
 		goto fail0;
 	}
 
-	LIST_FOREACH(req, &chanx->reqs, chanlist)
-	{
-		if (req->cpdu == NULL)
-			continue;
-		if (ep_dbg_test(Dbg, 48))
-		{
-			gdp_pname_t src_p, dst_p;
-			ep_dbg_printf("    ?cpdu rid %" PRIgdp_rid "\t%s =>\n\t    %s\n",
-					req->cpdu->msg->rid,
-					gdp_printable_name(req->cpdu->src, src_p),
-					gdp_printable_name(req->cpdu->dst, dst_p));
-		}
-		if ((rpdu->msg->rid == GDP_PDU_ANY_RID ||
-					req->cpdu->msg->rid == rpdu->msg->rid) &&
-				GDP_NAME_SAME(req->cpdu->src, rpdu->dst) &&
-				GDP_NAME_SAME(req->cpdu->dst, rpdu->src))
-			break;
-	}
+	// our command went from rpdu->dst to rpdu->src
+	req = _gdp_req_chan_lookup(chanx, rpdu->dst, rpdu->src, rpdu->msg->rid);
 	if (ep_dbg_test(DbgProcResp, 40))
 	{
 		if (req == NULL)
@@ -447,8 +468,7 @@ process_resp(void *rpdu_)
 		// req is already locked by find_req_in_channel_list
 		if (EP_UT_BITSET(GDP_REQ_ON_GOB_LIST, req->flags))
 		{
-			LIST_REMOVE(req, goblist);
-			req->flags &= ~GDP_REQ_ON_GOB_LIST;
+			_gdp_req_gob_unlink(req);
 			//DEBUG: without this incref, a gdp_gob_create call on a log
 			//	that already exists throws the error:
 			//	Assertion failed at gob-create:gdp_gob_mgmt.c:435: GDP_GOB_ISGOOD(gob)
@@ -557,6 +577,14 @@ process_resp(void *rpdu_)
 	// mark this request as active (for subscriptions)
 	ep_time_now(&req->act_ts);
 
+	// note the arrival of a traced response
+	if (ep_trace_enabled() && rpdu->msg->has_trace_id)
+	{
+		ep_trace_set(rpdu->msg->trace_id, rpdu->msg->span_id);
+		ep_trace_instant("response", _gdp_proto_cmd_name(cmd));
+		ep_trace_set(0, 0);
+	}
+
 	// do ack/nak specific processing
 	estat = _gdp_req_dispatch(req, cmd);
 
@@ -642,6 +670,151 @@ process_resp(void *rpdu_)
 }
 
 
+/*
+**  Priority lanes
+**
+**		Commands are run in one of several thread pool classes
+**		so that a flood of one kind of work (typically a bulk
+**		read) can't hold up the others.  Each lane has a weight
+**		and may be limited to a share of the workers; see
+**		ep_thr_pool_setclass.  Responses and anything else not
+**		listed run in the control lane.
+*/
+
+const char	*_GdpLaneNames[GDP_NLANES] =
+{
+	"control",
+	"append",
+	"read",
+	"subscr",
+};
+
+static const struct lane_default
+{
+	int		weight;
+	int		share;
+}	LaneDefaults[GDP_NLANES] =
+{
+	{	4,		100,	},		// control
+	{	4,		100,	},		// append
+	{	1,		40,		},		// read
+	{	2,		25,		},		// subscr
+};
+
+int
+_gdp_cmd_lane(int cmd)
+{
+	switch (cmd)
+	{
+	  case GDP_CMD_APPEND:
+		return GDP_LANE_APPEND;
+
+	  case GDP_CMD_READ_BY_RECNO:
+	  case GDP_CMD_READ_BY_TS:
+	  case GDP_CMD_READ_BY_HASH:
+	  case GDP_CMD_MULTIREAD:
+	  case GDP_CMD_GET_PROOF:
+	  case GDP_CMD_REPLICATE:
+		return GDP_LANE_READ;
+
+	  case GDP_CMD_SUBSCRIBE_BY_RECNO:
+	  case GDP_CMD_SUBSCRIBE_BY_TS:
+	  case GDP_CMD_SUBSCRIBE_BY_HASH:
+	  case GDP_CMD_SUBSCRIBE_GROUP:
+	  case GDP_CMD_SUBSCRIBE_CREDIT:
+		return GDP_LANE_SUBSCR;
+
+	  default:
+		return GDP_LANE_CONTROL;
+	}
+}
+
+static void
+lanes_init(void)
+{
+	int lane;
+
+	for (lane = 0; lane < GDP_NLANES; lane++)
+	{
+		char argname[100];
+		int weight;
+		int share;
+
+		snprintf(argname, sizeof argname, "swarm.gdp.lane.%s.weight",
+				_GdpLaneNames[lane]);
+		weight = ep_adm_getintparam(argname, LaneDefaults[lane].weight);
+		snprintf(argname, sizeof argname, "swarm.gdp.lane.%s.share",
+				_GdpLaneNames[lane]);
+		share = ep_adm_getintparam(argname, LaneDefaults[lane].share);
+		ep_thr_pool_setclass(lane, _GdpLaneNames[lane], weight, share);
+	}
+}
+
+
+/*
+**  Per-GOB serial execution
+**
+**		PDUs for a single GOB are run one at a time, in order of
+**		arrival, on a serial executor scheduled on the thread pool.
+**		This keeps a hot log from tying up more than one worker
+**		(the others would just block on the GOB lock) and lets
+**		work for other logs proceed in parallel.  PDUs addressed
+**		to this process itself (e.g., create or multiread on a log
+**		server) are not tied to a single GOB and go straight to
+**		the pool.
+**
+**		Executors are found by name rather than hung off the GOB
+**		itself so they exist before the GOB is opened and don't
+**		depend on its lifetime.  Idle ones are reclaimed along
+**		with other resources.
+**
+**		A server can set _GdpGobPoolFunc to run the work for some
+**		GOBs on their own thread pool (gdplogd uses one per disk).
+**		This is looked up in the I/O thread, so it mustn't block.
+*/
+
+static EP_HASH			*GobSerials;		// executors, keyed by GOB name
+static EP_THR_MUTEX		GobSerialsMutex		EP_THR_MUTEX_INITIALIZER2(
+												GDP_MUTEX_LORDER_LEAF);
+
+static void
+run_per_gob(gdp_name_t gob_name, void (*func)(void *), gdp_pdu_t *pdu)
+{
+	EP_THR_SERIAL *s;
+	EP_THR_POOL *pool = NULL;
+	int lane = _gdp_cmd_lane(pdu->msg->cmd);
+
+	if (!gdp_name_is_valid(gob_name) ||
+			GDP_NAME_SAME(gob_name, _GdpMyRoutingName))
+	{
+		ep_thr_pool_run_class(lane, func, pdu);
+		return;
+	}
+	if (_GdpGobPoolFunc != NULL)
+		pool = (*_GdpGobPoolFunc)(gob_name);
+	if (!_GdpRunPerGob)
+	{
+		ep_thr_pool_run_in(pool, lane, func, pdu);
+		return;
+	}
+
+	ep_thr_mutex_lock(&GobSerialsMutex);
+	if (GobSerials == NULL)
+		GobSerials = ep_hash_new("GobSerials", NULL, 0);
+	s = (EP_THR_SERIAL *) ep_hash_search(GobSerials,
+								sizeof (gdp_name_t), gob_name);
+	if (s == NULL)
+	{
+		s = ep_thr_serial_new();
+		(void) ep_hash_insert(GobSerials, sizeof (gdp_name_t), gob_name, s);
+	}
+
+	// must be done before unlocking so reclaim can't free it
+	ep_thr_serial_run_in(s, pool, lane, func, pdu);
+	ep_thr_mutex_unlock(&GobSerialsMutex);
+}
+
+
 /*
 **  _GDP_PDU_PROCESS --- process a PDU
 **
@@ -656,18 +829,19 @@ _gdp_pdu_process(gdp_pdu_t *pdu, gdp_chan_t *chan)
 {
 	// use "cheat" field in pdu to pass chan up
 	pdu->chan = chan;
+	pdu->rcvd = _gdp_lat_now();
 
 	if (GDP_CMD_IS_COMMAND(pdu->msg->cmd))
 	{
 		if (_GdpRunCmdInThread)
-			ep_thr_pool_run(&process_cmd, pdu);
+			run_per_gob(pdu->dst, &process_cmd, pdu);
 		else
 			process_cmd(pdu);
 	}
 	else
 	{
 		if (_GdpRunRespInThread)
-			ep_thr_pool_run(&process_resp, pdu);
+			run_per_gob(pdu->src, &process_resp, pdu);
 		else
 			process_resp(pdu);
 	}
@@ -675,28 +849,114 @@ _gdp_pdu_process(gdp_pdu_t *pdu, gdp_chan_t *chan)
 
 
 /*
-**  _GDP_RECLAIM_RESOURCES --- find unused GDP resources and reclaim them
+**  _GDP_GOB_QUEUE_DEPTH --- return number of PDUs waiting for a GOB
 **
-**		This should really also have a maximum number of GOBs to leave
-**		open so we don't run out of file descriptors under high load.
+**		If max_depth is non-NULL it gets the high water mark.
+**		Both are zero if nothing has been queued recently.
+*/
+
+int
+_gdp_gob_queue_depth(const gdp_name_t gob_name, int *max_depth)
+{
+	EP_THR_SERIAL *s = NULL;
+	int depth = 0;
+
+	if (max_depth != NULL)
+		*max_depth = 0;
+	ep_thr_mutex_lock(&GobSerialsMutex);
+	if (GobSerials != NULL)
+		s = (EP_THR_SERIAL *) ep_hash_search(GobSerials,
+									sizeof (gdp_name_t), gob_name);
+	if (s != NULL)
+		depth = ep_thr_serial_depth(s, max_depth);
+	ep_thr_mutex_unlock(&GobSerialsMutex);
+	return depth;
+}
+
+
+/*
+**  Release executors for GOBs that have gone quiet.
+*/
+
+struct idle_serials
+{
+	int				n;
+	int				max;
+	gdp_name_t		*names;
+};
+
+static void
+find_idle_serial(size_t keylen, const void *key, const void *val, va_list av)
+{
+	struct idle_serials *idle = va_arg(av, struct idle_serials *);
+
+	if (!ep_thr_serial_idle((EP_THR_SERIAL *) val))
+		return;
+	if (idle->n >= idle->max)
+	{
+		idle->max = idle->max == 0 ? 32 : idle->max * 2;
+		idle->names = (gdp_name_t *) ep_mem_realloc(idle->names,
+								idle->max * sizeof *idle->names);
+	}
+	memcpy(idle->names[idle->n++], key, sizeof (gdp_name_t));
+}
+
+static void
+reclaim_gob_serials(void)
+{
+	struct idle_serials idle = { 0, 0, NULL };
+	int i;
+
+	ep_thr_mutex_lock(&GobSerialsMutex);
+	if (GobSerials != NULL)
+		ep_hash_forall(GobSerials, find_idle_serial, &idle);
+	for (i = 0; i < idle.n; i++)
+	{
+		EP_THR_SERIAL *s = (EP_THR_SERIAL *) ep_hash_delete(GobSerials,
+									sizeof (gdp_name_t), idle.names[i]);
+		if (s != NULL)
+			ep_thr_serial_free(s);
+	}
+	ep_thr_mutex_unlock(&GobSerialsMutex);
+	ep_dbg_cprintf(Dbg, 69, "reclaim_gob_serials: freed %d\n", idle.n);
+	if (idle.names != NULL)
+		ep_mem_free(idle.names);
+}
+
+
+/*
+**  _GDP_RECLAIM_RESOURCES --- find unused GDP resources and reclaim them
 **
-**		This implementation locks the GclsByUse list during the
-**		entire operation.  That's probably not the best idea.
+**		Idle GOBs are normally reclaimed by their own timers (see
+**		gdp_gob_cache.c); this only sweeps the GOB cache if we are
+**		running short of file descriptors.
 */
 
 void
 _gdp_reclaim_resources(void *null)
+{
+	ep_dbg_cprintf(Dbg, 69, "_gdp_reclaim_resources\n");
+	_gdp_gob_cache_reclaim(_gdp_reclaim_age());
+	reclaim_gob_serials();
+}
+
+
+/*
+**  _GDP_RECLAIM_AGE --- how long to leave GOBs open before reclaiming
+*/
+
+time_t
+_gdp_reclaim_age(void)
 {
 	char pbuf[200];
-	time_t reclaim_age;		// how long to leave GOBs open before reclaiming
+	time_t reclaim_age;
 
-	ep_dbg_cprintf(Dbg, 69, "_gdp_reclaim_resources\n");
 	snprintf(pbuf, sizeof pbuf, "swarm.%s.reclaim.age", ep_app_getprogname());
 	reclaim_age = ep_adm_getlongparam(pbuf, -1);
 	if (reclaim_age == -1)
 		reclaim_age = ep_adm_getlongparam("swarm.gdp.reclaim.age",
 									GDP_RECLAIM_AGE_DEF);
-	_gdp_gob_cache_reclaim(reclaim_age);
+	return reclaim_age;
 }
 
 // stub for libevent
@@ -739,6 +999,33 @@ _gdp_reclaim_resources_init(void (*f)(int, short, void *))
 }
 
 
+/*
+**  Run the timer wheel from the event loop.
+**
+**		The tick (in milliseconds) is the resolution of all timers
+**		on the wheel.  The wheel only needs to be looked at once a tick; it
+**		catches up on its own if a tick is missed.
+*/
+
+static long
+gdp_timer_tick(void)
+{
+	long tick_ms = ep_adm_getlongparam("swarm.gdp.timer.tick", 100);
+
+	return tick_ms > 0 ? tick_ms : 100;
+}
+
+static void
+gdp_timers_callback(int fd, short what, void *ctx)
+{
+	int nfired = ep_timer_wheel_run(_GdpTimers);
+
+	if (nfired > 0)
+		ep_dbg_cprintf(DbgTimers, 44, "gdp_timers_callback: %d fired\n",
+				nfired);
+}
+
+
 /*
 **  Set libevent timer.
 **
@@ -964,6 +1251,38 @@ _gdp_chan_dumpreqs(gdp_chan_t *chan, FILE *fp)
 extern const char	GdpVersion[];
 EP_FUNCLIST			*_GdpDumpFuncs;
 
+// write the trace rings to a file (they are too big for stderr)
+static void
+dump_trace(FILE *fp)
+{
+	char pbuf[200];
+	const char *path;
+	FILE *tfp;
+	int n;
+
+	if (!ep_trace_enabled())
+		return;
+	path = ep_adm_getstrparam("swarm.gdp.trace.file", NULL);
+	if (path == NULL)
+	{
+		const char *progname = ep_app_getprogname();
+
+		snprintf(pbuf, sizeof pbuf, "/tmp/%s.%d.trace.json",
+				progname == NULL ? "gdp" : progname, (int) getpid());
+		path = pbuf;
+	}
+	fprintf(fp, "\n<<< Trace >>>\n");
+	tfp = fopen(path, "w");
+	if (tfp == NULL)
+	{
+		fprintf(fp, "    cannot create %s: %s\n", path, strerror(errno));
+		return;
+	}
+	n = ep_trace_dump(tfp);
+	fclose(tfp);
+	fprintf(fp, "    %d events written to %s\n", n, path);
+}
+
 void
 _gdp_dump_state(int plev)
 {
@@ -984,6 +1303,10 @@ _gdp_dump_state(int plev)
 	fprintf(fp, "\n<<< Statistics >>>\n");
 	_gdp_req_pr_stats(fp);
 	_gdp_gob_pr_stats(fp);
+	_gdp_lat_dump(fp);
+	ep_mem_account_dump(fp);
+	ep_thr_lockprof_dump(fp, ep_adm_getintparam("libep.thr.lockprof.top", 20));
+	dump_trace(fp);
 	funlockfile(fp);
 }
 
@@ -999,6 +1322,62 @@ siginfo(int sig, short what, void *arg)
 
 
 
+/*
+**  Memory accounting setup.
+**
+**		libevent buffers are routed through ep_mem so that they
+**		can be charged to their own tag.  This has to happen
+**		before libevent allocates anything.
+*/
+
+int		_GdpMemTagPdu;
+int		_GdpMemTagDatum;
+int		_GdpMemTagGob;
+int		_GdpMemTagEvbuf;
+int		_GdpMemTagProtobuf;
+
+static void *
+evmem_malloc(size_t size)
+{
+	int otag = ep_mem_tag_set(_GdpMemTagEvbuf);
+	void *p = ep_mem_malloc(size);
+
+	ep_mem_tag_set(otag);
+	return p;
+}
+
+static void *
+evmem_realloc(void *p, size_t size)
+{
+	int otag = ep_mem_tag_set(_GdpMemTagEvbuf);
+
+	p = ep_mem_realloc(p, size);
+	ep_mem_tag_set(otag);
+	return p;
+}
+
+static void
+evmem_free(void *p)
+{
+	if (p != NULL)
+		ep_mem_free(p);
+}
+
+static void
+mem_account_init(void)
+{
+	ep_mem_account_init();
+	if (!_EpMemAccount)
+		return;
+	_GdpMemTagPdu = ep_mem_tag_register("pdu");
+	_GdpMemTagDatum = ep_mem_tag_register("datum");
+	_GdpMemTagGob = ep_mem_tag_register("gob");
+	_GdpMemTagEvbuf = ep_mem_tag_register("evbuffer");
+	_GdpMemTagProtobuf = ep_mem_tag_register("protobuf");
+	event_set_mem_functions(&evmem_malloc, &evmem_realloc, &evmem_free);
+}
+
+
 /*
 **  Initialization, Part 0:
 **		Initialize external libraries.
@@ -1025,6 +1404,8 @@ gdp_init_phase_0(const char *progname, uint32_t flags)
 		progname = ep_app_getprogname();
 	if (progname != NULL)
 		_gdp_adm_readparams(progname);
+	ep_thr_lockprof_init();
+	mem_account_init();
 	ep_crypto_init(0);
 
 	// clear out spurious errors
@@ -1103,6 +1484,15 @@ gdp_lib_init(const char *progname, const char *myname, uint32_t flags)
 									true);
 	_GdpRunRespInThread = ep_adm_getboolparam("swarm.gdp.response.runinthread",
 									false);
+	_GdpRunPerGob = ep_adm_getboolparam("swarm.gdp.runpergob", true);
+	lanes_init();
+
+	// request tracing (see <ep/ep_trace.h>)
+	if (ep_adm_getboolparam("swarm.gdp.trace.enable", false))
+	{
+		ep_trace_init(ep_adm_getintparam("swarm.gdp.trace.events", 8192));
+		_GdpTraceSample = ep_adm_getintparam("swarm.gdp.trace.sample", 100);
+	}
 
 	// figure out or generate our name (for routing)
 	if (myname == NULL && progname != NULL)
@@ -1158,6 +1548,10 @@ gdp_lib_init(const char *progname, const char *myname, uint32_t flags)
 				gdp_printable_name(_GdpMyRoutingName, pname));
 	}
 
+	// timers for leases, idle GOBs, etc.; the cache needs this
+	if (_GdpTimers == NULL)
+		_GdpTimers = ep_timer_wheel_new(gdp_timer_tick() * 1000, 0);
+
 	// initialize the GOB cache.  In theory this "cannot fail"
 	estat = _gdp_gob_cache_init();
 	EP_STAT_CHECK(estat, goto fail0);
@@ -1191,9 +1585,24 @@ gdp_lib_init(const char *progname, const char *myname, uint32_t flags)
 		event_add(evsignal_new(_GdpIoEventBase, SIGINFO, siginfo, NULL), NULL);
 #endif
 		event_add(evsignal_new(_GdpIoEventBase, SIGUSR1, siginfo, NULL), NULL);
+
+		// advance the timer wheel once a tick
+		{
+			long tick_ms = gdp_timer_tick();
+			struct timeval tv;
+
+			tv.tv_sec = tick_ms / 1000;
+			tv.tv_usec = (tick_ms % 1000) * 1000;
+			event_add(event_new(_GdpIoEventBase, -1, EV_PERSIST,
+							gdp_timers_callback, NULL), &tv);
+		}
 	}
 
 	estat = _gdp_chan_init(_GdpIoEventBase, NULL);
+	_gdp_pdu_init();
+	_gdp_lat_init();
+	if (EP_STAT_ISOK(estat))
+		(void) _gdp_metrics_init(_GdpIoEventBase);
 
 done:
 fail0:
@@ -1237,6 +1646,60 @@ _gdp_evloop_init(void)
 */
 
 
+/*
+**  ADMIT_CMD --- apply admission control to an incoming command
+**
+**		Called in the I/O thread before the command is queued, so
+**		a server can turn away clients it cannot afford without
+**		letting them fill up the thread pool.  Refused commands
+**		get a NAK_C_TOOMANY with a hint of when to try again
+**		(blind commands are just dropped).
+**
+**		Returns false (and frees the PDU) if the command is refused.
+*/
+
+static bool
+admit_cmd(gdp_pdu_t *pdu, size_t payload_len, gdp_chan_t *chan)
+{
+	EP_STAT estat;
+	uint32_t retry_ms = 0;
+
+	estat = (*_GdpAdmitFunc)(pdu, payload_len, &retry_ms);
+	if (EP_STAT_ISOK(estat))
+		return true;
+
+	if (ep_dbg_test(Dbg, 12))
+	{
+		gdp_pname_t src_p, dst_p;
+		char ebuf[100];
+
+		ep_dbg_printf("admit_cmd: refusing %s from %s to %s:\n"
+				"    %s, retry after %" PRIu32 " ms\n",
+				_gdp_proto_cmd_name(pdu->msg->cmd),
+				gdp_printable_name(pdu->src, src_p),
+				gdp_printable_name(pdu->dst, dst_p),
+				ep_stat_tostr(estat, ebuf, sizeof ebuf), retry_ms);
+	}
+
+	if (GDP_CMD_NEEDS_ACK(pdu->msg->cmd))
+	{
+		gdp_msg_t *msg = _gdp_msg_new(GDP_NAK_C_TOOMANY, pdu->msg->rid,
+									pdu->msg->l5seqno);
+		gdp_pdu_t *rpdu = _gdp_pdu_new(msg, pdu->dst, pdu->src,
+									GDP_SEQNO_NONE);
+
+		msg->nak->ep_stat = EP_STAT_TO_INT(estat);
+		msg->nak->has_ep_stat = true;
+		msg->nak->retry_after = retry_ms;
+		msg->nak->has_retry_after = true;
+		(void) _gdp_pdu_out(rpdu, chan);
+		_gdp_pdu_free(&rpdu);
+	}
+	_gdp_pdu_free(&pdu);
+	return false;
+}
+
+
 /*
 **  Data Ready (Receive) callback
 **
@@ -1260,6 +1723,10 @@ _gdp_io_recv(
 	estat = _gdp_pdu_in(pdu, payload_buf, payload_len, chan);
 	EP_STAT_CHECK(estat, goto fail0);
 
+	if (_GdpAdmitFunc != NULL && GDP_CMD_IS_COMMAND(pdu->msg->cmd) &&
+			!admit_cmd(pdu, payload_len, chan))
+		goto fail0;
+
 	_gdp_pdu_process(pdu, chan);
 	// _gdp_pdu_process frees pdu, possibly in a thread
 
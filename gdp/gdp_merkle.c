@@ -0,0 +1,171 @@
+/* vim: set ai sw=4 sts=4 ts=4 :*/
+
+/*
+**	Merkle tree support (shared by clients and log servers)
+**
+**		Log servers fold the hashes of the records in a log into a
+**		Merkle tree and periodically record checkpoints (the tree
+**		size and root hash, signed when the server has the key).
+**		A record can then be shown to be part of a checkpoint with
+**		an audit path of O(log n) hashes rather than by walking the
+**		whole prevhash chain.
+**
+**		The tree shape and hashing follow RFC 6962 (Certificate
+**		Transparency): leaves are H(0x00 || record hash), interior
+**		nodes are H(0x01 || left || right), and a tree of n leaves
+**		is split at the largest power of two less than n.  H is
+**		always SHA-256, independent of the hash used for records.
+**
+**	----- BEGIN LICENSE BLOCK -----
+**	GDP: Global Data Plane Support Library
+**	From the Ubiquitous Swarm Lab, 490 Cory Hall, U.C. Berkeley.
+**
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**	----- END LICENSE BLOCK -----
+*/
+
+#include "gdp.h"
+#include "gdp_priv.h"
+
+#include <ep/ep_crypto.h>
+#include <ep/ep_dbg.h>
+
+#include <string.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("gdp.merkle", "GDP Merkle tree support");
+
+
+/*
+**  _GDP_MERKLE_LEAF --- compute the leaf hash for a record hash
+*/
+
+void
+_gdp_merkle_leaf(const void *rechash, size_t rechashlen, uint8_t *out)
+{
+	uint8_t buf[1 + EP_CRYPTO_MAX_DIGEST];
+
+	if (rechashlen > EP_CRYPTO_MAX_DIGEST)
+		rechashlen = EP_CRYPTO_MAX_DIGEST;
+	buf[0] = 0x00;
+	memcpy(&buf[1], rechash, rechashlen);
+	ep_crypto_md_sha256(buf, 1 + rechashlen, out);
+}
+
+
+/*
+**  _GDP_MERKLE_NODE --- compute an interior node from its children
+*/
+
+void
+_gdp_merkle_node(const uint8_t *left, const uint8_t *right, uint8_t *out)
+{
+	uint8_t buf[1 + 2 * GDP_MERKLE_HASHLEN];
+
+	buf[0] = 0x01;
+	memcpy(&buf[1], left, GDP_MERKLE_HASHLEN);
+	memcpy(&buf[1 + GDP_MERKLE_HASHLEN], right, GDP_MERKLE_HASHLEN);
+	ep_crypto_md_sha256(buf, sizeof buf, out);
+}
+
+
+/*
+**  _GDP_MERKLE_PATH_ROOT --- compute the root implied by an audit path
+**
+**		Given the leaf hash for leaf number leafidx (zero based) in
+**		a tree of treesize leaves and its audit path (ordered from
+**		the leaf up), compute the root of the tree.  The caller
+**		compares that to the checkpoint.  Returns
+**		GDP_STAT_MERKLE_PROOF_FAIL if the path has the wrong shape
+**		for that leaf and tree size.
+**
+**		This is the verification algorithm from RFC 9162 2.1.3.2.
+*/
+
+EP_STAT
+_gdp_merkle_path_root(uint64_t leafidx,
+			uint64_t treesize,
+			const uint8_t *leaf,
+			int npath,
+			const uint8_t *const *path,
+			uint8_t *root)
+{
+	uint64_t fn = leafidx;
+	uint64_t sn = treesize - 1;
+	uint8_t r[GDP_MERKLE_HASHLEN];
+	int i;
+
+	if (leafidx >= treesize)
+		return GDP_STAT_MERKLE_PROOF_FAIL;
+	memcpy(r, leaf, sizeof r);
+	for (i = 0; i < npath; i++)
+	{
+		if (sn == 0)
+			return GDP_STAT_MERKLE_PROOF_FAIL;
+		if ((fn & 1) != 0 || fn == sn)
+		{
+			_gdp_merkle_node(path[i], r, r);
+			while ((fn & 1) == 0 && fn != 0)
+			{
+				fn >>= 1;
+				sn >>= 1;
+			}
+		}
+		else
+		{
+			_gdp_merkle_node(r, path[i], r);
+		}
+		fn >>= 1;
+		sn >>= 1;
+	}
+	if (sn != 0)
+	{
+		ep_dbg_cprintf(Dbg, 10, "_gdp_merkle_path_root: path too short\n");
+		return GDP_STAT_MERKLE_PROOF_FAIL;
+	}
+	memcpy(root, r, sizeof r);
+	return EP_STAT_OK;
+}
+
+
+/*
+**  _GDP_MERKLE_CKPT_DIGEST --- add a checkpoint to a signing digest
+**
+**		The digest should already include the log name and metadata
+**		(as for record signatures) so a checkpoint cannot be moved
+**		to a different log.
+*/
+
+void
+_gdp_merkle_ckpt_digest(EP_CRYPTO_MD *md,
+			uint64_t treesize,
+			const EP_TIME_SPEC *ts,
+			const uint8_t *root)
+{
+	uint8_t buf[8 + 8 + 4 + GDP_MERKLE_HASHLEN];
+	uint8_t *pbp = buf;
+
+	PUT64(treesize);
+	PUT64(ts->tv_sec);
+	PUT32(ts->tv_nsec);
+	memcpy(pbp, root, GDP_MERKLE_HASHLEN);
+	ep_crypto_md_update(md, buf, sizeof buf);
+}
@@ -0,0 +1,251 @@
+/* vim: set ai sw=4 sts=4 ts=4 :*/
+
+/*
+**	GDP_METRICS.C --- export metrics on a local socket
+**
+**		If swarm.gdp.metrics.socket names a path, a Unix domain
+**		socket is created there and every connection to it gets
+**		all registered metrics (see <ep/ep_metric.h>) in the
+**		Prometheus text format, after which the connection is
+**		closed.  If the peer starts by sending an HTTP GET the
+**		response has an HTTP header, so a scraper can talk to it
+**		directly; anything else (e.g., "socat - UNIX:path") just
+**		gets the text.
+**
+**		Accepting is done in the I/O thread; the formatting and
+**		writing is done in a worker thread so a slow reader never
+**		holds up the event loop.
+**
+**	----- BEGIN LICENSE BLOCK -----
+**	GDP: Global Data Plane Support Library
+**	From the Ubiquitous Swarm Lab, 490 Cory Hall, U.C. Berkeley.
+**
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**	----- END LICENSE BLOCK -----
+*/
+
+#include "gdp.h"
+#include "gdp_priv.h"
+
+#include <ep/ep_app.h>
+#include <ep/ep_dbg.h>
+#include <ep/ep_log.h>
+#include <ep/ep_metric.h>
+#include <ep/ep_string.h>
+#include <ep/ep_thr.h>
+
+#include <event2/event.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("gdp.metrics", "GDP metrics export");
+
+#define METRICS_REQ_WAIT_MS		100		// time to wait for a request line
+#define METRICS_SEND_TIMEOUT	5		// seconds to write a response
+
+
+/*
+**  Thread pool lane gauges (computed when exported)
+*/
+
+static int64_t
+lane_depth(EP_METRIC *m, void *lane_)
+{
+	EP_THR_POOL_STATS st;
+
+	ep_thr_pool_getstats((int) (intptr_t) lane_, &st, false);
+	return st.depth;
+}
+
+static int64_t
+lane_running(EP_METRIC *m, void *lane_)
+{
+	EP_THR_POOL_STATS st;
+
+	ep_thr_pool_getstats((int) (intptr_t) lane_, &st, false);
+	return st.running;
+}
+
+static void
+register_lanes(void)
+{
+	int lane;
+
+	for (lane = 0; lane < GDP_NLANES; lane++)
+	{
+		char labels[40];
+
+		snprintf(labels, sizeof labels, "lane=\"%s\"", _GdpLaneNames[lane]);
+		ep_metric_new(EP_METRIC_GAUGE, "pool", "lane_depth",
+				"Commands waiting for a worker", labels,
+				&lane_depth, (void *) (intptr_t) lane);
+		ep_metric_new(EP_METRIC_GAUGE, "pool", "lane_running",
+				"Commands being run", labels,
+				&lane_running, (void *) (intptr_t) lane);
+	}
+}
+
+
+/*
+**  METRICS_SERVE --- send the metrics to one client (in a worker)
+*/
+
+static void
+metrics_serve(void *fd_)
+{
+	int fd = (int) (intptr_t) fd_;
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	struct timeval tv = { METRICS_SEND_TIMEOUT, 0 };
+	char rbuf[512];
+	ssize_t rlen = 0;
+	FILE *fp;
+
+	// see if they are speaking HTTP (but don't wait long)
+	if (poll(&pfd, 1, METRICS_REQ_WAIT_MS) > 0)
+		rlen = read(fd, rbuf, sizeof rbuf);
+
+	(void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+	fp = fdopen(fd, "w");
+	if (fp == NULL)
+	{
+		ep_dbg_cprintf(Dbg, 1, "metrics_serve: fdopen: %s\n",
+				strerror(errno));
+		close(fd);
+		return;
+	}
+	if (rlen >= 4 && strncmp(rbuf, "GET ", 4) == 0)
+	{
+		fprintf(fp, "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\n"
+				"Connection: close\r\n"
+				"\r\n");
+	}
+	ep_metric_export(fp, "gdp");
+	fclose(fp);
+}
+
+
+/*
+**  METRICS_ACCEPT --- a client has connected (in the I/O thread)
+*/
+
+static void
+metrics_accept(int lfd, short what, void *unused)
+{
+	int fd = accept(lfd, NULL, NULL);
+
+	if (fd < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			ep_dbg_cprintf(Dbg, 1, "metrics_accept: %s\n", strerror(errno));
+		return;
+	}
+	ep_dbg_cprintf(Dbg, 20, "metrics_accept: fd %d\n", fd);
+	ep_thr_pool_run(&metrics_serve, (void *) (intptr_t) fd);
+}
+
+
+/*
+**  _GDP_METRICS_INIT --- register library metrics and start exporter
+**
+**		Failing to start the exporter is logged but not fatal.
+*/
+
+EP_STAT
+_gdp_metrics_init(event_base_t *evbase)
+{
+	const char *path;
+	struct sockaddr_un sun;
+	struct event *ev;
+	EP_STAT estat;
+	int lfd;
+
+	register_lanes();
+
+	path = ep_adm_getstrparam("swarm.gdp.metrics.socket", NULL);
+	if (path == NULL || *path == '\0')
+		return EP_STAT_OK;
+	memset(&sun, 0, sizeof sun);
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof sun.sun_path)
+	{
+		estat = EP_STAT_BUF_OVERFLOW;
+		goto fail0;
+	}
+	strlcpy(sun.sun_path, path, sizeof sun.sun_path);
+
+	// don't steal the socket from a live process
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd < 0)
+		goto fail1;
+	if (connect(lfd, (struct sockaddr *) &sun, sizeof sun) == 0)
+	{
+		close(lfd);
+		estat = ep_stat_from_errno(EADDRINUSE);
+		goto fail0;
+	}
+
+	// a socket that failed to connect can't be reused, so start over
+	close(lfd);
+	(void) unlink(path);
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd < 0)
+		goto fail1;
+
+	if (bind(lfd, (struct sockaddr *) &sun, sizeof sun) < 0 ||
+			chmod(path, ep_adm_getintparam("swarm.gdp.metrics.mode",
+									0660)) < 0 ||
+			listen(lfd, 8) < 0 ||
+			fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK) < 0)
+	{
+		int err = errno;
+
+		close(lfd);
+		errno = err;
+		goto fail1;
+	}
+
+	ev = event_new(evbase, lfd, EV_READ | EV_PERSIST, &metrics_accept, NULL);
+	if (ev == NULL || event_add(ev, NULL) < 0)
+	{
+		if (ev != NULL)
+			event_free(ev);
+		close(lfd);
+		(void) unlink(path);
+		estat = EP_STAT_OUT_OF_MEMORY;
+		goto fail0;
+	}
+	ep_dbg_cprintf(Dbg, 8, "_gdp_metrics_init: exporting on %s\n", path);
+	return EP_STAT_OK;
+
+fail1:
+	estat = ep_stat_from_errno(errno);
+fail0:
+	ep_log(estat, "cannot export metrics on %s", path);
+	return estat;
+}
@@ -34,6 +34,7 @@
 #include <ep/ep_dbg.h>
 #include <ep/ep_hexdump.h>
 #include <ep/ep_log.h>
+#include <ep/ep_mem.h>
 #include <ep/ep_prflags.h>
 #include <ep/ep_stat.h>
 
@@ -156,6 +157,43 @@ _gdp_msg_new(gdp_cmd_t cmd, gdp_rid_t rid, gdp_l5seqno_t l5seqno)
 						msg->cmd_subscribe_by_hash);
 		break;
 
+	case GDP_CMD_MULTIREAD:
+		msg->body_case = GDP_MESSAGE__BODY_CMD_MULTIREAD;
+		msg->cmd_multiread = (GdpMessage__CmdMultiread *)
+					ep_mem_zalloc(sizeof *msg->cmd_multiread);
+		gdp_message__cmd_multiread__init(msg->cmd_multiread);
+		// individual selectors need to be allocated and initialized when set
+		break;
+
+	case GDP_CMD_SUBSCRIBE_GROUP:
+		msg->body_case = GDP_MESSAGE__BODY_CMD_SUBSCRIBE_GROUP;
+		msg->cmd_subscribe_group = (GdpMessage__CmdSubscribeGroup *)
+					ep_mem_zalloc(sizeof *msg->cmd_subscribe_group);
+		gdp_message__cmd_subscribe_group__init(msg->cmd_subscribe_group);
+		// individual selectors need to be allocated and initialized when set
+		break;
+
+	case GDP_CMD_GET_PROOF:
+		msg->body_case = GDP_MESSAGE__BODY_CMD_GET_PROOF;
+		msg->cmd_get_proof = (GdpMessage__CmdGetProof *)
+					ep_mem_zalloc(sizeof *msg->cmd_get_proof);
+		gdp_message__cmd_get_proof__init(msg->cmd_get_proof);
+		break;
+
+	case GDP_CMD_REPLICATE:
+		msg->body_case = GDP_MESSAGE__BODY_CMD_REPLICATE;
+		msg->cmd_replicate = (GdpMessage__CmdReplicate *)
+					ep_mem_zalloc(sizeof *msg->cmd_replicate);
+		gdp_message__cmd_replicate__init(msg->cmd_replicate);
+		break;
+
+	case GDP_CMD_SUBSCRIBE_CREDIT:
+		msg->body_case = GDP_MESSAGE__BODY_CMD_SUBSCRIBE_CREDIT;
+		msg->cmd_subscribe_credit = (GdpMessage__CmdSubscribeCredit *)
+					ep_mem_zalloc(sizeof *msg->cmd_subscribe_credit);
+		gdp_message__cmd_subscribe_credit__init(msg->cmd_subscribe_credit);
+		break;
+
 	case GDP_ACK_CHANGED:
 		msg->body_case = GDP_MESSAGE__BODY_ACK_CHANGED;
 		msg->ack_changed = (GdpMessage__AckChanged *)
@@ -177,6 +215,14 @@ _gdp_msg_new(gdp_cmd_t cmd, gdp_rid_t rid, gdp_l5seqno_t l5seqno)
 //		gdp_datum__init(msg->ack_content->datum);
 		break;
 
+	case GDP_ACK_MULTI_CONTENT:
+		msg->body_case = GDP_MESSAGE__BODY_ACK_MULTI_CONTENT;
+		msg->ack_multi_content = (GdpMessage__AckMultiContent *)
+					ep_mem_zalloc(sizeof *msg->ack_multi_content);
+		gdp_message__ack_multi_content__init(msg->ack_multi_content);
+		// individual results need to be allocated and initialized when set
+		break;
+
 	case GDP_ACK_END_OF_RESULTS:
 		msg->body_case = GDP_MESSAGE__BODY_ACK_END_OF_RESULTS;
 		msg->ack_end_of_results = (GdpMessage__AckEndOfResults *)
@@ -214,11 +260,52 @@ _gdp_msg_new(gdp_cmd_t cmd, gdp_rid_t rid, gdp_l5seqno_t l5seqno)
 }
 
 
+/*
+**  Allocator for protobuf-c.
+**
+**		Messages are built from ep_mem allocations, so they have
+**		to be freed the same way (accounted blocks can't be handed
+**		to free(3)).  Unpacked messages are charged to the
+**		protobuf memory tag.  Large payloads may be wire blocks
+**		shared with a datum or a buffer being sent.  Received
+**		messages live in their PDU's arena and are freed with
+**		_gdp_pdu_msg_free, never directly with this allocator.
+*/
+
+static void *
+pb_alloc(void *unused, size_t size)
+{
+	int otag = ep_mem_tag_set(_GdpMemTagProtobuf);
+	void *p = ep_mem_malloc(size);
+
+	ep_mem_tag_set(otag);
+	return p;
+}
+
+static void
+pb_free(void *unused, void *p)
+{
+	if (p == NULL)
+		return;
+	if (_gdp_buf_is_wblock(p, 0))
+		_gdp_buf_wblock_free((uint8_t *) p);
+	else
+		ep_mem_free(p);
+}
+
+ProtobufCAllocator	_GdpProtobufAllocator =
+{
+	&pb_alloc,
+	&pb_free,
+	NULL,
+};
+
+
 void
 _gdp_msg_free(gdp_msg_t **pmsg)
 {
 	ep_dbg_cprintf(Dbg, 24, "_gdp_msg_free(%p)\n", *pmsg);
-	gdp_message__free_unpacked(*pmsg, NULL);
+	gdp_message__free_unpacked(*pmsg, &_GdpProtobufAllocator);
 	*pmsg = NULL;
 }
 
@@ -368,6 +455,10 @@ _gdp_msg_dump(const gdp_msg_t *msg, FILE *fp, int indent)
 				_gdp_pr_indent(indent), msg->cmd_read_by_recno->recno);
 		if (msg->cmd_read_by_recno->has_nrecs)
 			fprintf(fp, ", nrecs %"PRId32, msg->cmd_read_by_recno->nrecs);
+		if (msg->cmd_read_by_recno->has_maxbytes)
+			fprintf(fp, ", maxbytes %"PRIu32, msg->cmd_read_by_recno->maxbytes);
+		if (msg->cmd_read_by_recno->has_cont)
+			fprintf(fp, ", cont (%zd bytes)", msg->cmd_read_by_recno->cont.len);
 		fprintf(fp, "\n");
 		break;
 
@@ -389,6 +480,9 @@ _gdp_msg_dump(const gdp_msg_t *msg, FILE *fp, int indent)
 					_gdp_pr_indent(indent),
 					msg->cmd_subscribe_by_recno->start,
 					msg->cmd_subscribe_by_recno->nrecs);
+		if (msg->cmd_subscribe_by_recno->has_window)
+			fprintf(fp, "%swindow %" PRId32 "\n", _gdp_pr_indent(indent),
+					msg->cmd_subscribe_by_recno->window);
 		break;
 
 	case GDP_MESSAGE__BODY_CMD_SUBSCRIBE_BY_TS:
@@ -411,6 +505,66 @@ _gdp_msg_dump(const gdp_msg_t *msg, FILE *fp, int indent)
 		fprintf(fp, "cmd_delete: (no payload)\n");
 		break;
 
+	case GDP_MESSAGE__BODY_CMD_MULTIREAD:
+		fprintf(fp, "cmd_multiread: nlogs %zd\n",
+				msg->cmd_multiread->n_sel);
+		for (dno = 0; dno < msg->cmd_multiread->n_sel; dno++)
+		{
+			GdpMessage__CmdMultiread__Selector *sel =
+						msg->cmd_multiread->sel[dno];
+
+			if (sel->logname.len == sizeof (gdp_name_t))
+				gdp_printable_name(sel->logname.data, pname);
+			else
+				snprintf(pname, sizeof pname, "(bad name)");
+			fprintf(fp, "%s[%d] %s recno %" PRIgdp_recno "\n",
+					_gdp_pr_indent(indent), dno, pname, sel->recno);
+		}
+		break;
+
+	case GDP_MESSAGE__BODY_CMD_SUBSCRIBE_GROUP:
+		fprintf(fp, "cmd_subscribe_group: nlogs %zd%s\n",
+				msg->cmd_subscribe_group->n_sel,
+				msg->cmd_subscribe_group->renew ? " (renew)" : "");
+		for (dno = 0; dno < msg->cmd_subscribe_group->n_sel; dno++)
+		{
+			GdpMessage__CmdSubscribeGroup__Selector *sel =
+						msg->cmd_subscribe_group->sel[dno];
+
+			if (sel->logname.len == sizeof (gdp_name_t))
+				gdp_printable_name(sel->logname.data, pname);
+			else
+				snprintf(pname, sizeof pname, "(bad name)");
+			fprintf(fp, "%s[%d] %s start %" PRIgdp_recno "\n",
+					_gdp_pr_indent(indent), dno, pname, sel->start);
+		}
+		break;
+
+	case GDP_MESSAGE__BODY_CMD_GET_PROOF:
+		fprintf(fp, "cmd_get_proof: recno %" PRIgdp_recno,
+				msg->cmd_get_proof->recno);
+		if (msg->cmd_get_proof->has_treesize)
+			fprintf(fp, ", treesize %" PRIu64, msg->cmd_get_proof->treesize);
+		fprintf(fp, "\n");
+		break;
+
+	case GDP_MESSAGE__BODY_CMD_REPLICATE:
+		if (msg->cmd_replicate->logname.len == sizeof (gdp_name_t))
+			gdp_printable_name(msg->cmd_replicate->logname.data, pname);
+		else
+			snprintf(pname, sizeof pname, "(bad name)");
+		fprintf(fp, "cmd_replicate: %s start %" PRIgdp_recno,
+				pname, msg->cmd_replicate->start);
+		if (msg->cmd_replicate->has_maxrecs)
+			fprintf(fp, ", maxrecs %" PRId32, msg->cmd_replicate->maxrecs);
+		fprintf(fp, "\n");
+		break;
+
+	case GDP_MESSAGE__BODY_CMD_SUBSCRIBE_CREDIT:
+		fprintf(fp, "cmd_subscribe_credit: %" PRId32 "\n",
+				msg->cmd_subscribe_credit->credit);
+		break;
+
 	case GDP_MESSAGE__BODY_ACK_SUCCESS:
 		fprintf(fp, "ack_success:\n%srecno ", _gdp_pr_indent(indent));
 		if (msg->ack_success->has_recno)
@@ -420,6 +574,9 @@ _gdp_msg_dump(const gdp_msg_t *msg, FILE *fp, int indent)
 		fprintf(fp, ", ts=");
 		print_pb_ts(msg->ack_success->ts, fp);
 		fprintf(fp, "\n");
+		if (msg->ack_success->has_window)
+			fprintf(fp, "%swindow %" PRId32 "\n", _gdp_pr_indent(indent + 1),
+					msg->ack_success->window);
 		if (msg->ack_success->has_hash)
 		{
 			fprintf(fp, "%shash ", _gdp_pr_indent(indent + 1));
@@ -439,6 +596,24 @@ _gdp_msg_dump(const gdp_msg_t *msg, FILE *fp, int indent)
 						msg->ack_success->metadata.len,
 						fp, EP_HEXDUMP_ASCII, 0);
 		}
+		if (msg->ack_success->proof != NULL)
+		{
+			MerkleProof *proof = msg->ack_success->proof;
+
+			fprintf(fp, "%sproof recno %" PRIgdp_recno
+					", treesize %" PRIu64 ", %zd nodes%s\n",
+					_gdp_pr_indent(indent + 1), proof->recno,
+					proof->ckpt->treesize, proof->n_path,
+					proof->ckpt->has_sig ? ", signed" : "");
+		}
+		if (msg->ack_success->dl != NULL)
+		{
+			for (dno = 0; dno < msg->ack_success->dl->n_d; dno++)
+			{
+				fprintf(fp, "%s[%d] ", _gdp_pr_indent(indent + 1), dno);
+				print_pb_datum(msg->ack_success->dl->d[dno], fp, indent + 2);
+			}
+		}
 		break;
 
 	case GDP_MESSAGE__BODY_ACK_CHANGED:
@@ -454,12 +629,37 @@ _gdp_msg_dump(const gdp_msg_t *msg, FILE *fp, int indent)
 		}
 		break;
 
+	case GDP_MESSAGE__BODY_ACK_MULTI_CONTENT:
+		fprintf(fp, "ack_multi_content: nresults %zd\n",
+				msg->ack_multi_content->n_r);
+		for (dno = 0; dno < msg->ack_multi_content->n_r; dno++)
+		{
+			GdpMessage__AckMultiContent__Result *r =
+						msg->ack_multi_content->r[dno];
+
+			if (r->logname.len == sizeof (gdp_name_t))
+				gdp_printable_name(r->logname.data, pname);
+			else
+				snprintf(pname, sizeof pname, "(bad name)");
+			fprintf(fp, "%s[%d] %s ", _gdp_pr_indent(indent), dno, pname);
+			if (r->datum != NULL)
+				print_pb_datum(r->datum, fp, indent + 1);
+			else
+				fprintf(fp, "%s\n",
+						ep_stat_tostr(EP_STAT_FROM_INT(r->ep_stat),
+								ebuf, sizeof ebuf));
+		}
+		break;
+
 	case GDP_MESSAGE__BODY_ACK_END_OF_RESULTS:
 		fprintf(fp, "ack_end_of_results: nresults ");
 		if (msg->ack_end_of_results->has_nresults)
 			fprintf(fp, "%" PRIu64 "\n", msg->ack_end_of_results->nresults);
 		else
 			fprintf(fp, "(unset)\n");
+		if (msg->ack_end_of_results->has_cont)
+			fprintf(fp, "%scont (%zd bytes)\n", _gdp_pr_indent(indent),
+					msg->ack_end_of_results->cont.len);
 		if (msg->nak->has_ep_stat)
 			fprintf(fp, "%sep_stat %s\n",
 					_gdp_pr_indent(indent),
@@ -482,6 +682,10 @@ _gdp_msg_dump(const gdp_msg_t *msg, FILE *fp, int indent)
 			fprintf(fp, "%srecno %" PRIgdp_recno "\n",
 					_gdp_pr_indent(indent),
 					msg->nak->recno);
+		if (msg->nak->has_retry_after)
+			fprintf(fp, "%sretry_after %" PRIu32 " ms\n",
+					_gdp_pr_indent(indent),
+					msg->nak->retry_after);
 		break;
 
 	case GDP_MESSAGE__BODY_NAK_CONFLICT:
@@ -42,6 +42,7 @@
 #include <ep/ep_dbg.h>
 #include <ep/ep_hexdump.h>
 #include <ep/ep_log.h>
+#include <ep/ep_metric.h>
 #include <ep/ep_prflags.h>
 #include <ep/ep_stat.h>
 
@@ -59,6 +60,44 @@ static EP_DBG	Dbg = EP_DBG_INIT("gdp.pdu", "GDP PDU manipulation");
 static EP_DBG	DbgIn = EP_DBG_INIT("gdp.pdu.in", "GDP PDU incoming traffic");
 static EP_DBG	DbgOut = EP_DBG_INIT("gdp.pdu.out", "GDP PDU outgoing traffic");
 
+static EP_METRIC	PdusOut = EP_METRIC_COUNTER_INIT("pdu",
+							"encoded_total", "Messages packed and sent");
+static EP_METRIC	PdusSharedOut = EP_METRIC_COUNTER_INIT("pdu",
+							"shared_sent_total", "Copies of shared messages sent");
+static EP_METRIC	PdusIn = EP_METRIC_COUNTER_INIT("pdu",
+							"decoded_total", "Messages received and unpacked");
+static EP_METRIC	PdusCorrupt = EP_METRIC_COUNTER_INIT("pdu",
+							"decode_errors_total", "Messages that could not be unpacked");
+static EP_METRIC	PduSizeOut = EP_METRIC_HISTOGRAM_INIT("pdu",
+							"sent_octets", "Size of packed messages sent",
+							EpMetricSizeBounds);
+static EP_METRIC	PduSizeIn = EP_METRIC_HISTOGRAM_INIT("pdu",
+							"recv_octets", "Size of packed messages received",
+							EpMetricSizeBounds);
+static EP_METRIC	ArenaChunks = EP_METRIC_COUNTER_INIT("pdu",
+							"arena_chunks_total",
+							"Memory chunks allocated to unpack messages into");
+
+static size_t		ArenaKeep;		// largest arena kept on free list
+
+
+/*
+**  _GDP_PDU_INIT --- make PDU statistics visible
+*/
+
+void
+_gdp_pdu_init(void)
+{
+	ep_metric_register(&PdusOut);
+	ep_metric_register(&PdusSharedOut);
+	ep_metric_register(&PdusIn);
+	ep_metric_register(&PdusCorrupt);
+	ep_metric_register(&PduSizeOut);
+	ep_metric_register(&PduSizeIn);
+	ep_metric_register(&ArenaChunks);
+	ArenaKeep = ep_adm_getlongparam("swarm.gdp.pdu.arena.keep", 16384);
+}
+
 
 void
 _gdp_pdu_dump(const gdp_pdu_t *pdu, FILE *fp, int indent)
@@ -85,6 +124,69 @@ done:
 }
 
 
+/*
+**  Serialization target for protobuf-c.
+**
+**		Wire blocks (large record payloads) are added to the
+**		output buffer by reference; everything else is gathered
+**		in a small staging area and copied in a piece at a time,
+**		since protobuf-c hands it over a few bytes at a time.
+*/
+
+struct pdu_packbuf
+{
+	ProtobufCBuffer	base;
+	gdp_buf_t		*obuf;
+	int				istat;			// -1 if anything failed
+	size_t			copied;			// octets copied into obuf
+	size_t			nstage;
+	uint8_t			stage[512];
+};
+
+static void
+pdu_pack_flush(struct pdu_packbuf *pb)
+{
+	if (pb->nstage > 0 && pb->istat >= 0)
+		pb->istat = evbuffer_add(pb->obuf, pb->stage, pb->nstage);
+	pb->copied += pb->nstage;
+	pb->nstage = 0;
+}
+
+static void
+pdu_pack_append(ProtobufCBuffer *buf, size_t len, const uint8_t *data)
+{
+	struct pdu_packbuf *pb = (struct pdu_packbuf *) buf;
+
+	if (pb->istat < 0)
+		return;
+	if (len >= GDP_BUF_WBLOCK_MIN && _gdp_buf_is_wblock(data, len))
+	{
+		pdu_pack_flush(pb);
+		if (pb->istat >= 0)
+			pb->istat = _gdp_buf_add_wblock(pb->obuf, (uint8_t *) data, len);
+	}
+	else if (len > sizeof pb->stage - pb->nstage)
+	{
+		pdu_pack_flush(pb);
+		if (len >= sizeof pb->stage)
+		{
+			pb->istat = evbuffer_add(pb->obuf, data, len);
+			pb->copied += len;
+		}
+		else
+		{
+			memcpy(pb->stage, data, len);
+			pb->nstage = len;
+		}
+	}
+	else
+	{
+		memcpy(pb->stage + pb->nstage, data, len);
+		pb->nstage += len;
+	}
+}
+
+
 /*
 **	GDP_PDU_OUT --- send a PDU to a network buffer
 **
@@ -121,8 +223,8 @@ _gdp_pdu_out(gdp_pdu_t *pdu, gdp_chan_t *chan)
 	/*
 	**  Protobuf should be ready to go now --- serialize it.
 	**
-	**		Currently uses evbuffer_reserve_space to avoid another
-	**		copy.  Alternative: use evbuffer_add_reference.
+	**		Large payloads are chained in by reference rather
+	**		than being copied (see pdu_pack_append).
 	*/
 
 	if (ep_dbg_test(DbgOut, 1))
@@ -130,47 +232,29 @@ _gdp_pdu_out(gdp_pdu_t *pdu, gdp_chan_t *chan)
 
 	{
 		size_t pb_len;
-		int istat;
-		struct evbuffer_iovec v[1];
+		struct pdu_packbuf pb;
 
 		pdu->msg->has_rid = (pdu->msg->rid != GDP_PDU_NO_RID);
 		pdu->msg->has_l5seqno = (pdu->msg->l5seqno != GDP_PDU_NO_L5SEQNO);
 
-		// *__get_packed_size has no error returns
-		pb_len = gdp_message__get_packed_size(pdu->msg);
-		ep_dbg_cprintf(Dbg, 24,
-				"_gdp_pdu_out: serialized length %zd, obuf len %zd\n",
-				pb_len, gdp_buf_getlength(obuf));
-		istat =  evbuffer_reserve_space(obuf, pb_len, v, 1);
-		if (istat <= 0)
-		{
-			ep_dbg_cprintf(Dbg, 1,
-					"_gdp_pdu_out: evbuffer_reserve_space(%zd) => %d\n",
-					pb_len, istat);
-			estat = GDP_STAT_PDU_WRITE_FAIL;
-			goto fail1;
-		}
-		if (v[0].iov_len < pb_len)
+		pb.base.append = &pdu_pack_append;
+		pb.obuf = obuf;
+		pb.istat = 0;
+		pb.copied = 0;
+		pb.nstage = 0;
+		pb_len = gdp_message__pack_to_buffer(pdu->msg, &pb.base);
+		pdu_pack_flush(&pb);
+		if (pb.istat < 0)
 		{
 			ep_dbg_cprintf(Dbg, 1,
-					"_gdp_pdu_out: cannot reserve space, need %zd, got %zd\n",
-					pb_len, v[0].iov_len);
-			estat = GDP_STAT_PDU_WRITE_FAIL;
-			goto fail1;
-		}
-
-		pb_len = gdp_message__pack(pdu->msg, (uint8_t*) v[0].iov_base);
-		v[0].iov_len = pb_len;
-		istat = evbuffer_commit_space(obuf, v, 1);
-		if (istat < 0)
-		{
-			ep_dbg_cprintf(Dbg, 1,
-					"_gdp_pdu_out: cannot commit space\n");
+					"_gdp_pdu_out: cannot serialize %zd octets\n", pb_len);
 			estat = GDP_STAT_PDU_WRITE_FAIL;
 			goto fail1;
 		}
+		ep_metric_add(&_GdpOctetsCopied, pb.copied);
 		ep_dbg_cprintf(Dbg, 24,
-				"_gdp_pdu_out: new obuf len %zd\n", gdp_buf_getlength(obuf));
+				"_gdp_pdu_out: serialized length %zd, %zd copied\n",
+				pb_len, pb.copied);
 	}
 
 	if (ep_dbg_test(DbgOut, 18))
@@ -198,6 +282,9 @@ fail1:
 		funlockfile(ep_dbg_getfile());
 	if (EP_STAT_ISOK(estat))
 	{
+		ep_metric_inc(&PdusOut);
+		ep_metric_observe(&PduSizeOut, gdp_buf_getlength(obuf));
+
 		// actually send this all to the channel
 		_gdp_chan_send(chan, NULL, pdu->src, pdu->dst, obuf,
 					GDP_PKT_TYPE_REGULAR);
@@ -211,6 +298,311 @@ fail1:
 }
 
 
+/*
+**  Shared PDU bodies
+**
+**		When the same message goes to many destinations (e.g.,
+**		subscription notifications) only the destination and the
+**		rid and l5seqno fields differ.  Rather than packing the whole
+**		message for each one, the message is packed once without
+**		those fields and each copy sent is a small per-destination
+**		prefix (cmd, rid, and l5seqno) followed by a reference to
+**		the shared packed body.  This works because protobuf allows
+**		fields in any order and takes the last value of a repeated
+**		scalar, so the receiver decodes it as usual.
+**
+**		The shared body is reference counted since libevent holds
+**		onto it until the data has actually been written.
+*/
+
+struct gdp_pdu_shared
+{
+	EP_THR_MUTEX		mutex;			// protects refcnt
+	int					refcnt;			// references (incl. evbuffers)
+	gdp_cmd_t			cmd;			// command (goes in each prefix)
+	size_t				len;			// length of packed body
+	uint8_t				*data;			// packed body (follows struct)
+};
+
+static void
+pdu_shared_decref(gdp_pdu_shared_t *sh)
+{
+	int refcnt;
+
+	ep_thr_mutex_lock(&sh->mutex);
+	refcnt = --sh->refcnt;
+	ep_thr_mutex_unlock(&sh->mutex);
+	if (refcnt > 0)
+		return;
+	ep_dbg_cprintf(Dbg, 44, "pdu_shared_decref(%p): freeing\n", sh);
+	ep_thr_mutex_destroy(&sh->mutex);
+	ep_mem_free(sh);
+}
+
+// called by libevent when it is done with the body
+static void
+pdu_shared_cleanup(const void *data, size_t len, void *sh_)
+{
+	pdu_shared_decref((gdp_pdu_shared_t *) sh_);
+}
+
+
+/*
+**	_GDP_PDU_SHARE --- pack a message once for sending many times
+**
+**		The rid and l5seqno in msg are ignored; they are supplied
+**		for each destination in _gdp_pdu_out_shared.
+*/
+
+gdp_pdu_shared_t *
+_gdp_pdu_share(GdpMessage *msg)
+{
+	gdp_pdu_shared_t *sh;
+	protobuf_c_boolean has_rid = msg->has_rid;
+	protobuf_c_boolean has_l5seqno = msg->has_l5seqno;
+	size_t pb_len;
+
+	msg->has_rid = msg->has_l5seqno = false;
+	pb_len = gdp_message__get_packed_size(msg);
+	sh = (gdp_pdu_shared_t *) ep_mem_malloc(sizeof *sh + pb_len);
+	ep_thr_mutex_init(&sh->mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_mutex_setorder(&sh->mutex, GDP_MUTEX_LORDER_LEAF);
+	sh->refcnt = 1;
+	sh->cmd = msg->cmd;
+	sh->data = (uint8_t *) (sh + 1);
+	sh->len = gdp_message__pack(msg, sh->data);
+	msg->has_rid = has_rid;
+	msg->has_l5seqno = has_l5seqno;
+	ep_dbg_cprintf(Dbg, 44, "_gdp_pdu_share(%s): %p, %zd bytes\n",
+			_gdp_proto_cmd_name(sh->cmd), sh, sh->len);
+	return sh;
+}
+
+
+/*
+**	_GDP_PDU_SHARE_REF --- add a reference to a packed message
+*/
+
+gdp_pdu_shared_t *
+_gdp_pdu_share_ref(gdp_pdu_shared_t *sh)
+{
+	ep_thr_mutex_lock(&sh->mutex);
+	sh->refcnt++;
+	ep_thr_mutex_unlock(&sh->mutex);
+	return sh;
+}
+
+
+/*
+**	_GDP_PDU_SHARE_LEN --- return the size of a packed message
+*/
+
+size_t
+_gdp_pdu_share_len(gdp_pdu_shared_t *sh)
+{
+	return sh->len;
+}
+
+
+/*
+**	_GDP_PDU_SHARE_FREE --- release the caller's reference
+**
+**		Data still waiting to be written keeps its own reference.
+*/
+
+void
+_gdp_pdu_share_free(gdp_pdu_shared_t **shp)
+{
+	if (*shp == NULL)
+		return;
+	pdu_shared_decref(*shp);
+	*shp = NULL;
+}
+
+
+/*
+**	_GDP_PDU_OUT_SHARED --- send a shared message to one destination
+*/
+
+EP_STAT
+_gdp_pdu_out_shared(gdp_pdu_shared_t *sh,
+			gdp_name_t src,
+			gdp_name_t dst,
+			gdp_rid_t rid,
+			gdp_l5seqno_t l5seqno,
+			gdp_chan_t *chan)
+{
+	EP_STAT estat;
+	GdpMessage hdr;
+	uint8_t hbuf[32];				// cmd + rid + l5seqno, at most 15
+	size_t hlen;
+	gdp_buf_t *obuf;
+
+	if (chan == NULL)
+	{
+		ep_dbg_cprintf(Dbg, 1, "_gdp_pdu_out_shared: no channel\n");
+		return GDP_STAT_DEAD_DAEMON;
+	}
+	if (!gdp_name_is_valid(src))
+		src = _GdpMyRoutingName;
+
+	// the per-destination prefix
+	gdp_message__init(&hdr);
+	hdr.cmd = sh->cmd;
+	hdr.rid = rid;
+	hdr.has_rid = (rid != GDP_PDU_NO_RID);
+	hdr.l5seqno = l5seqno;
+	hdr.has_l5seqno = (l5seqno != GDP_PDU_NO_L5SEQNO);
+	hlen = gdp_message__pack(&hdr, hbuf);
+
+	obuf = gdp_buf_new();
+	gdp_buf_write(obuf, hbuf, hlen);
+
+	// and the body, by reference
+	(void) _gdp_pdu_share_ref(sh);
+	if (evbuffer_add_reference(obuf, sh->data, sh->len,
+				pdu_shared_cleanup, sh) != 0)
+	{
+		pdu_shared_decref(sh);
+		estat = GDP_STAT_PDU_WRITE_FAIL;
+	}
+	else
+	{
+		ep_dbg_cprintf(DbgOut, 18,
+				"_gdp_pdu_out_shared, chan = %p: %s rid %" PRIgdp_rid "\n",
+				chan, _gdp_proto_cmd_name(sh->cmd), rid);
+		ep_metric_inc(&PdusSharedOut);
+		ep_metric_observe(&PduSizeOut, hlen + sh->len);
+		estat = _gdp_chan_send(chan, NULL, src, dst, obuf,
+					GDP_PKT_TYPE_REGULAR);
+	}
+	gdp_buf_free(obuf);
+	return estat;
+}
+
+
+/*
+**  Per-PDU arenas for unpacking.
+**
+**		protobuf-c makes a separate allocation for every nested
+**		message, repeated field, and bytes field it unpacks, and
+**		frees them again one at a time.  Instead each PDU has an
+**		arena: unpacking carves pieces out of it, freeing a piece
+**		does nothing, and the whole arena is reset when the PDU
+**		is freed.  The arena stays with the PDU on the free list,
+**		sized to what it needed last time (up to ArenaKeep), so a
+**		steady stream of similar PDUs doesn't allocate at all.
+**
+**		The arena remembers the message unpacked into it, and
+**		that message must be freed with the arena's allocator
+**		(_gdp_pdu_msg_free does this).  Its free function skips
+**		anything inside one of the arena's chunks and hands
+**		everything else (fields added to a received message
+**		later) to the usual protobuf allocator.  Nothing may be
+**		moved out of a received message into one that outlives
+**		the PDU; copy it instead.
+*/
+
+struct arena_chunk
+{
+	struct arena_chunk	*next;
+	size_t				size;			// usable size of data
+	size_t				used;
+	uint8_t				data[];
+};
+
+struct gdp_pdu_arena
+{
+	ProtobufCAllocator	alloc;			// allocator_data points here
+	struct arena_chunk	*chunks;		// current chunk first
+	size_t				total;			// sum of chunk sizes
+	size_t				hint;			// size to start with next time
+	GdpMessage			*msg;			// message unpacked into the arena
+};
+
+#define ARENA_MINCHUNK	4096
+
+static void *
+arena_alloc(void *a_, size_t size)
+{
+	struct gdp_pdu_arena *a = (struct gdp_pdu_arena *) a_;
+	struct arena_chunk *c = a->chunks;
+	size_t need = (size + 7) & ~(size_t) 7;
+	uint8_t *p;
+
+	if (c == NULL || c->size - c->used < need)
+	{
+		size_t csize = a->total > a->hint ? a->total : a->hint;
+		int otag;
+
+		if (csize < ARENA_MINCHUNK)
+			csize = ARENA_MINCHUNK;
+		if (csize < need)
+			csize = need;
+		otag = ep_mem_tag_set(_GdpMemTagProtobuf);
+		c = (struct arena_chunk *) ep_mem_malloc(sizeof *c + csize);
+		ep_mem_tag_set(otag);
+		c->size = csize;
+		c->used = 0;
+		c->next = a->chunks;
+		a->chunks = c;
+		a->total += csize;
+		ep_metric_inc(&ArenaChunks);
+	}
+	p = c->data + c->used;
+	c->used += need;
+	return p;
+}
+
+static void
+arena_free(void *a_, void *p)
+{
+	struct gdp_pdu_arena *a = (struct gdp_pdu_arena *) a_;
+	struct arena_chunk *c;
+
+	// arena memory is ignored; anything else is freed as usual
+	for (c = a->chunks; c != NULL; c = c->next)
+	{
+		if ((uint8_t *) p >= c->data && (uint8_t *) p < c->data + c->used)
+			return;
+	}
+	(*_GdpProtobufAllocator.free)(NULL, p);
+}
+
+static struct gdp_pdu_arena *
+arena_new(void)
+{
+	struct gdp_pdu_arena *a = (struct gdp_pdu_arena *) ep_mem_zalloc(sizeof *a);
+
+	a->alloc.alloc = &arena_alloc;
+	a->alloc.free = &arena_free;
+	a->alloc.allocator_data = a;
+	return a;
+}
+
+// empty the arena, keeping one chunk if it's not too big
+static void
+arena_reset(struct gdp_pdu_arena *a, bool keep)
+{
+	struct arena_chunk *c;
+
+	a->msg = NULL;
+	if (a->chunks != NULL && a->chunks->next == NULL &&
+			keep && a->total <= ArenaKeep)
+	{
+		a->chunks->used = 0;
+		return;
+	}
+	while ((c = a->chunks) != NULL)
+	{
+		a->chunks = c->next;
+		ep_mem_free(c);
+	}
+	a->hint = a->total <= ArenaKeep ? a->total : 0;
+	a->total = 0;
+}
+
+
 /*
 **	GDP_PDU_IN --- read a PDU from the network
 **
@@ -240,8 +632,10 @@ _gdp_pdu_in(
 	ep_dbg_cprintf(DbgIn, 30, "\n\t>>>>>  _gdp_pdu_in(%zd)  >>>>>\n", plen);
 
 	// unpack Protobuf into local data structure
+	if (pdu->arena == NULL)
+		pdu->arena = arena_new();
 	mbuf = gdp_buf_getptr(pbuf, plen);
-	msg = gdp_message__unpack(NULL, plen, mbuf);
+	msg = gdp_message__unpack(&pdu->arena->alloc, plen, mbuf);
 	if (msg == NULL)
 	{
 		ep_dbg_cprintf(DbgIn, 1,
@@ -249,8 +643,11 @@ _gdp_pdu_in(
 		if (ep_dbg_test(DbgIn, 10))
 			ep_hexdump(mbuf, plen, ep_dbg_getfile(), EP_HEXDUMP_ASCII, 0);
 		estat = GDP_STAT_PDU_CORRUPT;
+		ep_metric_inc(&PdusCorrupt);
 		goto fail1;
 	}
+	ep_metric_inc(&PdusIn);
+	ep_metric_observe(&PduSizeIn, plen);
 
 	// XXX hack: cache chan into pdu for use when creating requests
 	pdu->chan = chan;
@@ -284,13 +681,40 @@ fail1:
 
 	gdp_buf_drain(pbuf, plen);
 	if (EP_STAT_ISOK(estat))
-		pdu->msg = msg;
-	else if (msg != NULL)
-		gdp_message__free_unpacked(msg, NULL);
+		pdu->msg = pdu->arena->msg = msg;
+	else if (pdu->msg == NULL && pdu->arena != NULL)
+		arena_reset(pdu->arena, true);
 	return estat;
 }
 
 
+/*
+**  _GDP_PDU_MSG_FREE --- free the message in a PDU
+**
+**		A message unpacked by _gdp_pdu_in lives in the PDU's arena
+**		and has to be freed through it; any other message is freed
+**		the usual way.
+*/
+
+void
+_gdp_pdu_msg_free(gdp_pdu_t *pdu)
+{
+	if (pdu->msg == NULL)
+		return;
+	if (pdu->arena != NULL && pdu->msg == pdu->arena->msg)
+	{
+		ep_dbg_cprintf(Dbg, 48, "_gdp_pdu_msg_free(%p): arena\n", pdu);
+		gdp_message__free_unpacked(pdu->msg, &pdu->arena->alloc);
+		pdu->arena->msg = NULL;
+		pdu->msg = NULL;
+	}
+	else
+	{
+		_gdp_msg_free(&pdu->msg);
+	}
+}
+
+
 /*
 **  _GDP_PDU_NEW --- allocate a PDU (from free list if possible)
 **  _GDP_PDU_FREE --- return a PDU to the free list
@@ -305,6 +729,7 @@ gdp_pdu_t *
 _gdp_pdu_new(GdpMessage *msg, gdp_name_t src, gdp_name_t dst, gdp_seqno_t seqno)
 {
 	gdp_pdu_t *pdu;
+	struct gdp_pdu_arena *arena;
 
 	if (ep_dbg_test(Dbg, 48))
 	{
@@ -323,15 +748,20 @@ _gdp_pdu_new(GdpMessage *msg, gdp_name_t src, gdp_name_t dst, gdp_seqno_t seqno)
 			TAILQ_REMOVE(&PduFreeList, pdu, list);
 		else
 		{
+			int otag = ep_mem_tag_set(_GdpMemTagPdu);
+
 			pdu = (gdp_pdu_t *) ep_mem_zalloc(sizeof *pdu);
+			ep_mem_tag_set(otag);
 		}
 		EP_ASSERT_ELSE(!EP_UT_BITSET(GDP_PDU_INUSE, pdu->flags), pdu = NULL);
 	} while (pdu == NULL);
 	ep_thr_mutex_unlock(&PduFreeListMutex);
 	VALGRIND_HG_CLEAN_MEMORY(pdu, sizeof *pdu);
 
-	// initialize the PDU
+	// initialize the PDU (but keep the arena)
+	arena = pdu->arena;
 	memset(pdu, 0, sizeof *pdu);
+	pdu->arena = arena;
 	pdu->flags |= GDP_PDU_INUSE;
 	pdu->msg = msg;
 	memcpy(pdu->src, src, sizeof pdu->src);
@@ -351,12 +781,18 @@ _gdp_pdu_free(gdp_pdu_t **ppdu)
 	// abandon this PDU if already free
 	EP_ASSERT_ELSE(EP_UT_BITSET(GDP_PDU_INUSE, pdu->flags), return);
 	pdu->flags &= ~GDP_PDU_INUSE;
-	if (pdu->msg != NULL)
-		_gdp_msg_free(&pdu->msg);
+	_gdp_pdu_msg_free(pdu);
 	*ppdu = NULL;
 #if GDP_DEBUG_NO_FREE_LISTS		// avoid helgrind complaints
+	if (pdu->arena != NULL)
+	{
+		arena_reset(pdu->arena, false);
+		ep_mem_free(pdu->arena);
+	}
 	ep_mem_free(pdu);
 #else
+	if (pdu->arena != NULL)
+		arena_reset(pdu->arena, true);
 	ep_thr_mutex_lock(&PduFreeListMutex); TAILQ_INSERT_HEAD(&PduFreeList, pdu, list);
 	ep_thr_mutex_unlock(&PduFreeListMutex);
 #endif
@@ -107,6 +107,7 @@ struct gdp_pdu
 	TAILQ_ENTRY(gdp_pdu)	list;		// free list
 	uint32_t				flags;
 	gdp_chan_t				*chan;		// only used in _gdp_pdu_process
+	uint64_t				rcvd;		// arrival time (see _gdp_lat_now)
 
 	// copied from L4 (lower layer)
 	gdp_name_t				dst;		// destination address
@@ -115,6 +116,9 @@ struct gdp_pdu
 
 	// Layer 5 info
 	GdpMessage				*msg;		// on-the-wire message (not NULL)
+
+	// kept when the PDU is on the free list
+	struct gdp_pdu_arena	*arena;		// memory for unpacked messages
 };
 
 // flag bits
@@ -183,6 +187,11 @@ struct gdp_pdu
 #define GDP_CMD_GETMETADATA			GDP_MSG_CODE__CMD_GETMETADATA
 #define GDP_CMD_NEWSEGMENT			GDP_MSG_CODE__CMD_NEWSEGMENT
 #define GDP_CMD_DELETE				GDP_MSG_CODE__CMD_DELETE
+#define GDP_CMD_MULTIREAD			GDP_MSG_CODE__CMD_MULTIREAD
+#define GDP_CMD_SUBSCRIBE_GROUP		GDP_MSG_CODE__CMD_SUBSCRIBE_GROUP
+#define GDP_CMD_GET_PROOF			GDP_MSG_CODE__CMD_GET_PROOF
+#define GDP_CMD_REPLICATE			GDP_MSG_CODE__CMD_REPLICATE
+#define GDP_CMD_SUBSCRIBE_CREDIT	GDP_MSG_CODE__CMD_SUBSCRIBE_CREDIT
 #define GDP_CMD_FWD_APPEND			GDP_MSG_CODE__CMD_FWD_APPEND
 
 //		128-191			Positive acks (HTTP 200-263)
@@ -193,6 +202,7 @@ struct gdp_pdu
 #define GDP_ACK_VALID				GDP_MSG_CODE__ACK_VALID
 #define GDP_ACK_CHANGED				GDP_MSG_CODE__ACK_CHANGED
 #define GDP_ACK_CONTENT				GDP_MSG_CODE__ACK_CONTENT
+#define GDP_ACK_MULTI_CONTENT		GDP_MSG_CODE__ACK_MULTI_CONTENT
 #define GDP_ACK_END_OF_RESULTS		GDP_MSG_CODE__ACK_END_OF_RESULTS
 #define GDP_ACK_MAX			191			// maximum ack code
 
@@ -210,6 +220,7 @@ struct gdp_pdu
 #define GDP_NAK_C_PRECONFAILED		GDP_MSG_CODE__NAK_C_PRECONFAILED
 #define GDP_NAK_C_TOOLARGE			GDP_MSG_CODE__NAK_C_TOOLARGE
 #define GDP_NAK_C_UNSUPMEDIA		GDP_MSG_CODE__NAK_C_UNSUPMEDIA
+#define GDP_NAK_C_TOOMANY			GDP_MSG_CODE__NAK_C_TOOMANY
 #define GDP_NAK_C_REC_MISSING		GDP_MSG_CODE__NAK_C_REC_MISSING
 #define GDP_NAK_C_REC_DUP			GDP_MSG_CODE__NAK_C_REC_DUP
 #define GDP_NAK_C_MAX		223			// maximum client-side nak code
@@ -234,6 +245,8 @@ struct gdp_pdu
 //		255				Reserved
 
 
+void		_gdp_pdu_init(void);	// initialize PDU module
+
 gdp_pdu_t	*_gdp_pdu_new(			// allocate a new PDU
 				GdpMessage *msg,		// the initial message (may be NULL)
 				gdp_name_t src,			// source address
@@ -247,6 +260,33 @@ EP_STAT		_gdp_pdu_out(			// send a PDU to a network buffer
 				gdp_pdu_t *,			// the PDU information
 				gdp_chan_t *);			// the network channel
 
+typedef struct gdp_pdu_shared	gdp_pdu_shared_t;
+
+gdp_pdu_shared_t
+			*_gdp_pdu_share(		// pack a message to send many times
+				GdpMessage *msg);
+
+gdp_pdu_shared_t
+			*_gdp_pdu_share_ref(	// add a reference to packed message
+				gdp_pdu_shared_t *);
+
+size_t		_gdp_pdu_share_len(		// size of packed message
+				gdp_pdu_shared_t *);
+
+void		_gdp_pdu_share_free(	// release a packed message
+				gdp_pdu_shared_t **);
+
+EP_STAT		_gdp_pdu_out_shared(	// send packed message to one dest
+				gdp_pdu_shared_t *,		// the packed message
+				gdp_name_t src,			// source address
+				gdp_name_t dst,			// destination address
+				gdp_rid_t rid,			// request id for this dest
+				gdp_l5seqno_t l5seqno,	// sequence number for this dest
+				gdp_chan_t *);			// the network channel
+
+void		_gdp_pdu_msg_free(		// free the message in a PDU
+				gdp_pdu_t *);
+
 EP_STAT		_gdp_pdu_in(			// read a PDU from a network buffer
 				gdp_pdu_t *,			// the buffer to store the result
 				gdp_buf_t *pbuf,		// the payload (input) buffer
@@ -38,7 +38,10 @@
 #include <ep/ep.h>
 #include <ep/ep_assert.h>
 #include <ep/ep_crypto.h>
+#include <ep/ep_metric.h>
 #include <ep/ep_thr.h>
+#include <ep/ep_timer.h>
+#include <ep/ep_trace.h>
 
 #include <event2/buffer.h>
 
@@ -88,8 +91,30 @@ TAILQ_HEAD(gev_list, gdp_event);
 extern EP_THR		_GdpIoEventLoopThread;
 extern event_base_t	*_GdpIoEventBase;	// for all I/O events
 extern gdp_chan_t	*_GdpChannel;		// our primary app-level protocol port
+extern EP_TIMER_WHEEL	*_GdpTimers;	// leases, idle timeouts, etc.
 extern gdp_name_t	_GdpMyRoutingName;	// source name for PDUs
 extern int			_GdpInitState;		// initialization state, see below
+extern int			_GdpTraceSample;	// trace one in this many invocations
+
+// admission control: lets a server refuse commands before they are queued
+typedef EP_STAT		gdp_admit_func_t(
+						gdp_pdu_t *pdu,			// incoming command
+						size_t len,				// size on the wire
+						uint32_t *retry_ms);	// out: when to try again
+extern gdp_admit_func_t	*_GdpAdmitFunc;	// NULL unless a server sets it
+
+// priority lanes: thread pool classes commands are run in
+#define GDP_LANE_CONTROL	0	// opens, closes, responses, etc.
+#define GDP_LANE_APPEND		1	// appends
+#define GDP_LANE_READ		2	// reads, multireads, replication
+#define GDP_LANE_SUBSCR		3	// subscriptions and their backlogs
+#define GDP_NLANES			4
+extern const char		*_GdpLaneNames[GDP_NLANES];
+
+// lets a server run work for a GOB on a pool of its choice (NULL: default)
+typedef EP_THR_POOL		*gdp_pool_func_t(
+						const gdp_name_t gob_name);
+extern gdp_pool_func_t	*_GdpGobPoolFunc;	// NULL unless a server sets it
 
 #define GDP_INIT_NONE		0	// uninitialized
 #define GDP_INIT_PHASE_0	10	// phase 0 complete
@@ -130,6 +155,14 @@ extern int			_GdpInitState;		// initialization state, see below
 // declare the type of the gdp_req linked list (used multiple places)
 LIST_HEAD(req_head, gdp_req);
 
+// hash index over a gdp_req list (see gdp_req.c)
+struct req_index
+{
+	struct req_head		*tab;			// hash chains (NULL until first use)
+	uint32_t			tabsize;		// number of chains (power of two)
+	uint32_t			nreqs;			// number of reqs in index
+};
+
 
 /*
 **  Some generic constants
@@ -164,6 +197,33 @@ gdp_buf_t		*_gdp_hash_getbuf(gdp_hash_t *hash);
 gdp_buf_t		*_gdp_sig_getbuf(gdp_sig_t *sig);
 
 
+/*
+**  Wire blocks (see gdp_buf.c)
+**
+**		Reference counted, read-only memory for large payloads,
+**		so that they can be passed from a datum through protobuf
+**		to the socket without being copied.
+*/
+
+#define GDP_BUF_WBLOCK_MIN	2048	// smaller payloads are just copied
+
+uint8_t			*_gdp_buf_wblock_new(	// allocate new wire block
+						size_t len);
+void			_gdp_buf_wblock_free(	// drop a reference
+						uint8_t *p);
+bool			_gdp_buf_is_wblock(		// is this a wire block?
+						const void *p,
+						size_t len);		// if non-zero, must match
+int				_gdp_buf_add_wblock(	// add to buffer by reference
+						gdp_buf_t *buf,
+						uint8_t *p,
+						size_t len);
+uint8_t			*_gdp_buf_get_wblock(	// buffer as wire block, if it is one
+						gdp_buf_t *buf);
+
+extern EP_METRIC	_GdpOctetsCopied;		// copied while building PDUs
+
+
 /*
 **  Names
 */
@@ -246,6 +306,37 @@ void			_gdp_timestamp_from_pb(	// convert protobuf form to EP_TIME_SPEC
 						const GdpTimestamp *pbd);
 
 
+/*
+**  Merkle trees over record hashes (see gdp_merkle.c)
+*/
+
+#define GDP_MERKLE_HASHLEN		32			// SHA-256
+
+void			_gdp_merkle_leaf(		// leaf hash from a record hash
+						const void *rechash,
+						size_t rechashlen,
+						uint8_t *out);
+
+void			_gdp_merkle_node(		// interior node from its children
+						const uint8_t *left,
+						const uint8_t *right,
+						uint8_t *out);
+
+EP_STAT			_gdp_merkle_path_root(	// root implied by an audit path
+						uint64_t leafidx,			// zero based
+						uint64_t treesize,			// number of leaves
+						const uint8_t *leaf,		// leaf hash
+						int npath,					// length of path
+						const uint8_t *const *path,	// path, leaf first
+						uint8_t *root);				// output
+
+void			_gdp_merkle_ckpt_digest(	// add checkpoint to digest
+						EP_CRYPTO_MD *md,
+						uint64_t treesize,
+						const EP_TIME_SPEC *ts,
+						const uint8_t *root);
+
+
 
 /*
 **  GDP Objects
@@ -301,8 +392,10 @@ struct gdp_gob
 {
 	EP_THR_MUTEX		mutex;			// lock on this data structure
 	time_t				utime;			// last time used (seconds only)
+	EP_TIMER			idle_timer;		// reclaims GOB when idle too long
 	LIST_ENTRY(gdp_gob)	ulist;			// list sorted by use time
 	struct req_head		reqs;			// list of outstanding requests
+	struct req_index	reqindex;		// reqs by (src, rid)
 	gdp_name_t			name;			// the internal name
 	gdp_pname_t			pname;			// printable name (for debugging)
 	uint16_t			flags;			// flag bits, see below
@@ -436,6 +529,25 @@ EP_STAT			_gdp_gob_read_by_recno_async(	// read asynchronously
 						void *cbarg,
 						gdp_chan_t *chan);
 
+EP_STAT			_gdp_gob_read_range_async(	// budgeted async read
+						gdp_gob_t *gob,
+						gdp_gin_t *gin,
+						gdp_recno_t recno,
+						uint32_t nrecs,
+						size_t maxbytes,
+						gdp_buf_t *cont,
+						gdp_event_cbfunc_t cbfunc,
+						void *cbarg,
+						gdp_chan_t *chan);
+
+EP_STAT			_gdp_gob_multiread(			// read from many logs at once
+						int n_gins,
+						gdp_gin_t **gins,
+						const gdp_recno_t *recnos,
+						gdp_event_cbfunc_t cbfunc,
+						void *cbarg,
+						gdp_chan_t *chan);
+
 EP_STAT			_gdp_gob_append_sync(		// append a record (gdpd shared)
 						gdp_gob_t *gob,
 						int n_datums,
@@ -464,6 +576,13 @@ EP_STAT			_gdp_gin_subscribe(			// subscribe to data
 						gdp_event_cbfunc_t cbfunc,
 						void *cbarg);
 
+EP_STAT			_gdp_gin_subscribe_group(	// subscribe to many logs
+						int n_gins,
+						gdp_gin_t **gins,
+						const gdp_recno_t *starts,
+						gdp_event_cbfunc_t cbfunc,
+						void *cbarg);
+
 EP_STAT			_gdp_gin_unsubscribe(		// delete subscriptions
 						gdp_gin_t *gin,
 						gdp_event_cbfunc_t cbfunc,
@@ -476,6 +595,21 @@ EP_STAT			_gdp_gob_getmetadata(		// retrieve metadata
 						gdp_chan_t *chan,
 						uint32_t reqflags);
 
+EP_STAT			_gdp_gob_vrfy_records(		// verify records against log
+						gdp_gob_t *gob,
+						int n,
+						gdp_datum_t **datums,
+						gdp_chan_t *chan,
+						uint32_t reqflags);
+
+EP_STAT			_gdp_replica_pull(			// pull records from a leader
+						const gdp_name_t leader,
+						const gdp_name_t logname,
+						gdp_recno_t start,
+						int32_t maxrecs,
+						gdp_chan_t *chan,
+						gdp_req_t **reqp);
+
 EP_STAT			_gdp_gob_newsegment(		// create a new physical segment
 						gdp_gob_t *gob,
 						gdp_chan_t *chan,
@@ -710,6 +844,11 @@ struct gdp_open_info
 **		Implemented in gdp_req.c.
 */
 
+// request indexes (entries in ix)
+#define GDP_REQ_IX_GOB			0			// gob->reqindex
+#define GDP_REQ_IX_CHAN			1			// chanx->reqindex
+#define GDP_REQ_NIX				2			// number of indexes
+
 struct gdp_req
 {
 	EP_THR_MUTEX		mutex;		// lock on this data structure
@@ -717,6 +856,11 @@ struct gdp_req
 	uint16_t			state;		// see below
 	LIST_ENTRY(gdp_req)	goblist;	// linked list for cache management
 	LIST_ENTRY(gdp_req)	chanlist;	// reqs associated with a given channel
+	struct req_link
+	{
+		LIST_ENTRY(gdp_req)	chain;		// hash chain (le_prev NULL if unlinked)
+		uint32_t			hval;		// hash of key when linked
+	}					ix[GDP_REQ_NIX];	// GOB and channel index links
 	gdp_gob_t			*gob;		// associated GDP Object handle
 	gdp_pdu_t			*cpdu;		// PDU for commands
 	gdp_pdu_t			*rpdu;		// PDU for ack/nak responses
@@ -732,12 +876,27 @@ struct gdp_req
 	gdp_event_cbfunc_t	sub_cbfunc;	// callback function (subscribe & async I/O)
 	void				*sub_cbarg;	// user-supplied opaque data to cb
 
+	// these are only of interest in gdplogd
+	struct sub_outq		*outq;		// queued subscription output
+	void				(*outq_release)(struct sub_outq *);
+									// drop req's reference to outq
+	int32_t				sub_credit;	// catch-up records allowed (-1 => any)
+	uint32_t			sub_pass;	// catch-up scan that last served us
+	EP_TIMER			lease_timer;	// expires subscription
+
 	// these are only of interest in clients, never in gdplogd
 	gdp_gin_t			*gin;		// GIN handle (client only, may be NULL)
+	gdp_gin_t			**gins;		// GIN handles for multiread results
+	int					ngins;		// number of entries in gins
+	int					mr_batches;	// multiread batches not yet ended
+	int64_t				mr_results;	// results sent by batches that ended
+	struct EP_HASH		*ginindex;	// log name => GIN (large gins only)
 	int64_t				r_results;	// number of results received so far
 	struct gev_list		events;		// pending events (see above)
 	gdp_seqno_t			seqnext;	// next expected seqno
 	struct event		*ev_to;		// event timeout (to scan pending events)
+	int32_t				sub_window;	// catch-up window granted by server
+	int32_t				sub_unacked;	// records since last credit grant
 };
 
 // states
@@ -758,6 +917,7 @@ struct gdp_req
 #define GDP_REQ_ON_CHAN_LIST	0x00000100	// this is on a channel list
 #define GDP_REQ_VRFY_CONTENT	0x00000200	// verify content proof
 #define GDP_REQ_ROUTEFAIL		0x00000400	// fail immediately on route failure
+#define GDP_REQ_SRV_CATCHUP		0x00000800	// server-side subscription catching up
 
 EP_STAT			_gdp_req_new(				// create new request
 						gdp_cmd_t cmd,
@@ -779,6 +939,25 @@ void			_gdp_req_unlock(			// unlock a request mutex
 gdp_req_t		*_gdp_req_find(				// find a request in a GOB
 						gdp_gob_t *gob, gdp_rid_t rid);
 
+void			_gdp_req_gob_link(			// add req to its GOB list
+						gdp_req_t *req);
+
+void			_gdp_req_gob_unlink(		// remove req from its GOB list
+						gdp_req_t *req);
+
+gdp_req_t		*_gdp_req_gob_lookup(		// find req on GOB list (unlocked)
+						gdp_gob_t *gob,
+						const gdp_name_t src,
+						gdp_rid_t rid);
+
+void			_gdp_req_set_rid(			// change rid, reindexing req
+						gdp_req_t *req,
+						gdp_rid_t rid);
+
+void			_gdp_req_set_dst(			// change dst, reindexing req
+						gdp_req_t *req,
+						const gdp_name_t dst);
+
 gdp_rid_t		_gdp_rid_new(				// create new request id
 						gdp_gob_t *gob, gdp_chan_t *chan);
 
@@ -828,10 +1007,26 @@ EP_STAT			_gdp_req_nak_resp(			// helper: create NAK response
 struct gdp_chan_x
 {
 	struct req_head		reqs;			// reqs associated with this channel
+	struct req_index	reqindex;		// reqs by (src, dst, rid)
 	EP_STAT				(*connect_cb)(	// called on connection established
 							gdp_chan_t *chan);
 };
 
+// request list maintenance for channels (in gdp_req.c)
+void			_gdp_req_chan_link(			// add req to channel list
+						gdp_req_t *req,
+						struct gdp_chan_x *chanx);
+
+void			_gdp_req_chan_unlink(		// remove req from channel list
+						gdp_req_t *req,
+						struct gdp_chan_x *chanx);
+
+gdp_req_t		*_gdp_req_chan_lookup(		// find req on chan list (unlocked)
+						struct gdp_chan_x *chanx,
+						const gdp_name_t src,
+						const gdp_name_t dst,
+						gdp_rid_t rid);
+
 // functions used internally related to channel I/O
 EP_STAT			_gdp_io_recv(
 						gdp_chan_t *chan,
@@ -937,6 +1132,7 @@ EP_STAT			_gdp_advertise_me(			// advertise me only
 
 #define GDP_SUBSCR_REFRESH_DEF	60L			// default refresh interval (sec)
 #define GDP_SUBSCR_TIMEOUT_DEF	180L		// default timeout (sec)
+#define GDP_SUBSCR_WINDOW_DEF	256			// default catch-up window (records)
 
 extern EP_THR_MUTEX		_GdpSubscriptionMutex;
 extern struct req_head	_GdpSubscriptionRequests;
@@ -944,6 +1140,9 @@ extern struct req_head	_GdpSubscriptionRequests;
 void			_gdp_subscr_lost(			// subscription disappeared
 						gdp_req_t *req);
 
+void			_gdp_subscr_credit(			// note record, grant credit
+						gdp_req_t *req);
+
 void			_gdp_subscr_poke(			// test subscriptions still alive
 						gdp_chan_t *chan);
 
@@ -957,9 +1156,75 @@ void			_gdp_newname(gdp_name_t gname,
 void			_gdp_reclaim_resources(		// reclaim system resources
 						void *);				// unused
 
+time_t			_gdp_reclaim_age(void);		// max idle time for GOBs
+
 void			_gdp_reclaim_resources_init(
 						void (*f)(int, short, void *));
 
+EP_STAT			_gdp_metrics_init(			// register/export metrics
+						event_base_t *evbase);
+
+/*
+**  Command latency histograms (gdp_latency.c).
+**
+**		Take a timestamp with _gdp_lat_now at the start of a stage
+**		and pass it to _gdp_lat_record at the end.
+*/
+
+#define GDP_LAT_QUEUE		0		// arrival to start of processing
+#define GDP_LAT_LOCK		1		// waiting for the GOB
+#define GDP_LAT_STORAGE		2		// physical log access
+#define GDP_LAT_CRYPTO		3		// signature verification
+#define GDP_LAT_OUTPUT		4		// sending the response
+#define GDP_LAT_RTT			5		// client: command to response
+#define GDP_LAT_TOTAL		6		// server: arrival to response sent
+#define GDP_LAT_NSTAGES		7
+
+struct gdp_lat_summary
+{
+	uint64_t		count;
+	uint64_t		sum;				// all in microseconds
+	uint64_t		p50;
+	uint64_t		p90;
+	uint64_t		p99;
+	uint64_t		p999;
+	uint64_t		max;
+};
+
+void			_gdp_lat_init(void);
+uint64_t		_gdp_lat_now(void);			// zero if not recording
+void			_gdp_lat_record(			// record time since start
+						int cmd,
+						int stage,
+						uint64_t start);
+bool			_gdp_lat_summary(			// get percentiles
+						int cmd,
+						int stage,
+						struct gdp_lat_summary *ls);
+const char		*_gdp_lat_stage_name(int stage);
+void			_gdp_lat_dump(FILE *fp);
+
+/*
+**  Memory accounting tags (see ep_mem_tag_register).  All zero
+**  (i.e., EP_MEM_TAG_OTHER) unless libep.mem.account is set.
+*/
+
+extern int		_GdpMemTagPdu;
+extern int		_GdpMemTagDatum;
+extern int		_GdpMemTagGob;
+extern int		_GdpMemTagEvbuf;
+extern int		_GdpMemTagProtobuf;
+
+// pass to protobuf unpack and free_unpacked in place of NULL
+extern ProtobufCAllocator	_GdpProtobufAllocator;
+
+int				_gdp_cmd_lane(				// lane to run command in
+						int cmd);
+
+int				_gdp_gob_queue_depth(		// PDUs waiting for a GOB
+						const gdp_name_t gob_name,
+						int *max_depth);		// if set, high water mark
+
 void			_gdp_dump_state(int plev);
 
 gdp_cmd_t		_gdp_acknak_from_estat(		// produce acknak code from status
@@ -71,14 +71,20 @@ _gdp_invoke(gdp_req_t *req)
 	bool retry;					// retry the command
 	int retries;				// how many times to retry
 	long retry_delay;			// how long to delay between retries
+	long throttle_ms;			// server's retry hint (if throttled)
 	EP_TIME_SPEC delta_ts;
 	const char *cmdname;
+	uint64_t t0 = _gdp_lat_now();
+	bool traced;				// we started a trace
+	EP_TRACE_SPAN span;
 
 	EP_ASSERT_POINTER_VALID(req);
 	GDP_MSG_CHECK(req->cpdu, return EP_STAT_ASSERT_ABORT);
 	if (req->gob != NULL)
 		GDP_GOB_ASSERT_ISLOCKED(req->gob);
 	cmdname = _gdp_proto_cmd_name(req->cpdu->msg->cmd);
+	traced = ep_trace_sample(_GdpTraceSample);
+	ep_trace_begin(&span, "invoke", cmdname);
 	if (ep_dbg_test(Dbg, 11))
 	{
 		ep_dbg_printf("\n>>> _gdp_invoke(req=%p rid=%" PRIgdp_rid "): %s (%d), gob@%p\n",
@@ -116,6 +122,7 @@ _gdp_invoke(gdp_req_t *req)
 				req->cpdu->msg->cmd, retries);
 
 		retry = false;
+		throttle_ms = -1;
 		estat = _gdp_req_send(req);
 		EP_STAT_CHECK(estat, continue);
 
@@ -181,6 +188,18 @@ _gdp_invoke(gdp_req_t *req)
 			if (EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOROUTE) &&
 					!EP_UT_BITSET(GDP_REQ_ROUTEFAIL, req->flags))
 				retry = true;
+
+			// server is busy: wait as long as it asks and try again
+			if (EP_STAT_IS_SAME(estat, GDP_STAT_NAK_TOOMANY))
+			{
+				GdpMessage *msg = req->rpdu == NULL ? NULL : req->rpdu->msg;
+
+				retry = true;
+				throttle_ms = retry_delay;
+				if (msg != NULL && msg->body_case == GDP_MESSAGE__BODY_NAK &&
+						msg->nak->has_retry_after)
+					throttle_ms = msg->nak->retry_after;
+			}
 		}
 
 		// (maybe) do a retry, after re-locking the GOB
@@ -188,16 +207,30 @@ _gdp_invoke(gdp_req_t *req)
 		{
 			estat = _gdp_req_unsend(req);
 			EP_STAT_CHECK(estat, break);
-			estat = GDP_STAT_INVOKE_TIMEOUT;
-			if (retries > 1)
+			if (throttle_ms >= 0)
+			{
+				estat = GDP_STAT_NAK_TOOMANY;
+				if (retries > 1)
+					ep_time_nanosleep(throttle_ms MILLISECONDS);
+			}
+			else
 			{
-				// if ETIMEDOUT, maybe the router had a glitch:
-				//   wait and try again
-				ep_time_nanosleep(retry_delay MILLISECONDS);
+				estat = GDP_STAT_INVOKE_TIMEOUT;
+				if (retries > 1)
+				{
+					// if ETIMEDOUT, maybe the router had a glitch:
+					//   wait and try again
+					ep_time_nanosleep(retry_delay MILLISECONDS);
+				}
 			}
 		}
 	} while (retry && --retries > 0);
 
+	_gdp_lat_record(req->cpdu->msg->cmd, GDP_LAT_RTT, t0);
+	ep_trace_end(&span);
+	if (traced)
+		ep_trace_set(0, 0);
+
 	// if we had any pending asynchronous events, deliver them
 	_gdp_event_trigger_pending(req, false);
 
@@ -464,6 +497,36 @@ ack_data_content(gdp_req_t *req)
 }
 
 
+// 206 --- response to multiread command
+static EP_STAT
+ack_multi_content(gdp_req_t *req)
+{
+	EP_STAT estat;
+
+	EP_ASSERT_ELSE(req->gob != NULL, return EP_STAT_ASSERT_ABORT);
+	GDP_MSG_CHECK(req->rpdu, return EP_STAT_ASSERT_ABORT);
+
+	estat = ack(req, "ack_multi_content");
+	EP_STAT_CHECK(estat, return estat);
+
+	EP_ASSERT_ELSE(req->rpdu->msg->body_case ==
+						GDP_MESSAGE__BODY_ACK_MULTI_CONTENT,
+				return EP_STAT_ASSERT_ABORT);
+	GdpMessage__AckMultiContent *payload = req->rpdu->msg->ack_multi_content;
+
+	ep_dbg_cprintf(Dbg, 25, "ack_multi_content(%zd): %"PRId64 " so far\n",
+			payload->n_r, req->r_results);
+
+	// individual results are turned into events by _gdp_event_add_from_req;
+	// here we just keep track of how many we got
+	req->r_results += payload->n_r;
+	if (req->s_results >= 0 && req->r_results >= req->s_results)
+		req->flags &= ~GDP_REQ_PERSIST;
+
+	return estat;
+}
+
+
 // 263 --- no more results to come
 static EP_STAT
 ack_end_results(gdp_req_t *req)
@@ -482,8 +545,17 @@ ack_end_results(gdp_req_t *req)
 				return EP_STAT_ASSERT_ABORT);
 	GdpMessage__AckEndOfResults *payload = req->rpdu->msg->ack_end_of_results;
 
+	// each multiread batch ends on its own; only the last ends the req
+	if (req->mr_batches > 0 && --req->mr_batches > 0)
+	{
+		req->mr_results += payload->nresults;
+		ep_dbg_cprintf(Dbg, 15,
+				"ack_end_results: batch done, %d to go\n", req->mr_batches);
+		return EP_STAT_OK;
+	}
+
 	// don't need to check has_nresults, since the default is what we want
-	req->s_results = payload->nresults;
+	req->s_results = req->mr_results + payload->nresults;
 	ep_dbg_cprintf(Dbg, req->r_results == req->s_results ? 15 : 10,
 			"ack_end_results: read %"PRId64 " sent %"PRId64 "\n",
 			req->r_results, req->s_results);
@@ -643,11 +715,11 @@ static dispatch_ent_t	DispatchTable[256] =
 	{ NULL,				"CMD_GETMETADATA",		GDP_STAT_ACK_SUCCESS		},	// 79
 	{ NULL,				"CMD_NEWSEGMENT",		GDP_STAT_ACK_SUCCESS		},	// 80
 	{ NULL,				"CMD_DELETE",			GDP_STAT_ACK_SUCCESS		},	// 81
-	NOENT,				// 82
-	NOENT,				// 83
-	NOENT,				// 84
-	NOENT,				// 85
-	NOENT,				// 86
+	{ NULL,				"CMD_MULTIREAD",		GDP_STAT_ACK_SUCCESS		},	// 82
+	{ NULL,				"CMD_SUBSCRIBE_GROUP",	GDP_STAT_ACK_SUCCESS		},	// 83
+	{ NULL,				"CMD_GET_PROOF",		GDP_STAT_ACK_SUCCESS		},	// 84
+	{ NULL,				"CMD_REPLICATE",		GDP_STAT_ACK_SUCCESS		},	// 85
+	{ NULL,				"CMD_SUBSCRIBE_CREDIT",	GDP_STAT_ACK_SUCCESS		},	// 86
 	NOENT,				// 87
 	NOENT,				// 88
 	NOENT,				// 89
@@ -695,7 +767,7 @@ static dispatch_ent_t	DispatchTable[256] =
 	{ ack_success,		"ACK_DATA_VALID",		GDP_STAT_ACK_VALID			},	// 131
 	{ ack_data_changed,	"ACK_DATA_CHANGED",		GDP_STAT_ACK_CHANGED		},	// 132
 	{ ack_data_content,	"ACK_DATA_CONTENT",		GDP_STAT_ACK_CONTENT		},	// 133
-	NOENT,				// 134
+	{ ack_multi_content, "ACK_MULTI_CONTENT",	GDP_STAT_ACK_MULTI_CONTENT	},	// 134
 	NOENT,				// 135
 	NOENT,				// 136
 	NOENT,				// 137
@@ -783,7 +855,7 @@ static dispatch_ent_t	DispatchTable[256] =
 	NOENT,				// 218
 	NOENT,				// 219
 	NOENT,				// 220
-	NOENT,				// 221
+	{ nak_client,		"NAK_C_TOOMANY",		GDP_STAT_NAK_TOOMANY		},	// 221
 	{ nak_client,		"NAK_C_MISSING_RECORD",	GDP_STAT_NAK_REC_MISSING	},	// 222
 	{ nak_client,		"NAK_C_REC_DUP",		GDP_STAT_NAK_REC_DUP		},	// 223
 
@@ -39,6 +39,7 @@
 #include "gdp_priv.h"
 
 #include <ep/ep_dbg.h>
+#include <ep/ep_hash.h>
 #include <ep/ep_log.h>
 #include <ep/ep_prflags.h>
 #include <ep/ep_thr.h>
@@ -86,6 +87,366 @@ statestr(const gdp_req_t *req)
 	}
 }
 
+/***********************************************************************
+**
+**	Request indexes
+**
+**		Responses, subscription refreshes, and credit grants are
+**		matched to their request by the request id and the names at
+**		the two ends.  Walking the GOB or channel list to do that
+**		(locking every req on the way) is O(n) per PDU, which hurts
+**		on a log server with thousands of subscriptions to one log
+**		or a client with many asynchronous requests outstanding.
+**		Each of those lists therefore has a hash index alongside it.
+**
+**		The GOB index is keyed on (cpdu->src, rid) and the channel
+**		index on (cpdu->src, cpdu->dst, rid).  The chains run through
+**		the reqs themselves, so linking only allocates when the table
+**		doubles (at a load factor of one).  An index is protected by
+**		the same lock as the list it shadows, so a lookup touches no
+**		req locks; the caller locks the req it gets back.  Always use
+**		the link/unlink routines below so list and index stay in step.
+**
+**		Requests with the same key (e.g., the rid 0 shared by
+**		synchronous commands) are kept newest first, as on the lists.
+**		A request without a command PDU is on the list but not in the
+**		index, since there is nothing to match it against.
+*/
+
+#define REQ_INDEX_MINSIZE		16
+
+static uint32_t
+req_key_hash(int which,
+		const gdp_name_t src,
+		const gdp_name_t dst,
+		gdp_rid_t rid)
+{
+	uint32_t h;
+	uint32_t h2;
+
+	// names are already cryptographic hashes; any 32 bits will do
+	memcpy(&h, src, sizeof h);
+	if (which == GDP_REQ_IX_CHAN)
+	{
+		memcpy(&h2, dst, sizeof h2);
+		h ^= (h2 << 16) | (h2 >> 16);
+	}
+
+	// multiply so consecutive rids land in different chains
+	return h ^ (rid * 0x9e3779b1U);
+}
+
+static bool
+req_key_match(const gdp_req_t *req,
+		int which,
+		const gdp_name_t src,
+		const gdp_name_t dst,
+		gdp_rid_t rid)
+{
+	return req->cpdu->msg->rid == rid &&
+			GDP_NAME_SAME(req->cpdu->src, src) &&
+			(which != GDP_REQ_IX_CHAN || GDP_NAME_SAME(req->cpdu->dst, dst));
+}
+
+/*
+**  Double the number of chains.  Each old chain splits into two
+**  new ones; entries are appended so the order within each is kept.
+*/
+
+static void
+req_index_grow(struct req_index *idx, int which)
+{
+	struct req_head *otab = idx->tab;
+	uint32_t osize = idx->tabsize;
+	uint32_t nsize = osize == 0 ? REQ_INDEX_MINSIZE : osize * 2;
+	uint32_t i;
+
+	idx->tab = (struct req_head *) ep_mem_malloc(nsize * sizeof *idx->tab);
+	for (i = 0; i < nsize; i++)
+		LIST_INIT(&idx->tab[i]);
+	for (i = 0; i < osize; i++)
+	{
+		gdp_req_t *last[2] = { NULL, NULL };
+		gdp_req_t *req;
+
+		while ((req = LIST_FIRST(&otab[i])) != NULL)
+		{
+			int hi = (req->ix[which].hval & osize) != 0;
+
+			LIST_REMOVE(req, ix[which].chain);
+			if (last[hi] == NULL)
+				LIST_INSERT_HEAD(&idx->tab[i + hi * osize],
+						req, ix[which].chain);
+			else
+				LIST_INSERT_AFTER(last[hi], req, ix[which].chain);
+			last[hi] = req;
+		}
+	}
+	idx->tabsize = nsize;
+	if (otab != NULL)
+		ep_mem_free(otab);
+	ep_dbg_cprintf(Dbg, 40, "req_index_grow(%p): %" PRIu32 " chains\n",
+			idx, nsize);
+}
+
+static void
+req_index_insert(struct req_index *idx, int which, gdp_req_t *req)
+{
+	struct req_link *link = &req->ix[which];
+
+	if (req->cpdu == NULL || req->cpdu->msg == NULL)
+		return;
+	if (idx->nreqs >= idx->tabsize)
+		req_index_grow(idx, which);
+	link->hval = req_key_hash(which, req->cpdu->src, req->cpdu->dst,
+						req->cpdu->msg->rid);
+	LIST_INSERT_HEAD(&idx->tab[link->hval & (idx->tabsize - 1)],
+			req, ix[which].chain);
+	idx->nreqs++;
+}
+
+static void
+req_index_remove(struct req_index *idx, int which, gdp_req_t *req)
+{
+	if (req->ix[which].chain.le_prev == NULL)
+		return;				// never indexed
+	LIST_REMOVE(req, ix[which].chain);
+	req->ix[which].chain.le_prev = NULL;
+	idx->nreqs--;
+}
+
+static gdp_req_t *
+req_index_find(struct req_index *idx,
+		int which,
+		const gdp_name_t src,
+		const gdp_name_t dst,
+		gdp_rid_t rid)
+{
+	gdp_req_t *req;
+	uint32_t h;
+
+	if (idx->nreqs == 0)
+		return NULL;
+	h = req_key_hash(which, src, dst, rid);
+	LIST_FOREACH(req, &idx->tab[h & (idx->tabsize - 1)], ix[which].chain)
+	{
+		if (req->ix[which].hval == h &&
+				req_key_match(req, which, src, dst, rid))
+			break;
+	}
+	return req;
+}
+
+/*
+**  Drop everything in an index and release the table (the list it
+**  shadows has been abandoned or emptied).
+*/
+
+static void
+req_index_clear(struct req_index *idx, int which)
+{
+	uint32_t i;
+
+	for (i = 0; i < idx->tabsize; i++)
+	{
+		gdp_req_t *req;
+
+		while ((req = LIST_FIRST(&idx->tab[i])) != NULL)
+			req_index_remove(idx, which, req);
+	}
+	if (idx->tab != NULL)
+		ep_mem_free(idx->tab);
+	idx->tab = NULL;
+	idx->tabsize = 0;
+	idx->nreqs = 0;
+}
+
+
+/*
+**  _GDP_REQ_GOB_LINK, _GDP_REQ_GOB_UNLINK --- maintain req->gob list
+**
+**		The GOB must be locked.
+*/
+
+void
+_gdp_req_gob_link(gdp_req_t *req)
+{
+	gdp_gob_t *gob = req->gob;
+
+	EP_ASSERT_ELSE(gob != NULL, return);
+	LIST_INSERT_HEAD(&gob->reqs, req, goblist);
+	req_index_insert(&gob->reqindex, GDP_REQ_IX_GOB, req);
+	req->flags |= GDP_REQ_ON_GOB_LIST;
+}
+
+void
+_gdp_req_gob_unlink(gdp_req_t *req)
+{
+	gdp_gob_t *gob = req->gob;
+
+	if (!EP_UT_BITSET(GDP_REQ_ON_GOB_LIST, req->flags))
+		return;
+	EP_ASSERT_ELSE(gob != NULL, return);
+	LIST_REMOVE(req, goblist);
+	req_index_remove(&gob->reqindex, GDP_REQ_IX_GOB, req);
+	req->flags &= ~GDP_REQ_ON_GOB_LIST;
+}
+
+
+/*
+**  _GDP_REQ_GOB_LOOKUP --- find a req on a GOB list by (src, rid)
+**
+**		Returns the most recently linked match.  A rid of
+**		GDP_PDU_ANY_RID matches any request from src; that is rare
+**		enough (router errors) to just walk the list.
+**
+**		The GOB must be locked.  The req is returned unlocked.
+*/
+
+gdp_req_t *
+_gdp_req_gob_lookup(gdp_gob_t *gob, const gdp_name_t src, gdp_rid_t rid)
+{
+	gdp_req_t *req;
+
+	if (rid != GDP_PDU_ANY_RID)
+		return req_index_find(&gob->reqindex, GDP_REQ_IX_GOB, src, NULL, rid);
+	LIST_FOREACH(req, &gob->reqs, goblist)
+	{
+		if (req->cpdu != NULL && req->cpdu->msg != NULL &&
+				GDP_NAME_SAME(req->cpdu->src, src))
+			break;
+	}
+	return req;
+}
+
+
+/*
+**  _GDP_REQ_CHAN_LINK, _GDP_REQ_CHAN_UNLINK --- maintain channel list
+**
+**		The channel must be locked.
+*/
+
+void
+_gdp_req_chan_link(gdp_req_t *req, gdp_chan_x_t *chanx)
+{
+	LIST_INSERT_HEAD(&chanx->reqs, req, chanlist);
+	req_index_insert(&chanx->reqindex, GDP_REQ_IX_CHAN, req);
+	req->flags |= GDP_REQ_ON_CHAN_LIST;
+}
+
+void
+_gdp_req_chan_unlink(gdp_req_t *req, gdp_chan_x_t *chanx)
+{
+	if (!EP_UT_BITSET(GDP_REQ_ON_CHAN_LIST, req->flags))
+		return;
+	LIST_REMOVE(req, chanlist);
+	req_index_remove(&chanx->reqindex, GDP_REQ_IX_CHAN, req);
+	req->flags &= ~GDP_REQ_ON_CHAN_LIST;
+}
+
+
+/*
+**  _GDP_REQ_CHAN_LOOKUP --- find a req on a channel by (src, dst, rid)
+**
+**		As for _gdp_req_gob_lookup, but the destination must match
+**		as well.  The channel must be locked.
+*/
+
+gdp_req_t *
+_gdp_req_chan_lookup(gdp_chan_x_t *chanx,
+		const gdp_name_t src,
+		const gdp_name_t dst,
+		gdp_rid_t rid)
+{
+	gdp_req_t *req;
+
+	if (rid != GDP_PDU_ANY_RID)
+		return req_index_find(&chanx->reqindex, GDP_REQ_IX_CHAN,
+							src, dst, rid);
+	LIST_FOREACH(req, &chanx->reqs, chanlist)
+	{
+		if (req->cpdu != NULL && req->cpdu->msg != NULL &&
+				GDP_NAME_SAME(req->cpdu->src, src) &&
+				GDP_NAME_SAME(req->cpdu->dst, dst))
+			break;
+	}
+	return req;
+}
+
+
+/*
+**  _GDP_REQ_SET_RID --- change the rid of a command
+**
+**		The request is moved to its new place in any index it is in.
+**		The request and its GOB (if it is on the GOB list) must be
+**		locked; this takes the channel lock itself.
+*/
+
+void
+_gdp_req_set_rid(gdp_req_t *req, gdp_rid_t rid)
+{
+	bool on_gob = req->ix[GDP_REQ_IX_GOB].chain.le_prev != NULL;
+	bool on_chan = req->ix[GDP_REQ_IX_CHAN].chain.le_prev != NULL;
+	gdp_chan_x_t *chanx = NULL;
+
+	GDP_MSG_CHECK(req->cpdu, return);
+	if (on_gob)
+	{
+		GDP_GOB_ASSERT_ISLOCKED(req->gob);
+		req_index_remove(&req->gob->reqindex, GDP_REQ_IX_GOB, req);
+	}
+	if (on_chan)
+	{
+		_gdp_chan_lock(req->chan);
+		chanx = _gdp_chan_get_cdata(req->chan);
+		req_index_remove(&chanx->reqindex, GDP_REQ_IX_CHAN, req);
+	}
+
+	req->cpdu->msg->rid = rid;
+
+	if (on_chan)
+	{
+		req_index_insert(&chanx->reqindex, GDP_REQ_IX_CHAN, req);
+		_gdp_chan_unlock(req->chan);
+	}
+	if (on_gob)
+		req_index_insert(&req->gob->reqindex, GDP_REQ_IX_GOB, req);
+}
+
+
+/*
+**  _GDP_REQ_SET_DST --- change the destination of a command
+**
+**		Only the channel index is keyed on the destination, so the
+**		request is moved to its new place there if it is indexed.
+**		The request must be locked; this takes the channel lock
+**		itself.
+*/
+
+void
+_gdp_req_set_dst(gdp_req_t *req, const gdp_name_t dst)
+{
+	bool on_chan = req->ix[GDP_REQ_IX_CHAN].chain.le_prev != NULL;
+	gdp_chan_x_t *chanx = NULL;
+
+	EP_ASSERT_ELSE(req->cpdu != NULL, return);
+	if (on_chan)
+	{
+		_gdp_chan_lock(req->chan);
+		chanx = _gdp_chan_get_cdata(req->chan);
+		req_index_remove(&chanx->reqindex, GDP_REQ_IX_CHAN, req);
+	}
+
+	memcpy(req->cpdu->dst, dst, sizeof req->cpdu->dst);
+
+	if (on_chan)
+	{
+		req_index_insert(&chanx->reqindex, GDP_REQ_IX_CHAN, req);
+		_gdp_chan_unlock(req->chan);
+	}
+}
+
+
 /*
 **  _GDP_REQ_NEW --- allocate a new request
 **
@@ -174,6 +535,8 @@ _gdp_req_new(gdp_cmd_t cmd,
 		_gdp_gob_incref(gob);		// request has a new reference
 	req->r_results = 0;				// no results received yet
 	req->s_results = -1;			// unknown number of results sent
+	req->mr_batches = 0;			// not a multiread
+	req->mr_results = 0;
 
 	// if we're not passing in a PDU, create and initialize the new one
 	if (pdu == NULL)
@@ -236,8 +599,7 @@ _gdp_req_new(gdp_cmd_t cmd,
 		}
 		IF_LIST_CHECK_OK(&chanx->reqs, req, chanlist, gdp_req_t)
 		{
-			LIST_INSERT_HEAD(&chanx->reqs, req, chanlist);
-			req->flags |= GDP_REQ_ON_CHAN_LIST;
+			_gdp_req_chan_link(req, chanx);
 		}
 		else
 		{
@@ -292,6 +654,7 @@ _gdp_req_free(gdp_req_t **reqp)
 
 	// remove any timeout associated with this req
 	_gdp_evloop_timer_clr(&req->ev_to);
+	ep_timer_clr(_GdpTimers, &req->lease_timer);
 
 	// flush any saved events for this req
 	_gdp_event_trigger_pending(req, true);
@@ -300,8 +663,7 @@ _gdp_req_free(gdp_req_t **reqp)
 	if (EP_UT_BITSET(GDP_REQ_ON_CHAN_LIST, req->flags))
 	{
 		_gdp_chan_lock(req->chan);
-		LIST_REMOVE(req, chanlist);
-		req->flags &= ~GDP_REQ_ON_CHAN_LIST;
+		_gdp_req_chan_unlink(req, _gdp_chan_get_cdata(req->chan));
 		_gdp_chan_unlock(req->chan);
 	}
 
@@ -310,8 +672,7 @@ _gdp_req_free(gdp_req_t **reqp)
 	{
 		EP_ASSERT_ELSE(req->gob != NULL, return);
 		GDP_GOB_ASSERT_ISLOCKED(req->gob);
-		LIST_REMOVE(req, goblist);
-		req->flags &= ~GDP_REQ_ON_GOB_LIST;
+		_gdp_req_gob_unlink(req);
 	}
 
 	// remove any pending events from the request
@@ -321,17 +682,35 @@ _gdp_req_free(gdp_req_t **reqp)
 			TAILQ_REMOVE(&req->events, gev, queue);
 	}
 
+	// queued subscription output outlives the req (gdplogd only)
+	if (req->outq != NULL)
+		(*req->outq_release)(req->outq);
+	req->outq = NULL;
+
 	// free the associated PDU(s)
 	if (req->rpdu != NULL && req->rpdu != req->cpdu)
 		_gdp_pdu_free(&req->rpdu);
 	if (req->cpdu != NULL)
 		_gdp_pdu_free(&req->cpdu);
 
+	// free the GIN table from a multiread (the GINs themselves aren't ours)
+	if (req->gins != NULL)
+		ep_mem_free(req->gins);
+	req->gins = NULL;
+	req->ngins = 0;
+	if (req->ginindex != NULL)
+		ep_hash_free(req->ginindex);
+	req->ginindex = NULL;
+
 	if (req->gob != NULL)
 		_gdp_gob_decref(&req->gob, true);
 	req->state = GDP_REQ_FREE;
 	req->flags = 0;
 	req->sub_cbarg = NULL;
+	req->sub_credit = 0;
+	req->sub_pass = 0;
+	req->sub_window = 0;
+	req->sub_unacked = 0;
 
 	// add the empty request to the free list
 	ep_thr_mutex_lock(&ReqFreeListMutex);
@@ -379,8 +758,7 @@ _gdp_req_freeall(gdp_gob_t *gob,
 		{
 			// couldn't lock the request, so skip it
 			ep_log(estat, "_gdp_req_freeall: couldn't acquire req lock");
-			LIST_REMOVE(req, goblist);
-			req->flags &= ~GDP_REQ_ON_GOB_LIST;
+			_gdp_req_gob_unlink(req);
 			rstat = estat;
 		}
 		else if (gin == NULL || req->gin == gin)
@@ -403,6 +781,7 @@ _gdp_req_freeall(gdp_gob_t *gob,
 		// if there were errors, it's possible that there are still some
 		// items on reqlist.  Abandon those to avoid cascading errors.
 		LIST_INIT(&gob->reqs);
+		req_index_clear(&gob->reqindex, GDP_REQ_IX_GOB);
 	}
 
 	if (ep_dbg_test(Dbg, EP_STAT_ISOK(rstat) ? 49 : 1))
@@ -483,8 +862,17 @@ _gdp_req_send(gdp_req_t *req)
 		// link the request to the GOB
 		ep_dbg_cprintf(Dbg, 49, "_gdp_req_send(%p) gob=%p\n", req, gob);
 		GDP_GOB_ASSERT_ISLOCKED(gob);
-		LIST_INSERT_HEAD(&gob->reqs, req, goblist);
-		req->flags |= GDP_REQ_ON_GOB_LIST;
+		_gdp_req_gob_link(req);
+	}
+
+	// if this thread is tracing, the receiver should join in
+	if (ep_trace_enabled() && ep_trace_id() != 0 &&
+			!req->cpdu->msg->has_trace_id)
+	{
+		req->cpdu->msg->has_trace_id = true;
+		req->cpdu->msg->trace_id = ep_trace_id();
+		req->cpdu->msg->has_span_id = true;
+		req->cpdu->msg->span_id = ep_trace_span_id();
 	}
 
 	// write the message out
@@ -525,8 +913,7 @@ _gdp_req_unsend(gdp_req_t *req)
 				req);
 	}
 	GDP_GOB_ASSERT_ISLOCKED(gob);
-	LIST_REMOVE(req, goblist);
-	req->flags &= ~GDP_REQ_ON_GOB_LIST;
+	_gdp_req_gob_unlink(req);
 
 	return EP_STAT_OK;
 }
@@ -548,6 +935,9 @@ _gdp_req_unsend(gdp_req_t *req)
 **		more-or-less what gdplogd does now, so this problem only shows
 **		up in clients that may be working with many GOBs at the same
 **		time.  Tomorrow is another day.
+**
+**		Only requests we sent can be answered, so this looks for
+**		(_GdpMyRoutingName, rid) in the GOB request index.
 */
 
 gdp_req_t *
@@ -563,30 +953,16 @@ _gdp_req_find(gdp_gob_t *gob, gdp_rid_t rid)
 
 	for (;;)
 	{
-		EP_STAT estat;
-		gdp_req_t *nextreq;
-
-		do
-		{
-			estat = EP_STAT_OK;
-			req = LIST_FIRST(&gob->reqs);
-			for (; req != NULL; req = nextreq)
-			{
-				estat = _gdp_req_lock(req);
-				EP_STAT_CHECK(estat, break);
-				nextreq = LIST_NEXT(req, goblist);
-				if (req->cpdu != NULL && req->cpdu->msg != NULL &&
-						(rid == GDP_PDU_ANY_RID || req->cpdu->msg->rid == rid))
-					break;
-				_gdp_req_unlock(req);
-			}
-		} while (!EP_STAT_ISOK(estat));
+		req = _gdp_req_gob_lookup(gob, _GdpMyRoutingName, rid);
 		if (req == NULL)
 			break;				// nothing to find
 
 		// if we find a free request (we shouldn't), just ignore it
-		EP_ASSERT_ELSE(req->state != GDP_REQ_FREE,
-						continue);
+		if (!EP_STAT_ISOK(_gdp_req_lock(req)))
+		{
+			req = NULL;
+			break;
+		}
 		if (req->state != GDP_REQ_ACTIVE)
 			break;				// this is what we are looking for!
 
@@ -595,14 +971,14 @@ _gdp_req_find(gdp_gob_t *gob, gdp_rid_t rid)
 				statestr(req));
 		//XXX should have a timeout here
 		ep_thr_cond_wait(&req->cond, &req->mutex, NULL);
+		_gdp_req_unlock(req);
 	}
 	if (req != NULL)
 	{
 		if (!EP_UT_BITSET(GDP_REQ_PERSIST|GDP_REQ_ASYNCIO, req->flags))
 		{
 			EP_ASSERT(EP_UT_BITSET(GDP_REQ_ON_GOB_LIST, req->flags));
-			LIST_REMOVE(req, goblist);
-			req->flags &= ~GDP_REQ_ON_GOB_LIST;
+			_gdp_req_gob_unlink(req);
 		}
 	}
 
@@ -634,6 +1010,7 @@ static EP_PRFLAGS_DESC	ReqFlags[] =
 	{ GDP_REQ_ON_CHAN_LIST,	GDP_REQ_ON_CHAN_LIST,	"ON_CHAN_LIST"	},
 	{ GDP_REQ_VRFY_CONTENT,	GDP_REQ_VRFY_CONTENT,	"VRFY_CONTENT"	},
 	{ GDP_REQ_ROUTEFAIL,	GDP_REQ_ROUTEFAIL,		"ROUTEFAIL"		},
+	{ GDP_REQ_SRV_CATCHUP,	GDP_REQ_SRV_CATCHUP,	"SRV_CATCHUP"	},
 	{ 0,					0,						NULL			}
 };
 
@@ -96,6 +96,11 @@ static struct ep_stat_to_string Stats[] =
 	{ GDP_STAT_CRYPTO_NO_SIG,			"datum missing required signature",	},
 	{ GDP_STAT_SVC_NAME_REQ,			"service name required",			},
 	{ GDP_STAT_HONGD_UNAVAILABLE,		"human-to-GDPname directory unavailable",	},
+	{ GDP_STAT_READ_BUDGET,				"read byte budget exhausted",		},
+	{ GDP_STAT_MERKLE_PROOF_FAIL,		"Merkle inclusion proof failed",	},
+	{ GDP_STAT_MERKLE_UNSIGNED,			"Merkle checkpoint not signed",		},
+	{ GDP_STAT_PDU_FLOW_UNKNOWN,		"unknown PDU flow id",				},
+	{ GDP_STAT_PDU_DESYNC,				"lost PDU framing",					},
 
 	// codes corresponding to command responses
 	{ GDP_STAT_ACK_END_OF_RESULTS,		"263 end of results",				},
@@ -112,6 +117,7 @@ static struct ep_stat_to_string Stats[] =
 	{ GDP_STAT_NAK_PRECONFAILED,		"412 precondition failed",			},
 	{ GDP_STAT_NAK_TOOLARGE,			"413 request entity too large",		},
 	{ GDP_STAT_NAK_UNSUPMEDIA,			"415 unsupported media type",		},
+	{ GDP_STAT_NAK_TOOMANY,				"429 too many requests",			},
 	{ GDP_STAT_NAK_REC_MISSING,			"430 missing record",				},
 	{ GDP_STAT_NAK_REC_DUP,				"431 duplicate record",				},
 
@@ -100,6 +100,11 @@ extern void		_gdp_stat_init(void);
 #define GDP_STAT_OK_NAME_PNAME			GDP_STAT_NEW(OK, 51)
 #define GDP_STAT_OK_NAME_HEX			GDP_STAT_NEW(OK, 52)
 #define GDP_STAT_HONGD_UNAVAILABLE		GDP_STAT_NEW(ERROR, 53)
+#define GDP_STAT_READ_BUDGET			GDP_STAT_NEW(WARN, 54)
+#define GDP_STAT_MERKLE_PROOF_FAIL		GDP_STAT_NEW(ERROR, 55)
+#define GDP_STAT_MERKLE_UNSIGNED		GDP_STAT_NEW(WARN, 56)
+#define GDP_STAT_PDU_FLOW_UNKNOWN		GDP_STAT_NEW(WARN, 57)
+#define GDP_STAT_PDU_DESYNC				GDP_STAT_NEW(ERROR, 58)
 
 
 /*
@@ -127,6 +132,7 @@ extern void		_gdp_stat_init(void);
 #define _GDP_CCODE_CONTENT			205		// Content (~200, GET only)
 											// (HTTP 205 Reset Content)
 											// (HTTP 206 Partial Content)
+#define _GDP_CCODE_MULTI_CONTENT	206		// Content from several logs (mread)
 #define _GDP_CCODE_END_OF_RESULTS	263		// end of results (subscr/mread)
 
 #define _GDP_CCODE_BADREQ			400		// HTTP/CoAP Bad Request
@@ -149,6 +155,7 @@ extern void		_gdp_stat_init(void);
 											// (HTTP 415 Request URI Too Long)
 											// (HTTP 416 Requested Range Not Satisficable)
 											// (HTTP 417 Expectation Failed)
+#define _GDP_CCODE_TOOMANY			429		// HTTP/CoAP Too Many Requests
 #define _GDP_CCODE_REC_MISSING		430		// GDP missing record (gap)
 #define _GDP_CCODE_REC_DUP			431		// GDP Duplicate Record
 
@@ -172,6 +179,7 @@ extern void		_gdp_stat_init(void);
 #define GDP_STAT_ACK_VALID			GDP_STAT_NEW(OK, _GDP_CCODE_VALID)
 #define GDP_STAT_ACK_CHANGED		GDP_STAT_NEW(OK, _GDP_CCODE_CHANGED)
 #define GDP_STAT_ACK_CONTENT		GDP_STAT_NEW(OK, _GDP_CCODE_CONTENT)
+#define GDP_STAT_ACK_MULTI_CONTENT	GDP_STAT_NEW(OK, _GDP_CCODE_MULTI_CONTENT)
 #define GDP_STAT_ACK_END_OF_RESULTS	GDP_STAT_NEW(WARN, _GDP_CCODE_END_OF_RESULTS)
 
 #define GDP_STAT_NAK_BADREQ			GDP_STAT_NEW(ERROR, _GDP_CCODE_BADREQ)
@@ -186,6 +194,7 @@ extern void		_gdp_stat_init(void);
 #define GDP_STAT_NAK_PRECONFAILED	GDP_STAT_NEW(ERROR, _GDP_CCODE_PRECONFAILED)
 #define GDP_STAT_NAK_TOOLARGE		GDP_STAT_NEW(ERROR, _GDP_CCODE_TOOLARGE)
 #define GDP_STAT_NAK_UNSUPMEDIA		GDP_STAT_NEW(ERROR, _GDP_CCODE_UNSUPMEDIA)
+#define GDP_STAT_NAK_TOOMANY		GDP_STAT_NEW(WARN, _GDP_CCODE_TOOMANY)
 #define GDP_STAT_NAK_REC_MISSING	GDP_STAT_NEW(WARN, _GDP_CCODE_REC_MISSING)
 #define GDP_STAT_NAK_REC_DUP		GDP_STAT_NEW(WARN, _GDP_CCODE_REC_DUP)
 
@@ -51,6 +51,185 @@ EP_THR_MUTEX		_GdpSubscriptionMutex	EP_THR_MUTEX_INITIALIZER;
 struct req_head		_GdpSubscriptionRequests;
 
 
+/*
+**  Send the membership of a group subscription.
+**
+**		Used both for the initial setup and to re-establish a group
+**		that the server has lost.  The logs are sent in batches that
+**		fit in a PDU, all with the same rid, so the server adds them
+**		to the same group.  If starts is NULL each log resumes after
+**		the last record we have seen.
+*/
+
+#define SUBGRP_MAXLOGS_DEFAULT	1200		// ~45 bytes each on the wire
+
+static EP_STAT
+subscr_group_send(gdp_req_t *req, const gdp_recno_t *starts)
+{
+	EP_STAT estat = EP_STAT_OK;
+	GdpMessage__CmdSubscribeGroup *payload;
+	int maxlogs;
+	int first;
+
+	GDP_MSG_CHECK(req->cpdu, return EP_STAT_ASSERT_ABORT);
+	EP_ASSERT_ELSE(req->cpdu->msg->cmd == GDP_CMD_SUBSCRIBE_GROUP,
+					return EP_STAT_ASSERT_ABORT);
+	payload = req->cpdu->msg->cmd_subscribe_group;
+	payload->has_renew = false;
+	payload->renew = false;
+
+	maxlogs = ep_adm_getintparam("swarm.gdp.subscr.group.maxlogs",
+							SUBGRP_MAXLOGS_DEFAULT);
+	if (maxlogs <= 0)
+		maxlogs = SUBGRP_MAXLOGS_DEFAULT;
+
+	for (first = 0; first < req->ngins; first += maxlogs)
+	{
+		size_t i;
+		int n = req->ngins - first;
+
+		if (n > maxlogs)
+			n = maxlogs;
+		payload->n_sel = n;
+		payload->sel = (GdpMessage__CmdSubscribeGroup__Selector **)
+					ep_mem_malloc(n * sizeof *payload->sel);
+		for (i = 0; i < payload->n_sel; i++)
+		{
+			GdpMessage__CmdSubscribeGroup__Selector *sel;
+			gdp_gob_t *gob = req->gins[first + i]->gob;
+
+			sel = (GdpMessage__CmdSubscribeGroup__Selector *)
+						ep_mem_zalloc(sizeof *sel);
+			gdp_message__cmd_subscribe_group__selector__init(sel);
+			sel->logname.len = sizeof (gdp_name_t);
+			sel->logname.data = (uint8_t *) ep_mem_malloc(sizeof (gdp_name_t));
+			memcpy(sel->logname.data, gob->name, sizeof (gdp_name_t));
+			sel->has_start = true;
+			sel->start = starts != NULL ? starts[first + i] : gob->nrecs + 1;
+			payload->sel[i] = sel;
+		}
+
+		req->state = GDP_REQ_ACTIVE;
+		estat = _gdp_invoke(req);
+		if (req->rpdu != NULL)
+			_gdp_pdu_free(&req->rpdu);
+
+		// selectors are only needed for this batch
+		for (i = 0; i < payload->n_sel; i++)
+		{
+			ep_mem_free(payload->sel[i]->logname.data);
+			ep_mem_free(payload->sel[i]);
+		}
+		ep_mem_free(payload->sel);
+		payload->sel = NULL;
+		payload->n_sel = 0;
+
+		EP_STAT_CHECK(estat, break);
+	}
+
+	ep_dbg_cprintf(Dbg, EP_STAT_ISOK(estat) ? 20 : 1,
+			"subscr_group_send: %d logs in batches of %d\n",
+			req->ngins, maxlogs);
+	return estat;
+}
+
+
+/*
+**  Renew the lease on a group subscription.
+**
+**		This is one small PDU regardless of the size of the group.
+**		If the server has forgotten the group (e.g., it restarted)
+**		we send the whole thing again.
+*/
+
+static EP_STAT
+subscr_group_renew(gdp_req_t *req)
+{
+	EP_STAT estat;
+	GdpMessage__CmdSubscribeGroup *payload;
+
+	GDP_MSG_CHECK(req->cpdu, return EP_STAT_ASSERT_ABORT);
+	payload = req->cpdu->msg->cmd_subscribe_group;
+	payload->has_renew = true;
+	payload->renew = true;
+	payload->n_sel = 0;
+
+	estat = _gdp_invoke(req);
+	if (req->rpdu != NULL)
+		_gdp_pdu_free(&req->rpdu);
+	if (EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOTFOUND))
+	{
+		ep_dbg_cprintf(Dbg, 10, "subscr_group_renew: re-establishing group\n");
+		estat = subscr_group_send(req, NULL);
+	}
+	return estat;
+}
+
+
+/*
+**  Note the catch-up window the server agreed to.
+**
+**		A server that doesn't know about windows doesn't echo one,
+**		so we never send it credit it wouldn't understand.
+*/
+
+static void
+subscr_set_window(gdp_req_t *req)
+{
+	req->sub_window = 0;
+	req->sub_unacked = 0;
+	if (req->rpdu != NULL && req->rpdu->msg != NULL &&
+			req->rpdu->msg->body_case == GDP_MESSAGE__BODY_ACK_SUCCESS &&
+			req->rpdu->msg->ack_success->has_window)
+	{
+		req->sub_window = req->rpdu->msg->ack_success->window;
+	}
+}
+
+
+/*
+**  _GDP_SUBSCR_CREDIT --- count a record, granting more credit if needed
+**
+**		Called as each record arrives on a subscription.  Credit is
+**		granted half a window at a time so the server never stalls
+**		waiting for us while the records are still flowing.  The
+**		command has no response.  req must be locked.
+*/
+
+void
+_gdp_subscr_credit(gdp_req_t *req)
+{
+	EP_STAT estat;
+	gdp_msg_t *msg;
+	gdp_pdu_t *pdu;
+
+	if (req->sub_window <= 0 || req->gob == NULL || req->cpdu == NULL ||
+			++req->sub_unacked < (req->sub_window + 1) / 2)
+		return;
+
+	msg = _gdp_msg_new(GDP_CMD_SUBSCRIBE_CREDIT,
+						req->cpdu->msg->rid, req->cpdu->msg->l5seqno);
+	msg->cmd_subscribe_credit->credit = req->sub_unacked;
+	pdu = _gdp_pdu_new(msg, _GdpMyRoutingName, req->gob->name, GDP_SEQNO_NONE);
+	estat = _gdp_pdu_out(pdu, req->chan);
+	_gdp_pdu_free(&pdu);
+	if (EP_STAT_ISOK(estat))
+	{
+		ep_dbg_cprintf(Dbg, 44, "_gdp_subscr_credit: granted %" PRId32 "\n",
+				req->sub_unacked);
+		req->sub_unacked = 0;
+	}
+	else if (ep_dbg_test(Dbg, 1))
+	{
+		char ebuf[100];
+
+		// we'll try again with the next record
+		ep_dbg_printf("_gdp_subscr_credit: cannot send: %s\n",
+				ep_stat_tostr(estat, ebuf, sizeof ebuf));
+	}
+}
+
+
 /*
 **  Re-subscribe to a GCL
 */
@@ -71,6 +250,12 @@ subscr_resub(gdp_req_t *req)
 	// payload should already be set up
 	memcpy(req->cpdu->dst, req->gob->name, sizeof req->cpdu->dst);
 	memcpy(req->cpdu->src, _GdpMyRoutingName, sizeof req->cpdu->src);
+	if (req->cpdu->msg != NULL &&
+			req->cpdu->msg->cmd == GDP_CMD_SUBSCRIBE_GROUP)
+	{
+		estat = subscr_group_renew(req);
+	}
+	else
 	{
 		GDP_MSG_CHECK(req->cpdu, return EP_STAT_ASSERT_ABORT);
 		gdp_msg_t *msg = req->cpdu->msg;
@@ -82,9 +267,11 @@ subscr_resub(gdp_req_t *req)
 		payload->start = req->gob->nrecs + 1;
 		payload->has_nrecs = true;
 		payload->nrecs = req->numrecs;
-	}
 
-	estat = _gdp_invoke(req);
+		estat = _gdp_invoke(req);
+		if (EP_STAT_ISOK(estat))
+			subscr_set_window(req);
+	}
 
 	if (ep_dbg_test(Dbg, EP_STAT_ISOK(estat) ? 20 : 1))
 	{
@@ -98,10 +285,7 @@ subscr_resub(gdp_req_t *req)
 	req->state = GDP_REQ_IDLE;
 	// req->rpdu might be NULL if _gdp_invoke failed
 	if (req->rpdu != NULL)
-	{
-		gdp_message__free_unpacked(req->rpdu->msg, NULL);
-		req->rpdu->msg = NULL;
-	}
+		_gdp_pdu_msg_free(req->rpdu);
 
 	return estat;
 }
@@ -186,7 +370,8 @@ subscr_poker_thread(void *chan_)
 					// not a subscription: skip this entry
 					ep_dbg_cprintf(Dbg, 51, "   ... not client subscription\n");
 				}
-				else if (ep_time_before(&t_poke, &req->act_ts))
+				else if (ep_time_before(&t_poke, &req->act_ts) &&
+						req->cpdu->msg->cmd != GDP_CMD_SUBSCRIBE_GROUP)
 				{
 					// we've seen activity recently, no need to poke
 					ep_dbg_cprintf(Dbg, 51, "   ... not yet\n");
@@ -211,6 +396,36 @@ subscr_poker_thread(void *chan_)
 }
 
 
+/*
+**  Start a subscription poker thread if there isn't one already.
+*/
+
+static void
+subscr_start_poker(gdp_chan_t *chan)
+{
+	long poke = ep_adm_getlongparam("swarm.gdp.subscr.pokeintvl", 60L);
+	bool spawnthread = false;
+
+	ep_thr_mutex_lock(&_GdpSubscriptionMutex);
+	if (poke > 0 && !SubscriptionThreadRunning)
+	{
+		spawnthread = true;
+		SubscriptionThreadRunning = true;
+	}
+	if (spawnthread)
+	{
+		int istat = ep_thr_spawn(&SubscriptionThreadId,
+							subscr_poker_thread, chan);
+		if (istat != 0)
+		{
+			EP_STAT spawn_stat = ep_stat_from_errno(istat);
+			ep_log(spawn_stat, "_gdp_gin_subscribe: thread spawn failure");
+		}
+	}
+	ep_thr_mutex_unlock(&_GdpSubscriptionMutex);
+}
+
+
 /*
 **	_GDP_GIN_SUBSCRIBE_BY_RECNO --- subscribe to a GCL
 **
@@ -260,6 +475,17 @@ _gdp_gin_subscribe(gdp_gin_t *gin,
 			payload->has_nrecs = true;
 			payload->nrecs = numrecs;
 		}
+		if (cmd == GDP_CMD_SUBSCRIBE_BY_RECNO)
+		{
+			int32_t window = ep_adm_getintparam("swarm.gdp.subscr.window",
+									GDP_SUBSCR_WINDOW_DEF);
+
+			if (window > 0)
+			{
+				payload->has_window = true;
+				payload->window = window;
+			}
+		}
 	}
 
 	// arrange for responses to appear as events or callbacks
@@ -280,6 +506,8 @@ _gdp_gin_subscribe(gdp_gin_t *gin,
 
 		// now waiting for other events; go ahead and unlock
 		req->state = GDP_REQ_IDLE;
+		if (cmd == GDP_CMD_SUBSCRIBE_BY_RECNO)
+			subscr_set_window(req);
 		if (req->rpdu != NULL)
 			_gdp_pdu_free(&req->rpdu);
 		ep_thr_cond_signal(&req->cond);
@@ -289,34 +517,75 @@ _gdp_gin_subscribe(gdp_gin_t *gin,
 
 		// start a subscription poker thread if needed (not for multiread)
 		if (cmd == GDP_CMD_SUBSCRIBE_BY_RECNO)
-		{
-			long poke = ep_adm_getlongparam("swarm.gdp.subscr.pokeintvl", 60L);
-			bool spawnthread = false;
-
-			ep_thr_mutex_lock(&_GdpSubscriptionMutex);
-			if (poke > 0 && !SubscriptionThreadRunning)
-			{
-				spawnthread = true;
-				SubscriptionThreadRunning = true;
-			}
-			if (spawnthread)
-			{
-				int istat = ep_thr_spawn(&SubscriptionThreadId,
-									subscr_poker_thread, req->chan);
-				if (istat != 0)
-				{
-					EP_STAT spawn_stat = ep_stat_from_errno(istat);
-					ep_log(spawn_stat, "_gdp_gin_subscribe: thread spawn failure");
-				}
-			}
-			ep_thr_mutex_unlock(&_GdpSubscriptionMutex);
-		}
+			subscr_start_poker(req->chan);
 	}
 
 fail0:
 	return estat;
 }
 
+/*
+**	_GDP_GIN_SUBSCRIBE_GROUP --- subscribe to a group of logs
+**
+**		The group shares one request (and one lease on the server),
+**		which hangs off the first GIN.  The first GIN should be
+**		locked.
+*/
+
+EP_STAT
+_gdp_gin_subscribe_group(int n_gins,
+		gdp_gin_t **gins,
+		const gdp_recno_t *starts,
+		gdp_event_cbfunc_t cbfunc,
+		void *cbarg)
+{
+	EP_STAT estat;
+	gdp_req_t *req;
+	int i;
+
+	if (n_gins <= 0)
+		return EP_STAT_INVALID_ARG;
+	for (i = 0; i < n_gins; i++)
+	{
+		if (gins[i] == NULL || !GDP_GOB_ISGOOD(gins[i]->gob))
+			return GDP_STAT_LOG_NOT_OPEN;
+	}
+
+	estat = _gdp_req_new(GDP_CMD_SUBSCRIBE_GROUP, gins[0]->gob, _GdpChannel,
+			NULL, GDP_REQ_PERSIST | GDP_REQ_CLT_SUBSCR | GDP_REQ_ALLOC_RID,
+			&req);
+	EP_STAT_CHECK(estat, return estat);
+	req->gin = gins[0];
+
+	// remember the GINs so results can be mapped back
+	req->gins = (gdp_gin_t **) ep_mem_malloc(n_gins * sizeof *req->gins);
+	memcpy(req->gins, gins, n_gins * sizeof *req->gins);
+	req->ngins = n_gins;
+
+	// arrange for responses to appear as events or callbacks
+	_gdp_event_setcb(req, cbfunc, cbarg);
+
+	errno = 0;				// avoid spurious messages
+	estat = subscr_group_send(req, starts);
+
+	if (!EP_STAT_ISOK(estat))
+	{
+		_gdp_req_free(&req);
+	}
+	else
+	{
+		// from now on results are asynchronous
+		req->flags |= GDP_REQ_ASYNCIO;
+		req->state = GDP_REQ_IDLE;
+		ep_thr_cond_signal(&req->cond);
+		_gdp_req_unlock(req);
+
+		subscr_start_poker(_GdpChannel);
+	}
+	return estat;
+}
+
+
 EP_STAT
 _gdp_gin_unsubscribe(gdp_gin_t *gin,
 		gdp_event_cbfunc_t cbfunc,
@@ -360,7 +629,7 @@ _gdp_gin_unsubscribe(gdp_gin_t *gin,
 		GDP_MSG_CHECK(sub->cpdu, continue);
 		ep_dbg_cprintf(Dbg, 1, "... deleting rid %" PRIgdp_rid "\n",
 					sub->cpdu->msg->rid);
-		req->cpdu->msg->rid = sub->cpdu->msg->rid;
+		_gdp_req_set_rid(req, sub->cpdu->msg->rid);
 
 		estat = _gdp_invoke(req);
 		EP_STAT_CHECK(estat, continue);
@@ -29,6 +29,7 @@
 */
 
 #include "logd.h"
+#include "logd_admin.h"
 #include "logd_pubsub.h"
 
 #include <gdp/gdp_chan.h>
@@ -41,6 +42,8 @@
 #include <event2/listener.h>
 #include <event2/thread.h>
 
+#include <sqlite3.h>
+
 #include <ctype.h>
 #include <errno.h>
 #include <signal.h>
@@ -79,6 +82,211 @@ logd_sock_close_cb(gdp_chan_t *chan)
 }
 
 
+/*
+**  REPORT_LANES --- post thread pool lane statistics
+**
+**		Reported per reclaim interval, so the counts and
+**		maximums are reset each time.
+*/
+
+static void
+report_lanes(void)
+{
+	int lane;
+
+	for (lane = 0; lane < GDP_NLANES; lane++)
+	{
+		EP_THR_POOL_STATS st;
+		char depth[40];
+		char running[40];
+		char nrun[40];
+		char avgwait[40];
+		char maxwait[40];
+
+		ep_thr_pool_getstats(lane, &st, true);
+		if (st.nrun == 0 && st.max_depth == 0)
+			continue;
+		snprintf(depth, sizeof depth, "%d/%d", st.depth, st.max_depth);
+		snprintf(running, sizeof running, "%d/%d/%d",
+				st.running, st.max_running, st.limit);
+		snprintf(nrun, sizeof nrun, "%" PRIu64, st.nrun);
+		snprintf(avgwait, sizeof avgwait, "%" PRIu64,
+				st.nrun == 0 ? 0 : st.wait_usec / st.nrun);
+		snprintf(maxwait, sizeof maxwait, "%" PRIu64, st.max_wait_usec);
+		ep_dbg_cprintf(Dbg, 10,
+				"lane %s: depth %s running %s nrun %s wait %s/%s usec\n",
+				_GdpLaneNames[lane], depth, running, nrun, avgwait, maxwait);
+		admin_post_stats(ADMIN_LOG_LANES, "pool-lane",
+				"lane", _GdpLaneNames[lane],
+				"depth", depth,
+				"running", running,
+				"nrun", nrun,
+				"avg-wait-us", avgwait,
+				"max-wait-us", maxwait,
+				NULL, NULL);
+	}
+}
+
+
+/*
+**  REPORT_SHARDS --- post log directory shard statistics
+**
+**		Nothing is reported if there is only one log directory.
+*/
+
+static void
+report_shards(void)
+{
+	int shard;
+
+	if (shard_count() < 2)
+		return;
+	for (shard = 0; shard < shard_count(); shard++)
+	{
+		struct shard_stats ss;
+		char index[20];
+		char nlogs[40];
+		char used[20];
+		char moved[60];
+		char depth[20];
+		char nrun[40];
+		int lane;
+		int qdepth = 0;
+		uint64_t nran = 0;
+
+		shard_getstats(shard, &ss);
+		for (lane = 0; lane < GDP_NLANES; lane++)
+		{
+			EP_THR_POOL_STATS st;
+
+			ep_thr_pool_getstats_in(ss.pool, lane, &st, true);
+			qdepth += st.depth;
+			nran += st.nrun;
+		}
+		snprintf(index, sizeof index, "%d", shard);
+		snprintf(nlogs, sizeof nlogs, "%ld", ss.nlogs);
+		snprintf(used, sizeof used, "%d%%", ss.used_pct);
+		snprintf(moved, sizeof moved, "%ld/%ld", ss.nmoved_in, ss.nmoved_out);
+		snprintf(depth, sizeof depth, "%d", qdepth);
+		snprintf(nrun, sizeof nrun, "%" PRIu64, nran);
+		ep_dbg_cprintf(Dbg, 10,
+				"shard %s (%s): %s logs, %s used, moved %s, depth %s, nrun %s\n",
+				index, ss.root, nlogs, used, moved, depth, nrun);
+		admin_post_stats(ADMIN_LOG_SHARD, "shard-stats",
+				"shard", index,
+				"dir", ss.root,
+				"logs", nlogs,
+				"used", used,
+				"moved-in/out", moved,
+				"depth", depth,
+				"nrun", nrun,
+				NULL, NULL);
+	}
+}
+
+
+/*
+**  REPORT_LATENCY --- post per-command latency percentiles
+**
+**		The histograms are cumulative; only commands and stages
+**		that have been used since the last report are posted.
+*/
+
+static void
+report_latency(void)
+{
+	static uint64_t lastcount[256][GDP_LAT_NSTAGES];
+	int cmd;
+	int stage;
+
+	for (cmd = 0; cmd < 256; cmd++)
+	{
+		for (stage = 0; stage < GDP_LAT_NSTAGES; stage++)
+		{
+			struct gdp_lat_summary ls;
+			char count[40];
+			char pcts[100];
+			char max[40];
+
+			if (!_gdp_lat_summary(cmd, stage, &ls) ||
+					ls.count == lastcount[cmd][stage])
+				continue;
+			lastcount[cmd][stage] = ls.count;
+			snprintf(count, sizeof count, "%" PRIu64, ls.count);
+			snprintf(pcts, sizeof pcts,
+					"%" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64,
+					ls.p50, ls.p90, ls.p99, ls.p999);
+			snprintf(max, sizeof max, "%" PRIu64, ls.max);
+			admin_post_stats(ADMIN_LOG_LATENCY, "cmd-latency",
+					"cmd", _gdp_proto_cmd_name(cmd),
+					"stage", _gdp_lat_stage_name(stage),
+					"count", count,
+					"p50/90/99/99.9-us", pcts,
+					"max-us", max,
+					NULL, NULL);
+		}
+	}
+}
+
+
+/*
+**  REPORT_MEMORY --- post memory use by subsystem
+**
+**		Only tags whose usage has changed since the last report
+**		are posted.  SQLite doesn't allocate through ep_mem, so
+**		its own counters are reported alongside.
+*/
+
+static void
+report_memory(void)
+{
+	static int64_t lastlive[EP_MEM_MAXTAGS];
+	static uint64_t lastnalloc[EP_MEM_MAXTAGS];
+	static int64_t lastsqlite;
+	EP_MEM_TAG_STATS st;
+	char live[40];
+	char max[40];
+	int tag;
+
+	if (!_EpMemAccount)
+		return;
+	for (tag = 0; ep_mem_tag_stats(tag, &st); tag++)
+	{
+		char nalloc[40];
+		char nfree[40];
+
+		if (st.live_bytes == lastlive[tag] && st.nalloc == lastnalloc[tag])
+			continue;
+		lastlive[tag] = st.live_bytes;
+		lastnalloc[tag] = st.nalloc;
+		snprintf(live, sizeof live, "%" PRId64, st.live_bytes);
+		snprintf(max, sizeof max, "%" PRId64, st.max_bytes);
+		snprintf(nalloc, sizeof nalloc, "%" PRIu64, st.nalloc);
+		snprintf(nfree, sizeof nfree, "%" PRIu64, st.nfree);
+		admin_post_stats(ADMIN_LOG_MEMORY, "mem-usage",
+				"tag", st.name,
+				"live-bytes", live,
+				"max-bytes", max,
+				"allocs", nalloc,
+				"frees", nfree,
+				NULL, NULL);
+	}
+
+	if (sqlite3_memory_used() != lastsqlite)
+	{
+		lastsqlite = sqlite3_memory_used();
+		snprintf(live, sizeof live, "%" PRId64, (int64_t) lastsqlite);
+		snprintf(max, sizeof max, "%" PRId64,
+				(int64_t) sqlite3_memory_highwater(0));
+		admin_post_stats(ADMIN_LOG_MEMORY, "mem-usage",
+				"tag", "sqlite",
+				"live-bytes", live,
+				"max-bytes", max,
+				NULL, NULL);
+	}
+}
+
+
 /*
 **  LOGD_RECLAIM_RESOURCES --- called periodically to prune old resources
 */
@@ -88,6 +296,11 @@ logd_reclaim_resources(void *null)
 {
 	_gdp_reclaim_resources(NULL);
 	sub_reclaim_resources(_GdpChannel);
+	logd_admit_report();
+	report_lanes();
+	report_shards();
+	report_latency();
+	report_memory();
 }
 
 
@@ -109,7 +322,39 @@ renew_advertisements(int fd, short what, void *_chan)
 {
 	gdp_chan_t *chan = (gdp_chan_t *) _chan;
 	ep_sd_notifyf("WATCHDOG=1\n");
-	(void) logd_advertise_all(chan, GDP_CMD_ADVERTISE, NULL);
+	logd_advertise_renew(chan);
+}
+
+
+/*
+**  SIGHUP --- re-read runtime parameters (runs in the I/O thread)
+**
+**		Only things that look at their parameters again pick up
+**		the changes; at the moment that is admission control.
+*/
+
+static void
+reload_params(int sig, short what, void *unused)
+{
+	ep_log(EP_STAT_OK, "Reloading parameters on signal %d", sig);
+	_gdp_adm_readparams("gdp");
+	_gdp_adm_readparams("gdplogd");
+	logd_admit_reload();
+}
+
+
+/*
+**  SIGUSR2 --- move cold logs between shards (runs in the I/O thread)
+**
+**		Also run from a timer if swarm.gdplogd.shard.rebalance.interval
+**		is set.  The work itself is done in a worker thread.
+*/
+
+static void
+rebalance_shards(int fd, short what, void *unused)
+{
+	ep_dbg_cprintf(Dbg, 8, "rebalance_shards\n");
+	ep_thr_pool_run(&shard_rebalance, NULL);
 }
 
 
@@ -130,7 +375,7 @@ shutdown_req(gdp_req_t *req)
 	EP_ASSERT_ELSE(req->cpdu != NULL, return);
 	EP_ASSERT_ELSE(req->cpdu->msg != NULL, return);
 
-	if (EP_UT_BITSET(GDP_REQ_SRV_SUBSCR, req->flags))
+	if ((req->flags & (GDP_REQ_SRV_SUBSCR | GDP_REQ_SRV_CATCHUP)) != 0)
 	{
 		gdp_msg_t *msg = _gdp_msg_new(GDP_NAK_S_LOST_SUBSCR,
 									req->cpdu->msg->rid,
@@ -347,6 +592,29 @@ main(int argc, char **argv)
 	phase = "gdplogd protocol module";
 	estat = gdpd_proto_init();
 	EP_STAT_CHECK(estat, goto fail0);
+	sub_init();
+
+	// admission control must be set up before commands arrive
+	logd_admit_reload();
+	event_add(evsignal_new(_GdpIoEventBase, SIGHUP, &reload_params, NULL),
+			NULL);
+
+	// log shards can be rebalanced on request or periodically
+	if (shard_count() > 1)
+	{
+		long rebal_intvl = ep_adm_getlongparam(
+								"swarm.gdplogd.shard.rebalance.interval", 0);
+
+		event_add(evsignal_new(_GdpIoEventBase, SIGUSR2,
+								&rebalance_shards, NULL), NULL);
+		if (rebal_intvl > 0)
+		{
+			struct event *rebaltimer = event_new(_GdpIoEventBase, -1,
+											EV_PERSIST, &rebalance_shards, NULL);
+			struct timeval tv = { rebal_intvl, 0 };
+			event_add(rebaltimer, &tv);
+		}
+	}
 
 	progname = ep_app_getprogname();
 
@@ -427,6 +695,12 @@ main(int argc, char **argv)
 	_gdp_reclaim_resources_init(&logd_reclaim_resources_callback);
 
 	// open the channel connection
+	// start following logs on another server (if configured);
+	// before connecting so catching-up logs are never advertised
+	phase = "replica initialization";
+	estat = replica_init();
+	EP_STAT_CHECK(estat, goto fail0);
+
 	phase = "connection to router";
 
 	{
@@ -92,6 +92,19 @@ struct gdp_gob_xtra
 	// physical implementation declarations
 	struct gob_phys_impl	*physimpl;		// physical implementation
 	gob_physinfo_t			*physinfo;		// info needed by physical module
+
+	// group subscriptions that include this GOB (see logd_pubsub.c)
+	LIST_HEAD(, sub_member)	groupsubs;
+
+	// subscription catch-up scan (see logd_pubsub.c)
+	bool					catchup_sched:1;	// scan is scheduled
+	uint32_t				catchup_pass;		// scans run so far
+
+	// Merkle tree state (see logd_merkle.c)
+	bool					merkle_valid:1;		// merkle_nleaves is current
+	bool					merkle_keytried:1;	// looked for signing key
+	uint64_t				merkle_nleaves;		// leaves folded into tree
+	EP_CRYPTO_MD			*merkle_sign;		// checkpoint signing context
 };
 
 
@@ -124,6 +137,10 @@ extern void		gob_showusage(			// show GOB LRU list
 extern EP_STAT	get_open_handle(		// get open handle (pref from cache)
 					gdp_req_t *req);
 
+extern EP_STAT	get_open_gob(			// get open handle by name
+					gdp_name_t gob_name,
+					gdp_gob_t **pgob);
+
 extern void		gob_reclaim_resources(	// reclaim old GOBs
 					void *null);			// parameter unused
 
@@ -138,6 +155,15 @@ extern EP_STAT	dispatch_cmd(			// dispatch a request
 					gdp_req_t *req);
 
 
+/*
+**  Admission control (logd_admit.c)
+*/
+
+extern void		logd_admit_reload(void);	// (re)read limits
+
+extern void		logd_admit_report(void);	// report throttling
+
+
 /*
 **  Advertisements
 */
@@ -152,9 +178,105 @@ extern void		logd_advertise_one(
 						gdp_name_t name,
 						int cmd);
 
+extern void		logd_advertise_renew(
+						gdp_chan_t *chan);
+
 extern EP_STAT	sub_send_message_notification(
 						gdp_req_t *req);
 
+
+/*
+**  Merkle checkpoints (logd_merkle.c)
+*/
+
+struct merkle_ckpt
+{
+	uint64_t		treesize;				// number of records covered
+	uint8_t			root[GDP_MERKLE_HASHLEN];	// root hash
+	EP_TIME_SPEC	ts;						// when it was made
+	size_t			siglen;					// zero if unsigned
+	uint8_t			sig[EP_CRYPTO_MAX_SIG];	// signature
+};
+
+extern EP_STAT	merkle_append(			// fold new records into tree
+						gdp_gob_t *gob,
+						gdp_recno_t recno);		// last record appended
+
+extern void		merkle_invalidate(		// forget cached tree size
+						gdp_gob_t *gob);
+
+extern EP_STAT	merkle_get_proof(		// get proof for one record
+						gdp_gob_t *gob,
+						gdp_recno_t recno,
+						uint64_t treesize,		// zero => first covering
+						struct merkle_ckpt *ckpt,
+						uint8_t (*path)[GDP_MERKLE_HASHLEN],
+						int *npathp);
+
+#define MERKLE_MAXPATH		64			// maximum audit path length
+
+
+/*
+**  Following logs on another server (logd_replica.c)
+*/
+
+extern EP_STAT	replica_init(void);		// start following logs
+
+extern bool		replica_is_follower(	// is this a replicated log?
+						const gdp_name_t name);
+
+extern bool		replica_is_pending(		// replica not yet caught up?
+						const gdp_name_t name);
+
+
+/*
+**  Log directory shards (logd_shard.c)
+*/
+
+struct shard_stats
+{
+	const char		*root;					// shard directory
+	EP_THR_POOL		*pool;					// its workers (if any)
+	long			nlogs;					// logs known to be there
+	long			nmoved_in;				// moved here since last call
+	long			nmoved_out;				// moved away since last call
+	int				used_pct;				// disk in use, -1 if unknown
+};
+
+extern EP_STAT	shard_init(				// find log roots
+						const char *logroot,	// single root, may be NULL
+						const char *default_dir,
+						const char *sfx);		// every log has this file
+
+extern int		shard_count(void);		// number of shards
+
+extern const char
+				*shard_root(			// directory for a shard
+						int shard);
+
+extern int		shard_pin(				// find log, keep it from moving
+						const gdp_name_t name,
+						bool create);
+
+extern void		shard_unpin(			// let a log move again
+						const gdp_name_t name,
+						bool forget);			// it no longer exists
+
+extern bool		shard_note(				// record log found in scan
+						const gdp_name_t name,
+						int shard);
+
+extern EP_THR_POOL
+				*shard_pool_for(		// worker pool for a log
+						const gdp_name_t name);
+
+extern void		shard_getstats(			// statistics for reporting
+						int shard,
+						struct shard_stats *st);
+
+extern void		shard_rebalance(		// move cold logs between shards
+						void *unused);
+
 /*
 **  Physical Implementation --- these are the routines that implement the
 **			on-disk (or in-memory) structure.
@@ -229,6 +351,32 @@ struct gob_phys_impl
 						gdp_gob_t *gob);
 	EP_STAT		(*xact_abort)(
 						gdp_gob_t *gob);
+	EP_STAT		(*get_rechash)(
+						gdp_gob_t *gob,
+						gdp_recno_t recno,
+						uint8_t *hash,
+						size_t *hashlen);
+	EP_STAT		(*merkle_nleaves)(
+						gdp_gob_t *gob,
+						uint64_t *nleavesp);
+	EP_STAT		(*merkle_get)(
+						gdp_gob_t *gob,
+						int level,
+						uint64_t idx,
+						uint8_t *hash);
+	EP_STAT		(*merkle_put)(
+						gdp_gob_t *gob,
+						int level,
+						uint64_t idx,
+						const uint8_t *hash);
+	EP_STAT		(*ckpt_get)(
+						gdp_gob_t *gob,
+						uint64_t treesize,
+						bool exact,
+						struct merkle_ckpt *ckpt);
+	EP_STAT		(*ckpt_put)(
+						gdp_gob_t *gob,
+						const struct merkle_ckpt *ckpt);
 };
 
 // known implementations
@@ -217,15 +217,21 @@ admin_post_statsv(
 	if (forbidchars == NULL)
 		forbidchars = ep_adm_getstrparam("gdplogd.admin.forbidchars", "=;");
 
-	// check to see if we need to re-open the output
+	// check to see if we need to re-open the output (at most once a second;
+	// counters that change on every operation belong in metrics instead)
 	if (AdminStatsFileName != NULL)
 	{
+		static time_t lastcheck = 0;
+		time_t now = time(NULL);
 		struct stat st;
 
-		if (stat(AdminStatsFileName, &st) != 0 || st.st_ino != AdminStatsIno)
+		if (now != lastcheck &&
+				(stat(AdminStatsFileName, &st) != 0 ||
+				 st.st_ino != AdminStatsIno))
 		{
 			reopen(AdminStatsFileName, &AdminStatsFp, &AdminStatsIno);
 		}
+		lastcheck = now;
 	}
 	fp = AdminStatsFp;
 
@@ -314,6 +320,14 @@ post_one_log(gdp_name_t gdpname, void *ctx)
 	}
 	if (gob != NULL)
 	{
+		char qdepthbuf[20];
+		char qmaxbuf[20];
+		int qmax;
+
+		// commands waiting for this log (see _gdp_pdu_process)
+		snprintf(qdepthbuf, sizeof qdepthbuf, "%d",
+				_gdp_gob_queue_depth(gdpname, &qmax));
+		snprintf(qmaxbuf, sizeof qmaxbuf, "%d", qmax);
 		if (gob->x->physimpl->getstats != NULL)
 		{
 			char nrecsbuf[40];
@@ -328,6 +342,8 @@ post_one_log(gdp_name_t gdpname, void *ctx)
 					"in-cache", "true",
 					"nrecs", nrecsbuf,
 					"size", logsizebuf,
+					"queue-depth", qdepthbuf,
+					"queue-max", qmaxbuf,
 					NULL, NULL);
 		}
 		else
@@ -335,6 +351,8 @@ post_one_log(gdp_name_t gdpname, void *ctx)
 			admin_post_stats(ADMIN_LOG_SNAPSHOT, "log-snapshot",
 					"name", gdppname,
 					"in-cache", "true",
+					"queue-depth", qdepthbuf,
+					"queue-max", qmaxbuf,
 					NULL, NULL);
 		}
 
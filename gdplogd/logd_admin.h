@@ -56,5 +56,13 @@ extern void		admin_post_statsv(
 #define ADMIN_LOG_READ		0x00000004	// read operations
 #define ADMIN_LOG_WRITE		0x00000008	// write/append operations
 #define ADMIN_LOG_SNAPSHOT	0x00000010	// periodic log summary (size, etc.)
+#define ADMIN_LOG_REPLICA	0x00000020	// replication progress and lag
+#define ADMIN_LOG_SUBSCR	0x00000040	// subscriber queue lag and drops
+#define ADMIN_LOG_ADVERT	0x00000080	// advertisement refreshes
+#define ADMIN_LOG_ADMIT		0x00000100	// admission control throttling
+#define ADMIN_LOG_LANES		0x00000200	// thread pool lane depth and waits
+#define ADMIN_LOG_SHARD		0x00000400	// log directory shard usage and moves
+#define ADMIN_LOG_LATENCY	0x00000800	// per-command latency percentiles
+#define ADMIN_LOG_MEMORY	0x00001000	// memory use by subsystem
 
 #endif // _GDPD_ADMIN_H_
@@ -0,0 +1,460 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Admission Control
+**
+**	----- BEGIN LICENSE BLOCK -----
+**	GDPLOGD: Log Daemon for the Global Data Plane
+**	From the Ubiquitous Swarm Lab, 490 Cory Hall, U.C. Berkeley.
+**
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**	----- END LICENSE BLOCK -----
+*/
+
+/*
+**  Commands are checked against token buckets as they come off the
+**  channel, in the I/O thread, before they are queued for a worker.
+**  There is one bucket per client (the source of the PDU) and one
+**  per log (the destination), each limiting both requests per second
+**  and bytes per second.  A command is admitted only if every bucket
+**  it touches has room; otherwise the client gets a NAK_C_TOOMANY
+**  saying how long until it would have been admitted.
+**
+**  Limits come from runtime parameters:
+**
+**		swarm.gdplogd.admit.{client,log}.reqrate
+**		swarm.gdplogd.admit.{client,log}.byterate
+**
+**  which can be overridden for a single client or log by putting its
+**  printable name after "client" or "log", e.g.,
+**  swarm.gdplogd.admit.client.<name>.reqrate.  Limits are re-read
+**  when parameters are reloaded (see logd_admit_reload); buckets pick
+**  up the new values the next time they are used.
+**
+**  Buckets are kept in two hash tables under one mutex that is only
+**  ever held for a lookup and a little arithmetic.  Buckets that
+**  have been idle for swarm.gdplogd.admit.idle msec (plus the burst
+**  time) are freed when resources are reclaimed, and clients and logs
+**  that were throttled are reported then too.
+*/
+
+#include "logd.h"
+#include "logd_admin.h"
+
+#include <ep/ep_hash.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("gdplogd.admit", "GDP admission control");
+
+
+#define ADMIT_CLIENT	0			// bucket kinds
+#define ADMIT_LOG		1
+
+static const char	*KindNames[] = { "client", "log" };
+
+struct admit_limits
+{
+	long			reqrate;		// requests/second (0 => unlimited)
+	long			byterate;		// bytes/second (0 => unlimited)
+};
+
+struct admit_bucket
+{
+	gdp_name_t		name;			// client or log name
+	int				kind;			// ADMIT_CLIENT or ADMIT_LOG
+	uint32_t		gen;			// generation of limits
+	struct admit_limits	lim;		// limits for this bucket
+	double			reqs;			// request tokens available
+	double			bytes;			// byte tokens available
+	int64_t			last_ns;		// time of last refill
+	uint64_t		nadmitted;		// commands admitted
+	uint64_t		nthrottled;		// commands refused
+	uint64_t		nreported;		// nthrottled at last report
+};
+
+static EP_THR_MUTEX	AdmitMutex		EP_THR_MUTEX_INITIALIZER2(
+										GDP_MUTEX_LORDER_LEAF);
+static EP_HASH		*Buckets[2];	// indexed by kind
+static uint32_t		AdmitGen;		// bumped when limits are reloaded
+static struct admit_limits	DefLimits[2];
+static long			BurstMsec;		// bucket capacity in msec of rate
+static long			IdleMsec;		// forget buckets idle this long
+
+
+static int64_t
+now_nsec(void)
+{
+	EP_TIME_SPEC now;
+
+	ep_time_now(&now);
+	return now.tv_sec * INT64_C(1000000000) + now.tv_nsec;
+}
+
+
+/*
+**  BUCKET_LIMITS --- (re)compute the limits for a bucket
+*/
+
+static void
+bucket_limits(struct admit_bucket *b)
+{
+	gdp_pname_t pname;
+	char argname[100];
+	const char *kind = KindNames[b->kind];
+
+	gdp_printable_name(b->name, pname);
+	snprintf(argname, sizeof argname, "swarm.gdplogd.admit.%s.%s.reqrate",
+			kind, pname);
+	b->lim.reqrate = ep_adm_getlongparam(argname, DefLimits[b->kind].reqrate);
+	snprintf(argname, sizeof argname, "swarm.gdplogd.admit.%s.%s.byterate",
+			kind, pname);
+	b->lim.byterate = ep_adm_getlongparam(argname,
+							DefLimits[b->kind].byterate);
+	b->gen = AdmitGen;
+}
+
+
+/*
+**  BUCKET_GET --- find (or create) a bucket and top it up
+**
+**		Called with AdmitMutex held.
+*/
+
+static struct admit_bucket *
+bucket_get(int kind, const gdp_name_t name, int64_t now_ns)
+{
+	struct admit_bucket *b;
+	double secs;
+
+	b = (struct admit_bucket *) ep_hash_search(Buckets[kind],
+							sizeof (gdp_name_t), name);
+	if (b == NULL)
+	{
+		b = (struct admit_bucket *) ep_mem_zalloc(sizeof *b);
+		memcpy(b->name, name, sizeof b->name);
+		b->kind = kind;
+		bucket_limits(b);
+		b->reqs = (double) b->lim.reqrate * BurstMsec / 1000;
+		b->bytes = (double) b->lim.byterate * BurstMsec / 1000;
+		b->last_ns = now_ns;
+		(void) ep_hash_insert(Buckets[kind], sizeof (gdp_name_t), name, b);
+		return b;
+	}
+
+	if (b->gen != AdmitGen)
+		bucket_limits(b);
+
+	// refill for the time since we last looked, up to the burst size
+	secs = (double) (now_ns - b->last_ns) / 1.0e9;
+	b->last_ns = now_ns;
+	if (b->lim.reqrate > 0)
+	{
+		double max = (double) b->lim.reqrate * BurstMsec / 1000;
+
+		b->reqs += b->lim.reqrate * secs;
+		if (b->reqs > max)
+			b->reqs = max;
+	}
+	if (b->lim.byterate > 0)
+	{
+		double max = (double) b->lim.byterate * BurstMsec / 1000;
+
+		b->bytes += b->lim.byterate * secs;
+		if (b->bytes > max)
+			b->bytes = max;
+	}
+	return b;
+}
+
+
+/*
+**  BUCKET_WAIT --- how long (in seconds) until this command would fit
+**
+**		A command bigger than the whole bucket is let in when the
+**		bucket is full; the bucket then goes negative and later
+**		commands wait for it to fill back up.
+*/
+
+static double
+bucket_wait(struct admit_bucket *b, size_t len)
+{
+	double wait = 0.0;
+
+	if (b == NULL)
+		return 0.0;
+	if (b->lim.reqrate > 0 && b->reqs < 1.0)
+		wait = (1.0 - b->reqs) / b->lim.reqrate;
+	if (b->lim.byterate > 0)
+	{
+		double need = (double) b->lim.byterate * BurstMsec / 1000;
+
+		if (need > len)
+			need = len;
+		if (b->bytes < need && (need - b->bytes) / b->lim.byterate > wait)
+			wait = (need - b->bytes) / b->lim.byterate;
+	}
+	return wait;
+}
+
+
+static void
+bucket_debit(struct admit_bucket *b, size_t len)
+{
+	if (b == NULL)
+		return;
+	if (b->lim.reqrate > 0)
+		b->reqs -= 1.0;
+	if (b->lim.byterate > 0)
+		b->bytes -= len;
+	b->nadmitted++;
+}
+
+
+/*
+**  LOGD_ADMIT --- admission control function (called from I/O thread)
+*/
+
+static EP_STAT
+logd_admit(gdp_pdu_t *pdu, size_t len, uint32_t *retry_ms)
+{
+	struct admit_bucket *cb;
+	struct admit_bucket *lb = NULL;
+	double cwait, lwait;
+	int64_t now_ns = now_nsec();
+
+	ep_thr_mutex_lock(&AdmitMutex);
+	cb = bucket_get(ADMIT_CLIENT, pdu->src, now_ns);
+	if (!GDP_NAME_SAME(pdu->dst, _GdpMyRoutingName))
+		lb = bucket_get(ADMIT_LOG, pdu->dst, now_ns);
+	cwait = bucket_wait(cb, len);
+	lwait = bucket_wait(lb, len);
+
+	if (cwait <= 0.0 && lwait <= 0.0)
+	{
+		bucket_debit(cb, len);
+		bucket_debit(lb, len);
+		ep_thr_mutex_unlock(&AdmitMutex);
+		return EP_STAT_OK;
+	}
+
+	// charge the refusal to whichever was over its limit
+	if (cwait > 0.0)
+		cb->nthrottled++;
+	if (lwait > 0.0)
+		lb->nthrottled++;
+	ep_thr_mutex_unlock(&AdmitMutex);
+
+	if (lwait > cwait)
+		cwait = lwait;
+	*retry_ms = (uint32_t) (cwait * 1000.0) + 1;
+	return GDP_STAT_NAK_TOOMANY;
+}
+
+
+/*
+**  LOGD_ADMIT_RELOAD --- (re)read limits from runtime parameters
+**
+**		Admission control is only hooked in if it is enabled, so
+**		it costs nothing otherwise.
+*/
+
+void
+logd_admit_reload(void)
+{
+	bool enable;
+	int kind;
+
+	enable = ep_adm_getboolparam("swarm.gdplogd.admit.enable", false);
+
+	ep_thr_mutex_lock(&AdmitMutex);
+	for (kind = ADMIT_CLIENT; kind <= ADMIT_LOG; kind++)
+	{
+		char argname[100];
+
+		if (Buckets[kind] == NULL)
+			Buckets[kind] = ep_hash_new("admission buckets", NULL, 0);
+		snprintf(argname, sizeof argname, "swarm.gdplogd.admit.%s.reqrate",
+				KindNames[kind]);
+		DefLimits[kind].reqrate = ep_adm_getlongparam(argname, 0);
+		snprintf(argname, sizeof argname, "swarm.gdplogd.admit.%s.byterate",
+				KindNames[kind]);
+		DefLimits[kind].byterate = ep_adm_getlongparam(argname, 0);
+	}
+	BurstMsec = ep_adm_getlongparam("swarm.gdplogd.admit.burst", 2000);
+	if (BurstMsec < 1)
+		BurstMsec = 1;
+	IdleMsec = ep_adm_getlongparam("swarm.gdplogd.admit.idle", 60000);
+	if (IdleMsec < 0)
+		IdleMsec = 0;
+	AdmitGen++;
+	ep_thr_mutex_unlock(&AdmitMutex);
+
+	_GdpAdmitFunc = enable ? &logd_admit : NULL;
+	ep_dbg_cprintf(Dbg, 1,
+			"logd_admit_reload: %s, client %ld req/s %ld B/s, "
+			"log %ld req/s %ld B/s, burst %ld ms\n",
+			enable ? "enabled" : "disabled",
+			DefLimits[ADMIT_CLIENT].reqrate, DefLimits[ADMIT_CLIENT].byterate,
+			DefLimits[ADMIT_LOG].reqrate, DefLimits[ADMIT_LOG].byterate,
+			BurstMsec);
+}
+
+
+/*
+**  LOGD_ADMIT_REPORT --- report throttling and free idle buckets
+**
+**		Clients and logs that have been throttled since the last
+**		report are posted as admin-throttle events.  Buckets that
+**		have been idle long enough to have filled up again are
+**		forgotten; they will start out full if they come back.
+**
+**		ep_hash_delete leaves the (now NULL) node in the table, so
+**		a table that has lost buckets is copied into a new one and
+**		the old one is freed.  Otherwise clients that come and go
+**		would grow the table without bound.
+*/
+
+struct admit_report
+{
+	int					kind;
+	gdp_pname_t			name;
+	uint64_t			nadmitted;
+	uint64_t			nthrottled;
+};
+
+struct admit_sweep
+{
+	int64_t				now_ns;
+	int64_t				idle_ns;
+	struct admit_report	*rpt;
+	int					nrpt;
+	int					maxrpt;
+	gdp_name_t			*idle;
+	int					nidle;
+	int					maxidle;
+};
+
+static void
+sweep_bucket(size_t keylen, const void *key, const void *val, va_list av)
+{
+	struct admit_bucket *b = (struct admit_bucket *) val;
+	struct admit_sweep *sw = va_arg(av, struct admit_sweep *);
+
+	if (b == NULL)
+		return;
+	if (b->nthrottled != b->nreported)
+	{
+		struct admit_report *r;
+
+		if (sw->nrpt >= sw->maxrpt)
+		{
+			sw->maxrpt = sw->maxrpt == 0 ? 16 : sw->maxrpt * 2;
+			sw->rpt = (struct admit_report *) ep_mem_realloc(sw->rpt,
+									sw->maxrpt * sizeof *sw->rpt);
+		}
+		r = &sw->rpt[sw->nrpt++];
+		r->kind = b->kind;
+		gdp_printable_name(b->name, r->name);
+		r->nadmitted = b->nadmitted;
+		r->nthrottled = b->nthrottled;
+		b->nreported = b->nthrottled;
+	}
+	else if (sw->now_ns - b->last_ns > sw->idle_ns)
+	{
+		if (sw->nidle >= sw->maxidle)
+		{
+			sw->maxidle = sw->maxidle == 0 ? 32 : sw->maxidle * 2;
+			sw->idle = (gdp_name_t *) ep_mem_realloc(sw->idle,
+									sw->maxidle * sizeof *sw->idle);
+		}
+		memcpy(sw->idle[sw->nidle++], b->name, sizeof (gdp_name_t));
+	}
+}
+
+static void
+keep_bucket(size_t keylen, const void *key, const void *val, va_list av)
+{
+	EP_HASH *newtab = va_arg(av, EP_HASH *);
+
+	if (val != NULL)
+		(void) ep_hash_insert(newtab, keylen, key, val);
+}
+
+void
+logd_admit_report(void)
+{
+	struct admit_sweep sw;
+	int kind;
+	int i;
+
+	memset(&sw, 0, sizeof sw);
+	sw.now_ns = now_nsec();
+	sw.idle_ns = (int64_t) (BurstMsec + IdleMsec) * 1000000;
+
+	ep_thr_mutex_lock(&AdmitMutex);
+	for (kind = ADMIT_CLIENT; kind <= ADMIT_LOG; kind++)
+	{
+		EP_HASH *newtab;
+
+		if (Buckets[kind] == NULL)
+			continue;
+		sw.nidle = 0;
+		ep_hash_forall(Buckets[kind], sweep_bucket, &sw);
+		if (sw.nidle == 0)
+			continue;
+		for (i = 0; i < sw.nidle; i++)
+		{
+			struct admit_bucket *b = (struct admit_bucket *)
+						ep_hash_delete(Buckets[kind],
+								sizeof (gdp_name_t), sw.idle[i]);
+			if (b != NULL)
+				ep_mem_free(b);
+		}
+
+		// drop the deleted nodes by rebuilding the table
+		newtab = ep_hash_new("admission buckets", NULL, 0);
+		ep_hash_forall(Buckets[kind], keep_bucket, newtab);
+		ep_hash_free(Buckets[kind]);
+		Buckets[kind] = newtab;
+	}
+	ep_thr_mutex_unlock(&AdmitMutex);
+
+	for (i = 0; i < sw.nrpt; i++)
+	{
+		struct admit_report *r = &sw.rpt[i];
+		char abuf[40];
+		char tbuf[40];
+
+		snprintf(abuf, sizeof abuf, "%" PRIu64, r->nadmitted);
+		snprintf(tbuf, sizeof tbuf, "%" PRIu64, r->nthrottled);
+		ep_dbg_cprintf(Dbg, 10, "%s %s: admitted %s, throttled %s\n",
+				KindNames[r->kind], r->name, abuf, tbuf);
+		admin_post_stats(ADMIN_LOG_ADMIT, "admit-throttle",
+				KindNames[r->kind], r->name,
+				"admitted", abuf,
+				"throttled", tbuf,
+				NULL, NULL);
+	}
+	if (sw.rpt != NULL)
+		ep_mem_free(sw.rpt);
+	if (sw.idle != NULL)
+		ep_mem_free(sw.idle);
+}
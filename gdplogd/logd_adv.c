@@ -32,6 +32,7 @@
 
 
 #include "logd.h"
+#include "logd_admin.h"
 
 #include <gdp/gdp.h>
 #include <gdp/gdp_chan.h>
@@ -89,82 +90,316 @@ logd_advertise_one(gdp_chan_t *chan, gdp_name_t gname, int cmd)
 
 /*
 **  Advertise all known GCLs
+**
+**		A full refresh takes a snapshot of the names of all local
+**		logs and sends them in batches (see _gdp_chan_advertise_batch)
+**		from a timer, so a server with many logs neither floods the
+**		router nor stalls the I/O thread.  Periodic refreshes are
+**		spread over most of swarm.gdplogd.advertise.interval; on
+**		(re)connection the router knows nothing about us, so the
+**		refresh goes as fast as swarm.gdplogd.advertise.rate allows
+**		and the time until everything has been advertised is logged.
+**
+**		Logs created, deleted, or caught up in between are sent as
+**		they happen by logd_advertise_one, so only those changes
+**		go out between refreshes.
+**
+**		Withdrawals at shutdown are batched but not paced.
 */
 
-static EP_STAT
-advertise_one(gdp_name_t gname, void *ax_)
+#define ADV_STEP_USEC		(100 * 1000)	// time between refresh steps
+#define ADV_SPREAD_PCT		75				// % of interval to spread over
+
+static struct adv_refresh
 {
-	gdp_advert_x_t *ax = (gdp_advert_x_t *) ax_;
-	EP_STAT estat;
+	EP_TIMER		timer;			// fires each step
+	gdp_chan_t		*chan;			// channel to advertise on
+	gdp_name_t		*names;			// snapshot of names (NULL if idle)
+	int				nnames;			// number of names in snapshot
+	int				maxnames;		// allocated size of names
+	int				next;			// next name to send
+	int				quota;			// names per step
+	bool			reconnect;		// refresh is for a new connection
+	EP_TIME_SPEC	start;			// when refresh started
+	long			npdus;			// PDUs sent so far
+	size_t			octets;			// octets sent so far
+}		Refresh;
+
+static EP_THR_MUTEX	RefreshMutex	EP_THR_MUTEX_INITIALIZER;
 
-	estat = _gdp_chan_advertise(ax->chan, gname, ax->adcert,
-							ax->challenge_cb, ax);
+static void	refresh_step(EP_TIMER *, void *);
 
-	if (ep_dbg_test(Dbg, 54))
+
+static EP_STAT
+snapshot_one(gdp_name_t gname, void *ctx_unused)
+{
+	// replicas are advertised once they have caught up
+	if (replica_is_pending(gname))
+		return EP_STAT_OK;
+
+	if (Refresh.nnames >= Refresh.maxnames)
 	{
-		gdp_pname_t pname;
-		char ebuf[100];
+		Refresh.maxnames = Refresh.maxnames == 0 ? 1024 : Refresh.maxnames * 2;
+		Refresh.names = (gdp_name_t *) ep_mem_realloc(Refresh.names,
+								Refresh.maxnames * sizeof *Refresh.names);
+	}
+	memcpy(Refresh.names[Refresh.nnames++], gname, sizeof (gdp_name_t));
+	return EP_STAT_OK;
+}
 
-		ep_dbg_printf("\tAdvertise %s => %s\n",
-				gdp_printable_name(gname, pname),
+
+/*
+**  REFRESH_DONE --- finish (or abandon) a refresh
+**
+**		Called with RefreshMutex held.
+*/
+
+static void
+refresh_done(EP_STAT estat)
+{
+	EP_TIME_SPEC now;
+	double secs;
+	size_t octets = Refresh.octets;
+	char ebuf[100];
+
+	ep_time_now(&now);
+	secs = (double) (now.tv_sec - Refresh.start.tv_sec) +
+			(double) (now.tv_nsec - Refresh.start.tv_nsec) / 1.0e9;
+	if (!EP_STAT_ISOK(estat))
+	{
+		ep_dbg_cprintf(Dbg, 1,
+				"refresh_done: abandoned after %d of %d names: %s\n",
+				Refresh.next, Refresh.nnames,
 				ep_stat_tostr(estat, ebuf, sizeof ebuf));
 	}
-	return estat;
+	else if (Refresh.reconnect)
+	{
+		ep_log(EP_STAT_OK,
+				"advertised %d logs in %ld PDUs (%zd octets), "
+				"%.3f seconds after connecting",
+				Refresh.nnames, Refresh.npdus, octets, secs);
+	}
+	else
+	{
+		ep_dbg_cprintf(Dbg, 11,
+				"refresh_done: %d names in %ld PDUs (%zd octets), %.3f s\n",
+				Refresh.nnames, Refresh.npdus, octets, secs);
+	}
+
+	if (EP_STAT_ISOK(estat))
+	{
+		char nbuf[20], pbuf[20], obuf[20], sbuf[20];
+
+		snprintf(nbuf, sizeof nbuf, "%d", Refresh.nnames);
+		snprintf(pbuf, sizeof pbuf, "%ld", Refresh.npdus);
+		snprintf(obuf, sizeof obuf, "%zd", octets);
+		snprintf(sbuf, sizeof sbuf, "%.3f", secs);
+		admin_post_stats(ADMIN_LOG_ADVERT, "advert-refresh",
+				"reason", Refresh.reconnect ? "connect" : "renew",
+				"logs", nbuf,
+				"pdus", pbuf,
+				"octets", obuf,
+				"seconds", sbuf,
+				NULL, NULL);
+	}
+
+	ep_mem_free(Refresh.names);
+	Refresh.names = NULL;
+	Refresh.nnames = Refresh.maxnames = 0;
+}
+
+
+/*
+**  REFRESH_STEP --- send the next batch of names (timer callback)
+*/
+
+static void
+refresh_step(EP_TIMER *t, void *unused)
+{
+	EP_STAT estat = EP_STAT_OK;
+	int n;
+
+	ep_thr_mutex_lock(&RefreshMutex);
+	if (Refresh.names == NULL)
+		goto done;
+
+	n = Refresh.nnames - Refresh.next;
+	if (n > Refresh.quota)
+		n = Refresh.quota;
+	if (n > 0)
+	{
+		estat = _gdp_chan_advertise_batch(Refresh.chan,
+							&Refresh.names[Refresh.next], n,
+							NULL, NULL, NULL, &Refresh.octets);
+		if (EP_STAT_ISOK(estat))
+		{
+			Refresh.npdus += EP_STAT_TO_INT(estat);
+			Refresh.next += n;
+		}
+	}
+
+	if (!EP_STAT_ISOK(estat) || Refresh.next >= Refresh.nnames)
+	{
+		// a failed refresh is restarted when the channel reconnects
+		refresh_done(estat);
+	}
+	else
+	{
+		ep_timer_set(_GdpTimers, &Refresh.timer, ADV_STEP_USEC,
+					refresh_step, NULL);
+	}
+done:
+	ep_thr_mutex_unlock(&RefreshMutex);
 }
 
+
+/*
+**  REFRESH_START --- start a full refresh of our advertisements
+**
+**		A reconnection restarts any refresh in progress; a periodic
+**		renewal that finds one still running leaves it alone.
+*/
+
 static EP_STAT
-withdraw_one(gdp_name_t gname, void *ax_)
+refresh_start(gdp_chan_t *chan, bool reconnect)
 {
-	gdp_advert_x_t *ax = (gdp_advert_x_t *) ax_;
 	EP_STAT estat;
+	long rate;
+	long quota;
+
+	// must not hold RefreshMutex: this waits for a running step
+	ep_timer_clr(_GdpTimers, &Refresh.timer);
+
+	ep_thr_mutex_lock(&RefreshMutex);
+	if (Refresh.names != NULL)
+	{
+		if (!reconnect)
+		{
+			ep_dbg_cprintf(Dbg, 3,
+					"refresh_start: previous refresh unfinished (%d of %d)\n",
+					Refresh.next, Refresh.nnames);
+			ep_timer_set(_GdpTimers, &Refresh.timer, ADV_STEP_USEC,
+						refresh_step, NULL);
+			ep_thr_mutex_unlock(&RefreshMutex);
+			return EP_STAT_OK;
+		}
+		ep_mem_free(Refresh.names);
+		Refresh.names = NULL;
+		Refresh.nnames = Refresh.maxnames = 0;
+	}
 
-	if (!EP_ASSERT(ax != NULL))
-		return EP_STAT_ASSERT_ABORT;
+	Refresh.chan = chan;
+	Refresh.reconnect = reconnect;
+	Refresh.next = 0;
+	Refresh.npdus = 0;
+	Refresh.octets = 0;
+	ep_time_now(&Refresh.start);
 
-	estat = _gdp_chan_withdraw(ax->chan, gname, ax);
+	// advertise me right away ...
+	estat = _gdp_chan_advertise(chan, _GdpMyRoutingName, NULL, NULL, NULL);
+	EP_STAT_CHECK(estat, goto done);
 
-	if (ep_dbg_test(Dbg, 54))
+	// ... and take a snapshot of all of my logs to send from the timer
+	estat = GdpSqliteImpl.foreach(snapshot_one, NULL);
+	if (Refresh.nnames == 0)
 	{
-		gdp_pname_t pname;
-		char ebuf[100];
+		ep_mem_free(Refresh.names);
+		Refresh.names = NULL;
+		Refresh.maxnames = 0;
+		goto done;
+	}
 
-		ep_dbg_printf("\tWithdraw %s => %s\n",
-				gdp_printable_name(gname, pname),
-				ep_stat_tostr(estat, ebuf, sizeof ebuf));
+	// figure out how many names to send per step
+	rate = ep_adm_getlongparam("swarm.gdplogd.advertise.rate", 50000);
+	if (rate > 0)
+		quota = (rate * ADV_STEP_USEC + 999999) / 1000000;
+	else
+		quota = Refresh.nnames;
+	if (!reconnect)
+	{
+		long intvl = ep_adm_getlongparam(
+							"swarm.gdplogd.advertise.interval", 150);
+		long nsteps = intvl * 10000L * ADV_SPREAD_PCT / ADV_STEP_USEC;
+
+		if (nsteps > 1 && (Refresh.nnames + nsteps - 1) / nsteps < quota)
+			quota = (Refresh.nnames + nsteps - 1) / nsteps;
 	}
+	Refresh.quota = quota < 1 ? 1 : quota > Refresh.nnames ?
+						Refresh.nnames : quota;
+	ep_dbg_cprintf(Dbg, 11,
+			"refresh_start: %d names, %d per step%s\n",
+			Refresh.nnames, Refresh.quota, reconnect ? " (connect)" : "");
+
+	// first step goes right away
+	ep_timer_set(_GdpTimers, &Refresh.timer, 0, refresh_step, NULL);
+
+done:
+	ep_thr_mutex_unlock(&RefreshMutex);
 	return estat;
 }
 
 
-EP_STAT
-logd_advertise_all(gdp_chan_t *chan, int cmd, void *adata_unused)
+/*
+**  LOGD_ADVERTISE_RENEW --- periodic refresh of all advertisements
+*/
+
+void
+logd_advertise_renew(gdp_chan_t *chan)
+{
+	(void) refresh_start(chan, false);
+}
+
+
+static EP_STAT
+withdraw_snapshot(gdp_chan_t *chan)
 {
 	EP_STAT estat;
-	gdp_adcert_t *adcert = NULL;					//XXX XXX
-	gdp_chan_advert_cr_t *challenge_cb = NULL;		//XXX XXX
-	gdp_advert_x_t advert;
 
-	memset(&advert, 0, sizeof advert);
-	advert.chan = chan;
+	ep_timer_clr(_GdpTimers, &Refresh.timer);
+	ep_thr_mutex_lock(&RefreshMutex);
+	ep_mem_free(Refresh.names);
+	Refresh.names = NULL;
+	Refresh.nnames = Refresh.maxnames = 0;
 
-	if (cmd == GDP_CMD_ADVERTISE)
+	estat = GdpSqliteImpl.foreach(snapshot_one, NULL);
+	if (Refresh.nnames > 0)
 	{
-		// advertise me ...
-		estat = _gdp_chan_advertise(chan, _GdpMyRoutingName, adcert,
-									challenge_cb, &advert);
-
-		// ... and all of my logs
-		EP_STAT tstat = GdpSqliteImpl.foreach(advertise_one, &advert);
+		EP_STAT tstat = _gdp_chan_withdraw_batch(chan, Refresh.names,
+								Refresh.nnames, NULL, NULL);
 		if (EP_STAT_SEVERITY(tstat) > EP_STAT_SEVERITY(estat))
 			estat = tstat;
 	}
+	ep_mem_free(Refresh.names);
+	Refresh.names = NULL;
+	Refresh.nnames = Refresh.maxnames = 0;
+	ep_thr_mutex_unlock(&RefreshMutex);
+	return estat;
+}
+
+
+/*
+**  LOGD_ADVERTISE_ALL --- advertise or withdraw everything
+**
+**		This is the channel advertise callback, so it is called
+**		whenever the connection to the router is (re)established.
+*/
+
+EP_STAT
+logd_advertise_all(gdp_chan_t *chan, int cmd, void *adata_unused)
+{
+	EP_STAT estat;
+
+	if (cmd == GDP_CMD_ADVERTISE)
+	{
+		estat = refresh_start(chan, true);
+	}
 	else
 	{
 		// withdraw log advertisements ...
-		estat = GdpSqliteImpl.foreach(withdraw_one, &advert);
+		estat = withdraw_snapshot(chan);
 
 		// ... and finally myself
-		EP_STAT tstat = _gdp_chan_withdraw(chan, _GdpMyRoutingName, &advert);
+		EP_STAT tstat = _gdp_chan_withdraw(chan, _GdpMyRoutingName, NULL);
 		if (EP_STAT_SEVERITY(tstat) > EP_STAT_SEVERITY(estat))
 			estat = tstat;
 	}
@@ -45,6 +45,7 @@ gob_alloc(gdp_name_t gob_name, gdp_iomode_t iomode, gdp_gob_t **pgob)
 {
 	EP_STAT estat;
 	gdp_gob_t *gob;
+	int otag;
 	extern void gob_close(gdp_gob_t *gob);
 
 	// get the standard handle
@@ -52,7 +53,9 @@ gob_alloc(gdp_name_t gob_name, gdp_iomode_t iomode, gdp_gob_t **pgob)
 	EP_STAT_CHECK(estat, goto fail0);
 
 	// add the gdpd-specific information
+	otag = ep_mem_tag_set(_GdpMemTagGob);
 	gob->x = (struct gdp_gob_xtra *) ep_mem_zalloc(sizeof *gob->x);
+	ep_mem_tag_set(otag);
 	if (gob->x == NULL)
 	{
 		estat = EP_STAT_OUT_OF_MEMORY;
@@ -91,6 +94,8 @@ gob_close(gdp_gob_t *gob)
 	if (gob->x->physimpl->close != NULL)
 		gob->x->physimpl->close(gob);
 
+	if (gob->x->merkle_sign != NULL)
+		ep_crypto_sign_free(gob->x->merkle_sign);
 	ep_mem_free(gob->x);
 	gob->x = NULL;
 }
@@ -118,6 +123,8 @@ gob_delete(gdp_gob_t *gob)
 	if (gob->x->physimpl->remove != NULL)
 		gob->x->physimpl->remove(gob);
 
+	if (gob->x->merkle_sign != NULL)
+		ep_crypto_sign_free(gob->x->merkle_sign);
 	ep_mem_free(gob->x);
 	gob->x = NULL;
 }
@@ -139,10 +146,12 @@ static EP_STAT
 do_physical_open(gdp_gob_t *gob, void *open_info_)
 {
 	EP_STAT estat;
+	int otag;
 
 	if (ep_dbg_test(Dbg, 11))
 		ep_dbg_printf("do_physical_open: %s\n", gob->pname);
 
+	otag = ep_mem_tag_set(_GdpMemTagGob);
 	gob->x = (struct gdp_gob_xtra *) ep_mem_zalloc(sizeof *gob->x);
 	gob->x->gob = gob;
 
@@ -152,8 +161,9 @@ do_physical_open(gdp_gob_t *gob, void *open_info_)
 	// make sure that if this is freed it gets removed from GclsByUse
 	gob->freefunc = gob_close;
 
-	// open the physical disk files
+	// open the physical disk files (their state is charged to the GOB)
 	estat = gob->x->physimpl->open(gob);
+	ep_mem_tag_set(otag);
 	if (EP_STAT_ISOK(estat))
 	{
 		gob->flags |= GOBF_DEFER_FREE;
@@ -241,4 +251,45 @@ get_open_handle(gdp_req_t *req)
 }
 
 
+/*
+**  Get an open instance of an arbitrary GOB by name.
+**
+**		Like get_open_handle, but not tied to a request (e.g.,
+**		for commands that name several logs).  The GOB is returned
+**		locked and with its reference count incremented.  The
+**		caller must not hold any GOB or req locks.
+*/
+
+EP_STAT
+get_open_gob(gdp_name_t gob_name, gdp_gob_t **pgob)
+{
+	EP_STAT estat;
+	gdp_gob_t *gob = NULL;
+
+	estat = _gdp_gob_cache_get(gob_name, GGCF_CREATE, &gob);
+	if (EP_STAT_ISOK(estat) && EP_UT_BITSET(GOBF_PENDING, gob->flags))
+	{
+		estat = do_physical_open(gob, NULL);
+		if (EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOTFOUND))
+		{
+			// not one of ours
+			_gdp_gob_free(&gob);
+		}
+	}
+	if (!EP_STAT_ISOK(estat) && gob != NULL)
+		_gdp_gob_decref(&gob, false);
+	if (ep_dbg_test(Dbg, 40))
+	{
+		char ebuf[60];
+		gdp_pname_t pname;
+
+		ep_dbg_printf("get_open_gob: %s => %p: %s\n",
+				gdp_printable_name(gob_name, pname), gob,
+				ep_stat_tostr(estat, ebuf, sizeof ebuf));
+	}
+	*pgob = gob;
+	return estat;
+}
+
+
 # endif // LOG_CHECK
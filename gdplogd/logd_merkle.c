@@ -0,0 +1,423 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Maintain a Merkle tree over the records in each log
+**
+**		Leaf i of the tree is record i + 1.  Only complete subtrees
+**		are stored (by level and index); anything else is computed
+**		from those on demand, so each append costs at most log2(n)
+**		hashes and writes.  See gdp/gdp_merkle.c for the hashing.
+**
+**		Logs created before this was added (or records skipped while
+**		the tree was behind) are folded in lazily the first time a
+**		checkpoint is needed.
+**
+**	----- BEGIN LICENSE BLOCK -----
+**	GDPLOGD: Log Daemon for the Global Data Plane
+**	From the Ubiquitous Swarm Lab, 490 Cory Hall, U.C. Berkeley.
+**
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**	----- END LICENSE BLOCK -----
+*/
+
+#include "logd.h"
+
+#include <gdp/gdp_md.h>
+#include <gdp/gdp_priv.h>
+#include <ep/ep_app.h>
+#include <ep/ep_crypto.h>
+#include <ep/ep_dbg.h>
+
+#include <string.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("gdplogd.merkle",
+								"GDP Log Daemon Merkle trees");
+
+#define MERKLE_DEFAULT_INTERVAL		4096	// records between checkpoints
+
+
+/*
+**  MERKLE_LOAD --- make sure we know how many leaves are in the tree
+*/
+
+static EP_STAT
+merkle_load(gdp_gob_t *gob)
+{
+	EP_STAT estat = EP_STAT_OK;
+	struct gdp_gob_xtra *x = gob->x;
+
+	if (x->merkle_valid)
+		return estat;
+	estat = x->physimpl->merkle_nleaves(gob, &x->merkle_nleaves);
+	if (EP_STAT_ISOK(estat))
+		x->merkle_valid = true;
+	ep_dbg_cprintf(Dbg, 20, "merkle_load(%s): %" PRIu64 " leaves\n",
+			gob->pname, x->merkle_nleaves);
+	return estat;
+}
+
+
+/*
+**  MERKLE_FOLD --- add one record to the tree
+**
+**		The record must be the next leaf.  Every time the new leaf
+**		completes a subtree (i.e., its index is odd at that level)
+**		the parent is computed and stored.
+*/
+
+static EP_STAT
+merkle_fold(gdp_gob_t *gob, gdp_recno_t recno)
+{
+	EP_STAT estat;
+	struct gdp_gob_xtra *x = gob->x;
+	uint8_t rechash[EP_CRYPTO_MAX_DIGEST];
+	size_t rechashlen = sizeof rechash;
+	uint8_t hash[GDP_MERKLE_HASHLEN];
+	uint8_t sibling[GDP_MERKLE_HASHLEN];
+	uint64_t idx = recno - 1;
+	int level = 0;
+
+	EP_ASSERT(x->merkle_valid && x->merkle_nleaves == idx);
+
+	estat = x->physimpl->get_rechash(gob, recno, rechash, &rechashlen);
+	EP_STAT_CHECK(estat, return estat);
+	_gdp_merkle_leaf(rechash, rechashlen, hash);
+	estat = x->physimpl->merkle_put(gob, level, idx, hash);
+	while (EP_STAT_ISOK(estat) && (idx & 1) != 0)
+	{
+		estat = x->physimpl->merkle_get(gob, level, idx - 1, sibling);
+		EP_STAT_CHECK(estat, break);
+		_gdp_merkle_node(sibling, hash, hash);
+		idx >>= 1;
+		level++;
+		estat = x->physimpl->merkle_put(gob, level, idx, hash);
+	}
+	if (EP_STAT_ISOK(estat))
+		x->merkle_nleaves = recno;
+	else
+		x->merkle_valid = false;
+	return estat;
+}
+
+
+/*
+**  MERKLE_SYNC --- bring the tree up to date through record upto
+**
+**		Stops quietly at the first missing record; the caller should
+**		check merkle_nleaves to see how far it got.
+*/
+
+static EP_STAT
+merkle_sync(gdp_gob_t *gob, gdp_recno_t upto)
+{
+	EP_STAT estat;
+	struct gdp_gob_xtra *x = gob->x;
+
+	estat = merkle_load(gob);
+	while (EP_STAT_ISOK(estat) && x->merkle_nleaves < (uint64_t) upto)
+	{
+		estat = merkle_fold(gob, x->merkle_nleaves + 1);
+		if (EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOTFOUND))
+		{
+			// gap in the log; the tree cannot go past it
+			ep_dbg_cprintf(Dbg, 10,
+					"merkle_sync(%s): record %" PRIu64 " missing\n",
+					gob->pname, x->merkle_nleaves + 1);
+			x->merkle_valid = true;
+			return EP_STAT_OK;
+		}
+	}
+	return estat;
+}
+
+
+/*
+**  MERKLE_SUBTREE --- compute the root of leaves [lo, lo + n)
+**
+**		Power of two subtrees are always aligned, so they come
+**		straight from the database; others are split RFC 6962
+**		style at the largest power of two less than n.
+*/
+
+static EP_STAT
+merkle_subtree(gdp_gob_t *gob, uint64_t lo, uint64_t n, uint8_t *out)
+{
+	EP_STAT estat;
+	uint8_t left[GDP_MERKLE_HASHLEN];
+	uint8_t right[GDP_MERKLE_HASHLEN];
+	uint64_t k;
+
+	EP_ASSERT(n > 0);
+	if ((n & (n - 1)) == 0)
+	{
+		int level = 0;
+
+		while ((UINT64_C(1) << level) < n)
+			level++;
+		return gob->x->physimpl->merkle_get(gob, level, lo >> level, out);
+	}
+
+	for (k = 1; (k << 1) < n; k <<= 1)
+		continue;
+	estat = merkle_subtree(gob, lo, k, left);
+	EP_STAT_CHECK(estat, return estat);
+	estat = merkle_subtree(gob, lo + k, n - k, right);
+	EP_STAT_CHECK(estat, return estat);
+	_gdp_merkle_node(left, right, out);
+	return estat;
+}
+
+
+/*
+**  MERKLE_PATH --- compute the audit path for leaf m of [lo, lo + n)
+**
+**		Hashes are appended to path from the leaf upward.
+*/
+
+static EP_STAT
+merkle_path(gdp_gob_t *gob,
+		uint64_t m,
+		uint64_t lo,
+		uint64_t n,
+		uint8_t (*path)[GDP_MERKLE_HASHLEN],
+		int *npathp)
+{
+	EP_STAT estat;
+	uint64_t k;
+
+	if (n <= 1)
+		return EP_STAT_OK;
+	for (k = 1; (k << 1) < n; k <<= 1)
+		continue;
+	if (m < k)
+		estat = merkle_path(gob, m, lo, k, path, npathp);
+	else
+		estat = merkle_path(gob, m - k, lo + k, n - k, path, npathp);
+	EP_STAT_CHECK(estat, return estat);
+	if (*npathp >= MERKLE_MAXPATH)
+		return GDP_STAT_MERKLE_PROOF_FAIL;
+	if (m < k)
+		estat = merkle_subtree(gob, lo + k, n - k, path[*npathp]);
+	else
+		estat = merkle_subtree(gob, lo, k, path[*npathp]);
+	if (EP_STAT_ISOK(estat))
+		(*npathp)++;
+	return estat;
+}
+
+
+/*
+**  MERKLE_SIGNER --- get the context used to sign checkpoints
+**
+**		Checkpoints are signed with the log's own key, which the
+**		server normally doesn't have.  It is only looked for if
+**		swarm.gdplogd.merkle.keypath is set, and only once per open.
+**		The context is seeded with the log name and metadata just
+**		like record signatures.
+*/
+
+static EP_CRYPTO_MD *
+merkle_signer(gdp_gob_t *gob)
+{
+	struct gdp_gob_xtra *x = gob->x;
+	const char *keypath;
+	size_t pklen;
+	uint8_t *pkbuf;
+	EP_CRYPTO_KEY *skey;
+	EP_STAT estat;
+
+	if (x->merkle_keytried)
+		return x->merkle_sign;
+	x->merkle_keytried = true;
+
+	keypath = ep_adm_getstrparam("swarm.gdplogd.merkle.keypath", NULL);
+	if (keypath == NULL)
+		return NULL;
+	estat = gdp_md_find(gob->gob_md, GDP_MD_PUBKEY, &pklen,
+					(const void **) &pkbuf);
+	if (!EP_STAT_ISOK(estat) || pklen < 5)
+		return NULL;
+
+	char skey_file_name[sizeof gob->pname + 5];
+	snprintf(skey_file_name, sizeof skey_file_name, "%s.pem", gob->pname);
+	skey = _gdp_crypto_skey_read(keypath, skey_file_name);
+	if (skey == NULL)
+	{
+		ep_dbg_cprintf(Dbg, 10, "merkle_signer(%s): no secret key\n",
+				gob->pname);
+		return NULL;
+	}
+	x->merkle_sign = ep_crypto_sign_new(skey, pkbuf[0]);
+	ep_crypto_key_free(skey);
+	if (x->merkle_sign == NULL)
+		return NULL;
+
+	ep_crypto_sign_update(x->merkle_sign, gob->name, sizeof gob->name);
+	{
+		uint8_t *mdbuf;
+		size_t mdlen;
+		mdlen = _gdp_md_serialize(gob->gob_md, &mdbuf);
+		ep_crypto_sign_update(x->merkle_sign, mdbuf, mdlen);
+		ep_mem_free(mdbuf);
+	}
+	return x->merkle_sign;
+}
+
+
+/*
+**  MERKLE_CHECKPOINT --- record a checkpoint of the first treesize records
+*/
+
+static EP_STAT
+merkle_checkpoint(gdp_gob_t *gob, uint64_t treesize, struct merkle_ckpt *ckpt)
+{
+	EP_STAT estat;
+	EP_CRYPTO_MD *signer;
+
+	ckpt->treesize = treesize;
+	estat = merkle_subtree(gob, 0, treesize, ckpt->root);
+	EP_STAT_CHECK(estat, return estat);
+	ep_time_now(&ckpt->ts);
+	ckpt->siglen = 0;
+
+	signer = merkle_signer(gob);
+	if (signer != NULL)
+	{
+		EP_CRYPTO_MD *md = ep_crypto_md_clone(signer);
+
+		_gdp_merkle_ckpt_digest(md, treesize, &ckpt->ts, ckpt->root);
+		ckpt->siglen = sizeof ckpt->sig;
+		estat = ep_crypto_sign_final(md, ckpt->sig, &ckpt->siglen);
+		ep_crypto_sign_free(md);
+		if (!EP_STAT_ISOK(estat))
+		{
+			// an unsigned checkpoint is still useful
+			ep_log(estat, "merkle_checkpoint(%s): cannot sign", gob->pname);
+			ckpt->siglen = 0;
+		}
+	}
+
+	ep_dbg_cprintf(Dbg, 11, "merkle_checkpoint(%s): %" PRIu64 " records%s\n",
+			gob->pname, treesize, ckpt->siglen > 0 ? ", signed" : "");
+	return gob->x->physimpl->ckpt_put(gob, ckpt);
+}
+
+
+/*
+**  MERKLE_APPEND --- fold a newly appended record into the tree
+**
+**		Called inside the append transaction so that tree nodes
+**		are committed (or rolled back) with the records.  If the
+**		tree is behind (e.g., the log predates Merkle support) this
+**		does nothing; merkle_get_proof will catch up later.
+*/
+
+EP_STAT
+merkle_append(gdp_gob_t *gob, gdp_recno_t recno)
+{
+	EP_STAT estat;
+	struct gdp_gob_xtra *x = gob->x;
+	long interval;
+
+	if (x->physimpl->merkle_put == NULL)
+		return EP_STAT_OK;
+	estat = merkle_load(gob);
+	EP_STAT_CHECK(estat, return estat);
+	if (x->merkle_nleaves != (uint64_t) recno - 1)
+		return EP_STAT_OK;
+
+	estat = merkle_fold(gob, recno);
+	EP_STAT_CHECK(estat, return estat);
+
+	interval = ep_adm_getlongparam("swarm.gdplogd.merkle.interval",
+							MERKLE_DEFAULT_INTERVAL);
+	if (interval > 0 && recno % interval == 0)
+	{
+		struct merkle_ckpt ckpt;
+
+		estat = merkle_checkpoint(gob, recno, &ckpt);
+	}
+	return estat;
+}
+
+
+/*
+**  MERKLE_INVALIDATE --- forget the cached tree size
+**
+**		Used when an append transaction is rolled back.
+*/
+
+void
+merkle_invalidate(gdp_gob_t *gob)
+{
+	if (gob->x != NULL)
+		gob->x->merkle_valid = false;
+}
+
+
+/*
+**  MERKLE_GET_PROOF --- get an inclusion proof for a record
+**
+**		If treesize is zero the proof is against the first checkpoint
+**		that covers recno; if there isn't one yet a new checkpoint is
+**		made covering the whole log.  Otherwise it is against the
+**		checkpoint of exactly treesize records, which must exist.
+*/
+
+EP_STAT
+merkle_get_proof(gdp_gob_t *gob,
+			gdp_recno_t recno,
+			uint64_t treesize,
+			struct merkle_ckpt *ckpt,
+			uint8_t (*path)[GDP_MERKLE_HASHLEN],
+			int *npathp)
+{
+	EP_STAT estat;
+	struct gdp_gob_xtra *x = gob->x;
+
+	*npathp = 0;
+	if (x->physimpl->ckpt_get == NULL)
+		return GDP_STAT_NOT_IMPLEMENTED;
+	if (recno <= 0 || (treesize != 0 && treesize < (uint64_t) recno))
+		return GDP_STAT_NAK_BADREQ;
+
+	if (treesize != 0)
+	{
+		estat = x->physimpl->ckpt_get(gob, treesize, true, ckpt);
+	}
+	else
+	{
+		estat = x->physimpl->ckpt_get(gob, recno, false, ckpt);
+		if (EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOTFOUND))
+		{
+			// nothing covers it yet: catch up and make one now
+			estat = merkle_sync(gob, gob->nrecs);
+			EP_STAT_CHECK(estat, return estat);
+			if (x->merkle_nleaves < (uint64_t) recno)
+				return GDP_STAT_NAK_NOTFOUND;
+			estat = merkle_checkpoint(gob, x->merkle_nleaves, ckpt);
+		}
+	}
+	EP_STAT_CHECK(estat, return estat);
+
+	return merkle_path(gob, recno - 1, 0, ckpt->treesize, path, npathp);
+}
@@ -158,7 +158,8 @@ cmd_ping(gdp_req_t *req)
 		LIST_FOREACH(sub, &req->gob->reqs, goblist)
 		{
 			if (GDP_NAME_SAME(sub->rpdu->dst, req->rpdu->dst) &&
-					EP_UT_BITSET(GDP_REQ_SRV_SUBSCR, sub->flags))
+					(sub->flags & (GDP_REQ_SRV_SUBSCR |
+								   GDP_REQ_SRV_CATCHUP)) != 0)
 			{
 				// Yes, we have a subscription!
 				goto done;
@@ -476,6 +477,64 @@ cmd_delete(gdp_req_t *req)
 }
 
 
+/*
+**  Read continuation tokens.
+**
+**		When a range read runs out of byte budget the server hands
+**		back an opaque token saying where to resume.  It holds the
+**		next record number and the number of records still owed,
+**		so a resumed read goes straight to that record (the recno
+**		index makes that a seek, not a rescan) without the server
+**		keeping any state between calls.  A few bytes of the log
+**		name catch tokens presented to the wrong log.
+**
+**		Clients must treat the contents as opaque.
+*/
+
+#define RDCONT_VERSION		1
+#define RDCONT_LEN			(1 + 8 + 4 + 4)
+
+static size_t
+rdcont_encode(gdp_req_t *req, uint8_t *buf)
+{
+	uint8_t *pbp = buf;
+	uint32_t remaining;
+
+	if (req->numrecs < 0)
+		remaining = UINT32_MAX;			// unbounded
+	else
+		remaining = req->numrecs - req->s_results;
+	PUT8(RDCONT_VERSION);
+	PUT64(req->nextrec);
+	PUT32(remaining);
+	memcpy(pbp, req->gob->name, 4);
+	pbp += 4;
+	return pbp - buf;
+}
+
+static EP_STAT
+rdcont_decode(gdp_req_t *req, ProtobufCBinaryData *cont)
+{
+	uint8_t *pbp = cont->data;
+	int version;
+	uint64_t recno;
+	uint32_t remaining;
+
+	if (cont->len != RDCONT_LEN)
+		return GDP_STAT_PDU_CORRUPT;
+	GET8(version);
+	if (version != RDCONT_VERSION)
+		return GDP_STAT_PDU_VERSION_MISMATCH;
+	GET64(recno);
+	GET32(remaining);
+	if (memcmp(pbp, req->gob->name, 4) != 0 || recno < 1 || remaining == 0)
+		return GDP_STAT_PDU_CORRUPT;
+	req->nextrec = recno;
+	req->numrecs = remaining;			// UINT32_MAX becomes unbounded
+	return EP_STAT_OK;
+}
+
+
 static void
 make_read_acknak_pdu(gdp_req_t *req, EP_STAT estat)
 {
@@ -512,6 +571,19 @@ make_read_acknak_pdu(gdp_req_t *req, EP_STAT estat)
 		resp->nresults = req->s_results;
 		resp->has_nresults = true;
 	}
+	else if (EP_STAT_IS_SAME(estat, GDP_STAT_READ_BUDGET))
+	{
+		// ran out of byte budget; tell the client where to pick up
+		_gdp_req_ack_resp(req, GDP_ACK_END_OF_RESULTS);
+		GdpMessage__AckEndOfResults *resp = req->rpdu->msg->ack_end_of_results;
+		resp->ep_stat = EP_STAT_TO_INT(estat);
+		resp->has_ep_stat = true;
+		resp->nresults = req->s_results;
+		resp->has_nresults = true;
+		resp->cont.data = ep_mem_malloc(RDCONT_LEN);
+		resp->cont.len = rdcont_encode(req, resp->cont.data);
+		resp->has_cont = true;
+	}
 	else
 	{
 		// some other failure
@@ -547,10 +619,47 @@ send_read_result(EP_STAT estat, gdp_datum_t *datum, gdp_result_ctx_t *cb_ctx)
 	return estat;
 }
 
+/*
+**  Byte-budgeted reads.  Each record is charged against the budget
+**  before it is sent; the first record that would overflow is held
+**  back (at least one record is always sent so that a budget smaller
+**  than a record still makes progress).
+*/
+
+struct read_budget
+{
+	gdp_req_t		*req;			// the request being answered
+	size_t			maxbytes;		// budget for this read
+	size_t			nbytes;			// bytes charged so far
+};
+
+static EP_STAT
+send_budget_result(EP_STAT estat, gdp_datum_t *datum, gdp_result_ctx_t *cb_ctx)
+{
+	struct read_budget *rb = (struct read_budget *) cb_ctx;
+	gdp_req_t *req = rb->req;
+
+	if (EP_STAT_ISOK(estat) && datum != NULL)
+	{
+		// the data dominates; the rest is a rough allowance
+		size_t l = gdp_buf_getlength(datum->dbuf) + 128;
+
+		if (req->s_results > 0 && rb->nbytes + l > rb->maxbytes)
+		{
+			req->nextrec = datum->recno;
+			return GDP_STAT_READ_BUDGET;
+		}
+		rb->nbytes += l;
+		req->nextrec = datum->recno + 1;
+	}
+	return send_read_result(estat, datum, (gdp_result_ctx_t *) req);
+}
+
 EP_STAT
 cmd_read_by_recno(gdp_req_t *req)
 {
 	EP_STAT estat;
+	struct read_budget rb;
 
 	estat = get_open_handle(req);
 	if (!EP_STAT_ISOK(estat))
@@ -574,9 +683,38 @@ cmd_read_by_recno(gdp_req_t *req)
 	}
 	req->s_results = 0;
 
-	estat = req->gob->x->physimpl->read_by_recno(req->gob,
+	// a continuation token overrides the starting point and count
+	if (payload->has_cont)
+	{
+		estat = rdcont_decode(req, &payload->cont);
+		if (!EP_STAT_ISOK(estat))
+			return _gdp_req_nak_resp(req, GDP_NAK_C_BADREQ,
+							"cmd_read_by_recno: bad continuation", estat);
+	}
+
+	// the server may impose a budget of its own
+	rb.req = req;
+	rb.nbytes = 0;
+	rb.maxbytes = ep_adm_getlongparam("swarm.gdplogd.read.maxbytes", 0);
+	if (payload->has_maxbytes && payload->maxbytes > 0 &&
+			(rb.maxbytes == 0 || payload->maxbytes < rb.maxbytes))
+		rb.maxbytes = payload->maxbytes;
+
+	// (storage time for reads includes sending the results)
+	uint64_t t0 = _gdp_lat_now();
+	EP_TRACE_SPAN span;
+
+	ep_trace_begin(&span, "gdplogd", "storage");
+	if (rb.maxbytes > 0)
+		estat = req->gob->x->physimpl->read_by_recno(req->gob,
+								req->nextrec, req->numrecs,
+								send_budget_result, &rb);
+	else
+		estat = req->gob->x->physimpl->read_by_recno(req->gob,
 								req->nextrec, req->numrecs,
 								send_read_result, req);
+	ep_trace_end(&span);
+	_gdp_lat_record(GDP_CMD_READ_BY_RECNO, GDP_LAT_STORAGE, t0);
 	// if successful, data will have already been returned
 	if (EP_STAT_ISOK(estat))
 		return GDP_STAT_RESPONSE_SENT;
@@ -626,6 +764,16 @@ EP_STAT
 cmd_append(gdp_req_t *req)
 {
 	EP_STAT estat;
+	uint64_t t0;
+	EP_TRACE_SPAN span;
+
+	// replicas only accept records from their leader
+	if (replica_is_follower(req->cpdu->dst))
+	{
+		return _gdp_req_nak_resp(req, GDP_NAK_C_METHNOTALLOWED,
+							"cmd_append: log is a read-only replica",
+							GDP_STAT_NAK_METHNOTALLOWED);
+	}
 
 	estat = get_open_handle(req);
 	if (!EP_STAT_ISOK(estat))
@@ -715,6 +863,8 @@ cmd_append(gdp_req_t *req)
 	gdp_datum_t *datum = gdp_datum_new();
 	_gdp_datum_from_pb(datum, pbd, pbd->sig);
 
+	t0 = _gdp_lat_now();
+	ep_trace_begin(&span, "gdplogd", "crypto");
 	estat = _gdp_datum_vrfy_gob(datum, req->gob);
 	if (EP_STAT_IS_SAME(estat, GDP_STAT_CRYPTO_NO_PUB_KEY))
 	{
@@ -764,8 +914,12 @@ cmd_append(gdp_req_t *req)
 		estat = _gdp_datum_vrfy_gob(datum, req->gob);
 		EP_STAT_CHECK(estat, goto fail1);
 	}
+	ep_trace_end(&span);
+	_gdp_lat_record(GDP_CMD_APPEND, GDP_LAT_CRYPTO, t0);
 
 	// append records to long term storage
+	t0 = _gdp_lat_now();
+	ep_trace_begin(&span, "gdplogd", "storage");
 	if (req->gob->x->physimpl->xact_begin != NULL)
 		req->gob->x->physimpl->xact_begin(req->gob);
 	for (rx = 0; rx < payload->dl->n_d; rx++)
@@ -779,6 +933,14 @@ cmd_append(gdp_req_t *req)
 		estat = req->gob->x->physimpl->append(req->gob, datum);
 		if (!EP_STAT_ISOK(estat))
 			break;
+
+		// keep the Merkle tree in step (failure just delays it)
+		EP_STAT mstat = merkle_append(req->gob, datum->recno);
+		if (!EP_STAT_ISOK(mstat))
+		{
+			ep_dbg_cprintf(Dbg, 1, "cmd_append: merkle_append failed\n");
+			merkle_invalidate(req->gob);
+		}
 	}
 	if (EP_STAT_ISOK(estat))
 	{
@@ -789,7 +951,10 @@ cmd_append(gdp_req_t *req)
 	{
 		if (req->gob->x->physimpl->xact_abort != NULL)
 			req->gob->x->physimpl->xact_abort(req->gob);
+		merkle_invalidate(req->gob);
 	}
+	ep_trace_end(&span);
+	_gdp_lat_record(GDP_CMD_APPEND, GDP_LAT_STORAGE, t0);
 
 	// if physical appends succeeded, notify subscribers
 	if (EP_STAT_ISOK(estat))
@@ -833,8 +998,18 @@ cmd_append(gdp_req_t *req)
 		_gdp_req_ack_resp(req, GDP_ACK_SUCCESS);
 		GdpMessage__AckSuccess *resp = req->rpdu->msg->ack_success;
 		resp->recno = req->gob->nrecs;
-		resp->ts = pbd->ts;
-		pbd->ts = NULL;		// avoid double free
+		if (pbd->ts != NULL)
+		{
+			// pbd lives in the command's arena, so copy
+			resp->ts = (GdpTimestamp *) ep_mem_malloc(sizeof *resp->ts);
+			gdp_timestamp__init(resp->ts);
+			resp->ts->sec = pbd->ts->sec;
+			resp->ts->has_sec = pbd->ts->has_sec;
+			resp->ts->nsec = pbd->ts->nsec;
+			resp->ts->has_nsec = pbd->ts->has_nsec;
+			resp->ts->accuracy = pbd->ts->accuracy;
+			resp->ts->has_accuracy = pbd->ts->has_accuracy;
+		}
 	}
 	else
 	{
@@ -846,6 +1021,7 @@ cmd_append(gdp_req_t *req)
 	if (false)
 	{
 fail1:
+		ep_trace_end(&span);		// verification failed
 		estat = _gdp_req_nak_resp(req, GDP_NAK_C_FORBIDDEN,
 						"cmd_append",
 						estat);
@@ -861,19 +1037,16 @@ fail0:
 /*
 **  POST_SUBSCRIBE --- do subscription work after initial ACK
 **
-**		Assuming the subscribe worked we are now going to deliver any
-**		previously existing records.  Once those are all sent we can
-**		convert this to an ordinary subscription.  If the subscribe
-**		request is satisified, we remove it.
-**
-**		This code is also the core of multiread.
+**		Existing records are sent by the catch-up scan (see
+**		logd_pubsub.c), which runs in the background a chunk at a
+**		time and turns this into an ordinary subscription when it
+**		reaches the end of the log.  Starting it here rather than
+**		in the command makes sure the ACK goes out first.
 */
 
 void
 post_subscribe(gdp_req_t *req)
 {
-	EP_STAT estat;
-
 	EP_ASSERT_ELSE(req != NULL, return);
 	EP_ASSERT_ELSE(req->state != GDP_REQ_FREE, return);
 	EP_ASSERT_ELSE(req->gob != NULL, return);
@@ -882,54 +1055,7 @@ post_subscribe(gdp_req_t *req)
 			" gob->nrecs %"PRIgdp_recno "\n",
 			req->numrecs, req->nextrec, req->gob->nrecs);
 
-	if (req->numrecs <= 0)
-		req->numrecs = INT32_MAX;
-
-	// if data pre-exists in the GOB, return it now
-	if (req->nextrec <= req->gob->nrecs)
-	{
-		// get the existing records and return them via callback
-		estat = req->gob->x->physimpl->read_by_recno(
-									req->gob,
-									req->nextrec, req->numrecs,
-									send_read_result, req);
-		if (EP_STAT_ISOK(estat))
-		{
-			gdp_recno_t nrecs = EP_STAT_TO_INT(estat);
-			req->nextrec += nrecs;
-			req->numrecs -= nrecs;
-		}
-	}
-
-	// done with response PDU
-	if (req->rpdu != NULL)
-		_gdp_pdu_free(&req->rpdu);
-
-	if (req->numrecs < 0 || !EP_UT_BITSET(GDP_REQ_SUBUPGRADE, req->flags))
-	{
-		// no more to read: do cleanup & send termination notice
-		sub_end_subscription(req);
-	}
-	else
-	{
-		if (ep_dbg_test(Dbg, 24))
-		{
-			ep_dbg_printf("post_subscribe: converting to subscription\n    ");
-			_gdp_req_dump(req, NULL, GDP_PR_BASIC, 0);
-		}
-		req->flags |= GDP_REQ_SRV_SUBSCR;
-
-		// link this request into the GOB so the subscription can be found
-		if (!EP_UT_BITSET(GDP_REQ_ON_GOB_LIST, req->flags))
-		{
-			IF_LIST_CHECK_OK(&req->gob->reqs, req, goblist, gdp_req_t)
-			{
-				// req->gob->refcnt already allows for this reference
-				LIST_INSERT_HEAD(&req->gob->reqs, req, goblist);
-				req->flags |= GDP_REQ_ON_GOB_LIST;
-			}
-		}
-	}
+	sub_catchup_start(req->gob);
 }
 
 
@@ -938,16 +1064,9 @@ post_subscribe(gdp_req_t *req)
 **
 **		Arranges to return existing data (if any) after the response
 **		is sent, and non-existing data (if any) as a side-effect of
-**		append.
-**
-**		XXX	Race Condition: if records are written between the time
-**			the subscription and the completion of the first half of
-**			this process, some records may be lost.  For example,
-**			if the GOB has 20 records (1-20) and you ask for 20
-**			records starting at record 11, you probably want records
-**			11-30.  But if during the return of records 11-20 another
-**			record (21) is written, then the second half of the
-**			subscription will actually return records 22-31.
+**		append.  If the client gives a window, no more than that
+**		many existing records are sent until it grants more credit;
+**		the window is echoed in the ACK to show we honor it.
 **
 **		XXX	Does not implement timeouts.
 **
@@ -1040,30 +1159,20 @@ cmd_subscribe_by_recno(gdp_req_t *req)
 			ep_dbg_printf("cmd_subscribe_by_recno: starting ");
 			_gdp_req_dump(req, NULL, GDP_PR_BASIC, 0);
 		}
-		for (r1 = LIST_FIRST(&gob->reqs); r1 != NULL;
-				r1 = LIST_NEXT(r1, goblist))
+		r1 = _gdp_req_gob_lookup(gob, req->cpdu->src, req->cpdu->msg->rid);
+		if (r1 != NULL)
 		{
-			EP_ASSERT(GDP_GOB_ISGOOD(r1->gob));
 			EP_ASSERT(r1->gob == gob);
-			if (ep_dbg_test(Dbg, 50))
+			if (ep_dbg_test(Dbg, 20))
 			{
-				ep_dbg_printf("cmd_subscribe: comparing to ");
+				ep_dbg_printf("cmd_subscribe: refreshing sub ");
 				_gdp_req_dump(r1, NULL, GDP_PR_BASIC, 0);
 			}
-			if (GDP_NAME_SAME(r1->cpdu->src, req->cpdu->src) &&
-					r1->cpdu->msg->rid == req->cpdu->msg->rid)
-			{
-				ep_dbg_cprintf(Dbg, 20, "cmd_subscribe: refreshing sub\n");
-				break;
-			}
-		}
-		if (r1 != NULL)
-		{
+
 			// abandon old request, we'll overwrite it with new request
 			// (but keep the GOB around)
 			ep_dbg_cprintf(Dbg, 20, "cmd_subscribe: removing old request\n");
-			LIST_REMOVE(r1, goblist);
-			r1->flags &= ~GDP_REQ_ON_GOB_LIST;
+			_gdp_req_gob_unlink(r1);
 			_gdp_req_lock(r1);
 			_gdp_req_free(&r1);
 		}
@@ -1075,14 +1184,21 @@ cmd_subscribe_by_recno(gdp_req_t *req)
 	// mark this as persistent and upgradable
 	req->flags |= GDP_REQ_PERSIST | GDP_REQ_SUBUPGRADE;
 
-	// note that the subscription is active
-	ep_time_now(&req->act_ts);
+	// note that the subscription is active (this starts the lease)
+	sub_lease_start(req);
+
+	// catch-up credit (negative => no limit)
+	req->sub_credit = -1;
+	if (payload->has_window && payload->window > 0)
+		req->sub_credit = payload->window;
 
 	// if some of the records already exist, arrange to return them
 	if (req->nextrec <= gob->nrecs)
 	{
+		// on the GOB list, but append leaves it to the catch-up scan
 		ep_dbg_cprintf(Dbg, 24, "cmd_subscribe: doing post processing\n");
 		req->flags &= ~GDP_REQ_SRV_SUBSCR;
+		req->flags |= GDP_REQ_SRV_CATCHUP;
 		req->postproc = &post_subscribe;
 	}
 	else
@@ -1090,19 +1206,18 @@ cmd_subscribe_by_recno(gdp_req_t *req)
 		// this is a pure "future" subscription
 		ep_dbg_cprintf(Dbg, 24, "cmd_subscribe: enabling subscription\n");
 		req->flags |= GDP_REQ_SRV_SUBSCR;
+	}
 
-		// link this request into the GOB so the subscription can be found
-		if (!EP_UT_BITSET(GDP_REQ_ON_GOB_LIST, req->flags))
+	// link this request into the GOB so the subscription can be found
+	if (!EP_UT_BITSET(GDP_REQ_ON_GOB_LIST, req->flags))
+	{
+		IF_LIST_CHECK_OK(&gob->reqs, req, goblist, gdp_req_t)
 		{
-			IF_LIST_CHECK_OK(&gob->reqs, req, goblist, gdp_req_t)
-			{
-				LIST_INSERT_HEAD(&gob->reqs, req, goblist);
-				req->flags |= GDP_REQ_ON_GOB_LIST;
-			}
-			else
-			{
-				estat = EP_STAT_ASSERT_ABORT;
-			}
+			_gdp_req_gob_link(req);
+		}
+		else
+		{
+			estat = EP_STAT_ASSERT_ABORT;
 		}
 	}
 
@@ -1111,84 +1226,459 @@ cmd_subscribe_by_recno(gdp_req_t *req)
 	if (EP_STAT_ISOK(estat) && req->rpdu == NULL)
 	{
 		_gdp_req_ack_resp(req, GDP_ACK_SUCCESS);
-		// ... if we want to fill in some info later....
-		//GdpMessage__AckSuccess *resp = req->rpdu->msg->ack_success;
+		GdpMessage__AckSuccess *resp = req->rpdu->msg->ack_success;
+		if (req->sub_credit > 0)
+		{
+			resp->window = req->sub_credit;
+			resp->has_window = true;
+		}
 	}
 	return estat;
 }
 
 
 /*
-**  CMD_MULTIREAD --- read multiple records
+**  CMD_SUBSCRIBE_CREDIT --- subscriber can take more existing records
 **
-**		Arranges to return existing data (if any) after the response
-**		is sent.  No long-term subscription will ever be created, but
-**		much of the infrastructure is reused.
+**		Addressed to the log with the rid of the subscription.
+**		There is no response: a stale or unknown rid (e.g., the
+**		subscription has ended) is just ignored.
 */
 
-#if 0		//XXX NOT IMPLEMENTED YET
 EP_STAT
-cmd_multiread(gdp_req_t *req)
+cmd_subscribe_credit(gdp_req_t *req)
 {
 	EP_STAT estat;
+	gdp_req_t *r1;
 
-	req->rpdu->cmd = GDP_ACK_SUCCESS;
+	GdpMessage__CmdSubscribeCredit *payload;
+	GET_PAYLOAD(req, cmd_subscribe_credit, CMD_SUBSCRIBE_CREDIT);
 
-	// find the GOB handle
 	estat = get_open_handle(req);
 	if (!EP_STAT_ISOK(estat))
+	{
+		ep_dbg_cprintf(Dbg, 10, "cmd_subscribe_credit: GOB not open\n");
+		return GDP_STAT_RESPONSE_SENT;
+	}
+
+	r1 = _gdp_req_gob_lookup(req->gob, req->cpdu->src, req->cpdu->msg->rid);
+	if (r1 == NULL)
+	{
+		ep_dbg_cprintf(Dbg, 20,
+				"cmd_subscribe_credit: no subscription for rid %" PRIgdp_rid "\n",
+				req->cpdu->msg->rid);
+		return GDP_STAT_RESPONSE_SENT;
+	}
+
+	_gdp_req_lock(r1);
+	sub_catchup_credit(r1, payload->credit);
+	_gdp_req_unlock(r1);
+	return GDP_STAT_RESPONSE_SENT;
+}
+
+
+/*
+**  CMD_MULTIREAD --- read one record from each of a set of logs
+**
+**		The logs must all be hosted here.  They are read in parallel
+**		using the thread pool; the thread running the command also
+**		takes work items itself, so it always makes progress even
+**		if the pool is saturated.  Results (including per-log
+**		failures) are packed into as few ACK_MULTI_CONTENT PDUs as
+**		will fit, followed by an ACK_END_OF_RESULTS giving the
+**		number of logs.
+*/
+
+#define MREAD_MAXBYTES_DEFAULT		60000	// < L4 payload limit
+#define MREAD_PARALLELISM_DEFAULT	8		// helper threads
+
+struct mread_ent
+{
+	gdp_name_t			name;		// name of log to read
+	gdp_recno_t			recno;		// record number (<= 0 from end)
+	EP_STAT				estat;		// status of read
+	GdpDatum			*pbd;		// result (if successful)
+};
+
+struct mread_ctx
+{
+	EP_THR_MUTEX		mutex;		// protects the rest of this struct
+	EP_THR_COND			cond;		// signaled when all entries are done
+	int					refcnt;		// command thread + running helpers
+	int					n_ents;		// number of logs to read
+	int					next_ent;	// next entry to be claimed
+	int					n_done;		// number of entries completed
+	struct mread_ent	*ents;		// one per log
+};
+
+static EP_STAT
+mread_result(EP_STAT estat, gdp_datum_t *datum, gdp_result_ctx_t *cb_ctx)
+{
+	struct mread_ent *ent = (struct mread_ent *) cb_ctx;
+
+	// only keep the first record (there may be duplicates)
+	if (EP_STAT_ISOK(estat) && datum != NULL && ent->pbd == NULL)
+	{
+		ent->pbd = (GdpDatum *) ep_mem_malloc(sizeof *ent->pbd);
+		gdp_datum__init(ent->pbd);
+		_gdp_datum_to_pb(datum, NULL, ent->pbd);
+	}
+	return EP_STAT_OK;
+}
+
+static void
+mread_one(struct mread_ent *ent)
+{
+	EP_STAT estat;
+	gdp_gob_t *gob;
+	gdp_recno_t recno;
+
+	estat = get_open_gob(ent->name, &gob);
+	EP_STAT_CHECK(estat, goto fail0);
+
+	recno = ent->recno;
+	if (recno <= 0)
+	{
+		// relative to end; both 0 and -1 mean "latest"
+		if (recno == 0)
+			recno = -1;
+		recno += gob->nrecs + 1;
+		if (recno <= 0)
+			recno = 1;
+	}
+	estat = gob->x->physimpl->read_by_recno(gob, recno, 1, mread_result, ent);
+	if (ent->pbd != NULL)
+		estat = EP_STAT_OK;
+	else if (EP_STAT_ISOK(estat))
+		estat = GDP_STAT_NAK_NOTFOUND;
+
+	if (EP_STAT_ISOK(estat))
+	{
+		admin_post_stats(ADMIN_LOG_READ, "multiread",
+				"log-name", gob->pname,
+				NULL, NULL);
+	}
+	_gdp_gob_decref(&gob, false);
+
+fail0:
+	ent->estat = estat;
+}
+
+static void
+mread_ctx_release(struct mread_ctx *mctx)
+{
+	int refcnt;
+
+	ep_thr_mutex_lock(&mctx->mutex);
+	refcnt = --mctx->refcnt;
+	ep_thr_mutex_unlock(&mctx->mutex);
+	if (refcnt > 0)
+		return;
+
+	// entries have already been handed off (or freed) by the command
+	ep_thr_cond_destroy(&mctx->cond);
+	ep_thr_mutex_destroy(&mctx->mutex);
+	ep_mem_free(mctx->ents);
+	ep_mem_free(mctx);
+}
+
+// claim and process entries until there are none left
+static void
+mread_work(struct mread_ctx *mctx)
+{
+	for (;;)
+	{
+		int ex;
+
+		ep_thr_mutex_lock(&mctx->mutex);
+		ex = mctx->next_ent++;
+		ep_thr_mutex_unlock(&mctx->mutex);
+		if (ex >= mctx->n_ents)
+			break;
+
+		mread_one(&mctx->ents[ex]);
+
+		ep_thr_mutex_lock(&mctx->mutex);
+		if (++mctx->n_done >= mctx->n_ents)
+			ep_thr_cond_broadcast(&mctx->cond);
+		ep_thr_mutex_unlock(&mctx->mutex);
+	}
+}
+
+static void
+mread_helper(void *mctx_)
+{
+	struct mread_ctx *mctx = (struct mread_ctx *) mctx_;
+
+	mread_work(mctx);
+	mread_ctx_release(mctx);
+}
+
+// send one batch of results
+static EP_STAT
+mread_send(gdp_req_t *req, struct mread_ent *ents, int n_ents)
+{
+	EP_STAT estat;
+	int ex;
+
+	_gdp_req_ack_resp(req, GDP_ACK_MULTI_CONTENT);
+	GdpMessage__AckMultiContent *resp = req->rpdu->msg->ack_multi_content;
+	resp->n_r = n_ents;
+	resp->r = (GdpMessage__AckMultiContent__Result **)
+				ep_mem_malloc(n_ents * sizeof *resp->r);
+	for (ex = 0; ex < n_ents; ex++)
+	{
+		GdpMessage__AckMultiContent__Result *r;
+
+		r = (GdpMessage__AckMultiContent__Result *) ep_mem_zalloc(sizeof *r);
+		gdp_message__ack_multi_content__result__init(r);
+		r->logname.len = sizeof (gdp_name_t);
+		r->logname.data = (uint8_t *) ep_mem_malloc(sizeof (gdp_name_t));
+		memcpy(r->logname.data, ents[ex].name, sizeof (gdp_name_t));
+		if (ents[ex].pbd != NULL)
+		{
+			// message now owns the datum
+			r->datum = ents[ex].pbd;
+			ents[ex].pbd = NULL;
+		}
+		else
+		{
+			r->ep_stat = EP_STAT_TO_INT(ents[ex].estat);
+			r->has_ep_stat = true;
+		}
+		resp->r[ex] = r;
+	}
+	estat = _gdp_pdu_out(req->rpdu, req->chan);
+	if (EP_STAT_ISOK(estat))
+		req->s_results += n_ents;
+	return estat;
+}
+
+EP_STAT
+cmd_multiread(gdp_req_t *req)
+{
+	EP_STAT estat = EP_STAT_OK;
+	struct mread_ctx *mctx;
+	gdp_gob_t *gob = req->gob;
+	int ex;
+
+	GdpMessage__CmdMultiread *payload;
+	GET_PAYLOAD(req, cmd_multiread, CMD_MULTIREAD);
+
+	if (payload->n_sel <= 0)
 	{
 		return _gdp_req_nak_resp(req, GDP_NAK_C_BADREQ,
-							"cmd_multiread: GOB not open", estat);
+							"cmd_multiread: no logs specified",
+							GDP_STAT_NAK_BADREQ);
+	}
+	for (ex = 0; ex < payload->n_sel; ex++)
+	{
+		if (payload->sel[ex]->logname.len != sizeof (gdp_name_t) ||
+				!gdp_name_is_valid(payload->sel[ex]->logname.data))
+		{
+			return _gdp_req_nak_resp(req, GDP_NAK_C_BADREQ,
+								"cmd_multiread: improper log name",
+								GDP_STAT_GDP_NAME_INVALID);
+		}
 	}
 
-	// get the additional parameters: number of records and timeout
-	req->numrecs = (int) gdp_buf_get_uint32(req->cpdu->datum->dbuf);
+	mctx = (struct mread_ctx *) ep_mem_zalloc(sizeof *mctx);
+	ep_thr_mutex_init(&mctx->mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_mutex_setorder(&mctx->mutex, GDP_MUTEX_LORDER_LEAF);
+	ep_thr_cond_init(&mctx->cond);
+	mctx->refcnt = 1;
+	mctx->n_ents = payload->n_sel;
+	mctx->ents = (struct mread_ent *)
+				ep_mem_zalloc(mctx->n_ents * sizeof *mctx->ents);
+	for (ex = 0; ex < mctx->n_ents; ex++)
+	{
+		memcpy(mctx->ents[ex].name, payload->sel[ex]->logname.data,
+				sizeof (gdp_name_t));
+		mctx->ents[ex].recno = payload->sel[ex]->recno;
+	}
 
-	if (ep_dbg_test(Dbg, 14))
+	ep_dbg_cprintf(Dbg, 14, "cmd_multiread: %d logs\n", mctx->n_ents);
+
+	// have to get lock ordering right here: the reads lock other GOBs
+	// (possibly including this one).  Safe because no one else can
+	// have a handle on this req.
+	_gdp_req_unlock(req);
+	if (gob != NULL)
+		_gdp_gob_unlock(gob);
+
+	// start helpers, then pitch in ourselves
 	{
-		ep_dbg_printf("cmd_multiread: first = %" PRIgdp_recno ", numrecs = %d\n  ",
-				pbd->recno, req->numrecs);
-		_gdp_gob_dump(req->gob, ep_dbg_getfile(), GDP_PR_BASIC, 0);
+		int nhelpers = ep_adm_getintparam("swarm.gdplogd.multiread.parallelism",
+								MREAD_PARALLELISM_DEFAULT);
+		if (nhelpers > mctx->n_ents - 1)
+			nhelpers = mctx->n_ents - 1;
+		ep_thr_mutex_lock(&mctx->mutex);
+		mctx->refcnt += nhelpers > 0 ? nhelpers : 0;
+		ep_thr_mutex_unlock(&mctx->mutex);
+		while (nhelpers-- > 0)
+			ep_thr_pool_run_class(GDP_LANE_READ, mread_helper, mctx);
 	}
+	mread_work(mctx);
 
-	if (req->numrecs < 0)
+	// wait for entries claimed by helpers to finish
+	ep_thr_mutex_lock(&mctx->mutex);
+	while (mctx->n_done < mctx->n_ents)
+		ep_thr_cond_wait(&mctx->cond, &mctx->mutex, NULL);
+	ep_thr_mutex_unlock(&mctx->mutex);
+
+	if (gob != NULL)
+		_gdp_gob_lock(gob);
+	_gdp_req_lock(req);
+
+	// pack the results into PDUs bounded by size
 	{
-		return GDP_STAT_NAK_BADOPT;
+		size_t maxbytes = ep_adm_getlongparam("swarm.gdplogd.multiread.maxbytes",
+								MREAD_MAXBYTES_DEFAULT);
+		size_t nbytes = 0;
+		int first = 0;
+
+		req->s_results = 0;
+		for (ex = 0; ex < mctx->n_ents; ex++)
+		{
+			// name, status, and framing are small; the datum dominates
+			size_t l = sizeof (gdp_name_t) + 16;
+
+			if (mctx->ents[ex].pbd != NULL)
+				l += gdp_datum__get_packed_size(mctx->ents[ex].pbd);
+			if (ex > first && nbytes + l > maxbytes)
+			{
+				estat = mread_send(req, &mctx->ents[first], ex - first);
+				EP_STAT_CHECK(estat, break);
+				first = ex;
+				nbytes = 0;
+			}
+			nbytes += l;
+		}
+		if (EP_STAT_ISOK(estat) && ex > first)
+			estat = mread_send(req, &mctx->ents[first], ex - first);
 	}
 
-	// get our starting point, which may be relative to the end
-	estat = get_starting_point_by_recno(req, payload->start);
-	EP_STAT_CHECK(estat, goto fail0);
+	// free anything that didn't get sent
+	for (ex = 0; ex < mctx->n_ents; ex++)
+	{
+		if (mctx->ents[ex].pbd != NULL)
+			gdp_datum__free_unpacked(mctx->ents[ex].pbd,
+					&_GdpProtobufAllocator);
+		mctx->ents[ex].pbd = NULL;
+	}
+	mread_ctx_release(mctx);
 
-	ep_dbg_cprintf(Dbg, 24, "cmd_multiread: starting from %" PRIgdp_recno
-			", %d records\n",
-			req->nextrec, req->numrecs);
+	// now tell the client we're done
+	if (EP_STAT_ISOK(estat))
+	{
+		_gdp_req_ack_resp(req, GDP_ACK_END_OF_RESULTS);
+		GdpMessage__AckEndOfResults *resp =
+					req->rpdu->msg->ack_end_of_results;
+		resp->nresults = req->s_results;
+		resp->has_nresults = true;
+		estat = _gdp_pdu_out(req->rpdu, req->chan);
+	}
+	if (!EP_STAT_ISOK(estat))
+	{
+		// can't reach the client, so no point in sending a NAK
+		char ebuf[100];
+		ep_dbg_cprintf(Dbg, 1, "cmd_multiread: cannot send results: %s\n",
+				ep_stat_tostr(estat, ebuf, sizeof ebuf));
+	}
+	req->stat = estat;
+	return GDP_STAT_RESPONSE_SENT;
+}
 
-	// if some of the records already exist, arrange to return them
-	if (req->nextrec <= req->gob->nrecs)
+
+/*
+**  CMD_SUBSCRIBE_GROUP --- subscribe to a group of logs
+**
+**		All logs in the group share one lease, identified by the
+**		client and rid.  Large groups arrive as several commands
+**		with the same rid, each adding more logs.  A renewal has
+**		no selectors and just extends the lease.  Setup is
+**		all-or-nothing: if any log can't be added the whole group
+**		is ended and the command is NAKed.
+*/
+
+EP_STAT
+cmd_subscribe_group(gdp_req_t *req)
+{
+	EP_STAT estat = EP_STAT_OK;
+	struct sub_group *grp;
+	gdp_gob_t *gob = req->gob;
+	int ex;
+
+	GdpMessage__CmdSubscribeGroup *payload;
+	GET_PAYLOAD(req, cmd_subscribe_group, CMD_SUBSCRIBE_GROUP);
+
+	if (payload->renew)
 	{
-		ep_dbg_cprintf(Dbg, 24, "cmd_multiread: doing post processing\n");
-		req->postproc = &post_subscribe;
+		if (!sub_group_renew(req->cpdu->src, req->cpdu->msg->rid))
+		{
+			return _gdp_req_nak_resp(req, GDP_NAK_C_NOTFOUND,
+								"cmd_subscribe_group: unknown group",
+								GDP_STAT_NAK_NOTFOUND);
+		}
+		_gdp_req_ack_resp(req, GDP_ACK_SUCCESS);
+		return estat;
+	}
 
-		// make this a "snapshot", i.e., don't read additional records
-		int32_t nrec = req->gob->nrecs - req->nextrec;
-		if (nrec < req->numrecs || req->numrecs == 0)
-			req->numrecs = nrec + 1;
+	if (payload->n_sel <= 0)
+	{
+		return _gdp_req_nak_resp(req, GDP_NAK_C_BADREQ,
+							"cmd_subscribe_group: no logs specified",
+							GDP_STAT_NAK_BADREQ);
+	}
+	for (ex = 0; ex < payload->n_sel; ex++)
+	{
+		if (payload->sel[ex]->logname.len != sizeof (gdp_name_t) ||
+				!gdp_name_is_valid(payload->sel[ex]->logname.data))
+		{
+			return _gdp_req_nak_resp(req, GDP_NAK_C_BADREQ,
+								"cmd_subscribe_group: improper log name",
+								GDP_STAT_GDP_NAME_INVALID);
+		}
+	}
 
-		// keep the request around until the post-processing is done
-		req->flags |= GDP_REQ_PERSIST;
+	grp = sub_group_get(req, true);
+	if (grp == NULL)
+	{
+		return _gdp_req_nak_resp(req, GDP_NAK_C_CONFLICT,
+							"cmd_subscribe_group: group has ended",
+							GDP_STAT_NAK_CONFLICT);
 	}
-	else
+
+	ep_dbg_cprintf(Dbg, 14, "cmd_subscribe_group: adding %zd logs\n",
+			payload->n_sel);
+
+	// as for cmd_multiread, adding members locks other GOBs
+	_gdp_req_unlock(req);
+	if (gob != NULL)
+		_gdp_gob_unlock(gob);
+
+	for (ex = 0; ex < payload->n_sel; ex++)
 	{
-		// no data to read
-		estat = GDP_STAT_NAK_NOTFOUND;
+		estat = sub_group_add_member(grp, payload->sel[ex]->logname.data,
+								payload->sel[ex]->start);
+		EP_STAT_CHECK(estat, break);
 	}
+	if (!EP_STAT_ISOK(estat))
+		(void) sub_group_end(req->cpdu->src, req->cpdu->msg->rid);
+	sub_group_release(grp);
 
-fail0:
+	if (gob != NULL)
+		_gdp_gob_lock(gob);
+	_gdp_req_lock(req);
+
+	if (!EP_STAT_ISOK(estat))
+	{
+		return _gdp_req_nak_resp(req, 0,
+							"cmd_subscribe_group: cannot add log", estat);
+	}
+	_gdp_req_ack_resp(req, GDP_ACK_SUCCESS);
 	return estat;
 }
-#endif //XXX
 
 
 /*
@@ -1209,6 +1699,7 @@ cmd_unsubscribe(gdp_req_t *req)
 
 	// remove any subscriptions
 	sub_end_all_subscriptions(req->gob, req->cpdu->src, req->cpdu->msg->rid);
+	(void) sub_group_end(req->cpdu->src, req->cpdu->msg->rid);
 
 	// send the ack
 	_gdp_req_ack_resp(req, GDP_ACK_SUCCESS);
@@ -1267,6 +1758,260 @@ fail0:
 }
 
 
+/*
+**  CMD_GET_PROOF --- get a Merkle inclusion proof for a record
+**
+**		The proof is an audit path from the record to a (possibly
+**		signed) checkpoint of the log.  Together with the prevhash
+**		chain it lets a client verify a whole range of records.
+*/
+
+EP_STAT
+cmd_get_proof(gdp_req_t *req)
+{
+	EP_STAT estat;
+	struct merkle_ckpt ckpt;
+	uint8_t path[MERKLE_MAXPATH][GDP_MERKLE_HASHLEN];
+	int npath;
+	int i;
+
+	estat = get_open_handle(req);
+	if (!EP_STAT_ISOK(estat))
+	{
+		return _gdp_req_nak_resp(req, GDP_NAK_C_BADREQ,
+							"cmd_get_proof: GOB not open", estat);
+	}
+
+	GdpMessage__CmdGetProof *payload;
+	GET_PAYLOAD(req, cmd_get_proof, CMD_GET_PROOF);
+	CMD_TRACE(req->cpdu->msg->cmd, "%s %" PRIgdp_recno,
+			req->gob->pname, payload->recno);
+
+	estat = merkle_get_proof(req->gob, payload->recno,
+					payload->has_treesize ? payload->treesize : 0,
+					&ckpt, path, &npath);
+	if (!EP_STAT_ISOK(estat))
+	{
+		return _gdp_req_nak_resp(req, 0,
+							"cmd_get_proof: no proof", estat);
+	}
+
+	_gdp_req_ack_resp(req, GDP_ACK_SUCCESS);
+	GdpMessage__AckSuccess *resp = req->rpdu->msg->ack_success;
+	resp->recno = req->gob->nrecs;
+	resp->proof = ep_mem_malloc(sizeof *resp->proof);
+	merkle_proof__init(resp->proof);
+	resp->proof->recno = payload->recno;
+	resp->proof->n_path = npath;
+	resp->proof->path = ep_mem_malloc(npath * sizeof *resp->proof->path + 1);
+	for (i = 0; i < npath; i++)
+	{
+		resp->proof->path[i].data = ep_mem_malloc(GDP_MERKLE_HASHLEN);
+		memcpy(resp->proof->path[i].data, path[i], GDP_MERKLE_HASHLEN);
+		resp->proof->path[i].len = GDP_MERKLE_HASHLEN;
+	}
+
+	MerkleCheckpoint *pbc = ep_mem_malloc(sizeof *pbc);
+	merkle_checkpoint__init(pbc);
+	resp->proof->ckpt = pbc;
+	pbc->treesize = ckpt.treesize;
+	pbc->root.data = ep_mem_malloc(GDP_MERKLE_HASHLEN);
+	memcpy(pbc->root.data, ckpt.root, GDP_MERKLE_HASHLEN);
+	pbc->root.len = GDP_MERKLE_HASHLEN;
+	pbc->ts = ep_mem_malloc(sizeof *pbc->ts);
+	gdp_timestamp__init(pbc->ts);
+	pbc->ts->sec = ckpt.ts.tv_sec;
+	pbc->ts->has_sec = true;
+	pbc->ts->nsec = ckpt.ts.tv_nsec;
+	pbc->ts->has_nsec = pbc->ts->nsec != 0;
+	if (ckpt.siglen > 0)
+	{
+		pbc->sig.data = ep_mem_malloc(ckpt.siglen);
+		memcpy(pbc->sig.data, ckpt.sig, ckpt.siglen);
+		pbc->sig.len = ckpt.siglen;
+		pbc->has_sig = true;
+	}
+	return estat;
+}
+
+
+/*
+**  CMD_REPLICATE --- send a batch of records to a follower
+**
+**		The follower pulls from its own last record number, so we
+**		keep no per-follower state: each batch is just a bounded
+**		range read packed into one response.  The leader's record
+**		count and newest timestamp ride along so the follower can
+**		tell how far behind it is.
+*/
+
+#define REPL_MAXRECS_DEFAULT	256			// records per batch
+#define REPL_MAXBYTES_DEFAULT	60000		// must fit in one PDU
+
+struct repl_batch
+{
+	GdpDatum		**d;			// records collected so far
+	int				n_d;			// number of records in d
+	int				maxrecs;		// size of d
+	size_t			nbytes;			// approximate encoded size
+	size_t			maxbytes;		// budget for nbytes
+	EP_TIME_SPEC	newest;			// timestamp of newest record
+};
+
+static EP_STAT
+repl_collect(EP_STAT estat, gdp_datum_t *datum, gdp_result_ctx_t *cb_ctx)
+{
+	struct repl_batch *rb = (struct repl_batch *) cb_ctx;
+	GdpDatum *pbd;
+	size_t l;
+
+	if (!EP_STAT_ISOK(estat) || datum == NULL)
+		return EP_STAT_OK;
+	if (rb->n_d >= rb->maxrecs)
+		return GDP_STAT_READ_BUDGET;
+	pbd = (GdpDatum *) ep_mem_malloc(sizeof *pbd);
+	gdp_datum__init(pbd);
+	_gdp_datum_to_pb(datum, NULL, pbd);
+	l = gdp_datum__get_packed_size(pbd) + 8;
+	if (rb->n_d > 0 && rb->nbytes + l > rb->maxbytes)
+	{
+		gdp_datum__free_unpacked(pbd, &_GdpProtobufAllocator);
+		return GDP_STAT_READ_BUDGET;
+	}
+	rb->nbytes += l;
+	rb->d[rb->n_d++] = pbd;
+	return EP_STAT_OK;
+}
+
+static EP_STAT
+repl_newest(EP_STAT estat, gdp_datum_t *datum, gdp_result_ctx_t *cb_ctx)
+{
+	struct repl_batch *rb = (struct repl_batch *) cb_ctx;
+
+	if (EP_STAT_ISOK(estat) && datum != NULL)
+		rb->newest = datum->ts;
+	return EP_STAT_OK;
+}
+
+EP_STAT
+cmd_replicate(gdp_req_t *req)
+{
+	EP_STAT estat;
+	gdp_gob_t *gob;
+	gdp_name_t gobname;
+	gdp_pname_t pname;
+	struct repl_batch rb;
+	gdp_recno_t nrecs = 0;
+	uint8_t *mdbuf = NULL;
+	size_t mdlen = 0;
+
+	if (!GDP_NAME_SAME(req->cpdu->dst, _GdpMyRoutingName))
+	{
+		// this is directed to a GOB, not to the daemon
+		return _gdp_req_nak_resp(req, GDP_NAK_C_BADREQ,
+						"cmd_replicate: must be sent to log server",
+						GDP_STAT_NAK_BADREQ);
+	}
+
+	GdpMessage__CmdReplicate *payload;
+	GET_PAYLOAD(req, cmd_replicate, CMD_REPLICATE);
+	if (payload->logname.len != sizeof gobname ||
+			!gdp_name_is_valid(payload->logname.data))
+	{
+		return _gdp_req_nak_resp(req, GDP_NAK_C_BADREQ,
+						"cmd_replicate: improper log name",
+						GDP_STAT_GDP_NAME_INVALID);
+	}
+	if (payload->start < 1)
+	{
+		return _gdp_req_nak_resp(req, GDP_NAK_C_BADREQ,
+						"cmd_replicate: start must be > 0",
+						GDP_STAT_NAK_BADREQ);
+	}
+	memcpy(gobname, payload->logname.data, sizeof gobname);
+
+	memset(&rb, 0, sizeof rb);
+	rb.maxrecs = ep_adm_getintparam("swarm.gdplogd.replica.maxrecs",
+							REPL_MAXRECS_DEFAULT);
+	if (payload->has_maxrecs && payload->maxrecs > 0 &&
+			payload->maxrecs < rb.maxrecs)
+		rb.maxrecs = payload->maxrecs;
+	if (rb.maxrecs <= 0)
+		rb.maxrecs = 1;
+	rb.maxbytes = ep_adm_getlongparam("swarm.gdplogd.replica.maxbytes",
+							REPL_MAXBYTES_DEFAULT);
+	rb.d = (GdpDatum **) ep_mem_zalloc(rb.maxrecs * sizeof *rb.d);
+
+	CMD_TRACE(req->cpdu->msg->cmd, "%s %" PRIgdp_recno,
+			gdp_printable_name(gobname, pname), payload->start);
+
+	// lock ordering: GOB before req (no one else has this req)
+	_gdp_req_unlock(req);
+	estat = get_open_gob(gobname, &gob);
+	if (EP_STAT_ISOK(estat))
+	{
+		estat = gob->x->physimpl->read_by_recno(gob, payload->start,
+								rb.maxrecs, repl_collect, &rb);
+		if (gob->nrecs > 0)
+			(void) gob->x->physimpl->read_by_recno(gob, gob->nrecs, 1,
+								repl_newest, &rb);
+		nrecs = gob->nrecs;
+		if (payload->start == 1)
+			mdlen = _gdp_md_serialize(gob->gob_md, &mdbuf);
+		admin_post_stats(ADMIN_LOG_READ, "replicate",
+				"log-name", gob->pname,
+				NULL, NULL);
+		_gdp_gob_decref(&gob, false);
+
+		// running off the end just means the follower is caught up
+		if (EP_STAT_IS_SAME(estat, GDP_STAT_READ_BUDGET) ||
+				EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOTFOUND) ||
+				EP_STAT_IS_SAME(estat, GDP_STAT_ACK_END_OF_RESULTS))
+			estat = EP_STAT_OK;
+	}
+	_gdp_req_lock(req);
+
+	if (EP_STAT_ISOK(estat))
+	{
+		_gdp_req_ack_resp(req, GDP_ACK_SUCCESS);
+		GdpMessage__AckSuccess *resp = req->rpdu->msg->ack_success;
+		resp->recno = nrecs;
+		resp->has_recno = true;
+		resp->ts = (GdpTimestamp *) ep_mem_malloc(sizeof *resp->ts);
+		gdp_timestamp__init(resp->ts);
+		resp->ts->sec = rb.newest.tv_sec;
+		resp->ts->has_sec = true;
+		resp->ts->nsec = rb.newest.tv_nsec;
+		resp->ts->has_nsec = resp->ts->nsec != 0;
+		if (mdbuf != NULL)
+		{
+			resp->metadata.data = mdbuf;
+			resp->metadata.len = mdlen;
+			resp->has_metadata = true;
+			mdbuf = NULL;
+		}
+		resp->dl = (GdpDatumList *) ep_mem_malloc(sizeof *resp->dl);
+		gdp_datum_list__init(resp->dl);
+		resp->dl->n_d = rb.n_d;
+		resp->dl->d = rb.d;			// message now owns the records
+		rb.d = NULL;
+		rb.n_d = 0;
+	}
+	else
+	{
+		estat = _gdp_req_nak_resp(req, 0, "cmd_replicate", estat);
+	}
+
+	while (rb.n_d > 0)
+		gdp_datum__free_unpacked(rb.d[--rb.n_d], &_GdpProtobufAllocator);
+	if (rb.d != NULL)
+		ep_mem_free(rb.d);
+	if (mdbuf != NULL)
+		ep_mem_free(mdbuf);
+	return estat;
+}
+
+
 /*
 **  CMD_FWD_APPEND --- forwarded APPEND command
 **
@@ -1306,7 +2051,7 @@ cmd_fwd_append(gdp_req_t *req)
 								"cmd_fwd_append: gobname required",
 								GDP_STAT_GDP_NAME_INVALID);
 		}
-		memcpy(req->cpdu->dst, gobname, sizeof req->cpdu->dst);
+		_gdp_req_set_dst(req, gobname);
 
 		ep_dbg_cprintf(Dbg, 14, "cmd_fwd_append: %s\n",
 				gdp_printable_name(req->cpdu->dst, pbuf));
@@ -1351,6 +2096,11 @@ static struct cmdfuncs	CmdFuncs[] =
 //	{ GDP_CMD_FWD_APPEND,			cmd_fwd_append			},
 	{ GDP_CMD_UNSUBSCRIBE,			cmd_unsubscribe			},
 	{ GDP_CMD_DELETE,				cmd_delete				},
+	{ GDP_CMD_MULTIREAD,			cmd_multiread			},
+	{ GDP_CMD_SUBSCRIBE_GROUP,		cmd_subscribe_group		},
+	{ GDP_CMD_GET_PROOF,			cmd_get_proof			},
+	{ GDP_CMD_REPLICATE,			cmd_replicate			},
+	{ GDP_CMD_SUBSCRIBE_CREDIT,		cmd_subscribe_credit	},
 	{ 0,							NULL					}
 };
 
@@ -31,6 +31,7 @@
 */
 
 #include "logd.h"
+#include "logd_admin.h"
 #include "logd_pubsub.h"
 
 #include <gdp/gdp_priv.h>
@@ -38,6 +39,13 @@
 #include <ep/ep.h>
 #include <ep/ep_dbg.h>
 #include <ep/ep_hash.h>
+#include <ep/ep_metric.h>
+#include <ep/ep_string.h>
+
+#include <event2/event.h>
+
+#include <string.h>
+#include <strings.h>
 
 #include <sys/queue.h>
 
@@ -46,6 +54,20 @@ static EP_DBG	Dbg = EP_DBG_INIT("gdplogd.pubsub",
 
 extern EP_HASH	*_OpenGOBCache;		// associative cache
 
+static EP_METRIC	Notifications = EP_METRIC_COUNTER_INIT("pubsub",
+						"notifications_total",
+						"Notifications queued for subscribers");
+static EP_METRIC	Dropped = EP_METRIC_COUNTER_INIT("pubsub",
+						"records_dropped_total",
+						"Records not sent to slow subscribers");
+static EP_METRIC	Evictions = EP_METRIC_COUNTER_INIT("pubsub",
+						"evictions_total",
+						"Subscribers evicted for being too slow");
+static EP_METRIC	Queues = EP_METRIC_GAUGE_INIT("pubsub",
+						"queues", "Subscriber output queues");
+
+static void		sub_group_notify(gdp_gob_t *gob, GdpDatum *pbd);
+
 
 /*
 **  SUB_SEND_MESSAGE_NOTIFICATION --- inform a subscriber of a new message
@@ -84,9 +106,540 @@ sub_send_message_notification(gdp_req_t *req)
 }
 
 
+/*
+**  Subscription output queues
+**
+**		Notifications are not sent from the append path.  Each
+**		subscription has a bounded queue of packed messages (shared
+**		between subscribers, see _gdp_pdu_share) that is drained in
+**		the I/O thread.  An append only adds a reference to each
+**		queue, so slow or numerous subscribers don't slow writers.
+**
+**		When a queue is full swarm.gdplogd.subscr.queue.policy says
+**		what to do:
+**			drop		drop the new record; the subscriber gets a
+**						"missing record" notice before the next one
+**			coalesce	throw away what is queued and keep only the
+**						newest record (again with a notice)
+**			evict		end the subscription
+**
+**		The drain stops while more than
+**		swarm.gdplogd.subscr.queue.highwater bytes are waiting in
+**		the channel and tries again shortly, so a congested channel
+**		backs up into the queues (where the policy applies) rather
+**		than into unbounded channel buffers.
+**
+**		Locking: each queue has its own mutex; OutqMutex protects
+**		the ready list and the list of all queues.  The two are
+**		never held at the same time.
+*/
+
+#define SUBQ_POLICY_DROP		0
+#define SUBQ_POLICY_COALESCE	1
+#define SUBQ_POLICY_EVICT		2
+
+#define SUBQ_BATCH				32			// max sent per queue per pass
+#define SUBQ_RETRY_USEC			10000		// retry when channel backed up
+
+struct sub_qent
+{
+	gdp_pdu_shared_t		*sh;			// packed message
+	gdp_recno_t				recno;			// last record (0 if not data)
+	gdp_recno_t				gap_first;		// records dropped before this
+	gdp_recno_t				gap_count;		//    ... and how many
+};
+
+struct sub_outq
+{
+	EP_THR_MUTEX			mutex;			// protects everything below
+	int						refcnt;			// req + ready list
+	gdp_chan_t				*chan;			// where to send
+	gdp_name_t				src;			// log name
+	gdp_name_t				dst;			// subscriber
+	gdp_rid_t				rid;			// subscriber's request id
+	gdp_l5seqno_t			l5seqno;		// from subscribe command
+	struct sub_qent			*ents;			// ring buffer
+	int						nslots;			// size of ents
+	int						head;			// index of oldest entry
+	int						count;			// entries in use
+	int						ndata;			// data entries in use
+	bool					ready;			// on OutqReady
+	gdp_recno_t				gap_first;		// pending gap (0 => none)
+	gdp_recno_t				gap_count;		// records in pending gap
+	uint64_t				ndropped;		// records dropped, total
+	uint64_t				nreported;		// ndropped at last report
+	gdp_recno_t				last_queued;	// newest record queued
+	gdp_recno_t				last_taken;		// newest record taken to send
+	gdp_recno_t				last_sent;		// newest record sent
+	TAILQ_ENTRY(sub_outq)	readyq;			// on OutqReady
+	LIST_ENTRY(sub_outq)	all;			// on OutqAll
+};
+
+static EP_THR_MUTEX				OutqMutex	EP_THR_MUTEX_INITIALIZER2(
+												GDP_MUTEX_LORDER_LEAF);
+static TAILQ_HEAD(, sub_outq)	OutqReady = TAILQ_HEAD_INITIALIZER(OutqReady);
+static LIST_HEAD(, sub_outq)	OutqAll = LIST_HEAD_INITIALIZER(OutqAll);
+static struct event				*OutqEvent;		// runs drain in I/O thread
+
+// parameters, read once at startup by sub_init
+static long						SubTimeout;		// seconds
+static int						SubqMax;		// data entries per queue
+static int						SubqPolicy;
+static size_t					SubqHighwater;	// bytes in channel
+static int						SubCatchupChunk;	// records per catch-up pass
+
+/*
+**  SUB_INIT --- read subscription parameters and register metrics
+**
+**		Called once from gdplogd startup, before any commands
+**		arrive.
+*/
+
+void
+sub_init(void)
+{
+	const char *policy;
+
+	SubTimeout = ep_adm_getlongparam("swarm.gdplogd.subscr.timeout", 0);
+	if (SubTimeout == 0)
+		SubTimeout = ep_adm_getlongparam("swarm.gdp.subscr.timeout",
+								GDP_SUBSCR_TIMEOUT_DEF);
+	SubqMax = ep_adm_getintparam("swarm.gdplogd.subscr.queue.max", 256);
+	if (SubqMax < 1)
+		SubqMax = 1;
+	SubqHighwater = ep_adm_getlongparam("swarm.gdplogd.subscr.queue.highwater",
+								1024 * 1024);
+	SubCatchupChunk = ep_adm_getintparam("swarm.gdplogd.subscr.catchup.chunk",
+								64);
+	if (SubCatchupChunk < 1)
+		SubCatchupChunk = 1;
+	policy = ep_adm_getstrparam("swarm.gdplogd.subscr.queue.policy", "drop");
+	if (strcasecmp(policy, "coalesce") == 0)
+		SubqPolicy = SUBQ_POLICY_COALESCE;
+	else if (strcasecmp(policy, "evict") == 0)
+		SubqPolicy = SUBQ_POLICY_EVICT;
+	else
+	{
+		if (strcasecmp(policy, "drop") != 0)
+			ep_app_warn("swarm.gdplogd.subscr.queue.policy: "
+					"unknown policy %s, using drop", policy);
+		SubqPolicy = SUBQ_POLICY_DROP;
+	}
+	ep_metric_register(&Notifications);
+	ep_metric_register(&Dropped);
+	ep_metric_register(&Evictions);
+	ep_metric_register(&Queues);
+}
+
+// compute the oldest activity time for a live subscription
+static void
+sub_timeout_ts(EP_TIME_SPEC *sub_timeout)
+{
+	EP_TIME_SPEC sub_delta;
+
+	ep_time_from_nsec(-SubTimeout SECONDS, &sub_delta);
+	ep_time_deltanow(&sub_delta, sub_timeout);
+}
+
+// drop all entries (queue must be locked)
+static void
+outq_flush(struct sub_outq *q)
+{
+	while (q->count > 0)
+	{
+		struct sub_qent *e = &q->ents[q->head];
+
+		if (e->recno != 0)
+			q->ndata--;
+		_gdp_pdu_share_free(&e->sh);
+		q->head = (q->head + 1) % q->nslots;
+		q->count--;
+	}
+}
+
+static void
+outq_decref(struct sub_outq *q)
+{
+	int refcnt;
+
+	ep_thr_mutex_lock(&q->mutex);
+	refcnt = --q->refcnt;
+	ep_thr_mutex_unlock(&q->mutex);
+	if (refcnt > 0)
+		return;
+
+	ep_thr_mutex_lock(&OutqMutex);
+	LIST_REMOVE(q, all);
+	ep_thr_mutex_unlock(&OutqMutex);
+	outq_flush(q);
+	ep_thr_mutex_destroy(&q->mutex);
+	ep_mem_free(q->ents);
+	ep_mem_free(q);
+	ep_metric_add(&Queues, -1);
+}
+
+static void		outq_drain(int fd, short what, void *unused);
+
+// attach a new output queue to a subscription
+static struct sub_outq *
+outq_new(gdp_req_t *req, gdp_name_t src)
+{
+	struct sub_outq *q;
+
+	q = (struct sub_outq *) ep_mem_zalloc(sizeof *q);
+	ep_thr_mutex_init(&q->mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_mutex_setorder(&q->mutex, GDP_MUTEX_LORDER_LEAF);
+	q->refcnt = 1;
+	q->chan = req->chan;
+	memcpy(q->src, src, sizeof q->src);
+	memcpy(q->dst, req->cpdu->src, sizeof q->dst);
+	q->rid = req->cpdu->msg->rid;
+	q->l5seqno = req->cpdu->msg->l5seqno;
+
+	// room for the end-of-subscription (or eviction) notice
+	q->nslots = SubqMax + 1;
+	q->ents = (struct sub_qent *) ep_mem_zalloc(q->nslots * sizeof *q->ents);
+
+	ep_thr_mutex_lock(&OutqMutex);
+	LIST_INSERT_HEAD(&OutqAll, q, all);
+	ep_metric_inc(&Queues);
+	if (OutqEvent == NULL)
+		OutqEvent = event_new(_GdpIoEventBase, -1, 0, outq_drain, NULL);
+	ep_thr_mutex_unlock(&OutqMutex);
+
+	req->outq = q;
+	req->outq_release = outq_decref;
+	return q;
+}
+
+/*
+**  OUTQ_PUT --- add a message to a subscriber's queue
+**
+**		recno is the last record in the message, or zero if it
+**		isn't data (e.g., end of subscription), in which case it
+**		is always accepted.  Returns false if the subscriber must
+**		be evicted.
+*/
+
+static bool
+outq_put(struct sub_outq *q,
+		gdp_pdu_shared_t *sh,
+		gdp_recno_t first,
+		gdp_recno_t recno)
+{
+	bool schedule = false;
+	struct sub_qent *e;
+
+	ep_thr_mutex_lock(&q->mutex);
+	if (recno != 0 && q->ndata >= SubqMax)
+	{
+		gdp_recno_t nrecs = recno - first + 1;
+
+		switch (SubqPolicy)
+		{
+		  case SUBQ_POLICY_EVICT:
+			ep_thr_mutex_unlock(&q->mutex);
+			return false;
+
+		  case SUBQ_POLICY_COALESCE:
+			// the records being thrown away become a gap
+			if (q->gap_first == 0 || q->gap_first > q->last_taken + 1)
+				q->gap_first = q->last_taken + 1;
+			q->ndropped += q->last_queued - q->last_taken;
+			ep_metric_add(&Dropped, q->last_queued - q->last_taken);
+			outq_flush(q);
+			q->gap_count = first - q->gap_first;
+			break;
+
+		  default:
+			if (q->gap_first == 0)
+				q->gap_first = first;
+			q->gap_count += nrecs;
+			q->ndropped += nrecs;
+			ep_metric_add(&Dropped, nrecs);
+			ep_thr_mutex_unlock(&q->mutex);
+			return true;
+		}
+	}
+	if (q->count >= q->nslots)
+	{
+		// only possible with several control messages; shouldn't happen
+		ep_thr_mutex_unlock(&q->mutex);
+		ep_dbg_cprintf(Dbg, 1, "outq_put: queue overflow\n");
+		return true;
+	}
+
+	e = &q->ents[(q->head + q->count++) % q->nslots];
+	e->sh = _gdp_pdu_share_ref(sh);
+	e->recno = recno;
+	e->gap_first = q->gap_first;
+	e->gap_count = q->gap_count;
+	q->gap_first = q->gap_count = 0;
+	if (recno != 0)
+	{
+		q->ndata++;
+		q->last_queued = recno;
+	}
+	if (!q->ready)
+	{
+		q->ready = true;
+		q->refcnt++;			// the ready list holds a reference
+		schedule = true;
+	}
+	ep_thr_mutex_unlock(&q->mutex);
+
+	if (schedule)
+	{
+		ep_thr_mutex_lock(&OutqMutex);
+		TAILQ_INSERT_TAIL(&OutqReady, q, readyq);
+		ep_thr_mutex_unlock(&OutqMutex);
+		event_active(OutqEvent, EV_TIMEOUT, 0);
+	}
+	return true;
+}
+
+// tell subscriber that records were dropped
+static void
+outq_send_gap(struct sub_outq *q, gdp_recno_t first, gdp_recno_t count)
+{
+	gdp_msg_t *msg;
+	gdp_pdu_t *pdu;
+	char dbuf[80];
+
+	msg = _gdp_msg_new(GDP_NAK_C_REC_MISSING, q->rid, q->l5seqno);
+	msg->nak->ep_stat = EP_STAT_TO_INT(GDP_STAT_NAK_REC_MISSING);
+	msg->nak->has_ep_stat = true;
+	msg->nak->recno = first;
+	msg->nak->has_recno = true;
+	snprintf(dbuf, sizeof dbuf,
+			"%" PRIgdp_recno " records dropped (subscriber too slow)", count);
+	msg->nak->description = ep_mem_strdup(dbuf);
+	pdu = _gdp_pdu_new(msg, q->src, q->dst, GDP_SEQNO_NONE);
+	(void) _gdp_pdu_out(pdu, q->chan);
+	_gdp_pdu_free(&pdu);
+}
+
+/*
+**  OUTQ_DRAIN --- send queued notifications (in I/O thread)
+**
+**		Queues take turns, a batch at a time.
+*/
+
+static void
+outq_drain(int fd, short what, void *unused)
+{
+	for (;;)
+	{
+		struct sub_outq *q;
+		struct sub_qent ents[SUBQ_BATCH];
+		int n = 0;
+		int i;
+		bool more;
+
+		ep_thr_mutex_lock(&OutqMutex);
+		if ((q = TAILQ_FIRST(&OutqReady)) != NULL)
+			TAILQ_REMOVE(&OutqReady, q, readyq);
+		ep_thr_mutex_unlock(&OutqMutex);
+		if (q == NULL)
+			return;
+
+		if (_gdp_chan_get_outlen(q->chan) > SubqHighwater)
+		{
+			// channel is backed up; let it drain first
+			struct timeval tv = { 0, SUBQ_RETRY_USEC };
+
+			ep_dbg_cprintf(Dbg, 20, "outq_drain: channel backed up\n");
+			ep_thr_mutex_lock(&OutqMutex);
+			TAILQ_INSERT_HEAD(&OutqReady, q, readyq);
+			ep_thr_mutex_unlock(&OutqMutex);
+			event_add(OutqEvent, &tv);
+			return;
+		}
+
+		ep_thr_mutex_lock(&q->mutex);
+		while (n < SUBQ_BATCH && q->count > 0)
+		{
+			ents[n] = q->ents[q->head];
+			if (ents[n].recno != 0)
+			{
+				q->ndata--;
+				q->last_taken = ents[n].recno;
+			}
+			q->head = (q->head + 1) % q->nslots;
+			q->count--;
+			n++;
+		}
+		more = q->count > 0;
+		if (!more)
+			q->ready = false;
+		ep_thr_mutex_unlock(&q->mutex);
+
+		for (i = 0; i < n; i++)
+		{
+			if (ents[i].gap_count > 0)
+				outq_send_gap(q, ents[i].gap_first, ents[i].gap_count);
+			(void) _gdp_pdu_out_shared(ents[i].sh, q->src, q->dst,
+							q->rid, q->l5seqno, q->chan);
+			_gdp_pdu_share_free(&ents[i].sh);
+		}
+
+		ep_thr_mutex_lock(&q->mutex);
+		for (i = 0; i < n; i++)
+		{
+			if (ents[i].recno > q->last_sent)
+				q->last_sent = ents[i].recno;
+		}
+		ep_thr_mutex_unlock(&q->mutex);
+
+		if (more)
+		{
+			ep_thr_mutex_lock(&OutqMutex);
+			TAILQ_INSERT_TAIL(&OutqReady, q, readyq);
+			ep_thr_mutex_unlock(&OutqMutex);
+		}
+		else
+		{
+			outq_decref(q);			// ready list reference
+		}
+	}
+}
+
+
+/*
+**  SUB_EVICT --- give up on a subscriber that can't keep up
+**
+**		Whatever is queued is thrown away and replaced by a "lost
+**		subscription" notice.  The caller frees the req; the queue
+**		lives on until the notice has been sent.
+*/
+
+static void
+sub_evict(gdp_req_t *req, gdp_recno_t last)
+{
+	struct sub_outq *q = req->outq;
+	gdp_msg_t *msg;
+	gdp_pdu_shared_t *sh;
+
+	if (ep_dbg_test(Dbg, 5))
+	{
+		ep_dbg_printf("sub_evict: subscriber too slow: ");
+		_gdp_req_dump(req, ep_dbg_getfile(), GDP_PR_BASIC, 0);
+	}
+
+	ep_thr_mutex_lock(&q->mutex);
+	if (last > q->last_taken)
+	{
+		q->ndropped += last - q->last_taken;
+		ep_metric_add(&Dropped, last - q->last_taken);
+	}
+	ep_metric_inc(&Evictions);
+	q->last_queued = q->last_taken;
+	outq_flush(q);
+	q->gap_first = q->gap_count = 0;
+	ep_thr_mutex_unlock(&q->mutex);
+
+	msg = _gdp_msg_new(GDP_NAK_S_LOST_SUBSCR, q->rid, q->l5seqno);
+	sh = _gdp_pdu_share(msg);
+	_gdp_msg_free(&msg);
+	(void) outq_put(q, sh, 0, 0);
+	_gdp_pdu_share_free(&sh);
+}
+
+
+/*
+**  SUB_REPORT_QUEUES --- report subscriber lag and drops
+**
+**		Only subscribers that are behind or have dropped records
+**		since the last report are listed.
+*/
+
+struct outq_report
+{
+	gdp_pname_t		log;
+	gdp_pname_t		subscriber;
+	gdp_rid_t		rid;
+	int				queued;
+	gdp_recno_t		lag;
+	uint64_t		ndropped;
+};
+
+static void
+sub_report_queues(void)
+{
+	struct sub_outq *q;
+	struct outq_report *rpt = NULL;
+	int nrpt = 0;
+	int maxrpt = 0;
+	int i;
+
+	ep_thr_mutex_lock(&OutqMutex);
+	LIST_FOREACH(q, &OutqAll, all)
+	{
+		struct outq_report r;
+
+		ep_thr_mutex_lock(&q->mutex);
+		r.queued = q->ndata;
+		r.lag = q->last_queued > q->last_sent ?
+					q->last_queued - q->last_sent : 0;
+		r.ndropped = q->ndropped;
+		r.rid = q->rid;
+		if (r.lag == 0 && q->ndropped == q->nreported)
+		{
+			ep_thr_mutex_unlock(&q->mutex);
+			continue;
+		}
+		q->nreported = q->ndropped;
+		gdp_printable_name(q->src, r.log);
+		gdp_printable_name(q->dst, r.subscriber);
+		ep_thr_mutex_unlock(&q->mutex);
+
+		if (nrpt >= maxrpt)
+		{
+			maxrpt = maxrpt == 0 ? 16 : maxrpt * 2;
+			rpt = (struct outq_report *) ep_mem_realloc(rpt,
+									maxrpt * sizeof *rpt);
+		}
+		rpt[nrpt++] = r;
+	}
+	ep_thr_mutex_unlock(&OutqMutex);
+
+	for (i = 0; i < nrpt; i++)
+	{
+		char ridbuf[20];
+		char queuedbuf[20];
+		char lagbuf[40];
+		char dropbuf[40];
+
+		snprintf(ridbuf, sizeof ridbuf, "%" PRIgdp_rid, rpt[i].rid);
+		snprintf(queuedbuf, sizeof queuedbuf, "%d", rpt[i].queued);
+		snprintf(lagbuf, sizeof lagbuf, "%" PRIgdp_recno, rpt[i].lag);
+		snprintf(dropbuf, sizeof dropbuf, "%" PRIu64, rpt[i].ndropped);
+		ep_dbg_cprintf(Dbg, 10, "subscriber %s rid %s on %s: "
+				"lag %s, queued %s, dropped %s\n",
+				rpt[i].subscriber, ridbuf, rpt[i].log,
+				lagbuf, queuedbuf, dropbuf);
+		admin_post_stats(ADMIN_LOG_SUBSCR, "subscr-queue",
+				"log-name", rpt[i].log,
+				"subscriber", rpt[i].subscriber,
+				"rid", ridbuf,
+				"lag-records", lagbuf,
+				"queued", queuedbuf,
+				"dropped", dropbuf,
+				NULL, NULL);
+	}
+	if (rpt != NULL)
+		ep_mem_free(rpt);
+}
+
+
 /*
 **  SUB_NOTIFY_ALL_SUBSCRIBERS --- send something to all interested parties
 **
+**		The notification is packed once and shared by reference;
+**		only the destination, rid, and l5seqno are written per
+**		subscriber (see _gdp_pdu_share).  Nothing is sent from
+**		here: the message is put on each subscriber's output queue.
+**
 **		pubreq should be locked when this is called.
 */
 
@@ -95,7 +648,9 @@ sub_notify_all_subscribers(gdp_req_t *pubreq)
 {
 	gdp_req_t *req;
 	gdp_req_t *nextreq;
-	long timeout;
+	gdp_pdu_shared_t *shared = NULL;	// packed once for all subscribers
+	gdp_recno_t first = 0;				// records in notification
+	gdp_recno_t last = 0;
 	EP_TIME_SPEC sub_timeout;
 
 	EP_THR_MUTEX_ASSERT_ISLOCKED(&pubreq->mutex);
@@ -104,16 +659,19 @@ sub_notify_all_subscribers(gdp_req_t *pubreq)
 	EP_ASSERT_ELSE(pubreq->rpdu->msg != NULL, return);
 
 	// set up for subscription timeout
+	sub_timeout_ts(&sub_timeout);
+
+	// queue limits are in records
+	if (pubreq->rpdu->msg->body_case == GDP_MESSAGE__BODY_ACK_CONTENT &&
+			pubreq->rpdu->msg->ack_content->dl->n_d > 0)
 	{
-		EP_TIME_SPEC sub_delta;
-		timeout = ep_adm_getlongparam("swarm.gdplogd.subscr.timeout", 0);
+		GdpDatumList *dl = pubreq->rpdu->msg->ack_content->dl;
 
-		if (timeout == 0)
-			timeout = ep_adm_getlongparam("swarm.gdp.subscr.timeout",
-									GDP_SUBSCR_TIMEOUT_DEF);
-		ep_time_from_nsec(-timeout SECONDS, &sub_delta);
-		ep_time_deltanow(&sub_delta, &sub_timeout);
+		first = dl->d[0]->recno;
+		last = dl->d[dl->n_d - 1]->recno;
 	}
+	if (last < first || first == 0)
+		first = last = pubreq->gob->nrecs;
 
 	if (ep_dbg_test(Dbg, 32))
 	{
@@ -122,7 +680,7 @@ sub_notify_all_subscribers(gdp_req_t *pubreq)
 
 		ep_time_now(&now);
 		ep_dbg_printf("sub_notify_all_subscribers(timeout=%ld, now=%s)\n",
-					timeout,
+					SubTimeout,
 					ep_time_format(&now, tbuf, sizeof tbuf, EP_TIME_FMT_HUMAN));
 		ep_dbg_printf("%spub", _gdp_pr_indent(1));
 		_gdp_req_dump(pubreq, ep_dbg_getfile(), GDP_PR_BASIC, 1);
@@ -157,15 +715,28 @@ sub_notify_all_subscribers(gdp_req_t *pubreq)
 		}
 		else if (!ep_time_before(&req->act_ts, &sub_timeout))
 		{
-			EP_STAT estat;
 			EP_ASSERT_ELSE(req->cpdu != NULL, continue);
 			EP_ASSERT_ELSE(req->cpdu->msg != NULL, continue);
-			gdp_pdu_t *save_pdu = req->rpdu;
-			req->rpdu = pubreq->rpdu;
-			estat = sub_send_message_notification(req);
-			req->rpdu = save_pdu;
-			if (EP_STAT_ISOK(estat))
+
+			// pack the notification once, on first use
+			if (shared == NULL)
+				shared = _gdp_pdu_share(pubreq->rpdu->msg);
+			if (ep_dbg_test(Dbg, 33))
+			{
+				ep_dbg_printf("sub_notify_all_subscribers: notifying ");
+				_gdp_req_dump(req, NULL, GDP_PR_BASIC, 0);
+			}
+			if (req->outq == NULL)
+				(void) outq_new(req, pubreq->rpdu->src);
+			if (!outq_put(req->outq, shared, first, last))
+			{
+				sub_evict(req, last);
+				_gdp_req_free(&req);
+			}
+			else
 			{
+				ep_metric_inc(&Notifications);
+
 				// XXX: This won't really work in case of holes.
 				req->nextrec++;
 
@@ -201,6 +772,15 @@ sub_notify_all_subscribers(gdp_req_t *pubreq)
 			_gdp_req_unlock(req);
 	}
 	pubreq->gob->flags &= ~GOBF_KEEPLOCKED;
+	_gdp_pdu_share_free(&shared);
+
+	// now any group subscriptions that include this GOB
+	if (!LIST_EMPTY(&pubreq->gob->x->groupsubs) &&
+			pubreq->rpdu->msg->body_case == GDP_MESSAGE__BODY_ACK_CONTENT &&
+			pubreq->rpdu->msg->ack_content->dl->n_d > 0)
+	{
+		sub_group_notify(pubreq->gob, pubreq->rpdu->msg->ack_content->dl->d[0]);
+	}
 }
 
 
@@ -224,8 +804,7 @@ sub_end_subscription(gdp_req_t *req)
 	if (EP_UT_BITSET(GDP_REQ_ON_GOB_LIST, req->flags))
 	{
 		gdp_gob_t *gob = req->gob;
-		LIST_REMOVE(req, goblist);
-		req->flags &= ~GDP_REQ_ON_GOB_LIST;
+		_gdp_req_gob_unlink(req);
 		EP_ASSERT(gob->refcnt > 1);
 		_gdp_gob_decref(&gob, true);
 	}
@@ -251,201 +830,971 @@ sub_end_subscription(gdp_req_t *req)
 		_gdp_req_dump(req, ep_dbg_getfile(), GDP_PR_BASIC, 0);
 	}
 
-	(void) _gdp_pdu_out(req->rpdu, req->chan);
+	if (req->outq != NULL)
+	{
+		// must follow any notifications still queued
+		gdp_pdu_shared_t *sh;
+
+		sh = _gdp_pdu_share(req->rpdu->msg);
+		(void) outq_put(req->outq, sh, 0, 0);
+		_gdp_pdu_share_free(&sh);
+	}
+	else
+	{
+		(void) _gdp_pdu_out(req->rpdu, req->chan);
+	}
 }
 
 
 /*
-**  Unsubscribe all requests for a given gob and destination.
-**  Can also optionally select a particular request id.
+**  Subscription catch-up.
+**
+**		A subscription that starts before the end of the log goes on
+**		the GOB list at once, flagged as catching up, and the existing
+**		records are sent by a scan that runs in the thread pool a
+**		chunk at a time.  Appends don't notify these subscriptions;
+**		when a scan brings one to the end of the log it is switched
+**		to an ordinary subscription.  The scan and append both hold
+**		the GOB lock, so nothing can be appended between the last
+**		record the scan sends and the switch: each record goes out
+**		exactly once.
+**
+**		All subscriptions catching up on a GOB share the scan.  A
+**		pass starts from the subscription that has waited longest
+**		and picks up any others that are waiting for records in the
+**		same range; each record read is packed once and put on the
+**		output queue of every subscription that wants it.
+**
+**		No subscription is sent more than its credit (the window
+**		the client asked for, topped up by CMD_SUBSCRIBE_CREDIT) or
+**		more than fits in its output queue.  When nobody can take
+**		more the scan stops; new credit restarts it, and full queues
+**		are retried shortly.
 */
 
-EP_STAT
-sub_end_all_subscriptions(
-		gdp_gob_t *gob,
-		gdp_name_t dest,
-		gdp_rid_t rid)
+#define SUBC_RETRY_USEC			10000		// retry when queues are full
+
+struct catchup_scan
 {
-	EP_STAT estat;
-	gdp_req_t *req;
-	gdp_req_t *nextreq;
+	gdp_gob_t				*gob;			// log being scanned
+	uint32_t				pass;			// this pass number
+	gdp_recno_t				lo;				// first record in this pass
+	gdp_recno_t				hi;				// last record in this pass
+	gdp_recno_t				last;			// last record examined
+	int						nsent;			// records queued (all subs)
+};
 
-	if (ep_dbg_test(Dbg, 29))
+static void		catchup_run(void *gob_);
+
+// records this subscription can take right now (req locked)
+static int32_t
+catchup_room(gdp_req_t *req)
+{
+	int32_t room = req->sub_credit < 0 ? INT32_MAX : req->sub_credit;
+	int32_t space = SubqMax;
+
+	if (req->outq != NULL)
 	{
-		gdp_pname_t dst_p;
-		ep_dbg_printf("sub_end_all_subscriptions: rid %" PRIgdp_rid " dst %s\n    ",
-				rid, gdp_printable_name(dest, dst_p));
-		_gdp_gob_dump(gob, ep_dbg_getfile(), GDP_PR_BASIC, 1);
+		ep_thr_mutex_lock(&req->outq->mutex);
+		space -= req->outq->ndata;
+		ep_thr_mutex_unlock(&req->outq->mutex);
 	}
+	return space < room ? space : room;
+}
 
-	GDP_GOB_ASSERT_ISLOCKED(gob);
-	if (EP_UT_BITSET(GOBF_KEEPLOCKED, gob->flags) && ep_dbg_test(Dbg, 1))
-		ep_dbg_printf("sub_end_all_subscriptions: GOBF_KEEPLOCKED on entry\n");
-	gob->flags |= GOBF_KEEPLOCKED;
+static void
+catchup_timer(int fd, short what, void *gob_)
+{
+	ep_thr_pool_run_class(GDP_LANE_SUBSCR, catchup_run, gob_);
+}
 
-	do
-	{
-		estat = EP_STAT_OK;
-		for (req = LIST_FIRST(&gob->reqs); req != NULL; req = nextreq)
-		{
-			estat = _gdp_req_lock(req);
-			EP_STAT_CHECK(estat, break);
-			nextreq = LIST_NEXT(req, goblist);
-			if (!GDP_NAME_SAME(req->cpdu->dst, dest) ||
-					(rid != GDP_PDU_NO_RID && rid != req->cpdu->msg->rid) ||
-					!EP_ASSERT(req->gob == gob))
-			{
-				_gdp_req_unlock(req);
-				continue;
-			}
+// arrange for a scan pass (GOB locked)
+static void
+catchup_schedule(gdp_gob_t *gob, long usec)
+{
+	struct timeval tv = { 0, usec };
 
-			// remove subscription for this destination (but keep GOB locked)
-			if (ep_dbg_test(Dbg, 39))
-			{
-				ep_dbg_printf("sub_end_all_subscriptions removing ");
-				_gdp_req_dump(req, ep_dbg_getfile(), GDP_PR_BASIC, 0);
-			}
-			LIST_REMOVE(req, goblist);
-			req->flags &= ~GDP_REQ_ON_GOB_LIST;
-			_gdp_gob_decref(&req->gob, false);
-			_gdp_req_free(&req);
-		}
-	} while (!EP_STAT_ISOK(estat));
-	gob->flags &= ~GOBF_KEEPLOCKED;
-	return estat;
+	GDP_GOB_ASSERT_ISLOCKED(gob);
+	if (gob->x->catchup_sched)
+		return;
+	gob->x->catchup_sched = true;
+	(void) _gdp_gob_incref(gob);		// released by catchup_run
+	if (usec <= 0 ||
+			event_base_once(_GdpIoEventBase, -1, EV_TIMEOUT,
+						catchup_timer, gob, &tv) != 0)
+	{
+		ep_thr_pool_run_class(GDP_LANE_SUBSCR, catchup_run, gob);
+	}
 }
 
+// pack one record as a subscription notification
+static gdp_pdu_shared_t *
+catchup_pack(gdp_datum_t *datum)
+{
+	gdp_msg_t *msg;
+	GdpDatum *pbd;
+	GdpDatumList *dl;
+	gdp_pdu_shared_t *sh;
+
+	msg = _gdp_msg_new(GDP_ACK_CONTENT, GDP_PDU_NO_RID, GDP_PDU_NO_L5SEQNO);
+	pbd = (GdpDatum *) ep_mem_malloc(sizeof *pbd);
+	gdp_datum__init(pbd);
+	_gdp_datum_to_pb(datum, msg, pbd);
+	dl = msg->ack_content->dl;
+	dl->d = (GdpDatum **) ep_mem_malloc(sizeof *dl->d);
+	dl->n_d = 1;
+	dl->d[0] = pbd;
+	sh = _gdp_pdu_share(msg);
+	_gdp_msg_free(&msg);
+	return sh;
+}
 
 /*
-**  SUB_RECLAIM_RESOURCES --- remove any expired subscriptions
-**
-**		This is a bit tricky to get lock ordering correct.  The
-**		obvious implementation is to loop through the channel
-**		list, but when you try to lock a GOB or a request you
-**		have a lock ordering problem (the channel is quite low
-**		in the locking hierarchy).  Instead you run through
-**		the GOB hash table.
+**  CATCHUP_CB --- give one record to everyone waiting for it
+**
+**		A subscription wants the record if its next record is
+**		after the last one examined: anything in between is missing
+**		from the log.  Stops the read when nobody else in range can
+**		take more.
 */
 
-// helper (does most of the work)
-static void
-gob_reclaim_subscriptions(gdp_gob_t *gob)
+static EP_STAT
+catchup_cb(EP_STAT estat, gdp_datum_t *datum, gdp_result_ctx_t *ctx)
 {
-	int istat;
+	struct catchup_scan *cs = (struct catchup_scan *) ctx;
+	gdp_pdu_shared_t *sh = NULL;
 	gdp_req_t *req;
 	gdp_req_t *nextreq;
-	EP_TIME_SPEC sub_timeout;
-
-	// just in case
-	if (gob == NULL)
-		return;
+	int nwaiting = 0;
 
-	{
-		EP_TIME_SPEC sub_delta;
-		long timeout = ep_adm_getlongparam("swarm.gdp.subscr.timeout",
-								GDP_SUBSCR_TIMEOUT_DEF);
-
-		ep_time_from_nsec(-timeout SECONDS, &sub_delta);
-		ep_time_deltanow(&sub_delta, &sub_timeout);
-		ep_dbg_cprintf(Dbg, 39,
-				"gob_reclaim_subscriptions: GOB = %p, refcnt = %d, timeout = %ld\n",
-				gob, gob->refcnt, timeout);
-	}
+	if (!EP_STAT_ISOK(estat) || datum == NULL)
+		return EP_STAT_OK;
 
-	// don't even try locked GOBs
-	// first check is to avoid extraneous errors
-	if (EP_UT_BITSET(GOBF_ISLOCKED, gob->flags))
+	for (req = LIST_FIRST(&cs->gob->reqs); req != NULL; req = nextreq)
 	{
-		ep_dbg_cprintf(Dbg, 39, " ... skipping locked GOB\n");
-		return;
+		_gdp_req_lock(req);
+		nextreq = LIST_NEXT(req, goblist);
+		if (!EP_UT_BITSET(GDP_REQ_SRV_CATCHUP, req->flags) ||
+				req->nextrec <= cs->last || req->nextrec > cs->hi ||
+				catchup_room(req) <= 0)
+		{
+			_gdp_req_unlock(req);
+			continue;
+		}
+		if (req->nextrec <= datum->recno)
+		{
+			if (sh == NULL)
+				sh = catchup_pack(datum);
+			if (req->outq == NULL)
+				(void) outq_new(req, req->cpdu->dst);
+			(void) outq_put(req->outq, sh, datum->recno, datum->recno);
+			cs->nsent++;
+			req->nextrec = datum->recno + 1;
+			req->sub_pass = cs->pass;
+			if (req->sub_credit > 0)
+				req->sub_credit--;
+			if (req->numrecs > 0 && --req->numrecs <= 0)
+			{
+				req->flags &= ~GDP_REQ_SRV_CATCHUP;
+				sub_end_subscription(req);
+				_gdp_req_unlock(req);
+				continue;
+			}
+		}
+		if (req->nextrec <= cs->hi && catchup_room(req) > 0)
+			nwaiting++;
+		_gdp_req_unlock(req);
 	}
-	istat = ep_thr_mutex_trylock(&gob->mutex);
-	if (istat != 0)
+	_gdp_pdu_share_free(&sh);
+	cs->last = datum->recno;
+
+	// nothing else to do in this pass
+	if (nwaiting == 0)
+		return GDP_STAT_READ_BUDGET;
+	return EP_STAT_OK;
+}
+
+/*
+**  CATCHUP_RUN --- one pass of the catch-up scan (in a worker thread)
+*/
+
+static void
+catchup_run(void *gob_)
+{
+	gdp_gob_t *gob = (gdp_gob_t *) gob_;
+	struct catchup_scan cs;
+	gdp_req_t *req;
+	gdp_req_t *nextreq;
+	EP_STAT estat;
+	uint32_t oldest = 0;
+	bool found = false;
+	bool complete = false;				// read the whole range
+	bool failed = false;				// couldn't read the range
+	int nready = 0;						// can take more now
+	int nblocked = 0;					// have credit, but queue is full
+
+	_gdp_gob_lock(gob);
+	gob->x->catchup_sched = false;
+
+	memset(&cs, 0, sizeof cs);
+	cs.gob = gob;
+	cs.pass = ++gob->x->catchup_pass;
+
+	// start from whoever has waited longest
+	LIST_FOREACH(req, &gob->reqs, goblist)
 	{
-		if (ep_dbg_test(Dbg, 21))
+		_gdp_req_lock(req);
+		if (EP_UT_BITSET(GDP_REQ_SRV_CATCHUP, req->flags) &&
+				req->nextrec <= gob->nrecs && catchup_room(req) > 0 &&
+				(!found || req->sub_pass < oldest ||
+				 (req->sub_pass == oldest && req->nextrec < cs.lo)))
 		{
-			ep_dbg_printf("gob_reclaim_subscriptions: gob already locked:\n    ");
-			_gdp_gob_dump(gob, ep_dbg_getfile(), GDP_PR_BASIC, 0);
+			found = true;
+			oldest = req->sub_pass;
+			cs.lo = req->nextrec;
 		}
-		return;
+		_gdp_req_unlock(req);
 	}
-	gob->flags |= GOBF_ISLOCKED;	// if trylock succeeded
 
-	nextreq = LIST_FIRST(&gob->reqs);
-	while ((req = nextreq) != NULL)
+	if (found)
 	{
-		if (ep_dbg_test(Dbg, 59))
+		cs.hi = cs.lo + SubCatchupChunk - 1;
+		if (cs.hi > gob->nrecs)
+			cs.hi = gob->nrecs;
+		cs.last = cs.lo - 1;
+		estat = gob->x->physimpl->read_by_recno(gob, cs.lo,
+								cs.hi - cs.lo + 1, catchup_cb, &cs);
+		if (EP_STAT_IS_SAME(estat, GDP_STAT_READ_BUDGET))
 		{
-			ep_dbg_printf("gob_reclaim_subscriptions: checking ");
-			_gdp_req_dump(req, ep_dbg_getfile(), GDP_PR_BASIC, 0);
+			// stopped early: nobody could take more
 		}
-
-		// now that GOB is locked, we lock the request
-		istat = ep_thr_mutex_trylock(&req->mutex);
-		if (istat != 0)		// checking on status of req lock attempt
+		else if (EP_STAT_ISOK(estat) ||
+				EP_STAT_IS_SAME(estat, GDP_STAT_ACK_END_OF_RESULTS) ||
+				EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOTFOUND))
 		{
-			// already locked
-			if (ep_dbg_test(Dbg, 41))
-			{
-				ep_dbg_printf("gob_reclaim_subscriptions: req already locked:\n    ");
-				_gdp_req_dump(req, ep_dbg_getfile(), GDP_PR_BASIC, 0);
-			}
-			_gdp_gob_unlock(req->gob);
-			continue;
+			complete = true;
+		}
+		else
+		{
+			ep_log(estat, "catchup_run(%s): cannot read from %" PRIgdp_recno,
+					gob->pname, cs.lo);
+			failed = true;
 		}
+	}
 
-		// get next request while locked and do sanity checks
+	for (req = LIST_FIRST(&gob->reqs); req != NULL; req = nextreq)
+	{
+		_gdp_req_lock(req);
 		nextreq = LIST_NEXT(req, goblist);
-		if (!EP_ASSERT(req != nextreq) || !EP_ASSERT(req->gob == gob))
+		if (!EP_UT_BITSET(GDP_REQ_SRV_CATCHUP, req->flags))
 		{
-			_gdp_gob_unlock(req->gob);
-			break;
+			_gdp_req_unlock(req);
+			continue;
 		}
-
-
-		if (!EP_UT_BITSET(GDP_REQ_SRV_SUBSCR, req->flags))
+		if (failed && req->nextrec >= cs.lo && req->nextrec <= cs.hi)
 		{
-			ep_dbg_cprintf(Dbg, 59, "   ... not a subscription (flags = 0x%x)\n",
-					req->flags);
+			// read failed; don't spin on it
+			req->flags &= ~GDP_REQ_SRV_CATCHUP;
+			sub_end_subscription(req);
+			_gdp_req_unlock(req);
+			continue;
 		}
-		else if (ep_time_before(&req->act_ts, &sub_timeout))
+		if (complete && req->nextrec > cs.last && req->nextrec <= cs.hi)
 		{
-			// this subscription seems to be dead
-			if (ep_dbg_test(Dbg, 18))
-			{
-				ep_dbg_printf("    ...  subscription timeout: ");
-				_gdp_gob_dump(req->gob, ep_dbg_getfile(), GDP_PR_BASIC, 0);
-			}
+			// the rest of the range is missing from the log
+			req->nextrec = cs.hi + 1;
+		}
+		if (req->nextrec > gob->nrecs)
+		{
+			// caught up: from now on append will notify it
+			ep_dbg_cprintf(Dbg, 24,
+					"catchup_run: live from %" PRIgdp_recno "\n",
+					req->nextrec);
+			req->flags &= ~GDP_REQ_SRV_CATCHUP;
+			if (EP_UT_BITSET(GDP_REQ_SUBUPGRADE, req->flags))
+				req->flags |= GDP_REQ_SRV_SUBSCR;
+			else
+				sub_end_subscription(req);
+		}
+		else if (catchup_room(req) > 0)
+		{
+			nready++;
+		}
+		else if (req->sub_credit != 0)
+		{
+			nblocked++;
+		}
+		_gdp_req_unlock(req);
+	}
+
+	ep_dbg_cprintf(Dbg, 32, "catchup_run(%s): pass %" PRIu32
+			" %" PRIgdp_recno "-%" PRIgdp_recno ", sent %d,"
+			" ready %d, blocked %d\n",
+			gob->pname, cs.pass, cs.lo, cs.hi, cs.nsent, nready, nblocked);
+
+	// go around again without hogging this worker
+	if (nready > 0)
+		catchup_schedule(gob, 0);
+	else if (nblocked > 0)
+		catchup_schedule(gob, SUBC_RETRY_USEC);
+	_gdp_gob_decref(&gob, false);
+}
 
-			// have to manually remove req from lists to avoid lock inversion
-			if (EP_UT_BITSET(GDP_REQ_ON_GOB_LIST, req->flags))
+
+/*
+**  SUB_CATCHUP_START --- start sending existing records to subscribers
+**
+**		The subscriptions must already be on the GOB list, flagged
+**		GDP_REQ_SRV_CATCHUP.  The GOB must be locked.
+*/
+
+void
+sub_catchup_start(gdp_gob_t *gob)
+{
+	catchup_schedule(gob, 0);
+}
+
+
+/*
+**  SUB_CATCHUP_CREDIT --- subscriber can take more records
+**
+**		This also shows the subscriber is still there.  req and
+**		req->gob must be locked.
+*/
+
+void
+sub_catchup_credit(gdp_req_t *req, int32_t credit)
+{
+	EP_THR_MUTEX_ASSERT_ISLOCKED(&req->mutex);
+	GDP_GOB_ASSERT_ISLOCKED(req->gob);
+
+	ep_time_now(&req->act_ts);
+	if (credit <= 0 || req->sub_credit < 0)
+		return;
+	if (req->sub_credit > INT32_MAX - credit)
+		req->sub_credit = INT32_MAX;
+	else
+		req->sub_credit += credit;
+	if (EP_UT_BITSET(GDP_REQ_SRV_CATCHUP, req->flags))
+		catchup_schedule(req->gob, 0);
+}
+
+
+/*
+**  Unsubscribe all requests for a given gob and destination.
+**  Can also optionally select a particular request id.
+*/
+
+EP_STAT
+sub_end_all_subscriptions(
+		gdp_gob_t *gob,
+		gdp_name_t dest,
+		gdp_rid_t rid)
+{
+	EP_STAT estat;
+	gdp_req_t *req;
+	gdp_req_t *nextreq;
+
+	if (ep_dbg_test(Dbg, 29))
+	{
+		gdp_pname_t dst_p;
+		ep_dbg_printf("sub_end_all_subscriptions: rid %" PRIgdp_rid " dst %s\n    ",
+				rid, gdp_printable_name(dest, dst_p));
+		_gdp_gob_dump(gob, ep_dbg_getfile(), GDP_PR_BASIC, 1);
+	}
+
+	GDP_GOB_ASSERT_ISLOCKED(gob);
+	if (EP_UT_BITSET(GOBF_KEEPLOCKED, gob->flags) && ep_dbg_test(Dbg, 1))
+		ep_dbg_printf("sub_end_all_subscriptions: GOBF_KEEPLOCKED on entry\n");
+	gob->flags |= GOBF_KEEPLOCKED;
+
+	do
+	{
+		estat = EP_STAT_OK;
+		for (req = LIST_FIRST(&gob->reqs); req != NULL; req = nextreq)
+		{
+			estat = _gdp_req_lock(req);
+			EP_STAT_CHECK(estat, break);
+			nextreq = LIST_NEXT(req, goblist);
+			if (!GDP_NAME_SAME(req->cpdu->dst, dest) ||
+					(rid != GDP_PDU_NO_RID && rid != req->cpdu->msg->rid) ||
+					!EP_ASSERT(req->gob == gob))
 			{
-				// gob is already locked
-				LIST_REMOVE(req, goblist);
+				_gdp_req_unlock(req);
+				continue;
 			}
-			if (EP_UT_BITSET(GDP_REQ_ON_CHAN_LIST, req->flags))
+
+			// remove subscription for this destination (but keep GOB locked)
+			if (ep_dbg_test(Dbg, 39))
 			{
-				LIST_REMOVE(req, chanlist);			// chan already locked
+				ep_dbg_printf("sub_end_all_subscriptions removing ");
+				_gdp_req_dump(req, ep_dbg_getfile(), GDP_PR_BASIC, 0);
 			}
-			req->flags &= ~(GDP_REQ_ON_GOB_LIST | GDP_REQ_ON_CHAN_LIST);
-			_gdp_gob_decref(&req->gob, true);
+			_gdp_req_gob_unlink(req);
+			_gdp_gob_decref(&req->gob, false);
 			_gdp_req_free(&req);
 		}
-		else if (ep_dbg_test(Dbg, 59))
+	} while (!EP_STAT_ISOK(estat));
+	gob->flags &= ~GOBF_KEEPLOCKED;
+	return estat;
+}
+
+
+/*
+**  Subscription leases.
+**
+**		Each subscription has a lease timer on the shared timer
+**		wheel, started when the subscription is set up.  Renewals
+**		and credit grants only update act_ts; when the timer goes
+**		off it checks act_ts and, if the lease has been renewed in
+**		the meantime, sets itself for the rest of the lease.  So
+**		expiring a subscription costs the same however many there
+**		are, and nothing has to walk all the GOBs looking for them.
+**
+**		The timer runs with nothing locked, and the request could
+**		be in the middle of being freed (which waits for us), so
+**		we can't block on the GOB or request locks.  If we can't
+**		get them we try again a little later.
+*/
+
+#define SUB_LEASE_RETRY_USEC	(1 * 1000000)	// retry if GOB/req busy
+
+static void
+sub_lease_timeout(EP_TIMER *t, void *req_)
+{
+	gdp_req_t *req = (gdp_req_t *) req_;
+	gdp_gob_t *gob = req->gob;
+	EP_TIME_SPEC sub_timeout;
+
+	// gob can't change under us for a subscription
+	if (gob == NULL)
+		return;
+	if (ep_thr_mutex_trylock(&gob->mutex) != 0)
+	{
+		ep_dbg_cprintf(Dbg, 41, "sub_lease_timeout(%p): GOB busy\n", req);
+		ep_timer_set(_GdpTimers, t, SUB_LEASE_RETRY_USEC,
+				&sub_lease_timeout, req);
+		return;
+	}
+	gob->flags |= GOBF_ISLOCKED;
+	if (ep_thr_mutex_trylock(&req->mutex) != 0)
+	{
+		ep_dbg_cprintf(Dbg, 41, "sub_lease_timeout(%p): req busy\n", req);
+		_gdp_gob_unlock(gob);
+		ep_timer_set(_GdpTimers, t, SUB_LEASE_RETRY_USEC,
+				&sub_lease_timeout, req);
+		return;
+	}
+
+	sub_timeout_ts(&sub_timeout);
+	if (ep_dbg_test(Dbg, 59))
+	{
+		ep_dbg_printf("sub_lease_timeout: checking ");
+		_gdp_req_dump(req, ep_dbg_getfile(), GDP_PR_BASIC, 0);
+	}
+
+	if (req->state == GDP_REQ_FREE || req->gob != gob ||
+			(req->flags & (GDP_REQ_SRV_SUBSCR | GDP_REQ_SRV_CATCHUP)) == 0)
+	{
+		ep_dbg_cprintf(Dbg, 59, "   ... not a subscription (flags = 0x%x)\n",
+				req->flags);
+	}
+	else if (!ep_time_before(&req->act_ts, &sub_timeout))
+	{
+		// renewed since the timer was set: wait for the rest of the lease
+		int64_t usec;
+
+		usec = (req->act_ts.tv_sec - sub_timeout.tv_sec) * INT64_C(1000000) +
+				(req->act_ts.tv_nsec - sub_timeout.tv_nsec) / 1000;
+		ep_timer_set(_GdpTimers, t, usec, &sub_lease_timeout, req);
+	}
+	else
+	{
+		// this subscription seems to be dead
+		if (ep_dbg_test(Dbg, 18))
 		{
-			ep_dbg_printf("    ... not yet time\n");
+			ep_dbg_printf("sub_lease_timeout: subscription timeout: ");
+			_gdp_gob_dump(req->gob, ep_dbg_getfile(), GDP_PR_BASIC, 0);
 		}
 
-		if (req != NULL)
-			_gdp_req_unlock(req);
+		// have to manually remove req from lists to avoid lock inversion
+		// gob is already locked
+		_gdp_req_gob_unlink(req);
+		if (EP_UT_BITSET(GDP_REQ_ON_CHAN_LIST, req->flags))
+		{
+			// chan comes after req in the lock order
+			_gdp_chan_lock(req->chan);
+			_gdp_req_chan_unlink(req, _gdp_chan_get_cdata(req->chan));
+			_gdp_chan_unlock(req->chan);
+		}
+		_gdp_gob_decref(&req->gob, true);
+		_gdp_req_free(&req);
 	}
 
-	if (gob != NULL)
-		_gdp_gob_unlock(gob);
+	if (req != NULL)
+		_gdp_req_unlock(req);
+	_gdp_gob_unlock(gob);
+}
+
+
+/*
+**  SUB_LEASE_START --- start the lease on a new subscription
+**
+**		req must be locked.
+*/
+
+void
+sub_lease_start(gdp_req_t *req)
+{
+	EP_THR_MUTEX_ASSERT_ISLOCKED(&req->mutex);
+
+	ep_time_now(&req->act_ts);
+	ep_timer_set(_GdpTimers, &req->lease_timer, SubTimeout * INT64_C(1000000),
+			&sub_lease_timeout, req);
 }
 
+
+/*
+**  SUB_RECLAIM_RESOURCES --- periodic subscription housekeeping
+**
+**		Expired subscriptions and groups are removed by their lease
+**		timers; this just reports on the subscription queues.
+*/
+
 void
 sub_reclaim_resources(gdp_chan_t *chan)
 {
-	_gdp_gob_cache_foreach(gob_reclaim_subscriptions);
+	sub_report_queues();
+}
+
+
+/*
+**  Group subscriptions.
+**
+**		A group subscription covers many logs with one lease.  The
+**		group itself is found by {client, rid}; each log in the
+**		group has a small member record linked onto the GOB (so
+**		appends can find it) and onto the group (so it can be torn
+**		down).  Renewal only touches the group, so it costs the
+**		same regardless of the number of logs.
+**
+**		Locking: SubGroupMutex protects the group table and the
+**		group reference counts.  grp->mutex protects the lease
+**		and the member list.  A member's GOB link and nextrec are
+**		protected by that GOB's lock.  A group is only torn down
+**		once it has no references, and tearing it down needs each
+**		member GOB lock, so holding a GOB lock keeps the groups of
+**		that GOB's members alive.
+*/
+
+struct sub_member
+{
+	LIST_ENTRY(sub_member)	goblist;	// on gob->x->groupsubs
+	LIST_ENTRY(sub_member)	grplist;	// on grp->members
+	struct sub_group		*grp;		// enclosing group
+	gdp_gob_t				*gob;		// member log (we hold a reference)
+	gdp_recno_t				nextrec;	// next record to deliver
+};
+
+struct sub_group
+{
+	EP_THR_MUTEX			mutex;		// protects lease and members
+	EP_TIMER				lease_timer;	// tears down group on expiry
+	struct sub_group_key
+	{
+		gdp_name_t			client;		// subscriber
+		gdp_rid_t			rid;		// request id at subscriber
+	}						key;
+	gdp_name_t				anchor;		// log used as source of PDUs
+	gdp_l5seqno_t			l5seqno;	// from the original command
+	gdp_chan_t				*chan;		// channel to send results
+	EP_TIME_SPEC			act_ts;		// lease start (last renewal)
+	bool					ended;		// unsubscribed
+	int						refcnt;		// table + commands in progress
+	int						nmembers;	// number of logs in group
+	LIST_HEAD(, sub_member)	members;	// member logs
+};
+
+static EP_THR_MUTEX				SubGroupMutex	EP_THR_MUTEX_INITIALIZER;
+static EP_HASH					*SubGroups;		// {client, rid} => group
+
+static void		sub_group_lease_timeout(EP_TIMER *, void *);
+
+// compute the oldest lease that is still valid
+static void
+sub_group_expiry(EP_TIME_SPEC *expiry)
+{
+	EP_TIME_SPEC sub_delta;
+	long timeout = ep_adm_getlongparam("swarm.gdplogd.subscr.timeout", 0);
+
+	if (timeout == 0)
+		timeout = ep_adm_getlongparam("swarm.gdp.subscr.timeout",
+								GDP_SUBSCR_TIMEOUT_DEF);
+	ep_time_from_nsec(-timeout SECONDS, &sub_delta);
+	ep_time_deltanow(&sub_delta, expiry);
+}
+
+static void
+sub_group_key(struct sub_group_key *key, gdp_name_t client, gdp_rid_t rid)
+{
+	memset(key, 0, sizeof *key);
+	memcpy(key->client, client, sizeof key->client);
+	key->rid = rid;
+}
+
+
+/*
+**  SUB_GROUP_GET --- find (and optionally create) a group
+**
+**		Returns the group with an extra reference that must be
+**		released using sub_group_release.  Ended groups are
+**		treated as nonexistent (and cannot be recreated until
+**		they have been reclaimed).  Adding to an existing group
+**		also renews its lease.
+*/
+
+struct sub_group *
+sub_group_get(gdp_req_t *req, bool create)
+{
+	struct sub_group_key key;
+	struct sub_group *grp;
+
+	sub_group_key(&key, req->cpdu->src, req->cpdu->msg->rid);
+	ep_thr_mutex_lock(&SubGroupMutex);
+	if (SubGroups == NULL)
+		SubGroups = ep_hash_new("SubGroups", NULL, 0);
+	grp = (struct sub_group *) ep_hash_search(SubGroups, sizeof key, &key);
+	if (grp != NULL)
+	{
+		bool ended;
+
+		ep_thr_mutex_lock(&grp->mutex);
+		ended = grp->ended;
+		if (!ended && create)
+			ep_time_now(&grp->act_ts);
+		ep_thr_mutex_unlock(&grp->mutex);
+		if (ended)
+			grp = NULL;				// can't reuse until reclaimed
+	}
+	else if (create)
+	{
+		grp = (struct sub_group *) ep_mem_zalloc(sizeof *grp);
+		ep_thr_mutex_init(&grp->mutex, EP_THR_MUTEX_DEFAULT);
+		ep_thr_mutex_setorder(&grp->mutex, GDP_MUTEX_LORDER_LEAF);
+		grp->key = key;
+		memcpy(grp->anchor, req->cpdu->dst, sizeof grp->anchor);
+		grp->l5seqno = req->cpdu->msg->l5seqno;
+		grp->chan = req->chan;
+		ep_time_now(&grp->act_ts);
+		grp->refcnt = 1;				// for the table
+		LIST_INIT(&grp->members);
+		(void) ep_hash_insert(SubGroups, sizeof grp->key, &grp->key, grp);
+		ep_timer_set(_GdpTimers, &grp->lease_timer,
+				SubTimeout * INT64_C(1000000), &sub_group_lease_timeout, grp);
+		ep_dbg_cprintf(Dbg, 20, "sub_group_get: new group %p rid %"
+				PRIgdp_rid "\n", grp, grp->key.rid);
+	}
+	if (grp != NULL)
+		grp->refcnt++;
+	ep_thr_mutex_unlock(&SubGroupMutex);
+	return grp;
+}
+
+
+/*
+**  SUB_GROUP_RELEASE --- drop a reference to a group
+**
+**		If this is the last reference, the members are removed from
+**		their GOBs, so the caller must not hold any GOB locks.
+*/
+
+void
+sub_group_release(struct sub_group *grp)
+{
+	struct sub_member *m;
+	int refcnt;
+
+	ep_thr_mutex_lock(&SubGroupMutex);
+	refcnt = --grp->refcnt;
+	ep_thr_mutex_unlock(&SubGroupMutex);
+	if (refcnt > 0)
+		return;
+
+	ep_dbg_cprintf(Dbg, 20, "sub_group_release: freeing group %p (%d logs)\n",
+			grp, grp->nmembers);
+
+	// no one else can find this group now
+	while ((m = LIST_FIRST(&grp->members)) != NULL)
+	{
+		LIST_REMOVE(m, grplist);
+		_gdp_gob_lock(m->gob);
+		LIST_REMOVE(m, goblist);
+		_gdp_gob_decref(&m->gob, false);
+		ep_mem_free(m);
+	}
+	ep_thr_mutex_destroy(&grp->mutex);
+	ep_mem_free(grp);
+}
+
+
+/*
+**  SUB_GROUP_RENEW --- extend the lease on a group
+**
+**		Returns false if there is no such group (e.g., because the
+**		lease already expired), in which case the client needs to
+**		set it up again.
+*/
+
+bool
+sub_group_renew(gdp_name_t client, gdp_rid_t rid)
+{
+	struct sub_group_key key;
+	struct sub_group *grp = NULL;
+
+	sub_group_key(&key, client, rid);
+	ep_thr_mutex_lock(&SubGroupMutex);
+	if (SubGroups != NULL)
+		grp = (struct sub_group *) ep_hash_search(SubGroups, sizeof key, &key);
+	if (grp != NULL)
+	{
+		ep_thr_mutex_lock(&grp->mutex);
+		if (grp->ended)
+			grp = NULL;
+		else
+			ep_time_now(&grp->act_ts);
+		ep_thr_mutex_unlock(&grp->mutex);
+	}
+	ep_thr_mutex_unlock(&SubGroupMutex);
+	return grp != NULL;
+}
+
+
+/*
+**  SUB_GROUP_END --- terminate a group subscription
+**
+**		The group stops delivering immediately; the resources are
+**		recovered by the lease timer, which we set to go off right
+**		away.  Returns true if there was such a group.
+*/
+
+bool
+sub_group_end(gdp_name_t client, gdp_rid_t rid)
+{
+	struct sub_group_key key;
+	struct sub_group *grp = NULL;
+
+	sub_group_key(&key, client, rid);
+	ep_thr_mutex_lock(&SubGroupMutex);
+	if (SubGroups != NULL)
+		grp = (struct sub_group *) ep_hash_search(SubGroups, sizeof key, &key);
+	if (grp != NULL)
+	{
+		ep_thr_mutex_lock(&grp->mutex);
+		grp->ended = true;
+		ep_timer_set(_GdpTimers, &grp->lease_timer, 0,
+				&sub_group_lease_timeout, grp);
+		ep_thr_mutex_unlock(&grp->mutex);
+	}
+	ep_thr_mutex_unlock(&SubGroupMutex);
+	return grp != NULL;
+}
+
+
+/*
+**  Send one record (or failure) to a group subscriber.
+**
+**		The datum is borrowed from the caller.
+*/
+
+static EP_STAT
+sub_group_send(struct sub_group *grp, gdp_gob_t *gob, GdpDatum *pbd)
+{
+	EP_STAT estat;
+	gdp_msg_t *msg;
+	gdp_pdu_t *pdu;
+	GdpMessage__AckMultiContent__Result *r;
+
+	msg = _gdp_msg_new(GDP_ACK_MULTI_CONTENT, grp->key.rid, grp->l5seqno);
+	r = (GdpMessage__AckMultiContent__Result *) ep_mem_zalloc(sizeof *r);
+	gdp_message__ack_multi_content__result__init(r);
+	r->logname.len = sizeof (gdp_name_t);
+	r->logname.data = (uint8_t *) ep_mem_malloc(sizeof (gdp_name_t));
+	memcpy(r->logname.data, gob->name, sizeof (gdp_name_t));
+	r->datum = pbd;
+	msg->ack_multi_content->n_r = 1;
+	msg->ack_multi_content->r = (GdpMessage__AckMultiContent__Result **)
+				ep_mem_malloc(sizeof *msg->ack_multi_content->r);
+	msg->ack_multi_content->r[0] = r;
+
+	pdu = _gdp_pdu_new(msg, grp->anchor, grp->key.client, GDP_SEQNO_NONE);
+	estat = _gdp_pdu_out(pdu, grp->chan);
+	r->datum = NULL;				// still belongs to caller
+	_gdp_pdu_free(&pdu);
+
+	if (!EP_STAT_ISOK(estat))
+		ep_dbg_cprintf(Dbg, 1, "sub_group_send: couldn't write PDU!\n");
+	return estat;
+}
+
+// true if this group should still get data
+static bool
+sub_group_live(struct sub_group *grp, EP_TIME_SPEC *expiry)
+{
+	bool live;
+
+	ep_thr_mutex_lock(&grp->mutex);
+	live = !grp->ended && !ep_time_before(&grp->act_ts, expiry);
+	ep_thr_mutex_unlock(&grp->mutex);
+	return live;
+}
+
+
+/*
+**  Tell all groups including this GOB about a new record.
+**
+**		GOB must be locked.  Expired groups are skipped here and
+**		cleaned up by sub_group_lease_timeout.
+*/
+
+static void
+sub_group_notify(gdp_gob_t *gob, GdpDatum *pbd)
+{
+	struct sub_member *m;
+	EP_TIME_SPEC expiry;
+
+	GDP_GOB_ASSERT_ISLOCKED(gob);
+	sub_group_expiry(&expiry);
+	LIST_FOREACH(m, &gob->x->groupsubs, goblist)
+	{
+		// may already have been sent as part of the backlog
+		if (pbd->recno < m->nextrec || !sub_group_live(m->grp, &expiry))
+			continue;
+		if (EP_STAT_ISOK(sub_group_send(m->grp, gob, pbd)))
+			m->nextrec = pbd->recno + 1;
+	}
+}
+
+// send the backlog for a new member
+static EP_STAT
+sub_group_backlog_cb(EP_STAT estat, gdp_datum_t *datum, gdp_result_ctx_t *ctx)
+{
+	struct sub_member *m = (struct sub_member *) ctx;
+	GdpDatum *pbd;
+
+	if (!EP_STAT_ISOK(estat) || datum == NULL || datum->recno < m->nextrec)
+		return EP_STAT_OK;
+	pbd = (GdpDatum *) ep_mem_malloc(sizeof *pbd);
+	gdp_datum__init(pbd);
+	_gdp_datum_to_pb(datum, NULL, pbd);
+	estat = sub_group_send(m->grp, m->gob, pbd);
+	if (EP_STAT_ISOK(estat))
+		m->nextrec = datum->recno + 1;
+	gdp_datum__free_unpacked(pbd, &_GdpProtobufAllocator);
+	return estat;
+}
+
+
+/*
+**  SUB_GROUP_ADD_MEMBER --- add a log to a group
+**
+**		Start is as for subscriptions: zero or negative values are
+**		relative to the end, so zero means "only new records".  Any
+**		existing records from start on are sent immediately.  Adding
+**		a log that is already in the group just renews the lease.
+**		The caller must not hold any GOB or request locks.
+*/
+
+EP_STAT
+sub_group_add_member(struct sub_group *grp,
+		gdp_name_t logname,
+		gdp_recno_t start)
+{
+	EP_STAT estat;
+	gdp_gob_t *gob;
+	struct sub_member *m;
+
+	estat = get_open_gob(logname, &gob);
+	EP_STAT_CHECK(estat, return estat);
+
+	LIST_FOREACH(m, &gob->x->groupsubs, goblist)
+	{
+		if (m->grp == grp)
+			break;
+	}
+	if (m != NULL)
+	{
+		// already there
+		_gdp_gob_decref(&gob, false);
+		return EP_STAT_OK;
+	}
+
+	m = (struct sub_member *) ep_mem_zalloc(sizeof *m);
+	m->grp = grp;
+	m->gob = gob;					// keeps the reference
+	m->nextrec = start;
+	if (m->nextrec <= 0)
+	{
+		m->nextrec += gob->nrecs + 1;
+		if (m->nextrec <= 0)
+			m->nextrec = 1;
+	}
+	LIST_INSERT_HEAD(&gob->x->groupsubs, m, goblist);
+	ep_thr_mutex_lock(&grp->mutex);
+	LIST_INSERT_HEAD(&grp->members, m, grplist);
+	grp->nmembers++;
+	ep_thr_mutex_unlock(&grp->mutex);
+
+	// existing records (appends are held off by the GOB lock)
+	if (m->nextrec <= gob->nrecs)
+	{
+		estat = gob->x->physimpl->read_by_recno(gob, m->nextrec,
+							gob->nrecs - m->nextrec + 1,
+							sub_group_backlog_cb, (gdp_result_ctx_t *) m);
+	}
+	_gdp_gob_unlock(gob);
+	return estat;
+}
+
+
+/*
+**  SUB_GROUP_LEASE_TIMEOUT --- tear down ended or expired groups
+**
+**		As for individual subscriptions, renewals only update
+**		act_ts, so if the lease was renewed the timer is just set
+**		for the rest of it.
+*/
+
+static void
+sub_group_lease_timeout(EP_TIMER *t, void *grp_)
+{
+	struct sub_group *grp = (struct sub_group *) grp_;
+	EP_TIME_SPEC expiry;
+
+	sub_group_expiry(&expiry);
+	ep_thr_mutex_lock(&SubGroupMutex);
+	ep_thr_mutex_lock(&grp->mutex);
+	if (!grp->ended && !ep_time_before(&grp->act_ts, &expiry))
+	{
+		int64_t usec;
+
+		usec = (grp->act_ts.tv_sec - expiry.tv_sec) * INT64_C(1000000) +
+				(grp->act_ts.tv_nsec - expiry.tv_nsec) / 1000;
+		ep_timer_set(_GdpTimers, t, usec, &sub_group_lease_timeout, grp);
+		ep_thr_mutex_unlock(&grp->mutex);
+		ep_thr_mutex_unlock(&SubGroupMutex);
+		return;
+	}
+	ep_dbg_cprintf(Dbg, 18, "sub_group_lease_timeout: group %p rid %"
+			PRIgdp_rid " (%d logs) %s\n",
+			grp, grp->key.rid, grp->nmembers,
+			grp->ended ? "ended" : "expired");
+
+	// sub_group_end may have set the timer again while we waited
+	ep_timer_clr(_GdpTimers, t);
+	ep_thr_mutex_unlock(&grp->mutex);
+	(void) ep_hash_delete(SubGroups, sizeof grp->key, &grp->key);
+	ep_thr_mutex_unlock(&SubGroupMutex);
+
+	// drop the table reference (without holding SubGroupMutex)
+	sub_group_release(grp);
 }
@@ -33,6 +33,9 @@
 #ifndef _GDPD_PUBSUB_H_
 #define _GDPD_PUBSUB_H_
 
+// read parameters (once, at startup)
+void			sub_init(void);
+
 // notify all subscribers of a new message
 void			sub_notify_all_subscribers(
 						gdp_req_t *pubreq);
@@ -40,13 +43,42 @@ void			sub_notify_all_subscribers(
 // terminate a subscription
 void			sub_end_subscription(gdp_req_t *req);
 
+// send existing records to new subscriptions (in the background)
+void			sub_catchup_start(gdp_gob_t *gob);
+
+// client granted more catch-up credit
+void			sub_catchup_credit(
+						gdp_req_t *req,
+						int32_t credit);
+
 // terminate all subscriptions for a given {gcl, client, rid} tuple
 EP_STAT			sub_end_all_subscriptions(
 						gdp_gob_t *gob,
 						gdp_name_t dest,
 						gdp_rid_t rid);
 
+// start the lease on a new subscription
+void			sub_lease_start(gdp_req_t *req);
+
 // reclaim subscription resources
 void			sub_reclaim_resources(gdp_chan_t *chan);
 
+// group subscriptions (many logs, one lease)
+struct sub_group;
+struct sub_group	*sub_group_get(			// find/create group for req
+						gdp_req_t *req,
+						bool create);
+void			sub_group_release(			// drop reference from get
+						struct sub_group *grp);
+bool			sub_group_renew(			// extend lease
+						gdp_name_t client,
+						gdp_rid_t rid);
+EP_STAT			sub_group_add_member(		// add a log to a group
+						struct sub_group *grp,
+						gdp_name_t logname,
+						gdp_recno_t start);
+bool			sub_group_end(				// terminate a group
+						gdp_name_t client,
+						gdp_rid_t rid);
+
 #endif // _GDPD_PUBSUB_H_
@@ -0,0 +1,508 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Follow logs hosted on another log server (read replicas)
+**
+**		A follower is configured with the name of a leader log
+**		server and a list of logs.  A single thread pulls each log
+**		in batches starting just after the last record we have
+**		(see cmd_replicate on the leader side), checks that every
+**		record chains to the one before it, and writes the batch in
+**		one transaction.  Logs are not advertised until they have
+**		caught up, so clients are never routed to a stale copy.
+**
+**		Replicas are read only: appends from clients are refused.
+**
+**	----- BEGIN LICENSE BLOCK -----
+**	GDPLOGD: Log Daemon for the Global Data Plane
+**	From the Ubiquitous Swarm Lab, 490 Cory Hall, U.C. Berkeley.
+**
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**	----- END LICENSE BLOCK -----
+*/
+
+#include "logd.h"
+#include "logd_admin.h"
+
+#include <gdp/gdp_md.h>
+#include <gdp/gdp_priv.h>
+#include <ep/ep_app.h>
+#include <ep/ep_dbg.h>
+#include <ep/ep_string.h>
+
+#include <string.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("gdplogd.replica",
+								"GDP Log Daemon replication");
+
+#define REPLICA_POLL_DEFAULT		1000		// milliseconds
+#define REPLICA_REPORT_DEFAULT		60			// seconds
+#define REPLICA_MAXLOGS				256
+
+struct replica
+{
+	gdp_name_t		name;				// name of the log
+	gdp_pname_t		pname;				// printable version of name
+	bool			live:1;				// caught up and advertised
+	bool			failed:1;			// gave up (chain broken)
+	gdp_recno_t		nrecs;				// records we hold
+	gdp_recno_t		leader_nrecs;		// records the leader holds
+	EP_TIME_SPEC	ts;					// timestamp of our newest record
+	EP_TIME_SPEC	leader_ts;			// timestamp of leader's newest
+	uint8_t			lasthash[EP_CRYPTO_MAX_DIGEST];	// hash of our newest
+	size_t			lasthashlen;		// zero if not yet known
+};
+
+static gdp_name_t		Leader;				// who we follow
+static struct replica	*Replicas;			// what we follow
+static int				NReplicas;
+static EP_THR_MUTEX		ReplicaMutex		EP_THR_MUTEX_INITIALIZER2(
+												GDP_MUTEX_LORDER_LEAF);
+static EP_THR			ReplicaThread;
+
+
+static struct replica *
+replica_find(const gdp_name_t name)
+{
+	int i;
+
+	for (i = 0; i < NReplicas; i++)
+	{
+		if (GDP_NAME_SAME(Replicas[i].name, name))
+			return &Replicas[i];
+	}
+	return NULL;
+}
+
+
+/*
+**  REPLICA_IS_FOLLOWER --- tell if we are following this log
+*/
+
+bool
+replica_is_follower(const gdp_name_t name)
+{
+	return replica_find(name) != NULL;
+}
+
+
+/*
+**  REPLICA_IS_PENDING --- tell if a log is still catching up
+**
+**		Such logs must not be advertised.
+*/
+
+bool
+replica_is_pending(const gdp_name_t name)
+{
+	struct replica *r = replica_find(name);
+	bool pending;
+
+	if (r == NULL)
+		return false;
+	ep_thr_mutex_lock(&ReplicaMutex);
+	pending = !r->live;
+	ep_thr_mutex_unlock(&ReplicaMutex);
+	return pending;
+}
+
+
+/*
+**  REPLICA_CREATE --- create the local copy of a log
+**
+**		Uses the metadata sent by the leader, so the copy has the
+**		same name and keys.  Returns the GOB locked and referenced.
+*/
+
+static EP_STAT
+replica_create(struct replica *r,
+		ProtobufCBinaryData *md,
+		gdp_gob_t **pgob)
+{
+	EP_STAT estat;
+	gdp_gob_t *gob;
+
+	estat = gob_alloc(r->name, GDP_MODE_AO, &gob);
+	EP_STAT_CHECK(estat, return estat);
+	gob->gob_md = _gdp_md_deserialize(md->data, md->len);
+	_gdp_gob_lock(gob);
+	estat = gob->x->physimpl->create(gob, gob->gob_md);
+	if (!EP_STAT_ISOK(estat))
+	{
+		_gdp_gob_free(&gob);
+		return estat;
+	}
+	gob->flags |= GOBF_DEFER_FREE;
+	gob->flags &= ~GOBF_PENDING;
+	_gdp_gob_cache_add(gob);
+
+	admin_post_stats(ADMIN_LOG_EXIST, "log-create",
+			"log-name", gob->pname,
+			"replica", "true",
+			NULL, NULL);
+	*pgob = gob;
+	return estat;
+}
+
+
+/*
+**  REPLICA_APPLY --- verify and write one batch from the leader
+**
+**		Records are checked against the hash of the record before
+**		them (and their signature, if any) as they are written, and
+**		the whole batch is one transaction.  If a record fails the
+**		checks the ones before it are kept and the replica stops;
+**		something is badly wrong with the leader or with us.
+*/
+
+static EP_STAT
+replica_apply(struct replica *r, GdpMessage__AckSuccess *resp)
+{
+	EP_STAT estat;
+	EP_STAT vstat = EP_STAT_OK;
+	gdp_gob_t *gob;
+	gdp_datum_t *datum;
+	gdp_recno_t orig_nrecs;
+	int dx;
+
+	estat = get_open_gob(r->name, &gob);
+	if (EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOTFOUND))
+	{
+		// don't have it yet; need the metadata to create it
+		if (!resp->has_metadata || resp->metadata.len == 0)
+		{
+			r->nrecs = 0;
+			return estat;
+		}
+		estat = replica_create(r, &resp->metadata, &gob);
+	}
+	EP_STAT_CHECK(estat, return estat);
+
+	// pick up where the disk says we are
+	r->nrecs = orig_nrecs = gob->nrecs;
+	if (r->lasthashlen == 0 && r->nrecs > 0)
+	{
+		r->lasthashlen = sizeof r->lasthash;
+		estat = gob->x->physimpl->get_rechash(gob, r->nrecs,
+								r->lasthash, &r->lasthashlen);
+		if (!EP_STAT_ISOK(estat))
+		{
+			r->lasthashlen = 0;
+			goto fail0;
+		}
+	}
+
+	if (resp->dl == NULL || resp->dl->n_d == 0)
+		goto fail0;
+
+	datum = gdp_datum_new();
+	if (gob->x->physimpl->xact_begin != NULL)
+		gob->x->physimpl->xact_begin(gob);
+	for (dx = 0; dx < resp->dl->n_d; dx++)
+	{
+		GdpDatum *pbd = resp->dl->d[dx];
+
+		if ((gdp_recno_t) pbd->recno <= gob->nrecs)
+			continue;				// duplicate
+		if ((gdp_recno_t) pbd->recno != gob->nrecs + 1)
+		{
+			vstat = GDP_STAT_RECNO_SEQ_ERROR;
+			break;
+		}
+		gdp_datum_reset(datum);
+		_gdp_datum_from_pb(datum, pbd, pbd->sig);
+
+		// must chain to what we already have
+		if (datum->recno > 1)
+		{
+			size_t hashlen = 0;
+			void *hashptr = NULL;
+
+			if (datum->prevhash != NULL)
+				hashptr = gdp_hash_getptr(datum->prevhash, &hashlen);
+			if (hashptr == NULL || hashlen != r->lasthashlen ||
+					memcmp(hashptr, r->lasthash, hashlen) != 0)
+			{
+				vstat = GDP_STAT_CRYPTO_VRFY_FAIL;
+				break;
+			}
+		}
+		if (datum->sig != NULL && EP_UT_BITSET(GOBF_VERIFYING, gob->flags))
+		{
+			vstat = _gdp_datum_vrfy_gob(datum, gob);
+			EP_STAT_CHECK(vstat, break);
+		}
+
+		estat = gob->x->physimpl->append(gob, datum);
+		EP_STAT_CHECK(estat, break);
+		(void) merkle_append(gob, datum->recno);
+
+		{
+			gdp_hash_t *hash = _gdp_datum_hash(datum, gob);
+			size_t hashlen;
+			void *hashptr = gdp_hash_getptr(hash, &hashlen);
+
+			if (hashlen > sizeof r->lasthash)
+				hashlen = sizeof r->lasthash;
+			memcpy(r->lasthash, hashptr, hashlen);
+			r->lasthashlen = hashlen;
+			gdp_hash_free(hash);
+		}
+		gob->nrecs = datum->recno;
+		r->ts = datum->ts;
+	}
+	gdp_datum_free(datum);
+
+	if (EP_STAT_ISOK(estat))
+	{
+		// group commit: one transaction for the whole batch
+		if (gob->x->physimpl->xact_end != NULL)
+			gob->x->physimpl->xact_end(gob);
+	}
+	else
+	{
+		if (gob->x->physimpl->xact_abort != NULL)
+			gob->x->physimpl->xact_abort(gob);
+		merkle_invalidate(gob);
+		gob->nrecs = orig_nrecs;
+		r->lasthashlen = 0;			// reload from disk next time
+	}
+	r->nrecs = gob->nrecs;
+
+	if (!EP_STAT_ISOK(vstat))
+	{
+		char ebuf[100];
+
+		ep_log(vstat, "replica %s: bad record %" PRIgdp_recno
+				" from leader, giving up",
+				r->pname, gob->nrecs + 1);
+		ep_dbg_cprintf(Dbg, 1, "replica_apply(%s): %s\n", r->pname,
+				ep_stat_tostr(vstat, ebuf, sizeof ebuf));
+		r->failed = true;
+		estat = vstat;
+	}
+	if (r->nrecs > orig_nrecs)
+	{
+		admin_post_stats(ADMIN_LOG_WRITE, "replica-append",
+				"log-name", gob->pname,
+				NULL, NULL);
+	}
+
+fail0:
+	_gdp_gob_decref(&gob, false);
+	return estat;
+}
+
+
+/*
+**  REPLICA_REPORT --- report how far behind a replica is
+*/
+
+static void
+replica_report(struct replica *r)
+{
+	char nbuf[40];
+	char sbuf[40];
+	double lag_secs = 0.0;
+
+	if (r->nrecs < r->leader_nrecs && EP_TIME_IS_VALID(&r->leader_ts))
+	{
+		lag_secs = (r->leader_ts.tv_sec - r->ts.tv_sec) +
+				(r->leader_ts.tv_nsec - r->ts.tv_nsec) / 1.0e9;
+		if (r->nrecs == 0 || lag_secs < 0.0)
+			lag_secs = 0.0;
+	}
+	snprintf(nbuf, sizeof nbuf, "%" PRIgdp_recno,
+			r->leader_nrecs > r->nrecs ? r->leader_nrecs - r->nrecs : 0);
+	snprintf(sbuf, sizeof sbuf, "%.3f", lag_secs);
+	ep_dbg_cprintf(Dbg, 10, "replica %s: lag %s records, %s seconds\n",
+			r->pname, nbuf, sbuf);
+	admin_post_stats(ADMIN_LOG_REPLICA, "replica-lag",
+			"log-name", r->pname,
+			"lag-records", nbuf,
+			"lag-seconds", sbuf,
+			NULL, NULL);
+}
+
+
+/*
+**  REPLICA_PULL --- fetch and apply one batch for one log
+**
+**		Returns true if there may be more to fetch right away.
+*/
+
+static bool
+replica_pull(struct replica *r, int32_t maxrecs)
+{
+	EP_STAT estat;
+	gdp_req_t *req;
+	GdpMessage__AckSuccess *resp;
+	bool more = false;
+
+	estat = _gdp_replica_pull(Leader, r->name, r->nrecs + 1, maxrecs,
+							_GdpChannel, &req);
+	if (!EP_STAT_ISOK(estat))
+	{
+		char ebuf[100];
+
+		ep_dbg_cprintf(Dbg, 5, "replica_pull(%s): %s\n", r->pname,
+				ep_stat_tostr(estat, ebuf, sizeof ebuf));
+		return false;
+	}
+	resp = req->rpdu->msg->ack_success;
+	if (resp->has_recno)
+		r->leader_nrecs = resp->recno;
+	if (resp->ts != NULL)
+		_gdp_timestamp_from_pb(&r->leader_ts, resp->ts);
+	estat = replica_apply(r, resp);
+	if (EP_STAT_IS_SAME(estat, GDP_STAT_NAK_NOTFOUND) && r->nrecs == 0)
+		more = true;				// retry from the start for the metadata
+	else if (EP_STAT_ISOK(estat) && resp->dl != NULL && resp->dl->n_d > 0)
+		more = r->nrecs < r->leader_nrecs;
+	_gdp_req_free(&req);
+
+	// advertise once we have caught up
+	if (EP_STAT_ISOK(estat) && !r->live && r->nrecs >= r->leader_nrecs)
+	{
+		ep_thr_mutex_lock(&ReplicaMutex);
+		r->live = true;
+		ep_thr_mutex_unlock(&ReplicaMutex);
+		ep_dbg_cprintf(Dbg, 2, "replica %s caught up at %" PRIgdp_recno "\n",
+				r->pname, r->nrecs);
+		logd_advertise_one(_GdpChannel, r->name, GDP_CMD_ADVERTISE);
+		replica_report(r);
+	}
+	return more;
+}
+
+
+static void *
+replica_thread(void *unused)
+{
+	long poll_ms = ep_adm_getlongparam("swarm.gdplogd.replica.pollinterval",
+							REPLICA_POLL_DEFAULT);
+	long report = ep_adm_getlongparam("swarm.gdplogd.replica.report.interval",
+							REPLICA_REPORT_DEFAULT);
+	int32_t maxrecs = ep_adm_getintparam("swarm.gdplogd.replica.maxrecs", 0);
+	EP_TIME_SPEC next_report;
+
+	ep_time_now(&next_report);
+	for (;;)
+	{
+		bool busy = false;
+		EP_TIME_SPEC now;
+		int i;
+
+		for (i = 0; i < NReplicas && _GdpChannel != NULL; i++)
+		{
+			if (!Replicas[i].failed)
+				busy |= replica_pull(&Replicas[i], maxrecs);
+		}
+
+		ep_time_now(&now);
+		if (report > 0 && ep_time_before(&next_report, &now))
+		{
+			for (i = 0; i < NReplicas; i++)
+				replica_report(&Replicas[i]);
+			next_report = now;
+			next_report.tv_sec += report;
+		}
+
+		// no pause while anyone is still catching up
+		if (!busy)
+			ep_time_nanosleep(poll_ms * INT64_C(1000000));
+	}
+	return NULL;
+}
+
+
+/*
+**  REPLICA_INIT --- start following logs
+**
+**		Reads the leader name from swarm.gdplogd.replica.leader and
+**		the logs from swarm.gdplogd.replica.logs (separated by spaces
+**		or commas).  Does nothing if either is unset.
+*/
+
+EP_STAT
+replica_init(void)
+{
+	const char *leader = ep_adm_getstrparam("swarm.gdplogd.replica.leader",
+							NULL);
+	const char *logs = ep_adm_getstrparam("swarm.gdplogd.replica.logs", NULL);
+	char *lbuf;
+	char *p;
+	char *tok;
+	EP_STAT estat;
+
+	if (leader == NULL || logs == NULL)
+		return EP_STAT_OK;
+	estat = gdp_parse_name(leader, Leader);
+	if (!EP_STAT_ISOK(estat))
+	{
+		ep_app_error("swarm.gdplogd.replica.leader: cannot parse %s", leader);
+		return estat;
+	}
+	if (GDP_NAME_SAME(Leader, _GdpMyRoutingName))
+	{
+		ep_app_error("swarm.gdplogd.replica.leader: cannot follow myself");
+		return GDP_STAT_GDP_NAME_INVALID;
+	}
+
+	Replicas = (struct replica *)
+				ep_mem_zalloc(REPLICA_MAXLOGS * sizeof *Replicas);
+	p = lbuf = ep_mem_strdup(logs);
+	while ((tok = strsep(&p, ", \t")) != NULL)
+	{
+		struct replica *r;
+
+		if (*tok == '\0')
+			continue;
+		if (NReplicas >= REPLICA_MAXLOGS)
+		{
+			ep_app_warn("swarm.gdplogd.replica.logs: only %d logs allowed",
+					REPLICA_MAXLOGS);
+			break;
+		}
+		r = &Replicas[NReplicas];
+		estat = gdp_parse_name(tok, r->name);
+		if (!EP_STAT_ISOK(estat))
+		{
+			ep_app_warn("swarm.gdplogd.replica.logs: cannot parse %s", tok);
+			continue;
+		}
+		gdp_printable_name(r->name, r->pname);
+		NReplicas++;
+	}
+	ep_mem_free(lbuf);
+	if (NReplicas == 0)
+		return EP_STAT_OK;
+
+	ep_dbg_cprintf(Dbg, 1, "Following %d logs from %s\n", NReplicas, leader);
+	estat = EP_STAT_OK;
+	if (ep_thr_spawn(&ReplicaThread, replica_thread, NULL) != 0)
+	{
+		estat = ep_stat_from_errno(errno);
+		ep_log(estat, "replica_init: cannot start replication thread");
+	}
+	return estat;
+}
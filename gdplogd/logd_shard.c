@@ -0,0 +1,868 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Log Shards
+**
+**	----- BEGIN LICENSE BLOCK -----
+**	GDPLOGD: Log Daemon for the Global Data Plane
+**	From the Ubiquitous Swarm Lab, 490 Cory Hall, U.C. Berkeley.
+**
+**	Copyright (c) 2015-2019, Regents of the University of California.
+**	All rights reserved.
+**
+**	Permission is hereby granted, without written agreement and without
+**	license or royalty fees, to use, copy, modify, and distribute this
+**	software and its documentation for any purpose, provided that the above
+**	copyright notice and the following two paragraphs appear in all copies
+**	of this software.
+**
+**	IN NO EVENT SHALL REGENTS BE LIABLE TO ANY PARTY FOR DIRECT, INDIRECT,
+**	SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING LOST
+**	PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+**	EVEN IF REGENTS HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**	REGENTS SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT NOT
+**	LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+**	FOR A PARTICULAR PURPOSE. THE SOFTWARE AND ACCOMPANYING DOCUMENTATION,
+**	IF ANY, PROVIDED HEREUNDER IS PROVIDED "AS IS". REGENTS HAS NO
+**	OBLIGATION TO PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS,
+**	OR MODIFICATIONS.
+**	----- END LICENSE BLOCK -----
+*/
+
+/*
+**  Logs can be spread over several root directories ("shards"),
+**  normally each on its own disk.  Within a shard the layout is
+**  the same as it always was: <root>/_xx/<name><suffix>, where xx
+**  is the first octet of the name.
+**
+**  New logs are placed either by a hash of their name or on the
+**  shard with the most free space.  Since logs can be moved, where
+**  a log actually lives is recorded in an in-memory catalog, keyed
+**  by name.  The catalog is filled in as logs are found (by foreach
+**  when advertising, or by probing each shard when a log nobody has
+**  seen yet is opened), so nothing needs to be stored on disk.
+**
+**  With more than one shard each gets its own thread pool, and the
+**  GDP library is told to run commands for a log on the pool of the
+**  shard it lives on.  A slow or stuck disk then only ties up the
+**  workers for that disk.
+**
+**  Open logs are pinned in the catalog.  The rebalancer moves cold
+**  (unpinned and not recently modified) logs from the fullest shard
+**  to the emptiest one while the daemon is running; anyone trying to
+**  open a log that is being moved waits until it has landed.
+*/
+
+#include "logd.h"
+
+#include <ep/ep_hash.h>
+#include <ep/ep_string.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("gdplogd.shard", "GDP Log Daemon log shards");
+
+#define MAX_SHARDS			32			// most log roots
+#define SHARD_PATH_MAX		260			// max length of pathname
+#define SHARD_WORKERS_DEFAULT	8		// max workers per shard pool
+#define REBAL_BATCH			64			// candidates looked at per pass
+#define REBAL_MOVES			8			// moves between balance checks
+#define MOVE_MAXFILES		8			// files making up one log
+
+struct shard
+{
+	char				root[SHARD_PATH_MAX];	// the directory
+	EP_THR_POOL			*pool;					// NULL if only one shard
+	long				nlogs;					// logs in the catalog
+	long				nmoved_in;				// since last report
+	long				nmoved_out;				// since last report
+};
+
+struct shard_loc
+{
+	int					shard;					// where it lives
+	int					npins;					// number of opens
+	bool				moving:1;				// being rebalanced
+};
+
+static struct shard	Shards[MAX_SHARDS];
+static int			NShards;
+static bool			PlaceBySpace;				// else place by hash
+static const char	*ProbeSuffix;				// file marking a log
+static EP_HASH		*Catalog;					// name => shard_loc
+static bool			Rebalancing;				// rebalancer running
+static EP_THR_COND	ShardCond;					// a move has finished
+static EP_THR_MUTEX	ShardMutex		EP_THR_MUTEX_INITIALIZER2(
+										GDP_MUTEX_LORDER_LEAF);
+
+
+/*
+**  Helpers
+*/
+
+static int
+hash_shard(const gdp_name_t name)
+{
+	// name[0] already picks the subdirectory, so use other octets
+	return ((name[1] << 8) | name[2]) % NShards;
+}
+
+static EP_STAT
+log_dir(int shard, const gdp_name_t name, char *buf, size_t bufsize)
+{
+	if (snprintf(buf, bufsize, "%s/_%02x", Shards[shard].root, name[0]) >=
+			(int) bufsize)
+		return EP_STAT_BUF_OVERFLOW;
+	return EP_STAT_OK;
+}
+
+// return true if the log exists in the named shard
+static bool
+probe(int shard, const gdp_name_t name)
+{
+	char path[SHARD_PATH_MAX];
+	gdp_pname_t pname;
+	struct stat st;
+
+	gdp_printable_name(name, pname);
+	if (snprintf(path, sizeof path, "%s/_%02x/%s%s", Shards[shard].root,
+				name[0], pname, ProbeSuffix) >= (int) sizeof path)
+		return false;
+	return stat(path, &st) == 0;
+}
+
+// return percentage of the disk in use, or -1 if unknown
+static int
+used_pct(int shard, uint64_t *availp)
+{
+	struct statvfs sv;
+
+	if (availp != NULL)
+		*availp = 0;
+	if (statvfs(Shards[shard].root, &sv) < 0 || sv.f_blocks == 0)
+		return -1;
+	if (availp != NULL)
+		*availp = (uint64_t) sv.f_bavail * sv.f_frsize;
+	return 100 - (int) ((uint64_t) sv.f_bavail * 100 / sv.f_blocks);
+}
+
+// choose a shard for a new log
+static int
+place(const gdp_name_t name)
+{
+	int best = -1;
+	uint64_t bestavail = 0;
+	int shard;
+
+	if (!PlaceBySpace)
+		return hash_shard(name);
+	for (shard = 0; shard < NShards; shard++)
+	{
+		uint64_t avail;
+
+		if (used_pct(shard, &avail) >= 0 && (best < 0 || avail > bestavail))
+		{
+			best = shard;
+			bestavail = avail;
+		}
+	}
+	return best >= 0 ? best : hash_shard(name);
+}
+
+// find a log on disk, trying the likely shard first
+static int
+find_log(const gdp_name_t name)
+{
+	int first = hash_shard(name);
+	int shard;
+
+	if (probe(first, name))
+		return first;
+	for (shard = 0; shard < NShards; shard++)
+	{
+		if (shard != first && probe(shard, name))
+			return shard;
+	}
+	return -1;
+}
+
+// add a log to the catalog (ShardMutex locked)
+static struct shard_loc *
+catalog_add(const gdp_name_t name, int shard)
+{
+	struct shard_loc *loc = (struct shard_loc *) ep_mem_zalloc(sizeof *loc);
+
+	loc->shard = shard;
+	(void) ep_hash_insert(Catalog, sizeof (gdp_name_t), name, loc);
+	Shards[shard].nlogs++;
+	return loc;
+}
+
+
+/*
+**  SHARD_INIT --- find the log roots and set up their pools
+**
+**		If logroot is given (e.g., on the command line) it is the
+**		only shard.  Otherwise swarm.gdplogd.log.dirs lists them,
+**		falling back to the single swarm.gdplogd.log.dir.  The
+**		probe suffix names the file that every log has; it is used
+**		to find logs that aren't yet in the catalog.
+**
+**		Called before threads have been spawned.
+*/
+
+EP_STAT
+shard_init(const char *logroot, const char *default_dir, const char *sfx)
+{
+	EP_STAT estat = EP_STAT_OK;
+	const char *dirs = NULL;
+	const char *p;
+	int shard;
+
+	ProbeSuffix = sfx;
+	NShards = 0;
+	if (logroot == NULL)
+		dirs = ep_adm_getstrparam("swarm.gdplogd.log.dirs", NULL);
+	if (logroot != NULL)
+	{
+		strlcpy(Shards[0].root, logroot, sizeof Shards[0].root);
+		NShards = 1;
+	}
+	else if (dirs == NULL || *dirs == '\0')
+	{
+		estat = _gdp_adm_path_find("swarm.gdp.data.root", GDP_DEFAULT_DATA_ROOT,
+							"swarm.gdplogd.log.dir", default_dir,
+							Shards[0].root, sizeof Shards[0].root);
+		EP_STAT_CHECK(estat, return estat);
+		NShards = 1;
+	}
+	else
+	{
+		// comma-separated list of directories
+		for (p = dirs; *p != '\0'; )
+		{
+			size_t len = strcspn(p, ",");
+			const char *next = p + len;
+
+			while (len > 0 && (*p == ' ' || *p == '\t'))
+			{
+				p++;
+				len--;
+			}
+			while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t'))
+				len--;
+			if (len > 0)
+			{
+				if (NShards >= MAX_SHARDS)
+				{
+					ep_app_warn("shard_init: more than %d log directories;"
+							" ignoring the rest", MAX_SHARDS);
+					break;
+				}
+				// relative names are relative to the data root
+				char *root = Shards[NShards].root;
+				size_t rootsize = sizeof Shards[NShards].root;
+				int n = 0;
+
+				if (*p != '/')
+				{
+					n = snprintf(root, rootsize, "%s/",
+							ep_adm_getstrparam("swarm.gdp.data.root",
+										GDP_DEFAULT_DATA_ROOT));
+				}
+				if (n < 0 || n + len >= rootsize)
+					return EP_STAT_BUF_OVERFLOW;
+				memcpy(root + n, p, len);
+				root[n + len] = '\0';
+				NShards++;
+			}
+			p = *next == ',' ? next + 1 : next;
+		}
+		if (NShards == 0)
+			return EP_STAT_ERROR;
+	}
+
+	for (shard = 0; shard < NShards; shard++)
+	{
+		struct stat st;
+
+		if (stat(Shards[shard].root, &st) < 0 || !S_ISDIR(st.st_mode))
+		{
+			estat = ep_stat_from_errno(errno == 0 ? ENOTDIR : errno);
+			ep_app_message(estat, "shard_init: %s", Shards[shard].root);
+			return estat;
+		}
+	}
+
+	p = ep_adm_getstrparam("swarm.gdplogd.log.placement", "hash");
+	PlaceBySpace = strcasecmp(p, "space") == 0;
+	ep_thr_cond_init(&ShardCond);
+	Catalog = ep_hash_new("shard catalog", NULL, 0);
+
+	if (NShards > 1)
+	{
+		int nworkers = ep_adm_getintparam("swarm.gdplogd.shard.workers",
+								SHARD_WORKERS_DEFAULT);
+
+		// threads are started as they are needed
+		for (shard = 0; shard < NShards; shard++)
+			Shards[shard].pool = ep_thr_pool_new(Shards[shard].root,
+										0, nworkers);
+		_GdpGobPoolFunc = &shard_pool_for;
+	}
+
+	for (shard = 0; shard < NShards; shard++)
+		ep_dbg_cprintf(Dbg, 8, "shard_init: shard %d = %s\n",
+				shard, Shards[shard].root);
+	return estat;
+}
+
+
+/*
+**  SHARD_COUNT, SHARD_ROOT --- enumerate shards
+*/
+
+int
+shard_count(void)
+{
+	return NShards;
+}
+
+const char *
+shard_root(int shard)
+{
+	EP_ASSERT_ELSE(shard >= 0 && shard < NShards, return NULL);
+	return Shards[shard].root;
+}
+
+
+/*
+**  SHARD_PIN --- find (or place) a log and keep it from moving
+**
+**		If the log doesn't exist anywhere and create is false this
+**		returns the shard it would be on, so the caller's open fails
+**		in the usual way; it should then unpin with forget set.
+*/
+
+int
+shard_pin(const gdp_name_t name, bool create)
+{
+	struct shard_loc *loc;
+	int shard;
+
+	for (;;)
+	{
+		ep_thr_mutex_lock(&ShardMutex);
+		loc = (struct shard_loc *) ep_hash_search(Catalog,
+								sizeof (gdp_name_t), name);
+		while (loc != NULL && loc->moving)
+		{
+			// wait for it to land (it can't disappear while moving)
+			ep_thr_cond_wait(&ShardCond, &ShardMutex, NULL);
+		}
+		if (loc != NULL)
+		{
+			loc->npins++;
+			shard = loc->shard;
+			ep_thr_mutex_unlock(&ShardMutex);
+			return shard;
+		}
+		ep_thr_mutex_unlock(&ShardMutex);
+
+		// not cataloged: look on the disks without holding the lock
+		shard = NShards == 1 ? 0 : find_log(name);
+		if (shard < 0)
+			shard = create ? place(name) : hash_shard(name);
+
+		ep_thr_mutex_lock(&ShardMutex);
+		if (ep_hash_search(Catalog, sizeof (gdp_name_t), name) == NULL)
+		{
+			loc = catalog_add(name, shard);
+			loc->npins++;
+			ep_thr_mutex_unlock(&ShardMutex);
+			return shard;
+		}
+
+		// someone else got there first; use what they found
+		ep_thr_mutex_unlock(&ShardMutex);
+	}
+}
+
+
+/*
+**  SHARD_UNPIN --- release a log pinned by shard_pin
+**
+**		If forget is set (the log was removed or never existed)
+**		it is dropped from the catalog once nobody has it pinned.
+*/
+
+void
+shard_unpin(const gdp_name_t name, bool forget)
+{
+	struct shard_loc *loc;
+
+	ep_thr_mutex_lock(&ShardMutex);
+	loc = (struct shard_loc *) ep_hash_search(Catalog,
+							sizeof (gdp_name_t), name);
+	if (EP_ASSERT(loc != NULL) && EP_ASSERT(loc->npins > 0))
+	{
+		if (--loc->npins == 0 && forget)
+		{
+			Shards[loc->shard].nlogs--;
+			(void) ep_hash_delete(Catalog, sizeof (gdp_name_t), name);
+			ep_mem_free(loc);
+		}
+	}
+	ep_thr_mutex_unlock(&ShardMutex);
+}
+
+
+/*
+**  SHARD_NOTE --- record a log found while scanning a shard
+**
+**		Returns false if the log is already known to be on another
+**		shard, in which case the caller should skip it.  That happens
+**		briefly while a log is being moved, or if a move was cut
+**		short by a crash, leaving copies in two places.
+*/
+
+bool
+shard_note(const gdp_name_t name, int shard)
+{
+	struct shard_loc *loc;
+	bool ok = true;
+
+	ep_thr_mutex_lock(&ShardMutex);
+	loc = (struct shard_loc *) ep_hash_search(Catalog,
+							sizeof (gdp_name_t), name);
+	if (loc == NULL)
+		(void) catalog_add(name, shard);
+	else if (loc->shard != shard)
+	{
+		ok = false;
+		if (!loc->moving)
+		{
+			gdp_pname_t pname;
+
+			ep_log(GDP_STAT_CORRUPT_LOG,
+					"log %s is in both %s and %s; using the first",
+					gdp_printable_name(name, pname),
+					Shards[loc->shard].root, Shards[shard].root);
+		}
+	}
+	ep_thr_mutex_unlock(&ShardMutex);
+	return ok;
+}
+
+
+/*
+**  SHARD_POOL_FOR --- return the thread pool for a log
+**
+**		Called from the I/O thread (see _GdpGobPoolFunc), so this
+**		never touches the disk: logs not in the catalog yet go to
+**		the shard they would be placed on by hash, or to the default
+**		pool if placement is by space.
+*/
+
+EP_THR_POOL *
+shard_pool_for(const gdp_name_t name)
+{
+	struct shard_loc *loc;
+	int shard = -1;
+
+	if (NShards < 2)
+		return NULL;
+	ep_thr_mutex_lock(&ShardMutex);
+	loc = (struct shard_loc *) ep_hash_search(Catalog,
+							sizeof (gdp_name_t), name);
+	if (loc != NULL)
+		shard = loc->shard;
+	ep_thr_mutex_unlock(&ShardMutex);
+	if (shard < 0 && !PlaceBySpace)
+		shard = hash_shard(name);
+	return shard < 0 ? NULL : Shards[shard].pool;
+}
+
+
+/*
+**  SHARD_GETSTATS --- return statistics for a shard
+**
+**		Move counts are reset each time.
+*/
+
+void
+shard_getstats(int shard, struct shard_stats *st)
+{
+	EP_ASSERT_ELSE(shard >= 0 && shard < NShards, return);
+	memset(st, 0, sizeof *st);
+	st->root = Shards[shard].root;
+	st->pool = Shards[shard].pool;
+	st->used_pct = used_pct(shard, NULL);
+	ep_thr_mutex_lock(&ShardMutex);
+	st->nlogs = Shards[shard].nlogs;
+	st->nmoved_in = Shards[shard].nmoved_in;
+	st->nmoved_out = Shards[shard].nmoved_out;
+	Shards[shard].nmoved_in = Shards[shard].nmoved_out = 0;
+	ep_thr_mutex_unlock(&ShardMutex);
+}
+
+
+/*
+**  Moving logs between shards.
+*/
+
+static EP_STAT
+copy_file(const char *from, const char *to)
+{
+	EP_STAT estat = EP_STAT_OK;
+	char buf[64 * 1024];
+	struct stat st;
+	int ifd;
+	int ofd = -1;
+	ssize_t n;
+
+	if ((ifd = open(from, O_RDONLY)) < 0 || fstat(ifd, &st) < 0)
+		goto fail0;
+	ofd = open(to, O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 07777);
+	if (ofd < 0)
+		goto fail0;
+	while ((n = read(ifd, buf, sizeof buf)) > 0)
+	{
+		char *p = buf;
+
+		while (n > 0)
+		{
+			ssize_t w = write(ofd, p, n);
+
+			if (w < 0)
+				goto fail0;
+			p += w;
+			n -= w;
+		}
+	}
+	if (n < 0 || fsync(ofd) < 0)
+		goto fail0;
+	goto done;
+
+fail0:
+	estat = ep_stat_from_errno(errno);
+	ep_log(estat, "shard: cannot copy %s to %s", from, to);
+done:
+	if (ofd >= 0 && close(ofd) < 0 && EP_STAT_ISOK(estat))
+		estat = ep_stat_from_errno(errno);
+	if (ifd >= 0)
+		close(ifd);
+	return estat;
+}
+
+/*
+**  MOVE_LOG --- move one cold log from one shard to another
+**
+**		All the files for the log are copied next to their final
+**		names, then renamed into place, then the originals are
+**		removed.  A crash part way through leaves either the old
+**		copy alone or both (see shard_note), never neither.
+**		Returns true if the log was moved.
+*/
+
+static bool
+move_log(const gdp_name_t name, int from, int to)
+{
+	struct shard_loc *loc;
+	char fromdir[SHARD_PATH_MAX];
+	char todir[SHARD_PATH_MAX];
+	char files[MOVE_MAXFILES][NAME_MAX + 1];
+	gdp_pname_t pname;
+	EP_STAT estat = EP_STAT_OK;
+	struct dirent *dent;
+	DIR *dir;
+	int nfiles = 0;
+	int i;
+
+	EP_ASSERT_ELSE(from != to, return false);
+	ep_thr_mutex_lock(&ShardMutex);
+	loc = (struct shard_loc *) ep_hash_search(Catalog,
+							sizeof (gdp_name_t), name);
+	if (loc == NULL || loc->npins > 0 || loc->moving || loc->shard != from)
+	{
+		ep_thr_mutex_unlock(&ShardMutex);
+		return false;
+	}
+	loc->moving = true;
+	ep_thr_mutex_unlock(&ShardMutex);
+
+	gdp_printable_name(name, pname);
+	ep_dbg_cprintf(Dbg, 10, "move_log(%s): %s => %s\n",
+			pname, Shards[from].root, Shards[to].root);
+	estat = log_dir(from, name, fromdir, sizeof fromdir);
+	if (EP_STAT_ISOK(estat))
+		estat = log_dir(to, name, todir, sizeof todir);
+	EP_STAT_CHECK(estat, goto done);
+	if (mkdir(todir, 0775) < 0 && errno != EEXIST)
+	{
+		estat = ep_stat_from_errno(errno);
+		goto done;
+	}
+
+	// copy everything belonging to the log
+	if ((dir = opendir(fromdir)) == NULL)
+	{
+		estat = ep_stat_from_errno(errno);
+		goto done;
+	}
+	while (EP_STAT_ISOK(estat) && (dent = readdir(dir)) != NULL)
+	{
+		char frompath[SHARD_PATH_MAX + NAME_MAX + 2];
+		char topath[SHARD_PATH_MAX + NAME_MAX + 10];
+
+		if (strncmp(pname, dent->d_name, GDP_GOB_PNAME_LEN) != 0)
+			continue;
+		if (nfiles >= MOVE_MAXFILES)
+		{
+			estat = EP_STAT_BUF_OVERFLOW;
+			break;
+		}
+		strlcpy(files[nfiles], dent->d_name, sizeof files[nfiles]);
+		snprintf(frompath, sizeof frompath, "%s/%s", fromdir, dent->d_name);
+		snprintf(topath, sizeof topath, "%s/%s.moving", todir, dent->d_name);
+		estat = copy_file(frompath, topath);
+		nfiles++;
+	}
+	closedir(dir);
+
+	// put them in place, or clean up
+	for (i = 0; i < nfiles; i++)
+	{
+		char path[SHARD_PATH_MAX + NAME_MAX + 10];
+		char topath[SHARD_PATH_MAX + NAME_MAX + 2];
+
+		snprintf(path, sizeof path, "%s/%s.moving", todir, files[i]);
+		snprintf(topath, sizeof topath, "%s/%s", todir, files[i]);
+		if (!EP_STAT_ISOK(estat))
+			(void) unlink(path);
+		else if (rename(path, topath) < 0)
+			estat = ep_stat_from_errno(errno);
+	}
+	if (EP_STAT_ISOK(estat))
+	{
+		for (i = 0; i < nfiles; i++)
+		{
+			char path[SHARD_PATH_MAX + NAME_MAX + 2];
+
+			snprintf(path, sizeof path, "%s/%s", fromdir, files[i]);
+			if (unlink(path) < 0)
+				ep_log(ep_stat_from_errno(errno), "shard: cannot remove %s",
+						path);
+		}
+	}
+
+done:
+	if (!EP_STAT_ISOK(estat))
+		ep_log(estat, "shard: cannot move log %s from %s to %s",
+				pname, Shards[from].root, Shards[to].root);
+	ep_thr_mutex_lock(&ShardMutex);
+	if (EP_STAT_ISOK(estat) && nfiles > 0)
+	{
+		loc->shard = to;
+		Shards[from].nlogs--;
+		Shards[from].nmoved_out++;
+		Shards[to].nlogs++;
+		Shards[to].nmoved_in++;
+	}
+	loc->moving = false;
+	ep_thr_cond_broadcast(&ShardCond);
+	ep_thr_mutex_unlock(&ShardMutex);
+	return EP_STAT_ISOK(estat) && nfiles > 0;
+}
+
+// collect names of unpinned logs on one shard
+struct rebal_scan
+{
+	int			shard;
+	int			n;
+	gdp_name_t	names[REBAL_BATCH];
+};
+
+static void
+scan_shard(size_t keylen, const void *key, const void *val, va_list av)
+{
+	struct rebal_scan *scan = va_arg(av, struct rebal_scan *);
+	const struct shard_loc *loc = (const struct shard_loc *) val;
+
+	// deleted entries stay in the table with no value
+	if (loc == NULL || scan->n >= REBAL_BATCH || loc->shard != scan->shard ||
+			loc->npins > 0 || loc->moving)
+		return;
+	memcpy(scan->names[scan->n++], key, sizeof (gdp_name_t));
+}
+
+// true if the log hasn't been written for a while
+static bool
+is_cold(int shard, const gdp_name_t name, time_t minidle)
+{
+	char path[SHARD_PATH_MAX];
+	gdp_pname_t pname;
+	struct stat st;
+
+	gdp_printable_name(name, pname);
+	if (snprintf(path, sizeof path, "%s/_%02x/%s%s", Shards[shard].root,
+				name[0], pname, ProbeSuffix) >= (int) sizeof path)
+		return false;
+	return stat(path, &st) == 0 && st.st_mtime + minidle < time(NULL);
+}
+
+
+/*
+**  The copying is done on the pool of the shard being moved from,
+**  in the read lane, so it ties up that disk's workers (and only
+**  a share of them) rather than the default pool's.  The
+**  rebalancer hands out a few moves at a time and waits for them.
+*/
+
+struct rebal_batch
+{
+	int			from;
+	int			to;
+	time_t		minidle;
+	int			npending;				// moves not yet finished
+	int			nmoved;					// moves that succeeded
+	struct rebal_move
+	{
+		struct rebal_batch	*batch;
+		gdp_name_t			name;
+	}			moves[REBAL_MOVES];
+};
+
+static void
+rebal_move(void *m_)
+{
+	struct rebal_move *m = (struct rebal_move *) m_;
+	struct rebal_batch *batch = m->batch;
+	bool moved;
+
+	moved = is_cold(batch->from, m->name, batch->minidle) &&
+			move_log(m->name, batch->from, batch->to);
+	ep_thr_mutex_lock(&ShardMutex);
+	if (moved)
+		batch->nmoved++;
+	batch->npending--;
+	ep_thr_cond_broadcast(&ShardCond);
+	ep_thr_mutex_unlock(&ShardMutex);
+}
+
+
+/*
+**  SHARD_REBALANCE --- move cold logs off the fullest shard
+**
+**		Moves logs from the shard with the highest percentage of
+**		its disk used to the one with the lowest until they are
+**		within swarm.gdplogd.shard.rebalance.spread percent of each
+**		other, or swarm.gdplogd.shard.rebalance.max logs have moved.
+**		Only logs that aren't open and haven't been written for
+**		swarm.gdplogd.shard.rebalance.minidle seconds are moved.
+**		Runs in a worker thread; only one can run at a time.
+*/
+
+void
+shard_rebalance(void *unused)
+{
+	int spread = ep_adm_getintparam("swarm.gdplogd.shard.rebalance.spread", 10);
+	int maxmoves = ep_adm_getintparam("swarm.gdplogd.shard.rebalance.max", 100);
+	time_t minidle = ep_adm_getlongparam("swarm.gdplogd.shard.rebalance.minidle",
+								3600);
+	struct rebal_batch batch;
+	int nmoved = 0;
+	int from = -1;
+	int to = -1;
+
+	if (NShards < 2)
+		return;
+	ep_thr_mutex_lock(&ShardMutex);
+	if (Rebalancing)
+	{
+		ep_thr_mutex_unlock(&ShardMutex);
+		return;
+	}
+	Rebalancing = true;
+	ep_thr_mutex_unlock(&ShardMutex);
+
+	while (nmoved < maxmoves)
+	{
+		struct rebal_scan scan;
+		int maxused = -1;
+		int minused = 101;
+		int shard;
+		int i;
+		bool progress = false;
+
+		// find the fullest and emptiest shards
+		for (shard = 0; shard < NShards; shard++)
+		{
+			int used = used_pct(shard, NULL);
+
+			if (used < 0)
+				continue;
+			if (used > maxused)
+			{
+				maxused = used;
+				from = shard;
+			}
+			if (used < minused)
+			{
+				minused = used;
+				to = shard;
+			}
+		}
+		if (maxused < 0 || from == to || maxused - minused <= spread)
+			break;
+
+		scan.shard = from;
+		scan.n = 0;
+		ep_thr_mutex_lock(&ShardMutex);
+		ep_hash_forall(Catalog, scan_shard, &scan);
+		ep_thr_mutex_unlock(&ShardMutex);
+
+		// hand out moves until some succeed, then recheck the balance
+		for (i = 0; i < scan.n && !progress; )
+		{
+			int n;
+
+			batch.from = from;
+			batch.to = to;
+			batch.minidle = minidle;
+			batch.nmoved = 0;
+			for (n = 0; n < REBAL_MOVES && i < scan.n &&
+					nmoved + n < maxmoves; n++, i++)
+			{
+				batch.moves[n].batch = &batch;
+				memcpy(batch.moves[n].name, scan.names[i], sizeof (gdp_name_t));
+			}
+			if (n == 0)
+				break;
+			batch.npending = n;
+			while (--n >= 0)
+				ep_thr_pool_run_in(Shards[from].pool, GDP_LANE_READ,
+						&rebal_move, &batch.moves[n]);
+			ep_thr_mutex_lock(&ShardMutex);
+			while (batch.npending > 0)
+				ep_thr_cond_wait(&ShardCond, &ShardMutex, NULL);
+			ep_thr_mutex_unlock(&ShardMutex);
+			nmoved += batch.nmoved;
+			progress = batch.nmoved > 0;
+		}
+		if (!progress)
+			break;
+	}
+
+	if (nmoved > 0)
+		ep_log(EP_STAT_OK, "shard: moved %d logs from %s to %s",
+				nmoved, Shards[from].root, Shards[to].root);
+	ep_thr_mutex_lock(&ShardMutex);
+	Rebalancing = false;
+	ep_thr_mutex_unlock(&ShardMutex);
+}
@@ -43,6 +43,7 @@
 #include <gdp/gdp_md.h>
 
 #include <ep/ep_hexdump.h>
+#include <ep/ep_metric.h>
 #include <ep/ep_net.h>
 #include <ep/ep_string.h>
 
@@ -61,6 +62,16 @@ static int			GOBfilemode;		// the file mode on create
 static uint32_t		DefaultLogFlags;	// as indicated
 static char			LogDir[GOB_PATH_MAX];	// the gob data directory
 
+static EP_METRIC	Appends = EP_METRIC_COUNTER_INIT("sqlite",
+						"appends_total", "Records appended");
+static EP_METRIC	AppendUsec = EP_METRIC_HISTOGRAM_INIT("sqlite",
+						"append_usec", "Time to append a record",
+						EpMetricUsecBounds);
+static EP_METRIC	RecordsRead = EP_METRIC_COUNTER_INIT("sqlite",
+						"records_read_total", "Records read");
+static EP_METRIC	Errors = EP_METRIC_COUNTER_INIT("sqlite",
+						"errors_total", "SQLite errors");
+
 #define GETPHYS(gob)	((gob)->x->physinfo)
 
 #define FLAG_TMPFILE		0x00000001	// this is a temporary file
@@ -92,6 +103,26 @@ static const char *LogSchema =
 				"CREATE INDEX timestamp_index\n"
 				"	ON log_entry(timestamp);\n";
 
+/*
+**  Merkle tree nodes and checkpoints (see logd_merkle.c).  Only
+**  complete (power of two) subtrees are stored; level 0 holds the
+**  leaves.  These were added after the log format was fixed, so
+**  they are created on open if missing rather than bumping the
+**  database version.
+*/
+
+static const char *MerkleSchema =
+				"CREATE TABLE IF NOT EXISTS merkle_node (\n"
+				"	level INTEGER,\n"
+				"	idx INTEGER,\n"
+				"	hash BLOB(32),\n"
+				"	PRIMARY KEY (level, idx));\n"
+				"CREATE TABLE IF NOT EXISTS merkle_checkpoint (\n"
+				"	treesize INTEGER PRIMARY KEY,\n"
+				"	root BLOB(32),\n"
+				"	timestamp INTEGER,\n"	// 64 bit, nanoseconds since 1/1/70
+				"	sig BLOB);\n";
+
 
 /*
 **  FSIZEOF --- return the size of a file
@@ -196,6 +227,7 @@ sqlite_error(int rc, const char *sqerrmsg, const char *where, const char *phase)
 	EP_STAT estat = ep_stat_from_sqlite_result_code(rc);
 	if (EP_STAT_ISOK(estat))
 		estat = GDP_STAT_SQLITE_ERROR;
+	ep_metric_inc(&Errors);
 	if ((rc != SQLITE_OK || sqerrmsg != NULL) && ep_dbg_test(Dbg, 1))
 	{
 		char ebuf[100];
@@ -294,24 +326,18 @@ sqlite_init(const char *logroot)
 {
 	EP_STAT estat = EP_STAT_OK;
 
-	// find physical location of GOB directory
-	if (logroot != NULL)
-		strlcpy(LogDir, logroot, sizeof LogDir);
-	else
+	// find physical location(s) of GOB directories
+	estat = shard_init(logroot, GDP_DEFAULT_LOG_DIR, GLOG_SUFFIX);
+	if (!EP_STAT_ISOK(estat))
 	{
-		estat = _gdp_adm_path_find("swarm.gdp.data.root", GDP_DEFAULT_DATA_ROOT,
-							"swarm.gdplogd.log.dir", GDP_DEFAULT_LOG_DIR,
-							LogDir, sizeof LogDir);
-		if (!EP_STAT_ISOK(estat))
-		{
-			char ebuf[100];
-			ep_dbg_cprintf(Dbg, 1, "sqlite_init: _gdp_adm_path_find => %s\n",
-					ep_stat_tostr(estat, ebuf, sizeof ebuf));
-			return estat;
-		}
+		char ebuf[100];
+		ep_dbg_cprintf(Dbg, 1, "sqlite_init: shard_init => %s\n",
+				ep_stat_tostr(estat, ebuf, sizeof ebuf));
+		return estat;
 	}
+	strlcpy(LogDir, shard_root(0), sizeof LogDir);
 
-	// we will run out of that directory
+	// we will run out of the first directory
 	if (chdir(LogDir) != 0)
 	{
 		estat = ep_stat_from_errno(errno);
@@ -334,9 +360,14 @@ sqlite_init(const char *logroot)
 
 	sqlite_init_pragmas();
 
+	ep_metric_register(&Appends);
+	ep_metric_register(&AppendUsec);
+	ep_metric_register(&RecordsRead);
+	ep_metric_register(&Errors);
+
 	SQLiteInitialized = true;
-	ep_dbg_cprintf(Dbg, 8, "sqlite_init: log dir = %s, mode = 0%o\n",
-			LogDir, GOBfilemode);
+	ep_dbg_cprintf(Dbg, 8, "sqlite_init: log dir = %s (%d shards), mode = 0%o\n",
+			LogDir, shard_count(), GOBfilemode);
 
 	return estat;
 }
@@ -399,10 +430,13 @@ sql_bind_buf(sqlite3_stmt *stmt, int index, gdp_buf_t *buf)
 
 /*
 **	GET_LOG_PATH --- get the pathname to an on-disk version of the gob
+**
+**		The log must have been pinned to the shard (see logd_shard.c).
 */
 
 static EP_STAT
 get_log_path(gdp_gob_t *gob,
+		int shard,
 		const char *sfx,
 		char *pbuf,
 		int pbufsiz)
@@ -418,7 +452,7 @@ get_log_path(gdp_gob_t *gob,
 	gdp_printable_name(gob->name, pname);
 
 	// find the subdirectory based on the first part of the name
-	i = snprintf(pbuf, pbufsiz, "%s/_%02x", LogDir, gob->name[0]);
+	i = snprintf(pbuf, pbufsiz, "%s/_%02x", shard_root(shard), gob->name[0]);
 	if (i >= pbufsiz)
 		goto fail1;
 	if (stat(pbuf, &st) < 0)
@@ -437,7 +471,7 @@ get_log_path(gdp_gob_t *gob,
 
 	// now return the final complete name
 	i = snprintf(pbuf, pbufsiz, "%s/_%02x/%s%s",
-				LogDir, gob->name[0], pname, sfx);
+				shard_root(shard), gob->name[0], pname, sfx);
 	if (i < pbufsiz)
 		return EP_STAT_OK;
 
@@ -513,6 +547,12 @@ physinfo_free(gob_physinfo_t *phys)
 			sqlite3_finalize(phys->read_by_timestamp_stmt);
 		if (phys->insert_stmt != NULL)
 			sqlite3_finalize(phys->insert_stmt);
+		if (phys->rechash_stmt != NULL)
+			sqlite3_finalize(phys->rechash_stmt);
+		if (phys->merkle_get_stmt != NULL)
+			sqlite3_finalize(phys->merkle_get_stmt);
+		if (phys->merkle_put_stmt != NULL)
+			sqlite3_finalize(phys->merkle_put_stmt);
 
 		// we can now close the database
 		rc = sqlite3_close(phys->db);
@@ -556,6 +596,7 @@ sqlite_create(gdp_gob_t *gob, gdp_md_t *gmd)
 	const char *phase = "init";
 	int rc;
 	char *sqerrstr = NULL;
+	bool pinned = false;
 
 	EP_ASSERT_POINTER_VALID(gob);
 
@@ -572,10 +613,15 @@ sqlite_create(gdp_gob_t *gob, gdp_md_t *gmd)
 		EP_STAT_CHECK(estat, goto fail0);
 	}
 
+	// decide where it goes and keep it there
+	phys->shard = shard_pin(gob->name, true);
+	pinned = true;
+
 	// create an empty file to hold the log database (this is required
 	// to get the file mode right)
 	char db_path[GOB_PATH_MAX];
-	estat = get_log_path(gob, GLOG_SUFFIX, db_path, sizeof db_path);
+	estat = get_log_path(gob, phys->shard, GLOG_SUFFIX,
+						db_path, sizeof db_path);
 	EP_STAT_CHECK(estat, goto fail0);
 
 	ep_dbg_cprintf(Dbg, 20, "sqlite_create: creating %s\n", db_path);
@@ -651,6 +697,8 @@ sqlite_create(gdp_gob_t *gob, gdp_md_t *gmd)
 		// sqlite3_exec(db, cmd, callback, closure, *errmsg)
 		rc = sqlite3_exec(phys->db, LogSchema, NULL, NULL, &sqerrstr);
 		CHECK_RC(rc, goto fail1);
+		rc = sqlite3_exec(phys->db, MerkleSchema, NULL, NULL, &sqerrstr);
+		CHECK_RC(rc, goto fail1);
 	}
 
 	//XXX should probably use Write Ahead Logging
@@ -744,6 +792,8 @@ fail0:
 			estat = GDP_STAT_NAK_CONFLICT;
 
 	// free up resources
+	if (pinned)
+		shard_unpin(gob->name, true);
 	if (phys != NULL)
 	{
 		physinfo_free(phys);
@@ -842,8 +892,10 @@ sqlite_open(gdp_gob_t *gob)
 	*/
 
 	phase = "get db path";
+	phys->shard = shard_pin(gob->name, false);
 	char db_path[GOB_PATH_MAX];
-	estat = get_log_path(gob, GLOG_SUFFIX, db_path, sizeof db_path);
+	estat = get_log_path(gob, phys->shard, GLOG_SUFFIX,
+						db_path, sizeof db_path);
 	EP_STAT_CHECK(estat, goto fail1);
 
 	phase = "sqlite3_open_v2";
@@ -875,6 +927,14 @@ sqlite_open(gdp_gob_t *gob)
 	if (!EP_STAT_ISOK(estat))
 		goto fail1;
 
+#if !GDP_LOG_VIEW
+	// logs created before Merkle support won't have those tables yet
+	phase = "merkle schema";
+	rc = sqlite3_exec(phys->db, MerkleSchema, NULL, NULL, NULL);
+	if (rc != SQLITE_OK)
+		goto fail2;
+#endif
+
 	// read metadata
 	phase = "metadata read";
 	if (gob->gob_md == NULL)
@@ -936,6 +996,7 @@ fail2:
 			estat = GDP_STAT_NAK_INTERNAL;
 	}
 fail1:
+	shard_unpin(gob->name, true);
 	physinfo_free(phys);
 	gob->x->physinfo = phys = NULL;
 
@@ -965,6 +1026,7 @@ sqlite_close(gdp_gob_t *gob)
 		// close as a result of incomplete open; just ignore it
 		return EP_STAT_OK;
 	}
+	shard_unpin(gob->name, false);
 	physinfo_free(GETPHYS(gob));
 	gob->x->physinfo = NULL;
 
@@ -990,8 +1052,15 @@ sqlite_remove(gdp_gob_t *gob)
 
 	DIR *dir;
 	char dbuf[GOB_PATH_MAX];
+	int shard;
+
+	// an open log is already pinned; otherwise find it
+	if (GETPHYS(gob) != NULL)
+		shard = GETPHYS(gob)->shard;
+	else
+		shard = shard_pin(gob->name, false);
 
-	snprintf(dbuf, sizeof dbuf, "%s/_%02x", LogDir, gob->name[0]);
+	snprintf(dbuf, sizeof dbuf, "%s/_%02x", shard_root(shard), gob->name[0]);
 	ep_dbg_cprintf(Dbg, 21, "  remove directory %s%s%s\n",
 					EpChar->lquote, dbuf, EpChar->rquote);
 	dir = opendir(dbuf);
@@ -1017,8 +1086,8 @@ sqlite_remove(gdp_gob_t *gob)
 			char filenamebuf[GOB_PATH_MAX];
 
 			ep_dbg_cprintf(Dbg, 50, "unlinking\n");
-			snprintf(filenamebuf, sizeof filenamebuf, "_%02x/%s",
-					gob->name[0], dent->d_name);
+			snprintf(filenamebuf, sizeof filenamebuf, "%s/%s",
+					dbuf, dent->d_name);
 			if (unlink(filenamebuf) < 0)
 				estat = posix_error(errno, "unlink(%s)", filenamebuf);
 		}
@@ -1030,6 +1099,8 @@ sqlite_remove(gdp_gob_t *gob)
 	closedir(dir);
 
 fail0:
+	// this drops the pin from the open (or the one above)
+	shard_unpin(gob->name, true);
 	physinfo_free(GETPHYS(gob));
 	gob->x->physinfo = NULL;
 
@@ -1121,6 +1192,7 @@ process_row(sqlite3_stmt *stmt,
 	}
 
 	estat = (*cb)(GDP_STAT_ACK_CONTENT, datum, cb_ctx);
+	ep_metric_inc(&RecordsRead);
 
 	gdp_datum_free(datum);
 	return estat;
@@ -1135,10 +1207,17 @@ process_select_results(sqlite3_stmt *stmt,
 	int rc;
 	EP_STAT estat = EP_STAT_OK;
 	int nresults = 0;
+	bool budget_stop = false;
 
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
 	{
-		process_row(stmt, cb, cb_ctx);
+		// callback may decline a row if it is over its byte budget
+		if (EP_STAT_IS_SAME(process_row(stmt, cb, cb_ctx),
+					GDP_STAT_READ_BUDGET))
+		{
+			budget_stop = true;
+			break;
+		}
 		nresults++;
 		if (one_only)
 			break;
@@ -1148,6 +1227,11 @@ process_select_results(sqlite3_stmt *stmt,
 	{
 		estat = sqlite_error(reset_rc, NULL, "process_select_results", "reset");
 	}
+	else if (budget_stop)
+	{
+		// caller knows where to resume
+		estat = GDP_STAT_READ_BUDGET;
+	}
 	else if (rc == SQLITE_ROW)
 	{
 		// "one_only" case
@@ -1457,7 +1541,9 @@ sqlite_append(gdp_gob_t *gob,
 	int rc = SQLITE_OK;
 	gob_physinfo_t *phys;
 	const char *phase;
+	EP_TIME_SPEC start, end;
 
+	ep_time_now(&start);
 	if (ep_dbg_test(Dbg, 44))
 	{
 		ep_dbg_printf("sqlite_append(%s):\n    ", gob->pname);
@@ -1530,6 +1616,12 @@ fail3:
 
 	ep_thr_rwlock_unlock(&phys->lock);
 
+	if (EP_STAT_ISOK(estat))
+	{
+		ep_time_now(&end);
+		ep_metric_inc(&Appends);
+		ep_metric_observe(&AppendUsec, ep_time_diff_usec(&start, &end));
+	}
 	return estat;
 }
 
@@ -1572,55 +1664,66 @@ sqlite_getmetadata(gdp_gob_t *gob,
 /*
 **  GOB_PHYSFOREACH --- call function for each GOB in directory
 **
+**		Walks every shard.  A log found in more than one shard
+**		(e.g., one being moved) is only reported once.
+**
 **		Return the highest severity error code found
 */
 
 static EP_STAT
 sqlite_foreach(EP_STAT (*func)(gdp_name_t, void *), void *ctx)
 {
+	int shard;
 	int subdir;
 	EP_STAT estat = EP_STAT_OK;
 
-	for (subdir = 0; subdir < 0x100; subdir++)
+	for (shard = 0; shard < shard_count(); shard++)
 	{
-		DIR *dir;
-		char dbuf[400];
+		for (subdir = 0; subdir < 0x100; subdir++)
+		{
+			DIR *dir;
+			char dbuf[400];
 
-		snprintf(dbuf, sizeof dbuf, "%s/_%02x", LogDir, subdir);
-		dir = opendir(dbuf);
-		if (dir == NULL)
-			continue;
+			snprintf(dbuf, sizeof dbuf, "%s/_%02x", shard_root(shard), subdir);
+			dir = opendir(dbuf);
+			if (dir == NULL)
+				continue;
 
-		for (;;)
-		{
-			struct dirent *dent;
+			for (;;)
+			{
+				struct dirent *dent;
 
-			// read the next directory entry
-			dent = readdir(dir);
-			if (dent == NULL)
-				break;
+				// read the next directory entry
+				dent = readdir(dir);
+				if (dent == NULL)
+					break;
 
-			// we're only interested in .gdpndx files
-			char *p = strrchr(dent->d_name, '.');
-			if (p == NULL || strcmp(p, GLOG_SUFFIX) != 0)
-				continue;
+				// we're only interested in .gdpndx files
+				char *p = strrchr(dent->d_name, '.');
+				if (p == NULL || strcmp(p, GLOG_SUFFIX) != 0)
+					continue;
 
-			// strip off the file extension
-			*p = '\0';
+				// strip off the file extension
+				*p = '\0';
 
-			// convert the base64-encoded name to internal form
-			gdp_name_t gname;
-			EP_STAT estat = gdp_internal_name(dent->d_name, gname);
-			EP_STAT_CHECK(estat, continue);
+				// convert the base64-encoded name to internal form
+				gdp_name_t gname;
+				EP_STAT estat = gdp_internal_name(dent->d_name, gname);
+				EP_STAT_CHECK(estat, continue);
 
-			// now call the function
-			EP_STAT tstat = (*func)((uint8_t *) gname, ctx);
+				// remember where it is; skip duplicates
+				if (!shard_note(gname, shard))
+					continue;
 
-			// adjust return status only if new one more severe than existing
-			if (EP_STAT_SEVERITY(tstat) > EP_STAT_SEVERITY(estat))
-				estat = tstat;
+				// now call the function
+				EP_STAT tstat = (*func)((uint8_t *) gname, ctx);
+
+				// adjust return status only if new one more severe
+				if (EP_STAT_SEVERITY(tstat) > EP_STAT_SEVERITY(estat))
+					estat = tstat;
+			}
+			closedir(dir);
 		}
-		closedir(dir);
 	}
 	return estat;
 }
@@ -1703,6 +1806,295 @@ sqlite_xact_abort(gdp_gob_t *gob)
 }
 
 
+/*
+**  Merkle tree support.
+**
+**		These are just storage; the tree logic is in logd_merkle.c.
+**		Callers hold the GOB lock, which serializes tree updates.
+*/
+
+static EP_STAT
+sqlite_get_rechash(gdp_gob_t *gob,
+			gdp_recno_t recno,
+			uint8_t *hash,
+			size_t *hashlen)
+{
+	EP_STAT estat = EP_STAT_OK;
+	gob_physinfo_t *phys = GETPHYS(gob);
+	const char *phase = "prepare";
+	int rc = SQLITE_OK;
+
+	ep_thr_rwlock_rdlock(&phys->lock);
+	if (phys->rechash_stmt == NULL)
+	{
+		rc = sqlite3_prepare_v2(phys->db,
+						"SELECT hash FROM log_entry\n"
+						"	WHERE recno = ?\n"
+						"	LIMIT 1;",
+						-1, &phys->rechash_stmt, NULL);
+		CHECK_RC(rc, goto fail1);
+	}
+	phase = "bind";
+	rc = sqlite3_bind_int64(phys->rechash_stmt, 1, recno);
+	CHECK_RC(rc, goto fail1);
+	phase = "step";
+	rc = sqlite3_step(phys->rechash_stmt);
+	if (rc == SQLITE_ROW)
+	{
+		size_t l = sqlite3_column_bytes(phys->rechash_stmt, 0);
+
+		if (l > *hashlen)
+			l = *hashlen;
+		memcpy(hash, sqlite3_column_blob(phys->rechash_stmt, 0), l);
+		*hashlen = l;
+	}
+	else if (rc == SQLITE_DONE)
+	{
+		estat = GDP_STAT_NAK_NOTFOUND;
+	}
+	else
+	{
+fail1:
+		estat = sqlite_error(rc, NULL, "sqlite_get_rechash", phase);
+	}
+	if (phys->rechash_stmt != NULL)
+		sqlite3_reset(phys->rechash_stmt);
+	ep_thr_rwlock_unlock(&phys->lock);
+	return estat;
+}
+
+
+static EP_STAT
+sqlite_merkle_nleaves(gdp_gob_t *gob, uint64_t *nleavesp)
+{
+	EP_STAT estat = EP_STAT_OK;
+	gob_physinfo_t *phys = GETPHYS(gob);
+	sqlite3_stmt *stmt = NULL;
+	int rc;
+
+	// uses the primary key index, so no table scan
+	ep_thr_rwlock_rdlock(&phys->lock);
+	rc = sqlite3_prepare_v2(phys->db,
+					"SELECT MAX(idx) FROM merkle_node WHERE level = 0;",
+					-1, &stmt, NULL);
+	if (rc == SQLITE_OK)
+		rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW)
+	{
+		if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+			*nleavesp = 0;
+		else
+			*nleavesp = sqlite3_column_int64(stmt, 0) + 1;
+	}
+	else
+	{
+		estat = sqlite_error(rc, NULL, "sqlite_merkle_nleaves", "select");
+	}
+	if (stmt != NULL)
+		sqlite3_finalize(stmt);
+	ep_thr_rwlock_unlock(&phys->lock);
+	return estat;
+}
+
+
+static EP_STAT
+sqlite_merkle_get(gdp_gob_t *gob, int level, uint64_t idx, uint8_t *hash)
+{
+	EP_STAT estat = EP_STAT_OK;
+	gob_physinfo_t *phys = GETPHYS(gob);
+	const char *phase = "prepare";
+	int rc = SQLITE_OK;
+
+	ep_thr_rwlock_rdlock(&phys->lock);
+	if (phys->merkle_get_stmt == NULL)
+	{
+		rc = sqlite3_prepare_v2(phys->db,
+						"SELECT hash FROM merkle_node\n"
+						"	WHERE level = ? AND idx = ?;",
+						-1, &phys->merkle_get_stmt, NULL);
+		CHECK_RC(rc, goto fail1);
+	}
+	phase = "bind";
+	rc = sqlite3_bind_int(phys->merkle_get_stmt, 1, level);
+	CHECK_RC(rc, goto fail1);
+	rc = sqlite3_bind_int64(phys->merkle_get_stmt, 2, idx);
+	CHECK_RC(rc, goto fail1);
+	phase = "step";
+	rc = sqlite3_step(phys->merkle_get_stmt);
+	if (rc == SQLITE_ROW &&
+			sqlite3_column_bytes(phys->merkle_get_stmt, 0) == GDP_MERKLE_HASHLEN)
+	{
+		memcpy(hash, sqlite3_column_blob(phys->merkle_get_stmt, 0),
+				GDP_MERKLE_HASHLEN);
+	}
+	else if (rc == SQLITE_ROW || rc == SQLITE_DONE)
+	{
+		estat = GDP_STAT_NAK_NOTFOUND;
+	}
+	else
+	{
+fail1:
+		estat = sqlite_error(rc, NULL, "sqlite_merkle_get", phase);
+	}
+	if (phys->merkle_get_stmt != NULL)
+		sqlite3_reset(phys->merkle_get_stmt);
+	ep_thr_rwlock_unlock(&phys->lock);
+	return estat;
+}
+
+
+static EP_STAT
+sqlite_merkle_put(gdp_gob_t *gob, int level, uint64_t idx, const uint8_t *hash)
+{
+	EP_STAT estat = EP_STAT_OK;
+	gob_physinfo_t *phys = GETPHYS(gob);
+	const char *phase = "prepare";
+	int rc = SQLITE_OK;
+
+	ep_thr_rwlock_wrlock(&phys->lock);
+	if (phys->merkle_put_stmt == NULL)
+	{
+		rc = sqlite3_prepare_v2(phys->db,
+						"INSERT OR REPLACE INTO merkle_node\n"
+						"	(level, idx, hash) VALUES (?, ?, ?);",
+						-1, &phys->merkle_put_stmt, NULL);
+		CHECK_RC(rc, goto fail1);
+	}
+	phase = "bind";
+	rc = sqlite3_bind_int(phys->merkle_put_stmt, 1, level);
+	CHECK_RC(rc, goto fail1);
+	rc = sqlite3_bind_int64(phys->merkle_put_stmt, 2, idx);
+	CHECK_RC(rc, goto fail1);
+	rc = sqlite3_bind_blob(phys->merkle_put_stmt, 3, hash,
+						GDP_MERKLE_HASHLEN, BLOB_DESTRUCTOR);
+	CHECK_RC(rc, goto fail1);
+	phase = "step";
+	rc = sqlite3_step(phys->merkle_put_stmt);
+	if (rc != SQLITE_DONE)
+	{
+fail1:
+		estat = sqlite_error(rc, NULL, "sqlite_merkle_put", phase);
+	}
+	if (phys->merkle_put_stmt != NULL)
+		sqlite3_reset(phys->merkle_put_stmt);
+	ep_thr_rwlock_unlock(&phys->lock);
+	return estat;
+}
+
+
+/*
+**  SQLITE_CKPT_GET --- find a Merkle checkpoint
+**
+**		Returns the checkpoint of exactly treesize records if exact
+**		is set, otherwise the smallest one covering at least that
+**		many records.
+*/
+
+static EP_STAT
+sqlite_ckpt_get(gdp_gob_t *gob,
+			uint64_t treesize,
+			bool exact,
+			struct merkle_ckpt *ckpt)
+{
+	EP_STAT estat = EP_STAT_OK;
+	gob_physinfo_t *phys = GETPHYS(gob);
+	sqlite3_stmt *stmt = NULL;
+	const char *phase = "prepare";
+	int rc;
+
+	ep_thr_rwlock_rdlock(&phys->lock);
+	rc = sqlite3_prepare_v2(phys->db, exact ?
+					"SELECT treesize, root, timestamp, sig\n"
+					"	FROM merkle_checkpoint\n"
+					"	WHERE treesize = ?;" :
+					"SELECT treesize, root, timestamp, sig\n"
+					"	FROM merkle_checkpoint\n"
+					"	WHERE treesize >= ?\n"
+					"	ORDER BY treesize\n"
+					"	LIMIT 1;",
+					-1, &stmt, NULL);
+	CHECK_RC(rc, goto fail1);
+	phase = "bind";
+	rc = sqlite3_bind_int64(stmt, 1, treesize);
+	CHECK_RC(rc, goto fail1);
+	phase = "step";
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW &&
+			sqlite3_column_bytes(stmt, 1) == GDP_MERKLE_HASHLEN)
+	{
+		size_t siglen = sqlite3_column_bytes(stmt, 3);
+
+		ckpt->treesize = sqlite3_column_int64(stmt, 0);
+		memcpy(ckpt->root, sqlite3_column_blob(stmt, 1), GDP_MERKLE_HASHLEN);
+		ep_time_from_nsec(sqlite3_column_int64(stmt, 2), &ckpt->ts);
+		if (siglen > sizeof ckpt->sig)
+			siglen = 0;
+		ckpt->siglen = siglen;
+		if (siglen > 0)
+			memcpy(ckpt->sig, sqlite3_column_blob(stmt, 3), siglen);
+	}
+	else if (rc == SQLITE_ROW || rc == SQLITE_DONE)
+	{
+		estat = GDP_STAT_NAK_NOTFOUND;
+	}
+	else
+	{
+fail1:
+		estat = sqlite_error(rc, NULL, "sqlite_ckpt_get", phase);
+	}
+	if (stmt != NULL)
+		sqlite3_finalize(stmt);
+	ep_thr_rwlock_unlock(&phys->lock);
+	return estat;
+}
+
+
+static EP_STAT
+sqlite_ckpt_put(gdp_gob_t *gob, const struct merkle_ckpt *ckpt)
+{
+	EP_STAT estat = EP_STAT_OK;
+	gob_physinfo_t *phys = GETPHYS(gob);
+	sqlite3_stmt *stmt = NULL;
+	EP_TIME_SPEC ts;
+	const char *phase = "prepare";
+	int rc;
+
+	ep_thr_rwlock_wrlock(&phys->lock);
+	rc = sqlite3_prepare_v2(phys->db,
+					"INSERT OR REPLACE INTO merkle_checkpoint\n"
+					"	(treesize, root, timestamp, sig)\n"
+					"	VALUES (?, ?, ?, ?);",
+					-1, &stmt, NULL);
+	CHECK_RC(rc, goto fail1);
+	phase = "bind";
+	rc = sqlite3_bind_int64(stmt, 1, ckpt->treesize);
+	CHECK_RC(rc, goto fail1);
+	rc = sqlite3_bind_blob(stmt, 2, ckpt->root, GDP_MERKLE_HASHLEN,
+						BLOB_DESTRUCTOR);
+	CHECK_RC(rc, goto fail1);
+	ts = ckpt->ts;
+	rc = sqlite3_bind_int64(stmt, 3, ep_time_to_nsec(&ts));
+	CHECK_RC(rc, goto fail1);
+	if (ckpt->siglen > 0)
+	{
+		rc = sqlite3_bind_blob(stmt, 4, ckpt->sig, ckpt->siglen,
+						BLOB_DESTRUCTOR);
+		CHECK_RC(rc, goto fail1);
+	}
+	phase = "step";
+	rc = sqlite3_step(stmt);
+	if (rc != SQLITE_DONE)
+	{
+fail1:
+		estat = sqlite_error(rc, NULL, "sqlite_ckpt_put", phase);
+	}
+	if (stmt != NULL)
+		sqlite3_finalize(stmt);
+	ep_thr_rwlock_unlock(&phys->lock);
+	return estat;
+}
+
+
 __BEGIN_DECLS
 struct gob_phys_impl	GdpSqliteImpl =
 {
@@ -1721,5 +2113,11 @@ struct gob_phys_impl	GdpSqliteImpl =
 	.xact_begin			= sqlite_xact_begin,
 	.xact_end			= sqlite_xact_end,
 	.xact_abort			= sqlite_xact_abort,
+	.get_rechash		= sqlite_get_rechash,
+	.merkle_nleaves		= sqlite_merkle_nleaves,
+	.merkle_get			= sqlite_merkle_get,
+	.merkle_put			= sqlite_merkle_put,
+	.ckpt_get			= sqlite_ckpt_get,
+	.ckpt_put			= sqlite_ckpt_put,
 };
 __END_DECLS
@@ -73,6 +73,7 @@ struct physinfo
 	gdp_recno_t			max_recno;				// last recno in log (dynamic)
 	uint32_t			flags;					// see below
 	int32_t				ver;					// database version
+	int					shard;					// log dir shard (pinned)
 
 	// the underlying SQLite database
 	struct sqlite3		*db;					// database handle
@@ -83,6 +84,9 @@ struct physinfo
 	struct sqlite3_stmt	*read_by_recno_stmt1;
 	struct sqlite3_stmt	*read_by_recno_stmt2;
 	struct sqlite3_stmt	*read_by_timestamp_stmt;
+	struct sqlite3_stmt	*rechash_stmt;
+	struct sqlite3_stmt	*merkle_get_stmt;
+	struct sqlite3_stmt	*merkle_put_stmt;
 };
 
 // values for physinfo:flags
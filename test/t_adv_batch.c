@@ -0,0 +1,293 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Advertise and then withdraw many names through a mock router and
+**  count the PDUs and octets it sees, once with the batch size given
+**  by -b and once with one name per PDU for comparison.  The mock
+**  router is a listening socket on the loopback interface; it just
+**  parses PDU headers and collects the names, so this does not need
+**  a real router or log server.  Every name must arrive, in order.
+*/
+
+#include "t_common_support.h"
+
+#include <gdp/gdp_chan.h>
+#include <gdp/gdp_priv.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_thr.h>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sysexits.h>
+
+#define HDR_LEN		76				// version 4, two full addresses
+
+static struct
+{
+	EP_THR_MUTEX	mutex;
+	EP_THR_COND		cond;
+	int				lsock;			// listening socket
+	gdp_name_t		*names;			// names received, in order
+	long			nnames;			// number of names received
+	long			npdus;			// PDUs received
+	long			noctets;		// octets received
+	int				type;			// type of the PDUs counted
+	bool			done;			// peer closed connection
+}		Router;
+
+static gdp_name_t	*Names;			// names to advertise
+static long			NNames;
+static int			Cmd;			// GDP_CMD_ADVERTISE or _WITHDRAW
+static size_t		SentOctets;		// as reported by the batch call
+
+
+static bool
+read_fully(int sock, uint8_t *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = read(sock, buf, len);
+
+		if (n <= 0)
+			return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+
+/*
+**  Mock router: accept one connection and count what comes in.
+*/
+
+static void *
+router_thread(void *unused)
+{
+	int sock = accept(Router.lsock, NULL, NULL);
+	uint8_t hdr[HDR_LEN];
+	uint8_t *payload = (uint8_t *) ep_mem_malloc(UINT16_MAX);
+
+	while (sock >= 0 && read_fully(sock, hdr, sizeof hdr))
+	{
+		size_t paylen = (hdr[10] << 8) | hdr[11];
+		size_t i;
+
+		if (hdr[1] * 4 != HDR_LEN || !read_fully(sock, payload, paylen))
+			break;
+		ep_thr_mutex_lock(&Router.mutex);
+		Router.npdus++;
+		Router.noctets += HDR_LEN + paylen;
+		Router.type = hdr[2] & GDP_PKT_TYPE_MASK;
+		if (Router.nnames < NNames)
+			memcpy(Router.names[Router.nnames], &hdr[12], sizeof (gdp_name_t));
+		Router.nnames++;
+		for (i = 0; i + sizeof (gdp_name_t) <= paylen; i += sizeof (gdp_name_t))
+		{
+			if (Router.nnames < NNames)
+				memcpy(Router.names[Router.nnames], &payload[i],
+						sizeof (gdp_name_t));
+			Router.nnames++;
+		}
+		ep_thr_cond_broadcast(&Router.cond);
+		ep_thr_mutex_unlock(&Router.mutex);
+	}
+
+	ep_thr_mutex_lock(&Router.mutex);
+	Router.done = true;
+	ep_thr_cond_broadcast(&Router.cond);
+	ep_thr_mutex_unlock(&Router.mutex);
+	if (sock >= 0)
+		close(sock);
+	ep_mem_free(payload);
+	return NULL;
+}
+
+
+/*
+**  Advertise callback: called by the channel code on connect.
+*/
+
+static EP_STAT
+advertise_names(gdp_chan_t *chan, int cmd_unused, void *adata)
+{
+	if (Cmd == GDP_CMD_ADVERTISE)
+		return _gdp_chan_advertise_batch(chan, Names, NNames, NULL, NULL, NULL,
+						&SentOctets);
+	else
+		return _gdp_chan_withdraw_batch(chan, Names, NNames, NULL,
+						&SentOctets);
+}
+
+
+/*
+**  Run one advertise or withdraw pass and check what the router saw.
+*/
+
+static int
+run_pass(int cmd, const char *batch)
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof sin;
+	char addr[40];
+	EP_THR thr;
+	gdp_chan_t *chan;
+	gdp_chan_x_t *chanx;
+	EP_STAT estat;
+	int nerrors = 0;
+
+	ep_adm_setparam("swarm.gdp.advertise.batch", batch);
+	Cmd = cmd;
+	memset(Router.names, 0, NNames * sizeof *Router.names);
+	Router.nnames = Router.npdus = Router.noctets = 0;
+	SentOctets = 0;
+	Router.done = false;
+
+	// start the mock router on an unused port
+	Router.lsock = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (Router.lsock < 0 ||
+			bind(Router.lsock, (struct sockaddr *) &sin, sizeof sin) < 0 ||
+			listen(Router.lsock, 1) < 0 ||
+			getsockname(Router.lsock, (struct sockaddr *) &sin, &sinlen) < 0)
+	{
+		ep_app_fatal("cannot start mock router: %s", strerror(errno));
+	}
+	snprintf(addr, sizeof addr, "127.0.0.1:%d", ntohs(sin.sin_port));
+	if (ep_thr_spawn(&thr, router_thread, NULL) != 0)
+		ep_app_fatal("cannot start mock router thread");
+
+	// connecting sends the names
+	chanx = (gdp_chan_x_t *) ep_mem_zalloc(sizeof *chanx);
+	LIST_INIT(&chanx->reqs);
+	estat = _gdp_chan_open(addr, NULL, &_gdp_io_recv, NULL, &_gdp_io_event,
+						&_gdp_router_event, &advertise_names, chanx, &chan);
+	test_message(estat, "_gdp_chan_open(%s)", addr);
+
+	// wait for everything to arrive
+	ep_thr_mutex_lock(&Router.mutex);
+	while (Router.nnames < NNames && !Router.done)
+	{
+		EP_TIME_SPEC delta;
+		EP_TIME_SPEC timeout;
+
+		ep_time_from_nsec(10 SECONDS, &delta);
+		ep_time_deltanow(&delta, &timeout);
+		if (ep_thr_cond_wait(&Router.cond, &Router.mutex, &timeout) != 0)
+			break;
+	}
+	ep_thr_mutex_unlock(&Router.mutex);
+	_gdp_chan_close(chan);
+	pthread_join(thr, NULL);
+	close(Router.lsock);
+
+	if (Router.nnames != NNames)
+	{
+		ep_app_error("router saw %ld names, expected %ld",
+				Router.nnames, NNames);
+		nerrors++;
+	}
+	else if (memcmp(Router.names, Names, NNames * sizeof *Names) != 0)
+	{
+		ep_app_error("router saw the wrong names");
+		nerrors++;
+	}
+	if (Router.type != (cmd == GDP_CMD_ADVERTISE ?
+				GDP_PKT_TYPE_ADVERTISE : GDP_PKT_TYPE_WITHDRAW))
+	{
+		ep_app_error("router saw PDU type 0x%02x", Router.type);
+		nerrors++;
+	}
+	if (SentOctets != (size_t) Router.noctets)
+	{
+		ep_app_error("sent %zd octets, router saw %ld",
+				SentOctets, Router.noctets);
+		nerrors++;
+	}
+	printf("%-9s batch %5s: %8ld names %8ld PDUs %10ld octets\n",
+			cmd == GDP_CMD_ADVERTISE ? "advertise" : "withdraw",
+			batch, Router.nnames, Router.npdus, Router.noctets);
+	return nerrors;
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-b batch] [-n nnames]\n"
+			"    -b  names per PDU (default 1024)\n"
+			"    -D  set debugging flags\n"
+			"    -n  number of names to advertise (default 100000)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *batch = "1024";
+	EP_STAT estat;
+	long i;
+	int opt;
+	int nerrors = 0;
+	bool show_usage = false;
+
+	NNames = 100000;
+	while ((opt = getopt(argc, argv, "b:D:n:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'b':
+			batch = optarg;
+			break;
+
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			NNames = atol(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || NNames < 1 || atoi(batch) < 1)
+		usage();
+
+	estat = gdp_lib_init(NULL, NULL, GDP_INIT_NO_ZEROCONF | GDP_INIT_NO_HONGDS);
+	test_message(estat, "gdp_lib_init");
+	if (ep_thr_spawn(&_GdpIoEventLoopThread, &_gdp_run_event_loop, NULL) != 0)
+		ep_app_fatal("cannot spawn event i/o thread");
+	srandom(getpid());
+
+	ep_thr_mutex_init(&Router.mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_cond_init(&Router.cond);
+	Names = (gdp_name_t *) ep_mem_malloc(NNames * sizeof *Names);
+	Router.names = (gdp_name_t *) ep_mem_malloc(NNames * sizeof *Names);
+	for (i = 0; i < NNames; i++)
+	{
+		size_t j;
+
+		// real names are hashes, so random bytes are a fair stand-in
+		for (j = 0; j < sizeof (gdp_name_t); j++)
+			Names[i][j] = random() & 0xff;
+	}
+
+	nerrors += run_pass(GDP_CMD_ADVERTISE, batch);
+	nerrors += run_pass(GDP_CMD_WITHDRAW, batch);
+	nerrors += run_pass(GDP_CMD_ADVERTISE, "1");
+
+	printf("%ld names, %d errors\n", NNames, nerrors);
+	return nerrors == 0 ? EX_OK : EX_SOFTWARE;
+}
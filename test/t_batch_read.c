@@ -0,0 +1,129 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Read the latest record from several logs using one multiread
+**  command and check that exactly one result arrives per log.
+**
+**  All of the logs must be on the same log server.
+*/
+
+#include "t_common_support.h"
+
+#include <ep/ep_mem.h>
+
+#include <getopt.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_batch_read", "GDP multi-log batch read test");
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-r recno] log_name ...\n"
+			"    -D  set debugging flags\n"
+			"    -r  record number to read (default 0, meaning latest)\n"
+			"all logs must already exist on the same server\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	gdp_gin_t **gins;
+	gdp_recno_t *recnos;
+	EP_STAT estat;
+	int opt;
+	int nlogs;
+	int i;
+	int ndata = 0;
+	int nother = 0;
+	gdp_recno_t recno = 0;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "D:r:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'r':
+			recno = atol(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc <= 0)
+		usage();
+
+	estat = gdp_init(NULL);
+	test_message(estat, "gdp_init");
+
+	nlogs = argc;
+	gins = (gdp_gin_t **) ep_mem_zalloc(nlogs * sizeof *gins);
+	recnos = (gdp_recno_t *) ep_mem_zalloc(nlogs * sizeof *recnos);
+	for (i = 0; i < nlogs; i++)
+	{
+		gdp_name_t gdpname;
+
+		estat = gdp_parse_name(argv[i], gdpname);
+		test_message(estat, "gdp_parse_name(%s)", argv[i]);
+		estat = gdp_gin_open(gdpname, GDP_MODE_RO, NULL, &gins[i]);
+		test_message(estat, "gdp_gin_open(%s)", argv[i]);
+		recnos[i] = recno;
+	}
+
+	estat = gdp_gin_multiread_async(nlogs, gins, recnos, NULL, NULL);
+	test_message(estat, "gdp_gin_multiread_async");
+
+	// collect events until the end of results (or we give up)
+	for (;;)
+	{
+		EP_TIME_SPEC timeout;
+		gdp_event_t *gev;
+
+		ep_time_from_nsec(10 SECONDS, &timeout);
+		gev = gdp_event_next(NULL, &timeout);
+		if (gev == NULL)
+		{
+			ep_app_error("timed out waiting for results");
+			break;
+		}
+		ep_dbg_cprintf(Dbg, 10, "event type %d\n", gdp_event_gettype(gev));
+		if (ep_dbg_test(Dbg, 20))
+			print_event(gev);
+		switch (gdp_event_gettype(gev))
+		{
+		  case GDP_EVENT_DATA:
+			ndata++;
+			break;
+
+		  case GDP_EVENT_DONE:
+			gdp_event_free(gev);
+			goto done;
+
+		  default:
+			nother++;
+			break;
+		}
+		gdp_event_free(gev);
+	}
+
+done:
+	printf("%d logs: %d data, %d missing or failed\n", nlogs, ndata, nother);
+	for (i = 0; i < nlogs; i++)
+		gdp_gin_close(gins[i]);
+	ep_mem_free(gins);
+	ep_mem_free(recnos);
+	return ndata + nother == nlogs ? EX_OK : EX_SOFTWARE;
+}
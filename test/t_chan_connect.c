@@ -0,0 +1,398 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Time connecting to the routing layer when some of the routers
+**  listed are dead.  Three kinds of mock router are set up on the
+**  loopback interface: a black hole (a listening socket whose
+**  accept queue is full, so connects just hang), a closed port
+**  (connects are refused), and live ones that accept connections.
+**
+**  First the channel is opened with the dead ones listed ahead of
+**  a live one; it must connect in well under the connect timeout.
+**  Opening again must go straight to the live router, since the
+**  dead ones are remembered.  Then the router a channel is talking
+**  to is killed and the channel must move to another one quickly.
+*/
+
+#include "t_common_support.h"
+
+#include <gdp/gdp_chan.h>
+#include <gdp/gdp_priv.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_metric.h>
+#include <ep/ep_thr.h>
+#include <ep/ep_time.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sysexits.h>
+
+#define NFILLERS	4				// connections to fill a black hole
+
+struct mock_router
+{
+	int				lsock;			// listening socket
+	int				port;			// port it is on
+	int				sock;			// last accepted connection
+	int				naccepted;		// connections accepted
+	int64_t			accepted_at;	// time of last accept (usec)
+	EP_THR			thr;			// accepting thread
+};
+
+static EP_THR_MUTEX	Mutex;
+static EP_THR_COND	Cond;
+static int			NErrors;
+static int			NAdverts;		// times the channel (re)connected
+
+
+static int64_t
+now_usec(void)
+{
+	EP_TIME_SPEC tv;
+
+	ep_time_now(&tv);
+	return tv.tv_sec * INT64_C(1000000) + tv.tv_nsec / 1000;
+}
+
+
+// make a listening socket on an unused loopback port
+static int
+listen_on(int backlog, int *portp)
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof sin;
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (sock < 0 ||
+			bind(sock, (struct sockaddr *) &sin, sizeof sin) < 0 ||
+			listen(sock, backlog) < 0 ||
+			getsockname(sock, (struct sockaddr *) &sin, &sinlen) < 0)
+	{
+		ep_app_fatal("cannot start mock router: %s", strerror(errno));
+	}
+	*portp = ntohs(sin.sin_port);
+	return sock;
+}
+
+
+/*
+**  Live router: accept connections and throw away what they send.
+*/
+
+static void *
+drain_thread(void *sock_)
+{
+	int sock = (int) (intptr_t) sock_;
+	char buf[4096];
+
+	while (read(sock, buf, sizeof buf) > 0)
+		continue;
+	return NULL;
+}
+
+static void *
+accept_thread(void *r_)
+{
+	struct mock_router *r = (struct mock_router *) r_;
+
+	for (;;)
+	{
+		int sock = accept(r->lsock, NULL, NULL);
+		EP_THR thr;
+
+		if (sock < 0)
+			break;
+		ep_thr_mutex_lock(&Mutex);
+		r->sock = sock;
+		r->naccepted++;
+		r->accepted_at = now_usec();
+		ep_thr_cond_broadcast(&Cond);
+		ep_thr_mutex_unlock(&Mutex);
+		if (ep_thr_spawn(&thr, drain_thread, (void *) (intptr_t) sock) == 0)
+			pthread_detach(thr);
+	}
+	return NULL;
+}
+
+static void
+live_router(struct mock_router *r)
+{
+	memset(r, 0, sizeof *r);
+	r->sock = -1;
+	r->lsock = listen_on(8, &r->port);
+	if (ep_thr_spawn(&r->thr, accept_thread, r) != 0)
+		ep_app_fatal("cannot start mock router thread");
+}
+
+// stop accepting and drop the current connection
+static void
+kill_router(struct mock_router *r)
+{
+	shutdown(r->lsock, SHUT_RDWR);
+	close(r->lsock);
+	pthread_join(r->thr, NULL);
+	ep_thr_mutex_lock(&Mutex);
+	if (r->sock >= 0)
+		shutdown(r->sock, SHUT_RDWR);
+	ep_thr_mutex_unlock(&Mutex);
+}
+
+
+/*
+**  Black hole: a listening socket with a full accept queue.
+**  Returns the port.
+*/
+
+static int
+black_hole(void)
+{
+	int port;
+	int i;
+
+	(void) listen_on(0, &port);
+	for (i = 0; i < NFILLERS; i++)
+	{
+		struct sockaddr_in sin;
+		int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+		memset(&sin, 0, sizeof sin);
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		sin.sin_port = htons(port);
+		fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+		(void) connect(sock, (struct sockaddr *) &sin, sizeof sin);
+	}
+	ep_time_nanosleep(100 MILLISECONDS);
+	return port;
+}
+
+// a port with nothing listening on it
+static int
+closed_port(void)
+{
+	int port;
+
+	close(listen_on(1, &port));
+	return port;
+}
+
+
+// advertise callback: just note that we are connected
+static EP_STAT
+advertise_nothing(gdp_chan_t *chan, int cmd_unused, void *adata)
+{
+	ep_thr_mutex_lock(&Mutex);
+	NAdverts++;
+	ep_thr_cond_broadcast(&Cond);
+	ep_thr_mutex_unlock(&Mutex);
+	return EP_STAT_OK;
+}
+
+// current value of an exported metric
+static long
+metric_value(const char *name)
+{
+	char *buf = NULL;
+	size_t bufsize = 0;
+	FILE *fp = open_memstream(&buf, &bufsize);
+	const char *p;
+	long v = -1;
+
+	ep_metric_export(fp, "gdp");
+	fclose(fp);
+	for (p = buf; (p = strstr(p, name)) != NULL; p++)
+	{
+		if ((p == buf || p[-1] == '\n') && p[strlen(name)] == ' ')
+		{
+			v = atol(p + strlen(name) + 1);
+			break;
+		}
+	}
+	free(buf);
+	return v;
+}
+
+static gdp_chan_t *
+open_chan(const char *addrs, int64_t *usecp)
+{
+	gdp_chan_t *chan;
+	gdp_chan_x_t *chanx;
+	EP_STAT estat;
+	int64_t start = now_usec();
+
+	chanx = (gdp_chan_x_t *) ep_mem_zalloc(sizeof *chanx);
+	LIST_INIT(&chanx->reqs);
+	estat = _gdp_chan_open(addrs, NULL, &_gdp_io_recv, NULL, &_gdp_io_event,
+						&_gdp_router_event, &advertise_nothing, chanx, &chan);
+	*usecp = now_usec() - start;
+	test_message(estat, "_gdp_chan_open(%s)", addrs);
+	if (!EP_STAT_ISOK(estat))
+		exit(EX_UNAVAILABLE);
+	return chan;
+}
+
+static void
+expect_below(const char *what, int64_t usec, long limit_ms)
+{
+	printf("    %-34s %8.1f ms\n", what, usec / 1000.0);
+	if (usec > limit_ms * 1000)
+	{
+		ep_app_error("%s took %" PRId64 " ms (limit %ld)",
+				what, usec / 1000, limit_ms);
+		NErrors++;
+	}
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-s stagger]\n"
+			"    -D  set debugging flags\n"
+			"    -s  connect stagger in milliseconds (default 100)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct mock_router live1, live2;
+	char addrs[200];
+	char sbuf[20];
+	gdp_chan_t *chan;
+	EP_STAT estat;
+	int64_t usec;
+	long stagger = 100;
+	long nfails;
+	int hole, closed;
+	int opt;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "D:s:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 's':
+			stagger = atol(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || stagger < 1)
+		usage();
+
+	estat = gdp_lib_init(NULL, NULL, GDP_INIT_NO_ZEROCONF | GDP_INIT_NO_HONGDS);
+	test_message(estat, "gdp_lib_init");
+	if (ep_thr_spawn(&_GdpIoEventLoopThread, &_gdp_run_event_loop, NULL) != 0)
+		ep_app_fatal("cannot spawn event i/o thread");
+	ep_thr_mutex_init(&Mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_cond_init(&Cond);
+
+	snprintf(sbuf, sizeof sbuf, "%ld", stagger);
+	ep_adm_setparam("swarm.gdp.connect.stagger", sbuf);
+	ep_adm_setparam("swarm.gdp.connect.timeout", "20000");
+	ep_adm_setparam("swarm.gdp.reconnect.delay", "1000");
+
+	hole = black_hole();
+	closed = closed_port();
+	live_router(&live1);
+	live_router(&live2);
+
+	// dead routers first: costs about one stagger, not a TCP timeout
+	printf("black hole %d, closed %d, live %d and %d\n",
+			hole, closed, live1.port, live2.port);
+	snprintf(addrs, sizeof addrs, "127.0.0.1:%d; 127.0.0.1:%d; 127.0.0.1:%d",
+			hole, closed, live1.port);
+	chan = open_chan(addrs, &usec);
+	expect_below("connect past dead routers", usec, stagger * 2 + 500);
+
+	// the connection can be up before the mock router has accepted it
+	ep_thr_mutex_lock(&Mutex);
+	while (live1.naccepted < 1)
+	{
+		EP_TIME_SPEC delta;
+		EP_TIME_SPEC timeout;
+
+		ep_time_from_nsec(10 SECONDS, &delta);
+		ep_time_deltanow(&delta, &timeout);
+		if (ep_thr_cond_wait(&Cond, &Mutex, &timeout) != 0)
+			break;
+	}
+	ep_thr_mutex_unlock(&Mutex);
+	if (live1.naccepted != 1)
+	{
+		ep_app_error("live router accepted %d connections", live1.naccepted);
+		NErrors++;
+	}
+	_gdp_chan_close(chan);
+
+	// the dead ones are remembered and not tried first
+	nfails = metric_value("gdp_chan_connect_failures_total");
+	chan = open_chan(addrs, &usec);
+	expect_below("connect again", usec, stagger);
+	if (metric_value("gdp_chan_connect_failures_total") != nfails)
+	{
+		ep_app_error("dead routers tried again");
+		NErrors++;
+	}
+	_gdp_chan_close(chan);
+
+	// failover: kill the router we are talking to
+	snprintf(addrs, sizeof addrs, "127.0.0.1:%d; 127.0.0.1:%d; 127.0.0.1:%d",
+			hole, live1.port, live2.port);
+	chan = open_chan(addrs, &usec);
+	ep_thr_mutex_lock(&Mutex);
+	while (live1.naccepted < 3)
+		ep_thr_cond_wait(&Cond, &Mutex, NULL);
+	ep_thr_mutex_unlock(&Mutex);
+	{
+		int64_t start = now_usec();
+		int nadverts = NAdverts;
+
+		kill_router(&live1);
+		ep_thr_mutex_lock(&Mutex);
+		while (live2.naccepted < 1 || NAdverts == nadverts)
+		{
+			EP_TIME_SPEC delta;
+			EP_TIME_SPEC timeout;
+
+			ep_time_from_nsec(30 SECONDS, &delta);
+			ep_time_deltanow(&delta, &timeout);
+			if (ep_thr_cond_wait(&Cond, &Mutex, &timeout) != 0)
+				break;
+		}
+		ep_thr_mutex_unlock(&Mutex);
+		if (live2.naccepted < 1)
+		{
+			ep_app_error("no failover to second live router");
+			NErrors++;
+		}
+		else
+		{
+			expect_below("failover to another router",
+					live2.accepted_at - start, stagger * 2 + 500);
+		}
+	}
+	_gdp_chan_close(chan);
+
+	printf("%d errors\n", NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
@@ -0,0 +1,737 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Check flow id header compression on a channel.  Small PDUs
+**  are sent to several log names through a mock router that
+**  understands flow ids, first with compression off and then on,
+**  and the header octets per PDU are compared.  Then the cases
+**  that could make the two ends disagree are tried: more flows
+**  than our sending table holds, and a router that restarts; no
+**  PDU may be lost in either.  The router then sends compressed
+**  PDUs to us on many more ids than our swarm.gdp.chan.flows,
+**  which must all come out with the right addresses and turn
+**  compression on in our direction; only ids that were never set
+**  up, or are out of range, are NAKed.  Finally the router sends
+**  a header with impossible lengths, and the channel must drop
+**  the connection and carry on over a new one.
+*/
+
+#include "t_common_support.h"
+
+#include <gdp/gdp_chan.h>
+#include <gdp/gdp_priv.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_metric.h>
+#include <ep/ep_thr.h>
+#include <ep/ep_time.h>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sysexits.h>
+
+#define MIN_HDR_LEN	16				// fixed part plus flow id
+#define FULL_HDR_LEN	76				// fixed part plus both addresses
+#define MAX_CONNS	16				// connections the router will take
+#define ROUTER_IDS	65536			// flow ids the router can hold
+#define NFLOWS		8				// log names to send to
+#define PAYLEN		40				// a small sensor reading
+#define ROUTER_FLOW	1000			// first flow id the router uses
+#define ROUTER_REUSE	40				// ids the router binds per flow
+#define MAX_FLOWS	65536			// first id we must refuse
+
+struct router_flow
+{
+	bool			bound;			// id is in use
+	gdp_name_t		dst;
+	gdp_name_t		src;
+};
+
+static struct
+{
+	EP_THR_MUTEX	mutex;
+	EP_THR_COND		cond;
+	int				lsock;			// listening socket
+	int				socks[MAX_CONNS];	// accepted connections
+	int				nconns;			// number of accepted connections
+	long			npdus;			// good PDUs received
+	long			n2full;			// ... with full addresses
+	long			nflowset;		// ... binding a flow id
+	long			nflowid;		// ... with only a flow id
+	long			nmisses;		// PDUs with unknown flow ids
+	long			nnaks;			// flow id NAKs received
+}		Router;
+
+static struct
+{
+	gdp_name_t		name;			// destination of this flow
+	uint32_t		sendseq;		// next sequence number to send
+}		Flows[NFLOWS];
+
+static EP_THR_MUTEX	RecvMutex;
+static EP_THR_COND	RecvCond;
+static long			NRecv;			// PDUs delivered to us
+static int			NAdverts;		// times the channel (re)connected
+static int			NErrors;
+
+
+static bool
+read_fully(int sock, uint8_t *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = read(sock, buf, len);
+
+		if (n <= 0)
+			return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+// wait (with the router locked) until cond is true or ten seconds pass
+#define ROUTER_WAIT(cond) \
+		{ \
+			EP_TIME_SPEC delta, timeout; \
+			ep_time_from_nsec(10 SECONDS, &delta); \
+			ep_time_deltanow(&delta, &timeout); \
+			while (!(cond) && router_wait(&timeout) == 0) \
+				continue; \
+		}
+
+static int
+router_wait(EP_TIME_SPEC *timeout)
+{
+	return ep_thr_cond_wait(&Router.cond, &Router.mutex, timeout);
+}
+
+
+/*
+**  Mock router: one reader per connection, each with its own table
+**  of the flow ids we have bound.  Called with the router locked.
+*/
+
+static void
+router_send(int sock,
+		int addr_type,
+		uint32_t flowid,
+		const gdp_name_t dst,
+		const gdp_name_t src,
+		int type,
+		const uint8_t *payload,
+		size_t paylen)
+{
+	uint8_t pdu[80 + PAYLEN];
+	uint8_t *p = pdu + 12;
+
+	memset(pdu, 0, 12);
+	pdu[0] = 4;
+	pdu[2] = type | addr_type;
+	pdu[3] = GDP_TTL_DEFAULT;
+	pdu[10] = paylen >> 8;
+	pdu[11] = paylen & 0xff;
+	if (addr_type != GDP_PKT_ADDR_TYPE_2FULL)
+	{
+		*p++ = flowid >> 24;
+		*p++ = flowid >> 16;
+		*p++ = flowid >> 8;
+		*p++ = flowid;
+	}
+	if (addr_type != GDP_PKT_ADDR_TYPE_FLOWID)
+	{
+		memcpy(p, dst, sizeof (gdp_name_t));
+		p += sizeof (gdp_name_t);
+		memcpy(p, src, sizeof (gdp_name_t));
+		p += sizeof (gdp_name_t);
+	}
+	pdu[1] = (p - pdu) / 4;
+	if (paylen > 0)
+		memcpy(p, payload, paylen);
+	if (write(sock, pdu, (p - pdu) + paylen) < 0)
+		ep_app_error("mock router write: %s", strerror(errno));
+}
+
+static void *
+reader_thread(void *conn_)
+{
+	int conn = (int) (intptr_t) conn_;
+	int sock = Router.socks[conn];
+	struct router_flow *flows;
+	uint8_t hdr[MIN_HDR_LEN + 64];
+	uint8_t payload[UINT16_MAX];
+
+	flows = (struct router_flow *) ep_mem_zalloc(ROUTER_IDS * sizeof *flows);
+	while (read_fully(sock, hdr, MIN_HDR_LEN))
+	{
+		size_t hdrlen = (hdr[1] & 0x3f) * 4;
+		size_t paylen = (hdr[10] << 8) | hdr[11];
+		int addr_type = hdr[2] & GDP_PKT_ADDR_TYPE_MASK;
+		uint32_t flowid = 0;
+		uint8_t *dst, *src;
+		uint32_t flow;
+
+		if (hdrlen < MIN_HDR_LEN || hdrlen > sizeof hdr ||
+				!read_fully(sock, hdr + MIN_HDR_LEN, hdrlen - MIN_HDR_LEN) ||
+				!read_fully(sock, payload, paylen))
+			break;
+		if (addr_type == GDP_PKT_ADDR_TYPE_2FULL)
+		{
+			dst = &hdr[12];
+			src = &hdr[44];
+		}
+		else
+		{
+			flowid = (hdr[12] << 24) | (hdr[13] << 16) |
+					(hdr[14] << 8) | hdr[15];
+			dst = &hdr[16];
+			src = &hdr[48];
+		}
+
+		ep_thr_mutex_lock(&Router.mutex);
+		if ((hdr[2] & GDP_PKT_TYPE_MASK) == GDP_PKT_TYPE_NAK_NOROUTE &&
+				addr_type == GDP_PKT_ADDR_TYPE_FLOWID)
+		{
+			Router.nnaks++;
+			goto next;
+		}
+		if ((hdr[2] & GDP_PKT_TYPE_MASK) != GDP_PKT_TYPE_REGULAR)
+			goto next;
+		if (addr_type == GDP_PKT_ADDR_TYPE_FLOWSET && flowid < ROUTER_IDS)
+		{
+			flows[flowid].bound = true;
+			memcpy(flows[flowid].dst, dst, sizeof (gdp_name_t));
+			memcpy(flows[flowid].src, src, sizeof (gdp_name_t));
+		}
+		else if (addr_type == GDP_PKT_ADDR_TYPE_FLOWID)
+		{
+			if (flowid >= ROUTER_IDS || !flows[flowid].bound)
+			{
+				// we don't know it: NAK it and drop the PDU
+				Router.nmisses++;
+				router_send(sock, GDP_PKT_ADDR_TYPE_FLOWID, flowid,
+						NULL, NULL, GDP_PKT_TYPE_NAK_NOROUTE, NULL, 0);
+				ep_thr_cond_broadcast(&Router.cond);
+				goto next;
+			}
+			dst = flows[flowid].dst;
+			src = flows[flowid].src;
+		}
+
+		// payload starts with the flow number; the names must match it
+		memcpy(&flow, payload, sizeof flow);
+		if (paylen != PAYLEN || flow >= NFLOWS ||
+				memcmp(dst, Flows[flow].name, sizeof (gdp_name_t)) != 0 ||
+				memcmp(src, _GdpMyRoutingName, sizeof (gdp_name_t)) != 0)
+		{
+			ep_app_error("conn %d: PDU with wrong addresses (format %d)",
+					conn, addr_type);
+			NErrors++;
+			goto next;
+		}
+		Router.npdus++;
+		if (addr_type == GDP_PKT_ADDR_TYPE_2FULL)
+			Router.n2full++;
+		else if (addr_type == GDP_PKT_ADDR_TYPE_FLOWSET)
+			Router.nflowset++;
+		else
+			Router.nflowid++;
+		ep_thr_cond_broadcast(&Router.cond);
+next:
+		ep_thr_mutex_unlock(&Router.mutex);
+	}
+
+	close(sock);
+	ep_mem_free(flows);
+	return NULL;
+}
+
+static void *
+accept_thread(void *unused)
+{
+	for (;;)
+	{
+		int sock = accept(Router.lsock, NULL, NULL);
+		EP_THR thr;
+
+		if (sock < 0)
+			break;
+		ep_thr_mutex_lock(&Router.mutex);
+		if (Router.nconns >= MAX_CONNS)
+		{
+			ep_thr_mutex_unlock(&Router.mutex);
+			close(sock);
+			continue;
+		}
+		Router.socks[Router.nconns] = sock;
+		if (ep_thr_spawn(&thr, reader_thread,
+					(void *) (intptr_t) Router.nconns) != 0)
+			ep_app_fatal("cannot start mock router reader");
+		pthread_detach(thr);
+		Router.nconns++;
+		ep_thr_cond_broadcast(&Router.cond);
+		ep_thr_mutex_unlock(&Router.mutex);
+	}
+	return NULL;
+}
+
+
+/*
+**  Our side of the channel.
+*/
+
+// PDUs from the router: check that the addresses match the payload
+static EP_STAT
+recv_pdu(gdp_chan_t *chan,
+		gdp_name_t src,
+		gdp_name_t dst,
+		gdp_seqno_t seqno,
+		gdp_buf_t *payload,
+		size_t payload_len)
+{
+	uint8_t buf[PAYLEN];
+	uint32_t flow;
+
+	if (payload_len != PAYLEN)
+	{
+		ep_app_error("received payload of %zd octets", payload_len);
+		NErrors++;
+		gdp_buf_drain(payload, payload_len);
+		return EP_STAT_OK;
+	}
+	gdp_buf_read(payload, buf, sizeof buf);
+	memcpy(&flow, buf, sizeof flow);
+	ep_thr_mutex_lock(&RecvMutex);
+	if (flow >= NFLOWS ||
+			memcmp(src, Flows[flow].name, sizeof (gdp_name_t)) != 0 ||
+			memcmp(dst, _GdpMyRoutingName, sizeof (gdp_name_t)) != 0)
+	{
+		ep_app_error("received PDU with wrong addresses");
+		NErrors++;
+	}
+	NRecv++;
+	ep_thr_cond_broadcast(&RecvCond);
+	ep_thr_mutex_unlock(&RecvMutex);
+	return EP_STAT_OK;
+}
+
+// advertise callback: just note that we are connected
+static EP_STAT
+advertise_nothing(gdp_chan_t *chan, int cmd_unused, void *adata)
+{
+	ep_thr_mutex_lock(&Router.mutex);
+	NAdverts++;
+	ep_thr_cond_broadcast(&Router.cond);
+	ep_thr_mutex_unlock(&Router.mutex);
+	return EP_STAT_OK;
+}
+
+// current value of an exported metric
+static long
+metric_value(const char *name)
+{
+	char *buf = NULL;
+	size_t bufsize = 0;
+	FILE *fp = open_memstream(&buf, &bufsize);
+	const char *p;
+	long v = -1;
+
+	ep_metric_export(fp, "gdp");
+	fclose(fp);
+	for (p = buf; (p = strstr(p, name)) != NULL; p++)
+	{
+		if ((p == buf || p[-1] == '\n') && p[strlen(name)] == ' ')
+		{
+			v = atol(p + strlen(name) + 1);
+			break;
+		}
+	}
+	free(buf);
+	return v;
+}
+
+static gdp_chan_t *
+open_chan(const char *addr, bool flowid)
+{
+	gdp_chan_t *chan;
+	gdp_chan_x_t *chanx;
+	EP_STAT estat;
+	int nconns;
+
+	ep_adm_setparam("swarm.gdp.chan.flowid", flowid ? "true" : "false");
+	ep_thr_mutex_lock(&Router.mutex);
+	nconns = Router.nconns;
+	ep_thr_mutex_unlock(&Router.mutex);
+
+	chanx = (gdp_chan_x_t *) ep_mem_zalloc(sizeof *chanx);
+	LIST_INIT(&chanx->reqs);
+	estat = _gdp_chan_open(addr, NULL, &recv_pdu, NULL, &_gdp_io_event,
+						&_gdp_router_event, &advertise_nothing, chanx, &chan);
+	test_message(estat, "_gdp_chan_open(%s, flowid %s)",
+				addr, flowid ? "on" : "off");
+	if (!EP_STAT_ISOK(estat))
+		exit(EX_UNAVAILABLE);
+
+	ep_thr_mutex_lock(&Router.mutex);
+	ROUTER_WAIT(Router.nconns > nconns);
+	ep_thr_mutex_unlock(&Router.mutex);
+	return chan;
+}
+
+/*
+**  Send npdus PDUs to each flow and wait until the router has
+**  seen them all.  Returns the header octets sent per PDU.
+*/
+
+static double
+send_flows(gdp_chan_t *chan, long npdus)
+{
+	uint8_t data[PAYLEN];
+	gdp_buf_t *payload = gdp_buf_new();
+	long hdr0 = metric_value("gdp_chan_header_octets_sent_total");
+	long pdus0 = metric_value("gdp_chan_pdus_sent_total");
+	long expected;
+	long i;
+	uint32_t flow;
+
+	ep_thr_mutex_lock(&Router.mutex);
+	expected = Router.npdus + npdus * NFLOWS;
+	ep_thr_mutex_unlock(&Router.mutex);
+
+	memset(data, 0, sizeof data);
+	for (i = 0; i < npdus; i++)
+	{
+		for (flow = 0; flow < NFLOWS; flow++)
+		{
+			uint32_t seq = Flows[flow].sendseq++;
+			EP_STAT estat;
+
+			memcpy(&data[0], &flow, sizeof flow);
+			memcpy(&data[4], &seq, sizeof seq);
+			gdp_buf_write(payload, data, sizeof data);
+			estat = _gdp_chan_send(chan, NULL, _GdpMyRoutingName,
+							Flows[flow].name, payload, GDP_PKT_TYPE_REGULAR);
+			if (!EP_STAT_ISOK(estat))
+			{
+				test_message(estat, "_gdp_chan_send");
+				NErrors++;
+			}
+			gdp_buf_reset(payload);
+		}
+	}
+	gdp_buf_free(payload);
+
+	ep_thr_mutex_lock(&Router.mutex);
+	ROUTER_WAIT(Router.npdus >= expected);
+	if (Router.npdus != expected)
+	{
+		ep_app_error("router saw %ld PDUs, expected %ld",
+				Router.npdus, expected);
+		NErrors++;
+	}
+	ep_thr_mutex_unlock(&Router.mutex);
+
+	return (double) (metric_value("gdp_chan_header_octets_sent_total") - hdr0) /
+			(metric_value("gdp_chan_pdus_sent_total") - pdus0);
+}
+
+// note router counters so changes can be checked
+static long	Base2full, BaseFlowset, BaseFlowid, BaseMisses;
+
+static void
+router_mark(void)
+{
+	ep_thr_mutex_lock(&Router.mutex);
+	Base2full = Router.n2full;
+	BaseFlowset = Router.nflowset;
+	BaseFlowid = Router.nflowid;
+	BaseMisses = Router.nmisses;
+	ep_thr_mutex_unlock(&Router.mutex);
+}
+
+static void
+router_expect(const char *what, long n2full, long nflowset, long nmisses)
+{
+	long d2full, dflowset, dmisses;
+
+	ep_thr_mutex_lock(&Router.mutex);
+	d2full = Router.n2full - Base2full;
+	dflowset = Router.nflowset - BaseFlowset;
+	dmisses = Router.nmisses - BaseMisses;
+	printf("    %-24s %5ld full %5ld flowset %5ld flowid %3ld misses\n",
+			what, d2full, dflowset, Router.nflowid - BaseFlowid, dmisses);
+	ep_thr_mutex_unlock(&Router.mutex);
+	if (d2full != n2full || (nflowset >= 0 && dflowset != nflowset) ||
+			dmisses != nmisses)
+	{
+		ep_app_error("%s: expected %ld full, %ld flowset, %ld misses",
+				what, n2full, nflowset, nmisses);
+		NErrors++;
+	}
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-n npdus]\n"
+			"    -D  set debugging flags\n"
+			"    -n  PDUs per flow (default 100)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof sin;
+	char addr[40];
+	EP_THR thr;
+	EP_STAT estat;
+	gdp_chan_t *chan;
+	long npdus = 100;
+	int opt;
+	int i;
+	bool show_usage = false;
+	double full, compressed;
+
+	while ((opt = getopt(argc, argv, "D:n:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			npdus = atol(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || npdus < 2)
+		usage();
+
+	estat = gdp_lib_init(NULL, NULL, GDP_INIT_NO_ZEROCONF | GDP_INIT_NO_HONGDS);
+	test_message(estat, "gdp_lib_init");
+	if (ep_thr_spawn(&_GdpIoEventLoopThread, &_gdp_run_event_loop, NULL) != 0)
+		ep_app_fatal("cannot spawn event i/o thread");
+	ep_thr_mutex_init(&RecvMutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_cond_init(&RecvCond);
+	srandom(getpid());
+	ep_adm_setparam("swarm.gdp.reconnect.delay", "100");
+
+	// real names are hashes, so random bytes are a fair stand-in
+	for (i = 0; i < NFLOWS; i++)
+	{
+		size_t j;
+
+		for (j = 0; j < sizeof (gdp_name_t); j++)
+			Flows[i].name[j] = random() & 0xff;
+	}
+
+	// start the mock router on an unused port
+	ep_thr_mutex_init(&Router.mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_cond_init(&Router.cond);
+	Router.lsock = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (Router.lsock < 0 ||
+			bind(Router.lsock, (struct sockaddr *) &sin, sizeof sin) < 0 ||
+			listen(Router.lsock, MAX_CONNS) < 0 ||
+			getsockname(Router.lsock, (struct sockaddr *) &sin, &sinlen) < 0)
+	{
+		ep_app_fatal("cannot start mock router: %s", strerror(errno));
+	}
+	snprintf(addr, sizeof addr, "127.0.0.1:%d", ntohs(sin.sin_port));
+	if (ep_thr_spawn(&thr, accept_thread, NULL) != 0)
+		ep_app_fatal("cannot start mock router thread");
+
+	// baseline: full addresses on every PDU
+	router_mark();
+	chan = open_chan(addr, false);
+	full = send_flows(chan, npdus);
+	router_expect("flow ids off", npdus * NFLOWS, 0, 0);
+	_gdp_chan_close(chan);
+
+	// compressed: one FLOWSET per flow, then just the ids
+	router_mark();
+	chan = open_chan(addr, true);
+	compressed = send_flows(chan, npdus);
+	router_expect("flow ids on", 0, NFLOWS, 0);
+	printf("    header octets per %d octet PDU: %.1f off, %.1f on\n",
+			PAYLEN, full, compressed);
+	if (compressed > full / 2)
+	{
+		ep_app_error("flow ids saved too little");
+		NErrors++;
+	}
+
+	// the router restarts: all flows are set up on the new connection
+	{
+		int nconns;
+		int nadverts;
+
+		router_mark();
+		ep_thr_mutex_lock(&Router.mutex);
+		nconns = Router.nconns;
+		nadverts = NAdverts;
+		shutdown(Router.socks[nconns - 1], SHUT_RDWR);
+		ROUTER_WAIT(Router.nconns > nconns && NAdverts > nadverts);
+		ep_thr_mutex_unlock(&Router.mutex);
+		(void) send_flows(chan, npdus);
+		router_expect("router restarted", 0, NFLOWS, 0);
+	}
+	_gdp_chan_close(chan);
+
+	// more flows than the table holds: ids are rebound, nothing lost
+	ep_adm_setparam("swarm.gdp.chan.flows", "4");
+	router_mark();
+	chan = open_chan(addr, true);
+	(void) send_flows(chan, npdus);
+	router_expect("table too small", 0, -1, 0);
+	_gdp_chan_close(chan);
+
+	// the router uses flow ids toward us, many more of them (and
+	// higher) than our own table holds; we follow its lead
+	router_mark();
+	chan = open_chan(addr, false);
+	{
+		uint8_t data[PAYLEN];
+		long nrecv;
+		long nmisses = metric_value("gdp_chan_flow_misses_total");
+		long routernaks;
+		int sock;
+		uint32_t flow;
+		int k;
+
+		memset(data, 0, sizeof data);
+		ep_thr_mutex_lock(&RecvMutex);
+		nrecv = NRecv;
+		ep_thr_mutex_unlock(&RecvMutex);
+		ep_thr_mutex_lock(&Router.mutex);
+		sock = Router.socks[Router.nconns - 1];
+		routernaks = Router.nnaks;
+		for (k = 0; k < ROUTER_REUSE; k++)
+		{
+			for (flow = 0; flow < NFLOWS; flow++)
+			{
+				memcpy(data, &flow, sizeof flow);
+				router_send(sock, GDP_PKT_ADDR_TYPE_FLOWSET,
+						ROUTER_FLOW + k * NFLOWS + flow,
+						_GdpMyRoutingName, Flows[flow].name,
+						GDP_PKT_TYPE_REGULAR, data, sizeof data);
+			}
+		}
+		// only now use them all, so none can have been forgotten
+		for (k = 0; k < ROUTER_REUSE; k++)
+		{
+			for (flow = 0; flow < NFLOWS; flow++)
+			{
+				memcpy(data, &flow, sizeof flow);
+				router_send(sock, GDP_PKT_ADDR_TYPE_FLOWID,
+						ROUTER_FLOW + k * NFLOWS + flow,
+						NULL, NULL, GDP_PKT_TYPE_REGULAR, data, sizeof data);
+			}
+		}
+
+		// one we never set up, which must be NAKed and dropped ...
+		router_send(sock, GDP_PKT_ADDR_TYPE_FLOWID, ROUTER_FLOW - 1,
+				NULL, NULL, GDP_PKT_TYPE_REGULAR, data, sizeof data);
+
+		// ... and one out of range, which is delivered but NAKed
+		flow = 0;
+		memcpy(data, &flow, sizeof flow);
+		router_send(sock, GDP_PKT_ADDR_TYPE_FLOWSET, MAX_FLOWS,
+				_GdpMyRoutingName, Flows[flow].name,
+				GDP_PKT_TYPE_REGULAR, data, sizeof data);
+		ROUTER_WAIT(Router.nnaks >= routernaks + 2);
+		if (Router.nnaks != routernaks + 2)
+		{
+			ep_app_error("router got %ld flow NAKs, expected 2",
+					Router.nnaks - routernaks);
+			NErrors++;
+		}
+		ep_thr_mutex_unlock(&Router.mutex);
+
+		ep_thr_mutex_lock(&RecvMutex);
+		if (NRecv != nrecv + 2 * ROUTER_REUSE * NFLOWS + 1)
+		{
+			ep_app_error("received %ld PDUs, expected %d",
+					NRecv - nrecv, 2 * ROUTER_REUSE * NFLOWS + 1);
+			NErrors++;
+		}
+		ep_thr_mutex_unlock(&RecvMutex);
+		if (metric_value("gdp_chan_flow_misses_total") != nmisses + 2)
+		{
+			ep_app_error("%ld flow misses counted, expected 2",
+					metric_value("gdp_chan_flow_misses_total") - nmisses);
+			NErrors++;
+		}
+
+		// flow ids were off, but the router has shown it knows them
+		(void) send_flows(chan, npdus);
+		router_expect("router went first", 0, -1, 0);
+	}
+
+	// a header that can't be right: start over on a new connection
+	{
+		uint8_t bogus[FULL_HDR_LEN + PAYLEN];
+		long nrecv;
+		long nerrs = metric_value("gdp_chan_recv_errors_total");
+		int nconns;
+		int nadverts;
+
+		memset(bogus, 0, sizeof bogus);
+		bogus[0] = 4;
+		bogus[1] = FULL_HDR_LEN / 4;
+		bogus[2] = GDP_PKT_TYPE_REGULAR | GDP_PKT_ADDR_TYPE_2FULL;
+		bogus[9] = PAYLEN - 1;				// fragment shorter than payload
+		bogus[11] = PAYLEN;
+		ep_thr_mutex_lock(&RecvMutex);
+		nrecv = NRecv;
+		ep_thr_mutex_unlock(&RecvMutex);
+		ep_thr_mutex_lock(&Router.mutex);
+		nconns = Router.nconns;
+		nadverts = NAdverts;
+		if (write(Router.socks[nconns - 1], bogus, sizeof bogus) < 0)
+			ep_app_error("mock router write: %s", strerror(errno));
+		ROUTER_WAIT(Router.nconns > nconns && NAdverts > nadverts);
+		if (Router.nconns == nconns)
+		{
+			ep_app_error("channel did not reconnect after bad header");
+			NErrors++;
+		}
+		ep_thr_mutex_unlock(&Router.mutex);
+		ep_thr_mutex_lock(&RecvMutex);
+		if (NRecv != nrecv)
+		{
+			ep_app_error("bad header delivered %ld PDUs", NRecv - nrecv);
+			NErrors++;
+		}
+		ep_thr_mutex_unlock(&RecvMutex);
+		if (metric_value("gdp_chan_recv_errors_total") != nerrs + 1)
+		{
+			ep_app_error("bad header not counted as a receive error");
+			NErrors++;
+		}
+		router_mark();
+		(void) send_flows(chan, npdus);
+		router_expect("after bad header", npdus * NFLOWS, 0, 0);
+	}
+	_gdp_chan_close(chan);
+	ep_adm_setparam("swarm.gdp.chan.flows", "256");
+
+	printf("%d errors\n", NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
@@ -0,0 +1,466 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Send several flows (one per log name) over a striped channel
+**  to a mock router and check that each flow stays on one
+**  connection and arrives in order.  Then one connection is
+**  dropped and the flows that used it must move to the others
+**  with nothing lost.  Finally the throughput with one stripe
+**  and with -s stripes is printed for comparison.  The mock
+**  router is a listening socket on the loopback interface with a
+**  reader thread per connection, so this does not need a real
+**  router or log server.
+*/
+
+#include "t_common_support.h"
+
+#include <gdp/gdp_chan.h>
+#include <gdp/gdp_priv.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_metric.h>
+#include <ep/ep_thr.h>
+#include <ep/ep_time.h>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sysexits.h>
+
+#define HDR_LEN		76				// version 4, two full addresses
+#define MAX_CONNS	64				// connections the router will take
+#define NFLOWS		16				// log names to send to
+#define MAX_QUEUED	(8 * 1024 * 1024)	// hold off sending above this
+
+static struct
+{
+	EP_THR_MUTEX	mutex;
+	EP_THR_COND		cond;
+	int				lsock;			// listening socket
+	int				socks[MAX_CONNS];	// accepted connections
+	int				nconns;			// number of accepted connections
+	long			npdus;			// PDUs received (this pass)
+	long			noctets;		// octets received (this pass)
+}		Router;
+
+static struct
+{
+	gdp_name_t		name;			// destination of this flow
+	uint32_t		sendseq;		// next sequence number to send
+	uint32_t		nextseq;		// next sequence number expected
+	int				conn;			// connection it came in on (this pass)
+}		Flows[NFLOWS];
+
+static int			NErrors;
+
+
+static bool
+read_fully(int sock, uint8_t *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = read(sock, buf, len);
+
+		if (n <= 0)
+			return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+
+/*
+**  Mock router: one reader per connection.  Payloads start with
+**  the flow number and a sequence number.
+*/
+
+static void *
+reader_thread(void *conn_)
+{
+	int conn = (int) (intptr_t) conn_;
+	int sock = Router.socks[conn];
+	uint8_t hdr[HDR_LEN];
+	uint8_t *payload = (uint8_t *) ep_mem_malloc(UINT16_MAX);
+
+	while (read_fully(sock, hdr, sizeof hdr))
+	{
+		size_t paylen = (hdr[10] << 8) | hdr[11];
+		uint32_t flow;
+		uint32_t seq;
+
+		if (hdr[1] * 4 != HDR_LEN || !read_fully(sock, payload, paylen))
+			break;
+		if ((hdr[2] & GDP_PKT_TYPE_MASK) != GDP_PKT_TYPE_REGULAR || paylen < 8)
+			continue;
+		memcpy(&flow, &payload[0], sizeof flow);
+		memcpy(&seq, &payload[4], sizeof seq);
+
+		ep_thr_mutex_lock(&Router.mutex);
+		if (flow >= NFLOWS ||
+				memcmp(&hdr[12], Flows[flow].name, sizeof (gdp_name_t)) != 0)
+		{
+			ep_app_error("conn %d: PDU for unknown flow %u", conn, flow);
+			NErrors++;
+		}
+		else
+		{
+			if (Flows[flow].conn < 0)
+				Flows[flow].conn = conn;
+			else if (Flows[flow].conn != conn)
+			{
+				ep_app_error("flow %u on conn %d and %d",
+						flow, Flows[flow].conn, conn);
+				NErrors++;
+				Flows[flow].conn = conn;
+			}
+			if (seq != Flows[flow].nextseq)
+			{
+				ep_app_error("flow %u: seq %u, expected %u",
+						flow, seq, Flows[flow].nextseq);
+				NErrors++;
+			}
+			Flows[flow].nextseq = seq + 1;
+		}
+		Router.npdus++;
+		Router.noctets += HDR_LEN + paylen;
+		ep_thr_cond_broadcast(&Router.cond);
+		ep_thr_mutex_unlock(&Router.mutex);
+	}
+
+	close(sock);
+	ep_mem_free(payload);
+	return NULL;
+}
+
+static void *
+accept_thread(void *unused)
+{
+	for (;;)
+	{
+		int sock = accept(Router.lsock, NULL, NULL);
+		EP_THR thr;
+
+		if (sock < 0)
+			break;
+		ep_thr_mutex_lock(&Router.mutex);
+		if (Router.nconns >= MAX_CONNS)
+		{
+			ep_thr_mutex_unlock(&Router.mutex);
+			close(sock);
+			continue;
+		}
+		Router.socks[Router.nconns] = sock;
+		if (ep_thr_spawn(&thr, reader_thread,
+					(void *) (intptr_t) Router.nconns) != 0)
+			ep_app_fatal("cannot start mock router reader");
+		pthread_detach(thr);
+		Router.nconns++;
+		ep_thr_cond_broadcast(&Router.cond);
+		ep_thr_mutex_unlock(&Router.mutex);
+	}
+	return NULL;
+}
+
+
+/*
+**  Advertise callback: we have no names to advertise.
+*/
+
+static EP_STAT
+advertise_nothing(gdp_chan_t *chan, int cmd_unused, void *adata)
+{
+	return EP_STAT_OK;
+}
+
+
+// current value of an exported metric
+static long
+metric_value(const char *name)
+{
+	char *buf = NULL;
+	size_t bufsize = 0;
+	FILE *fp = open_memstream(&buf, &bufsize);
+	const char *p;
+	long v = -1;
+
+	ep_metric_export(fp, "gdp");
+	fclose(fp);
+	for (p = buf; (p = strstr(p, name)) != NULL; p++)
+	{
+		if ((p == buf || p[-1] == '\n') && p[strlen(name)] == ' ')
+		{
+			v = atol(p + strlen(name) + 1);
+			break;
+		}
+	}
+	free(buf);
+	return v;
+}
+
+
+/*
+**  Send npdus PDUs of paylen octets to each flow and wait for them.
+**  Returns the elapsed time in seconds.
+*/
+
+static double
+send_flows(gdp_chan_t *chan, long npdus, size_t paylen)
+{
+	uint8_t *data = (uint8_t *) ep_mem_zalloc(paylen);
+	gdp_buf_t *payload = gdp_buf_new();
+	EP_TIME_SPEC start, end;
+	long expected;
+	long i;
+	uint32_t flow;
+
+	ep_thr_mutex_lock(&Router.mutex);
+	expected = Router.npdus + npdus * NFLOWS;
+	for (flow = 0; flow < NFLOWS; flow++)
+		Flows[flow].conn = -1;
+	ep_thr_mutex_unlock(&Router.mutex);
+
+	ep_time_now(&start);
+	for (i = 0; i < npdus; i++)
+	{
+		for (flow = 0; flow < NFLOWS; flow++)
+		{
+			uint32_t seq = Flows[flow].sendseq++;
+			EP_STAT estat;
+
+			memcpy(&data[0], &flow, sizeof flow);
+			memcpy(&data[4], &seq, sizeof seq);
+			gdp_buf_write(payload, data, paylen);
+			estat = _gdp_chan_send(chan, NULL, _GdpMyRoutingName,
+							Flows[flow].name, payload, GDP_PKT_TYPE_REGULAR);
+			if (!EP_STAT_ISOK(estat))
+			{
+				test_message(estat, "_gdp_chan_send");
+				NErrors++;
+			}
+			gdp_buf_reset(payload);
+		}
+		while (_gdp_chan_get_outlen(chan) > MAX_QUEUED)
+			ep_time_nanosleep(100 MICROSECONDS);
+	}
+
+	// wait for everything to arrive
+	ep_thr_mutex_lock(&Router.mutex);
+	while (Router.npdus < expected)
+	{
+		EP_TIME_SPEC delta;
+		EP_TIME_SPEC timeout;
+
+		ep_time_from_nsec(10 SECONDS, &delta);
+		ep_time_deltanow(&delta, &timeout);
+		if (ep_thr_cond_wait(&Router.cond, &Router.mutex, &timeout) != 0)
+			break;
+	}
+	if (Router.npdus != expected)
+	{
+		ep_app_error("router saw %ld PDUs, expected %ld",
+				Router.npdus, expected);
+		NErrors++;
+	}
+	ep_thr_mutex_unlock(&Router.mutex);
+	ep_time_now(&end);
+
+	gdp_buf_free(payload);
+	ep_mem_free(data);
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+
+static gdp_chan_t *
+open_chan(const char *addr, int nstripes)
+{
+	char sbuf[20];
+	gdp_chan_t *chan;
+	gdp_chan_x_t *chanx;
+	EP_STAT estat;
+	int nconns;
+
+	snprintf(sbuf, sizeof sbuf, "%d", nstripes);
+	ep_adm_setparam("swarm.gdp.chan.stripes", sbuf);
+	ep_thr_mutex_lock(&Router.mutex);
+	nconns = Router.nconns;
+	ep_thr_mutex_unlock(&Router.mutex);
+
+	chanx = (gdp_chan_x_t *) ep_mem_zalloc(sizeof *chanx);
+	LIST_INIT(&chanx->reqs);
+	estat = _gdp_chan_open(addr, NULL, &_gdp_io_recv, NULL, &_gdp_io_event,
+						&_gdp_router_event, &advertise_nothing, chanx, &chan);
+	test_message(estat, "_gdp_chan_open(%s, %d stripes)", addr, nstripes);
+	if (!EP_STAT_ISOK(estat))
+		exit(EX_UNAVAILABLE);
+
+	ep_thr_mutex_lock(&Router.mutex);
+	while (Router.nconns < nconns + nstripes)
+		ep_thr_cond_wait(&Router.cond, &Router.mutex, NULL);
+	ep_thr_mutex_unlock(&Router.mutex);
+	return chan;
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-n npdus] [-p paylen] [-s nstripes]\n"
+			"    -D  set debugging flags\n"
+			"    -n  PDUs per flow (default 1000)\n"
+			"    -p  payload length (default 8192)\n"
+			"    -s  number of stripes (default 4)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof sin;
+	char addr[40];
+	EP_THR thr;
+	EP_STAT estat;
+	gdp_chan_t *chan;
+	long npdus = 1000;
+	long paylen = 8192;
+	int nstripes = 4;
+	int first;
+	int dead;
+	int nused;
+	int opt;
+	int i;
+	bool show_usage = false;
+	double t1, tn;
+
+	while ((opt = getopt(argc, argv, "D:n:p:s:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			npdus = atol(optarg);
+			break;
+
+		  case 'p':
+			paylen = atol(optarg);
+			break;
+
+		  case 's':
+			nstripes = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || npdus < 1 || paylen < 8 ||
+			paylen > UINT16_MAX || nstripes < 2 || nstripes > MAX_CONNS / 2)
+		usage();
+
+	estat = gdp_lib_init(NULL, NULL, GDP_INIT_NO_ZEROCONF | GDP_INIT_NO_HONGDS);
+	test_message(estat, "gdp_lib_init");
+	if (ep_thr_spawn(&_GdpIoEventLoopThread, &_gdp_run_event_loop, NULL) != 0)
+		ep_app_fatal("cannot spawn event i/o thread");
+	srandom(getpid());
+
+	// don't let the dropped connection come back during the test
+	ep_adm_setparam("swarm.gdp.reconnect.delay", "600000");
+
+	// real names are hashes, so random bytes are a fair stand-in
+	for (i = 0; i < NFLOWS; i++)
+	{
+		size_t j;
+
+		for (j = 0; j < sizeof (gdp_name_t); j++)
+			Flows[i].name[j] = random() & 0xff;
+	}
+
+	// start the mock router on an unused port
+	ep_thr_mutex_init(&Router.mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_cond_init(&Router.cond);
+	Router.lsock = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (Router.lsock < 0 ||
+			bind(Router.lsock, (struct sockaddr *) &sin, sizeof sin) < 0 ||
+			listen(Router.lsock, MAX_CONNS) < 0 ||
+			getsockname(Router.lsock, (struct sockaddr *) &sin, &sinlen) < 0)
+	{
+		ep_app_fatal("cannot start mock router: %s", strerror(errno));
+	}
+	snprintf(addr, sizeof addr, "127.0.0.1:%d", ntohs(sin.sin_port));
+	if (ep_thr_spawn(&thr, accept_thread, NULL) != 0)
+		ep_app_fatal("cannot start mock router thread");
+
+	// baseline: one stripe
+	chan = open_chan(addr, 1);
+	t1 = send_flows(chan, npdus, paylen);
+	_gdp_chan_close(chan);
+
+	// striped: each flow must stick to one connection, and use several
+	first = Router.nconns;
+	chan = open_chan(addr, nstripes);
+	tn = send_flows(chan, npdus, paylen);
+	nused = 0;
+	for (i = first; i < first + nstripes; i++)
+	{
+		int f;
+
+		for (f = 0; f < NFLOWS && Flows[f].conn != i; f++)
+			continue;
+		if (f < NFLOWS)
+			nused++;
+	}
+	if (nused < 2)
+	{
+		ep_app_error("%d flows used only %d of %d stripes",
+				NFLOWS, nused, nstripes);
+		NErrors++;
+	}
+
+	// drop the connection flow 0 is on; its flows must move elsewhere
+	dead = Flows[0].conn;
+	if (dead >= 0)
+	{
+		long ndisc = metric_value("gdp_chan_disconnects_total");
+
+		shutdown(Router.socks[dead], SHUT_RDWR);
+		for (i = 0; i < 1000 &&
+				metric_value("gdp_chan_disconnects_total") <= ndisc; i++)
+			ep_time_nanosleep(10 MILLISECONDS);
+		send_flows(chan, npdus / 10 + 1, 64);
+		for (i = 0; i < NFLOWS; i++)
+		{
+			if (Flows[i].conn == dead)
+			{
+				ep_app_error("flow %d still on dropped conn %d", i, dead);
+				NErrors++;
+			}
+		}
+		if (metric_value("gdp_chan_stripe_failovers_total") <= 0)
+		{
+			ep_app_error("no PDUs failed over");
+			NErrors++;
+		}
+	}
+	_gdp_chan_close(chan);
+
+	printf("%d flows x %ld PDUs x %ld octets\n", NFLOWS, npdus, paylen);
+	printf("    1 stripe:  %8.1f MB/s\n",
+			NFLOWS * npdus * (paylen + HDR_LEN) / t1 / 1e6);
+	printf("   %2d stripes: %8.1f MB/s (%d in use)\n", nstripes,
+			NFLOWS * npdus * (paylen + HDR_LEN) / tn / 1e6, nused);
+	printf("%d errors\n", NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
@@ -0,0 +1,203 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise the lock contention profiler.  Several threads fight
+**  over a mutex (holding it for a moment each time), a statically
+**  initialized mutex, and an rwlock.  The report must charge the
+**  dynamic locks to the line where they were initialized and the
+**  static one to where it was first locked, count every
+**  acquisition exactly, and show contention on the mutex.
+*/
+
+#include <ep/ep.h>
+#include <ep/ep_app.h>
+#include <ep/ep_dbg.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_thr.h>
+#include "t_common_support.h"
+
+#include <getopt.h>
+#include <string.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_ep_lockprof", "Lock profiler test");
+
+static EP_THR_MUTEX		Mutex;
+static EP_THR_MUTEX		StaticMutex		EP_THR_MUTEX_INITIALIZER;
+static EP_THR_RWLOCK	RwLock;
+static int				MutexLine;			// where Mutex was initialized
+static int				StaticLine;			// where StaticMutex first locked
+static long				NIter = 2000;
+static long				Counter;
+static int				NErrors;
+
+static void *
+fight(void *unused)
+{
+	long i;
+
+	for (i = 0; i < NIter; i++)
+	{
+		ep_thr_mutex_lock(&Mutex);
+		Counter++;
+		if (i % 100 == 0)
+			usleep(100);			// make the others wait
+		ep_thr_mutex_unlock(&Mutex);
+
+		ep_thr_rwlock_rdlock(&RwLock);
+		ep_thr_rwlock_unlock(&RwLock);
+		if (i % 10 == 0)
+		{
+			ep_thr_rwlock_wrlock(&RwLock);
+			ep_thr_rwlock_unlock(&RwLock);
+		}
+	}
+	return NULL;
+}
+
+// find the report line for a site and pull the counts out of it
+static bool
+site_counts(const char *buf, const char *site, long *nacq, long *ncont)
+{
+	const char *p = strstr(buf, site);
+	char lock[40];
+
+	if (p == NULL)
+	{
+		ep_app_error("site %s not in report", site);
+		NErrors++;
+		return false;
+	}
+	if (sscanf(p + strlen(site), " %39s %ld %ld", lock, nacq, ncont) != 3)
+	{
+		ep_app_error("cannot parse report line for %s", site);
+		NErrors++;
+		return false;
+	}
+	return true;
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-n niter] [-t nthreads]\n"
+			"    -D  set debugging flags\n"
+			"    -n  iterations per thread (default 2000)\n"
+			"    -t  number of threads (default 4)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	EP_THR *thrs;
+	int nthreads = 4;
+	int i;
+	int opt;
+	bool show_usage = false;
+	char *buf = NULL;
+	size_t bufsize = 0;
+	FILE *fp;
+	char site[60];
+	long nacq, ncont;
+
+	while ((opt = getopt(argc, argv, "D:n:t:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			NIter = atol(optarg);
+			break;
+
+		  case 't':
+			nthreads = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || NIter < 1 || nthreads < 2)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+	ep_adm_setparam("libep.thr.lockprof.enable", "true");
+	ep_thr_lockprof_init();
+	if (!_EpThrLockProf)
+	{
+		printf("lock profiling not compiled in, skipping\n");
+		return EX_OK;
+	}
+
+	MutexLine = __LINE__; ep_thr_mutex_init(&Mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_rwlock_init(&RwLock);
+
+	thrs = (EP_THR *) ep_mem_zalloc(nthreads * sizeof *thrs);
+	for (i = 0; i < nthreads; i++)
+		ep_thr_spawn(&thrs[i], &fight, NULL);
+	for (i = 0; i < 10; i++)
+	{
+		StaticLine = __LINE__; ep_thr_mutex_lock(&StaticMutex);
+		ep_thr_mutex_unlock(&StaticMutex);
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(thrs[i], NULL);
+	ep_mem_free(thrs);
+
+	fp = open_memstream(&buf, &bufsize);
+	ep_thr_lockprof_dump(fp, 0);
+	fclose(fp);
+	if (ep_dbg_test(Dbg, 1))
+		fputs(buf, stdout);
+
+	snprintf(site, sizeof site, " t_ep_lockprof.c:%d ", MutexLine);
+	if (site_counts(buf, site, &nacq, &ncont))
+	{
+		if (nacq != nthreads * NIter)
+		{
+			ep_app_error("mutex acquired %ld times, expected %ld",
+					nacq, nthreads * NIter);
+			NErrors++;
+		}
+		if (ncont == 0)
+		{
+			ep_app_error("no contention seen on mutex");
+			NErrors++;
+		}
+	}
+	snprintf(site, sizeof site, " *t_ep_lockprof.c:%d ", StaticLine);
+	if (site_counts(buf, site, &nacq, &ncont) && nacq != 10)
+	{
+		ep_app_error("static mutex acquired %ld times, expected 10", nacq);
+		NErrors++;
+	}
+	snprintf(site, sizeof site, " t_ep_lockprof.c:%d ", MutexLine + 1);
+	if (site_counts(buf, site, &nacq, &ncont) &&
+			nacq != nthreads * (NIter + (NIter + 9) / 10))
+	{
+		ep_app_error("rwlock acquired %ld times, expected %ld",
+				nacq, nthreads * (NIter + (NIter + 9) / 10));
+		NErrors++;
+	}
+	if (Counter != nthreads * NIter)
+	{
+		ep_app_error("counter %ld, expected %ld", Counter, nthreads * NIter);
+		NErrors++;
+	}
+	free(buf);
+
+	printf("%d threads x %ld iterations, %d errors\n",
+			nthreads, NIter, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
@@ -0,0 +1,296 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise memory accounting.  Threads allocate under their own
+**  tags, grow some blocks with realloc, and hand half of their
+**  blocks to another thread to be freed (under a different tag),
+**  which must still be charged back to the allocating tag.  Once
+**  the threads have exited their counts must all have been merged
+**  and the totals must be exact.  Blocks from before accounting
+**  was turned on must still grow and free cleanly without being
+**  charged to anyone.  Aligned blocks must stay aligned (where the
+**  system can align them) and keep their contents when they grow.
+*/
+
+#include <ep/ep.h>
+#include <ep/ep_app.h>
+#include <ep/ep_dbg.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_thr.h>
+#include "t_common_support.h"
+
+#include <getopt.h>
+#include <string.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_ep_mem_account", "Memory accounting test");
+
+#define BLKSIZE		100
+
+static long		NBlocks = 1000;			// per thread
+static int		TagA;
+static int		TagB;
+static int		NErrors;
+
+struct worker
+{
+	EP_THR		thr;
+	int			tag;
+	void		**handoff;				// blocks for main to free
+};
+
+static void *
+work(void *w_)
+{
+	struct worker *w = (struct worker *) w_;
+	long i;
+
+	ep_mem_tag_set(w->tag);
+	for (i = 0; i < NBlocks; i++)
+	{
+		void *p = ep_mem_malloc(BLKSIZE);
+
+		if (i % 2 == 0)
+		{
+			// grow it, then give it away
+			p = ep_mem_realloc(p, 2 * BLKSIZE);
+			w->handoff[i / 2] = p;
+		}
+		else
+		{
+			ep_mem_free(p);
+		}
+	}
+	return NULL;
+}
+
+struct handoff
+{
+	struct worker	*w;
+	int				nworkers;
+	long			nhand;
+};
+
+static void *
+free_all(void *h_)
+{
+	struct handoff *h = (struct handoff *) h_;
+	long j;
+	int i;
+
+	ep_mem_tag_set(TagB);
+	for (i = 0; i < h->nworkers; i++)
+		for (j = 0; j < h->nhand; j++)
+			ep_mem_free(h->w[i].handoff[j]);
+	return NULL;
+}
+
+// grow and free a block allocated before accounting was on
+static void *
+free_early(void *p_)
+{
+	void **p = (void **) p_;
+
+	*p = ep_mem_realloc(*p, 2 * BLKSIZE);
+	memset(*p, 0, 2 * BLKSIZE);
+	ep_mem_free(*p);
+	return NULL;
+}
+
+// allocate, grow and free an aligned block
+static void *
+aligned(void *tag_)
+{
+	size_t pagesize = getpagesize();
+	uint8_t *p;
+	size_t i;
+
+	ep_mem_tag_set(*(int *) tag_);
+	p = (uint8_t *) ep_mem_falloc(BLKSIZE, EP_MEM_F_ALIGN);
+	for (i = 0; i < BLKSIZE; i++)
+		p[i] = i;
+	p = (uint8_t *) ep_mem_realloc(p, 3 * pagesize);
+	for (i = 0; i < BLKSIZE; i++)
+	{
+		if (p[i] != (uint8_t) i)
+		{
+			ep_app_error("aligned block lost its contents growing");
+			NErrors++;
+			break;
+		}
+	}
+#ifdef EP_OSCF_SYSTEM_VALLOC
+	if (((uintptr_t) p & (pagesize - 1)) != 0)
+	{
+		ep_app_error("aligned block at %p", p);
+		NErrors++;
+	}
+#endif
+	ep_mem_free(p);
+	return NULL;
+}
+
+static void
+check(int tag, int64_t live, uint64_t nalloc, uint64_t nfree)
+{
+	EP_MEM_TAG_STATS st;
+
+	if (!ep_mem_tag_stats(tag, &st))
+	{
+		ep_app_error("no stats for tag %d", tag);
+		NErrors++;
+		return;
+	}
+	if (st.live_bytes != live || st.nalloc != nalloc || st.nfree != nfree)
+	{
+		ep_app_error("%s: live %" PRId64 " nalloc %" PRIu64
+				" nfree %" PRIu64 ", expected %" PRId64 " %" PRIu64
+				" %" PRIu64,
+				st.name, st.live_bytes, st.nalloc, st.nfree,
+				live, nalloc, nfree);
+		NErrors++;
+	}
+	if (st.max_bytes < st.live_bytes)
+	{
+		ep_app_error("%s: max %" PRId64 " below live %" PRId64,
+				st.name, st.max_bytes, st.live_bytes);
+		NErrors++;
+	}
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-n nblocks] [-t nthreads]\n"
+			"    -D  set debugging flags\n"
+			"    -n  blocks per thread (default 1000)\n"
+			"    -t  threads per tag (default 2)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct worker *w;
+	struct handoff h;
+	EP_THR thr;
+	EP_MEM_TAG_STATS st;
+	int nthreads = 2;
+	int i;
+	int opt;
+	bool show_usage = false;
+	void *early;
+	int tagalign;
+	EP_MEM_TAG_STATS before;
+	uint64_t nhand;
+
+	while ((opt = getopt(argc, argv, "D:n:t:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			NBlocks = atol(optarg);
+			break;
+
+		  case 't':
+			nthreads = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || NBlocks < 2 || nthreads < 1)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+	early = ep_mem_malloc(BLKSIZE);
+	ep_adm_setparam("libep.mem.account", "true");
+	ep_mem_account_init();
+	TagA = ep_mem_tag_register("test-a");
+	TagB = ep_mem_tag_register("test-b");
+	if (ep_mem_tag_register("test-a") != TagA || TagA == TagB)
+	{
+		ep_app_error("tag registration is not idempotent");
+		NErrors++;
+	}
+
+	// half the threads on each tag
+	w = (struct worker *) ep_mem_zalloc(2 * nthreads * sizeof *w);
+	nhand = (NBlocks + 1) / 2;
+	for (i = 0; i < 2 * nthreads; i++)
+	{
+		w[i].tag = i % 2 == 0 ? TagA : TagB;
+		w[i].handoff = (void **) calloc(nhand, sizeof (void *));
+		ep_thr_spawn(&w[i].thr, &work, &w[i]);
+	}
+	for (i = 0; i < 2 * nthreads; i++)
+		pthread_join(w[i].thr, NULL);
+
+	// exited threads have been merged
+	check(TagA, nthreads * nhand * 2 * BLKSIZE,
+			nthreads * NBlocks, nthreads * (NBlocks - nhand));
+	check(TagB, nthreads * nhand * 2 * BLKSIZE,
+			nthreads * NBlocks, nthreads * (NBlocks - nhand));
+
+	// free them elsewhere, under another tag
+	h.w = w;
+	h.nworkers = 2 * nthreads;
+	h.nhand = nhand;
+	ep_thr_spawn(&thr, &free_all, &h);
+	pthread_join(thr, NULL);
+	check(TagA, 0, nthreads * NBlocks, nthreads * NBlocks);
+	check(TagB, 0, nthreads * NBlocks, nthreads * NBlocks);
+	ep_mem_tag_stats(TagA, &st);
+	if (st.max_bytes < (int64_t) (nthreads * nhand * 2 * BLKSIZE))
+	{
+		ep_app_error("%s: max %" PRId64 " below peak", st.name, st.max_bytes);
+		NErrors++;
+	}
+	for (i = 0; i < 2 * nthreads; i++)
+		free(w[i].handoff);
+	ep_mem_free(w);
+
+	// memory from before accounting isn't charged when it goes
+	ep_mem_tag_stats(EP_MEM_TAG_OTHER, &before);
+	ep_thr_spawn(&thr, &free_early, &early);
+	pthread_join(thr, NULL);
+	ep_mem_tag_stats(EP_MEM_TAG_OTHER, &st);
+	if (st.live_bytes != before.live_bytes || st.nfree != before.nfree)
+	{
+		ep_app_error("early block charged: live %" PRId64 " => %" PRId64
+				", nfree %" PRIu64 " => %" PRIu64,
+				before.live_bytes, st.live_bytes, before.nfree, st.nfree);
+		NErrors++;
+	}
+
+	// aligned blocks are accounted like any other
+	tagalign = ep_mem_tag_register("test-align");
+	ep_thr_spawn(&thr, &aligned, &tagalign);
+	pthread_join(thr, NULL);
+	ep_mem_tag_stats(tagalign, &st);
+	if (st.live_bytes != 0 || st.nalloc == 0 || st.nalloc != st.nfree)
+	{
+		ep_app_error("%s: live %" PRId64 " nalloc %" PRIu64
+				" nfree %" PRIu64,
+				st.name, st.live_bytes, st.nalloc, st.nfree);
+		NErrors++;
+	}
+
+	if (ep_dbg_test(Dbg, 1))
+		ep_mem_account_dump(stdout);
+	printf("%d threads x %ld blocks, %d errors\n",
+			2 * nthreads, NBlocks, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
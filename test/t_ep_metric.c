@@ -0,0 +1,214 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise the metrics registry.  Several threads hammer on a
+**  counter, a gauge, and a histogram at once; afterwards the
+**  totals must be exact.  Then the export is parsed back to check
+**  that the names, HELP/TYPE lines, labels, and cumulative
+**  histogram buckets come out the way Prometheus expects.
+*/
+
+#include <ep/ep.h>
+#include <ep/ep_app.h>
+#include <ep/ep_dbg.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_metric.h>
+#include <ep/ep_thr.h>
+#include "t_common_support.h"
+
+#include <getopt.h>
+#include <string.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_ep_metric", "Metrics registry test");
+
+static const int64_t	Bounds[] = { 10, 100, 1000 };
+
+static EP_METRIC	Counter = EP_METRIC_COUNTER_INIT("test",
+							"ops_total", "Operations");
+static EP_METRIC	Gauge = EP_METRIC_GAUGE_INIT("test",
+							"inflight", "Operations in flight");
+static EP_METRIC	Hist = EP_METRIC_HISTOGRAM_INIT("test",
+							"op_usec", "Operation time", Bounds);
+
+static long			NIter = 100000;
+static int			NErrors;
+
+static void *
+hammer(void *unused)
+{
+	long i;
+
+	for (i = 0; i < NIter; i++)
+	{
+		ep_metric_inc(&Gauge);
+		ep_metric_inc(&Counter);
+		ep_metric_observe(&Hist, i % 2000);
+		ep_metric_add(&Gauge, -1);
+	}
+	return NULL;
+}
+
+static int64_t
+answer(EP_METRIC *m, void *arg)
+{
+	return (int64_t) (intptr_t) arg;
+}
+
+// true if line appears (as a whole line) in buf
+static bool
+has_line(const char *buf, const char *line)
+{
+	size_t l = strlen(line);
+	const char *p;
+
+	for (p = buf; (p = strstr(p, line)) != NULL; p += l)
+	{
+		if ((p == buf || p[-1] == '\n') && p[l] == '\n')
+			return true;
+	}
+	return false;
+}
+
+static void
+expect(const char *buf, const char *line)
+{
+	if (!has_line(buf, line))
+	{
+		ep_app_error("missing from export: %s", line);
+		NErrors++;
+	}
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-n niter] [-t nthreads]\n"
+			"    -D  set debugging flags\n"
+			"    -n  iterations per thread (default 100000)\n"
+			"    -t  number of threads (default 4)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	EP_THR *thrs;
+	int nthreads = 4;
+	int i;
+	int opt;
+	bool show_usage = false;
+	char *buf = NULL;
+	size_t bufsize = 0;
+	FILE *fp;
+	char lbuf[200];
+	int64_t nless;
+
+	while ((opt = getopt(argc, argv, "D:n:t:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			NIter = atol(optarg);
+			break;
+
+		  case 't':
+			nthreads = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || NIter < 2000 || nthreads < 1)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+
+	// updates before registration must count
+	ep_metric_inc(&Counter);
+	ep_metric_register(&Counter);
+	ep_metric_register(&Gauge);
+	ep_metric_register(&Hist);
+	ep_metric_register(&Counter);		// harmless
+	ep_metric_new(EP_METRIC_GAUGE, "test", "answer", "Computed",
+			"kind=\"a\"", &answer, (void *) 42);
+	ep_metric_new(EP_METRIC_GAUGE, "test", "answer", "Computed",
+			"kind=\"b\"", &answer, (void *) 7);
+
+	thrs = (EP_THR *) ep_mem_zalloc(nthreads * sizeof *thrs);
+	for (i = 0; i < nthreads; i++)
+		ep_thr_spawn(&thrs[i], &hammer, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(thrs[i], NULL);
+	ep_mem_free(thrs);
+
+	if (ep_metric_get(&Counter) != nthreads * NIter + 1)
+	{
+		ep_app_error("counter %" PRId64 ", expected %ld",
+				ep_metric_get(&Counter), nthreads * NIter + 1);
+		NErrors++;
+	}
+	if (ep_metric_get(&Gauge) != 0)
+	{
+		ep_app_error("gauge %" PRId64 ", expected 0", ep_metric_get(&Gauge));
+		NErrors++;
+	}
+
+	fp = open_memstream(&buf, &bufsize);
+	ep_metric_export(fp, "gdp");
+	fclose(fp);
+	if (ep_dbg_test(Dbg, 1))
+		fputs(buf, stdout);
+
+	snprintf(lbuf, sizeof lbuf, "gdp_test_ops_total %ld",
+			nthreads * NIter + 1);
+	expect(buf, lbuf);
+	expect(buf, "# TYPE gdp_test_ops_total counter");
+	expect(buf, "# HELP gdp_test_inflight Operations in flight");
+	expect(buf, "# TYPE gdp_test_op_usec histogram");
+	expect(buf, "gdp_test_answer{kind=\"a\"} 42");
+	expect(buf, "gdp_test_answer{kind=\"b\"} 7");
+
+	// each thread observes 0..1999 repeatedly, so buckets are predictable
+	nless = 0;
+	for (i = 0; i < NIter; i++)
+		if (i % 2000 <= 100)
+			nless++;
+	snprintf(lbuf, sizeof lbuf, "gdp_test_op_usec_bucket{le=\"100\"} %"
+			PRId64, nless * nthreads);
+	expect(buf, lbuf);
+	snprintf(lbuf, sizeof lbuf, "gdp_test_op_usec_bucket{le=\"+Inf\"} %ld",
+			nthreads * NIter);
+	expect(buf, lbuf);
+	snprintf(lbuf, sizeof lbuf, "gdp_test_op_usec_count %ld",
+			nthreads * NIter);
+	expect(buf, lbuf);
+
+	// one HELP line per name even with several label sets
+	{
+		const char *p = strstr(buf, "# HELP gdp_test_answer ");
+
+		if (p == NULL || strstr(p + 1, "# HELP gdp_test_answer ") != NULL)
+		{
+			ep_app_error("expected exactly one HELP for gdp_test_answer");
+			NErrors++;
+		}
+	}
+	free(buf);
+
+	printf("%d threads x %ld iterations, %d errors\n",
+			nthreads, NIter, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
@@ -0,0 +1,202 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise serial executors the way _gdp_pdu_process uses them,
+**  one per GOB.  Work for many "logs" is queued interleaved; each
+**  log's work must run in the order it was queued and never on two
+**  workers at once.  One log is hot (its work is slow): the others
+**  must all finish while it still has work waiting, rather than
+**  queueing up behind it.
+*/
+
+#include <ep/ep.h>
+#include <ep/ep_app.h>
+#include <ep/ep_dbg.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_thr.h>
+#include "t_common_support.h"
+
+#include <getopt.h>
+#include <sysexits.h>
+
+struct tlog
+{
+	EP_THR_SERIAL	*serial;
+	long			nwork;			// work items queued
+	long			nextseq;		// next one expected to run
+	bool			running;
+};
+
+struct twork
+{
+	struct tlog		*log;
+	long			seq;
+};
+
+static EP_THR_MUTEX	Mutex;
+static EP_THR_COND	Done;
+static long			NColdLeft;		// cold work not yet run
+static long			HotLeftAtCold;	// hot work left when the cold work ended
+static int			NErrors;
+static long			HotUsec = 2000;
+static struct tlog	*Hot;
+
+static void
+work(void *w_)
+{
+	struct twork *w = (struct twork *) w_;
+	struct tlog *l = w->log;
+
+	ep_thr_mutex_lock(&Mutex);
+	if (l->running)
+	{
+		ep_app_error("log %p: work %ld ran alongside other work",
+				l, w->seq);
+		NErrors++;
+	}
+	if (w->seq != l->nextseq)
+	{
+		ep_app_error("log %p: work %ld ran when %ld was expected",
+				l, w->seq, l->nextseq);
+		NErrors++;
+	}
+	l->running = true;
+	ep_thr_mutex_unlock(&Mutex);
+
+	// give another worker a chance to sneak in
+	if (l == Hot)
+		usleep(HotUsec);
+	else
+		ep_thr_yield();
+
+	ep_thr_mutex_lock(&Mutex);
+	l->running = false;
+	l->nextseq = w->seq + 1;
+	if (l != Hot && --NColdLeft == 0)
+		HotLeftAtCold = Hot->nwork - Hot->nextseq;
+	ep_thr_cond_broadcast(&Done);
+	ep_thr_mutex_unlock(&Mutex);
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-l nlogs] [-n nwork] [-w nworkers]\n"
+			"    -D  set debugging flags\n"
+			"    -l  number of logs (default 50)\n"
+			"    -n  work items per log (default 200)\n"
+			"    -w  number of workers (default 8)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct tlog *logs;
+	struct twork *works;
+	long nlogs = 50;
+	long nwork = 200;
+	long i;
+	long j;
+	int nworkers = 8;
+	int max_depth;
+	int opt;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "D:l:n:w:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'l':
+			nlogs = atol(optarg);
+			break;
+
+		  case 'n':
+			nwork = atol(optarg);
+			break;
+
+		  case 'w':
+			nworkers = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || nlogs < 2 || nwork < 2 || nworkers < 2)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+	ep_thr_mutex_init(&Mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_cond_init(&Done);
+	ep_thr_pool_init(nworkers, nworkers, 0);
+
+	logs = (struct tlog *) ep_mem_zalloc(nlogs * sizeof *logs);
+	works = (struct twork *) ep_mem_zalloc(nlogs * nwork * sizeof *works);
+	for (i = 0; i < nlogs; i++)
+		logs[i].serial = ep_thr_serial_new();
+	Hot = &logs[0];
+	NColdLeft = (nlogs - 1) * nwork;
+
+	// interleave the work for all logs, as it would come off the wire
+	for (j = 0; j < nwork; j++)
+	{
+		for (i = 0; i < nlogs; i++)
+		{
+			struct twork *w = &works[j * nlogs + i];
+
+			w->log = &logs[i];
+			w->seq = logs[i].nwork++;
+			ep_thr_serial_run(logs[i].serial, &work, w);
+		}
+	}
+
+	ep_thr_mutex_lock(&Mutex);
+	while (NColdLeft > 0 || Hot->nextseq < Hot->nwork)
+		ep_thr_cond_wait(&Done, &Mutex, NULL);
+	ep_thr_mutex_unlock(&Mutex);
+
+	// the hot log used one worker, so the others got done first
+	if (HotLeftAtCold == 0)
+	{
+		ep_app_error("other logs waited for the hot log to finish");
+		NErrors++;
+	}
+
+	for (i = 0; i < nlogs; i++)
+	{
+		struct tlog *l = &logs[i];
+
+		if (l->nextseq != nwork)
+		{
+			ep_app_error("log %ld: ran %ld of %ld", i, l->nextseq, nwork);
+			NErrors++;
+		}
+		while (!ep_thr_serial_idle(l->serial))
+			usleep(1000);
+		if (ep_thr_serial_depth(l->serial, &max_depth) != 0 ||
+				max_depth < 1 || max_depth > nwork)
+		{
+			ep_app_error("log %ld: bad queue depth (max %d)", i, max_depth);
+			NErrors++;
+		}
+		ep_thr_serial_free(l->serial);
+	}
+	ep_mem_free(works);
+	ep_mem_free(logs);
+
+	printf("%ld logs x %ld, %ld hot left when the rest were done, %d errors\n",
+			nlogs, nwork, HotLeftAtCold, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
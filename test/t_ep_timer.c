@@ -0,0 +1,192 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise the timer wheel.  Sets -n timers at random delays spread
+**  over all levels of the wheel (and past its end, if -m is big
+**  enough), cancels some of them and re-arms some more, then
+**  advances a manual wheel tick by tick and checks that every
+**  timer fires exactly when it should and that cancelled timers
+**  never fire.  A periodic timer re-arms itself from its function.
+*/
+
+#include <ep/ep.h>
+#include <ep/ep_app.h>
+#include <ep/ep_dbg.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_timer.h>
+#include "t_common_support.h"
+
+#include <getopt.h>
+#include <sysexits.h>
+
+struct ttimer
+{
+	EP_TIMER	timer;
+	uint64_t	due;			// tick when it should fire
+	int			nfired;			// number of times fired
+	bool		cancelled;
+};
+
+static uint64_t		Now;			// current tick
+static uint64_t		Period = 97;	// for periodic timer
+static int			NErrors;
+
+static void
+timer_func(EP_TIMER *t, void *arg)
+{
+	struct ttimer *tt = (struct ttimer *) arg;
+
+	if (&tt->timer != t)
+	{
+		ep_app_error("timer %p called with arg for %p", t, &tt->timer);
+		NErrors++;
+	}
+	if (tt->cancelled || tt->nfired > 0 || tt->due != Now)
+	{
+		ep_app_error("timer %p: due %" PRIu64 " fired at %" PRIu64
+				" (cancelled %d, nfired %d)",
+				t, tt->due, Now, tt->cancelled, tt->nfired);
+		NErrors++;
+	}
+	tt->nfired++;
+}
+
+static void
+periodic_func(EP_TIMER *t, void *arg)
+{
+	EP_TIMER_WHEEL *w = (EP_TIMER_WHEEL *) arg;
+	static uint64_t last = 0;
+
+	if (Now != last + Period)
+	{
+		ep_app_error("periodic timer: expected %" PRIu64 ", fired at %" PRIu64,
+				last + Period, Now);
+		NErrors++;
+	}
+	last = Now;
+	ep_timer_set(w, t, Period, &periodic_func, w);
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-m maxticks] [-n ntimers]\n"
+			"    -D  set debugging flags\n"
+			"    -m  maximum timer delay in ticks (default 100000)\n"
+			"    -n  number of timers (default 100000)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	EP_TIMER_WHEEL *w;
+	EP_TIMER periodic;
+	struct ttimer *timers;
+	long ntimers = 100000;
+	uint64_t maxticks = 100000;
+	uint64_t lastdue = 0;
+	long i;
+	long nfired = 0;
+	long ncancelled = 0;
+	int opt;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "D:m:n:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'm':
+			maxticks = strtoull(optarg, NULL, 0);
+			break;
+
+		  case 'n':
+			ntimers = atol(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || ntimers < 1 || maxticks < 1)
+		usage();
+
+	ep_lib_init(0);
+	srandom(getpid());
+
+	// one usec ticks make the arithmetic easy
+	w = ep_timer_wheel_new(1, EP_TIMER_WHEEL_MANUAL);
+	timers = (struct ttimer *) ep_mem_zalloc(ntimers * sizeof *timers);
+	memset(&periodic, 0, sizeof periodic);
+	ep_timer_set(w, &periodic, Period, &periodic_func, w);
+
+	for (i = 0; i < ntimers; i++)
+	{
+		struct ttimer *tt = &timers[i];
+
+		tt->due = ((uint64_t) random() << 16 ^ random()) % maxticks + 1;
+		ep_timer_set(w, &tt->timer, tt->due, &timer_func, tt);
+		if (tt->due > lastdue)
+			lastdue = tt->due;
+	}
+
+	// cancel some and move some others
+	for (i = 0; i < ntimers; i += 7)
+	{
+		if (!ep_timer_clr(w, &timers[i].timer))
+		{
+			ep_app_error("timer %ld was not pending", i);
+			NErrors++;
+		}
+		timers[i].cancelled = true;
+		ncancelled++;
+	}
+	for (i = 3; i < ntimers; i += 7)
+	{
+		timers[i].due = timers[i].due / 2 + 1;
+		ep_timer_set(w, &timers[i].timer, timers[i].due, &timer_func,
+				&timers[i]);
+	}
+	if (ep_timer_wheel_ntimers(w) != (uint64_t) (ntimers - ncancelled + 1))
+	{
+		ep_app_error("%" PRIu64 " timers pending, expected %ld",
+				ep_timer_wheel_ntimers(w), ntimers - ncancelled + 1);
+		NErrors++;
+	}
+
+	// we started at tick zero
+	for (Now = 1; Now <= lastdue; Now++)
+		nfired += ep_timer_wheel_advance(w, 1);
+	nfired -= lastdue / Period;		// don't count the periodic timer
+
+	for (i = 0; i < ntimers; i++)
+	{
+		if (!timers[i].cancelled && timers[i].nfired != 1)
+		{
+			ep_app_error("timer %ld (due %" PRIu64 ") fired %d times",
+					i, timers[i].due, timers[i].nfired);
+			NErrors++;
+		}
+	}
+	if (!ep_timer_clr(w, &periodic) || ep_timer_wheel_ntimers(w) != 0)
+	{
+		ep_app_error("timers left over");
+		NErrors++;
+	}
+	ep_timer_wheel_free(w);
+
+	printf("%ld timers, %ld cancelled, %ld fired, %d errors\n",
+			ntimers, ncancelled, nfired, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
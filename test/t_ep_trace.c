@@ -0,0 +1,246 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise request tracing.  Before tracing is turned on nothing
+**  may be recorded.  Then several threads each run traced
+**  "requests" made of a parent span with two children (plus some
+**  untraced ones), and the Chrome JSON dump is checked: the right
+**  number of spans, children pointing at their parents, and only
+**  the newest events kept when a ring wraps.
+*/
+
+#include <ep/ep.h>
+#include <ep/ep_app.h>
+#include <ep/ep_dbg.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_thr.h>
+#include <ep/ep_trace.h>
+#include "t_common_support.h"
+
+#include <getopt.h>
+#include <string.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_ep_trace", "Request tracing test");
+
+static int		NReqs = 100;		// traced requests per thread
+static int		NErrors;
+static pthread_barrier_t	Barrier;	// keep threads (and rings) alive
+
+static void *
+requests(void *unused)
+{
+	int i;
+
+	for (i = 0; i < NReqs * 2; i++)
+	{
+		EP_TRACE_SPAN parent;
+		EP_TRACE_SPAN child;
+		bool traced = ep_trace_enabled() && i % 2 == 0;
+
+		// odd numbered requests are not traced and must leave no trace
+		if (traced)
+			ep_trace_set((uint64_t) ep_thr_gettid() << 32 | (i + 1), 0);
+		ep_trace_begin(&parent, "test", "request");
+		ep_trace_begin(&child, "test", "lock");
+		ep_trace_end(&child);
+		if (traced && child.start != 0)
+		{
+			ep_app_error("span not reset by end");
+			NErrors++;
+		}
+		ep_trace_begin(&child, "test", "storage");
+		if (traced && ep_trace_span_id() != child.span_id)
+		{
+			ep_app_error("child is not the current span");
+			NErrors++;
+		}
+		ep_trace_instant("test", "mark");
+		ep_trace_end(&child);
+		if (traced && ep_trace_span_id() != parent.span_id)
+		{
+			ep_app_error("parent not restored after child");
+			NErrors++;
+		}
+		ep_trace_end(&parent);
+		if (traced)
+			ep_trace_set(0, 0);
+	}
+	return NULL;
+}
+
+static void *
+requests_thread(void *unused)
+{
+	requests(NULL);
+	pthread_barrier_wait(&Barrier);
+	return NULL;
+}
+
+static int
+count(const char *buf, const char *s)
+{
+	int n = 0;
+
+	while ((buf = strstr(buf, s)) != NULL)
+	{
+		n++;
+		buf += strlen(s);
+	}
+	return n;
+}
+
+static char *
+dump(void)
+{
+	char *buf = NULL;
+	size_t bufsize = 0;
+	FILE *fp = open_memstream(&buf, &bufsize);
+
+	ep_trace_dump(fp);
+	fclose(fp);
+	if (ep_dbg_test(Dbg, 1))
+		fputs(buf, stdout);
+	return buf;
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-n nreqs] [-t nthreads]\n"
+			"    -D  set debugging flags\n"
+			"    -n  traced requests per thread (default 100, at least 4)\n"
+			"    -t  number of threads (default 4)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	EP_THR *thrs;
+	int nthreads = 4;
+	int i;
+	int opt;
+	int n;
+	bool show_usage = false;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "D:n:t:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			NReqs = atoi(optarg);
+			break;
+
+		  case 't':
+			nthreads = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || NReqs < 4 || nthreads < 1)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+
+	// with tracing off, nothing happens
+	requests(NULL);
+	if (ep_trace_sample(1) || ep_trace_id() != 0)
+	{
+		ep_app_error("trace started while tracing is off");
+		NErrors++;
+	}
+	buf = dump();
+	if (count(buf, "\"ph\":\"X\"") != 0)
+	{
+		ep_app_error("spans recorded while tracing is off");
+		NErrors++;
+	}
+	free(buf);
+
+	// each request makes four events; keep them all
+	ep_trace_init(NReqs * 4);
+	pthread_barrier_init(&Barrier, NULL, nthreads);
+	thrs = (EP_THR *) ep_mem_zalloc(nthreads * sizeof *thrs);
+	for (i = 0; i < nthreads; i++)
+		ep_thr_spawn(&thrs[i], &requests_thread, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(thrs[i], NULL);
+	ep_mem_free(thrs);
+
+	buf = dump();
+	n = count(buf, "\"name\":\"request\"");
+	if (n != nthreads * NReqs)
+	{
+		ep_app_error("%d request spans, expected %d", n, nthreads * NReqs);
+		NErrors++;
+	}
+	n = count(buf, "\"ph\":\"X\"");
+	if (n != nthreads * NReqs * 3)
+	{
+		ep_app_error("%d spans, expected %d", n, nthreads * NReqs * 3);
+		NErrors++;
+	}
+	n = count(buf, "\"ph\":\"i\"");
+	if (n != nthreads * NReqs)
+	{
+		ep_app_error("%d instants, expected %d", n, nthreads * NReqs);
+		NErrors++;
+	}
+	// requests are roots; everything else has a parent
+	n = count(buf, "\"parent\":\"0000000000000000\"");
+	if (n != nthreads * NReqs)
+	{
+		ep_app_error("%d root spans, expected %d", n, nthreads * NReqs);
+		NErrors++;
+	}
+	free(buf);
+
+	// wrapping a ring keeps only the newest events (this thread
+	// probably reuses the ring of one of the exited threads)
+	{
+		EP_TRACE_SPAN sp;
+
+		ep_trace_set(1, 0);
+		for (i = 0; i < NReqs * 8; i++)
+		{
+			ep_trace_begin(&sp, "test", "wrap");
+			ep_trace_end(&sp);
+		}
+		ep_trace_set(0, 0);
+		buf = dump();
+		n = count(buf, "\"name\":\"wrap\"");
+		if (n != NReqs * 4)
+		{
+			ep_app_error("%d events after wrap, expected %d", n, NReqs * 4);
+			NErrors++;
+		}
+		free(buf);
+	}
+
+	// sampling one in one always starts a trace
+	if (!ep_trace_sample(1) || ep_trace_id() == 0 || ep_trace_sample(1))
+	{
+		ep_app_error("sampling did not start exactly one trace");
+		NErrors++;
+	}
+	ep_trace_set(0, 0);
+
+	printf("%d threads x %d requests, %d errors\n",
+			nthreads, NReqs, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
@@ -0,0 +1,326 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise the command latency histograms (gdp/gdp_latency.c,
+**  which is included here so that the clock can be stopped and the
+**  buckets looked at directly).  Checks that every value lands in
+**  the one bucket whose range covers it and that the buckets are no
+**  wider than the stated precision, then records known values, from
+**  one thread and from several at once, and checks the bucket
+**  counts, count, sum, max and percentiles that come out.
+*/
+
+#include "t_common_support.h"
+
+#include <ep/ep_thr.h>
+
+#include <getopt.h>
+#include <sysexits.h>
+#include <time.h>
+
+// a clock that stands still, so a start time gives an exact value
+static uint64_t		NowUsec = UINT64_C(1) << 45;
+
+static int
+fake_clock_gettime(clockid_t clk, struct timespec *ts)
+{
+	ts->tv_sec = NowUsec / 1000000;
+	ts->tv_nsec = (NowUsec % 1000000) * 1000;
+	return 0;
+}
+
+#define clock_gettime(clk, ts)	fake_clock_gettime(clk, ts)
+#include "gdp_latency.c"
+#undef clock_gettime
+
+#define TCMD		GDP_CMD_APPEND
+#define TSTAGE		GDP_LAT_STORAGE
+
+static int			NErrors;
+
+// record a value of exactly v usec
+static void
+record(int cmd, int stage, uint64_t v)
+{
+	_gdp_lat_record(cmd, stage, _gdp_lat_now() - v);
+}
+
+static struct lat_hist *
+hist(int cmd, int stage)
+{
+	struct lat_cmd *lc = LatCmds[cmd & 0xff];
+
+	return lc == NULL ? NULL : &lc->stages[stage];
+}
+
+// bucket i covers top(i - 1) + 1 through top(i); check one value
+static void
+check_value(uint64_t v)
+{
+	int i = lat_index(v);
+	uint64_t top = lat_bucket_top(i);
+	uint64_t bottom = i == 0 ? 0 : lat_bucket_top(i - 1) + 1;
+
+	if (i < 0 || i >= LAT_NBUCKETS)
+	{
+		ep_app_error("%" PRIu64 ": index %d out of range", v, i);
+		NErrors++;
+	}
+	else if (i == LAT_NBUCKETS - 1 && v > top)
+	{
+		// overflow bucket
+	}
+	else if (v < bottom || v > top)
+	{
+		ep_app_error("%" PRIu64 ": in bucket %d [%" PRIu64 ", %" PRIu64 "]",
+				v, i, bottom, top);
+		NErrors++;
+	}
+	else if (bottom >= LAT_SUBBUCKETS &&
+			(top - bottom + 1) * LAT_SUBBUCKETS > bottom)
+	{
+		ep_app_error("bucket %d [%" PRIu64 ", %" PRIu64 "] is too wide",
+				i, bottom, top);
+		NErrors++;
+	}
+}
+
+static void
+check_buckets(void)
+{
+	uint64_t v;
+	int i;
+
+	for (v = 0; v < (1 << 20); v++)
+		check_value(v);
+	for (i = 20; i < 64; i++)
+	{
+		v = UINT64_C(1) << i;
+		check_value(v - 1);
+		check_value(v);
+		check_value(v + 1);
+		check_value(v + (v >> 1) + 7);
+	}
+	for (i = 1; i < LAT_NBUCKETS; i++)
+	{
+		if (lat_bucket_top(i) <= lat_bucket_top(i - 1) ||
+				lat_index(lat_bucket_top(i)) != i)
+		{
+			ep_app_error("bucket %d: top %" PRIu64 " doesn't follow %" PRIu64,
+					i, lat_bucket_top(i), lat_bucket_top(i - 1));
+			NErrors++;
+		}
+	}
+}
+
+// a percentile of 1..n is the top of the bucket it falls in
+static void
+check_pct(const char *name, uint64_t got, uint64_t n, double frac)
+{
+	uint64_t v = (uint64_t) (n * frac);
+
+	if (got < v || got > lat_bucket_top(lat_index(v)))
+	{
+		ep_app_error("%s = %" PRIu64 " for 1..%" PRIu64, name, got, n);
+		NErrors++;
+	}
+}
+
+// 1..n usec once each: the counts follow from the bucket bounds
+static void
+check_counts(uint64_t n)
+{
+	struct gdp_lat_summary ls;
+	struct lat_hist *h;
+	uint64_t v;
+	uint64_t total = 0;
+	int i;
+
+	for (v = 1; v <= n; v++)
+		record(TCMD, TSTAGE, v);
+	h = hist(TCMD, TSTAGE);
+	if (h == NULL)
+	{
+		ep_app_error("nothing recorded");
+		NErrors++;
+		return;
+	}
+	for (i = 0; i < LAT_NBUCKETS; i++)
+	{
+		uint64_t bottom = i == 0 ? 0 : lat_bucket_top(i - 1) + 1;
+		uint64_t top = lat_bucket_top(i);
+		uint64_t expect = 0;
+
+		if (bottom < 1)
+			bottom = 1;
+		if (top > n)
+			top = n;
+		if (top >= bottom)
+			expect = top - bottom + 1;
+		if (h->buckets[i] != expect)
+		{
+			ep_app_error("bucket %d: %" PRIu64 " values, expected %" PRIu64,
+					i, h->buckets[i], expect);
+			NErrors++;
+		}
+		total += h->buckets[i];
+	}
+
+	if (!_gdp_lat_summary(TCMD, TSTAGE, &ls) || total != n ||
+			ls.count != n || ls.sum != n * (n + 1) / 2 || ls.max != n)
+	{
+		ep_app_error("count %" PRIu64 " sum %" PRIu64 " max %" PRIu64,
+				ls.count, ls.sum, ls.max);
+		NErrors++;
+	}
+
+	check_pct("p50", ls.p50, n, 0.50);
+	check_pct("p90", ls.p90, n, 0.90);
+	check_pct("p99", ls.p99, n, 0.99);
+	if (ls.p999 > n)
+	{
+		ep_app_error("p99.9 = %" PRIu64 " > max", ls.p999);
+		NErrors++;
+	}
+
+	// nothing leaked into other stages or commands
+	if (_gdp_lat_summary(TCMD, GDP_LAT_QUEUE, &ls) ||
+			_gdp_lat_summary(GDP_CMD_READ_BY_RECNO, TSTAGE, &ls))
+	{
+		ep_app_error("values recorded in the wrong place");
+		NErrors++;
+	}
+}
+
+// several threads recording at once, into a fresh command
+#define NTHRVALS	100000
+
+static void *
+record_thread(void *seed_)
+{
+	long seed = (long) seed_;
+	long i;
+
+	for (i = 0; i < NTHRVALS; i++)
+		record(GDP_CMD_MULTIREAD, GDP_LAT_TOTAL, (i * seed) % 5000);
+	return NULL;
+}
+
+static void
+check_threads(int nthreads)
+{
+	EP_THR *thrs = (EP_THR *) ep_mem_malloc(nthreads * sizeof *thrs);
+	struct gdp_lat_summary ls;
+	uint64_t sum = 0;
+	uint64_t max = 0;
+	long t;
+	long i;
+
+	for (t = 0; t < nthreads; t++)
+	{
+		for (i = 0; i < NTHRVALS; i++)
+		{
+			uint64_t v = (i * (t + 1)) % 5000;
+
+			sum += v;
+			if (v > max)
+				max = v;
+		}
+		ep_thr_spawn(&thrs[t], &record_thread, (void *) (t + 1));
+	}
+	for (t = 0; t < nthreads; t++)
+		pthread_join(thrs[t], NULL);
+	ep_mem_free(thrs);
+
+	if (!_gdp_lat_summary(GDP_CMD_MULTIREAD, GDP_LAT_TOTAL, &ls) ||
+			ls.count != (uint64_t) nthreads * NTHRVALS ||
+			ls.sum != sum || ls.max != max)
+	{
+		ep_app_error("%d threads: count %" PRIu64 " sum %" PRIu64
+				" (expected %" PRIu64 ") max %" PRIu64,
+				nthreads, ls.count, ls.sum, sum, ls.max);
+		NErrors++;
+	}
+}
+
+// with recording off nothing is counted
+static void
+check_disabled(void)
+{
+	struct gdp_lat_summary ls;
+	uint64_t before;
+
+	_gdp_lat_summary(TCMD, TSTAGE, &ls);
+	before = ls.count;
+	_GdpLatEnabled = false;
+	record(TCMD, TSTAGE, 10);
+	_GdpLatEnabled = true;
+	_gdp_lat_summary(TCMD, TSTAGE, &ls);
+	if (ls.count != before)
+	{
+		ep_app_error("recorded while disabled");
+		NErrors++;
+	}
+}
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-n nvalues] [-t nthreads]\n"
+			"    -D  set debugging flags\n"
+			"    -n  values recorded in order (default 100000)\n"
+			"    -t  threads recording at once (default 4)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t nvalues = 100000;
+	int nthreads = 4;
+	int opt;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "D:n:t:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			nvalues = strtoull(optarg, NULL, 0);
+			break;
+
+		  case 't':
+			nthreads = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || nvalues < 1000 || nthreads < 1)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+	_GdpLatEnabled = true;
+
+	check_buckets();
+	check_counts(nvalues);
+	check_threads(nthreads);
+	check_disabled();
+	if (ep_dbg_test(Dbg, 1))
+		_gdp_lat_dump(stdout);
+
+	printf("%" PRIu64 " values, %d threads, %d errors\n",
+			nvalues, nthreads, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
@@ -0,0 +1,241 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise gdplogd admission control (gdplogd/logd_admit.c, which
+**  is compiled into this test).  Each round a new set of clients is
+**  throttled, reported, left idle, and swept; reports must come out
+**  once per throttled client, sweeping then reporting again must
+**  work, a swept client must start with a full bucket, and memory
+**  for swept buckets must really be given back, so the live bytes
+**  after the last round are no more than after the first.
+*/
+
+#include "t_common_support.h"
+
+#include "logd.h"
+#include "logd_admin.h"
+
+#include <ep/ep_mem.h>
+#include <ep/ep_thr.h>
+
+#include <getopt.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_logd_admit", "Admission control test");
+
+static int		NReports;			// admit-throttle events posted
+
+// stand-in for the real admin event log
+void
+admin_post_stats(uint32_t mask, const char *msgid, ...)
+{
+	if (strcmp(msgid, "admit-throttle") == 0)
+		NReports++;
+}
+
+
+static void
+random_name(gdp_name_t name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof (gdp_name_t); i++)
+		name[i] = random() & 0xff;
+}
+
+static EP_STAT
+admit(gdp_name_t client)
+{
+	gdp_pdu_t pdu;
+	uint32_t retry_ms;
+
+	memset(&pdu, 0, sizeof pdu);
+	memcpy(pdu.src, client, sizeof pdu.src);
+	memcpy(pdu.dst, _GdpMyRoutingName, sizeof pdu.dst);
+	return (*_GdpAdmitFunc)(&pdu, 100, &retry_ms);
+}
+
+static int64_t
+live_bytes(int tag)
+{
+	EP_MEM_TAG_STATS st;
+
+	if (!ep_mem_tag_stats(tag, &st))
+		return -1;
+	return st.live_bytes;
+}
+
+
+/*
+**  Each round runs in its own thread so that its memory counts
+**  have been merged into the tag totals by the time it is joined.
+*/
+
+struct round
+{
+	int				round;
+	int				tag;
+	long			nclients;
+	int				nerrors;
+};
+
+static void *
+run_round(void *r_)
+{
+	struct round *r = (struct round *) r_;
+	gdp_name_t *clients;
+	long i;
+
+	ep_mem_tag_set(r->tag);
+	clients = (gdp_name_t *) ep_mem_malloc(r->nclients * sizeof *clients);
+	for (i = 0; i < r->nclients; i++)
+	{
+		random_name(clients[i]);
+		if (!EP_STAT_ISOK(admit(clients[i])))
+		{
+			ep_app_error("round %d: first command refused", r->round);
+			r->nerrors++;
+		}
+		if (EP_STAT_ISOK(admit(clients[i])))
+		{
+			ep_app_error("round %d: second command admitted", r->round);
+			r->nerrors++;
+		}
+	}
+
+	// throttled buckets are reported, not freed
+	NReports = 0;
+	logd_admit_report();
+	if (NReports != r->nclients)
+	{
+		ep_app_error("round %d: %d reports, expected %ld",
+				r->round, NReports, r->nclients);
+		r->nerrors++;
+	}
+
+	// now everything is idle: sweep, then report over what's left
+	ep_time_nanosleep(150 MILLISECONDS);
+	NReports = 0;
+	logd_admit_report();
+	logd_admit_report();
+	if (NReports != 0)
+	{
+		ep_app_error("round %d: %d reports after sweep, expected 0",
+				r->round, NReports);
+		r->nerrors++;
+	}
+
+	// a swept client comes back with a full bucket
+	if (!EP_STAT_ISOK(admit(clients[0])))
+	{
+		ep_app_error("round %d: swept client refused", r->round);
+		r->nerrors++;
+	}
+	ep_time_nanosleep(150 MILLISECONDS);
+	logd_admit_report();
+
+	ep_mem_free(clients);
+	return NULL;
+}
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-c nclients] [-r nrounds]\n"
+			"    -c  clients throttled each round (default 1000)\n"
+			"    -D  set debugging flags\n"
+			"    -r  number of rounds (default 5)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	long nclients = 1000;
+	int nrounds = 5;
+	int round;
+	int opt;
+	int tag;
+	int nerrors = 0;
+	int64_t live1 = 0;
+	int64_t live = 0;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "c:D:r:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'c':
+			nclients = atol(optarg);
+			break;
+
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'r':
+			nrounds = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || nclients < 1 || nrounds < 2)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+	ep_adm_setparam("libep.mem.account", "true");
+	ep_mem_account_init();
+	tag = ep_mem_tag_register("admit");
+
+	// one command per burst, idle as soon as the burst has passed
+	ep_adm_setparam("swarm.gdplogd.admit.enable", "true");
+	ep_adm_setparam("swarm.gdplogd.admit.client.reqrate", "10");
+	ep_adm_setparam("swarm.gdplogd.admit.burst", "100");
+	ep_adm_setparam("swarm.gdplogd.admit.idle", "0");
+	logd_admit_reload();
+	if (_GdpAdmitFunc == NULL)
+	{
+		ep_app_error("admission control not enabled");
+		exit(EX_SOFTWARE);
+	}
+
+	for (round = 1; round <= nrounds; round++)
+	{
+		struct round r;
+		EP_THR thr;
+
+		memset(&r, 0, sizeof r);
+		r.round = round;
+		r.tag = tag;
+		r.nclients = nclients;
+		ep_thr_spawn(&thr, &run_round, &r);
+		pthread_join(thr, NULL);
+		nerrors += r.nerrors;
+
+		live = live_bytes(tag);
+		ep_dbg_cprintf(Dbg, 1, "round %d: %" PRId64 " bytes live\n",
+				round, live);
+		if (round == 1)
+			live1 = live;
+	}
+
+	if (live > live1)
+	{
+		ep_app_error("%" PRId64 " bytes live after %d rounds, "
+				"%" PRId64 " after one",
+				live, nrounds, live1);
+		nerrors++;
+	}
+
+	printf("%d rounds x %ld clients, %d errors\n",
+			nrounds, nclients, nerrors);
+	return nerrors == 0 ? EX_OK : EX_SOFTWARE;
+}
@@ -0,0 +1,461 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise gdplogd subscription fan-out (gdplogd/logd_pubsub.c,
+**  which is included here so that packing can be counted).  A log
+**  with -s subscribers gets -n appends of small and large records.
+**  Each append must be packed exactly once however many subscribers
+**  there are, every subscriber must get a reference to that one
+**  packed copy, and the packed size must follow the record size,
+**  not the number of subscribers.
+**
+**  Then one subscriber stops reading while the rest keep up, under
+**  each slow-consumer policy.  The others must still get every
+**  record, with no gaps, while the slow one's queue stays bounded
+**  and it loses records as the policy says.
+**
+**  Nothing is sent: there is no channel, and the I/O thread that
+**  would drain the queues is never started.  Reading is done by
+**  taking entries off the queues directly.
+*/
+
+#include "t_common_support.h"
+
+#include "logd.h"
+#include "logd_admin.h"
+
+#include <gdp/gdp_priv.h>
+#include <gdp/gdp_chan.h>
+#include <ep/ep_mem.h>
+
+#include <getopt.h>
+#include <sysexits.h>
+
+static long		NPacks;				// messages packed for sharing
+static size_t	NPackBytes;			// total size of those
+
+static gdp_pdu_shared_t *
+counting_share(GdpMessage *msg)
+{
+	gdp_pdu_shared_t *sh = _gdp_pdu_share(msg);
+
+	NPacks++;
+	NPackBytes += _gdp_pdu_share_len(sh);
+	return sh;
+}
+
+#define _gdp_pdu_share(msg)		counting_share(msg)
+#include "logd_pubsub.c"
+#undef _gdp_pdu_share
+
+// stand-ins for the rest of gdplogd
+void
+admin_post_stats(uint32_t mask, const char *msgid, ...)
+{
+}
+
+EP_STAT
+get_open_gob(gdp_name_t gob_name, gdp_gob_t **pgob)
+{
+	return GDP_STAT_NOTFOUND;
+}
+
+
+static int		NErrors;
+
+static void
+fail(const char *what)
+{
+	ep_app_error("%s", what);
+	NErrors++;
+}
+
+static void
+random_name(gdp_name_t name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof (gdp_name_t); i++)
+		name[i] = random() & 0xff;
+}
+
+// a live subscription from a new client (GOB must be locked)
+static gdp_req_t *
+add_subscriber(gdp_gob_t *gob, gdp_rid_t rid)
+{
+	gdp_name_t client;
+	gdp_msg_t *msg;
+	gdp_pdu_t *pdu;
+	gdp_req_t *req;
+	EP_STAT estat;
+
+	random_name(client);
+	msg = _gdp_msg_new(GDP_CMD_SUBSCRIBE_BY_RECNO, rid, 1);
+	pdu = _gdp_pdu_new(msg, client, gob->name, GDP_SEQNO_NONE);
+	estat = _gdp_req_new(GDP_CMD_SUBSCRIBE_BY_RECNO, gob, NULL, pdu,
+						GDP_REQ_PERSIST, &req);
+	test_message(estat, "_gdp_req_new");
+	req->flags |= GDP_REQ_SRV_SUBSCR;
+	req->nextrec = gob->nrecs + 1;
+	ep_time_now(&req->act_ts);
+	_gdp_req_gob_link(req);
+	_gdp_req_unlock(req);
+	return req;
+}
+
+// the notification an append leaves in its response PDU
+static gdp_req_t *
+new_publisher(gdp_gob_t *gob, size_t reclen)
+{
+	gdp_msg_t *msg;
+	GdpDatumList *dl;
+	GdpDatum *pbd;
+	gdp_req_t *req;
+	EP_STAT estat;
+
+	estat = _gdp_req_new(GDP_CMD_APPEND, gob, NULL, NULL, 0, &req);
+	test_message(estat, "_gdp_req_new");
+	msg = _gdp_msg_new(GDP_ACK_CONTENT, 0, 0);
+	dl = msg->ack_content->dl;
+	dl->d = (GdpDatum **) ep_mem_malloc(sizeof *dl->d);
+	dl->n_d = 1;
+	pbd = dl->d[0] = (GdpDatum *) ep_mem_malloc(sizeof *pbd);
+	gdp_datum__init(pbd);
+	pbd->data.len = reclen;
+	pbd->data.data = (uint8_t *) ep_mem_malloc(reclen);
+	memset(pbd->data.data, 'x', reclen);
+	req->rpdu = _gdp_pdu_new(msg, gob->name, req->cpdu->src, GDP_SEQNO_NONE);
+	return req;
+}
+
+static void
+append(gdp_req_t *pubreq)
+{
+	gdp_gob_t *gob = pubreq->gob;
+
+	gob->nrecs++;
+	pubreq->rpdu->msg->ack_content->dl->d[0]->recno = gob->nrecs;
+	sub_notify_all_subscribers(pubreq);
+	gob->flags &= ~GOBF_KEEPLOCKED;
+}
+
+static gdp_gob_t *
+new_gob(void)
+{
+	gdp_name_t name;
+	gdp_gob_t *gob;
+	EP_STAT estat;
+
+	random_name(name);
+	estat = _gdp_gob_new(name, &gob);
+	test_message(estat, "_gdp_gob_new");
+	_gdp_gob_lock(gob);
+	gob->x = (struct gdp_gob_xtra *) ep_mem_zalloc(sizeof *gob->x);
+	gob->x->gob = gob;
+	LIST_INIT(&gob->x->groupsubs);
+	return gob;
+}
+
+// what the I/O thread does with a queue, without sending anything
+static long
+take(struct sub_outq *q, gdp_recno_t *gap_first, gdp_recno_t *gap_count)
+{
+	long n = 0;
+
+	ep_thr_mutex_lock(&q->mutex);
+	while (q->count > 0)
+	{
+		struct sub_qent *e = &q->ents[q->head];
+
+		if (e->recno != 0)
+		{
+			q->ndata--;
+			q->last_taken = q->last_sent = e->recno;
+			n++;
+		}
+		if (e->gap_count > 0 && gap_first != NULL)
+		{
+			*gap_first = e->gap_first;
+			*gap_count = e->gap_count;
+		}
+		_gdp_pdu_share_free(&e->sh);
+		q->head = (q->head + 1) % q->nslots;
+		q->count--;
+	}
+	ep_thr_mutex_unlock(&q->mutex);
+	return n;
+}
+
+/*
+**  Run nappends appends of reclen-byte records to a log with
+**  nsubs subscribers, then check the queues.
+*/
+
+static void
+fanout(long nsubs, long nappends, size_t reclen)
+{
+	gdp_gob_t *gob = new_gob();
+	gdp_req_t **subs;
+	gdp_req_t *pubreq;
+	struct sub_outq *q0;
+	long i;
+	long j;
+
+	subs = (gdp_req_t **) ep_mem_zalloc(nsubs * sizeof *subs);
+	for (i = 0; i < nsubs; i++)
+		subs[i] = add_subscriber(gob, i + 1);
+
+	pubreq = new_publisher(gob, reclen);
+	NPacks = 0;
+	NPackBytes = 0;
+	for (j = 0; j < nappends; j++)
+		append(pubreq);
+
+	if (NPacks != nappends)
+	{
+		ep_app_error("%ld subscribers, %ld appends: packed %ld times",
+				nsubs, nappends, NPacks);
+		NErrors++;
+	}
+	if (NPackBytes < nappends * reclen ||
+			NPackBytes > nappends * (reclen + 100))
+	{
+		ep_app_error("%ld subscribers, %zd byte records: packed %zd bytes",
+				nsubs, reclen, NPackBytes / nappends);
+		NErrors++;
+	}
+
+	// every subscriber holds the same packed copy of each append
+	q0 = subs[0]->outq;
+	for (i = 0; i < nsubs; i++)
+	{
+		struct sub_outq *q = subs[i]->outq;
+
+		if (q == NULL || q0 == NULL || q->count != nappends)
+		{
+			fail("subscriber didn't get every append");
+			continue;
+		}
+		for (j = 0; j < nappends; j++)
+		{
+			struct sub_qent *e = &q->ents[(q->head + j) % q->nslots];
+
+			if (e->sh != q0->ents[(q0->head + j) % q0->nslots].sh ||
+					e->recno != j + 1)
+				fail("subscriber queued its own copy of an append");
+		}
+	}
+
+	for (i = 0; i < nsubs; i++)
+	{
+		_gdp_req_lock(subs[i]);
+		_gdp_req_free(&subs[i]);
+	}
+	_gdp_req_free(&pubreq);
+	ep_mem_free(subs);
+	_gdp_gob_free(&gob);
+}
+
+/*
+**  Subscriber 0 stops reading; the other nsubs - 1 take everything
+**  after each append.  Queues hold qmax records.
+*/
+
+static void
+slow_subscriber(int policy, long nsubs, long qmax)
+{
+	static const char *names[] = { "drop", "coalesce", "evict" };
+	const char *pname = names[policy];
+	gdp_gob_t *gob = new_gob();
+	gdp_req_t **subs;
+	gdp_req_t *pubreq;
+	gdp_req_t *req;
+	struct sub_outq *slowq;
+	long nappends = 3 * qmax;
+	long ntaken;
+	long i;
+	long j;
+	gdp_recno_t gap_first;
+	gdp_recno_t gap_count;
+
+	SubqPolicy = policy;
+	subs = (gdp_req_t **) ep_mem_zalloc(nsubs * sizeof *subs);
+	for (i = 0; i < nsubs; i++)
+		subs[i] = add_subscriber(gob, i + 1);
+	pubreq = new_publisher(gob, 1000);
+
+	// the first append makes the queues; keep the slow one around
+	append(pubreq);
+	slowq = subs[0]->outq;
+	EP_ASSERT_ELSE(slowq != NULL, return);
+	ep_thr_mutex_lock(&slowq->mutex);
+	slowq->refcnt++;
+	ep_thr_mutex_unlock(&slowq->mutex);
+
+	for (j = 1; j <= nappends; j++)
+	{
+		for (i = 1; i < nsubs; i++)
+		{
+			gap_count = 0;
+			ntaken = take(subs[i]->outq, &gap_first, &gap_count);
+			if (ntaken != 1 || gap_count != 0)
+			{
+				ep_app_error("%s: fast subscriber took %ld records "
+						"(gap %" PRIgdp_recno ") at %ld",
+						pname, ntaken, gap_count, j);
+				NErrors++;
+			}
+		}
+		if (j < nappends)
+			append(pubreq);
+	}
+
+	ep_thr_mutex_lock(&slowq->mutex);
+	if (slowq->ndata > qmax)
+	{
+		ep_app_error("%s: slow queue holds %d records, limit %ld",
+				pname, slowq->ndata, qmax);
+		NErrors++;
+	}
+	ep_thr_mutex_unlock(&slowq->mutex);
+
+	// see what the slow subscriber gets when it finally reads
+	LIST_FOREACH(req, &gob->reqs, goblist)
+	{
+		if (req == subs[0])
+			break;
+	}
+	gap_count = 0;
+	switch (policy)
+	{
+	  case SUBQ_POLICY_DROP:
+		// the oldest records, then a gap up to the next one
+		ntaken = take(slowq, &gap_first, &gap_count);
+		append(pubreq);
+		take(slowq, &gap_first, &gap_count);
+		if (ntaken != qmax || gap_first != qmax + 1 ||
+				gap_count != nappends - qmax)
+		{
+			ep_app_error("drop: took %ld, then gap of %" PRIgdp_recno
+					" from %" PRIgdp_recno, ntaken, gap_count, gap_first);
+			NErrors++;
+		}
+		break;
+
+	  case SUBQ_POLICY_COALESCE:
+		// the newest record, after a gap covering the rest
+		ntaken = take(slowq, &gap_first, &gap_count);
+		if (ntaken < 1 || slowq->last_taken != (gdp_recno_t) nappends ||
+				gap_first < 1 ||
+				gap_first + gap_count + ntaken != (gdp_recno_t) nappends + 1)
+		{
+			ep_app_error("coalesce: took %ld up to %" PRIgdp_recno
+					", gap of %" PRIgdp_recno " from %" PRIgdp_recno,
+					ntaken, slowq->last_taken, gap_count, gap_first);
+			NErrors++;
+		}
+		break;
+
+	  case SUBQ_POLICY_EVICT:
+		// just the lost-subscription notice, and the req is gone
+		ntaken = take(slowq, NULL, NULL);
+		if (req != NULL || ntaken != 0 || slowq->last_taken != 0)
+		{
+			ep_app_error("evict: still subscribed %d, took %ld records",
+					req != NULL, ntaken);
+			NErrors++;
+		}
+		subs[0] = NULL;
+		break;
+	}
+	if (policy != SUBQ_POLICY_EVICT && req == NULL)
+	{
+		ep_app_error("%s: slow subscriber was dropped", pname);
+		NErrors++;
+	}
+
+	for (i = 0; i < nsubs; i++)
+	{
+		if (subs[i] == NULL)
+			continue;
+		_gdp_req_lock(subs[i]);
+		_gdp_req_free(&subs[i]);
+	}
+	outq_decref(slowq);
+	_gdp_req_free(&pubreq);
+	ep_mem_free(subs);
+	_gdp_gob_free(&gob);
+}
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-n nappends] [-s nsubs]\n"
+			"    -D  set debugging flags\n"
+			"    -n  appends per run (default 20)\n"
+			"    -s  most subscribers (default 200)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	long nappends = 20;
+	long maxsubs = 200;
+	long nsubs;
+	int opt;
+	bool show_usage = false;
+	EP_STAT estat;
+	char qmax[40];
+
+	while ((opt = getopt(argc, argv, "D:n:s:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			nappends = atol(optarg);
+			break;
+
+		  case 's':
+			maxsubs = atol(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || nappends < 1 || maxsubs < 1)
+		usage();
+
+	// room for every append, so nothing is dropped
+	snprintf(qmax, sizeof qmax, "%ld", nappends);
+	ep_adm_setparam("swarm.gdplogd.subscr.queue.max", qmax);
+	estat = gdp_lib_init(NULL, NULL, GDP_INIT_NO_ZEROCONF | GDP_INIT_NO_HONGDS);
+	test_message(estat, "gdp_lib_init");
+	sub_init();
+
+	for (nsubs = 1; nsubs <= maxsubs; nsubs *= 10)
+	{
+		fanout(nsubs, nappends, 100);
+		fanout(nsubs, nappends, 64 * 1024);
+	}
+	fanout(maxsubs, nappends, 64 * 1024);
+
+	slow_subscriber(SUBQ_POLICY_DROP, 10, nappends);
+	slow_subscriber(SUBQ_POLICY_COALESCE, 10, nappends);
+	slow_subscriber(SUBQ_POLICY_EVICT, 10, nappends);
+
+	printf("up to %ld subscribers x %ld appends, %d errors\n",
+			maxsubs, nappends, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
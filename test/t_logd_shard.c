@@ -0,0 +1,387 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise gdplogd log shards (gdplogd/logd_shard.c, which is
+**  included into this test so that it can make one shard look full).
+**  Logs are created on the full shard and noted in the catalog the
+**  way foreach does it, then the rebalancer runs while another thread
+**  keeps pinning logs.  A pinned log must always be on the shard it
+**  was pinned on, logs pinned for the whole run must not move, warm
+**  logs must not move, and everything else must end up on the empty
+**  shard, copied by the full shard's own workers.  Finally the
+**  catalog is reloaded from the disks, as after a restart, and must
+**  agree with where the files are.
+*/
+
+#include "t_common_support.h"
+
+#include <ep/ep_thr.h>
+
+#include <getopt.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
+#include <sysexits.h>
+
+// the shard whose root matches FullRoot says its disk is nearly full
+static const char	*FullRoot;
+static int fake_statvfs(const char *path, struct statvfs *sv);
+#define statvfs(path, sv)	fake_statvfs(path, sv)
+
+#include "logd_shard.c"
+
+#undef statvfs
+
+static int
+fake_statvfs(const char *path, struct statvfs *sv)
+{
+	memset(sv, 0, sizeof *sv);
+	sv->f_frsize = 4096;
+	sv->f_blocks = 1000;
+	sv->f_bavail = strcmp(path, FullRoot) == 0 ? 100 : 900;
+	return 0;
+}
+
+
+#define SUFFIX		".glog"
+#define NOTHER		"-index.db"			// second file for each log
+
+static char			Base[SHARD_PATH_MAX];
+static int			NErrors;
+
+static void
+random_name(gdp_name_t name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof (gdp_name_t); i++)
+		name[i] = random() & 0xff;
+}
+
+static void
+log_path(int shard, const gdp_name_t name, const char *sfx,
+		char *buf, size_t bufsize)
+{
+	gdp_pname_t pname;
+
+	snprintf(buf, bufsize, "%s/_%02x/%s%s", Shards[shard].root, name[0],
+			gdp_printable_name(name, pname), sfx);
+}
+
+static bool
+log_exists(int shard, const gdp_name_t name)
+{
+	char path[SHARD_PATH_MAX + 20];
+	struct stat st;
+
+	log_path(shard, name, SUFFIX, path, sizeof path);
+	if (stat(path, &st) < 0)
+		return false;
+	log_path(shard, name, NOTHER, path, sizeof path);
+	return stat(path, &st) == 0;
+}
+
+// create both files for a log, modified idle seconds ago
+static void
+make_log(int shard, const gdp_name_t name, time_t idle)
+{
+	const char *sfxs[] = { SUFFIX, NOTHER };
+	char path[SHARD_PATH_MAX + 20];
+	struct timeval tv[2];
+	unsigned i;
+
+	snprintf(path, sizeof path, "%s/_%02x", Shards[shard].root, name[0]);
+	if (mkdir(path, 0775) < 0 && errno != EEXIST)
+	{
+		ep_app_fatal("cannot create %s: %s", path, strerror(errno));
+	}
+	tv[0].tv_sec = tv[1].tv_sec = time(NULL) - idle;
+	tv[0].tv_usec = tv[1].tv_usec = 0;
+	for (i = 0; i < sizeof sfxs / sizeof sfxs[0]; i++)
+	{
+		FILE *fp;
+
+		log_path(shard, name, sfxs[i], path, sizeof path);
+		if ((fp = fopen(path, "w")) == NULL)
+			ep_app_fatal("cannot create %s: %s", path, strerror(errno));
+		fprintf(fp, "%s\n", path);
+		fclose(fp);
+		utimes(path, tv);
+	}
+}
+
+// note every log found on a shard, as foreach does
+static void
+scan_disk(int shard)
+{
+	char path[SHARD_PATH_MAX + 10];
+	DIR *top;
+	struct dirent *sub;
+
+	if ((top = opendir(Shards[shard].root)) == NULL)
+		return;
+	while ((sub = readdir(top)) != NULL)
+	{
+		DIR *dir;
+		struct dirent *dent;
+
+		if (sub->d_name[0] != '_')
+			continue;
+		snprintf(path, sizeof path, "%s/%s", Shards[shard].root, sub->d_name);
+		if ((dir = opendir(path)) == NULL)
+			continue;
+		while ((dent = readdir(dir)) != NULL)
+		{
+			gdp_pname_t pname;
+			gdp_name_t name;
+
+			if (strlen(dent->d_name) != GDP_GOB_PNAME_LEN + strlen(SUFFIX) ||
+					strcmp(dent->d_name + GDP_GOB_PNAME_LEN, SUFFIX) != 0)
+				continue;
+			memcpy(pname, dent->d_name, GDP_GOB_PNAME_LEN);
+			pname[GDP_GOB_PNAME_LEN] = '\0';
+			if (EP_STAT_ISOK(gdp_internal_name(pname, name)))
+				(void) shard_note(name, shard);
+		}
+		closedir(dir);
+	}
+	closedir(top);
+}
+
+static void
+check(bool ok, const char *what, const gdp_name_t name)
+{
+	gdp_pname_t pname;
+
+	if (ok)
+		return;
+	ep_app_error("%s: %s", gdp_printable_name(name, pname), what);
+	NErrors++;
+}
+
+
+/*
+**  Pin every log over and over while the rebalancer runs.
+*/
+
+struct pinner
+{
+	gdp_name_t		*names;
+	int				nlogs;
+	volatile bool	done;
+	long			npins;
+};
+
+static void *
+run_pinner(void *p_)
+{
+	struct pinner *p = (struct pinner *) p_;
+	int i;
+
+	while (!p->done)
+	{
+		for (i = 0; i < p->nlogs; i++)
+		{
+			int shard = shard_pin(p->names[i], false);
+
+			check(log_exists(shard, p->names[i]),
+					"not on the shard it was pinned on", p->names[i]);
+			shard_unpin(p->names[i], false);
+			p->npins++;
+		}
+	}
+	return NULL;
+}
+
+static void
+rm_tree(const char *path)
+{
+	char cmd[SHARD_PATH_MAX + 20];
+
+	snprintf(cmd, sizeof cmd, "rm -rf '%s'", path);
+	if (system(cmd) != 0)
+		ep_app_warn("cannot remove %s", path);
+}
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-n nlogs]\n"
+			"    -D  set debugging flags\n"
+			"    -n  number of cold logs (default 100)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	int nlogs = 100;
+	gdp_name_t *names;
+	gdp_name_t pinned;
+	gdp_name_t warm;
+	gdp_name_t dup;
+	gdp_name_t stray;
+	struct pinner p;
+	struct shard_stats st;
+	EP_THR_POOL_STATS pst;
+	char dirs[2 * SHARD_PATH_MAX + 10];
+	EP_THR thr;
+	EP_STAT estat;
+	long nmoved_out = 0;
+	long nmoved_in = 0;
+	int pass;
+	int opt;
+	int i;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "D:n:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'n':
+			nlogs = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || nlogs < 1)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+	snprintf(Base, sizeof Base, "%s/t_logd_shard.XXXXXX",
+			getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp");
+	if (mkdtemp(Base) == NULL)
+		ep_app_fatal("cannot create %s: %s", Base, strerror(errno));
+	snprintf(dirs, sizeof dirs, "%s/full", Base);
+	mkdir(dirs, 0775);
+	snprintf(dirs, sizeof dirs, "%s/empty", Base);
+	mkdir(dirs, 0775);
+	snprintf(dirs, sizeof dirs, "%s/full, %s/empty", Base, Base);
+	ep_adm_setparam("swarm.gdplogd.log.dirs", dirs);
+	ep_adm_setparam("swarm.gdplogd.shard.workers", "2");
+	ep_adm_setparam("swarm.gdplogd.shard.rebalance.minidle", "600");
+	ep_adm_setparam("swarm.gdplogd.shard.rebalance.max", "100000");
+	estat = shard_init(NULL, "glogs", SUFFIX);
+	if (!EP_STAT_ISOK(estat) || shard_count() != 2)
+		ep_app_fatal("shard_init failed");
+	FullRoot = shard_root(0);
+
+	// cold logs on the full shard, found the way foreach finds them
+	names = (gdp_name_t *) ep_mem_malloc(nlogs * sizeof *names);
+	for (i = 0; i < nlogs; i++)
+	{
+		random_name(names[i]);
+		make_log(0, names[i], 3600);
+	}
+	random_name(pinned);
+	make_log(0, pinned, 3600);
+	random_name(warm);
+	make_log(0, warm, 0);
+	random_name(dup);
+	make_log(0, dup, 3600);
+	make_log(1, dup, 3600);
+	scan_disk(0);
+	check(!shard_note(dup, 1), "second copy accepted", dup);
+	for (i = 0; i < nlogs; i++)
+		check(shard_pool_for(names[i]) == Shards[0].pool,
+				"noted log not on its shard's pool", names[i]);
+
+	// a log nobody has noted is found by probing
+	random_name(stray);
+	make_log(1, stray, 3600);
+	check(shard_pin(stray, false) == 1, "stray log not found", stray);
+	shard_unpin(stray, false);
+
+	// these stay where they are for the whole run
+	check(shard_pin(pinned, false) == 0, "pinned log misplaced", pinned);
+	check(shard_pin(dup, false) == 0, "first copy not used", dup);
+
+	memset(&p, 0, sizeof p);
+	p.names = names;
+	p.nlogs = nlogs;
+	ep_thr_spawn(&thr, &run_pinner, &p);
+
+	// a log that is pinned when it comes up is left for the next pass
+	for (pass = 0; pass < 10; pass++)
+	{
+		shard_rebalance(NULL);
+		shard_getstats(0, &st);
+		nmoved_out += st.nmoved_out;
+		shard_getstats(1, &st);
+		nmoved_in += st.nmoved_in;
+		if (st.nlogs == nlogs + 1)
+			break;
+	}
+	p.done = true;
+	pthread_join(thr, NULL);
+
+	for (i = 0; i < nlogs; i++)
+	{
+		check(log_exists(1, names[i]) && !log_exists(0, names[i]),
+				"cold log not moved", names[i]);
+		check(shard_pool_for(names[i]) == Shards[1].pool,
+				"moved log not on its new shard's pool", names[i]);
+	}
+	// the copying is done by the full shard's workers
+	ep_thr_pool_getstats_in(Shards[0].pool, GDP_LANE_READ, &pst, false);
+	if (pst.nrun < (uint64_t) nlogs)
+	{
+		ep_app_error("%" PRIu64 " moves run on the full shard's pool,"
+				" expected at least %d", pst.nrun, nlogs);
+		NErrors++;
+	}
+	check(log_exists(0, pinned) && !log_exists(1, pinned),
+			"pinned log moved", pinned);
+	check(log_exists(0, warm) && !log_exists(1, warm),
+			"warm log moved", warm);
+	check(log_exists(0, dup), "pinned duplicate moved", dup);
+	shard_unpin(pinned, false);
+	shard_unpin(dup, false);
+
+	shard_getstats(0, &st);
+	if (nmoved_out != nlogs || st.nlogs != 3)
+	{
+		ep_app_error("shard 0: %ld moved out, %ld logs; expected %d, 3",
+				nmoved_out, st.nlogs, nlogs);
+		NErrors++;
+	}
+	shard_getstats(1, &st);
+	if (nmoved_in != nlogs || st.nlogs != nlogs + 1)
+	{
+		ep_app_error("shard 1: %ld moved in, %ld logs; expected %d, %d",
+				nmoved_in, st.nlogs, nlogs, nlogs + 1);
+		NErrors++;
+	}
+
+	// reload the catalog from disk, as after a restart
+	estat = shard_init(NULL, "glogs", SUFFIX);
+	if (!EP_STAT_ISOK(estat))
+		ep_app_fatal("shard_init failed on reload");
+	scan_disk(0);
+	scan_disk(1);
+	for (i = 0; i < nlogs; i++)
+		check(shard_pin(names[i], false) == 1, "reloaded in the wrong place",
+				names[i]);
+	check(shard_pin(pinned, false) == 0, "reloaded in the wrong place",
+			pinned);
+	check(shard_pin(warm, false) == 0, "reloaded in the wrong place", warm);
+	check(shard_pin(dup, false) == 0, "reloaded in the wrong place", dup);
+	check(shard_pool_for(stray) == Shards[1].pool,
+			"reloaded in the wrong place", stray);
+
+	rm_tree(Base);
+	printf("%ld logs moved in %d passes, %ld pins meanwhile, %d errors\n",
+			nmoved_in, pass + 1, p.npins, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
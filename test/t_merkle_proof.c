@@ -0,0 +1,126 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Read a range of records and verify them against a Merkle
+**  checkpoint from the log server.  With -t, also flip a bit in one
+**  of the records first and make sure verification then fails.
+*/
+
+#include "t_common_support.h"
+
+#include <ep/ep_mem.h>
+
+#include <getopt.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_merkle_proof", "GDP Merkle proof test");
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-f firstrec] [-n nrecs] [-t] log_name\n"
+			"    -D  set debugging flags\n"
+			"    -f  first record to verify (default 1)\n"
+			"    -n  number of records to verify (default 10)\n"
+			"    -t  tamper with a record and expect failure\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	gdp_gin_t *gin;
+	gdp_name_t gdpname;
+	gdp_datum_t **datums;
+	EP_STAT estat;
+	int opt;
+	int i;
+	int nrecs = 10;
+	gdp_recno_t firstrec = 1;
+	bool tamper = false;
+	bool show_usage = false;
+	bool ok;
+
+	while ((opt = getopt(argc, argv, "D:f:n:t")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'f':
+			firstrec = atol(optarg);
+			break;
+
+		  case 'n':
+			nrecs = atoi(optarg);
+			break;
+
+		  case 't':
+			tamper = true;
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 1 || nrecs <= 0)
+		usage();
+
+	estat = gdp_init(NULL);
+	test_message(estat, "gdp_init");
+	estat = gdp_parse_name(argv[0], gdpname);
+	test_message(estat, "gdp_parse_name(%s)", argv[0]);
+	estat = gdp_gin_open(gdpname, GDP_MODE_RO, NULL, &gin);
+	test_message(estat, "gdp_gin_open(%s)", argv[0]);
+
+	datums = (gdp_datum_t **) ep_mem_zalloc(nrecs * sizeof *datums);
+	for (i = 0; i < nrecs; i++)
+	{
+		datums[i] = gdp_datum_new();
+		estat = gdp_gin_read_by_recno(gin, firstrec + i, datums[i]);
+		test_message(estat, "gdp_gin_read_by_recno(%" PRIgdp_recno ")",
+				firstrec + i);
+	}
+
+	if (tamper)
+	{
+		gdp_buf_t *dbuf = gdp_datum_getbuf(datums[nrecs / 2]);
+		uint8_t *p = gdp_buf_getptr(dbuf, gdp_buf_getlength(dbuf));
+
+		if (gdp_buf_getlength(dbuf) > 0)
+			p[0] ^= 0x01;
+		else
+			gdp_buf_write(dbuf, "x", 1);
+	}
+
+	estat = gdp_gin_vrfy_records(gin, nrecs, datums);
+	ep_dbg_cprintf(Dbg, 10, "gdp_gin_vrfy_records => %s\n",
+			EP_STAT_ISOK(estat) ? "OK" :
+			EP_STAT_IS_SAME(estat, GDP_STAT_MERKLE_UNSIGNED) ? "unsigned" :
+			"failed");
+	ok = EP_STAT_ISOK(estat) ||
+			EP_STAT_IS_SAME(estat, GDP_STAT_MERKLE_UNSIGNED);
+	if (tamper)
+		ok = !ok;
+	{
+		char ebuf[100];
+		printf("%d records from %" PRIgdp_recno ": %s (%s)\n",
+				nrecs, firstrec, ok ? "as expected" : "UNEXPECTED",
+				ep_stat_tostr(estat, ebuf, sizeof ebuf));
+	}
+
+	for (i = 0; i < nrecs; i++)
+		gdp_datum_free(datums[i]);
+	ep_mem_free(datums);
+	gdp_gin_close(gin);
+	return ok ? EX_OK : EX_SOFTWARE;
+}
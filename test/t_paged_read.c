@@ -0,0 +1,145 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Read a range of records in pages limited by size, resuming each
+**  page from the continuation token left by the last one, and check
+**  that every record arrives exactly once and in order.
+*/
+
+#include "t_common_support.h"
+
+#include <getopt.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_paged_read", "GDP paged read test");
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-b maxbytes] [-f firstrec] [-n nrecs] log_name\n"
+			"    -b  byte budget per page (default 1024)\n"
+			"    -D  set debugging flags\n"
+			"    -f  first record to read (default 1)\n"
+			"    -n  number of records to read (default all)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	gdp_gin_t *gin;
+	gdp_name_t gdpname;
+	gdp_buf_t *cont = NULL;
+	EP_STAT estat;
+	int opt;
+	int npages = 0;
+	int nerrors = 0;
+	size_t maxbytes = 1024;
+	gdp_recno_t firstrec = 1;
+	gdp_recno_t nextrec;
+	int32_t nrecs = -1;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "b:D:f:n:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'b':
+			maxbytes = atol(optarg);
+			break;
+
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'f':
+			firstrec = atol(optarg);
+			break;
+
+		  case 'n':
+			nrecs = atol(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 1)
+		usage();
+
+	estat = gdp_init(NULL);
+	test_message(estat, "gdp_init");
+	estat = gdp_parse_name(argv[0], gdpname);
+	test_message(estat, "gdp_parse_name(%s)", argv[0]);
+	estat = gdp_gin_open(gdpname, GDP_MODE_RO, NULL, &gin);
+	test_message(estat, "gdp_gin_open(%s)", argv[0]);
+
+	nextrec = firstrec;
+	estat = gdp_gin_read_range_async(gin, firstrec, nrecs, maxbytes,
+							NULL, NULL);
+	test_message(estat, "gdp_gin_read_range_async");
+
+	for (;;)
+	{
+		EP_TIME_SPEC timeout;
+		gdp_event_t *gev;
+
+		ep_time_from_nsec(10 SECONDS, &timeout);
+		gev = gdp_event_next(NULL, &timeout);
+		if (gev == NULL)
+		{
+			ep_app_error("timed out waiting for results");
+			nerrors++;
+			break;
+		}
+		if (ep_dbg_test(Dbg, 20))
+			print_event(gev);
+		switch (gdp_event_gettype(gev))
+		{
+		  case GDP_EVENT_DATA:
+			if (gdp_datum_getrecno(gdp_event_getdatum(gev)) != nextrec)
+			{
+				ep_app_error("expected recno %" PRIgdp_recno
+						", got %" PRIgdp_recno,
+						nextrec, gdp_datum_getrecno(gdp_event_getdatum(gev)));
+				nerrors++;
+			}
+			nextrec = gdp_datum_getrecno(gdp_event_getdatum(gev)) + 1;
+			break;
+
+		  case GDP_EVENT_DONE:
+			npages++;
+			if (gdp_event_getcont(gev) == NULL)
+			{
+				gdp_event_free(gev);
+				goto done;
+			}
+
+			// token belongs to the event, so resume before freeing it
+			cont = gdp_event_getcont(gev);
+			ep_dbg_cprintf(Dbg, 10, "page %d ends before %" PRIgdp_recno "\n",
+					npages, nextrec);
+			estat = gdp_gin_read_resume_async(gin, cont, maxbytes, NULL, NULL);
+			test_message(estat, "gdp_gin_read_resume_async");
+			break;
+
+		  default:
+			nerrors++;
+			break;
+		}
+		gdp_event_free(gev);
+	}
+
+done:
+	printf("%" PRIgdp_recno " records in %d pages, %d errors\n",
+			nextrec - firstrec, npages, nerrors);
+	gdp_gin_close(gin);
+	return nerrors == 0 ? EX_OK : EX_SOFTWARE;
+}
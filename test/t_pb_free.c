@@ -0,0 +1,351 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise freeing protobuf message memory that comes from
+**  different places.  A message being sent can hold plain ep_mem
+**  blocks and wire blocks (large payloads shared with a buffer);
+**  the protobuf allocator has to tell them apart when the message
+**  is freed, without being fooled by whatever happens to be in
+**  front of a pointer.  A received message lives in its PDU's
+**  arena, but may have plain and wire blocks added to it before
+**  it is freed.  Everything is done twice; the second time round
+**  must leave no more memory live than the first.
+*/
+
+#include "t_common_support.h"
+
+#include <gdp/gdp_buf.h>
+#include <gdp/gdp_chan.h>
+#include <gdp/gdp_priv.h>
+
+#include <ep/ep_mem.h>
+#include <ep/ep_thr.h>
+
+#include <getopt.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_pb_free", "Protobuf memory test");
+
+#define BIGLEN		(GDP_BUF_WBLOCK_MIN + 100)
+
+static int			Tag;
+static int			NErrors;
+
+static void
+fail(const char *what)
+{
+	ep_app_error("%s", what);
+	NErrors++;
+}
+
+static void
+pb_free(void *p)
+{
+	(*_GdpProtobufAllocator.free)(NULL, p);
+}
+
+static int64_t
+live_bytes(void)
+{
+	EP_MEM_TAG_STATS st;
+
+	if (!ep_mem_tag_stats(Tag, &st))
+		return -1;
+	return st.live_bytes;
+}
+
+
+/*
+**  Each case runs in its own thread so that its memory counts
+**  have been merged into the tag totals by the time it is joined.
+*/
+
+static void
+run(void *(*func)(void *), void *arg)
+{
+	EP_THR thr;
+
+	ep_thr_spawn(&thr, func, arg);
+	pthread_join(thr, NULL);
+}
+
+// plain blocks, including ones that look like wire blocks from outside
+static void *
+plain_blocks(void *unused)
+{
+	uint8_t *p;
+	uint32_t *w;
+	int i;
+
+	ep_mem_tag_set(Tag);
+	for (i = 0; i < 100; i++)
+	{
+		p = (uint8_t *) ep_mem_malloc(BIGLEN);
+		memset(p, 0, BIGLEN);
+
+		// fill the front with what an old-style header would hold
+		w = (uint32_t *) p;
+		w[0] = 1;
+		w[1] = BIGLEN - 16;
+		w[2] = 0;
+		w[3] = UINT32_C(0x47445742);
+		if (_gdp_buf_is_wblock(p + 16, 0) ||
+				_gdp_buf_is_wblock(p + 16, BIGLEN - 16))
+			fail("data after a fake header taken for a wire block");
+		if (_gdp_buf_is_wblock(p, 0))
+			fail("plain block taken for a wire block");
+		pb_free(p);
+	}
+	return NULL;
+}
+
+// wire blocks shared between a buffer and a message
+static void *
+shared_blocks(void *unused)
+{
+	static uint8_t data[BIGLEN];
+	gdp_buf_t *buf;
+	uint8_t *wb;
+	uint8_t *small;
+	int i;
+
+	ep_mem_tag_set(Tag);
+	for (i = 0; i < 100; i++)
+	{
+		memset(data, i, sizeof data);
+		buf = gdp_buf_new();
+		gdp_buf_write(buf, data, sizeof data);
+
+		// as _gdp_datum_to_pb does
+		wb = _gdp_buf_get_wblock(buf);
+		if (wb == NULL)
+		{
+			fail("large write didn't make a wire block");
+			gdp_buf_free(buf);
+			continue;
+		}
+		if (!_gdp_buf_is_wblock(wb, sizeof data) ||
+				_gdp_buf_is_wblock(wb, sizeof data - 1) ||
+				_gdp_buf_is_wblock(wb + 1, 0))
+			fail("wire block not recognized by address and length");
+		small = (uint8_t *) ep_mem_malloc(16);
+
+		// free the "message" first half the time, the buffer the rest
+		if (i % 2 == 0)
+		{
+			pb_free(wb);
+			pb_free(small);
+			if (memcmp(gdp_buf_getptr(buf, sizeof data), data, sizeof data) != 0)
+				fail("wire block changed while the buffer held it");
+			gdp_buf_free(buf);
+		}
+		else
+		{
+			gdp_buf_free(buf);
+			if (memcmp(wb, data, sizeof data) != 0)
+				fail("wire block changed while the message held it");
+			pb_free(small);
+			pb_free(wb);
+		}
+		if (_gdp_buf_is_wblock(wb, 0))
+			fail("freed wire block still registered");
+	}
+	return NULL;
+}
+
+// received messages, with blocks added after they were unpacked
+static void *
+arena_blocks(void *unused)
+{
+	gdp_name_t name;
+	gdp_msg_t *msg;
+	gdp_pdu_t *pdu;
+	gdp_buf_t *buf;
+	GdpDatum *pbd;
+	uint8_t *p;
+	size_t len;
+	int i;
+
+	ep_mem_tag_set(Tag);
+	memset(name, 0, sizeof name);
+	for (i = 0; i < 100; i++)
+	{
+		// build and pack an append command with a large payload
+		msg = _gdp_msg_new(GDP_CMD_APPEND, 1, 1);
+		pbd = (GdpDatum *) ep_mem_malloc(sizeof *pbd);
+		gdp_datum__init(pbd);
+		pbd->recno = i;
+		pbd->ts = (GdpTimestamp *) ep_mem_malloc(sizeof *pbd->ts);
+		gdp_timestamp__init(pbd->ts);
+		pbd->ts->sec = i;
+		pbd->ts->has_sec = true;
+		pbd->data.len = BIGLEN;
+		pbd->data.data = (uint8_t *) ep_mem_malloc(BIGLEN);
+		memset(pbd->data.data, i, BIGLEN);
+		msg->cmd_append->dl->d = (GdpDatum **) ep_mem_malloc(sizeof pbd);
+		msg->cmd_append->dl->d[0] = pbd;
+		msg->cmd_append->dl->n_d = 1;
+
+		len = gdp_message__get_packed_size(msg);
+		p = (uint8_t *) ep_mem_malloc(len);
+		gdp_message__pack(msg, p);
+		buf = gdp_buf_new();
+		gdp_buf_write(buf, p, len);
+		ep_mem_free(p);
+		_gdp_msg_free(&msg);
+
+		// receive it
+		pdu = _gdp_pdu_new(NULL, name, name, GDP_SEQNO_NONE);
+		if (!EP_STAT_ISOK(_gdp_pdu_in(pdu, buf, len, NULL)))
+		{
+			fail("couldn't unpack append command");
+			_gdp_pdu_free(&pdu);
+			gdp_buf_free(buf);
+			continue;
+		}
+		gdp_buf_free(buf);
+		pbd = pdu->msg->cmd_append->dl->d[0];
+		if (pbd->recno != i || pbd->data.len != BIGLEN ||
+				pbd->data.data[BIGLEN - 1] != (uint8_t) i)
+			fail("append command changed in transit");
+
+		// add to it the way a server would
+		pbd->sig = (GdpSignature *) ep_mem_malloc(sizeof *pbd->sig);
+		gdp_signature__init(pbd->sig);
+		pbd->sig->sig.len = 32;
+		pbd->sig->sig.data = (uint8_t *) ep_mem_zalloc(32);
+		if (i % 2 != 0)
+		{
+			p = _gdp_buf_wblock_new(BIGLEN);
+			memcpy(p, pbd->data.data, BIGLEN);
+			pbd->data.data = p;
+		}
+
+		// sometimes reuse the PDU for a reply
+		if (i % 3 == 0)
+		{
+			_gdp_pdu_msg_free(pdu);
+			if (pdu->msg != NULL)
+				fail("received message not freed");
+			pdu->msg = _gdp_msg_new(GDP_ACK_SUCCESS, 1, 1);
+		}
+		_gdp_pdu_free(&pdu);
+	}
+	return NULL;
+}
+
+// lots of wire blocks alive at once, from several threads
+#define NLIVE		1000
+
+static void *
+many_blocks(void *unused)
+{
+	uint8_t **wbs;
+	int i;
+
+	ep_mem_tag_set(Tag);
+	wbs = (uint8_t **) ep_mem_malloc(NLIVE * sizeof *wbs);
+	for (i = 0; i < NLIVE; i++)
+		wbs[i] = _gdp_buf_wblock_new(GDP_BUF_WBLOCK_MIN + i);
+	for (i = 0; i < NLIVE; i++)
+	{
+		if (!_gdp_buf_is_wblock(wbs[i], GDP_BUF_WBLOCK_MIN + i))
+			fail("live wire block not found");
+	}
+	for (i = 0; i < NLIVE; i += 2)
+		pb_free(wbs[i]);
+	for (i = 1; i < NLIVE; i += 2)
+	{
+		if (!_gdp_buf_is_wblock(wbs[i], 0))
+			fail("wire block lost when its neighbor was freed");
+		pb_free(wbs[i]);
+	}
+	ep_mem_free(wbs);
+	return NULL;
+}
+
+static void *
+many_threads(void *nthreads_)
+{
+	int nthreads = *(int *) nthreads_;
+	EP_THR *thrs;
+	int i;
+
+	thrs = (EP_THR *) ep_mem_malloc(nthreads * sizeof *thrs);
+	for (i = 0; i < nthreads; i++)
+		ep_thr_spawn(&thrs[i], &many_blocks, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(thrs[i], NULL);
+	ep_mem_free(thrs);
+	return NULL;
+}
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-t nthreads]\n"
+			"    -D  set debugging flags\n"
+			"    -t  threads sharing the wire block table (default 4)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	int nthreads = 4;
+	int opt;
+	int pass;
+	int64_t live[2];
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "D:t:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 't':
+			nthreads = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || nthreads < 1)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+	ep_adm_setparam("libep.mem.account", "true");
+	ep_mem_account_init();
+	Tag = ep_mem_tag_register("t_pb_free");
+
+	// the first time round includes one-time setup
+	for (pass = 1; pass <= 2; pass++)
+	{
+		run(&plain_blocks, NULL);
+		run(&shared_blocks, NULL);
+		run(&arena_blocks, NULL);
+		run(&many_threads, &nthreads);
+		live[pass - 1] = live_bytes();
+		ep_dbg_cprintf(Dbg, 1, "pass %d: %" PRId64 " bytes live\n",
+				pass, live[pass - 1]);
+	}
+	if (live[1] > live[0])
+	{
+		ep_app_error("%" PRId64 " bytes live after two passes, "
+				"%" PRId64 " after one", live[1], live[0]);
+		NErrors++;
+	}
+
+	printf("%d errors\n", NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
@@ -0,0 +1,201 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Exercise thread pool priority classes.  Floods a "read" class
+**  limited to half the workers with slow work, then trickles in
+**  quick "append" work and checks that the reads never held more
+**  than their share and that appends never waited behind them for
+**  as long as a single read takes.  Also runs interleaved work in
+**  both classes through one serial executor to check that it still
+**  runs in order.
+*/
+
+#include <ep/ep.h>
+#include <ep/ep_app.h>
+#include <ep/ep_dbg.h>
+#include <ep/ep_thr.h>
+#include "t_common_support.h"
+
+#include <getopt.h>
+#include <sysexits.h>
+
+#define CLASS_APPEND	1
+#define CLASS_READ		2
+
+static EP_THR_MUTEX	Mutex;
+static EP_THR_COND	Done;
+static long			NDone;			// work items finished
+static long			NextSeq;		// next expected serial item
+static int			NErrors;
+static long			ReadUsec = 20000;
+
+static void
+finish(void)
+{
+	ep_thr_mutex_lock(&Mutex);
+	NDone++;
+	ep_thr_cond_broadcast(&Done);
+	ep_thr_mutex_unlock(&Mutex);
+}
+
+static void
+read_work(void *unused)
+{
+	usleep(ReadUsec);
+	finish();
+}
+
+static void
+append_work(void *unused)
+{
+	finish();
+}
+
+static void
+serial_work(void *seq_)
+{
+	long seq = (long) seq_;
+
+	ep_thr_mutex_lock(&Mutex);
+	if (seq != NextSeq)
+	{
+		ep_app_error("serial work %ld ran when %ld was expected",
+				seq, NextSeq);
+		NErrors++;
+	}
+	NextSeq = seq + 1;
+	ep_thr_mutex_unlock(&Mutex);
+	finish();
+}
+
+static void
+wait_for(long n)
+{
+	ep_thr_mutex_lock(&Mutex);
+	while (NDone < n)
+		ep_thr_cond_wait(&Done, &Mutex, NULL);
+	ep_thr_mutex_unlock(&Mutex);
+}
+
+static void
+print_stats(int cls, EP_THR_POOL_STATS *st)
+{
+	ep_thr_pool_getstats(cls, st, true);
+	printf("%-8s nrun %6" PRIu64 " max running %2d/%-2d max depth %5d "
+			"wait avg %8" PRIu64 " max %8" PRIu64 " usec\n",
+			st->name, st->nrun, st->max_running, st->limit, st->max_depth,
+			st->nrun == 0 ? 0 : st->wait_usec / st->nrun, st->max_wait_usec);
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-a nappends] [-r nreads] [-w nworkers]\n"
+			"    -a  number of appends (default 200)\n"
+			"    -D  set debugging flags\n"
+			"    -r  number of reads (default 400)\n"
+			"    -w  number of workers (default 8)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	EP_THR_POOL_STATS st;
+	EP_THR_SERIAL *s;
+	long nappends = 200;
+	long nreads = 400;
+	long ntotal;
+	long i;
+	int nworkers = 8;
+	int opt;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "a:D:r:w:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'a':
+			nappends = atol(optarg);
+			break;
+
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'r':
+			nreads = atol(optarg);
+			break;
+
+		  case 'w':
+			nworkers = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || nappends < 1 || nreads < 1 || nworkers < 2)
+		usage();
+
+	ep_lib_init(EP_LIB_USEPTHREADS);
+	ep_thr_mutex_init(&Mutex, EP_THR_MUTEX_DEFAULT);
+	ep_thr_cond_init(&Done);
+	ep_thr_pool_setclass(CLASS_APPEND, "append", 4, 100);
+	ep_thr_pool_setclass(CLASS_READ, "read", 1, 50);
+	ep_thr_pool_init(nworkers, nworkers, 0);
+
+	// flood the reads, then trickle in appends behind them
+	for (i = 0; i < nreads; i++)
+		ep_thr_pool_run_class(CLASS_READ, &read_work, NULL);
+	for (i = 0; i < nappends; i++)
+	{
+		ep_thr_pool_run_class(CLASS_APPEND, &append_work, NULL);
+		usleep(1000);
+	}
+	ntotal = nreads + nappends;
+	wait_for(ntotal);
+
+	print_stats(CLASS_READ, &st);
+	if (st.max_running > st.limit || st.limit != nworkers / 2)
+	{
+		ep_app_error("reads used %d workers, limit %d",
+				st.max_running, st.limit);
+		NErrors++;
+	}
+	print_stats(CLASS_APPEND, &st);
+	if (st.nrun != (uint64_t) nappends || st.max_wait_usec >= (uint64_t) ReadUsec)
+	{
+		ep_app_error("appends waited up to %" PRIu64 " usec behind reads",
+				st.max_wait_usec);
+		NErrors++;
+	}
+
+	// one serial executor switching between classes keeps its order
+	s = ep_thr_serial_new();
+	for (i = 0; i < nappends; i++)
+	{
+		ep_thr_serial_run_class(s, (i / 3) % 2 ? CLASS_READ : CLASS_APPEND,
+				&serial_work, (void *) i);
+	}
+	ntotal += nappends;
+	wait_for(ntotal);
+	while (!ep_thr_serial_idle(s))
+		usleep(1000);
+	ep_thr_serial_free(s);
+	if (NextSeq != nappends)
+	{
+		ep_app_error("serial executor ran %ld of %ld", NextSeq, nappends);
+		NErrors++;
+	}
+
+	printf("%ld reads, %ld appends, %d errors\n", nreads, nappends, NErrors);
+	return NErrors == 0 ? EX_OK : EX_SOFTWARE;
+}
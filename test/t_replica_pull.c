@@ -0,0 +1,160 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Pull a log from a log server the way a replica does, in batches
+**  starting at a given record, and check that the records arrive in
+**  order and that each chains to the one before it.
+**
+**  This uses the internal replication interface; the server name is
+**  the name of the log server (gdplogd), not the log.
+*/
+
+#include "t_common_support.h"
+
+#include <gdp/gdp_priv.h>
+
+#include <getopt.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_replica_pull", "GDP replica pull test");
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-b batchsize] [-f firstrec] server_name log_name\n"
+			"    -b  records to ask for in each batch (default server limit)\n"
+			"    -D  set debugging flags\n"
+			"    -f  first record to pull (default 1)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	gdp_gin_t *gin;
+	gdp_name_t svrname;
+	gdp_name_t gdpname;
+	gdp_datum_t *prev = NULL;
+	EP_STAT estat;
+	int opt;
+	int nbatches = 0;
+	int nerrors = 0;
+	int32_t batchsize = 0;
+	gdp_recno_t firstrec = 1;
+	gdp_recno_t nextrec;
+	gdp_recno_t leader_nrecs = 0;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "b:D:f:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'b':
+			batchsize = atol(optarg);
+			break;
+
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'f':
+			firstrec = atol(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 2 || firstrec < 1)
+		usage();
+
+	estat = gdp_init(NULL);
+	test_message(estat, "gdp_init");
+	estat = gdp_parse_name(argv[0], svrname);
+	test_message(estat, "gdp_parse_name(%s)", argv[0]);
+	estat = gdp_parse_name(argv[1], gdpname);
+	test_message(estat, "gdp_parse_name(%s)", argv[1]);
+
+	// need the metadata to check hashes
+	estat = gdp_gin_open(gdpname, GDP_MODE_RO, NULL, &gin);
+	test_message(estat, "gdp_gin_open(%s)", argv[1]);
+
+	nextrec = firstrec;
+	for (;;)
+	{
+		gdp_req_t *req;
+		GdpMessage__AckSuccess *resp;
+		int dx;
+
+		estat = _gdp_replica_pull(svrname, gdpname, nextrec, batchsize,
+								_GdpChannel, &req);
+		test_message(estat, "_gdp_replica_pull(%" PRIgdp_recno ")", nextrec);
+		nbatches++;
+		resp = req->rpdu->msg->ack_success;
+		if (resp->has_recno)
+			leader_nrecs = resp->recno;
+		if (nextrec == 1 && (!resp->has_metadata || resp->metadata.len == 0))
+		{
+			ep_app_error("no metadata in first batch");
+			nerrors++;
+		}
+		if (resp->dl == NULL || resp->dl->n_d == 0)
+		{
+			_gdp_req_free(&req);
+			break;
+		}
+		ep_dbg_cprintf(Dbg, 10, "batch %d: %zd records from %" PRIgdp_recno
+				" (server has %" PRIgdp_recno ")\n",
+				nbatches, resp->dl->n_d, nextrec, leader_nrecs);
+
+		for (dx = 0; dx < resp->dl->n_d; dx++)
+		{
+			GdpDatum *pbd = resp->dl->d[dx];
+			gdp_datum_t *datum = gdp_datum_new();
+
+			_gdp_datum_from_pb(datum, pbd, pbd->sig);
+			if (datum->recno != nextrec)
+			{
+				ep_app_error("expected recno %" PRIgdp_recno
+						", got %" PRIgdp_recno,
+						nextrec, datum->recno);
+				nerrors++;
+			}
+			else if (prev != NULL &&
+					!_gdp_datum_hash_equal(prev, gin->gob, datum->prevhash))
+			{
+				ep_app_error("record %" PRIgdp_recno
+						" does not chain to the one before it",
+						datum->recno);
+				nerrors++;
+			}
+			nextrec = datum->recno + 1;
+			if (prev != NULL)
+				gdp_datum_free(prev);
+			prev = datum;
+		}
+		_gdp_req_free(&req);
+		if (nextrec > leader_nrecs)
+			break;
+	}
+
+	if (nextrec - 1 != leader_nrecs)
+	{
+		ep_app_error("pulled to %" PRIgdp_recno ", server has %" PRIgdp_recno,
+				nextrec - 1, leader_nrecs);
+		nerrors++;
+	}
+	printf("%" PRIgdp_recno " records in %d batches, %d errors\n",
+			nextrec - firstrec, nbatches, nerrors);
+	if (prev != NULL)
+		gdp_datum_free(prev);
+	gdp_gin_close(gin);
+	return nerrors == 0 ? EX_OK : EX_SOFTWARE;
+}
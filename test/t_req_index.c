@@ -0,0 +1,323 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Microbenchmark for request lookup.  Fills a GOB request list and
+**  a channel request list with up to -n outstanding requests and
+**  times random lookups through the request indexes at each power of
+**  ten along the way.  The time per lookup should stay (roughly)
+**  flat as the number of requests grows; every lookup is also
+**  checked to have found the right request.
+**
+**  Requests are spread over -c clients, each numbering its own
+**  requests from one, as they would be for a log server holding
+**  many subscriptions to one log.  Nothing is sent anywhere, so
+**  this does not need a router or log server.
+**
+**  Finally a few requests are readdressed with _gdp_req_set_dst, as
+**  replica pulls and forwarded appends are, and must then be found
+**  under their new destination and not their old one.  That needs
+**  a real channel, so it is opened to a listening socket that never
+**  reads anything.
+*/
+
+#include "t_common_support.h"
+
+#include <gdp/gdp_chan.h>
+#include <gdp/gdp_priv.h>
+#include <ep/ep_mem.h>
+#include <ep/ep_thr.h>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sysexits.h>
+
+
+static void
+random_name(gdp_name_t name)
+{
+	size_t i;
+
+	// real names are hashes, so random bytes are a fair stand-in
+	for (i = 0; i < sizeof (gdp_name_t); i++)
+		name[i] = random() & 0xff;
+}
+
+
+static int64_t
+elapsed_nsec(const EP_TIME_SPEC *start)
+{
+	EP_TIME_SPEC now;
+
+	ep_time_now(&now);
+	return (now.tv_sec - start->tv_sec) * INT64_C(1000000000) +
+			(now.tv_nsec - start->tv_nsec);
+}
+
+
+static EP_STAT
+advertise_nothing(gdp_chan_t *chan, int cmd_unused, void *adata)
+{
+	return EP_STAT_OK;
+}
+
+/*
+**  Change the destination of requests on a live channel and make
+**  sure the channel index follows.  Returns the number of errors.
+*/
+
+#define NDSTREQS		8
+
+static int
+check_set_dst(void)
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof sin;
+	int lsock = socket(AF_INET, SOCK_STREAM, 0);
+	char addr[40];
+	gdp_chan_t *chan;
+	gdp_chan_x_t *chanx;
+	gdp_req_t reqs[NDSTREQS];
+	gdp_pdu_t pdus[NDSTREQS];
+	GdpMessage msgs[NDSTREQS];
+	gdp_name_t src, olddst, newdst;
+	EP_STAT estat;
+	int nerrors = 0;
+	int i;
+
+	memset(&sin, 0, sizeof sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (lsock < 0 ||
+			bind(lsock, (struct sockaddr *) &sin, sizeof sin) < 0 ||
+			listen(lsock, 8) < 0 ||
+			getsockname(lsock, (struct sockaddr *) &sin, &sinlen) < 0)
+	{
+		ep_app_fatal("cannot start mock router: %s", strerror(errno));
+	}
+	snprintf(addr, sizeof addr, "127.0.0.1:%d", ntohs(sin.sin_port));
+
+	estat = gdp_lib_init(NULL, NULL, GDP_INIT_NO_ZEROCONF | GDP_INIT_NO_HONGDS);
+	test_message(estat, "gdp_lib_init");
+	if (ep_thr_spawn(&_GdpIoEventLoopThread, &_gdp_run_event_loop, NULL) != 0)
+		ep_app_fatal("cannot spawn event i/o thread");
+	chanx = (gdp_chan_x_t *) ep_mem_zalloc(sizeof *chanx);
+	LIST_INIT(&chanx->reqs);
+	estat = _gdp_chan_open(addr, NULL, &_gdp_io_recv, NULL, &_gdp_io_event,
+						&_gdp_router_event, &advertise_nothing, chanx, &chan);
+	test_message(estat, "_gdp_chan_open(%s)", addr);
+	if (!EP_STAT_ISOK(estat))
+		return 1;
+
+	random_name(src);
+	random_name(olddst);
+	random_name(newdst);
+	memset(reqs, 0, sizeof reqs);
+	memset(pdus, 0, sizeof pdus);
+	_gdp_chan_lock(chan);
+	for (i = 0; i < NDSTREQS; i++)
+	{
+		gdp_message__init(&msgs[i]);
+		msgs[i].cmd = GDP_CMD_REPLICATE;
+		msgs[i].rid = i + 1;
+		pdus[i].msg = &msgs[i];
+		memcpy(pdus[i].src, src, sizeof pdus[i].src);
+		memcpy(pdus[i].dst, olddst, sizeof pdus[i].dst);
+		reqs[i].cpdu = &pdus[i];
+		reqs[i].chan = chan;
+		_gdp_req_chan_link(&reqs[i], chanx);
+	}
+	_gdp_chan_unlock(chan);
+
+	// readdress every other request
+	for (i = 0; i < NDSTREQS; i += 2)
+		_gdp_req_set_dst(&reqs[i], newdst);
+
+	_gdp_chan_lock(chan);
+	for (i = 0; i < NDSTREQS; i++)
+	{
+		gdp_rid_t rid = i + 1;
+		gdp_req_t *want_new = i % 2 == 0 ? &reqs[i] : NULL;
+		gdp_req_t *want_old = i % 2 == 0 ? NULL : &reqs[i];
+
+		if (_gdp_req_chan_lookup(chanx, src, newdst, rid) != want_new ||
+				_gdp_req_chan_lookup(chanx, src, olddst, rid) != want_old)
+		{
+			ep_app_error("rid %" PRIu32 " not found under its %s destination",
+					rid, i % 2 == 0 ? "new" : "old");
+			nerrors++;
+		}
+	}
+	for (i = 0; i < NDSTREQS; i++)
+		_gdp_req_chan_unlink(&reqs[i], chanx);
+	if (chanx->reqindex.nreqs != 0)
+	{
+		ep_app_error("readdressed requests left over after unlinking");
+		nerrors++;
+	}
+	_gdp_chan_unlock(chan);
+
+	printf("%d readdressed requests, %d errors\n", NDSTREQS / 2, nerrors);
+	return nerrors;
+}
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-c nclients] [-l nlookups] [-n maxreqs]\n"
+			"    -c  number of clients issuing requests (default 1000)\n"
+			"    -D  set debugging flags\n"
+			"    -l  lookups to time at each size (default 1000000)\n"
+			"    -n  maximum number of outstanding requests (default 1000000)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	gdp_gob_t gob;
+	gdp_chan_x_t chanx;
+	gdp_req_t *reqs;
+	gdp_pdu_t *pdus;
+	GdpMessage *msgs;
+	gdp_name_t *clients;
+	long maxreqs = 1000000;
+	long nlookups = 1000000;
+	long nclients = 1000;
+	long nreqs = 0;
+	long size;
+	long i;
+	int opt;
+	int nerrors = 0;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "c:D:l:n:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'c':
+			nclients = atol(optarg);
+			break;
+
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'l':
+			nlookups = atol(optarg);
+			break;
+
+		  case 'n':
+			maxreqs = atol(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 0 || maxreqs < 1 || nlookups < 1 || nclients < 1)
+		usage();
+
+	gdp_init_phase_0(NULL, 0);
+	srandom(getpid());
+
+	// a bare GOB and channel are enough to hold the lists
+	memset(&gob, 0, sizeof gob);
+	LIST_INIT(&gob.reqs);
+	random_name(gob.name);
+	memset(&chanx, 0, sizeof chanx);
+	LIST_INIT(&chanx.reqs);
+
+	clients = (gdp_name_t *) ep_mem_malloc(nclients * sizeof *clients);
+	for (i = 0; i < nclients; i++)
+		random_name(clients[i]);
+	reqs = (gdp_req_t *) ep_mem_zalloc(maxreqs * sizeof *reqs);
+	pdus = (gdp_pdu_t *) ep_mem_zalloc(maxreqs * sizeof *pdus);
+	msgs = (GdpMessage *) ep_mem_zalloc(maxreqs * sizeof *msgs);
+
+	printf("%10s %16s %16s\n", "reqs", "gob ns/lookup", "chan ns/lookup");
+	for (size = 1000; ; size *= 10)
+	{
+		EP_TIME_SPEC start;
+		int64_t gob_ns;
+		int64_t chan_ns;
+
+		if (size > maxreqs)
+			size = maxreqs;
+
+		// add requests up to the new size
+		for (; nreqs < size; nreqs++)
+		{
+			gdp_req_t *req = &reqs[nreqs];
+			gdp_pdu_t *pdu = &pdus[nreqs];
+
+			gdp_message__init(&msgs[nreqs]);
+			msgs[nreqs].cmd = GDP_CMD_SUBSCRIBE_BY_RECNO;
+			msgs[nreqs].rid = nreqs / nclients + 1;
+			pdu->msg = &msgs[nreqs];
+			memcpy(pdu->src, clients[nreqs % nclients], sizeof pdu->src);
+			memcpy(pdu->dst, gob.name, sizeof pdu->dst);
+			req->cpdu = pdu;
+			req->gob = &gob;
+			_gdp_req_gob_link(req);
+			_gdp_req_chan_link(req, &chanx);
+		}
+
+		ep_time_now(&start);
+		for (i = 0; i < nlookups; i++)
+		{
+			long x = random() % nreqs;
+			gdp_pdu_t *pdu = &pdus[x];
+
+			if (_gdp_req_gob_lookup(&gob, pdu->src, pdu->msg->rid) != &reqs[x])
+				nerrors++;
+		}
+		gob_ns = elapsed_nsec(&start);
+
+		ep_time_now(&start);
+		for (i = 0; i < nlookups; i++)
+		{
+			long x = random() % nreqs;
+			gdp_pdu_t *pdu = &pdus[x];
+
+			if (_gdp_req_chan_lookup(&chanx, pdu->src, pdu->dst,
+							pdu->msg->rid) != &reqs[x])
+				nerrors++;
+		}
+		chan_ns = elapsed_nsec(&start);
+
+		printf("%10ld %16.1f %16.1f\n", nreqs,
+				(double) gob_ns / nlookups, (double) chan_ns / nlookups);
+		if (size >= maxreqs)
+			break;
+	}
+
+	// and one that isn't there
+	if (_gdp_req_gob_lookup(&gob, clients[0], maxreqs + 1) != NULL)
+		nerrors++;
+
+	for (i = 0; i < nreqs; i++)
+	{
+		_gdp_req_chan_unlink(&reqs[i], &chanx);
+		_gdp_req_gob_unlink(&reqs[i]);
+	}
+	if (!LIST_EMPTY(&gob.reqs) || !LIST_EMPTY(&chanx.reqs) ||
+			gob.reqindex.nreqs != 0 || chanx.reqindex.nreqs != 0)
+	{
+		ep_app_error("requests left over after unlinking");
+		nerrors++;
+	}
+
+	printf("%ld requests, %d errors\n", nreqs, nerrors);
+
+	nerrors += check_set_dst();
+	return nerrors == 0 ? EX_OK : EX_SOFTWARE;
+}
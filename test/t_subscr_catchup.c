@@ -0,0 +1,148 @@
+/* vim: set ai sw=4 sts=4 ts=4 : */
+
+/*
+**  Subscribe to a log from an early record and append to it while
+**  the subscription is still catching up, then check that every
+**  record from the starting point through the last one appended
+**  arrives exactly once and in order.
+*/
+
+#include "t_common_support.h"
+
+#include <getopt.h>
+#include <sysexits.h>
+
+static EP_DBG	Dbg = EP_DBG_INIT("t_subscr_catchup", "GDP subscription catch-up test");
+
+
+void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-D dbgspec] [-f firstrec] [-n nappend] log_name\n"
+			"    -D  set debugging flags\n"
+			"    -f  first record to subscribe from (default 1)\n"
+			"    -n  number of records to append (default 100)\n",
+			ep_app_getprogname());
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char **argv)
+{
+	gdp_gin_t *gin;
+	gdp_name_t gdpname;
+	gdp_datum_t *d;
+	EP_STAT estat;
+	int opt;
+	int i;
+	int nerrors = 0;
+	int nappend = 100;
+	gdp_recno_t firstrec = 1;
+	gdp_recno_t nextrec;
+	gdp_recno_t lastrec;
+	bool show_usage = false;
+
+	while ((opt = getopt(argc, argv, "D:f:n:")) > 0)
+	{
+		switch (opt)
+		{
+		  case 'D':
+			ep_dbg_set(optarg);
+			break;
+
+		  case 'f':
+			firstrec = atol(optarg);
+			break;
+
+		  case 'n':
+			nappend = atoi(optarg);
+			break;
+
+		  default:
+			show_usage = true;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (show_usage || argc != 1 || firstrec < 1 || nappend < 0)
+		usage();
+
+	estat = gdp_init(NULL);
+	test_message(estat, "gdp_init");
+	estat = gdp_parse_name(argv[0], gdpname);
+	test_message(estat, "gdp_parse_name(%s)", argv[0]);
+	estat = gdp_gin_open(gdpname, GDP_MODE_RA, NULL, &gin);
+	test_message(estat, "gdp_gin_open(%s)", argv[0]);
+
+	lastrec = gdp_gin_getnrecs(gin) + nappend;
+	if (firstrec > lastrec)
+		firstrec = lastrec;
+	estat = gdp_gin_subscribe_by_recno(gin, firstrec, 0, NULL, NULL, NULL);
+	test_message(estat, "gdp_gin_subscribe_by_recno(%" PRIgdp_recno ")",
+			firstrec);
+
+	// these race with the backlog being sent
+	d = gdp_datum_new();
+	for (i = 0; i < nappend; i++)
+	{
+		gdp_buf_reset(gdp_datum_getbuf(d));
+		gdp_buf_printf(gdp_datum_getbuf(d), "catchup %d", i);
+		estat = gdp_gin_append(gin, d, NULL);
+		test_message(estat, "gdp_gin_append(%d)", i);
+	}
+	gdp_datum_free(d);
+
+	nextrec = firstrec;
+	while (nextrec <= lastrec)
+	{
+		EP_TIME_SPEC timeout;
+		gdp_event_t *gev;
+		gdp_recno_t recno;
+
+		ep_time_from_nsec(10 SECONDS, &timeout);
+		gev = gdp_event_next(NULL, &timeout);
+		if (gev == NULL)
+		{
+			ep_app_error("timed out waiting for record %" PRIgdp_recno,
+					nextrec);
+			nerrors++;
+			break;
+		}
+		if (ep_dbg_test(Dbg, 20))
+			print_event(gev);
+		switch (gdp_event_gettype(gev))
+		{
+		  case GDP_EVENT_DATA:
+			recno = gdp_datum_getrecno(gdp_event_getdatum(gev));
+			if (recno != nextrec)
+			{
+				ep_app_error("expected recno %" PRIgdp_recno
+						", got %" PRIgdp_recno,
+						nextrec, recno);
+				nerrors++;
+			}
+			if (recno >= nextrec)
+				nextrec = recno + 1;
+			break;
+
+		  case GDP_EVENT_MISSING:
+			ep_app_error("records missing before %" PRIgdp_recno, nextrec);
+			nerrors++;
+			break;
+
+		  default:
+			print_event(gev);
+			nerrors++;
+			break;
+		}
+		gdp_event_free(gev);
+	}
+
+	printf("%" PRIgdp_recno " records from %" PRIgdp_recno ", %d errors\n",
+			nextrec - firstrec, firstrec, nerrors);
+	gdp_gin_close(gin);
+	return nerrors == 0 ? EX_OK : EX_SOFTWARE;
+}